@@ -0,0 +1,73 @@
+#include "allocation_counter.h"
+#include "Eigen/Core"
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#ifdef UKF_CHECK_ALLOCATIONS
+
+static thread_local long allocations = 0;
+
+void *operator new(std::size_t size) {
+	allocations++;
+	if (void *p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+	throw std::bad_alloc();
+#else
+	std::abort();
+#endif
+}
+
+void *operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+	std::free(p);
+}
+
+long AllocationCounter::Count() {
+	return allocations;
+}
+
+AllocationCounter::AllocationCounter() : start_(allocations) {
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+	eigen_malloc_allowed_ = Eigen::internal::is_malloc_allowed();
+	Eigen::internal::set_is_malloc_allowed(false);
+#else
+	eigen_malloc_allowed_ = true;
+#endif
+}
+
+AllocationCounter::~AllocationCounter() {
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+	Eigen::internal::set_is_malloc_allowed(eigen_malloc_allowed_);
+#endif
+	assert(allocations == start_ && "heap allocation in the filter hot path");
+}
+
+#else
+
+long AllocationCounter::Count() {
+	return 0;
+}
+
+AllocationCounter::AllocationCounter() : start_(0), eigen_malloc_allowed_(true) {}
+
+AllocationCounter::~AllocationCounter() {}
+
+#endif
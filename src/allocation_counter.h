@@ -0,0 +1,42 @@
+#ifndef ALLOCATION_COUNTER_H_
+#define ALLOCATION_COUNTER_H_
+
+/**
+ * Debug-mode heap allocation accounting for the filter hot path.
+ *
+ * When built with UKF_CHECK_ALLOCATIONS (and EIGEN_RUNTIME_NO_MALLOC, see
+ * CMakeLists.txt) every operator new on the calling thread is counted and
+ * UKF_ASSERT_NO_ALLOCATIONS asserts that the enclosing scope performed none,
+ * while also forbidding Eigen from calling malloc. In regular builds the
+ * macro expands to nothing.
+ */
+class AllocationCounter {
+public:
+  /**
+  * Number of operator new calls made by the calling thread so far. Always
+  * zero unless built with UKF_CHECK_ALLOCATIONS.
+  */
+  static long Count();
+
+  /**
+  * Records the current count and forbids Eigen heap allocations.
+  */
+  AllocationCounter();
+
+  /**
+  * Asserts that no allocation happened since construction.
+  */
+  ~AllocationCounter();
+
+private:
+  long start_;
+  bool eigen_malloc_allowed_;
+};
+
+#ifdef UKF_CHECK_ALLOCATIONS
+#define UKF_ASSERT_NO_ALLOCATIONS AllocationCounter ukf_allocation_counter_
+#else
+#define UKF_ASSERT_NO_ALLOCATIONS
+#endif
+
+#endif /* ALLOCATION_COUNTER_H_ */
@@ -0,0 +1,27 @@
+#ifndef ANGLE_H_
+#define ANGLE_H_
+
+#include <cmath>
+
+///* marks the functions the CUDA batch engine also runs on the device
+#ifdef __CUDACC__
+#define UKF_HOST_DEVICE __host__ __device__
+#else
+#define UKF_HOST_DEVICE
+#endif
+
+/**
+ * Wraps an angle in rad into [-pi, pi] by subtracting the nearest multiple
+ * of 2 pi. Unlike fmod(a + pi, 2 pi) - pi this is correct for negative
+ * inputs, and it has no branch, so loops over residuals vectorize.
+ */
+UKF_HOST_DEVICE inline double NormalizeAngle(double a) {
+  return a - (2.0 * M_PI) * std::nearbyint(a * (0.5 / M_PI));
+}
+
+///* the same in single precision
+UKF_HOST_DEVICE inline float NormalizeAngle(float a) {
+  return a - float(2.0 * M_PI) * std::nearbyint(a * float(0.5 / M_PI));
+}
+
+#endif /* ANGLE_H_ */
@@ -0,0 +1,54 @@
+#include "arena.h"
+#include <cstdlib>
+#include <cstring>
+
+const size_t Arena::kChunkSize;
+
+Arena::Arena(size_t chunk_size)
+	: chunk_size_(chunk_size), chunk_(nullptr), capacity_(0), used_(0), allocated_(0) {}
+
+Arena::~Arena() {
+	Clear();
+}
+
+void Arena::AddChunk(size_t size, bool huge_pages) {
+	//an object larger than a chunk gets a chunk of its own
+	size_t capacity = size > chunk_size_ ? size : chunk_size_;
+	chunks_.push_back(std::make_pair(nullptr, 0));
+	if (huge_pages) {
+		//whole huge pages, or the kernel keeps the tail on small ones
+		capacity = (capacity + HugePages::kSize - 1) & ~(HugePages::kSize - 1);
+		chunk_ = static_cast<char *>(HugePages::Map(capacity, true));
+		chunks_.back() = std::make_pair(chunk_, capacity);
+	}
+	else {
+		chunk_ = static_cast<char *>(CacheAlignedMalloc(capacity));
+		chunks_.back().first = chunk_;
+	}
+	capacity_ = capacity;
+	used_ = 0;
+}
+
+void Arena::Reserve(size_t size, bool huge_pages) {
+	if (chunk_ && used_ + size <= capacity_) {
+		return;
+	}
+	AddChunk(size, huge_pages || HugePages::enabled());
+	memset(chunk_, 0, capacity_);
+}
+
+void Arena::Clear() {
+	for (size_t i = 0; i < chunks_.size(); i++) {
+		if (chunks_[i].second) {
+			HugePages::Unmap(chunks_[i].first, chunks_[i].second);
+		}
+		else {
+			std::free(chunks_[i].first);
+		}
+	}
+	chunks_.clear();
+	chunk_ = nullptr;
+	capacity_ = 0;
+	used_ = 0;
+	allocated_ = 0;
+}
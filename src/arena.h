@@ -0,0 +1,87 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "cache_aligned.h"
+#include "huge_pages.h"
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * Bump allocator over cache-aligned chunks, for the objects of one pool
+ * that live as long as the pool does. Objects allocated one after another
+ * lie next to each other, so loops over the sessions or tracks of a pool
+ * walk memory in order; nothing is given back on its own, only all chunks
+ * at once by Clear or the destructor.
+ *
+ * While HugePages is enabled, every chunk is whole huge pages (see
+ * huge_pages.h), so that the walks take few TLB entries.
+ *
+ * The arena runs no destructors: who places objects with New destroys
+ * them before the arena's memory goes.
+ */
+class Arena {
+public:
+  ///* bytes of a chunk, unless an allocation needs more
+  static const size_t kChunkSize = 256 << 10;
+
+  explicit Arena(size_t chunk_size = kChunkSize);
+
+  ///* frees all chunks
+  ~Arena();
+
+  /**
+   * Memory for size bytes at a multiple of alignment, a power of two no
+   * larger than kCacheLineSize.
+   */
+  void *Allocate(size_t size, size_t alignment = kCacheLineSize) {
+    size_t offset = (used_ + alignment - 1) & ~(alignment - 1);
+    if (!chunk_ || offset + size > capacity_) {
+      AddChunk(size);
+      offset = 0;
+    }
+    used_ = offset + size;
+    allocated_ += size;
+    return chunk_ + offset;
+  }
+
+  ///* a T constructed from args in the arena
+  template <class T, class... Args>
+  T *New(Args&&... args) {
+    return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  /**
+   * Makes sure the next size bytes come from one chunk whose pages are all
+   * faulted in, at the cost of what is left of the current chunk if it is
+   * too small; with huge_pages the chunk is on huge pages, transparent
+   * ones at least, whatever the mode of HugePages. For a warm-up before
+   * the pool's first connection.
+   */
+  void Reserve(size_t size, bool huge_pages);
+
+  ///* frees all chunks; anything allocated before is gone
+  void Clear();
+
+  ///* bytes handed out, and chunks holding them
+  size_t allocated() const { return allocated_; }
+  size_t chunks() const { return chunks_.size(); }
+
+private:
+  size_t chunk_size_;
+  ///* each chunk and its size if it was Mapped, 0 if it is on the heap
+  std::vector<std::pair<char *, size_t> > chunks_;
+  ///* the chunk allocations come from, its size and the bytes used of it
+  char *chunk_;
+  size_t capacity_;
+  size_t used_;
+  size_t allocated_;
+
+  void AddChunk(size_t size, bool huge_pages = HugePages::enabled());
+
+  Arena(const Arena &);
+  Arena &operator=(const Arena &);
+};
+
+#endif /* ARENA_H_ */
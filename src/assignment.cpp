@@ -0,0 +1,95 @@
+#include "assignment.h"
+#include <cstddef>
+#include <limits>
+
+double AssignmentSolver::Solve(const double *cost, int rows, int cols, int *row_to_col) {
+	if (rows <= cols) {
+		return SolveWide(cost, rows, cols, row_to_col);
+	}
+	//assign the columns to rows instead
+	transposed_.resize(size_t(rows) * cols);
+	for (int r = 0; r < rows; r++) {
+		for (int c = 0; c < cols; c++) {
+			transposed_[size_t(c) * rows + r] = cost[size_t(r) * cols + c];
+		}
+	}
+	col_to_row_.resize(cols);
+	const double total = SolveWide(&transposed_[0], cols, rows, &col_to_row_[0]);
+	for (int r = 0; r < rows; r++) {
+		row_to_col[r] = -1;
+	}
+	for (int c = 0; c < cols; c++) {
+		row_to_col[col_to_row_[c]] = c;
+	}
+	return total;
+}
+
+double AssignmentSolver::SolveWide(const double *cost, int rows, int cols, int *row_to_col) {
+	const double infinity = std::numeric_limits<double>::infinity();
+	//rows and columns are numbered from 1 here, 0 being the virtual column
+	//each search starts from
+	u_.assign(rows + 1, 0.0);
+	v_.assign(cols + 1, 0.0);
+	column_row_.assign(cols + 1, 0);
+	distance_.resize(cols + 1);
+	previous_.resize(cols + 1);
+	visited_.resize(cols + 1);
+
+	for (int row = 1; row <= rows; row++) {
+		//shortest augmenting path from row, Dijkstra over reduced costs
+		column_row_[0] = row;
+		int col0 = 0;
+		distance_.assign(cols + 1, infinity);
+		visited_.assign(cols + 1, 0);
+		do {
+			visited_[col0] = 1;
+			const int r = column_row_[col0];
+			const double *cost_row = cost + size_t(r - 1) * cols;
+			double delta = infinity;
+			int col1 = 0;
+			for (int c = 1; c <= cols; c++) {
+				if (visited_[c]) {
+					continue;
+				}
+				const double reduced = cost_row[c - 1] - u_[r] - v_[c];
+				if (reduced < distance_[c]) {
+					distance_[c] = reduced;
+					previous_[c] = col0;
+				}
+				if (distance_[c] < delta) {
+					delta = distance_[c];
+					col1 = c;
+				}
+			}
+			for (int c = 0; c <= cols; c++) {
+				if (visited_[c]) {
+					u_[column_row_[c]] += delta;
+					v_[c] -= delta;
+				}
+				else {
+					distance_[c] -= delta;
+				}
+			}
+			col0 = col1;
+		} while (column_row_[col0] != 0);
+
+		//flip the path
+		do {
+			const int col1 = previous_[col0];
+			column_row_[col0] = column_row_[col1];
+			col0 = col1;
+		} while (col0);
+	}
+
+	double total = 0.0;
+	for (int r = 0; r < rows; r++) {
+		row_to_col[r] = -1;
+	}
+	for (int c = 1; c <= cols; c++) {
+		if (column_row_[c]) {
+			row_to_col[column_row_[c] - 1] = c - 1;
+			total += cost[size_t(column_row_[c] - 1) * cols + c - 1];
+		}
+	}
+	return total;
+}
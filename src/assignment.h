@@ -0,0 +1,41 @@
+#ifndef ASSIGNMENT_H_
+#define ASSIGNMENT_H_
+
+#include <vector>
+
+/**
+ * Minimum-cost assignment of rows to columns (the Hungarian method, in its
+ * shortest augmenting path form), O(n^2 m) for n rows and m columns. The
+ * scratch arrays grow to the largest problem solved and are then reused,
+ * so a solver kept across calls stops allocating.
+ */
+class AssignmentSolver {
+public:
+  /**
+   * Assigns every row of the rows x cols cost matrix (row major) to a
+   * different column, or every column to a different row if there are more
+   * rows, minimizing the total cost.
+   * @param row_to_col Receives the column of each row, or -1 for the rows
+   * left over
+   * @return The total cost of the assignment
+   */
+  double Solve(const double *cost, int rows, int cols, int *row_to_col);
+
+private:
+  ///* potentials of the rows and columns, and the row assigned to each
+  ///* column, with an extra column 0 as the start of every search
+  std::vector<double> u_;
+  std::vector<double> v_;
+  std::vector<int> column_row_;
+  ///* the search: shortest distance and predecessor of each column
+  std::vector<double> distance_;
+  std::vector<int> previous_;
+  std::vector<char> visited_;
+  ///* the cost matrix transposed, for more rows than columns
+  std::vector<double> transposed_;
+  std::vector<int> col_to_row_;
+
+  double SolveWide(const double *cost, int rows, int cols, int *row_to_col);
+};
+
+#endif /* ASSIGNMENT_H_ */
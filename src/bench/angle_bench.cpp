@@ -0,0 +1,52 @@
+#include "angle.h"
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+///* the wrap the filter used before NormalizeAngle
+inline double FmodAngle(double a) {
+	return fmod(a + M_PI, (2.0*M_PI)) - M_PI;
+}
+
+///* residual-sized angles, mostly within one turn as in the updates
+std::vector<double> Angles(size_t n) {
+	std::vector<double> angles(n);
+	for (size_t i = 0; i < n; i++) {
+		angles[i] = 7.0 * sin(0.37 * i);
+	}
+	return angles;
+}
+
+void BM_FmodAngle(benchmark::State &state) {
+	std::vector<double> in = Angles(state.range(0));
+	std::vector<double> out(in.size());
+	for (auto _ : state) {
+		for (size_t i = 0; i < in.size(); i++) {
+			out[i] = FmodAngle(in[i]);
+		}
+		benchmark::DoNotOptimize(out.data());
+	}
+	state.SetItemsProcessed(state.iterations() * in.size());
+}
+
+void BM_NormalizeAngle(benchmark::State &state) {
+	std::vector<double> in = Angles(state.range(0));
+	std::vector<double> out(in.size());
+	for (auto _ : state) {
+		for (size_t i = 0; i < in.size(); i++) {
+			out[i] = NormalizeAngle(in[i]);
+		}
+		benchmark::DoNotOptimize(out.data());
+	}
+	state.SetItemsProcessed(state.iterations() * in.size());
+}
+
+}
+
+//15 is one sigma-point loop
+BENCHMARK(BM_FmodAngle)->Arg(15)->Arg(4096);
+BENCHMARK(BM_NormalizeAngle)->Arg(15)->Arg(4096);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,761 @@
+#include "measurement_parser.h"
+#include "perf_counters.h"
+#include "measurement_record.h"
+#include "cholesky_kernel.h"
+#include "ctrv_kernel.h"
+#include "lidar_kernel.h"
+#include "radar_kernel.h"
+#include "ukf_batch_lane.h"
+#include "small_matrix.h"
+#include "json.hpp"
+#include "tools.h"
+#include "ukf.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// for convenience
+using json = nlohmann::json;
+
+///* set by --perf_counters
+bool perf_counters = false;
+
+/**
+ * With --perf_counters, counts the hardware events of a benchmark's loop
+ * from its construction right before the loop to its destruction, and
+ * reports them per item, items_per_iteration items in every iteration, with
+ * the IPC. Without the flag, or where no counter is available, it does
+ * nothing.
+ */
+class CountedLoop {
+public:
+	explicit CountedLoop(benchmark::State &state, double items_per_iteration = 1.0)
+		: state_(state), items_per_iteration_(items_per_iteration) {
+		if (perf_counters && counters_.Open()) {
+			counters_.Start();
+		}
+	}
+
+	~CountedLoop() {
+		counters_.Stop();
+		const double items = state_.iterations() * items_per_iteration_;
+		for (int i = 0; i < PerfCounters::EVENTS && items > 0; i++) {
+			const PerfCounters::Event event = PerfCounters::Event(i);
+			if (counters_.available(event)) {
+				state_.counters[PerfCounters::Name(event)] = counters_.Read(event) / items;
+			}
+		}
+		if (counters_.available(PerfCounters::CYCLES) && counters_.available(PerfCounters::INSTRUCTIONS)) {
+			state_.counters["ipc"] = counters_.IPC();
+		}
+	}
+
+private:
+	benchmark::State &state_;
+	double items_per_iteration_;
+	PerfCounters counters_;
+};
+
+///* a target on a circle of 20 m radius at 5 m/s, measured every 50 ms
+///* alternately by lidar and radar, with the ground truth
+struct Trajectory {
+	std::vector<MeasurementPackage> measurements;
+	std::vector<Eigen::Vector4d> ground_truth;
+
+	explicit Trajectory(size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			double t = 0.05 * i;
+			double a = 0.25 * t;
+			double p_x = 20.0 * sin(a), p_y = 20.0 * (1.0 - cos(a));
+			double v_x = 5.0 * cos(a), v_y = 5.0 * sin(a);
+			MeasurementPackage m;
+			m.timestamp_ = 1477010443000000LL + (long long) (50000 * i);
+			if (i % 2) {
+				double rho = sqrt(p_x*p_x + p_y*p_y);
+				m.sensor_type_ = MeasurementPackage::RADAR;
+				m.raw_measurements_.resize(3);
+				m.raw_measurements_ << rho, atan2(p_y, p_x), (p_x*v_x + p_y*v_y) / std::max(rho, 1e-3);
+			}
+			else {
+				m.sensor_type_ = MeasurementPackage::LASER;
+				m.raw_measurements_.resize(2);
+				m.raw_measurements_ << p_x, p_y;
+			}
+			measurements.push_back(m);
+			ground_truth.push_back(Eigen::Vector4d(p_x, p_y, v_x, v_y));
+		}
+	}
+};
+
+///* a filter some steps into the trajectory, as in the middle of a run
+template <class Filter>
+void WarmUp(Filter &ukf, const Trajectory &trajectory) {
+	for (size_t i = 0; i < trajectory.measurements.size(); i++) {
+		ukf.ProcessMeasurement(trajectory.measurements[i]);
+	}
+}
+
+void BM_Prediction(benchmark::State &state) {
+	double delta_t = state.range(0) / 1000.0;
+	Trajectory trajectory(40);
+	CTRVUKF ukf;
+	ukf.use_square_root_ = state.range(1);
+	WarmUp(ukf, trajectory);
+	CTRVUKF::StateVector x = ukf.x_;
+	CTRVUKF::StateMatrix P = ukf.P_, S = ukf.S_;
+	CountedLoop counted(state);
+	for (auto _ : state) {
+		// from the same state every time, so the covariance does not grow
+		ukf.x_ = x;
+		ukf.P_ = P;
+		ukf.S_ = S;
+		ukf.Prediction(delta_t);
+		benchmark::DoNotOptimize(ukf.P_.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+template <MeasurementPackage::SensorType sensor>
+void BM_Update(benchmark::State &state) {
+	Trajectory trajectory(41);
+	CTRVUKF ukf;
+	ukf.use_square_root_ = state.range(0);
+	WarmUp(ukf, trajectory);
+	ukf.Prediction(0.05);
+	const MeasurementPackage &m = trajectory.measurements[sensor == MeasurementPackage::LASER ? 40 : 39];
+	CTRVUKF::StateVector x = ukf.x_;
+	CTRVUKF::StateMatrix P = ukf.P_, S = ukf.S_;
+	CountedLoop counted(state);
+	for (auto _ : state) {
+		ukf.x_ = x;
+		ukf.P_ = P;
+		ukf.S_ = S;
+		if (sensor == MeasurementPackage::LASER) {
+			ukf.UpdateLidar(m);
+		}
+		else {
+			ukf.UpdateRadar(m);
+		}
+		benchmark::DoNotOptimize(ukf.P_.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+template <class Filter>
+void BM_ProcessMeasurement(benchmark::State &state) {
+	Trajectory trajectory(1000);
+	Filter ukf;
+	ukf.use_square_root_ = state.range(0);
+	size_t i = 0;
+	CountedLoop counted(state);
+	for (auto _ : state) {
+		ukf.ProcessMeasurement(trajectory.measurements[i]);
+		benchmark::DoNotOptimize(ukf.x_.data());
+		// start over at the end, so states stay those of a real run
+		if (++i == trajectory.measurements.size()) {
+			i = 0;
+			ukf.is_initialized_ = false;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+///* lidar and radar measuring at the same instant, the pairs processed one
+///* measurement at a time (0) or a pair at a time with ProcessMeasurements (1)
+void BM_CoTimestampedPairs(benchmark::State &state) {
+	Trajectory trajectory(1000);
+	for (size_t i = 1; i < trajectory.measurements.size(); i += 2) {
+		trajectory.measurements[i].timestamp_ = trajectory.measurements[i - 1].timestamp_;
+	}
+	CTRVUKF ukf;
+	size_t i = 0;
+	for (auto _ : state) {
+		if (state.range(0)) {
+			ukf.ProcessMeasurements(&trajectory.measurements[i], 2);
+		}
+		else {
+			ukf.ProcessMeasurement(trajectory.measurements[i]);
+			ukf.ProcessMeasurement(trajectory.measurements[i + 1]);
+		}
+		benchmark::DoNotOptimize(ukf.x_.data());
+		if ((i += 2) == trajectory.measurements.size()) {
+			i = 0;
+			ukf.is_initialized_ = false;
+		}
+	}
+	state.SetItemsProcessed(2 * state.iterations());
+}
+
+///* range(0) sensors reporting the target at every instant, lidars and
+///* radars in turn, updated one by one with ProcessMeasurements (0) or in
+///* one step with FuseMeasurements (1)
+void BM_FusedSensors(benchmark::State &state) {
+	const size_t sensors = state.range(0);
+	Trajectory trajectory(1000);
+	std::vector<MeasurementPackage> measurements;
+	for (size_t i = 0; i + 1 < trajectory.measurements.size(); i += 2) {
+		for (size_t k = 0; k < sensors; k++) {
+			measurements.push_back(trajectory.measurements[i + k % 2]);
+			measurements.back().timestamp_ = trajectory.measurements[i].timestamp_;
+		}
+	}
+	CTRVUKF ukf;
+	size_t i = 0;
+	for (auto _ : state) {
+		if (state.range(1)) {
+			ukf.FuseMeasurements(&measurements[i], sensors);
+		}
+		else {
+			ukf.ProcessMeasurements(&measurements[i], sensors);
+		}
+		benchmark::DoNotOptimize(ukf.x_.data());
+		if ((i += sensors) == measurements.size()) {
+			i = 0;
+			ukf.is_initialized_ = false;
+		}
+	}
+	state.SetItemsProcessed(sensors * state.iterations());
+}
+
+///* the matrices of sigma point generation, with fixed or dynamic sizes
+struct FixedSizes {
+	typedef Eigen::Matrix<double, 5, 1> Vector;
+	typedef Eigen::Matrix<double, 5, 5> Matrix;
+	typedef Eigen::Matrix<double, 7, 1> AugVector;
+	typedef Eigen::Matrix<double, 7, 7> AugMatrix;
+	typedef Eigen::Matrix<double, 7, 15> AugSigmaMatrix;
+};
+
+struct DynamicSizes {
+	typedef Eigen::VectorXd Vector;
+	typedef Eigen::MatrixXd Matrix;
+	typedef Eigen::VectorXd AugVector;
+	typedef Eigen::MatrixXd AugMatrix;
+	typedef Eigen::MatrixXd AugSigmaMatrix;
+};
+
+///* augmented sigma points of a 5-d state as Prediction generates them
+template <class Sizes>
+void AugmentedSigmaPoints(const typename Sizes::Vector &x, const typename Sizes::Matrix &P,
+                          double std_a, double std_yawdd, typename Sizes::AugSigmaMatrix &Xsig_aug) {
+	const int n_x = 5, n_aug = 7;
+	const double lambda = 3.0 - n_aug;
+	typename Sizes::AugVector x_aug(n_aug);
+	x_aug.head(n_x) = x;
+	x_aug(n_x) = 0;
+	x_aug(n_x + 1) = 0;
+	typename Sizes::AugMatrix P_aug(n_aug, n_aug);
+	P_aug.setZero();
+	P_aug.topLeftCorner(n_x, n_x) = P;
+	P_aug(n_x, n_x) = std_a*std_a;
+	P_aug(n_x + 1, n_x + 1) = std_yawdd*std_yawdd;
+	typename Sizes::AugMatrix L = P_aug.llt().matrixL();
+	double sqrt_lam_aug = sqrt(lambda + n_aug);
+	Xsig_aug.col(0) = x_aug;
+	for (int i = 0; i < n_aug; i++) {
+		Xsig_aug.col(i + 1) = x_aug + sqrt_lam_aug * L.col(i);
+		Xsig_aug.col(i + 1 + n_aug) = x_aug - sqrt_lam_aug * L.col(i);
+	}
+}
+
+template <class Sizes>
+void BM_SigmaPoints(benchmark::State &state) {
+	Trajectory trajectory(40);
+	CTRVUKF ukf;
+	WarmUp(ukf, trajectory);
+	typename Sizes::Vector x = ukf.x_;
+	typename Sizes::Matrix P = ukf.P_;
+	typename Sizes::AugSigmaMatrix Xsig_aug(7, 15);
+	for (auto _ : state) {
+		AugmentedSigmaPoints<Sizes>(x, P, ukf.config().std_a_, ukf.config().std_yawdd_, Xsig_aug);
+		benchmark::DoNotOptimize(Xsig_aug.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+void BM_PropagateCTRV(benchmark::State &state) {
+	const int n = state.range(0);
+	std::vector<double> in_data(7 * n), out_data(5 * n);
+	const double *in[7];
+	double *out[5];
+	for (int k = 0; k < 7; k++) {
+		in[k] = &in_data[k * n];
+	}
+	for (int k = 0; k < 5; k++) {
+		out[k] = &out_data[k * n];
+	}
+	for (int i = 0; i < n; i++) {
+		in_data[0 * n + i] = 1.0 + 0.01 * i;
+		in_data[1 * n + i] = 0.5;
+		in_data[2 * n + i] = 5.0;
+		in_data[3 * n + i] = 0.1 * i;
+		in_data[4 * n + i] = (i % 3) ? 0.2 : 0.0;
+		in_data[5 * n + i] = 0.3;
+		in_data[6 * n + i] = -0.1;
+	}
+	for (auto _ : state) {
+		PropagateCTRV(in, out, n, 0.05);
+		benchmark::DoNotOptimize(out_data.data());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+
+	//precision of the positions against the model in long double with libm
+	double max_error = 0.0;
+	for (int i = 0; i < n; i++) {
+		const long double v = in[2][i], yaw = in[3][i], yawd = in[4][i], dt = 0.05;
+		const long double half_dt2_a = 0.5L * dt * dt * in[5][i];
+		long double p_x = in[0][i] + half_dt2_a * cosl(yaw);
+		long double p_y = in[1][i] + half_dt2_a * sinl(yaw);
+		if (fabsl(yawd) > 0.001L) {
+			p_x += v / yawd * (sinl(yaw + yawd * dt) - sinl(yaw));
+			p_y += v / yawd * (cosl(yaw) - cosl(yaw + yawd * dt));
+		}
+		else {
+			p_x += v * dt * cosl(yaw);
+			p_y += v * dt * sinl(yaw);
+		}
+		max_error = std::max(max_error, double(std::max(fabsl(out[0][i] - p_x), fabsl(out[1][i] - p_y))));
+	}
+	state.counters["max_error"] = max_error;
+}
+
+///* radar projection of n states: 0 the exact kernel, 1 the approximate
+///* one, 2 lane::RadarMeasurement one state at a time with libm
+void BM_ProjectRadar(benchmark::State &state) {
+	const int n = state.range(0);
+	const int mode = state.range(1);
+	std::vector<double> in_data(4 * n), out_data(3 * n);
+	const double *in[4];
+	double *out[3];
+	for (int k = 0; k < 4; k++) {
+		in[k] = &in_data[k * n];
+	}
+	for (int k = 0; k < 3; k++) {
+		out[k] = &out_data[k * n];
+	}
+	//positions all around the sensor, and one at it
+	for (int i = 0; i < n; i++) {
+		in_data[0 * n + i] = i ? 20.0 * cos(0.37 * i) : 0.0;
+		in_data[1 * n + i] = i ? (5.0 + i % 7) * sin(0.37 * i) : 0.0;
+		in_data[2 * n + i] = 5.0;
+		in_data[3 * n + i] = 0.1 * i;
+	}
+	for (auto _ : state) {
+		if (mode == 2) {
+			for (int i = 0; i < n; i++) {
+				lane::RadarMeasurement(in[0][i], in[1][i], in[2][i], in[3][i], &out[0][i], &out[1][i], &out[2][i]);
+			}
+		}
+		else {
+			ProjectRadar(in, out, n, mode == 1);
+		}
+		benchmark::DoNotOptimize(out_data.data());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+
+	//precision of the bearing and the range rate against libm in long double
+	double max_phi_error = 0.0, max_rho_dot_error = 0.0;
+	for (int i = 0; i < n; i++) {
+		const long double p_x = in[0][i], p_y = in[1][i], v = in[2][i], yaw = in[3][i];
+		const long double rho = std::max(sqrtl(p_x * p_x + p_y * p_y), 0.001L);
+		const long double phi = rho > 0.001L ? atan2l(p_y, p_x) : 0.0L;
+		const long double rho_dot = (p_x * cosl(yaw) + p_y * sinl(yaw)) * v / rho;
+		max_phi_error = std::max(max_phi_error, double(fabsl(out[1][i] - phi)));
+		max_rho_dot_error = std::max(max_rho_dot_error, double(fabsl(out[2][i] - rho_dot)));
+	}
+	state.counters["max_phi_error"] = max_phi_error;
+	state.counters["max_rho_dot_error"] = max_rho_dot_error;
+}
+
+///* the covariances of the updates of a filter in the middle of the
+///* trajectory: the innovation covariance of each sensor, the state
+///* covariance, and a cross covariance with its gain
+struct SmallMatrices {
+	Eigen::Matrix2d S_laser;
+	Eigen::Matrix3d S_radar;
+	CTRVUKF::StateMatrix P;
+	Eigen::Matrix<double, 5, 3> T, K;
+
+	SmallMatrices() {
+		Trajectory trajectory(40);
+		CTRVUKF ukf;
+		WarmUp(ukf, trajectory);
+		const long long next = ukf.time_us_ + 50000;
+		Eigen::Vector3d z_pred;
+		Eigen::Matrix3d S;
+		ukf.PredictMeasurement(MeasurementPackage::LASER, next, &z_pred, &S);
+		S_laser = S.topLeftCorner<2, 2>();
+		ukf.PredictMeasurement(MeasurementPackage::RADAR, next, &z_pred, &S_radar);
+		P = ukf.P_;
+		//a gain K = T S^-1 keeps P - T K^T symmetric
+		T = P.leftCols<3>();
+		K = T * S_radar.inverse();
+	}
+};
+
+///* the relative difference of a kernel's result from Eigen's
+template <class Matrix>
+double Deviation(const Matrix &kernel, const Matrix &eigen) {
+	return (kernel - eigen).norm() / eigen.norm();
+}
+
+///* Eigen's inverse (0) against the closed form (1) of the radar's S, and
+///* of the lidar's with range(1)
+void BM_SymmetricInverse(benchmark::State &state) {
+	const SmallMatrices m;
+	Eigen::Matrix2d inverse2;
+	Eigen::Matrix3d inverse3;
+	small_matrix::SymmetricInverse(m.S_laser, &inverse2);
+	small_matrix::SymmetricInverse(m.S_radar, &inverse3);
+	state.counters["deviation"] = state.range(1) ? Deviation(inverse2, Eigen::Matrix2d(m.S_laser.inverse()))
+	                              : Deviation(inverse3, Eigen::Matrix3d(m.S_radar.inverse()));
+	for (auto _ : state) {
+		if (state.range(1)) {
+			benchmark::DoNotOptimize(m.S_laser.data());
+			if (state.range(0)) {
+				small_matrix::SymmetricInverse(m.S_laser, &inverse2);
+			}
+			else {
+				inverse2 = m.S_laser.inverse();
+			}
+			benchmark::DoNotOptimize(inverse2.data());
+		}
+		else {
+			benchmark::DoNotOptimize(m.S_radar.data());
+			if (state.range(0)) {
+				small_matrix::SymmetricInverse(m.S_radar, &inverse3);
+			}
+			else {
+				inverse3 = m.S_radar.inverse();
+			}
+			benchmark::DoNotOptimize(inverse3.data());
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+///* Eigen's LLT (0) against the unrolled kernel (1) of the state covariance
+void BM_Cholesky(benchmark::State &state) {
+	const SmallMatrices m;
+	Eigen::LLT<CTRVUKF::StateMatrix> llt(m.P);
+	CTRVUKF::StateMatrix L;
+	small_matrix::Cholesky(m.P, &L);
+	state.counters["deviation"] = Deviation(L, CTRVUKF::StateMatrix(llt.matrixL()));
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(m.P.data());
+		if (state.range(0)) {
+			small_matrix::Cholesky(m.P, &L);
+		}
+		else {
+			llt.compute(m.P);
+			L = llt.matrixL();
+		}
+		benchmark::DoNotOptimize(L.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+///* the covariances of a block of 32 tracks (UKFBatch::kLanes) factored by
+///* Eigen's LLT one at a time (0) or across lanes by Cholesky5 (1)
+void BM_Cholesky5(benchmark::State &state) {
+	const int lanes = 32;
+	const SmallMatrices m;
+	std::vector<double> P_data(15 * lanes), L_data(25 * lanes);
+	const double *P[15];
+	double *L[25];
+	for (int e = 0; e < 15; e++) {
+		P[e] = &P_data[e * lanes];
+	}
+	for (int k = 0; k < 25; k++) {
+		L[k] = &L_data[k * lanes];
+	}
+	//the same covariance scaled differently in every lane
+	for (int j = 0; j < lanes; j++) {
+		for (int r = 0, e = 0; r < 5; r++) {
+			for (int c = r; c < 5; c++, e++) {
+				P_data[e * lanes + j] = (1.0 + 0.1 * j) * m.P(r, c);
+			}
+		}
+	}
+	unsigned char failed[lanes];
+	Cholesky5(P, L, lanes, failed);
+	const CTRVUKF::StateMatrix scaled = (1.0 + 0.1 * (lanes - 1)) * m.P;
+	const CTRVUKF::StateMatrix reference = Eigen::LLT<CTRVUKF::StateMatrix>(scaled).matrixL();
+	CTRVUKF::StateMatrix last;
+	for (int k = 0; k < 25; k++) {
+		last(k / 5, k % 5) = L[k][lanes - 1];
+	}
+	state.counters["deviation"] = Deviation(last, reference);
+
+	CTRVUKF::StateMatrix Pj;
+	Eigen::LLT<CTRVUKF::StateMatrix> llt;
+	for (auto _ : state) {
+		if (state.range(0)) {
+			benchmark::DoNotOptimize(Cholesky5(P, L, lanes, failed));
+		}
+		else {
+			for (int j = 0; j < lanes; j++) {
+				for (int r = 0, e = 0; r < 5; r++) {
+					for (int c = r; c < 5; c++, e++) {
+						Pj(c, r) = P[e][j];
+					}
+				}
+				llt.compute(Pj);
+				const CTRVUKF::StateMatrix Lj = llt.matrixL();
+				for (int k = 0; k < 25; k++) {
+					L[k][j] = Lj(k / 5, k % 5);
+				}
+			}
+		}
+		benchmark::DoNotOptimize(L_data.data());
+	}
+	state.SetItemsProcessed(state.iterations() * lanes);
+}
+
+///* lidar updates of n tracks by lane::UpdateLidar one at a time (0) or
+///* across lanes by the lidar kernel (1), from the same moments every time
+void BM_UpdateLidar(benchmark::State &state) {
+	const int n = state.range(0);
+	const SmallMatrices m;
+	lane::Model<double> model;
+	model.R_laser[0] = model.R_laser[1] = 0.15 * 0.15;
+	std::vector<double> x_data(5 * n), P_data(15 * n), z_data(2 * n), nis(n);
+	std::vector<double> x_start(5 * n), P_start(15 * n);
+	double *x[5], *P[15];
+	const double *z[2] = {&z_data[0], &z_data[n]};
+	for (int k = 0; k < 5; k++) {
+		x[k] = &x_data[k * n];
+	}
+	for (int e = 0; e < 15; e++) {
+		P[e] = &P_data[e * n];
+	}
+	for (int j = 0; j < n; j++) {
+		for (int r = 0, e = 0; r < 5; r++) {
+			for (int c = r; c < 5; c++, e++) {
+				P_start[e * n + j] = (1.0 + 0.01 * j) * m.P(r, c);
+			}
+			x_start[r * n + j] = 0.1 * (r + 1) * j;
+		}
+		z_data[j] = x_start[j] + 0.2;
+		z_data[n + j] = x_start[n + j] - 0.1;
+	}
+
+	double measured[2];
+	for (auto _ : state) {
+		std::copy(x_start.begin(), x_start.end(), x_data.begin());
+		std::copy(P_start.begin(), P_start.end(), P_data.begin());
+		if (state.range(1)) {
+			UpdateLidar(z, x, P, model.R_laser, nis.data(), n);
+		}
+		else {
+			for (int j = 0; j < n; j++) {
+				measured[0] = z[0][j];
+				measured[1] = z[1][j];
+				nis[j] = lane::UpdateLidar(model, measured, &x[0][j], &P[0][j], n);
+			}
+		}
+		benchmark::DoNotOptimize(P_data.data());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+///* the radar's P - T K^T by Eigen's product (0), and symmetric in scalar (1)
+///* or the build's widest lanes (2)
+void BM_SubtractSymmetricProduct(benchmark::State &state) {
+	const SmallMatrices m;
+	CTRVUKF::StateMatrix P = m.P, eigen = m.P;
+	eigen.noalias() -= m.T * m.K.transpose();
+	small_matrix::SubtractSymmetricProduct<simd::ScalarDouble>(&P, m.T, m.K);
+	double deviation = Deviation(P, eigen);
+	P = m.P;
+	small_matrix::SubtractSymmetricProduct(&P, m.T, m.K);
+	state.counters["deviation"] = std::max(deviation, Deviation(P, eigen));
+	for (auto _ : state) {
+		P = m.P;
+		if (state.range(0) == 2) {
+			small_matrix::SubtractSymmetricProduct(&P, m.T, m.K);
+		}
+		else if (state.range(0) == 1) {
+			small_matrix::SubtractSymmetricProduct<simd::ScalarDouble>(&P, m.T, m.K);
+		}
+		else {
+			P.noalias() -= m.T * m.K.transpose();
+		}
+		benchmark::DoNotOptimize(P.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+void BM_CalculateRMSE(benchmark::State &state) {
+	Trajectory trajectory(state.range(0));
+	std::vector<Eigen::VectorXd> estimations, ground_truth;
+	for (size_t i = 0; i < trajectory.ground_truth.size(); i++) {
+		ground_truth.push_back(trajectory.ground_truth[i]);
+		estimations.push_back(trajectory.ground_truth[i] + Eigen::Vector4d(0.1, -0.1, 0.2, 0.05));
+	}
+	Tools tools;
+	for (auto _ : state) {
+		Eigen::VectorXd rmse = tools.CalculateRMSE(estimations, ground_truth);
+		benchmark::DoNotOptimize(rmse.data());
+	}
+	state.SetItemsProcessed(state.iterations() * estimations.size());
+}
+
+///* what the server does per estimate instead of CalculateRMSE over all
+void BM_RunningRMSE(benchmark::State &state) {
+	Trajectory trajectory(state.range(0));
+	Eigen::Vector4d offset(0.1, -0.1, 0.2, 0.05);
+	for (auto _ : state) {
+		RunningRMSE rmse;
+		for (size_t i = 0; i < trajectory.ground_truth.size(); i++) {
+			rmse.Add(trajectory.ground_truth[i] + offset, trajectory.ground_truth[i]);
+		}
+		Eigen::Vector4d result = rmse.RMSE();
+		benchmark::DoNotOptimize(result.data());
+	}
+	state.SetItemsProcessed(state.iterations() * trajectory.ground_truth.size());
+}
+
+const std::string kTelemetry =
+	"42[\"telemetry\",{\"sensor_measurement\":\"R\\t8.46642\\t0.0287602\\t-3.04035\\t1477010443050000"
+	"\\t8.6\\t0.25\\t-3.00029\\t0\\t0.0135\\t0.00022\\t0.01\"}]";
+
+void BM_ParseTelemetry(benchmark::State &state) {
+	MeasurementPackage m;
+	Eigen::Vector4d ground_truth;
+	const char *lines;
+	if (ParseTelemetry(kTelemetry.data(), kTelemetry.length(), &m, &ground_truth, &lines) != TELEMETRY_MEASUREMENT) {
+		state.SkipWithError("the telemetry sample does not parse");
+		return;
+	}
+	CountedLoop counted(state);
+	for (auto _ : state) {
+		TelemetryMessage message = ParseTelemetry(kTelemetry.data(), kTelemetry.length(), &m, &ground_truth, &lines);
+		benchmark::DoNotOptimize(message);
+		benchmark::DoNotOptimize(m.raw_measurements_.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * kTelemetry.length());
+}
+
+///* the estimate_marker event as Session writes it
+void BM_SerializeEstimate(benchmark::State &state) {
+	for (auto _ : state) {
+		json msgJson;
+		msgJson["estimate_x"] = 8.4614;
+		msgJson["estimate_y"] = 0.2434;
+		msgJson["rmse_x"] = 0.0714;
+		msgJson["rmse_y"] = 0.0832;
+		msgJson["rmse_vx"] = 0.3313;
+		msgJson["rmse_vy"] = 0.2796;
+		auto msg = "42[\"estimate_marker\"," + msgJson.dump() + "]";
+		benchmark::DoNotOptimize(msg.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+///* the binary protocol: one measurement record in, one estimate record out
+void BM_Records(benchmark::State &state) {
+	Trajectory trajectory(2);
+	std::vector<char> in((record::kMeasurementSize + record::kGroundTruthSize) * 2), out(record::kEstimateSize);
+	char *p = &in[0];
+	for (size_t i = 0; i < 2; i++) {
+		p = record::EncodeMeasurement(p, trajectory.measurements[i], &trajectory.ground_truth[i]);
+	}
+	const char *end = p;
+	MeasurementPackage m;
+	Eigen::Vector4d ground_truth, rmse(0.07, 0.08, 0.33, 0.28);
+	bool has_ground_truth;
+	for (auto _ : state) {
+		for (const char *q = &in[0]; q != end && (q = record::DecodeMeasurement(q, end, &m, &ground_truth, &has_ground_truth));) {
+			record::EncodeEstimate(&out[0], m.timestamp_, ground_truth(0), ground_truth(1), rmse);
+			benchmark::DoNotOptimize(out.data());
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * 2);
+}
+
+///* decoding a frame of 64 records without ground truth: full (0), compact
+///* (1) or compact and quantized (2), with the bytes each record takes
+void BM_RecordFrame(benchmark::State &state) {
+	const size_t kRecords = 64;
+	Trajectory trajectory(kRecords);
+	std::vector<char> in(kRecords * record::kMaxCompactSize);
+	char *p = &in[0];
+	record::DeltaState delta;
+	for (size_t i = 0; i < kRecords; i++) {
+		p = state.range(0) ? record::EncodeCompactMeasurement(p, &delta, trajectory.measurements[i], nullptr, state.range(0) == 2)
+		                   : record::EncodeMeasurement(p, trajectory.measurements[i], nullptr);
+	}
+	const char *end = p;
+	MeasurementPackage m;
+	Eigen::Vector4d ground_truth;
+	bool has_ground_truth;
+	CountedLoop counted(state, kRecords);
+	for (auto _ : state) {
+		delta.Reset();
+		for (const char *q = &in[0]; q != end && (q = record::DecodeMeasurement(q, end, &m, &ground_truth, &has_ground_truth, &delta));) {
+			benchmark::DoNotOptimize(m.raw_measurements_.data());
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * kRecords);
+	state.counters["bytes_per_record"] = double(end - &in[0]) / kRecords;
+}
+
+}
+
+// delta_t in ms: simulator rate, a dropped measurement, a long gap; then
+// covariance (0) or square-root (1) propagation
+BENCHMARK(BM_Prediction)->ArgsProduct({{1, 50, 100, 1000}, {0, 1}});
+BENCHMARK_TEMPLATE(BM_Update, MeasurementPackage::LASER)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_Update, MeasurementPackage::RADAR)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_ProcessMeasurement, CTRVUKF)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_ProcessMeasurement, UKF<5, 7, InverseSolver>)->Arg(0);
+BENCHMARK_TEMPLATE(BM_ProcessMeasurement, UKF<5, 7, SmallMatrixSolver, CTRVSigmaPoints>)->Arg(0)->Arg(1);
+// the filters of one sensor, which skip the measurements of the other
+BENCHMARK_TEMPLATE(BM_ProcessMeasurement, LaserCTRVUKF)->Arg(0);
+BENCHMARK_TEMPLATE(BM_ProcessMeasurement, RadarCTRVUKF)->Arg(0);
+BENCHMARK(BM_CoTimestampedPairs)->Arg(0)->Arg(1);
+BENCHMARK(BM_FusedSensors)->ArgsProduct({{2, 4, 8}, {0, 1}});
+BENCHMARK_TEMPLATE(BM_SigmaPoints, FixedSizes);
+BENCHMARK_TEMPLATE(BM_SigmaPoints, DynamicSizes);
+//15 is one filter's sigma points
+BENCHMARK(BM_PropagateCTRV)->Arg(15)->Arg(4096);
+BENCHMARK(BM_ProjectRadar)->ArgsProduct({{15, 4096}, {0, 1, 2}});
+BENCHMARK(BM_SymmetricInverse)->ArgsProduct({{0, 1}, {0, 1}});
+BENCHMARK(BM_Cholesky)->Arg(0)->Arg(1);
+BENCHMARK(BM_Cholesky5)->Arg(0)->Arg(1);
+BENCHMARK(BM_UpdateLidar)->ArgsProduct({{32, 512}, {0, 1}});
+BENCHMARK(BM_SubtractSymmetricProduct)->Arg(0)->Arg(1)->Arg(2);
+BENCHMARK(BM_CalculateRMSE)->Arg(100)->Arg(10000);
+BENCHMARK(BM_RunningRMSE)->Arg(100)->Arg(10000);
+BENCHMARK(BM_ParseTelemetry);
+BENCHMARK(BM_SerializeEstimate);
+BENCHMARK(BM_Records);
+BENCHMARK(BM_RecordFrame)->Arg(0)->Arg(1)->Arg(2);
+
+// --perf_counters adds the hardware counters of the filter, parsing and
+// record benchmarks per measurement (see CountedLoop)
+int main(int argc, char **argv) {
+	int kept = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--perf_counters") == 0) {
+			perf_counters = true;
+		}
+		else {
+			argv[kept++] = argv[i];
+		}
+	}
+	argc = kept;
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+		return 1;
+	}
+	benchmark::RunSpecifiedBenchmarks();
+	return 0;
+}
@@ -0,0 +1,560 @@
+#include "latency.h"
+#include "measurement_parser.h"
+#include "measurement_record.h"
+#include "shm_channel.h"
+#include <uWS/uWS.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Load generator for the filter's WebSocket server: opens many connections,
+ * each streaming the telemetry of its own simulated CTRV object as the
+ * simulator does, and measures the estimate_marker replies, e.g.
+ *   ukf_loadgen --connections 200 --rate 20 --seconds 10 --threads 2
+ * With --rate 0 every connection waits for the reply to one measurement
+ * before it sends the next (closed loop), which measures the throughput the
+ * server sustains. Otherwise each sends at the given rate however the server
+ * keeps up, and the round trips count from when a measurement was due, so
+ * that a server falling behind shows in the percentiles.
+ *
+ * With --replay <file> every connection plays a recorded measurement file
+ * in the L/R line format instead, each measurement due at its recorded time
+ * after the first divided by --warp (1 by default, 10 for ten times as
+ * fast), so that the server sees the bursts and gaps of real sensors:
+ *   ukf_loadgen --replay data/obj_pose-laser-radar-synthetic-input.txt --warp 100 --connections 50
+ * Round trips again count from when a measurement was due, and the run ends
+ * when every connection has played the file or the time is up.
+ *
+ * With --format binary or delta the connections ask for their estimates
+ * as estimate records or compact ones with the subprotocol ukf.binary or
+ * ukf.delta (see Session::OutputFormat), and a BINARY frame is the reply.
+ *
+ * With --shm <path> the connections are the server's shared-memory channels
+ * <path>.0 on (see shm_channel.h), each driven closed loop with binary
+ * measurement records, or with --replay all of them in step at the recorded
+ * times.
+ */
+
+namespace {
+
+const uint64_t kSecond = 1000000000ULL;
+
+///* simulated time between two measurements of an object, as in data/
+const long long kMeasurementMicros = 50000;
+
+struct Options {
+	std::string uri = "ws://127.0.0.1:4567";
+	int connections = 1;
+	double rate = 0.0;
+	double seconds = 10.0;
+	int threads = 1;
+	///* the channels of a server's --shm, instead of uri
+	std::string shm;
+	///* a measurement file every connection plays, instead of its object
+	std::string replay;
+	///* how many times faster than recorded the file is played
+	double warp = 1.0;
+	///* the subprotocol the connections ask for their replies with
+	std::string subprotocol;
+};
+
+/**
+ * The measurements of a --replay file, read once and shared by all workers,
+ * each with its telemetry event and the nanoseconds from the first
+ * measurement it is due at.
+ */
+struct Recording {
+	std::vector<MeasurementPackage> measurements;
+	std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > truths;
+	std::vector<std::string> messages;
+	std::vector<uint64_t> due;
+};
+
+/**
+ * One simulated object driving in a circle at constant speed and turn rate,
+ * measured by lidar and radar in turn.
+ */
+struct Connection {
+	uWS::WebSocket<uWS::CLIENT> ws;
+	bool open = false;
+	uint64_t opened = 0;
+	long long sent = 0;
+	///* when each measurement still without a reply was sent, or was due
+	std::deque<uint64_t> in_flight;
+
+	double center_x = 0.0;
+	double center_y = 0.0;
+	double radius = 10.0;
+	double v = 5.0;
+	double phase = 0.0;
+	std::mt19937 noise;
+};
+
+/**
+ * The connections of one thread, served by a Hub of its own.
+ */
+struct Worker {
+	Options options;
+	const Recording *recording = nullptr;
+	int first = 0;
+	int count = 0;
+
+	std::vector<Connection> connections;
+	uv_timer_t *timer = nullptr;
+	uint64_t start = 0;
+	uint64_t end = 0;
+	bool stopped = false;
+
+	long long sent = 0;
+	long long received = 0;
+	int failed = 0;
+	LatencyHistogram rtt;
+};
+
+/**
+ * The next measurement of c, and the object's true state at its time.
+ */
+void Sample(Connection &c, MeasurementPackage *meas_package, Eigen::Vector4d *ground_truth) {
+	meas_package->timestamp_ = 1477010443000000LL + c.sent * kMeasurementMicros;
+	double yaw_rate = c.v / c.radius;
+	double angle = c.phase + yaw_rate * c.sent * kMeasurementMicros / 1e6;
+	double p_x = c.center_x + c.radius * cos(angle);
+	double p_y = c.center_y + c.radius * sin(angle);
+	double v_x = -c.v * sin(angle);
+	double v_y = c.v * cos(angle);
+	*ground_truth << p_x, p_y, v_x, v_y;
+
+	if (c.sent % 2 == 0) {
+		std::normal_distribution<double> position(0.0, 0.15);
+		meas_package->sensor_type_ = MeasurementPackage::LASER;
+		meas_package->raw_measurements_.resize(2);
+		meas_package->raw_measurements_(0) = p_x + position(c.noise);
+		meas_package->raw_measurements_(1) = p_y + position(c.noise);
+	} else {
+		std::normal_distribution<double> range(0.0, 0.3);
+		std::normal_distribution<double> bearing(0.0, 0.03);
+		double rho = sqrt(p_x*p_x + p_y*p_y);
+		double phi = atan2(p_y, p_x);
+		double rho_dot = (p_x*v_x + p_y*v_y) / rho;
+		meas_package->sensor_type_ = MeasurementPackage::RADAR;
+		meas_package->raw_measurements_.resize(3);
+		meas_package->raw_measurements_(0) = rho + range(c.noise);
+		meas_package->raw_measurements_(1) = phi + bearing(c.noise);
+		meas_package->raw_measurements_(2) = rho_dot + range(c.noise);
+	}
+}
+
+/**
+ * The next measurement of c, as a telemetry event with ground truth.
+ */
+std::string Telemetry(Connection &c) {
+	MeasurementPackage meas_package;
+	Eigen::Vector4d truth;
+	Sample(c, &meas_package, &truth);
+	const MeasurementPackage::Vector &z = meas_package.raw_measurements_;
+
+	char line[256];
+	if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
+		snprintf(line, sizeof(line), "L\\t%.6f\\t%.6f\\t%lld", z(0), z(1), meas_package.timestamp_);
+	} else {
+		snprintf(line, sizeof(line), "R\\t%.6f\\t%.6f\\t%.6f\\t%lld", z(0), z(1), z(2), meas_package.timestamp_);
+	}
+	char message[512];
+	int length = snprintf(message, sizeof(message),
+	                      "42[\"telemetry\",{\"sensor_measurement\":\"%s\\t%.6f\\t%.6f\\t%.6f\\t%.6f\"}]",
+	                      line, truth(0), truth(1), truth(2), truth(3));
+	return std::string(message, length);
+}
+
+///* whether each connection waits for a reply before it sends again
+bool ClosedLoop(const Worker &worker) {
+	return worker.options.rate <= 0.0 && !worker.recording;
+}
+
+/**
+ * Reads the measurement lines of path, with their ground truth where they
+ * have one, into recording, timed as recorded divided by warp.
+ * @return false if the file cannot be read or holds no measurement
+ */
+bool ReadRecording(const std::string &path, double warp, Recording *recording) {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		return false;
+	}
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!line.empty() && line[line.length() - 1] == '\r') {
+			line.resize(line.length() - 1);
+		}
+		MeasurementPackage meas_package;
+		Eigen::Vector4d truth;
+		const char *begin = line.data();
+		const char *end = begin + line.length();
+		if (!ParseMeasurementLine(begin, end, &meas_package, &truth)) {
+			if (!ParseMeasurementLine(begin, end, &meas_package, nullptr)) {
+				continue;
+			}
+			truth.setZero();
+		}
+		// the event carries the line as recorded, its tabs escaped
+		std::string message = "42[\"telemetry\",{\"sensor_measurement\":\"";
+		for (char ch : line) {
+			if (ch == '\t') {
+				message += "\\t";
+			} else {
+				message += ch;
+			}
+		}
+		message += "\"}]";
+
+		const long long first = recording->measurements.empty() ? meas_package.timestamp_
+		                                                        : recording->measurements[0].timestamp_;
+		recording->due.push_back(uint64_t(std::max(0.0, (meas_package.timestamp_ - first) * 1000.0 / warp)));
+		recording->measurements.push_back(meas_package);
+		recording->truths.push_back(truth);
+		recording->messages.push_back(message);
+	}
+	return !recording->measurements.empty();
+}
+
+void Send(Worker &worker, Connection &c, uint64_t due) {
+	std::string message = worker.recording ? worker.recording->messages[c.sent] : Telemetry(c);
+	c.ws.send(message.data(), message.length(), uWS::OpCode::TEXT);
+	c.in_flight.push_back(due);
+	c.sent++;
+	worker.sent++;
+}
+
+void Stop(Worker &worker) {
+	worker.stopped = true;
+	worker.end = LatencyStats::Now();
+	uv_timer_stop(worker.timer);
+	uv_close(worker.timer, [](uv_handle_t *h) {
+		delete (uv_timer_t *) h;
+	});
+	for (Connection &c : worker.connections) {
+		if (c.open) {
+			c.ws.close();
+		}
+	}
+}
+
+///* every millisecond: sends what is due, and stops once the time is up or
+///* no connection could be opened
+void Tick(uv_timer_t *timer) {
+	Worker &worker = *(Worker *) timer->data;
+	uint64_t now = LatencyStats::Now();
+	if ((worker.start && now - worker.start >= worker.options.seconds * kSecond) || worker.failed == worker.count) {
+		Stop(worker);
+		return;
+	}
+	if (worker.recording) {
+		// the connections that failed, were closed or have played the file
+		const std::vector<uint64_t> &due = worker.recording->due;
+		int done = worker.failed;
+		for (Connection &c : worker.connections) {
+			if (!c.open) {
+				done += c.opened != 0;
+				continue;
+			}
+			while (size_t(c.sent) < due.size() && c.opened + due[c.sent] <= now) {
+				Send(worker, c, c.opened + due[c.sent]);
+			}
+			done += size_t(c.sent) == due.size() && c.in_flight.empty();
+		}
+		if (done >= worker.count) {
+			Stop(worker);
+		}
+		return;
+	}
+	if (worker.options.rate <= 0.0) {
+		return;
+	}
+	double interval = kSecond / worker.options.rate;
+	for (Connection &c : worker.connections) {
+		if (!c.open) {
+			continue;
+		}
+		uint64_t due;
+		while ((due = c.opened + (uint64_t) (c.sent * interval)) <= now) {
+			Send(worker, c, due);
+		}
+	}
+}
+
+void Run(Worker *worker) {
+	uWS::Hub h;
+	worker->connections.resize(worker->count);
+	for (int i = 0; i < worker->count; i++) {
+		Connection &c = worker->connections[i];
+		int index = worker->first + i;
+		// objects 40 m apart on a grid, turning with radii of 8 to 20 m
+		c.center_x = 40.0 * (index % 16);
+		c.center_y = 40.0 * (index / 16);
+		c.radius = 8.0 + (index * 7) % 13;
+		c.phase = 0.37 * index;
+		c.noise.seed(index + 1);
+	}
+
+	h.onConnection([worker](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+		Connection &c = *(Connection *) ws.getUserData();
+		c.ws = ws;
+		c.open = true;
+		c.opened = LatencyStats::Now();
+		if (!worker->start) {
+			worker->start = c.opened;
+		}
+		if (ClosedLoop(*worker)) {
+			Send(*worker, c, c.opened);
+		}
+	});
+
+	h.onMessage([worker](uWS::WebSocket<uWS::CLIENT> ws, char *data, size_t length, uWS::OpCode opCode) {
+		static const std::string estimate = "42[\"estimate_marker\"";
+		if (opCode != uWS::OpCode::BINARY
+		    && (length < estimate.length() || estimate.compare(0, estimate.length(), data, estimate.length()) != 0)) {
+			return;
+		}
+		Connection &c = *(Connection *) ws.getUserData();
+		uint64_t now = LatencyStats::Now();
+		if (!c.in_flight.empty()) {
+			worker->rtt.Record(now - c.in_flight.front());
+			c.in_flight.pop_front();
+		}
+		if (worker->stopped) {
+			return;
+		}
+		worker->received++;
+		if (ClosedLoop(*worker)) {
+			Send(*worker, c, now);
+		}
+	});
+
+	h.onDisconnection([](uWS::WebSocket<uWS::CLIENT> ws, int code, char *message, size_t length) {
+		((Connection *) ws.getUserData())->open = false;
+	});
+
+	h.onError([worker](void *user) {
+		worker->failed++;
+	});
+
+	worker->timer = new uv_timer_t;
+	worker->timer->data = worker;
+	uv_timer_init(h.getLoop(), worker->timer);
+	uv_timer_start(worker->timer, Tick, 1, 1);
+
+	for (Connection &c : worker->connections) {
+		h.connect(worker->options.uri, &c, 5000, nullptr, worker->options.subprotocol);
+	}
+	h.run();
+}
+
+///* drives the server's shared-memory channels, one measurement at a time
+void RunShm(Worker *worker) {
+	worker->connections.resize(worker->count);
+	std::vector<std::unique_ptr<ShmChannel> > channels(worker->count);
+	for (int i = 0; i < worker->count; i++) {
+		Connection &c = worker->connections[i];
+		int index = worker->first + i;
+		c.center_x = 40.0 * (index % 16);
+		c.center_y = 40.0 * (index / 16);
+		c.radius = 8.0 + (index * 7) % 13;
+		c.phase = 0.37 * index;
+		c.noise.seed(index + 1);
+		channels[i].reset(new ShmChannel);
+		const std::string path = worker->options.shm + "." + std::to_string(index);
+		c.open = channels[i]->Open(path.c_str());
+		if (!c.open) {
+			std::cerr << "Cannot open " << path << std::endl;
+			worker->failed++;
+		}
+	}
+	if (worker->failed == worker->count) {
+		return;
+	}
+
+	MeasurementPackage meas_package;
+	Eigen::Vector4d truth;
+	char estimate[record::kEstimateSize];
+	worker->start = LatencyStats::Now();
+	uint64_t now = worker->start;
+	const Recording *recording = worker->recording;
+	for (size_t k = 0; now - worker->start < worker->options.seconds * kSecond; k++) {
+		// a recording is played by all channels in step, each measurement
+		// sent once it is due and no sooner than the last reply
+		uint64_t due = 0;
+		if (recording) {
+			if (k == recording->measurements.size()) {
+				break;
+			}
+			due = worker->start + recording->due[k];
+			for (uint64_t now = LatencyStats::Now(); now < due; now = LatencyStats::Now()) {
+				std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+			}
+		}
+		for (int i = 0; i < worker->count; i++) {
+			Connection &c = worker->connections[i];
+			if (!c.open) {
+				continue;
+			}
+			if (recording) {
+				meas_package = recording->measurements[k];
+				truth = recording->truths[k];
+			} else {
+				Sample(c, &meas_package, &truth);
+			}
+			c.in_flight.push_back(recording ? due : LatencyStats::Now());
+			c.open = channels[i]->Send(meas_package, &truth);
+			c.sent++;
+			worker->sent++;
+		}
+		for (int i = 0; i < worker->count; i++) {
+			Connection &c = worker->connections[i];
+			if (c.open && !(c.open = channels[i]->Receive(estimate, 1000))) {
+				worker->failed++;
+			}
+			if (c.open) {
+				now = LatencyStats::Now();
+				worker->rtt.Record(now - c.in_flight.front());
+				c.in_flight.pop_front();
+				worker->received++;
+			}
+		}
+		if (worker->failed == worker->count) {
+			break;
+		}
+	}
+	worker->end = LatencyStats::Now();
+}
+
+bool ParseOptions(int argc, char *argv[], Options *options) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--uri" && i + 1 < argc) {
+			options->uri = argv[++i];
+		}
+		else if (arg == "--connections" && i + 1 < argc && (options->connections = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--rate" && i + 1 < argc && (options->rate = atof(argv[i + 1])) >= 0.0) {
+			i++;
+		}
+		else if (arg == "--seconds" && i + 1 < argc && (options->seconds = atof(argv[i + 1])) > 0.0) {
+			i++;
+		}
+		else if (arg == "--threads" && i + 1 < argc && (options->threads = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--shm" && i + 1 < argc) {
+			options->shm = argv[++i];
+		}
+		else if (arg == "--replay" && i + 1 < argc) {
+			options->replay = argv[++i];
+		}
+		else if (arg == "--warp" && i + 1 < argc && (options->warp = atof(argv[i + 1])) > 0.0) {
+			i++;
+		}
+		else if (arg == "--format" && i + 1 < argc) {
+			std::string format = argv[++i];
+			if (format != "json" && format != "binary" && format != "delta") {
+				return false;
+			}
+			options->subprotocol = "ukf." + format;
+		}
+		else {
+			return false;
+		}
+	}
+	return true;
+}
+
+void PrintMicros(const char *name, uint64_t nanoseconds) {
+	printf(" %s %.1f", name, nanoseconds / 1000.0);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	Options options;
+	if (!ParseOptions(argc, argv, &options)) {
+		std::cerr << "Usage: " << argv[0] << " [--uri ws://127.0.0.1:4567] [--connections <number>]"
+			<< " [--rate <measurements per second and connection, 0 for one at a time>]"
+			<< " [--seconds <duration>] [--threads <number of threads>] [--shm <path>]"
+			<< " [--replay <measurement file> [--warp <speed-up>]] [--format json|binary|delta]" << std::endl;
+		return -1;
+	}
+	Recording recording;
+	if (!options.replay.empty()) {
+		if (!ReadRecording(options.replay, options.warp, &recording)) {
+			std::cerr << "Cannot read measurements from " << options.replay << std::endl;
+			return -1;
+		}
+		printf("replaying %zu measurements of %s, %.2f s recorded, at %gx\n", recording.measurements.size(),
+		       options.replay.c_str(), recording.due.back() * options.warp / kSecond, options.warp);
+	}
+	if (options.threads > options.connections) {
+		options.threads = options.connections;
+	}
+
+	std::vector<Worker *> workers;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < options.threads; i++) {
+		Worker *worker = new Worker;
+		worker->options = options;
+		worker->recording = options.replay.empty() ? nullptr : &recording;
+		worker->first = i * options.connections / options.threads;
+		worker->count = (i + 1) * options.connections / options.threads - worker->first;
+		workers.push_back(worker);
+	}
+	for (Worker *worker : workers) {
+		threads.emplace_back(options.shm.empty() ? Run : RunShm, worker);
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	long long sent = 0;
+	long long received = 0;
+	int failed = 0;
+	double seconds = 0.0;
+	LatencyHistogram rtt;
+	for (Worker *worker : workers) {
+		sent += worker->sent;
+		received += worker->received;
+		failed += worker->failed;
+		if (worker->start && worker->end) {
+			seconds = std::max(seconds, double(worker->end - worker->start) / kSecond);
+		}
+		rtt.Add(worker->rtt);
+	}
+
+	printf("%d connections (%d failed), %lld measurements sent, %lld estimates received",
+	       options.connections, failed, sent, received);
+	if (seconds > 0.0) {
+		printf(" in %.2f s: %.0f/s", seconds, received / seconds);
+	}
+	printf("\nround trip us: mean %.1f", rtt.Mean() / 1000.0);
+	PrintMicros("p50", rtt.Percentile(0.5));
+	PrintMicros("p90", rtt.Percentile(0.9));
+	PrintMicros("p99", rtt.Percentile(0.99));
+	PrintMicros("p99.9", rtt.Percentile(0.999));
+	PrintMicros("max", rtt.max());
+	printf("\n");
+
+	for (Worker *worker : workers) {
+		delete worker;
+	}
+	return failed == options.connections ? 1 : 0;
+}
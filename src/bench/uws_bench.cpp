@@ -0,0 +1,214 @@
+#include <uWS/uWS.h>
+#include <benchmark/benchmark.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+using uWS::SERVER;
+using uWS::CLIENT;
+
+///* text like the sensors send, compressing about as well
+std::string Payload(size_t length) {
+	const std::string line = "{\"sensor\":\"L\",\"x\":3.122427e-01,\"y\":5.803398e-01,\"t\":1477010443000000}\n";
+	std::string payload;
+	while (payload.length() < length) {
+		payload += line;
+	}
+	payload.resize(length);
+	return payload;
+}
+
+///* appends payload as a masked client frame; a fragment but the last has
+///* FIN cleared and all but the first are continuations
+void AppendFrame(std::string *stream, const char *payload, size_t length, bool first, bool fin, bool compressed) {
+	std::vector<char> frame(length + 14);
+	const size_t n = uWS::WebSocketProtocol<CLIENT>::formatMessage(frame.data(), payload, length, uWS::TEXT, length, compressed && first);
+	if (!fin) {
+		frame[0] &= 0x7f;
+	}
+	if (!first) {
+		frame[0] &= 0xf0;
+	}
+	stream->append(frame.data(), n);
+}
+
+/**
+ * A server connection fed by hand: it is adopted from one end of a
+ * socketpair by a Hub whose loop never runs, so consume sees only the
+ * frames given to Feed and nothing is read from or written to the socket.
+ */
+class Receiver {
+public:
+	explicit Receiver(int compression_options) : poll_(nullptr), received_(0) {
+		socketpair(AF_UNIX, SOCK_STREAM, 0, fds_);
+		hub_.onConnection([this](uWS::WebSocket<SERVER> ws, uWS::HttpRequest) {
+			poll_ = ws.getPollHandle();
+		});
+		hub_.onMessage([this](uWS::WebSocket<SERVER> ws, char *message, size_t length, uWS::OpCode) {
+			received_ += length;
+		});
+		hub_.adopt(fds_[0], compression_options, nullptr);
+		buffer_.resize(kPre + kReadLength + kPost);
+	}
+
+	///* the loop is run once more to close the Hub's handles, which it
+	///* leaves to whoever stops it
+	~Receiver() {
+		uWS::WebSocket<SERVER>(poll_).terminate();
+		close(fds_[1]);
+		uv_walk(hub_.getLoop(), [](uv_handle_t *handle, void *) {
+			if (!uv_is_closing(handle)) {
+				uv_close(handle, nullptr);
+			}
+		}, nullptr);
+		uv_run(hub_.getLoop(), UV_RUN_DEFAULT);
+	}
+
+	///* frames are deflated by the Hub's shared stream
+	uWS::Hub &hub() { return hub_; }
+
+	///* consumes stream in reads as large as the Hub's, as if it arrived
+	void Feed(const std::string &stream) {
+		uWS::WebSocketProtocol<SERVER> *protocol = static_cast<uWS::WebSocket<SERVER>::Data *>(poll_->data);
+		for (size_t offset = 0; offset < stream.length(); ) {
+			const size_t n = std::min(stream.length() - offset, (size_t) kReadLength);
+			//consume unmasks in place, so each pass starts from a copy
+			memcpy(buffer_.data() + kPre, stream.data() + offset, n);
+			protocol->consume(buffer_.data() + kPre, n, poll_);
+			offset += n;
+		}
+	}
+
+	size_t received() const { return received_; }
+
+private:
+	static const int kPre = uWS::WebSocketProtocol<SERVER>::CONSUME_PRE_PADDING;
+	static const int kPost = uWS::WebSocketProtocol<SERVER>::CONSUME_POST_PADDING;
+	static const int kReadLength = uWS::Hub::LARGE_BUFFER_SIZE;
+
+	uWS::Hub hub_;
+	int fds_[2];
+	uv_poll_t *poll_;
+	std::vector<char> buffer_;
+	size_t received_;
+};
+
+///* as many messages of length as fill about a read, at least one
+size_t MessagesPerPass(size_t length) {
+	return std::max((size_t) 1, (size_t) 256 * 1024 / length);
+}
+
+void BM_ConsumeFrames(benchmark::State &state) {
+	Receiver receiver(uWS::NO_OPTIONS);
+	const std::string payload = Payload(state.range(0));
+	std::string stream;
+	const size_t messages = MessagesPerPass(payload.length());
+	for (size_t i = 0; i < messages; i++) {
+		AppendFrame(&stream, payload.data(), payload.length(), true, true, false);
+	}
+	for (auto _ : state) {
+		receiver.Feed(stream);
+	}
+	benchmark::DoNotOptimize(receiver.received());
+	state.SetItemsProcessed(state.iterations() * messages);
+	state.SetBytesProcessed(state.iterations() * stream.length());
+}
+
+///* each message in range(1) fragments, reassembled in the FragmentPool's
+///* buffers
+void BM_ConsumeFragmented(benchmark::State &state) {
+	Receiver receiver(uWS::NO_OPTIONS);
+	const std::string payload = Payload(state.range(0));
+	const size_t fragments = state.range(1);
+	const size_t fragment_length = (payload.length() + fragments - 1) / fragments;
+	std::string stream;
+	const size_t messages = MessagesPerPass(payload.length());
+	for (size_t i = 0; i < messages; i++) {
+		for (size_t offset = 0; offset < payload.length(); offset += fragment_length) {
+			const size_t n = std::min(fragment_length, payload.length() - offset);
+			AppendFrame(&stream, payload.data() + offset, n, !offset, offset + n == payload.length(), false);
+		}
+	}
+	for (auto _ : state) {
+		receiver.Feed(stream);
+	}
+	benchmark::DoNotOptimize(receiver.received());
+	state.SetItemsProcessed(state.iterations() * messages);
+	state.SetBytesProcessed(state.iterations() * stream.length());
+}
+
+///* permessage-deflate without context takeover, inflated by the Hub's
+///* shared stream; bytes are those inflated
+void BM_ConsumeCompressed(benchmark::State &state) {
+	Receiver receiver(uWS::PERMESSAGE_DEFLATE | uWS::SERVER_NO_CONTEXT_TAKEOVER | uWS::CLIENT_NO_CONTEXT_TAKEOVER);
+	const std::string payload = Payload(state.range(0));
+	size_t length = payload.length();
+	const char *deflated = receiver.hub().deflate(payload.data(), length);
+	if (!deflated) {
+		state.SkipWithError("payload does not compress");
+		return;
+	}
+	const std::string compressed(deflated, length);
+	std::string stream;
+	const size_t messages = MessagesPerPass(payload.length());
+	for (size_t i = 0; i < messages; i++) {
+		AppendFrame(&stream, compressed.data(), compressed.length(), true, true, true);
+	}
+	for (auto _ : state) {
+		receiver.Feed(stream);
+	}
+	benchmark::DoNotOptimize(receiver.received());
+	state.SetItemsProcessed(state.iterations() * messages);
+	state.SetBytesProcessed(state.iterations() * messages * payload.length());
+}
+
+void BM_FormatMessage(benchmark::State &state) {
+	const std::string payload = Payload(state.range(0));
+	std::vector<char> frame(payload.length() + 10);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(uWS::WebSocketProtocol<SERVER>::formatMessage(frame.data(), payload.data(), payload.length(), uWS::TEXT, payload.length(), false));
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * payload.length());
+}
+
+///* a broadcast of 16 messages framed into one buffer
+void BM_PrepareMessageBatch(benchmark::State &state) {
+	std::vector<std::string> messages(16, Payload(state.range(0)));
+	std::vector<int> excluded;
+	for (auto _ : state) {
+		uWS::WebSocket<SERVER>::PreparedMessage *prepared = uWS::WebSocket<SERVER>::prepareMessageBatch(messages, excluded, uWS::TEXT, false);
+		benchmark::DoNotOptimize(prepared->buffer);
+		uWS::WebSocket<SERVER>::finalizeMessage(prepared);
+	}
+	state.SetItemsProcessed(state.iterations() * messages.size());
+	state.SetBytesProcessed(state.iterations() * messages.size() * messages[0].length());
+}
+
+///* the shared stream's deflate of an outgoing message
+void BM_Deflate(benchmark::State &state) {
+	Receiver receiver(uWS::NO_OPTIONS);
+	const std::string payload = Payload(state.range(0));
+	for (auto _ : state) {
+		size_t length = payload.length();
+		benchmark::DoNotOptimize(receiver.hub().deflate(payload.data(), length));
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * payload.length());
+}
+
+}
+
+//64 is a measurement line, 1K a reply, 16K the bulk lane's threshold
+BENCHMARK(BM_ConsumeFrames)->Arg(64)->Arg(1024)->Arg(16 * 1024)->Arg(256 * 1024);
+BENCHMARK(BM_ConsumeFragmented)->Args({1024, 4})->Args({64 * 1024, 16});
+BENCHMARK(BM_ConsumeCompressed)->Arg(1024)->Arg(16 * 1024)->Arg(256 * 1024);
+BENCHMARK(BM_FormatMessage)->Arg(64)->Arg(1024)->Arg(16 * 1024);
+BENCHMARK(BM_PrepareMessageBatch)->Arg(64)->Arg(1024);
+BENCHMARK(BM_Deflate)->Arg(1024)->Arg(16 * 1024);
+
+BENCHMARK_MAIN();
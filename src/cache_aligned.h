@@ -0,0 +1,39 @@
+#ifndef CACHE_ALIGNED_H_
+#define CACHE_ALIGNED_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+///* the cache line of the x86-64 and ARMv8 cores the server runs on
+const size_t kCacheLineSize = 64;
+
+/**
+ * Heap memory aligned to a cache line, for objects declared
+ * alignas(kCacheLineSize); C++11 operator new only aligns to 16 bytes.
+ */
+inline void *CacheAlignedMalloc(size_t size) {
+  void *p;
+  if (posix_memalign(&p, kCacheLineSize, size ? size : 1) != 0) {
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+    throw std::bad_alloc();
+#else
+    std::abort();
+#endif
+  }
+  return p;
+}
+
+/**
+ * Like EIGEN_MAKE_ALIGNED_OPERATOR_NEW, which it replaces in classes aligned
+ * to a cache line: their new and new[] return cache-aligned memory.
+ */
+#define CACHE_ALIGNED_OPERATOR_NEW \
+  void *operator new(size_t size) { return CacheAlignedMalloc(size); } \
+  void *operator new[](size_t size) { return CacheAlignedMalloc(size); } \
+  void operator delete(void *p) { std::free(p); } \
+  void operator delete[](void *p) { std::free(p); } \
+  void *operator new(size_t, void *p) { return p; } \
+  void operator delete(void *, void *) {}
+
+#endif /* CACHE_ALIGNED_H_ */
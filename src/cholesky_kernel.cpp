@@ -0,0 +1,78 @@
+#include "cholesky_kernel.h"
+#include "simd.h"
+#include "ukf_batch_lane.h"
+
+namespace {
+
+const int n_x = lane::n_x;
+
+/**
+* Factors V::width matrices starting at index i. Returns whether all of
+* them are positive definite; T is the lane type of V, double or float.
+*/
+template <class V, class T>
+inline bool FactorLanes(const T *const P[15], T *const L[25], int i) {
+	typedef typename V::Vec Vec;
+	const Vec zero = V::Set1(0.0);
+	Vec l[n_x][n_x];
+	typename V::Mask positive = V::Equal(zero, zero);
+	for (int c = 0; c < n_x; c++) {
+		Vec d = V::Load(P[lane::Packed(c, c)] + i);
+		for (int k = 0; k < c; k++) {
+			d = V::Sub(d, V::Mul(l[c][k], l[c][k]));
+		}
+		//a pivot that is negative or NaN fails the comparison
+		positive = V::And(positive, V::Greater(d, zero));
+		d = V::Sqrt(d);
+		l[c][c] = d;
+		for (int r = c + 1; r < n_x; r++) {
+			Vec e = V::Load(P[lane::Packed(c, r)] + i);
+			for (int k = 0; k < c; k++) {
+				e = V::Sub(e, V::Mul(l[r][k], l[c][k]));
+			}
+			l[r][c] = V::Div(e, d);
+		}
+	}
+	for (int r = 0; r < n_x; r++) {
+		for (int c = 0; c < n_x; c++) {
+			V::Store(L[r * n_x + c] + i, c <= r ? l[r][c] : zero);
+		}
+	}
+	return V::All(positive);
+}
+
+template <class V, class S, class T>
+inline int FactorAll(const T *const P[15], T *const L[25], int count, unsigned char *failed) {
+	int indefinite = 0;
+	int i = 0;
+	for (; i + V::width <= count; i += V::width) {
+		if (FactorLanes<V>(P, L, i)) {
+			for (int j = i; j < i + V::width; j++) {
+				failed[j] = 0;
+			}
+			continue;
+		}
+		//rare: find the lanes that failed by their pivots
+		for (int j = i; j < i + V::width; j++) {
+			failed[j] = !FactorLanes<S>(P, L, j);
+			indefinite += failed[j];
+		}
+	}
+	for (; i < count; i++) {
+		failed[i] = !FactorLanes<S>(P, L, i);
+		indefinite += failed[i];
+	}
+	return indefinite;
+}
+
+}
+
+int Cholesky5(const double *const P[15], double *const L[25], int n,
+              unsigned char *failed) {
+	return FactorAll<simd::NativeDouble, simd::ScalarDouble>(P, L, n, failed);
+}
+
+int Cholesky5(const float *const P[15], float *const L[25], int n,
+              unsigned char *failed) {
+	return FactorAll<simd::NativeFloat, simd::ScalarFloat>(P, L, n, failed);
+}
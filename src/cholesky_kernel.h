@@ -0,0 +1,32 @@
+#ifndef CHOLESKY_KERNEL_H_
+#define CHOLESKY_KERNEL_H_
+
+/**
+ * Lower Cholesky factors of n symmetric 5x5 matrices, the covariances of the
+ * tracks of a UKFBatch block, factored side by side.
+ *
+ * The matrices are given interleaved and packed: P[lane::Packed(r, c)][i] is
+ * entry (r, c) of matrix i, and L[r * 5 + c][i] receives entry (r, c) of its
+ * factor, zero above the diagonal. Matrices are factored simd::NativeDouble
+ * lanes at a time with the column-by-column algorithm of lane::Factor, one
+ * instruction stream for all of them.
+ *
+ * A matrix that is not positive definite, a pivot not greater than zero or
+ * not finite, leaves its factor undefined and its flag set: the caller
+ * factors it again in a way that copes, one matrix at a time.
+ * @param P 15 packed input arrays of n matrices each
+ * @param L 25 output arrays of n factors each, may not alias P
+ * @param n Number of matrices
+ * @param failed n flags, 1 where the matrix is not positive definite, else 0
+ * @return The number of matrices that are not
+ */
+int Cholesky5(const double *const P[15], double *const L[25], int n,
+              unsigned char *failed);
+
+/**
+ * The same in single precision, simd::NativeFloat lanes wide.
+ */
+int Cholesky5(const float *const P[15], float *const L[25], int n,
+              unsigned char *failed);
+
+#endif /* CHOLESKY_KERNEL_H_ */
@@ -0,0 +1,28 @@
+#ifndef COLD_TRACK_H_
+#define COLD_TRACK_H_
+
+/**
+ * The track of a session that has gone quiet, in the few values it needs
+ * to resume (see Session::Demote): the filter's state and the time it is
+ * true at, its covariance packed as the upper triangle, row by row, and
+ * the counts and RMSE of the track, without the sigma points, workspace
+ * and buffers of a whole Session. In float a record takes about 160 bytes,
+ * against some 8 KB for a session, so that a listener can keep the tracks
+ * of many silent sensors while only the sensors heard recently hold one.
+ */
+template <class Scalar>
+struct ColdTrack {
+  int id;
+  bool initialized;
+  bool consistent;
+  long long time_us;
+  long long measurements;
+  long long shed_redundant;
+  long long shed_low_information;
+  long long rmse_count;
+  Scalar x[5];
+  Scalar P[15];
+  Scalar rmse[4];
+};
+
+#endif /* COLD_TRACK_H_ */
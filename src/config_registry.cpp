@@ -0,0 +1,122 @@
+#include "config_registry.h"
+#include "json.hpp"
+#include <cmath>
+#include <mutex>
+
+using json = nlohmann::json;
+
+std::atomic<const UKFConfig *> ConfigRegistry::current_(&UKFConfig::Default());
+
+namespace {
+
+// serializes updates; the sessions never take it
+std::mutex update_mutex;
+
+bool ReadNumber(const json &object, const char *key, bool positive, double *value, std::string *error) {
+	json::const_iterator it = object.find(key);
+	if (it == object.end()) {
+		return true;
+	}
+	if (!it->is_number() || !std::isfinite(it->get<double>())
+		|| (positive ? it->get<double>() <= 0.0 : it->get<double>() < 0.0)) {
+		*error = std::string(key) + (positive ? " must be a number above 0" : " must be a number of 0 or above");
+		return false;
+	}
+	*value = it->get<double>();
+	return true;
+}
+
+bool ReadFlag(const json &object, const char *key, bool *value, std::string *error) {
+	json::const_iterator it = object.find(key);
+	if (it == object.end()) {
+		return true;
+	}
+	if (!it->is_boolean()) {
+		*error = std::string(key) + " must be true or false";
+		return false;
+	}
+	*value = it->get<bool>();
+	return true;
+}
+
+}
+
+const UKFConfig *ConfigRegistry::Parse(const std::string &json_text, const UKFConfig &base, std::string *error) {
+	json object;
+	try {
+		object = json::parse(json_text);
+	}
+	catch (const std::exception &) {
+		*error = "not JSON";
+		return nullptr;
+	}
+	if (!object.is_object()) {
+		*error = "not a JSON object";
+		return nullptr;
+	}
+	static const char *const keys[] = {"std_a", "std_yawdd", "std_laspx", "std_laspy", "std_radr", "std_radphi",
+	                                   "std_radrd", "use_laser", "use_radar", "gate_laser", "gate_radar",
+	                                   "linearize_radar"};
+	for (json::const_iterator it = object.begin(); it != object.end(); ++it) {
+		bool known = false;
+		for (const char *key : keys) {
+			known = known || it.key() == key;
+		}
+		if (!known) {
+			*error = "unknown member " + it.key();
+			return nullptr;
+		}
+	}
+
+	double std_a = base.std_a_, std_yawdd = base.std_yawdd_;
+	double std_laspx = base.std_laspx_, std_laspy = base.std_laspy_;
+	double std_radr = base.std_radr_, std_radphi = base.std_radphi_, std_radrd = base.std_radrd_;
+	bool use_laser = base.use_laser_, use_radar = base.use_radar_;
+	double gate_laser = base.gate_laser_, gate_radar = base.gate_radar_;
+	double linearize_radar = base.linearize_radar_;
+	if (!ReadNumber(object, "std_a", true, &std_a, error)
+		|| !ReadNumber(object, "std_yawdd", true, &std_yawdd, error)
+		|| !ReadNumber(object, "std_laspx", true, &std_laspx, error)
+		|| !ReadNumber(object, "std_laspy", true, &std_laspy, error)
+		|| !ReadNumber(object, "std_radr", true, &std_radr, error)
+		|| !ReadNumber(object, "std_radphi", true, &std_radphi, error)
+		|| !ReadNumber(object, "std_radrd", true, &std_radrd, error)
+		|| !ReadFlag(object, "use_laser", &use_laser, error)
+		|| !ReadFlag(object, "use_radar", &use_radar, error)
+		|| !ReadNumber(object, "gate_laser", false, &gate_laser, error)
+		|| !ReadNumber(object, "gate_radar", false, &gate_radar, error)
+		|| !ReadNumber(object, "linearize_radar", false, &linearize_radar, error)) {
+		return nullptr;
+	}
+	return new UKFConfig(std_a, std_yawdd, std_laspx, std_laspy, std_radr, std_radphi, std_radrd,
+	                     use_laser, use_radar, gate_laser, gate_radar, linearize_radar);
+}
+
+bool ConfigRegistry::Update(const std::string &json_text, std::string *error) {
+	std::lock_guard<std::mutex> lock(update_mutex);
+	const UKFConfig *config = Parse(json_text, Current(), error);
+	if (!config) {
+		return false;
+	}
+	// the old profile stays, for the filters that took it
+	current_.store(config, std::memory_order_release);
+	return true;
+}
+
+std::string ConfigRegistry::Json() {
+	const UKFConfig &config = Current();
+	json object;
+	object["std_a"] = config.std_a_;
+	object["std_yawdd"] = config.std_yawdd_;
+	object["std_laspx"] = config.std_laspx_;
+	object["std_laspy"] = config.std_laspy_;
+	object["std_radr"] = config.std_radr_;
+	object["std_radphi"] = config.std_radphi_;
+	object["std_radrd"] = config.std_radrd_;
+	object["use_laser"] = config.use_laser_;
+	object["use_radar"] = config.use_radar_;
+	object["gate_laser"] = config.gate_laser_;
+	object["gate_radar"] = config.gate_radar_;
+	object["linearize_radar"] = config.linearize_radar_;
+	return object.dump();
+}
@@ -0,0 +1,46 @@
+#ifndef CONFIG_REGISTRY_H_
+#define CONFIG_REGISTRY_H_
+
+#include "ukf_config.h"
+#include <atomic>
+#include <string>
+
+/**
+ * The sensor profile the sessions' filters use, retuned while they run, in
+ * the manner of RCU: an update builds a whole new UKFConfig from the current
+ * one and the changed values, deriving its noise matrices once, and
+ * publishes it with one atomic store. A session takes the current profile
+ * at the start of each step, with one load and no lock, so every step sees
+ * one profile throughout and the filters keep their state. Profiles are
+ * never freed, as in TrackRegistry, since a filter on another thread may
+ * still read the one it took; an update costs a few hundred bytes.
+ */
+class ConfigRegistry {
+public:
+  ///* the profile published last, at first UKFConfig::Default()
+  static const UKFConfig &Current() { return *current_.load(std::memory_order_acquire); }
+
+  /**
+   * Publishes the current profile with the values of a JSON object, the
+   * members of Json, left as they are where absent; false with a message
+   * in error, publishing nothing, if a value is missing its type or range
+   * (standard deviations above 0, gates 0 or above) or a member is unknown.
+   * Updates from several threads are published one at a time.
+   */
+  static bool Update(const std::string &json_text, std::string *error);
+
+  /**
+   * A new profile with the values of a JSON object as Update takes it, and
+   * those of base where absent; null with a message in error if Update
+   * would refuse it. The caller owns the profile.
+   */
+  static const UKFConfig *Parse(const std::string &json_text, const UKFConfig &base, std::string *error);
+
+  ///* the current profile as a JSON object of the values Update takes
+  static std::string Json();
+
+private:
+  static std::atomic<const UKFConfig *> current_;
+};
+
+#endif /* CONFIG_REGISTRY_H_ */
@@ -0,0 +1,185 @@
+#include "ctrv_kernel.h"
+#include "simd.h"
+
+namespace {
+
+/**
+* Sine and cosine of yaw, and how much both change as yaw turns by w to
+* yaw_p = yaw + w. One SinCos of yaw and a SinCosM1 of w give the changes by
+* angle addition, without the cancellation of sin(yaw_p) - sin(yaw), as
+* long as no lane turns by more than pi/4; a step turning further, across a
+* long gap, takes a second SinCos of yaw_p instead.
+*/
+template <class V>
+inline void TurnSinCos(typename V::Vec yaw, typename V::Vec w, typename V::Vec yaw_p,
+                       typename V::Vec *sin_yaw, typename V::Vec *cos_yaw,
+                       typename V::Vec *sin_change, typename V::Vec *cos_change) {
+	typedef typename V::Vec Vec;
+	simd::SinCos<V>(yaw, sin_yaw, cos_yaw);
+	if (V::All(V::Less(V::Abs(w), V::Set1(simd::kSinCosM1Limit)))) {
+		Vec sin_w, cos_w_m1;
+		simd::SinCosM1<V>(w, &sin_w, &cos_w_m1);
+		*sin_change = V::MulAdd(*sin_yaw, cos_w_m1, V::Mul(*cos_yaw, sin_w));
+		*cos_change = V::Sub(V::Mul(*cos_yaw, cos_w_m1), V::Mul(*sin_yaw, sin_w));
+	}
+	else {
+		Vec sin_yaw_p, cos_yaw_p;
+		simd::SinCos<V>(yaw_p, &sin_yaw_p, &cos_yaw_p);
+		*sin_change = V::Sub(sin_yaw_p, *sin_yaw);
+		*cos_change = V::Sub(cos_yaw_p, *cos_yaw);
+	}
+}
+
+/**
+* Propagates V::width points starting at index i with time steps dt; T is
+* the lane type of V, double or float.
+*/
+template <class V, class T>
+inline void PropagateLanes(const T *const in[7], T *const out[5],
+                           int i, typename V::Vec dt) {
+	typedef typename V::Vec Vec;
+	const Vec p_x = V::Load(in[0] + i);
+	const Vec p_y = V::Load(in[1] + i);
+	const Vec v = V::Load(in[2] + i);
+	const Vec yaw = V::Load(in[3] + i);
+	const Vec yawd = V::Load(in[4] + i);
+	const Vec nu_a = V::Load(in[5] + i);
+	const Vec nu_yawdd = V::Load(in[6] + i);
+
+	const Vec w = V::Mul(yawd, dt);
+	const Vec yaw_p = V::MulAdd(yawd, dt, yaw);
+	Vec sin_yaw, cos_yaw, sin_change, cos_change;
+	TurnSinCos<V>(yaw, w, yaw_p, &sin_yaw, &cos_yaw, &sin_change, &cos_change);
+
+	//turning and straight-line displacement, blended to avoid division by zero
+	const typename V::Mask turning = V::Greater(V::Abs(yawd), V::Set1(0.001));
+	const Vec v_yawd = V::Div(v, V::Select(turning, yawd, V::Set1(1.0)));
+	const Vec v_dt = V::Mul(v, dt);
+	const Vec dx = V::Select(turning, V::Mul(v_yawd, sin_change), V::Mul(v_dt, cos_yaw));
+	const Vec dy = V::Select(turning, V::Mul(V::Sub(V::Set1(0.0), v_yawd), cos_change), V::Mul(v_dt, sin_yaw));
+
+	//add noise
+	const Vec half_dt2 = V::Mul(V::Set1(0.5), V::Mul(dt, dt));
+	const Vec a_dt2 = V::Mul(nu_a, half_dt2);
+	V::Store(out[0] + i, V::MulAdd(a_dt2, cos_yaw, V::Add(p_x, dx)));
+	V::Store(out[1] + i, V::MulAdd(a_dt2, sin_yaw, V::Add(p_y, dy)));
+	V::Store(out[2] + i, V::MulAdd(nu_a, dt, v));
+	V::Store(out[3] + i, V::MulAdd(nu_yawdd, half_dt2, yaw_p));
+	V::Store(out[4] + i, V::MulAdd(nu_yawdd, dt, yawd));
+}
+
+/**
+* Propagates V::width points of the constant turn rate and acceleration
+* model starting at index i.
+*/
+template <class V>
+inline void PropagateCTRALanes(const double *const in[8], double *const out[6],
+                               int i, typename V::Vec dt, const double *turn,
+                               const double *accel) {
+	typedef typename V::Vec Vec;
+	const Vec turn_factor = V::Load(turn + i);
+	const Vec accel_factor = V::Load(accel + i);
+	const Vec p_x = V::Load(in[0] + i);
+	const Vec p_y = V::Load(in[1] + i);
+	const Vec v = V::Load(in[2] + i);
+	const Vec yaw = V::Load(in[3] + i);
+	const Vec yawd = V::Load(in[4] + i);
+	const Vec acc = V::Load(in[5] + i);
+	const Vec nu_a = V::Load(in[6] + i);
+	const Vec nu_yawdd = V::Mul(turn_factor, V::Load(in[7] + i));
+	const Vec w = V::Mul(turn_factor, yawd);
+	const Vec a = V::Mul(accel_factor, acc);
+
+	const Vec a_dt = V::Mul(a, dt);
+	const Vec yaw_p = V::MulAdd(w, dt, yaw);
+	const Vec v_p = V::Add(v, a_dt);
+	Vec sin_yaw, cos_yaw, sin_change, cos_change;
+	TurnSinCos<V>(yaw, V::Mul(w, dt), yaw_p, &sin_yaw, &cos_yaw, &sin_change, &cos_change);
+
+	//turning and straight-line displacement, blended as in PropagateLanes;
+	//v_p sin(yaw_p) - v sin(yaw) = a dt sin(yaw) + v_p (sin(yaw_p) - sin(yaw)),
+	//and likewise for the cosines
+	const typename V::Mask turning = V::Greater(V::Abs(w), V::Set1(0.001));
+	const Vec inv_w = V::Div(V::Set1(1.0), V::Select(turning, w, V::Set1(1.0)));
+	const Vec a_w2 = V::Mul(a, V::Mul(inv_w, inv_w));
+	const Vec turn_dx = V::MulAdd(a_w2, cos_change,
+	                              V::Mul(inv_w, V::MulAdd(a_dt, sin_yaw, V::Mul(v_p, sin_change))));
+	const Vec turn_dy = V::MulAdd(a_w2, sin_change,
+	                              V::Mul(inv_w, V::Sub(V::Set1(0.0), V::MulAdd(a_dt, cos_yaw, V::Mul(v_p, cos_change)))));
+	const Vec half_dt2 = V::Mul(V::Set1(0.5), V::Mul(dt, dt));
+	const Vec s = V::MulAdd(a, half_dt2, V::Mul(v, dt));
+	const Vec dx = V::Select(turning, turn_dx, V::Mul(s, cos_yaw));
+	const Vec dy = V::Select(turning, turn_dy, V::Mul(s, sin_yaw));
+
+	//add noise
+	const Vec a_dt2 = V::Mul(nu_a, half_dt2);
+	V::Store(out[0] + i, V::MulAdd(a_dt2, cos_yaw, V::Add(p_x, dx)));
+	V::Store(out[1] + i, V::MulAdd(a_dt2, sin_yaw, V::Add(p_y, dy)));
+	V::Store(out[2] + i, V::MulAdd(nu_a, dt, v_p));
+	V::Store(out[3] + i, V::MulAdd(nu_yawdd, half_dt2, yaw_p));
+	V::Store(out[4] + i, V::MulAdd(nu_yawdd, dt, yawd));
+	V::Store(out[5] + i, V::MulAdd(V::Mul(accel_factor, nu_a), dt, acc));
+}
+
+}
+
+void PropagateCTRV(const double *const in[7], double *const out[5], int n,
+                   double delta_t) {
+	typedef simd::NativeDouble V;
+	int i = 0;
+	for (; i + V::width <= n; i += V::width) {
+		PropagateLanes<V>(in, out, i, V::Set1(delta_t));
+	}
+	//remaining points with the same polynomials, one at a time
+	for (; i < n; i++) {
+		PropagateLanes<simd::ScalarDouble>(in, out, i, delta_t);
+	}
+}
+
+void PropagateCTRV(const double *const in[7], double *const out[5], int n,
+                   const double *delta_t) {
+	typedef simd::NativeDouble V;
+	int i = 0;
+	for (; i + V::width <= n; i += V::width) {
+		PropagateLanes<V>(in, out, i, V::Load(delta_t + i));
+	}
+	for (; i < n; i++) {
+		PropagateLanes<simd::ScalarDouble>(in, out, i, delta_t[i]);
+	}
+}
+
+void PropagateCTRA(const double *const in[8], double *const out[6], int n,
+                   double delta_t, const double *turn, const double *accel) {
+	typedef simd::NativeDouble V;
+	int i = 0;
+	for (; i + V::width <= n; i += V::width) {
+		PropagateCTRALanes<V>(in, out, i, V::Set1(delta_t), turn, accel);
+	}
+	for (; i < n; i++) {
+		PropagateCTRALanes<simd::ScalarDouble>(in, out, i, delta_t, turn, accel);
+	}
+}
+
+void PropagateCTRV(const float *const in[7], float *const out[5], int n,
+                   float delta_t) {
+	typedef simd::NativeFloat V;
+	int i = 0;
+	for (; i + V::width <= n; i += V::width) {
+		PropagateLanes<V>(in, out, i, V::Set1(delta_t));
+	}
+	for (; i < n; i++) {
+		PropagateLanes<simd::ScalarFloat>(in, out, i, delta_t);
+	}
+}
+
+void PropagateCTRV(const float *const in[7], float *const out[5], int n,
+                   const float *delta_t) {
+	typedef simd::NativeFloat V;
+	int i = 0;
+	for (; i + V::width <= n; i += V::width) {
+		PropagateLanes<V>(in, out, i, V::Load(delta_t + i));
+	}
+	for (; i < n; i++) {
+		PropagateLanes<simd::ScalarFloat>(in, out, i, delta_t[i]);
+	}
+}
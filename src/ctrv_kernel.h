@@ -0,0 +1,58 @@
+#ifndef CTRV_KERNEL_H_
+#define CTRV_KERNEL_H_
+
+/**
+ * Propagates n augmented sigma points through the CTRV process model.
+ *
+ * The points are given component-wise: in[k][i] is component k
+ * (p_x, p_y, v, yaw, yawd, nu_a, nu_yawdd) of point i, and out[k][i] receives
+ * predicted state component k. Points are evaluated several at a time with
+ * the widest instruction set the build enables (simd::NativeDouble); the
+ * straight-line and turning cases are blended without branches, so every
+ * lane follows the same instruction stream. A point takes one sine and
+ * cosine of its yaw; the turn over delta_t follows by angle addition from a
+ * short polynomial when no point turns by more than pi/4.
+ * @param in 7 input component arrays of n points each
+ * @param out 5 output component arrays of n points each, may not alias in
+ * @param n Number of points
+ * @param delta_t Time step in s, shared by all points
+ */
+void PropagateCTRV(const double *const in[7], double *const out[5], int n,
+                   double delta_t);
+
+/**
+ * As above, with a separate time step delta_t[i] for every point.
+ */
+void PropagateCTRV(const double *const in[7], double *const out[5], int n,
+                   const double *delta_t);
+
+/**
+ * The two above in single precision, simd::NativeFloat lanes wide, for the
+ * float UKFBatch.
+ */
+void PropagateCTRV(const float *const in[7], float *const out[5], int n,
+                   float delta_t);
+void PropagateCTRV(const float *const in[7], float *const out[5], int n,
+                   const float *delta_t);
+
+/**
+ * Propagates n augmented sigma points of the 6-d state
+ * (p_x, p_y, v, yaw, yawd, a) through the constant turn rate and
+ * acceleration model, with the noise terms (nu_a, nu_yawdd) as the last two
+ * of the 8 input components. Per point, turn[i] and accel[i] scale the turn
+ * rate and the acceleration with their noise (1 or 0), so that one call runs
+ * the sigma points of constant velocity (0, 0), CTRV (1, 0) and CTRA (1, 1)
+ * filters side by side; a point with accel 0 follows PropagateCTRV above.
+ * The acceleration of CTRA is a random walk driven by nu_a, which also acts
+ * on v and the position as in CTRV.
+ * @param in 8 input component arrays of n points each
+ * @param out 6 output component arrays of n points each, may not alias in
+ * @param n Number of points
+ * @param delta_t Time step in s, shared by all points
+ * @param turn Turn rate factor of every point
+ * @param accel Acceleration factor of every point
+ */
+void PropagateCTRA(const double *const in[8], double *const out[6], int n,
+                   double delta_t, const double *turn, const double *accel);
+
+#endif /* CTRV_KERNEL_H_ */
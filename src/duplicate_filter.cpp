@@ -0,0 +1,81 @@
+#include "duplicate_filter.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+///* the finalizer of splitmix64, which spreads every input bit over the hash
+inline uint64_t Mix(uint64_t h) {
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+}
+
+const size_t DuplicateFilter::kRecent;
+
+DuplicateFilter::DuplicateFilter() {
+	Reset();
+}
+
+void DuplicateFilter::Reset() {
+	std::fill(slots_, slots_ + kSlots, 0);
+	next_ = 0;
+	size_ = 0;
+}
+
+uint64_t DuplicateFilter::Hash(const MeasurementPackage &meas_package) {
+	uint64_t h = Mix(uint64_t(meas_package.timestamp_) ^ (uint64_t(meas_package.sensor_type_) << 62));
+	for (int i = 0; i < meas_package.raw_measurements_.size(); i++) {
+		uint64_t bits;
+		const double value = meas_package.raw_measurements_(i);
+		memcpy(&bits, &value, sizeof(bits));
+		h = Mix(h ^ bits);
+	}
+	// 0 marks an empty slot
+	return h ? h : 1;
+}
+
+bool DuplicateFilter::Seen(const MeasurementPackage &meas_package) {
+	const uint64_t hash = Hash(meas_package);
+	size_t slot = hash & (kSlots - 1);
+	for (; slots_[slot]; slot = (slot + 1) & (kSlots - 1)) {
+		if (slots_[slot] == hash) {
+			return true;
+		}
+	}
+
+	if (size_ == kRecent) {
+		Remove(recent_[next_]);
+		// the slot found above may have been moved into
+		for (slot = hash & (kSlots - 1); slots_[slot]; slot = (slot + 1) & (kSlots - 1));
+	}
+	else {
+		size_++;
+	}
+	slots_[slot] = hash;
+	recent_[next_] = hash;
+	next_ = (next_ + 1) % kRecent;
+	return false;
+}
+
+void DuplicateFilter::Remove(uint64_t hash) {
+	size_t hole = hash & (kSlots - 1);
+	while (slots_[hole] != hash) {
+		hole = (hole + 1) & (kSlots - 1);
+	}
+	slots_[hole] = 0;
+	// an entry after the hole moves into it unless its home slot lies
+	// cyclically within (hole, slot], where probing still finds it
+	for (size_t slot = (hole + 1) & (kSlots - 1); slots_[slot]; slot = (slot + 1) & (kSlots - 1)) {
+		const size_t home = slots_[slot] & (kSlots - 1);
+		if (((slot - home) & (kSlots - 1)) >= ((slot - hole) & (kSlots - 1))) {
+			slots_[hole] = slots_[slot];
+			slots_[slot] = 0;
+			hole = slot;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef DUPLICATE_FILTER_H_
+#define DUPLICATE_FILTER_H_
+
+#include "measurement_package.h"
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Recognizes the measurements a session has already seen, as sent again
+ * over a redundant network path, so that they are dropped before the
+ * filter: a duplicate would predict over no time and update the filter a
+ * second time with the same information, which costs a step and makes the
+ * covariance overconfident.
+ *
+ * A measurement is its sensor, timestamp and values, hashed to 64 bits; the
+ * hashes of the last kRecent measurements are kept in an open-addressing
+ * table with linear probing, of fixed size and cleared of the oldest as
+ * new ones come, so a check is a hash and a probe or two and never
+ * allocates. A copy arriving after kRecent others is taken as new.
+ */
+class DuplicateFilter {
+public:
+  ///* measurements remembered
+  static const size_t kRecent = 32;
+
+  DuplicateFilter();
+
+  /**
+   * Whether meas_package is one of the last kRecent measurements seen; if
+   * not, it is remembered as the latest.
+   */
+  bool Seen(const MeasurementPackage &meas_package);
+
+  ///* forgets all measurements, for a new track
+  void Reset();
+
+private:
+  ///* slots of the table, a power of two at twice kRecent; 0 is empty
+  static const size_t kSlots = 2 * kRecent;
+
+  uint64_t slots_[kSlots];
+  ///* the hashes remembered, oldest at next_ once all are used
+  uint64_t recent_[kRecent];
+  size_t next_;
+  size_t size_;
+
+  static uint64_t Hash(const MeasurementPackage &meas_package);
+
+  ///* removes hash from the table, moving the entries probed past it back
+  void Remove(uint64_t hash);
+};
+
+#endif /* DUPLICATE_FILTER_H_ */
@@ -0,0 +1,217 @@
+#include "estimate_log.h"
+#include "tools.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+
+///* longest line of one record
+const size_t kMaxLine = 512;
+
+///* tells logs apart in the threads' caches of their producers
+std::atomic<unsigned> next_serial(1);
+
+bool WriteAll(int fd, const char *data, size_t length) {
+	while (length) {
+		const ssize_t written = write(fd, data, length);
+		if (written < 0) {
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+bool EndsWith(const char *s, const char *suffix) {
+	const size_t n = strlen(s);
+	const size_t m = strlen(suffix);
+	return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+}
+
+const size_t EstimateLog::kRingCapacity;
+const size_t EstimateLog::kBatchSize;
+const int EstimateLog::kFlushInterval;
+
+EstimateLog::EstimateLog()
+	: fd_(-1), gz_(nullptr), ring_capacity_(0), serial_(0), producers_(nullptr), closing_(false),
+	  logged_(0), used_(0), failed_(false) {}
+
+EstimateLog::~EstimateLog() {
+	Close();
+}
+
+bool EstimateLog::Open(const char *path, size_t ring_capacity) {
+	Close();
+	fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd_ < 0) {
+		return false;
+	}
+	if (EndsWith(path, ".gz")) {
+		//level 1: most of the gain on these lines, at a fraction of the time
+		gz_ = gzdopen(fd_, "wb1");
+		if (!gz_) {
+			close(fd_);
+			fd_ = -1;
+			return false;
+		}
+	}
+	ring_capacity_ = ring_capacity;
+	serial_ = next_serial++;
+	closing_ = false;
+	logged_ = 0;
+	batch_.resize(kBatchSize + kMaxLine);
+	used_ = 0;
+	failed_ = false;
+
+	static const char header[] = "# track timestamp sensor p_x p_y v yaw yaw_rate NIS rmse_x rmse_y rmse_vx rmse_vy\n";
+	memcpy(&batch_[0], header, sizeof(header) - 1);
+	used_ = sizeof(header) - 1;
+	writer_ = std::thread(&EstimateLog::Write, this);
+	return true;
+}
+
+bool EstimateLog::Append(const EstimateRecord &record) {
+	//every thread looks its ring up once, and again only for another log
+	static thread_local unsigned local_serial = 0;
+	static thread_local Producer *local = nullptr;
+	if (local_serial != serial_) {
+		if (fd_ < 0) {
+			return false;
+		}
+		local = Register();
+		local_serial = serial_;
+	}
+	if (!local->ring.TryPush(record)) {
+		local->dropped.store(local->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return false;
+	}
+	return true;
+}
+
+EstimateLog::Producer *EstimateLog::Register() {
+	Producer *producer = new Producer(ring_capacity_);
+	producer->next = producers_.load(std::memory_order_relaxed);
+	while (!producers_.compare_exchange_weak(producer->next, producer, std::memory_order_release,
+	                                         std::memory_order_relaxed)) {
+	}
+	return producer;
+}
+
+void EstimateLog::Write() {
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point last_report = Clock::now();
+	long long reported = 0;
+	int idle = 0;
+	EstimateRecord record;
+	for (;;) {
+		//a log closing after this load has nothing more coming than what
+		//the rings hold now
+		const bool closing = closing_.load(std::memory_order_acquire);
+		long long popped = 0;
+		for (Producer *producer = producers_.load(std::memory_order_acquire); producer; producer = producer->next) {
+			while (producer->ring.TryPop(&record)) {
+				char *p = &batch_[used_];
+				p += sprintf(p, "%d %lld %c", record.id, record.timestamp, record.sensor);
+				for (int i = 0; i < 5; i++) {
+					*p++ = ' ';
+					p = FormatFixed(p, record.x[i]);
+				}
+				*p++ = ' ';
+				p = FormatFixed(p, record.nis);
+				for (int i = 0; i < 4; i++) {
+					*p++ = ' ';
+					p = FormatFixed(p, record.rmse[i]);
+				}
+				*p++ = '\n';
+				used_ = p - &batch_[0];
+				if (used_ >= kBatchSize) {
+					WriteBatch();
+				}
+				popped++;
+			}
+		}
+		logged_.store(logged_.load(std::memory_order_relaxed) + popped, std::memory_order_relaxed);
+
+		const Clock::time_point now = Clock::now();
+		if (now - last_report >= std::chrono::seconds(1)) {
+			const long long total = dropped();
+			if (total != reported) {
+				std::cerr << "Estimate log falling behind, " << total - reported << " estimates dropped" << std::endl;
+				reported = total;
+			}
+			last_report = now;
+		}
+
+		if (popped) {
+			idle = 0;
+			continue;
+		}
+		if (closing) {
+			break;
+		}
+		if (used_ && ++idle >= kFlushInterval) {
+			WriteBatch();
+			idle = 0;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	WriteBatch();
+}
+
+void EstimateLog::WriteBatch() {
+	if (!used_) {
+		return;
+	}
+	bool ok;
+	if (gz_) {
+		ok = gzwrite(static_cast<gzFile>(gz_), &batch_[0], unsigned(used_)) == int(used_);
+	}
+	else {
+		ok = WriteAll(fd_, &batch_[0], used_);
+	}
+	failed_ = failed_ || !ok;
+	used_ = 0;
+}
+
+bool EstimateLog::Close() {
+	if (fd_ < 0) {
+		return true;
+	}
+	closing_.store(true, std::memory_order_release);
+	writer_.join();
+
+	bool ok = !failed_;
+	if (gz_) {
+		ok = gzclose(static_cast<gzFile>(gz_)) == Z_OK && ok;
+		gz_ = nullptr;
+	}
+	else {
+		ok = close(fd_) == 0 && ok;
+	}
+	fd_ = -1;
+	serial_ = 0;
+
+	Producer *producer = producers_.exchange(nullptr);
+	while (producer) {
+		Producer *next = producer->next;
+		delete producer;
+		producer = next;
+	}
+	return ok;
+}
+
+long long EstimateLog::dropped() const {
+	long long total = 0;
+	for (Producer *producer = producers_.load(std::memory_order_acquire); producer; producer = producer->next) {
+		total += producer->dropped.load(std::memory_order_relaxed);
+	}
+	return total;
+}
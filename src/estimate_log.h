@@ -0,0 +1,113 @@
+#ifndef ESTIMATE_LOG_H_
+#define ESTIMATE_LOG_H_
+
+#include "spsc_ring.h"
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * One estimate of a session, as it is logged.
+ */
+struct EstimateRecord {
+  int id;
+  ///* 'L' or 'R'
+  char sensor;
+  ///* in us
+  long long timestamp;
+  ///* p_x p_y v yaw yaw_rate
+  double x[5];
+  ///* of the measurement's sensor
+  double nis;
+  ///* cumulative, of p_x p_y v_x v_y
+  double rmse[4];
+};
+
+/**
+ * Writes the estimates of the sessions of all event loop threads to a file,
+ * without file I/O on those threads. Every thread that appends gets an
+ * SpscRing of its own to a writer thread, which formats the records as
+ * lines like those of --replay, preceded by the track id:
+ *   track timestamp sensor p_x p_y v yaw yaw_rate NIS rmse_x rmse_y rmse_vx rmse_vy
+ * into a batch and writes a full batch at once, or the batch so far when no
+ * record has come for kFlushInterval. A path ending in .gz is compressed
+ * with zlib on the writer thread.
+ *
+ * An append that finds its ring full drops the record and counts it rather
+ * than wait; the writer reports new drops on stderr at most once a second.
+ */
+class EstimateLog {
+public:
+  ///* records a thread may have waiting, by default
+  static const size_t kRingCapacity = 8192;
+  ///* bytes of formatted lines written at once
+  static const size_t kBatchSize = 1 << 20;
+  ///* in ms
+  static const int kFlushInterval = 100;
+
+  EstimateLog();
+
+  ///* closes the log
+  ~EstimateLog();
+
+  /**
+   * Creates the log at path and starts the writer thread.
+   * @param ring_capacity Records each appending thread may have waiting
+   * @return false if the file cannot be created
+   */
+  bool Open(const char *path, size_t ring_capacity = kRingCapacity);
+
+  /**
+   * Queues record on the calling thread's ring, from any thread.
+   * @return false if the record was dropped or the log is not open
+   */
+  bool Append(const EstimateRecord &record);
+
+  /**
+   * Writes the records still queued and closes the file; no thread may be
+   * appending any more.
+   * @return false if a write failed at any time
+   */
+  bool Close();
+
+  ///* records written, and dropped by Append
+  long long logged() const { return logged_.load(std::memory_order_relaxed); }
+  long long dropped() const;
+
+private:
+  ///* the ring of one appending thread
+  struct Producer {
+    SpscRing<EstimateRecord> ring;
+    std::atomic<long long> dropped;
+    Producer *next;
+
+    explicit Producer(size_t capacity) : ring(capacity), dropped(0), next(nullptr) {}
+
+    CACHE_ALIGNED_OPERATOR_NEW
+  };
+
+  int fd_;
+  void *gz_;
+  size_t ring_capacity_;
+  ///* tells the threads' cached producers of an earlier log apart
+  unsigned serial_;
+  std::atomic<Producer *> producers_;
+  std::atomic<bool> closing_;
+  std::thread writer_;
+  std::atomic<long long> logged_;
+
+  ///* the writer thread's
+  std::vector<char> batch_;
+  size_t used_;
+  bool failed_;
+
+  Producer *Register();
+  void Write();
+  void WriteBatch();
+
+  EstimateLog(const EstimateLog &);
+  EstimateLog &operator=(const EstimateLog &);
+};
+
+#endif /* ESTIMATE_LOG_H_ */
@@ -0,0 +1,87 @@
+#include "fixed_lag_smoother.h"
+#include "angle.h"
+
+FixedLagSmoother::FixedLagSmoother(size_t lag)
+	: steps_((lag > 0 ? lag : 1) + 1), head_(0), size_(0), drained_(false) {}
+
+FixedLagSmoother::Step &FixedLagSmoother::Push(long long timestamp) {
+	Step &step = at(size_++);
+	step.timestamp = timestamp;
+	return step;
+}
+
+bool FixedLagSmoother::Process(CTRVUKF &ukf, const MeasurementPackage &meas_package, SmoothedState *smoothed) {
+	if (!ukf.is_initialized_) {
+		ukf.ProcessMeasurement(meas_package);
+		//the first step has nothing before it to predict from or smooth into
+		Step &step = Push(ukf.time_us_);
+		step.x_predicted = ukf.x_;
+		step.P_predicted = ukf.P_;
+		step.gain.setZero();
+		step.x_filtered = ukf.x_;
+		step.P_filtered = ukf.P_;
+		return false;
+	}
+
+	const long long time_us = ukf.time_us_;
+	ukf.StateAt(meas_package.timestamp_);
+	bool emitted = false;
+	if (ukf.time_us_ != time_us) {
+		//a new step: the oldest has lag complete steps after it now
+		if (size_ == steps_.size()) {
+			Smooth();
+			Pop(smoothed);
+			emitted = true;
+		}
+		Step &step = Push(ukf.time_us_);
+		step.x_predicted = ukf.x_;
+		step.P_predicted = ukf.P_;
+		CTRVUKF::StateMatrix C;
+		ukf.PredictionCrossCovariance(&C);
+		//G = C P^-1, solved as G^T = P^-1 C^T with P symmetric
+		step.gain = step.P_predicted.ldlt().solve(C.transpose()).transpose();
+	}
+	//the filter has predicted already, so this is only the update
+	ukf.ProcessMeasurement(meas_package);
+	Step &step = at(size_ - 1);
+	step.x_filtered = ukf.x_;
+	step.P_filtered = ukf.P_;
+	return emitted;
+}
+
+void FixedLagSmoother::Smooth() {
+	Step &newest = at(size_ - 1);
+	newest.x_smoothed = newest.x_filtered;
+	newest.P_smoothed = newest.P_filtered;
+	for (size_t j = size_ - 1; j > 0; j--) {
+		const Step &next = at(j);
+		Step &step = at(j - 1);
+		CTRVUKF::StateVector x_diff = next.x_smoothed - next.x_predicted;
+		x_diff(3) = NormalizeAngle(x_diff(3));
+		step.x_smoothed = step.x_filtered;
+		step.x_smoothed.noalias() += next.gain * x_diff;
+		step.P_smoothed = step.P_filtered;
+		step.P_smoothed.noalias() += next.gain * (next.P_smoothed - next.P_predicted) * next.gain.transpose();
+	}
+}
+
+void FixedLagSmoother::Pop(SmoothedState *smoothed) {
+	const Step &oldest = at(0);
+	smoothed->timestamp = oldest.timestamp;
+	smoothed->x = oldest.x_smoothed;
+	smoothed->P = oldest.P_smoothed;
+	head_ = (head_ + 1) % steps_.size();
+	size_--;
+}
+
+bool FixedLagSmoother::Drain(SmoothedState *smoothed) {
+	if (!drained_ && size_) {
+		Smooth();
+		drained_ = true;
+	}
+	if (!size_) {
+		return false;
+	}
+	Pop(smoothed);
+	return true;
+}
@@ -0,0 +1,87 @@
+#ifndef FIXED_LAG_SMOOTHER_H_
+#define FIXED_LAG_SMOOTHER_H_
+
+#include "measurement_package.h"
+#include "ukf.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * Fixed-lag unscented Rauch-Tung-Striebel smoother for one filter. Every
+ * filter step (measurements of one timestamp) keeps the filtered and the
+ * predicted moments and the smoother gain from the cross-covariance of the
+ * prediction; a step is smoothed backwards over the lag steps after it and
+ * then leaves the window, so memory stays fixed however long the sequence.
+ * The window is allocated at construction and processing does not allocate.
+ */
+class FixedLagSmoother {
+public:
+  /**
+   * A step smoothed with the measurements up to lag steps after it
+   */
+  struct SmoothedState {
+    long long timestamp;
+    CTRVUKF::StateVector x;
+    CTRVUKF::StateMatrix P;
+  };
+
+  /**
+   * @param lag Steps the smoothed states trail the filter by, at least 1
+   */
+  explicit FixedLagSmoother(size_t lag);
+
+  /**
+   * Filters meas_package with ukf, which must only be run through this
+   * smoother, in time order. The filter predicts to every new timestamp,
+   * even for a sensor it ignores.
+   * @return Whether smoothed was set, to the oldest step once lag newer
+   * ones are complete
+   */
+  bool Process(CTRVUKF &ukf, const MeasurementPackage &meas_package, SmoothedState *smoothed);
+
+  /**
+   * At the end of the data: smooths the steps still in the window with
+   * everything filtered, then returns them oldest first, one per call.
+   * @return false once there are none left
+   */
+  bool Drain(SmoothedState *smoothed);
+
+  size_t lag() const { return steps_.size() - 1; }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  struct Step {
+    long long timestamp;
+    ///* filtered, after the measurements of the step
+    CTRVUKF::StateVector x_filtered;
+    CTRVUKF::StateMatrix P_filtered;
+    ///* predicted from the step before, and the gain of the smoother back
+    ///* into it, C P_predicted^-1
+    CTRVUKF::StateVector x_predicted;
+    CTRVUKF::StateMatrix P_predicted;
+    CTRVUKF::StateMatrix gain;
+    ///* results of the backward pass
+    CTRVUKF::StateVector x_smoothed;
+    CTRVUKF::StateMatrix P_smoothed;
+  };
+
+  std::vector<Step> steps_;
+  ///* oldest step in the ring, and number of steps
+  size_t head_;
+  size_t size_;
+  bool drained_;
+
+  Step &at(size_t i) { return steps_[(head_ + i) % steps_.size()]; }
+
+  ///* appends a step, which must not make the window overflow
+  Step &Push(long long timestamp);
+
+  ///* the backward pass from the newest step over the whole window
+  void Smooth();
+
+  ///* returns the oldest step, smoothed, and drops it
+  void Pop(SmoothedState *smoothed);
+};
+
+#endif /* FIXED_LAG_SMOOTHER_H_ */
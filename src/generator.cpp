@@ -0,0 +1,269 @@
+#include "generator.h"
+#include "angle.h"
+#include "ctrv_kernel.h"
+#include "measurement_log.h"
+#include "measurement_package.h"
+#include "measurement_record.h"
+#include "ukf_config.h"
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <thread>
+
+namespace {
+
+///* the first timestamp of every track, that of the simulator's data files
+const long long kStartTimestamp = 1477010443000000LL;
+
+///* formatted line; ten numbers take far less
+const int kMaxLine = 256;
+
+}
+
+GeneratorOptions::GeneratorOptions()
+	: seed(1), tracks(1), measurements(500), interval_us(50000),
+	  threads(1), binary(false), log(false), compress(false), scene(false) {
+	const UKFConfig &config = UKFConfig::Default();
+	std_a = config.std_a_;
+	std_yawdd = config.std_yawdd_;
+	std_laspx = config.std_laspx_;
+	std_laspy = config.std_laspy_;
+	std_radr = config.std_radr_;
+	std_radphi = config.std_radphi_;
+	std_radrd = config.std_radrd_;
+}
+
+void GenerateTrack(const GeneratorOptions &options, int track, std::vector<char> *out) {
+	std::seed_seq seq{(unsigned) options.seed, (unsigned) (options.seed >> 32), (unsigned) track};
+	std::mt19937_64 random(seq);
+	std::normal_distribution<double> normal(0.0, 1.0);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+	// p_x, p_y, v, yaw, yaw_rate, nu_a, nu_yawdd as PropagateCTRV reads them
+	double state[7];
+	double range = 5.0 + 45.0 * uniform(random);
+	double bearing = 2.0 * M_PI * uniform(random);
+	state[0] = range * cos(bearing);
+	state[1] = range * sin(bearing);
+	state[2] = 1.0 + 9.0 * uniform(random);
+	state[3] = NormalizeAngle(2.0 * M_PI * uniform(random));
+	state[4] = 0.6 * uniform(random) - 0.3;
+	double predicted[5];
+	const double *in[7];
+	double *next[5];
+	for (int k = 0; k < 7; k++) {
+		in[k] = &state[k];
+	}
+	for (int k = 0; k < 5; k++) {
+		next[k] = &predicted[k];
+	}
+	const double delta_t = options.interval_us / 1000000.0;
+
+	//a log is written from the measurement records
+	const bool binary = options.binary || options.log;
+	MeasurementPackage meas_package;
+	const size_t record_size = record::kMeasurementSize + record::kGroundTruthSize;
+	out->reserve(out->size() + options.measurements * (binary ? record_size : 100));
+	for (int i = 0; i < options.measurements; i++) {
+		if (i > 0) {
+			state[5] = options.std_a * normal(random);
+			state[6] = options.std_yawdd * normal(random);
+			PropagateCTRV(in, next, 1, delta_t);
+			for (int k = 0; k < 5; k++) {
+				state[k] = predicted[k];
+			}
+			state[3] = NormalizeAngle(state[3]);
+		}
+
+		const double p_x = state[0];
+		const double p_y = state[1];
+		const double v_x = cos(state[3]) * state[2];
+		const double v_y = sin(state[3]) * state[2];
+		meas_package.timestamp_ = kStartTimestamp + i * options.interval_us;
+		if (i % 2 == 0) {
+			meas_package.sensor_type_ = MeasurementPackage::LASER;
+			meas_package.raw_measurements_.resize(2);
+			meas_package.raw_measurements_ << p_x + options.std_laspx * normal(random),
+				p_y + options.std_laspy * normal(random);
+		}
+		else {
+			const double rho = sqrt(p_x*p_x + p_y*p_y);
+			const double rho_dot = rho > 0.001 ? (p_x*v_x + p_y*v_y) / rho : 0.0;
+			meas_package.sensor_type_ = MeasurementPackage::RADAR;
+			meas_package.raw_measurements_.resize(3);
+			meas_package.raw_measurements_ << rho + options.std_radr * normal(random),
+				NormalizeAngle(atan2(p_y, p_x) + options.std_radphi * normal(random)),
+				rho_dot + options.std_radrd * normal(random);
+		}
+
+		if (binary) {
+			Eigen::Vector4d ground_truth(p_x, p_y, v_x, v_y);
+			size_t used = out->size();
+			out->resize(used + record_size);
+			record::EncodeMeasurement(&(*out)[used], meas_package, &ground_truth);
+			continue;
+		}
+		char line[kMaxLine];
+		const MeasurementPackage::Vector &z = meas_package.raw_measurements_;
+		int n;
+		if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
+			n = snprintf(line, sizeof(line), "L\t%.6f\t%.6f\t%lld", z(0), z(1),
+			             (long long) meas_package.timestamp_);
+		}
+		else {
+			n = snprintf(line, sizeof(line), "R\t%.6f\t%.6f\t%.6f\t%lld", z(0), z(1), z(2),
+			             (long long) meas_package.timestamp_);
+		}
+		n += snprintf(line + n, sizeof(line) - n, "\t%.6f\t%.6f\t%.6f\t%.6f\t%.6f\t%.6f\n",
+		              p_x, p_y, v_x, v_y, state[3], state[4]);
+		out->insert(out->end(), line, line + n);
+	}
+}
+
+std::string TrackPath(const std::string &output_path, int track, int tracks) {
+	if (tracks == 1) {
+		return output_path;
+	}
+	size_t slash = output_path.find_last_of('/');
+	size_t dot = output_path.find_last_of('.');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash) || dot == slash + 1) {
+		dot = output_path.size();
+	}
+	return output_path.substr(0, dot) + "-" + std::to_string(track) + output_path.substr(dot);
+}
+
+namespace {
+
+/**
+* Appends the measurement records in [begin, end) to recorder as track.
+*/
+void AppendRecords(const char *begin, const char *end, uint32_t track, MeasurementLogRecorder *recorder) {
+	MeasurementPackage meas_package;
+	Eigen::Vector4d ground_truth;
+	bool has_ground_truth;
+	while (begin != end && (begin = record::DecodeMeasurement(begin, end, &meas_package, &ground_truth, &has_ground_truth))) {
+		recorder->Append(meas_package, has_ground_truth ? &ground_truth : nullptr, track);
+	}
+}
+
+/**
+* Generates all tracks and interleaves them measurement by measurement into
+* output_path: as the tracks share their timestamps and sensors, each group
+* of lines is one scan of the scene.
+*/
+int GenerateScene(const GeneratorOptions &options, const char *output_path) {
+	std::vector<std::vector<char> > tracks(options.tracks);
+	std::atomic<int> next_track(0);
+	auto generate = [&]() {
+		int track;
+		while ((track = next_track++) < options.tracks) {
+			GenerateTrack(options, track, &tracks[track]);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int i = 1; i < options.threads && i < options.tracks; i++) {
+		threads.emplace_back(generate);
+	}
+	generate();
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	MeasurementLogRecorder recorder;
+	FILE *out = nullptr;
+	bool ok = options.log ? recorder.Open(output_path, measurement_log::kDefaultBlockCapacity, 8, true, options.compress)
+	                      : (out = fopen(output_path, options.binary ? "wb" : "w")) != nullptr;
+	const size_t record_size = record::kMeasurementSize + record::kGroundTruthSize;
+	std::vector<size_t> read(options.tracks, 0);
+	for (int i = 0; i < options.measurements && ok; i++) {
+		for (int track = 0; track < options.tracks && ok; track++) {
+			const std::vector<char> &data = tracks[track];
+			size_t begin = read[track];
+			size_t end = begin + record_size;
+			if (!options.binary && !options.log) {
+				end = begin;
+				while (data[end++] != '\n') {
+				}
+			}
+			if (options.log) {
+				AppendRecords(&data[begin], &data[end], track, &recorder);
+			}
+			else {
+				ok = fwrite(&data[begin], 1, end - begin, out) == end - begin;
+			}
+			read[track] = end;
+		}
+	}
+	if (out) {
+		ok = fclose(out) == 0 && ok;
+	}
+	if (options.log) {
+		ok = recorder.Close() && ok;
+	}
+	if (!ok) {
+		std::cerr << "Cannot write " << output_path << std::endl;
+		return 1;
+	}
+	std::cout << "Generated a scene of " << options.tracks << " tracks of " << options.measurements
+		<< " measurements with seed " << options.seed << std::endl;
+	return 0;
+}
+
+}
+
+int RunGenerate(const GeneratorOptions &options, const char *output_path) {
+	if (options.scene) {
+		return GenerateScene(options, output_path);
+	}
+
+	// the threads take the next track to generate until all are written
+	std::atomic<int> next_track(0);
+	std::atomic<int> failed(-1);
+	auto generate = [&]() {
+		std::vector<char> data;
+		int track;
+		while ((track = next_track++) < options.tracks) {
+			data.clear();
+			GenerateTrack(options, track, &data);
+			std::string path = TrackPath(output_path, track, options.tracks);
+			bool ok;
+			if (options.log) {
+				MeasurementLogRecorder recorder;
+				ok = recorder.Open(path.c_str(), measurement_log::kDefaultBlockCapacity, 8, true, options.compress);
+				if (ok) {
+					AppendRecords(data.data(), data.data() + data.size(), track, &recorder);
+					ok = recorder.Close();
+				}
+			}
+			else {
+				FILE *out = fopen(path.c_str(), options.binary ? "wb" : "w");
+				ok = out && fwrite(data.data(), 1, data.size(), out) == data.size();
+				if (out) {
+					ok = fclose(out) == 0 && ok;
+				}
+			}
+			if (!ok) {
+				failed = track;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < options.threads && i < options.tracks; i++) {
+		threads.emplace_back(generate);
+	}
+	generate();
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	if (failed >= 0) {
+		std::cerr << "Cannot write " << TrackPath(output_path, failed, options.tracks) << std::endl;
+		return 1;
+	}
+	std::cout << "Generated " << options.tracks << " tracks of " << options.measurements
+		<< " measurements with seed " << options.seed << std::endl;
+	return 0;
+}
@@ -0,0 +1,87 @@
+#ifndef GENERATOR_H_
+#define GENERATOR_H_
+
+#include <string>
+#include <vector>
+
+/**
+ * Parameters of a synthetic data set. The noise levels default to those the
+ * filter assumes (UKFConfig::Default), so the generated tracks are exactly as
+ * the filter models them.
+ */
+struct GeneratorOptions {
+  ///* seed of the whole data set; every track draws from a stream of its
+  ///* own, so the data do not depend on the number of threads
+  unsigned long long seed;
+
+  ///* number of independent tracks, each written to a file of its own
+  int tracks;
+
+  ///* measurements per track, lidar and radar in turn
+  int measurements;
+
+  ///* time between two measurements of a track in us
+  long long interval_us;
+
+  ///* threads generating tracks in parallel
+  int threads;
+
+  ///* write binary measurement records with ground truth (see
+  ///* measurement_record.h) instead of L/R lines
+  bool binary;
+
+  ///* write a measurement log (see measurement_log.h) of each track, or of
+  ///* the scene, with the track number as the track id
+  bool log;
+
+  ///* deflate the blocks of the log, for replay to inflate in parallel
+  bool compress;
+
+  ///* write all tracks into one file as a scene of many targets, the
+  ///* measurements of all tracks at one time together, for the tracker
+  bool scene;
+
+  ///* process noise of the CTRV ground truth, in m/s^2 and rad/s^2
+  double std_a;
+  double std_yawdd;
+
+  ///* measurement noise of lidar (m) and radar (m, rad, m/s)
+  double std_laspx;
+  double std_laspy;
+  double std_radr;
+  double std_radphi;
+  double std_radrd;
+
+  GeneratorOptions();
+};
+
+/**
+ * Appends track number track of the data set to out.
+ *
+ * The ground truth starts from a random state 5 to 50 m from the sensor and
+ * follows the CTRV process model of UKF::Prediction (PropagateCTRV), with
+ * normally distributed longitudinal and yaw accelerations drawn for every
+ * interval. Each measurement is the true position (lidar) or range, bearing
+ * and range rate (radar) plus normal noise. Lines have the layout of the
+ * simulator's data files:
+ *
+ *   L p_x p_y timestamp x_gt y_gt vx_gt vy_gt yaw_gt yaw_rate_gt
+ *   R rho phi rho_dot timestamp x_gt y_gt vx_gt vy_gt yaw_gt yaw_rate_gt
+ */
+void GenerateTrack(const GeneratorOptions &options, int track, std::vector<char> *out);
+
+/**
+ * The file track number track is written to: output_path itself for a
+ * single track, otherwise output_path with "-<track>" inserted before its
+ * extension.
+ */
+std::string TrackPath(const std::string &output_path, int track, int tracks);
+
+/**
+ * Generates the data set into the files of TrackPath, or with scene into
+ * output_path alone.
+ * @return 0 on success, non-zero if a file cannot be written
+ */
+int RunGenerate(const GeneratorOptions &options, const char *output_path);
+
+#endif /* GENERATOR_H_ */
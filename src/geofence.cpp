@@ -0,0 +1,157 @@
+#include "geofence.h"
+#include "json.hpp"
+#include <algorithm>
+#include <cmath>
+
+// for convenience
+using json = nlohmann::json;
+
+const double Geofence::kCellSize = 50.0;
+const long long Geofence::kMaxZoneCells;
+
+uint64_t Geofence::CellKey(long long cx, long long cy) {
+	return uint64_t(cx) << 32 ^ uint64_t(uint32_t(cy));
+}
+
+bool Geofence::Parse(const std::string &text, std::string *error) {
+	json document;
+	try {
+		document = json::parse(text);
+	}
+	catch (const std::exception &) {
+		*error = "not JSON";
+		return false;
+	}
+	if (!document.is_array()) {
+		*error = "not a JSON array";
+		return false;
+	}
+	std::vector<Zone> zones;
+	std::unordered_map<uint64_t, std::vector<int> > cells;
+	for (const json &item : document) {
+		Zone zone;
+		double bounds[4];
+		if (!item.is_object() || !item.count("name") || !item["name"].is_string()) {
+			*error = "every zone has a name";
+			return false;
+		}
+		zone.name = item["name"].get<std::string>();
+		if (item.count("circle")) {
+			const json &circle = item["circle"];
+			if (!circle.is_array() || circle.size() != 3 || !circle[0].is_number() || !circle[1].is_number()
+			    || !circle[2].is_number() || circle[2].get<double>() <= 0.0) {
+				*error = "the circle of " + zone.name + " is not [x, y, radius]";
+				return false;
+			}
+			zone.circle = true;
+			zone.cx = circle[0].get<double>();
+			zone.cy = circle[1].get<double>();
+			zone.radius = circle[2].get<double>();
+			bounds[0] = zone.cx - zone.radius;
+			bounds[1] = zone.cy - zone.radius;
+			bounds[2] = zone.cx + zone.radius;
+			bounds[3] = zone.cy + zone.radius;
+		}
+		else if (item.count("polygon") && item["polygon"].is_array() && item["polygon"].size() >= 3) {
+			zone.circle = false;
+			zone.cx = zone.cy = zone.radius = 0.0;
+			bounds[0] = bounds[1] = HUGE_VAL;
+			bounds[2] = bounds[3] = -HUGE_VAL;
+			for (const json &vertex : item["polygon"]) {
+				if (!vertex.is_array() || vertex.size() != 2 || !vertex[0].is_number() || !vertex[1].is_number()) {
+					*error = "a vertex of " + zone.name + " is not [x, y]";
+					return false;
+				}
+				const double x = vertex[0].get<double>(), y = vertex[1].get<double>();
+				zone.polygon.push_back(x);
+				zone.polygon.push_back(y);
+				bounds[0] = std::min(bounds[0], x);
+				bounds[1] = std::min(bounds[1], y);
+				bounds[2] = std::max(bounds[2], x);
+				bounds[3] = std::max(bounds[3], y);
+			}
+		}
+		else {
+			*error = zone.name + " has neither a circle nor a polygon of three vertices or more";
+			return false;
+		}
+		if (!(std::isfinite(bounds[0]) && std::isfinite(bounds[1]) && std::isfinite(bounds[2]) && std::isfinite(bounds[3]))) {
+			*error = zone.name + " is not finite";
+			return false;
+		}
+		const double x0 = floor(bounds[0] / kCellSize), x1 = floor(bounds[2] / kCellSize);
+		const double y0 = floor(bounds[1] / kCellSize), y1 = floor(bounds[3] / kCellSize);
+		if ((x1 - x0 + 1) * (y1 - y0 + 1) > kMaxZoneCells) {
+			*error = zone.name + " is too large";
+			return false;
+		}
+		const int index = int(zones.size());
+		for (long long cx = (long long) x0; cx <= (long long) x1; cx++) {
+			for (long long cy = (long long) y0; cy <= (long long) y1; cy++) {
+				cells[CellKey(cx, cy)].push_back(index);
+			}
+		}
+		zones.push_back(zone);
+	}
+	zones_.swap(zones);
+	cells_.swap(cells);
+	return true;
+}
+
+bool Geofence::Contains(int zone, double x, double y) const {
+	const Zone &z = zones_[zone];
+	if (z.circle) {
+		const double dx = x - z.cx, dy = y - z.cy;
+		return dx * dx + dy * dy <= z.radius * z.radius;
+	}
+	// even-odd rule: a ray to +x crosses the edges an odd number of times
+	const std::vector<double> &p = z.polygon;
+	const size_t n = p.size() / 2;
+	bool inside = false;
+	for (size_t i = 0, j = n - 1; i < n; j = i++) {
+		const double xi = p[2 * i], yi = p[2 * i + 1], xj = p[2 * j], yj = p[2 * j + 1];
+		if ((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi) {
+			inside = !inside;
+		}
+	}
+	return inside;
+}
+
+void Geofence::Update(double x, double y, std::vector<int> *inside, std::vector<int> *entered,
+                      std::vector<int> *left) const {
+	static const std::vector<int> none;
+	const std::vector<int> *nearby = &none;
+	if (std::isfinite(x) && std::isfinite(y)) {
+		std::unordered_map<uint64_t, std::vector<int> >::const_iterator cell
+			= cells_.find(CellKey((long long) floor(x / kCellSize), (long long) floor(y / kCellSize)));
+		if (cell != cells_.end()) {
+			nearby = &cell->second;
+		}
+	}
+	if (nearby->empty() && inside->empty()) {
+		return;
+	}
+	// the zones it was in that it has left; those are the only ones of the
+	// old position that can change
+	size_t kept = 0;
+	for (size_t i = 0; i < inside->size(); i++) {
+		const int zone = (*inside)[i];
+		if (Contains(zone, x, y)) {
+			(*inside)[kept++] = zone;
+		}
+		else {
+			left->push_back(zone);
+		}
+	}
+	inside->resize(kept);
+	// the zones of the new cell it is in for the first time, kept in order;
+	// a track is in few zones at once
+	for (size_t i = 0; i < nearby->size(); i++) {
+		const int zone = (*nearby)[i];
+		std::vector<int>::iterator at = std::lower_bound(inside->begin(), inside->end(), zone);
+		if ((at == inside->end() || *at != zone) && Contains(zone, x, y)) {
+			entered->push_back(zone);
+			inside->insert(at, zone);
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#ifndef GEOFENCE_H_
+#define GEOFENCE_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Zones of the plane, circles and polygons, that tracks are reported
+ * entering and leaving (see Session::CheckGeofence). Each zone is listed
+ * under the grid cells its bounding box overlaps, so that placing a track
+ * only tests the zones of its cell and those it was in before, however
+ * many zones there are; a track away from every zone costs one lookup.
+ *
+ * The zones are read once, as a JSON array such as
+ *   [{"name":"depot","circle":[10,20,5]},
+ *    {"name":"gate","polygon":[[0,0],[4,0],[4,3],[0,3]]}]
+ * of circles [x, y, radius] and polygons of at least three vertices, in m,
+ * and are not changed afterwards, so sessions on all threads share them.
+ */
+class Geofence {
+public:
+  ///* edge of a cell, in m
+  static const double kCellSize;
+
+  ///* the most cells a zone may be listed under
+  static const long long kMaxZoneCells = 1 << 16;
+
+  /**
+   * Reads the zones of text; false, with the reason in error, if it is not
+   * such an array.
+   */
+  bool Parse(const std::string &text, std::string *error);
+
+  size_t zones() const { return zones_.size(); }
+  const std::string &name(int zone) const { return zones_[zone].name; }
+
+  ///* whether (x, y) is within zone, its edge included
+  bool Contains(int zone, double x, double y) const;
+
+  /**
+   * Moves a track to (x, y): inside holds the zones it was in, in
+   * ascending order, and is updated to those it is in now; the zones it
+   * entered are appended to entered and those it left to left.
+   */
+  void Update(double x, double y, std::vector<int> *inside, std::vector<int> *entered,
+              std::vector<int> *left) const;
+
+private:
+  struct Zone {
+    std::string name;
+    bool circle;
+    ///* centre and radius of a circle
+    double cx, cy, radius;
+    ///* x and y of a polygon's vertices in turn
+    std::vector<double> polygon;
+  };
+
+  std::vector<Zone> zones_;
+  ///* the zones whose bounding box overlaps each cell, by CellKey
+  std::unordered_map<uint64_t, std::vector<int> > cells_;
+
+  static uint64_t CellKey(long long cx, long long cy);
+};
+
+#endif /* GEOFENCE_H_ */
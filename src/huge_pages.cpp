@@ -0,0 +1,132 @@
+#include "huge_pages.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+const size_t HugePages::kSize;
+
+std::atomic<HugePages::Mode> HugePages::mode_(HugePages::MODE_OFF);
+std::atomic<size_t> HugePages::bytes_[HugePages::BACKINGS];
+
+namespace {
+
+///* the backing of each mapping, found again by its address at Unmap;
+///* mappings are few and seldom made, as chunks and arrays grow
+std::mutex mappings_mutex;
+std::unordered_map<void *, std::pair<size_t, HugePages::Backing> > mappings;
+
+size_t Rounded(size_t size) {
+	return (size + HugePages::kSize - 1) & ~(HugePages::kSize - 1);
+}
+
+[[noreturn]] void OutOfMemory() {
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+	throw std::bad_alloc();
+#else
+	std::abort();
+#endif
+}
+
+}
+
+bool HugePages::ParseMode(const std::string &name, Mode *mode) {
+	if (name == "off") {
+		*mode = MODE_OFF;
+	}
+	else if (name == "thp") {
+		*mode = MODE_TRANSPARENT;
+	}
+	else if (name == "explicit") {
+		*mode = MODE_EXPLICIT;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+void *HugePages::Map(size_t size, bool transparent) {
+	size = Rounded(size ? size : 1);
+	const Mode mode = transparent && HugePages::mode() == MODE_OFF ? MODE_TRANSPARENT : HugePages::mode();
+	void *p = nullptr;
+	Backing backing = BACKING_SMALL;
+#ifdef __linux__
+	if (mode == MODE_EXPLICIT) {
+		p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			backing = BACKING_EXPLICIT;
+		}
+		else {
+			p = nullptr;
+			static std::once_flag reported;
+			std::call_once(reported, [] {
+				std::cerr << "No explicit huge pages left (vm.nr_hugepages), advising transparent ones" << std::endl;
+			});
+		}
+	}
+	if (!p) {
+		// a huge page more, to trim to the alignment the kernel backs whole
+		char *area = static_cast<char *>(mmap(nullptr, size + kSize, PROT_READ | PROT_WRITE,
+		                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (area == MAP_FAILED) {
+			OutOfMemory();
+		}
+		char *aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(area) + kSize - 1) & ~(kSize - 1));
+		if (aligned != area) {
+			munmap(area, aligned - area);
+		}
+		munmap(aligned + size, area + kSize - aligned);
+		p = aligned;
+		//only advice: without THP the mapping stays on small pages
+		if (mode != MODE_OFF && madvise(p, size, MADV_HUGEPAGE) == 0) {
+			backing = BACKING_TRANSPARENT;
+		}
+	}
+#else
+	if (posix_memalign(&p, kSize, size) != 0) {
+		OutOfMemory();
+	}
+	memset(p, 0, size);
+#endif
+	bytes_[backing].fetch_add(size, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(mappings_mutex);
+	mappings[p] = std::make_pair(size, backing);
+	return p;
+}
+
+void HugePages::Unmap(void *p, size_t size) {
+	if (!p) {
+		return;
+	}
+	Backing backing = BACKING_SMALL;
+	{
+		std::lock_guard<std::mutex> lock(mappings_mutex);
+		std::unordered_map<void *, std::pair<size_t, Backing> >::iterator mapping = mappings.find(p);
+		if (mapping != mappings.end()) {
+			size = mapping->second.first;
+			backing = mapping->second.second;
+			mappings.erase(mapping);
+		}
+	}
+	bytes_[backing].fetch_sub(Rounded(size), std::memory_order_relaxed);
+#ifdef __linux__
+	munmap(p, Rounded(size));
+#else
+	std::free(p);
+#endif
+}
+
+std::string HugePages::Json() {
+	static const char *modes[] = {"off", "thp", "explicit"};
+	return std::string("{\"mode\":\"") + modes[mode()] + "\""
+		+ ",\"explicit_bytes\":" + std::to_string(Bytes(BACKING_EXPLICIT))
+		+ ",\"transparent_bytes\":" + std::to_string(Bytes(BACKING_TRANSPARENT))
+		+ ",\"small_bytes\":" + std::to_string(Bytes(BACKING_SMALL)) + "}";
+}
@@ -0,0 +1,105 @@
+#ifndef HUGE_PAGES_H_
+#define HUGE_PAGES_H_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <string>
+
+/**
+ * Memory on 2 MB pages for the large arrays the filters walk, the session
+ * arenas and the structure-of-arrays storage of UKFBatch, so that a pass
+ * over hundreds of thousands of tracks takes a TLB entry per 2 MB rather
+ * than per 4 KB.
+ *
+ * A mapping is whole huge pages aligned to one. In MODE_EXPLICIT it comes
+ * from the huge pages reserved in vm.nr_hugepages (MAP_HUGETLB), and when
+ * none are left, as in MODE_TRANSPARENT, from ordinary memory the kernel is
+ * advised to back with transparent huge pages (MADV_HUGEPAGE); without
+ * THP it stays on small pages. In MODE_OFF, the default, mappings are only
+ * aligned. Each mapping is counted by the backing it got, for /stats.
+ *
+ * Linux only; elsewhere every mapping is ordinary memory.
+ */
+class HugePages {
+public:
+  ///* the huge pages of x86-64 and ARMv8 with 4 KB pages
+  static const size_t kSize = 2 << 20;
+
+  enum Mode { MODE_OFF, MODE_TRANSPARENT, MODE_EXPLICIT };
+
+  enum Backing { BACKING_EXPLICIT, BACKING_TRANSPARENT, BACKING_SMALL, BACKINGS };
+
+  ///* set before the memory it is for is allocated
+  static void set_mode(Mode mode) { mode_.store(mode, std::memory_order_relaxed); }
+  static Mode mode() { return mode_.load(std::memory_order_relaxed); }
+  static bool enabled() { return mode() != MODE_OFF; }
+
+  ///* reads a --hugepages name; false if there is none of that name
+  static bool ParseMode(const std::string &name, Mode *mode);
+
+  /**
+   * A mapping of at least size bytes, rounded up to whole huge pages, in
+   * the current mode, or with transparent as MODE_TRANSPARENT at least;
+   * zeroed. Aborts, as operator new would throw, if there is no memory.
+   */
+  static void *Map(size_t size, bool transparent = false);
+
+  ///* gives back a mapping of Map, of the size asked for
+  static void Unmap(void *p, size_t size);
+
+  ///* bytes mapped, by backing
+  static size_t Bytes(Backing backing) { return bytes_[backing].load(std::memory_order_relaxed); }
+
+  ///* those as a JSON object, with the mode
+  static std::string Json();
+
+private:
+  static std::atomic<Mode> mode_;
+  static std::atomic<size_t> bytes_[BACKINGS];
+};
+
+/**
+ * A std::allocator for arrays that may grow large: those of half a huge
+ * page and more are Mapped, on huge pages while HugePages is enabled, the
+ * rest come from the heap.
+ */
+template <class T>
+struct HugePageAllocator {
+  typedef T value_type;
+
+  HugePageAllocator() {}
+  template <class U>
+  HugePageAllocator(const HugePageAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    const size_t size = n * sizeof(T);
+    if (Mapped(size)) {
+      return static_cast<T *>(HugePages::Map(size));
+    }
+    return static_cast<T *>(::operator new(size));
+  }
+
+  void deallocate(T *p, size_t n) {
+    const size_t size = n * sizeof(T);
+    if (Mapped(size)) {
+      HugePages::Unmap(p, size);
+    }
+    else {
+      ::operator delete(p);
+    }
+  }
+
+  template <class U>
+  struct rebind { typedef HugePageAllocator<U> other; };
+
+  bool operator==(const HugePageAllocator &) const { return true; }
+  bool operator!=(const HugePageAllocator &) const { return false; }
+
+private:
+  // by size alone, so that an array is given back the way it was taken
+  // whatever the mode has become since
+  static bool Mapped(size_t size) { return size >= HugePages::kSize / 2; }
+};
+
+#endif /* HUGE_PAGES_H_ */
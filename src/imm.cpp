@@ -0,0 +1,358 @@
+#include "imm.h"
+#include "angle.h"
+#include "ctrv_kernel.h"
+#include "unscented_transform.h"
+#include <cmath>
+
+template <class... Models>
+const int IMM<Models...>::n_models_;
+
+template <class... Models>
+const int IMM<Models...>::n_sig_;
+
+template <class... Models>
+const int IMM<Models...>::n_points_;
+
+namespace {
+
+///* log(2 pi)
+const double kLog2Pi = 1.83787706640934548356;
+
+}
+
+template <class... Models>
+IMM<Models...>::IMM(const UKFConfig &config, double stay) : config_(&config) {
+	is_initialized_ = false;
+	time_us_ = 0;
+	NIS_radar_ = 0.0;
+	NIS_laser_ = 0.0;
+	x_.fill(0.0);
+	P_.fill(0.0);
+	mu_.fill(1.0 / n_models_);
+	for (int j = 0; j < n_models_; j++) {
+		x_model_[j].fill(0.0);
+		P_model_[j].fill(0.0);
+	}
+
+	const double leave = n_models_ > 1 ? (1.0 - stay) / (n_models_ - 1) : 0.0;
+	transition_.fill(leave);
+	transition_.diagonal().fill(n_models_ > 1 ? stay : 1.0);
+
+	const double lambda = 3.0 - n_aug_;
+	sqrt_lambda_aug_ = sqrt(lambda + n_aug_);
+	weights_.fill(0.5 / (lambda + n_aug_));
+	weights_(0) = lambda / (lambda + n_aug_);
+
+	const bool turns[] = {Models::kTurns...};
+	const bool accelerates[] = {Models::kAccelerates...};
+	for (int j = 0; j < n_models_; j++) {
+		for (int i = 0; i < n_sig_; i++) {
+			turn_[j * n_sig_ + i] = turns[j] ? 1.0 : 0.0;
+			accel_[j * n_sig_ + i] = accelerates[j] ? 1.0 : 0.0;
+		}
+	}
+}
+
+template <class... Models>
+const char *IMM<Models...>::ModelName(int j) {
+	const char *names[] = {Models::Name()...};
+	return names[j];
+}
+
+template <class... Models>
+void IMM<Models...>::Initialize(const MeasurementPackage &meas_package) {
+	//as UKF, with an unknown acceleration of about 1 m/s^2
+	StateVector x;
+	x << 0.0, 0.0, 3.0, 0.0, 0.1, 0.0;
+	StateMatrix P = StateMatrix::Identity();
+	P(3, 3) = M_PI*M_PI / 64.0;
+	P(4, 4) = P(3, 3) / 10.0;
+	if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
+		double rho = meas_package.raw_measurements_[1];
+		x(0) = meas_package.raw_measurements_[0] * cos(rho);
+		x(1) = meas_package.raw_measurements_[0] * sin(rho);
+		P(0, 0) = config_->R_radar_(0, 0)*0.5;
+		P(1, 1) = config_->R_radar_(0, 0)*0.5;
+	}
+	else {
+		x(0) = meas_package.raw_measurements_[0];
+		x(1) = meas_package.raw_measurements_[1];
+		P(0, 0) = config_->R_laser_(0, 0);
+		P(1, 1) = config_->R_laser_(1, 1);
+	}
+	for (int j = 0; j < n_models_; j++) {
+		x_model_[j] = x;
+		P_model_[j] = P;
+	}
+	mu_.fill(1.0 / n_models_);
+	x_ = x;
+	P_ = P;
+	time_us_ = meas_package.timestamp_;
+	is_initialized_ = true;
+}
+
+template <class... Models>
+void IMM<Models...>::ProcessMeasurement(const MeasurementPackage &meas_package) {
+	if (!is_initialized_) {
+		Initialize(meas_package);
+		return;
+	}
+	const bool radar = meas_package.sensor_type_ == MeasurementPackage::RADAR;
+	if (!(radar ? config_->use_radar_ : config_->use_laser_)) {
+		(radar ? NIS_radar_ : NIS_laser_) = 0.0;
+		return;
+	}
+
+	const ModelVector c = Mix();
+	double dt = (meas_package.timestamp_ - time_us_) / 1000000.0;	//dt - expressed in seconds
+	time_us_ = meas_package.timestamp_;
+	Predict(dt);
+	if (radar) {
+		ProjectRadar();
+	}
+
+	//model probabilities from the log-likelihoods, scaled by the largest so
+	//that an unlikely measurement does not underflow all of them
+	ModelVector log_mu;
+	double nis = 0.0;
+	for (int j = 0; j < n_models_; j++) {
+		double model_nis;
+		const double log_likelihood = radar ? UpdateRadar(j, meas_package, &model_nis)
+		                                    : UpdateLidar(j, meas_package, &model_nis);
+		log_mu(j) = log(c(j)) + log_likelihood;
+		nis += c(j) * model_nis;
+	}
+	mu_ = (log_mu.array() - log_mu.maxCoeff()).exp();
+	mu_ /= mu_.sum();
+	(radar ? NIS_radar_ : NIS_laser_) = nis;
+
+	Combine();
+}
+
+template <class... Models>
+typename IMM<Models...>::ModelVector IMM<Models...>::Mix() {
+	const ModelVector c = transition_.transpose() * mu_;
+	for (int j = 0; j < n_models_; j++) {
+		//mixed around model j's own state, so yaw differences stay small
+		StateVector &x0 = x_mixed_[j];
+		StateMatrix &P0 = P_mixed_[j];
+		x0 = x_model_[j];
+		for (int i = 0; i < n_models_; i++) {
+			const double w = transition_(i, j) * mu_(i) / c(j);
+			StateVector x_diff = x_model_[i] - x_model_[j];
+			x_diff(3) = NormalizeAngle(x_diff(3));
+			x0.noalias() += w * x_diff;
+		}
+		P0.fill(0.0);
+		for (int i = 0; i < n_models_; i++) {
+			const double w = transition_(i, j) * mu_(i) / c(j);
+			StateVector x_diff = x_model_[i] - x0;
+			x_diff(3) = NormalizeAngle(x_diff(3));
+			P0.noalias() += w * (P_model_[i] + x_diff * x_diff.transpose());
+		}
+	}
+	return c;
+}
+
+template <class... Models>
+void IMM<Models...>::Predict(double delta_t) {
+	//augmented sigma points of every model; the augmented covariance is
+	//block diagonal, so only the state block needs factorizing
+	const double c = sqrt_lambda_aug_;
+	const double std_noise[2] = {config_->std_a_, config_->std_yawdd_};
+	for (int j = 0; j < n_models_; j++) {
+		Eigen::LLT<StateMatrix> llt(P_mixed_[j]);
+		const StateMatrix L = llt.matrixL();
+		const StateVector &x0 = x_mixed_[j];
+		const int o = j * n_sig_;
+		for (int k = 0; k < n_aug_; k++) {
+			double *X = Xsig_aug_[k] + o;
+			const double mean = k < n_x_ ? x0(k) : 0.0;
+			X[0] = mean;
+			for (int i = 0; i < n_aug_; i++) {
+				double offset;
+				if (k < n_x_) {
+					offset = i < n_x_ ? c * L(k, i) : 0.0;
+				}
+				else {
+					offset = i == k ? c * std_noise[k - n_x_] : 0.0;
+				}
+				X[1 + i] = mean + offset;
+				X[1 + n_aug_ + i] = mean - offset;
+			}
+		}
+	}
+
+	//all models in one pass through the kernel
+	const double *in[n_aug_];
+	double *out[n_x_];
+	for (int k = 0; k < n_aug_; k++) {
+		in[k] = Xsig_aug_[k];
+	}
+	for (int k = 0; k < n_x_; k++) {
+		out[k] = Xsig_pred_[k];
+	}
+	PropagateCTRA(in, out, n_points_, delta_t, turn_, accel_);
+
+	for (int j = 0; j < n_models_; j++) {
+		const int o = j * n_sig_;
+		double x[n_x_] = {0.0};
+		for (int i = 0; i < n_sig_; i++) {
+			for (int k = 0; k < n_x_; k++) {
+				x[k] += weights_(i) * Xsig_pred_[k][o + i];
+			}
+		}
+
+		//P as a sum of rank-one updates over the upper triangle
+		double P[n_x_][n_x_] = {{0.0}};
+		for (int i = 0; i < n_sig_; i++) {
+			double d[n_x_];
+			for (int k = 0; k < n_x_; k++) {
+				d[k] = Xsig_pred_[k][o + i] - x[k];
+			}
+			//angle normalization
+			d[3] = NormalizeAngle(d[3]);
+			for (int r = 0; r < n_x_; r++) {
+				const double wd = weights_(i) * d[r];
+				for (int col = r; col < n_x_; col++) {
+					P[r][col] += wd * d[col];
+				}
+			}
+		}
+		for (int r = 0; r < n_x_; r++) {
+			x_model_[j](r) = x[r];
+			for (int col = r; col < n_x_; col++) {
+				P_model_[j](r, col) = P[r][col];
+				P_model_[j](col, r) = P[r][col];
+			}
+		}
+	}
+}
+
+template <class... Models>
+void IMM<Models...>::ProjectRadar() {
+	typedef Eigen::InnerStride<n_points_> Stride;
+	for (int i = 0; i < n_points_; i++) {
+		RadarMeasurementModel::Project(
+			Eigen::Map<const StateVector, 0, Stride>(&Xsig_pred_[0][i]),
+			Eigen::Map<Eigen::Matrix<double, 3, 1>, 0, Stride>(&Zsig_[0][i]));
+	}
+}
+
+template <class... Models>
+double IMM<Models...>::UpdateLidar(int j, const MeasurementPackage &meas_package, double *nis) {
+	const int n_z = 2;
+	StateVector &x = x_model_[j];
+	StateMatrix &P = P_model_[j];
+
+	//H selects p_x and p_y, as in UKF::UpdateLidar
+	const Eigen::Matrix<double, n_z, n_x_> HP = P.template topRows<n_z>();
+	const Eigen::Matrix<double, n_z, 1> z_diff = meas_package.raw_measurements_.template head<n_z>() - x.template head<n_z>();
+	const Eigen::Matrix<double, n_z, n_z> S = config_->R_laser_ + HP.template leftCols<n_z>();
+	//closed-form inverse of the 2x2 innovation covariance
+	const Eigen::Matrix<double, n_z, n_z> Si = S.inverse();
+	const Eigen::Matrix<double, n_z, n_x_> Kt = Si.lazyProduct(HP);
+
+	x.noalias() += Kt.transpose().lazyProduct(z_diff);
+	//P - K H P is symmetric: the upper triangle, mirrored
+	for (int r = 0; r < n_x_; r++) {
+		for (int c = r; c < n_x_; c++) {
+			P(r, c) -= Kt(0, r)*HP(0, c) + Kt(1, r)*HP(1, c);
+			P(c, r) = P(r, c);
+		}
+	}
+
+	*nis = z_diff.dot(Si * z_diff);
+	return -0.5 * (*nis + log(S.determinant()) + n_z * kLog2Pi);
+}
+
+template <class... Models>
+double IMM<Models...>::UpdateRadar(int j, const MeasurementPackage &meas_package, double *nis) {
+	const int n_z = 3;
+	const int o = j * n_sig_;
+	StateVector &x = x_model_[j];
+	StateMatrix &P = P_model_[j];
+
+	double z_pred[n_z] = {0.0};
+	for (int i = 0; i < n_sig_; i++) {
+		for (int r = 0; r < n_z; r++) {
+			z_pred[r] += weights_(i) * Zsig_[r][o + i];
+		}
+	}
+
+	//innovation and cross covariance in one pass over the sigma points
+	double S_upper[n_z][n_z] = {{0.0}};
+	double T[n_x_][n_z] = {{0.0}};
+	for (int i = 0; i < n_sig_; i++) {
+		double dz[n_z], dx[n_x_];
+		for (int r = 0; r < n_z; r++) {
+			dz[r] = Zsig_[r][o + i] - z_pred[r];
+		}
+		dz[RadarMeasurementModel::angle_] = NormalizeAngle(dz[RadarMeasurementModel::angle_]);
+		for (int k = 0; k < n_x_; k++) {
+			dx[k] = Xsig_pred_[k][o + i] - x(k);
+		}
+		dx[3] = NormalizeAngle(dx[3]);
+		for (int r = 0; r < n_z; r++) {
+			const double wz = weights_(i) * dz[r];
+			for (int col = r; col < n_z; col++) {
+				S_upper[r][col] += wz * dz[col];
+			}
+			for (int k = 0; k < n_x_; k++) {
+				T[k][r] += wz * dx[k];
+			}
+		}
+	}
+	Eigen::Matrix<double, n_z, n_z> S = config_->R_radar_;
+	Eigen::Matrix<double, n_x_, n_z> Tc;
+	for (int r = 0; r < n_z; r++) {
+		for (int col = r; col < n_z; col++) {
+			S(r, col) += S_upper[r][col];
+			S(col, r) = S(r, col);
+		}
+		for (int k = 0; k < n_x_; k++) {
+			Tc(k, r) = T[k][r];
+		}
+	}
+
+	//closed-form inverse of the 3x3 innovation covariance
+	const Eigen::Matrix<double, n_z, n_z> Si = S.inverse();
+	const Eigen::Matrix<double, n_x_, n_z> K = Tc.lazyProduct(Si);
+	Eigen::Matrix<double, n_z, 1> residual;
+	for (int r = 0; r < n_z; r++) {
+		residual(r) = meas_package.raw_measurements_(r) - z_pred[r];
+	}
+	residual(RadarMeasurementModel::angle_) = NormalizeAngle(residual(RadarMeasurementModel::angle_));
+
+	x.noalias() += K.lazyProduct(residual);
+	//P - K S K^T = P - K Tc^T, symmetric
+	for (int r = 0; r < n_x_; r++) {
+		for (int c = r; c < n_x_; c++) {
+			P(r, c) -= K(r, 0)*Tc(c, 0) + K(r, 1)*Tc(c, 1) + K(r, 2)*Tc(c, 2);
+			P(c, r) = P(r, c);
+		}
+	}
+
+	*nis = residual.dot(Si * residual);
+	return -0.5 * (*nis + log(S.determinant()) + n_z * kLog2Pi);
+}
+
+template <class... Models>
+void IMM<Models...>::Combine() {
+	int best;
+	mu_.maxCoeff(&best);
+	x_ = x_model_[best];
+	for (int j = 0; j < n_models_; j++) {
+		StateVector x_diff = x_model_[j] - x_model_[best];
+		x_diff(3) = NormalizeAngle(x_diff(3));
+		x_.noalias() += mu_(j) * x_diff;
+	}
+	P_.fill(0.0);
+	for (int j = 0; j < n_models_; j++) {
+		StateVector x_diff = x_model_[j] - x_;
+		x_diff(3) = NormalizeAngle(x_diff(3));
+		P_.noalias() += mu_(j) * (P_model_[j] + x_diff * x_diff.transpose());
+	}
+}
+
+template class IMM<ConstantVelocity, ConstantTurnRateVelocity, ConstantTurnRateAcceleration>;
@@ -0,0 +1,137 @@
+#ifndef IMM_H_
+#define IMM_H_
+
+#include "measurement_package.h"
+#include "motion_models.h"
+#include "ukf_config.h"
+#include "Eigen/Dense"
+
+/**
+ * Interacting multiple model filter: one unscented filter per process model
+ * in Models (see motion_models.h), all on the state
+ * [p_x p_y v yaw yaw_rate a], mixed before every prediction by the Markov
+ * chain of model switches and weighted by how well each predicted the
+ * measurement. The sensors, noise and measurement models are those of
+ * UKFConfig and UKF.
+ *
+ * The model filters run as one batch rather than one after the other: the
+ * sigma points of all of them are propagated by a single PropagateCTRA
+ * call, which evaluates every model with the same instructions across the
+ * vector lanes, and the radar projection runs over all points in one loop.
+ * The moments are accumulated as symmetric rank-one updates with
+ * independent sums rather than as dot products, whose dependency chains
+ * would otherwise dominate the step. Everything is fixed-size and
+ * allocated with the filter.
+ */
+template <class... Models>
+class IMM {
+public:
+  static const int n_models_ = sizeof...(Models);
+  static const int n_x_ = 6;
+  static const int n_aug_ = 8;
+  static const int n_sig_ = 2 * n_aug_ + 1;
+  ///* sigma points of all models together
+  static const int n_points_ = n_models_ * n_sig_;
+
+  typedef Eigen::Matrix<double, n_x_, 1> StateVector;
+  typedef Eigen::Matrix<double, n_x_, n_x_> StateMatrix;
+  typedef Eigen::Matrix<double, n_models_, 1> ModelVector;
+  typedef Eigen::Matrix<double, n_models_, n_models_> TransitionMatrix;
+  typedef Eigen::Matrix<double, n_sig_, 1> WeightVector;
+
+  ///* combined state: [pos1 pos2 vel_abs yaw_angle yaw_rate acceleration]
+  ///* in SI units and rad, as UKF's with the acceleration appended
+  StateVector x_;
+
+  ///* combined state covariance matrix
+  StateMatrix P_;
+
+  ///* probability of each model
+  ModelVector mu_;
+
+  ///* state and covariance of each model filter
+  StateVector x_model_[n_models_];
+  StateMatrix P_model_[n_models_];
+
+  ///* transition_(i, j) is the probability of switching from model i to j
+  ///* between two measurements
+  TransitionMatrix transition_;
+
+  ///* time when the state is true, in us
+  long long time_us_;
+
+  ///* initially set to false, set to true in first call of ProcessMeasurement
+  bool is_initialized_;
+
+  ///* the NIS of the last radar and laser measurement, averaged over the
+  ///* models with their probabilities before the update
+  double NIS_radar_;
+  double NIS_laser_;
+
+  /**
+   * Constructor
+   * @param config The sensors and noise, which must outlive the filter
+   * @param stay Probability of keeping the model between two measurements;
+   * the rest is spread evenly over the other models
+   */
+  explicit IMM(const UKFConfig &config = UKFConfig::Default(), double stay = 0.95);
+
+  /**
+   * ProcessMeasurement
+   * @param meas_package The latest measurement data of either radar or laser
+   */
+  void ProcessMeasurement(const MeasurementPackage &meas_package);
+
+  ///* short name of model j, e.g. "CTRV"
+  static const char *ModelName(int j);
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  const UKFConfig *config_;
+
+  ///* weights and offset factor of the 2 n_aug_ + 1 sigma points
+  WeightVector weights_;
+  double sqrt_lambda_aug_;
+
+  ///* turn rate and acceleration factor of every sigma point, by model
+  double turn_[n_points_];
+  double accel_[n_points_];
+
+  ///* the sigma points of all models, component by component as
+  ///* PropagateCTRA reads and writes them; model j has points
+  ///* j n_sig_ .. (j + 1) n_sig_ - 1
+  double Xsig_aug_[n_aug_][n_points_];
+  double Xsig_pred_[n_x_][n_points_];
+
+  ///* radar measurement sigma points of all models
+  double Zsig_[3][n_points_];
+
+  ///* mixed initial conditions of the model filters
+  StateVector x_mixed_[n_models_];
+  StateMatrix P_mixed_[n_models_];
+
+  void Initialize(const MeasurementPackage &meas_package);
+
+  ///* mixes the model states; returns the predicted model probabilities
+  ModelVector Mix();
+
+  ///* predicts every model filter from its mixed state by delta_t seconds
+  void Predict(double delta_t);
+
+  ///* the radar measurement sigma points of all models, in one loop
+  void ProjectRadar();
+
+  ///* the update of model j, returning the log-likelihood of the
+  ///* measurement and its NIS
+  double UpdateLidar(int j, const MeasurementPackage &meas_package, double *nis);
+  double UpdateRadar(int j, const MeasurementPackage &meas_package, double *nis);
+
+  ///* the combined estimate, x_ and P_
+  void Combine();
+};
+
+///* the CV, CTRV and CTRA filter
+typedef IMM<ConstantVelocity, ConstantTurnRateVelocity, ConstantTurnRateAcceleration> MotionIMM;
+
+#endif /* IMM_H_ */
@@ -0,0 +1,114 @@
+#ifndef INNOVATION_SOLVER_H_
+#define INNOVATION_SOLVER_H_
+
+#include "Eigen/Dense"
+#include "small_matrix.h"
+#include <type_traits>
+
+/**
+ * Solver policies for the innovation covariance S of a measurement update.
+ *
+ * A policy provides Factorization<N>, which is computed once per update and
+ * then serves both the Kalman gain (K^T = S^-1 * C, C the cross covariance
+ * transposed) and the NIS quadratic form z^T * S^-1 * z. It also provides
+ * the covariance arithmetic around it, as static FactorCovariance and
+ * SubtractGainProduct.
+ */
+
+///* the covariance arithmetic of Eigen's generic code
+struct EigenCovariance {
+  ///* L, lower, with L L^T = P, through llt; false if P is not positive
+  ///* definite, L then being of no use
+  template <class Matrix>
+  static bool FactorCovariance(const Matrix &P, Eigen::LLT<Matrix> *llt, Matrix *L) {
+    llt->compute(P);
+    *L = llt->matrixL();
+    return llt->info() == Eigen::Success;
+  }
+
+  ///* P -= T K^T, the covariance update of a gain K and cross covariance T
+  template <class Matrix, class Gain>
+  static void SubtractGainProduct(Matrix *P, const Gain &T, const Gain &K) {
+    P->noalias() -= T * K.transpose();
+  }
+};
+
+///* LDLT factorization of S; the default
+struct LdltSolver : EigenCovariance {
+  template <int N>
+  struct Factorization {
+    typedef Eigen::Matrix<double, N, N> Matrix;
+
+    void Compute(const Matrix &S) { ldlt_.compute(S); }
+
+    ///* x = S^-1 * b
+    template <class Rhs, class Dst>
+    void Solve(const Rhs &b, Dst &x) const { x = ldlt_.solve(b); }
+
+    ///* z^T * S^-1 * z
+    template <class Vector>
+    double Quadratic(const Vector &z) const { return z.dot(ldlt_.solve(z)); }
+
+  private:
+    Eigen::LDLT<Matrix> ldlt_;
+  };
+};
+
+///* explicit inverse of S, as the filter originally computed it
+struct InverseSolver : EigenCovariance {
+  template <int N>
+  struct Factorization {
+    typedef Eigen::Matrix<double, N, N> Matrix;
+
+    void Compute(const Matrix &S) { Si_ = S.inverse(); }
+
+    template <class Rhs, class Dst>
+    void Solve(const Rhs &b, Dst &x) const { x.noalias() = Si_ * b; }
+
+    template <class Vector>
+    double Quadratic(const Vector &z) const { return z.dot(Si_ * z); }
+
+  private:
+    Matrix Si_;
+  };
+};
+
+/**
+ * The kernels of small_matrix.h: the closed-form inverse of a 2x2 or 3x3 S
+ * (LDLT for larger ones), the unrolled Cholesky factor and the symmetric
+ * update in vector lanes; picked for the CTRV filters by the
+ * UKF_SMALL_MATRIX build option.
+ */
+struct SmallMatrixSolver {
+  template <int N>
+  struct ClosedForm {
+    typedef Eigen::Matrix<double, N, N> Matrix;
+
+    void Compute(const Matrix &S) { small_matrix::SymmetricInverse(S, &Si_); }
+
+    template <class Rhs, class Dst>
+    void Solve(const Rhs &b, Dst &x) const { x.noalias() = Si_ * b; }
+
+    template <class Vector>
+    double Quadratic(const Vector &z) const { return z.dot(Si_ * z); }
+
+  private:
+    Matrix Si_;
+  };
+
+  template <int N>
+  using Factorization = typename std::conditional<N <= 3, ClosedForm<N>, LdltSolver::Factorization<N> >::type;
+
+  ///* an indefinite P, which the kernel gives up on, goes to llt as before
+  template <class Matrix>
+  static bool FactorCovariance(const Matrix &P, Eigen::LLT<Matrix> *llt, Matrix *L) {
+    return small_matrix::Cholesky(P, L) || EigenCovariance::FactorCovariance(P, llt, L);
+  }
+
+  template <class Matrix, class Gain>
+  static void SubtractGainProduct(Matrix *P, const Gain &T, const Gain &K) {
+    small_matrix::SubtractSymmetricProduct(P, T, K);
+  }
+};
+
+#endif /* INNOVATION_SOLVER_H_ */
@@ -0,0 +1,263 @@
+#include "interval_smoother.h"
+#include "angle.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+const size_t IntervalSmoother::kBlockSteps;
+
+///* the steps of a block, a column per field; x and P hold the filtered
+///* moments until the backward pass writes the smoothed ones over them
+struct IntervalSmoother::Block {
+	double x[5][kBlockSteps];
+	double P[15][kBlockSteps];
+	double x_predicted[5][kBlockSteps];
+	double P_predicted[15][kBlockSteps];
+	double gain[25][kBlockSteps];
+	double truth[4][kBlockSteps];
+	int64_t timestamp[kBlockSteps];
+	uint32_t track[kBlockSteps];
+	uint8_t has_truth[kBlockSteps];
+};
+
+namespace {
+
+const size_t kBlockSteps = IntervalSmoother::kBlockSteps;
+
+///* what the backward pass keeps of the step after a track's current one
+struct Later {
+	bool set;
+	CTRVUKF::StateVector x_smoothed;
+	CTRVUKF::StateMatrix P_smoothed;
+	CTRVUKF::StateVector x_predicted;
+	CTRVUKF::StateMatrix P_predicted;
+	CTRVUKF::StateMatrix gain;
+};
+
+void StoreVector(const CTRVUKF::StateVector &x, double (*columns)[kBlockSteps], size_t i) {
+	for (int r = 0; r < 5; r++) {
+		columns[r][i] = x(r);
+	}
+}
+
+void LoadVector(const double (*columns)[kBlockSteps], size_t i, CTRVUKF::StateVector *x) {
+	for (int r = 0; r < 5; r++) {
+		(*x)(r) = columns[r][i];
+	}
+}
+
+///* a covariance by its upper triangle
+void StoreSymmetric(const CTRVUKF::StateMatrix &P, double (*columns)[kBlockSteps], size_t i) {
+	int c = 0;
+	for (int r = 0; r < 5; r++) {
+		for (int k = r; k < 5; k++) {
+			columns[c++][i] = P(r, k);
+		}
+	}
+}
+
+void LoadSymmetric(const double (*columns)[kBlockSteps], size_t i, CTRVUKF::StateMatrix *P) {
+	int c = 0;
+	for (int r = 0; r < 5; r++) {
+		for (int k = r; k < 5; k++) {
+			(*P)(r, k) = (*P)(k, r) = columns[c++][i];
+		}
+	}
+}
+
+void StoreMatrix(const CTRVUKF::StateMatrix &M, double (*columns)[kBlockSteps], size_t i) {
+	for (int c = 0; c < 25; c++) {
+		columns[c][i] = M.data()[c];
+	}
+}
+
+void LoadMatrix(const double (*columns)[kBlockSteps], size_t i, CTRVUKF::StateMatrix *M) {
+	for (int c = 0; c < 25; c++) {
+		M->data()[c] = columns[c][i];
+	}
+}
+
+}
+
+IntervalSmoother::IntervalSmoother()
+	: fd_(-1), block_(new Block()), steps_(0), block_index_(0), next_(0), out_of_order_(0), failed_(false) {}
+
+IntervalSmoother::~IntervalSmoother() {
+	if (fd_ >= 0) {
+		close(fd_);
+	}
+}
+
+bool IntervalSmoother::Open(const std::string &directory) {
+	std::string path = directory + "/ukf-smooth-XXXXXX";
+	fd_ = mkstemp(&path[0]);
+	if (fd_ < 0) {
+		return false;
+	}
+	unlink(path.c_str());
+	return true;
+}
+
+bool IntervalSmoother::ReadBlock(size_t b) {
+	const ssize_t size = sizeof(Block);
+	failed_ = failed_ || pread(fd_, block_.get(), size, off_t(b) * size) != size;
+	return !failed_;
+}
+
+bool IntervalSmoother::WriteBlock(size_t b) {
+	const ssize_t size = sizeof(Block);
+	failed_ = failed_ || pwrite(fd_, block_.get(), size, off_t(b) * size) != size;
+	return !failed_;
+}
+
+void IntervalSmoother::Process(uint32_t track, const MeasurementPackage &meas_package,
+                               const Eigen::Vector4d *ground_truth) {
+	std::unordered_map<uint32_t, size_t>::iterator slot = index_.find(track);
+	if (slot == index_.end()) {
+		slot = index_.insert(std::make_pair(track, tracks_.size())).first;
+		tracks_.emplace_back(new Track());
+	}
+	CTRVUKF &ukf = tracks_[slot->second]->ukf;
+	Step &step = tracks_[slot->second]->step;
+
+	if (!ukf.is_initialized_) {
+		ukf.ProcessMeasurement(meas_package);
+		//the first step has nothing before it to predict from or smooth into
+		step.timestamp = ukf.time_us_;
+		step.has_truth = false;
+		step.x_predicted = ukf.x_;
+		step.P_predicted = ukf.P_;
+		step.gain.setZero();
+	}
+	else if (meas_package.timestamp_ < ukf.time_us_) {
+		out_of_order_++;
+		return;
+	}
+	else {
+		if (meas_package.timestamp_ != ukf.time_us_) {
+			Write(track, step);
+			ukf.StateAt(meas_package.timestamp_);
+			step.timestamp = ukf.time_us_;
+			step.x_predicted = ukf.x_;
+			step.P_predicted = ukf.P_;
+			CTRVUKF::StateMatrix C;
+			ukf.PredictionCrossCovariance(&C);
+			//G = C P^-1, solved as G^T = P^-1 C^T with P symmetric
+			step.gain = step.P_predicted.ldlt().solve(C.transpose()).transpose();
+			step.has_truth = false;
+		}
+		//the filter has predicted already, so this is only the update
+		ukf.ProcessMeasurement(meas_package);
+		if (ukf.reinitialized_) {
+			//started again: the steps before are not smoothed across it
+			step.gain.setZero();
+		}
+	}
+	step.x_filtered = ukf.x_;
+	step.P_filtered = ukf.P_;
+	if (ground_truth) {
+		step.has_truth = true;
+		step.truth = *ground_truth;
+	}
+}
+
+void IntervalSmoother::Write(uint32_t track, const Step &step) {
+	size_t i = steps_ - block_index_ * kBlockSteps;
+	if (i == kBlockSteps) {
+		WriteBlock(block_index_++);
+		i = 0;
+	}
+	Block &block = *block_;
+	StoreVector(step.x_filtered, block.x, i);
+	StoreSymmetric(step.P_filtered, block.P, i);
+	StoreVector(step.x_predicted, block.x_predicted, i);
+	StoreSymmetric(step.P_predicted, block.P_predicted, i);
+	StoreMatrix(step.gain, block.gain, i);
+	for (int r = 0; r < 4; r++) {
+		block.truth[r][i] = step.has_truth ? step.truth(r) : 0.0;
+	}
+	block.timestamp[i] = step.timestamp;
+	block.track[i] = track;
+	block.has_truth[i] = step.has_truth;
+	if (step.has_truth) {
+		filtered_rmse_.Add(CartesianEstimate(step.x_filtered.data()), step.truth);
+	}
+	steps_++;
+}
+
+bool IntervalSmoother::Smooth() {
+	//the steps the tracks are on are complete now
+	for (std::unordered_map<uint32_t, size_t>::const_iterator it = index_.begin(); it != index_.end(); ++it) {
+		const Track &track = *tracks_[it->second];
+		if (track.ukf.is_initialized_) {
+			Write(it->first, track.step);
+		}
+	}
+	const size_t tracks = tracks_.size();
+	std::vector<std::unique_ptr<Track> >().swap(tracks_);
+	if (!steps_ || !WriteBlock(block_index_)) {
+		return !failed_;
+	}
+
+	std::vector<Later> later(tracks);
+	for (size_t t = 0; t < tracks; t++) {
+		later[t].set = false;
+	}
+	const size_t blocks = (steps_ + kBlockSteps - 1) / kBlockSteps;
+	CTRVUKF::StateVector x;
+	CTRVUKF::StateMatrix P;
+	for (size_t b = blocks; b-- > 0;) {
+		//the last block is still in memory
+		if (b != block_index_ && !ReadBlock(b)) {
+			return false;
+		}
+		block_index_ = b;
+		Block &block = *block_;
+		for (size_t i = std::min(kBlockSteps, steps_ - b * kBlockSteps); i-- > 0;) {
+			Later &next = later[index_[block.track[i]]];
+			LoadVector(block.x, i, &x);
+			LoadSymmetric(block.P, i, &P);
+			if (next.set) {
+				CTRVUKF::StateVector x_diff = next.x_smoothed - next.x_predicted;
+				x_diff(3) = NormalizeAngle(x_diff(3));
+				x.noalias() += next.gain * x_diff;
+				P.noalias() += next.gain * (next.P_smoothed - next.P_predicted) * next.gain.transpose();
+				StoreVector(x, block.x, i);
+				StoreSymmetric(P, block.P, i);
+			}
+			next.set = true;
+			next.x_smoothed = x;
+			next.P_smoothed = P;
+			LoadVector(block.x_predicted, i, &next.x_predicted);
+			LoadSymmetric(block.P_predicted, i, &next.P_predicted);
+			LoadMatrix(block.gain, i, &next.gain);
+		}
+		if (!WriteBlock(b)) {
+			return false;
+		}
+	}
+	next_ = 0;
+	return true;
+}
+
+bool IntervalSmoother::Next(SmoothedStep *step) {
+	if (next_ >= steps_ || failed_) {
+		return false;
+	}
+	const size_t b = next_ / kBlockSteps;
+	if (b != block_index_ && !ReadBlock(b)) {
+		return false;
+	}
+	block_index_ = b;
+	const Block &block = *block_;
+	const size_t i = next_++ - b * kBlockSteps;
+	step->track = block.track[i];
+	step->timestamp = block.timestamp[i];
+	LoadVector(block.x, i, &step->x);
+	step->has_truth = block.has_truth[i] != 0;
+	for (int r = 0; r < 4; r++) {
+		step->truth(r) = block.truth[r][i];
+	}
+	return true;
+}
@@ -0,0 +1,137 @@
+#ifndef INTERVAL_SMOOTHER_H_
+#define INTERVAL_SMOOTHER_H_
+
+#include "cache_aligned.h"
+#include "measurement_package.h"
+#include "tools.h"
+#include "ukf.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Unscented Rauch-Tung-Striebel smoother over whole recorded sequences,
+ * for logs too long to hold: the batch counterpart of FixedLagSmoother,
+ * where every step is smoothed with all the measurements after it.
+ *
+ * The forward pass filters the tracks handed to it, each through a CTRVUKF
+ * of its own, and streams every complete step (the measurements of one
+ * timestamp) to a temporary file in blocks of kBlockSteps, column by
+ * column: the filtered and the predicted moments, the smoother gain and
+ * the ground truth, with the covariances as their upper triangles. Smooth
+ * then goes through the file backwards, a block at a time, keeping only
+ * the smoothed step after each track's current one, and writes the
+ * smoothed states over the filtered ones in place, so that Next reads them
+ * forwards again. Memory thus grows with the tracks and not with the
+ * length of the sequences; the file takes about 570 bytes a step.
+ *
+ * One smoother is used by one thread at a time; a log's tracks are dealt to
+ * several for parallel passes (see RunSmoothReplay in replay.h).
+ */
+class IntervalSmoother {
+public:
+  ///* steps per block of the file
+  static const size_t kBlockSteps = 1024;
+
+  ///* a step of a track smoothed with all its measurements
+  struct SmoothedStep {
+    uint32_t track;
+    long long timestamp;
+    CTRVUKF::StateVector x;
+    bool has_truth;
+    Eigen::Vector4d truth;
+  };
+
+  IntervalSmoother();
+
+  ///* closes, and so deletes, the file
+  ~IntervalSmoother();
+
+  /**
+   * Creates the file in directory, unlinked at once so that it goes with
+   * the process however that ends.
+   * @return false if it cannot be created
+   */
+  bool Open(const std::string &directory);
+
+  /**
+   * Filters a measurement of track, with its ground truth if that is not
+   * null. A track's measurements must come in time order; those before its
+   * latest are skipped and counted.
+   */
+  void Process(uint32_t track, const MeasurementPackage &meas_package, const Eigen::Vector4d *ground_truth);
+
+  /**
+   * Ends the forward pass, frees the filters and runs the backward pass.
+   * @return false if the file could not be written or read
+   */
+  bool Smooth();
+
+  /**
+   * The smoothed steps after Smooth, a track's in time order, one per
+   * call.
+   * @return false once there are none left, or if the file cannot be read
+   */
+  bool Next(SmoothedStep *step);
+
+  size_t tracks() const { return index_.size(); }
+  size_t steps() const { return steps_; }
+  long long out_of_order() const { return out_of_order_; }
+
+  ///* of the filtered estimates of the steps with ground truth
+  const RunningRMSE &filtered_rmse() const { return filtered_rmse_; }
+
+  ///* whether a read or write of the file failed
+  bool failed() const { return failed_; }
+
+private:
+  struct Block;
+
+  ///* a step of a track, filtered, as it is completed
+  struct Step {
+    long long timestamp;
+    CTRVUKF::StateVector x_filtered;
+    CTRVUKF::StateMatrix P_filtered;
+    CTRVUKF::StateVector x_predicted;
+    CTRVUKF::StateMatrix P_predicted;
+    CTRVUKF::StateMatrix gain;
+    bool has_truth;
+    Eigen::Vector4d truth;
+  };
+
+  ///* a track in the forward pass: its filter and the step it is on
+  struct Track {
+    CTRVUKF ukf;
+    Step step;
+
+    CACHE_ALIGNED_OPERATOR_NEW
+  };
+
+  int fd_;
+  std::unique_ptr<Block> block_;
+  ///* steps in the file and in block_, which holds those from
+  ///* block_index_ * kBlockSteps on
+  size_t steps_;
+  size_t block_index_;
+  ///* the next step Next reads
+  size_t next_;
+  std::unordered_map<uint32_t, size_t> index_;
+  std::vector<std::unique_ptr<Track> > tracks_;
+  long long out_of_order_;
+  RunningRMSE filtered_rmse_;
+  bool failed_;
+
+  ///* appends the step of track to the file
+  void Write(uint32_t track, const Step &step);
+
+  bool ReadBlock(size_t b);
+  bool WriteBlock(size_t b);
+
+  IntervalSmoother(const IntervalSmoother &);
+  IntervalSmoother &operator=(const IntervalSmoother &);
+};
+
+#endif /* INTERVAL_SMOOTHER_H_ */
@@ -0,0 +1,233 @@
+#include "latency.h"
+#include "json.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+// for convenience
+using json = nlohmann::json;
+
+const int LatencyHistogram::kSubBuckets;
+const int LatencyHistogram::kBuckets;
+
+const int LatencyStats::kDumpInterval;
+
+std::atomic<LatencyStats *> LatencyStats::head_(nullptr);
+std::atomic<int> LatencyStats::trace_every_(0);
+std::atomic<uint64_t> LatencyStats::trace_threshold_(0);
+std::atomic<uint64_t> LatencyStats::last_dump_(0);
+
+LatencyHistogram::LatencyHistogram() : count_(0), sum_(0), max_(0) {
+	for (int i = 0; i < kBuckets; i++) {
+		buckets_[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void LatencyHistogram::Add(const LatencyHistogram &other) {
+	for (int i = 0; i < kBuckets; i++) {
+		buckets_[i].store(buckets_[i].load(std::memory_order_relaxed) + other.buckets_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+	count_.store(count() + other.count(), std::memory_order_relaxed);
+	sum_.store(sum_.load(std::memory_order_relaxed) + other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	if (other.max() > max()) {
+		max_.store(other.max(), std::memory_order_relaxed);
+	}
+}
+
+double LatencyHistogram::Mean() const {
+	uint64_t n = count();
+	return n ? double(sum_.load(std::memory_order_relaxed)) / n : 0.0;
+}
+
+uint64_t LatencyHistogram::BucketEnd(int bucket) {
+	if (bucket < kSubBuckets) {
+		return bucket;
+	}
+	int shift = bucket / kSubBuckets - 1;
+	uint64_t start = uint64_t(kSubBuckets + bucket % kSubBuckets) << shift;
+	return start + (uint64_t(1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::Percentile(double fraction) const {
+	// the counts may run ahead of count_ while read from another thread, so
+	// the total is taken from the buckets themselves
+	uint64_t total = 0;
+	for (int i = 0; i < kBuckets; i++) {
+		total += buckets_[i].load(std::memory_order_relaxed);
+	}
+	uint64_t rank = (uint64_t) (fraction * total + 0.5);
+	uint64_t seen = 0;
+	for (int i = 0; i < kBuckets; i++) {
+		seen += buckets_[i].load(std::memory_order_relaxed);
+		if (seen && seen >= rank) {
+			return std::min(BucketEnd(i), max());
+		}
+	}
+	return max();
+}
+
+namespace {
+
+///* whether the thread's stats stay out of the list, see Unlisted
+thread_local bool unlisted = false;
+
+}
+
+void LatencyStats::Unlisted() {
+	unlisted = true;
+}
+
+LatencyStats *LatencyStats::Register() {
+	LatencyStats *stats = new LatencyStats();
+	if (unlisted) {
+		return stats;
+	}
+	stats->next_ = head_.load(std::memory_order_relaxed);
+	while (!head_.compare_exchange_weak(stats->next_, stats, std::memory_order_release, std::memory_order_relaxed));
+	return stats;
+}
+
+static const char *kStageNames[LATENCY_STAGES] = {
+	"total", "parse", "prediction", "update_lidar", "update_radar", "serialize", "send", "queue"
+};
+
+const char *LatencyStats::StageName(LatencyStage stage) {
+	return kStageNames[stage];
+}
+
+void LatencyStats::SetTracing(int every, uint64_t threshold_ns) {
+	trace_threshold_.store(threshold_ns, std::memory_order_relaxed);
+	trace_every_.store(every, std::memory_order_relaxed);
+}
+
+bool LatencyStats::Sample(int track) {
+	if (++trace_turn_ < trace_every_.load(std::memory_order_relaxed)) {
+		trace_ = nullptr;
+		return false;
+	}
+	trace_turn_ = 0;
+	Follow(track);
+	return true;
+}
+
+void LatencyStats::Follow(int track) {
+	TraceBuffer *buffer = trace_buffer_.load(std::memory_order_relaxed);
+	if (!buffer) {
+		buffer = new TraceBuffer();
+		trace_buffer_.store(buffer, std::memory_order_release);
+	}
+	trace_ = buffer;
+	trace_track_ = track;
+}
+
+void LatencyStats::Traced(LatencyStage stage, uint64_t start, uint64_t now) {
+	trace_->Append(stage, trace_track_, start, now);
+	if (stage != LATENCY_TOTAL) {
+		return;
+	}
+	trace_ = nullptr;
+	const uint64_t threshold = trace_threshold_.load(std::memory_order_relaxed);
+	if (threshold && now - start > threshold) {
+		Dump(trace_track_, now - start);
+	}
+}
+
+void LatencyStats::Dump(int track, uint64_t total) {
+	// one thread writes a dump per interval, the others go on
+	const uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	uint64_t last = last_dump_.load(std::memory_order_relaxed);
+	if ((last && now_ms - last < (uint64_t) kDumpInterval) || !last_dump_.compare_exchange_strong(last, now_ms)) {
+		return;
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "trace-%llu.json", (unsigned long long) now_ms);
+	FILE *file = fopen(path, "w");
+	if (!file) {
+		return;
+	}
+	const std::string trace = TraceJson();
+	fwrite(trace.data(), 1, trace.length(), file);
+	fclose(file);
+	fprintf(stderr, "A message of track %d took %llu us, traced in %s\n", track, (unsigned long long) (total / 1000), path);
+}
+
+std::string LatencyStats::TraceJson() {
+	// the list has the thread that came last first
+	std::vector<LatencyStats *> threads;
+	for (LatencyStats *stats = head_.load(std::memory_order_acquire); stats; stats = stats->next_) {
+		threads.push_back(stats);
+	}
+	std::string events;
+	for (size_t tid = 0; tid < threads.size(); tid++) {
+		TraceBuffer *buffer = threads[threads.size() - 1 - tid]->trace_buffer_.load(std::memory_order_acquire);
+		if (buffer) {
+			buffer->Events((int) tid, kStageNames, &events);
+		}
+	}
+	if (!events.empty()) {
+		events.pop_back();
+	}
+	return "{\"traceEvents\":[" + events + "],\"displayTimeUnit\":\"ns\"}";
+}
+
+std::string LatencyStats::Json() {
+	json stages;
+	for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+		LatencyHistogram sum;
+		for (LatencyStats *stats = head_.load(std::memory_order_acquire); stats; stats = stats->next_) {
+			sum.Add(stats->histograms_[stage]);
+		}
+		json histogram;
+		histogram["count"] = sum.count();
+		histogram["mean_us"] = sum.Mean() / 1000.0;
+		histogram["p50_us"] = sum.Percentile(0.5) / 1000.0;
+		histogram["p90_us"] = sum.Percentile(0.9) / 1000.0;
+		histogram["p99_us"] = sum.Percentile(0.99) / 1000.0;
+		histogram["p999_us"] = sum.Percentile(0.999) / 1000.0;
+		histogram["max_us"] = sum.max() / 1000.0;
+		stages[kStageNames[stage]] = histogram;
+	}
+	return stages.dump();
+}
+
+std::string LatencyStats::OpenMetrics() {
+	// bounds of 2^10 ns up to 2^35 ns, about 34 s, below the last bucket,
+	// which also holds the longer durations; Bucket(2^k) starts each
+	static const int kFirstBound = 10;
+	static const int kLastBound = LatencyHistogram::kBuckets / LatencyHistogram::kSubBuckets + LatencyHistogram::kSubBits - 2;
+
+	std::string text = "# TYPE ukf_latency_seconds histogram\n"
+		"# UNIT ukf_latency_seconds seconds\n"
+		"# HELP ukf_latency_seconds Durations of the stages of answering a measurement.\n";
+	char line[512];
+	for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+		LatencyHistogram sum;
+		for (LatencyStats *stats = head_.load(std::memory_order_acquire); stats; stats = stats->next_) {
+			sum.Add(stats->histograms_[stage]);
+		}
+		// cumulated from the buckets themselves, which may run ahead of
+		// count_ while other threads record
+		uint64_t below = 0;
+		int bucket = 0;
+		for (int bound = kFirstBound; bound <= kLastBound; bound++) {
+			const int end = (bound - LatencyHistogram::kSubBits + 1) * LatencyHistogram::kSubBuckets;
+			for (; bucket < end && bucket < LatencyHistogram::kBuckets; bucket++) {
+				below += sum.bucket_count(bucket);
+			}
+			snprintf(line, sizeof(line), "ukf_latency_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n",
+			         kStageNames[stage], (double) (uint64_t(1) << bound) / 1e9, (unsigned long long) below);
+			text += line;
+		}
+		for (; bucket < LatencyHistogram::kBuckets; bucket++) {
+			below += sum.bucket_count(bucket);
+		}
+		snprintf(line, sizeof(line), "ukf_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+		         "ukf_latency_seconds_count{stage=\"%s\"} %llu\n"
+		         "ukf_latency_seconds_sum{stage=\"%s\"} %.9g\n",
+		         kStageNames[stage], (unsigned long long) below, kStageNames[stage], (unsigned long long) below,
+		         kStageNames[stage], sum.sum() / 1e9);
+		text += line;
+	}
+	return text;
+}
@@ -0,0 +1,236 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include "trace.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * The stages of answering a message whose durations are recorded.
+ */
+enum LatencyStage {
+  ///* a message, from its handler being called to its answer being sent
+  LATENCY_TOTAL,
+  ///* the telemetry or measurement record of one measurement
+  LATENCY_PARSE,
+  ///* UKF::ProcessMeasurement
+  LATENCY_PREDICTION,
+  LATENCY_UPDATE_LIDAR,
+  LATENCY_UPDATE_RADAR,
+  ///* the estimate_marker message or estimate record
+  LATENCY_SERIALIZE,
+  ///* ws.send: writing the answer to the socket, or queueing it
+  LATENCY_SEND,
+  ///* a frame's wait in a Pipeline, from the loop handing it over to a
+  ///* filter thread taking it up
+  LATENCY_QUEUE,
+  LATENCY_STAGES
+};
+
+/**
+ * Counts of durations in nanoseconds, in buckets of about 6% width (HDR
+ * style: 16 linear buckets per power of two) up to about a minute, which is
+ * recorded as the longest. Written by one thread, read by any: the counts
+ * are atomics only updated with relaxed loads and stores, which cost as
+ * much as plain ones.
+ */
+class LatencyHistogram {
+public:
+  static const int kSubBits = 4;
+  static const int kSubBuckets = 1 << kSubBits;
+  static const int kBuckets = (36 - kSubBits + 1) * kSubBuckets;
+
+  LatencyHistogram();
+
+  void Record(uint64_t nanoseconds) {
+    int bucket = Bucket(nanoseconds);
+    buckets_[bucket].store(buckets_[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum_.store(sum_.load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+    if (nanoseconds > max_.load(std::memory_order_relaxed)) {
+      max_.store(nanoseconds, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Adds other's counts to this one's; for histograms read by one thread.
+   */
+  void Add(const LatencyHistogram &other);
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  uint64_t bucket_count(int bucket) const { return buckets_[bucket].load(std::memory_order_relaxed); }
+  double Mean() const;
+
+  /**
+   * The duration that fraction of the recorded ones do not exceed, as the
+   * upper end of its bucket.
+   */
+  uint64_t Percentile(double fraction) const;
+
+  static int Bucket(uint64_t nanoseconds) {
+    if (nanoseconds < kSubBuckets) {
+      return (int) nanoseconds;
+    }
+    int shift = 63 - __builtin_clzll(nanoseconds) - kSubBits;
+    int bucket = (shift + 1) * kSubBuckets + (int) ((nanoseconds >> shift) & (kSubBuckets - 1));
+    return bucket < kBuckets ? bucket : kBuckets - 1;
+  }
+
+  ///* the longest duration that falls into bucket
+  static uint64_t BucketEnd(int bucket);
+
+private:
+  std::atomic<uint64_t> buckets_[kBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+
+  LatencyHistogram(const LatencyHistogram &);
+  LatencyHistogram &operator=(const LatencyHistogram &);
+};
+
+/**
+ * The latency histograms of one thread, always on. Every thread that
+ * records gets its own the first time, kept for the life of the process;
+ * Json sums those of all threads.
+ *
+ * With tracing on (see SetTracing) a thread also keeps the stages of one
+ * message in every so many as spans in a TraceBuffer, with the track, and
+ * TraceJson gives those of all threads as a Chrome trace, for
+ * chrome://tracing or Perfetto. Off, this costs a load and a branch per
+ * message and per stage.
+ */
+class LatencyStats {
+public:
+  static LatencyStats &Local() {
+    static thread_local LatencyStats *local = Register();
+    return *local;
+  }
+
+  static uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  ///* records the time since start, which came from Now, and returns now
+  uint64_t Record(LatencyStage stage, uint64_t start) {
+    uint64_t now = Now();
+    histograms_[stage].Record(now - start);
+    if (cost_) {
+      cost_[stage] += now - start;
+    }
+    if (trace_) {
+      Traced(stage, start, now);
+    }
+    return now;
+  }
+
+  /**
+   * Traces every message in every'th of each thread, 0 for none; one whose
+   * LATENCY_TOTAL exceeds threshold_ns, if not 0, has the trace written to
+   * trace-<ms since the epoch>.json in the working directory, at most once
+   * every kDumpInterval ms.
+   */
+  static void SetTracing(int every, uint64_t threshold_ns);
+  static const int kDumpInterval = 10000;
+
+  /**
+   * Starts a message of track: if it is the thread's turn, the stages it
+   * records are traced until its LATENCY_TOTAL or StopTrace.
+   * @return whether it is traced, for the threads it goes on to to Follow
+   */
+  bool Trace(int track) {
+    if (!trace_every_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    return Sample(track);
+  }
+
+  ///* traces the stages of a message of track traced on another thread
+  void Follow(int track);
+
+  void StopTrace() { trace_ = nullptr; }
+
+  /**
+   * While it lives, the durations the thread records are also added to
+   * cost, in ns by stage, as well as to the histograms: the work of one
+   * session's messages (see TrackSnapshot::cost_ns), from the same clock
+   * readings, so that it costs an add per stage. The one made last counts;
+   * it gives way to the one before when it goes.
+   */
+  class Attribution {
+  public:
+    explicit Attribution(uint64_t *cost) : latency_(Local()), previous_(latency_.cost_) { latency_.cost_ = cost; }
+    ~Attribution() { latency_.cost_ = previous_; }
+
+  private:
+    LatencyStats &latency_;
+    uint64_t *previous_;
+
+    Attribution(const Attribution &);
+    Attribution &operator=(const Attribution &);
+  };
+
+  /**
+   * Keeps what the calling thread records out of Json, OpenMetrics and
+   * TraceJson, for a thread running filters beside those of the server
+   * (see ShadowFilter); called before the thread records anything.
+   */
+  static void Unlisted();
+
+  ///* the name of stage in the JSON and OpenMetrics documents
+  static const char *StageName(LatencyStage stage);
+
+  /**
+   * The spans held by all threads as a JSON object of the Chrome trace
+   * event format, each thread a tid in the order they first recorded.
+   */
+  static std::string TraceJson();
+
+  /**
+   * Counts, means, percentiles and maxima in microseconds of every stage,
+   * over all threads, as one JSON object.
+   */
+  static std::string Json();
+
+  /**
+   * The same histograms as the ukf_latency_seconds histogram family of the
+   * OpenMetrics text format, one per stage, with a bucket per power of two
+   * nanoseconds from about a microsecond, each counting the durations
+   * shorter than its bound.
+   */
+  static std::string OpenMetrics();
+
+private:
+  LatencyHistogram histograms_[LATENCY_STAGES];
+  LatencyStats *next_;
+
+  ///* the thread's spans, made the first time it traces; trace_ is that
+  ///* while it traces a message of trace_track_
+  std::atomic<TraceBuffer *> trace_buffer_;
+  TraceBuffer *trace_;
+  int trace_track_;
+  ///* messages started since the last one traced
+  int trace_turn_;
+
+  ///* the costs of the current Attribution, or none
+  uint64_t *cost_;
+
+  static std::atomic<LatencyStats *> head_;
+  static std::atomic<int> trace_every_;
+  static std::atomic<uint64_t> trace_threshold_;
+  static std::atomic<uint64_t> last_dump_;
+  static LatencyStats *Register();
+
+  bool Sample(int track);
+  void Traced(LatencyStage stage, uint64_t start, uint64_t now);
+  static void Dump(int track, uint64_t total);
+
+  LatencyStats() : next_(nullptr), trace_buffer_(nullptr), trace_(nullptr), trace_track_(0), trace_turn_(0), cost_(nullptr) {}
+};
+
+#endif /* LATENCY_H_ */
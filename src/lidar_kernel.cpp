@@ -0,0 +1,76 @@
+#include "lidar_kernel.h"
+#include "simd.h"
+#include "ukf_batch_lane.h"
+
+namespace {
+
+const int n_x = lane::n_x;
+
+/**
+* Updates V::width tracks starting at index i, with the arithmetic of
+* lane::UpdateLidar; T is the lane type of V, double or float.
+*/
+template <class V, class T>
+inline void UpdateLanes(const T *const z[2], T *const x[5], T *const P[15], const T R[2], T *nis, int i) {
+	typedef typename V::Vec Vec;
+	Vec p[lane::n_p];
+	for (int e = 0; e < lane::n_p; e++) {
+		p[e] = V::Load(P[e] + i);
+	}
+	const Vec s00 = V::Add(p[lane::Packed(0, 0)], V::Set1(R[0]));
+	const Vec s01 = p[lane::Packed(0, 1)];
+	const Vec s11 = V::Add(p[lane::Packed(1, 1)], V::Set1(R[1]));
+	const Vec inv_det = V::Div(V::Set1(1.0), V::Sub(V::Mul(s00, s11), V::Mul(s01, s01)));
+	const Vec si00 = V::Mul(s11, inv_det);
+	const Vec si01 = V::Sub(V::Set1(0.0), V::Mul(s01, inv_det));
+	const Vec si11 = V::Mul(s00, inv_det);
+
+	const Vec y0 = V::Sub(V::Load(z[0] + i), V::Load(x[0] + i));
+	const Vec y1 = V::Sub(V::Load(z[1] + i), V::Load(x[1] + i));
+
+	// P H^T, the first two columns of P, which are also H P by symmetry,
+	// and K = P H^T Si
+	Vec ph0[n_x], ph1[n_x], K0[n_x], K1[n_x];
+	for (int k = 0; k < n_x; k++) {
+		ph0[k] = p[lane::Packed(k, 0)];
+		ph1[k] = p[lane::Packed(k, 1)];
+		K0[k] = V::Add(V::Mul(ph0[k], si00), V::Mul(ph1[k], si01));
+		K1[k] = V::Add(V::Mul(ph0[k], si01), V::Mul(ph1[k], si11));
+	}
+
+	for (int k = 0; k < n_x; k++) {
+		const Vec x_k = V::Load(x[k] + i);
+		V::Store(x[k] + i, V::Add(x_k, V::Add(V::Mul(K0[k], y0), V::Mul(K1[k], y1))));
+		for (int c = k; c < n_x; c++) {
+			const int e = lane::Packed(k, c);
+			V::Store(P[e] + i, V::Sub(p[e], V::Add(V::Mul(K0[c], ph0[k]), V::Mul(K1[c], ph1[k]))));
+		}
+	}
+
+	const Vec w0 = V::Add(V::Mul(si00, y0), V::Mul(si01, y1));
+	const Vec w1 = V::Add(V::Mul(si01, y0), V::Mul(si11, y1));
+	V::Store(nis + i, V::Add(V::Mul(y0, w0), V::Mul(y1, w1)));
+}
+
+template <class V, class S, class T>
+inline void UpdateAll(const T *const z[2], T *const x[5], T *const P[15], const T R[2], T *nis, int n) {
+	int i = 0;
+	for (; i + V::width <= n; i += V::width) {
+		UpdateLanes<V>(z, x, P, R, nis, i);
+	}
+	for (; i < n; i++) {
+		UpdateLanes<S>(z, x, P, R, nis, i);
+	}
+}
+
+}
+
+void UpdateLidar(const double *const z[2], double *const x[5], double *const P[15],
+                 const double R[2], double *nis, int n) {
+	UpdateAll<simd::NativeDouble, simd::ScalarDouble>(z, x, P, R, nis, n);
+}
+
+void UpdateLidar(const float *const z[2], float *const x[5], float *const P[15],
+                 const float R[2], float *nis, int n) {
+	UpdateAll<simd::NativeFloat, simd::ScalarFloat>(z, x, P, R, nis, n);
+}
@@ -0,0 +1,30 @@
+#ifndef LIDAR_KERNEL_H_
+#define LIDAR_KERNEL_H_
+
+/**
+ * Linear lidar updates of n tracks side by side, the lidar update of the
+ * batched filter: lane::UpdateLidar across tracks rather than one at a time.
+ *
+ * The tracks are given component-wise, as in cholesky_kernel.h: x[k][i] is
+ * state component k of track i, P[lane::Packed(r, c)][i] entry (r, c) of
+ * its packed covariance, and z[0..1][i] its measured p_x and p_y. Both are
+ * updated in place, the 2x2 innovation covariance inverted in closed form
+ * and the covariance downdated in its packed triangle, simd::NativeDouble
+ * lanes at a time.
+ * @param z 2 measurement component arrays of n tracks each
+ * @param x 5 state component arrays of n tracks each
+ * @param P 15 packed covariance arrays of n tracks each
+ * @param R The lidar noise variances of p_x and p_y
+ * @param nis n outputs, the NIS of each update
+ * @param n Number of tracks
+ */
+void UpdateLidar(const double *const z[2], double *const x[5], double *const P[15],
+                 const double R[2], double *nis, int n);
+
+/**
+ * The same in single precision, simd::NativeFloat lanes wide.
+ */
+void UpdateLidar(const float *const z[2], float *const x[5], float *const P[15],
+                 const float R[2], float *nis, int n);
+
+#endif /* LIDAR_KERNEL_H_ */
@@ -0,0 +1,46 @@
+#include "load_shedder.h"
+#include <climits>
+#include <cmath>
+
+const double LoadShedder::kLowInformationNIS = 0.5;
+
+LoadShedder::LoadShedder() : backlog_(0), lag_ns_(0) {
+	Reset();
+}
+
+void LoadShedder::Configure(size_t backlog, long long lag_us) {
+	backlog_ = backlog;
+	lag_ns_ = lag_us > 0 ? uint64_t(lag_us) * 1000 : 0;
+}
+
+LoadShedder::Decision LoadShedder::Decide(const CTRVUKF &ukf, const MeasurementPackage &meas_package) const {
+	if (!ukf.is_initialized_) {
+		return USE;
+	}
+	if (meas_package.timestamp_ == last_used_[meas_package.sensor_type_]) {
+		return SHED_REDUNDANT;
+	}
+	if (meas_package.sensor_type_ != MeasurementPackage::LASER) {
+		return USE;
+	}
+
+	//the position at constant velocity, and the innovation covariance of
+	//the position without the process noise since the filter's state
+	const double dt = (meas_package.timestamp_ - ukf.time_us_) / 1000000.0;
+	const double v_dt = ukf.x_(2) * dt;
+	const double dx = meas_package.raw_measurements_(0) - (ukf.x_(0) + v_dt * cos(ukf.x_(3)));
+	const double dy = meas_package.raw_measurements_(1) - (ukf.x_(1) + v_dt * sin(ukf.x_(3)));
+	const Eigen::Matrix2d S = ukf.P_.topLeftCorner<2, 2>() + ukf.config().R_laser_;
+	const double det = S(0, 0)*S(1, 1) - S(0, 1)*S(1, 0);
+	const double nis = (S(1, 1)*dx*dx - 2.0*S(0, 1)*dx*dy + S(0, 0)*dy*dy) / det;
+	return nis < kLowInformationNIS ? SHED_LOW_INFORMATION : USE;
+}
+
+void LoadShedder::Used(const MeasurementPackage &meas_package) {
+	last_used_[meas_package.sensor_type_] = meas_package.timestamp_;
+}
+
+void LoadShedder::Reset() {
+	last_used_[MeasurementPackage::LASER] = LLONG_MIN;
+	last_used_[MeasurementPackage::RADAR] = LLONG_MIN;
+}
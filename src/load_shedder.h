@@ -0,0 +1,77 @@
+#ifndef LOAD_SHEDDER_H_
+#define LOAD_SHEDDER_H_
+
+#include "measurement_package.h"
+#include "ukf.h"
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Decides which measurements of a burst a session skips while it cannot
+ * keep up, so that its latency stays bounded at some cost in accuracy. The
+ * session counts as overloaded while more than a backlog of measurements of
+ * the message it is working on remain, or once the message has taken longer
+ * than a lag. Overloaded, it skips
+ *   - a measurement of the sensor and timestamp of the last one it used,
+ *     which adds little to it
+ *   - a lidar measurement that lies close to where the filter expects it,
+ *     NIS below kLowInformationNIS, which would hardly move the estimate
+ * and uses everything else. A skipped measurement is not predicted to: the
+ * filter's next update predicts over the whole interval, as it does after a
+ * measurement of an unused sensor, so the prediction stays exact.
+ *
+ * The lidar NIS here comes from the estimate extrapolated at constant
+ * velocity and the position covariance without the process noise since,
+ * not from a prediction, which would cost about what the update saves. It
+ * overstates the NIS, so it errs towards using measurements.
+ */
+class LoadShedder {
+public:
+  ///* the lidar NIS below which an overloaded session skips a measurement;
+  ///* about a fifth of the measurements of a consistent filter are below
+  static const double kLowInformationNIS;
+
+  enum Decision {
+    USE,
+    SHED_REDUNDANT,
+    SHED_LOW_INFORMATION
+  };
+
+  LoadShedder();
+
+  /**
+   * @param backlog Measurements still to process in the current message
+   * beyond which the session is overloaded, 0 for no limit
+   * @param lag_us Time in us the session may spend on one message before it
+   * is overloaded, 0 for no limit
+   */
+  void Configure(size_t backlog, long long lag_us);
+
+  ///* whether either limit is set
+  bool enabled() const { return backlog_ || lag_ns_; }
+
+  ///* with backlog measurements of a message left and elapsed_ns spent on it
+  bool Overloaded(size_t backlog, uint64_t elapsed_ns) const {
+    return (backlog_ && backlog > backlog_) || (lag_ns_ && elapsed_ns > lag_ns_);
+  }
+
+  /**
+   * What an overloaded session does with meas_package, for ukf as it is
+   * before the measurement
+   */
+  Decision Decide(const CTRVUKF &ukf, const MeasurementPackage &meas_package) const;
+
+  ///* notes a measurement the filter used
+  void Used(const MeasurementPackage &meas_package);
+
+  ///* forgets the measurements used, for a new track
+  void Reset();
+
+private:
+  size_t backlog_;
+  uint64_t lag_ns_;
+  ///* timestamp of the last measurement used, by sensor type
+  long long last_used_[2];
+};
+
+#endif /* LOAD_SHEDDER_H_ */
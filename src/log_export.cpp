@@ -0,0 +1,240 @@
+#include "log_export.h"
+#include "measurement_log.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kChunkedEnd[] = "0\r\n\r\n";
+
+///* writes the head of a chunked body of content_type
+void WriteChunkedHead(uWS::HttpResponse *res, const char *content_type) {
+	std::string head = std::string("HTTP/1.1 200 OK\r\nContent-Type: ") + content_type
+		+ "\r\nTransfer-Encoding: chunked\r\n\r\n";
+	res->write(head.data(), head.length());
+}
+
+///* whether an estimate log line is of track; the header comments go with
+///* every track
+bool OfTrack(const char *line, int64_t track) {
+	if (*line == '#') {
+		return true;
+	}
+	char *end;
+	return strtoll(line, &end, 10) == track && end != line && *end == ' ';
+}
+
+}
+
+const size_t LogExport::kChunkSize;
+
+LogExport::LogExport(uWS::HttpResponse *res, Kind kind, int fd, off_t end)
+	: res_(res), kind_(kind), fd_(fd), offset_(0), end_(end), track_(-1), block_size_(0), capacity_(0), compressed_(false),
+	  pumping_(false), ready_(false) {
+}
+
+LogExport::~LogExport() {
+	close(fd_);
+}
+
+LogExport *LogExport::Open(uWS::HttpResponse *res, Kind kind, const char *path) {
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return nullptr;
+	}
+	return new LogExport(res, kind, fd, st.st_size);
+}
+
+bool LogExport::SendFile(uWS::HttpResponse *res, const char *path, const char *content_type) {
+	LogExport *export_ = Open(res, FILE_BODY, path);
+	if (!export_) {
+		return false;
+	}
+	std::string head = std::string("HTTP/1.1 200 OK\r\nContent-Type: ") + content_type + "\r\nContent-Length: "
+		+ std::to_string((long long) export_->end_) + "\r\n\r\n";
+	res->write(head.data(), head.length());
+	res->extraUserData = export_;
+	export_->Pump();
+	return true;
+}
+
+bool LogExport::SendMeasurements(uWS::HttpResponse *res, const char *path, uint32_t track) {
+	LogExport *export_ = Open(res, MEASUREMENTS, path);
+	if (!export_) {
+		return false;
+	}
+	char header[measurement_log::kHeaderSize];
+	size_t capacity;
+	uint64_t index_offset;
+	bool compressed;
+	if (pread(export_->fd_, header, sizeof(header), 0) != (ssize_t) sizeof(header)
+	    || !MeasurementLog::ParseHeader(header, &capacity, &index_offset, &compressed)) {
+		delete export_;
+		return false;
+	}
+	//the blocks end where the index of a closed log starts
+	if (index_offset && (off_t) index_offset < export_->end_) {
+		export_->end_ = index_offset;
+	}
+	export_->track_ = track;
+	export_->offset_ = measurement_log::kHeaderSize;
+	export_->capacity_ = capacity;
+	export_->compressed_ = compressed;
+	export_->block_size_ = measurement_log::BlockSize(capacity);
+	export_->block_.resize((export_->block_size_ + 7) / 8);
+	WriteChunkedHead(res, "text/plain");
+	res->extraUserData = export_;
+	export_->Pump();
+	return true;
+}
+
+bool LogExport::SendEstimates(uWS::HttpResponse *res, const char *path, int track) {
+	LogExport *export_ = Open(res, ESTIMATES, path);
+	if (!export_) {
+		return false;
+	}
+	export_->track_ = track;
+	WriteChunkedHead(res, "text/plain");
+	res->extraUserData = export_;
+	export_->Pump();
+	return true;
+}
+
+void LogExport::Cancel(uWS::HttpResponse *res) {
+	delete static_cast<LogExport *>(res->extraUserData);
+	res->extraUserData = nullptr;
+}
+
+void LogExport::Pump() {
+	//the parts go out as the socket takes them, not into the cork buffer of
+	//the read that asked for them (see HttpResponse::flush)
+	res_->flush();
+	pumping_ = true;
+	do {
+		ready_ = false;
+		if (kind_ == FILE_BODY) {
+			while (offset_ < end_ && res_->sendFile(fd_, &offset_, end_ - offset_)) {
+			}
+			if (offset_ < end_) {
+				chunk_.resize(std::min<off_t>(kChunkSize, end_ - offset_));
+				const ssize_t n = pread(fd_, &chunk_[0], chunk_.size(), offset_);
+				if (n <= 0) {
+					//the file shrank under the Content-Length sent; the client
+					//is cut off, and Cancel frees the export
+					uWS::HttpSocket<true> socket = res_->getHttpSocket();
+					socket.terminate();
+					return;
+				}
+				offset_ += n;
+				res_->write(chunk_.data(), n, Written, this);
+				continue;
+			}
+			res_->extraUserData = nullptr;
+			res_->end(nullptr, 0);
+			delete this;
+			return;
+		}
+		if (!Fill()) {
+			res_->extraUserData = nullptr;
+			res_->end(kChunkedEnd, sizeof(kChunkedEnd) - 1);
+			delete this;
+			return;
+		}
+		res_->writeChunk(chunk_.data(), chunk_.size(), Written, this);
+	} while (ready_);
+	pumping_ = false;
+}
+
+bool LogExport::Fill() {
+	chunk_.clear();
+	if (kind_ == MEASUREMENTS) {
+		char *block = reinterpret_cast<char *>(block_.data());
+		while (chunk_.size() < kChunkSize && offset_ < end_) {
+			MeasurementLog::Block columns;
+			off_t next = offset_ + block_size_;
+			if (compressed_) {
+				uint32_t length = 0;
+				if (pread(fd_, &length, sizeof(length), offset_) == (ssize_t) sizeof(length)) {
+					next = offset_ + measurement_log::kFrameHeaderSize + length;
+				}
+				if (next <= end_) {
+					frame_.resize(length);
+				}
+				if (next > end_ || pread(fd_, frame_.data(), length, offset_ + measurement_log::kFrameHeaderSize) != (ssize_t) length
+				    || !MeasurementLog::InflateBlock(frame_.data(), length, capacity_, block)) {
+					next = end_ + 1;
+				}
+			}
+			else if (next <= end_ && pread(fd_, block, block_size_, offset_) != (ssize_t) block_size_) {
+				next = end_ + 1;
+			}
+			if (next > end_ || !MeasurementLog::ParseBlock(block, capacity_, &columns)) {
+				end_ = offset_;
+				break;
+			}
+			offset_ = next;
+			char line[256];
+			for (size_t i = 0; i < columns.count; i++) {
+				if (columns.track[i] != track_) {
+					continue;
+				}
+				int n;
+				if (columns.sensor[i]) {
+					n = snprintf(line, sizeof(line), "R\t%.6f\t%.6f\t%.6f\t%lld", columns.z[0][i], columns.z[1][i],
+					             columns.z[2][i], (long long) columns.timestamp[i]);
+				}
+				else {
+					n = snprintf(line, sizeof(line), "L\t%.6f\t%.6f\t%lld", columns.z[0][i], columns.z[1][i],
+					             (long long) columns.timestamp[i]);
+				}
+				if (columns.flags[i] & measurement_log::kHasGroundTruth) {
+					n += snprintf(line + n, sizeof(line) - n, "\t%.6f\t%.6f\t%.6f\t%.6f", columns.truth[0][i],
+					              columns.truth[1][i], columns.truth[2][i], columns.truth[3][i]);
+				}
+				line[n++] = '\n';
+				chunk_.append(line, n);
+			}
+		}
+		return !chunk_.empty();
+	}
+
+	//a line still being written past the end is left out
+	char buffer[kChunkSize];
+	while (chunk_.size() < kChunkSize && offset_ < end_) {
+		const ssize_t n = pread(fd_, buffer, std::min<off_t>(sizeof(buffer), end_ - offset_), offset_);
+		if (n <= 0) {
+			end_ = offset_;
+			break;
+		}
+		offset_ += n;
+		line_.append(buffer, n);
+		size_t start = 0;
+		for (size_t newline; (newline = line_.find('\n', start)) != std::string::npos; start = newline + 1) {
+			if (OfTrack(line_.c_str() + start, track_)) {
+				chunk_.append(line_, start, newline + 1 - start);
+			}
+		}
+		line_.erase(0, start);
+	}
+	return !chunk_.empty();
+}
+
+void LogExport::Written(void *socket, void *data, bool cancelled, void *reserved) {
+	if (cancelled) {
+		return;
+	}
+	LogExport *export_ = static_cast<LogExport *>(data);
+	export_->ready_ = true;
+	if (!export_->pumping_) {
+		export_->Pump();
+	}
+}
@@ -0,0 +1,99 @@
+#ifndef LOG_EXPORT_H_
+#define LOG_EXPORT_H_
+
+#include <uWS/uWS.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Streams a recorded log to an HTTP client, as far as it is written when
+ * the request comes, without building the body in memory: a part is
+ * produced only once the socket has taken the one before. The loop goes on
+ * serving its sessions in between, however large the log.
+ *
+ * A whole log goes out with its Content-Length, straight from the page
+ * cache with sendfile where the socket allows (see HttpResponse::sendFile):
+ * only when the kernel takes no more is a kChunkSize part read and queued,
+ * to be called back once it drains. The measurements or estimates of one
+ * track are filtered into text as they go, and sent with Transfer-Encoding:
+ * chunked, since their length is not known up front: the measurements of a
+ * measurement log (see measurement_log.h) as the lines of --replay, read a
+ * block at a time, and the lines of that track of a text EstimateLog.
+ *
+ * An export belongs to its response's loop and frees itself when it is
+ * done; if the client goes first, Cancel frees it.
+ */
+class LogExport {
+public:
+  ///* bytes read or formatted at once
+  static const size_t kChunkSize = 64 * 1024;
+
+  /**
+   * Answers res with the file at path, of content_type.
+   * @return false, with nothing sent, if it cannot be read
+   */
+  static bool SendFile(uWS::HttpResponse *res, const char *path, const char *content_type);
+
+  /**
+   * Answers res with the measurements of track in the measurement log at
+   * path.
+   * @return false, with nothing sent, if it cannot be read or is not a log
+   */
+  static bool SendMeasurements(uWS::HttpResponse *res, const char *path, uint32_t track);
+
+  /**
+   * Answers res with the lines of track in the text estimate log at path.
+   * @return false, with nothing sent, if it cannot be read
+   */
+  static bool SendEstimates(uWS::HttpResponse *res, const char *path, int track);
+
+  ///* frees the export of a response whose client went away, if it has one
+  static void Cancel(uWS::HttpResponse *res);
+
+private:
+  enum Kind { FILE_BODY, MEASUREMENTS, ESTIMATES };
+
+  uWS::HttpResponse *res_;
+  Kind kind_;
+  int fd_;
+  ///* the next byte of the file to send or read, and its size at the
+  ///* request
+  off_t offset_;
+  off_t end_;
+  int64_t track_;
+
+  ///* of a measurement log: the block size and measurements per block,
+  ///* and of a compressed one the frame read to inflate the block from
+  size_t block_size_;
+  size_t capacity_;
+  std::vector<uint64_t> block_;
+  bool compressed_;
+  std::vector<char> frame_;
+
+  ///* the part being sent, and of an estimate log the line it ends within
+  std::string chunk_;
+  std::string line_;
+
+  ///* within Pump, and called back meanwhile
+  bool pumping_;
+  bool ready_;
+
+  LogExport(uWS::HttpResponse *res, Kind kind, int fd, off_t end);
+  ~LogExport();
+
+  static LogExport *Open(uWS::HttpResponse *res, Kind kind, const char *path);
+
+  ///* sends parts while the socket takes them
+  void Pump();
+
+  ///* the next part of a filtered export into chunk_; false at the end
+  bool Fill();
+
+  static void Written(void *socket, void *data, bool cancelled, void *reserved);
+
+  LogExport(const LogExport &);
+  LogExport &operator=(const LogExport &);
+};
+
+#endif /* LOG_EXPORT_H_ */
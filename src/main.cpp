@@ -1,190 +1,1759 @@
 #include <uWS/uWS.h>
+#include <algorithm>
 #include <iostream>
-#include "json.hpp"
+#include <limits.h>
 #include <math.h>
-#include "ukf.h"
-#include "tools.h"
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "config_registry.h"
+#include "generator.h"
+#include "geofence.h"
+#include "latency.h"
+#include "log_export.h"
+#include "huge_pages.h"
+#include "memory_budget.h"
+#include "qos_governor.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "process_handoff.h"
+#include "replay.h"
+#include "session.h"
+#include "session_balancer.h"
+#include "session_resumption.h"
+#include "shadow_filter.h"
+#include "shard_router.h"
+#include "shm_track_table.h"
+#include "shm_transport.h"
+#include "track_index.h"
+#include "track_publisher.h"
+#include "track_relay.h"
+#include "track_state.h"
+#include "udp_listener.h"
 
 using namespace std;
 
-// for convenience
-using json = nlohmann::json;
+/**
+ * The --rate-limit options: the messages and bytes a second each client
+ * may send, 0 for no limit, and what happens to a message past them.
+ */
+struct RateLimitOptions {
+	double messages;
+	double bytes;
+	uWS::Group<uWS::SERVER>::RateLimitAction action;
+};
 
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-std::string hasData(std::string s) {
-	auto found_null = s.find("null");
-	auto b1 = s.find_first_of("[");
-	auto b2 = s.find_first_of("]");
-	if (found_null != std::string::npos) {
-		return "";
+/**
+ * The --send-batch options: how long in us the replies to a client are
+ * held to go out together, 0 not at all, and how many bytes of them make
+ * it go out earlier.
+ */
+struct SendBatchOptions {
+	int micros;
+	size_t bytes;
+};
+
+/**
+ * The --admit options: the most connections a loop serves and the busy
+ * fraction of its time past which it takes no more, 0 for no limit, and
+ * what happens to a connection it does not take.
+ */
+struct AdmissionOptions {
+	size_t connections;
+	double busy;
+	uWS::Group<uWS::SERVER>::Admission action;
+};
+
+/**
+ * Installs the handlers that give every connection of h its own session
+ * from sessions; clients with more than high_watermark bytes waiting are
+ * handled by policy, and those sending faster than rate_limit by its
+ * action. New connections past the limits of admission are deferred or
+ * rejected before their upgrade. Replies of 16 KB and more, the batched
+ * ones, queue behind the smaller ones and pings. The replies are held as
+ * send_batch says, or as a connection asks with ?batch=<us> in its URL,
+ * and its session is of the QoS class it asks for with ?qos=<class> (see
+ * Session::QosClass). A connection gets its estimates in the output format
+ * its subprotocol names, if any (see Session::OutputFormat). A connection
+ * presenting a session token goes on with the track parked under it, if
+ * any (see SessionResumption). With a pipeline the measurements are
+ * filtered on its threads, otherwise on h's.
+ */
+void ServeSessions(uWS::Hub &h, SessionPool &sessions, size_t high_watermark,
+                   uWS::Group<uWS::SERVER>::Backpressure policy, const RateLimitOptions &rate_limit,
+                   const SendBatchOptions &send_batch, const AdmissionOptions &admission, Pipeline *pipeline)
+{
+	h.getDefaultGroup<uWS::SERVER>().setBackpressure(high_watermark, policy);
+	h.getDefaultGroup<uWS::SERVER>().onBackpressure([](uWS::WebSocket<uWS::SERVER> ws, size_t buffered) {
+		std::cerr << "Client falling behind, " << buffered << " bytes waiting" << std::endl;
+	});
+	h.getDefaultGroup<uWS::SERVER>().setRateLimit(rate_limit.messages, rate_limit.bytes, rate_limit.action);
+	h.getDefaultGroup<uWS::SERVER>().setBulkLength(16 * 1024);
+	// an estimate marker of ~150 bytes saves less than deflating it costs;
+	// a connection whose messages shrink by under 10%, or cost over 100 ns a
+	// byte saved, gets them uncompressed
+	h.getDefaultGroup<uWS::SERVER>().setCompressionThreshold(256, 0.1, 100);
+	h.getDefaultGroup<uWS::SERVER>().setSendBatching(send_batch.micros, send_batch.bytes);
+	h.getDefaultGroup<uWS::SERVER>().setAdmission(admission.connections, admission.busy, admission.action);
+	h.getDefaultGroup<uWS::SERVER>().onRateLimit([](uWS::WebSocket<uWS::SERVER> ws,
+	                                                uWS::Group<uWS::SERVER>::RateLimit limit) {
+		Metrics::Local().Add(limit == uWS::Group<uWS::SERVER>::MESSAGE_RATE ? METRIC_RATE_LIMITED_MESSAGES
+		                                                                   : METRIC_RATE_LIMITED_BYTES);
+	});
+
+	// bound at compile time, so the frame parser calls into the session
+	// without going through a std::function
+	if (pipeline) {
+		h.onMessage<Pipeline, &Pipeline::OnMessage>(pipeline);
 	}
-	else if (b1 != std::string::npos && b2 != std::string::npos) {
-		return s.substr(b1, b2 - b1 + 1);
+	else {
+		h.onMessage<SessionPool, &SessionPool::OnMessage>(&sessions);
+	}
+
+	h.onConnection([&sessions](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+		// a socket handed over by another worker brings its track along, see
+		// SessionBalancer
+		std::string *state = static_cast<std::string *>(ws.getUserData());
+		Session *session = sessions.Acquire();
+		if (state) {
+			if (!session->Thaw(state->data(), state->length())) {
+				std::cerr << "Ignoring a malformed track handoff" << std::endl;
+			}
+			delete state;
+			ws.setUserData(session);
+			return;
+		}
+		ws.setUserData(session);
+		// a dashboard may take its estimates in batches, a planner not
+		uWS::Header url = req.getUrl();
+		std::string path(url.value, url.valueLength);
+		// a machine client asks for its estimates in binary
+		uWS::Header protocols = req.getHeader(uWS::HEADER_SEC_WEBSOCKET_PROTOCOL);
+		session->set_output_format(Session::ParseOutputFormat(protocols.value, protocols.valueLength));
+		// a client back after a drop goes on with its track
+		std::string token;
+		if (SessionResumption::ParseToken(url.value, url.valueLength, protocols.value, protocols.valueLength, &token)
+		    && sessions.Resume(session, token)) {
+			std::cout << "Resumed track " << session->id() << std::endl;
+		}
+		static const std::string batch("batch=");
+		size_t query = path.find('?');
+		size_t value = query == std::string::npos ? query : path.find(batch, query);
+		if (value != std::string::npos) {
+			ws.setSendBatching(std::max(0, atoi(path.c_str() + value + batch.length())));
+		}
+		// a background track is the first to be degraded under load, a
+		// premium one never
+		static const std::string qos("qos=");
+		value = query == std::string::npos ? query : path.find(qos, query);
+		if (value != std::string::npos) {
+			const size_t begin = value + qos.length();
+			const size_t end = std::min(path.find('&', begin), path.length());
+			Session::QosClass qos_class;
+			if (Session::ParseQosClass(path.data() + begin, end - begin, &qos_class)) {
+				session->set_qos_class(qos_class);
+			}
+		}
+		std::cout << "Connected!!!" << std::endl;
+	});
+
+	h.onDisconnection([&sessions, pipeline](uWS::WebSocket<uWS::SERVER> ws, int code, char *message, size_t length) {
+		// the socket is already closing here; calling ws.close() again would
+		// re-enter this handler
+		Session *session = static_cast<Session *>(ws.getUserData());
+		if (pipeline) {
+			pipeline->Release(session);
+		}
+		else {
+			sessions.Release(session);
+		}
+		ws.setUserData(nullptr);
+		std::cout << "Disconnected" << std::endl;
+	});
+}
+
+/**
+ * Creates the shared-memory channels <path>.<i> of worker index out of
+ * workers, every workers-th of the given number, on transport.
+ */
+bool ServeShm(ShmTransport &transport, const char *path, int channels, int index, int workers)
+{
+	for (int i = index; i < channels; i += workers) {
+		const std::string channel = std::string(path) + "." + std::to_string(i);
+		if (!transport.Add(channel.c_str())) {
+			std::cerr << "Cannot create " << channel << std::endl;
+			return false;
+		}
+		std::cout << "Serving drivers on " << channel << std::endl;
 	}
-	return "";
+	return true;
 }
 
-int main()
+/**
+ * Reports whether listening on the Unix domain socket at path succeeded.
+ */
+bool ListenUnix(bool listening, const char *path)
 {
-	uWS::Hub h;
+	if (listening) {
+		std::cout << "Listening to " << path << std::endl;
+	}
+	else {
+		std::cerr << "Failed to listen to " << path << std::endl;
+	}
+	return listening;
+}
 
-	// Create a Kalman Filter instance
-	UKF ukf;
+/**
+ * Has h's loop poll for spin_micros before it sleeps; only the micro uUV
+ * loop can.
+ */
+void SpinLoop(uWS::Hub &h, int spin_micros)
+{
+#ifdef USE_MICRO_UV
+	uv_loop_set_spin(h.getLoop(), spin_micros);
+#endif
+}
 
-	// used to compute the RMSE later
-	Tools tools;
-	vector<VectorXd> estimations;
-	vector<VectorXd> ground_truth;
+/**
+ * Moves h's buffers onto huge pages in the mode of HugePages, if it is not
+ * off, and says so if they could not be (see Node::useHugePages); on h's
+ * thread, before its loop runs.
+ */
+void UseHugePages(uWS::Hub &h)
+{
+	if (HugePages::enabled() && !h.useHugePages(HugePages::mode() == HugePages::MODE_EXPLICIT)) {
+		std::cerr << "Cannot put the loop's buffers on huge pages" << std::endl;
+	}
+}
 
-	h.onMessage([&ukf, &tools, &estimations, &ground_truth](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode) {
-		// "42" at the start of the message means there's a websocket message event.
-		// The 4 signifies a websocket message
-		// The 2 signifies a websocket event
+/**
+ * Prepares h's loop and its sessions for the first connections (see
+ * Hub::prefault and SessionPool::WarmUp), and reports how long it took.
+ */
+void WarmUp(uWS::Hub &h, SessionPool &sessions, int warmup_sessions, bool huge_pages)
+{
+	// enough to take each filter through initialization, both updates and
+	// a few turns of the covariance
+	static const int kSteps = 32;
+	const uint64_t start = LatencyStats::Now();
+	h.prefault();
+	sessions.WarmUp(warmup_sessions, kSteps, huge_pages);
+	std::cout << "Warmed up " << warmup_sessions << " sessions (" << (LatencyStats::Now() - start) / 1e6 << " ms)" << std::endl;
+}
 
-		if (length && length > 2 && data[0] == '4' && data[1] == '2')
-		{
+/**
+ * Reads a --rate-limit-action name into action; false if there is none of
+ * that name.
+ */
+bool ParseRateLimitAction(const std::string &name, uWS::Group<uWS::SERVER>::RateLimitAction *action)
+{
+	if (name == "drop") {
+		*action = uWS::Group<uWS::SERVER>::DROP_MESSAGE;
+	}
+	else if (name == "pause") {
+		*action = uWS::Group<uWS::SERVER>::PAUSE_READING;
+	}
+	else if (name == "disconnect") {
+		*action = uWS::Group<uWS::SERVER>::DISCONNECT_SENDER;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
 
-			auto s = hasData(std::string(data));
-			if (s != "") {
-
-				auto j = json::parse(s);
-
-				std::string event = j[0].get<std::string>();
-
-				if (event == "telemetry") {
-					// j[1] is the data JSON object
-
-					string sensor_measurment = j[1]["sensor_measurement"];
-
-					MeasurementPackage meas_package;
-					istringstream iss(sensor_measurment);
-					long long timestamp;
-
-					// reads first element from the current line
-					string sensor_type;
-					iss >> sensor_type;
-
-					if (sensor_type.compare("L") == 0) {
-						meas_package.sensor_type_ = MeasurementPackage::LASER;
-						meas_package.raw_measurements_ = VectorXd(2);
-						float px;
-						float py;
-						iss >> px;
-						iss >> py;
-						meas_package.raw_measurements_ << px, py;
-						iss >> timestamp;
-						meas_package.timestamp_ = timestamp;
-					}
-					else if (sensor_type.compare("R") == 0) {
-
-						meas_package.sensor_type_ = MeasurementPackage::RADAR;
-						meas_package.raw_measurements_ = VectorXd(3);
-						float ro;
-						float theta;
-						float ro_dot;
-						iss >> ro;
-						iss >> theta;
-						iss >> ro_dot;
-						meas_package.raw_measurements_ << ro, theta, ro_dot;
-						iss >> timestamp;
-						meas_package.timestamp_ = timestamp;
-					}
-					float x_gt;
-					float y_gt;
-					float vx_gt;
-					float vy_gt;
-					iss >> x_gt;
-					iss >> y_gt;
-					iss >> vx_gt;
-					iss >> vy_gt;
-					VectorXd gt_values(4);
-					gt_values(0) = x_gt;
-					gt_values(1) = y_gt;
-					gt_values(2) = vx_gt;
-					gt_values(3) = vy_gt;
-					ground_truth.push_back(gt_values);
-
-					//Call ProcessMeasurment(meas_package) for Kalman filter
-					ukf.ProcessMeasurement(meas_package);
-
-					//Push the current estimated x,y positon from the Kalman filter's state vector
-
-					VectorXd estimate(4);
-
-					double p_x = ukf.x_(0);
-					double p_y = ukf.x_(1);
-					double v = ukf.x_(2);
-					double yaw = ukf.x_(3);
-
-					double v1 = cos(yaw)*v;
-					double v2 = sin(yaw)*v;
-
-					estimate(0) = p_x;
-					estimate(1) = p_y;
-					estimate(2) = v1;
-					estimate(3) = v2;
-
-					estimations.push_back(estimate);
-
-					VectorXd RMSE = tools.CalculateRMSE(estimations, ground_truth);
-
-					json msgJson;
-					msgJson["estimate_x"] = p_x;
-					msgJson["estimate_y"] = p_y;
-					msgJson["rmse_x"] = RMSE(0);
-					msgJson["rmse_y"] = RMSE(1);
-					msgJson["rmse_vx"] = RMSE(2);
-					msgJson["rmse_vy"] = RMSE(3);
-					auto msg = "42[\"estimate_marker\"," + msgJson.dump() + "]";
-					// std::cout << msg << std::endl;
-					ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+/**
+ * Reads a --admit-action name into action; false if there is none of that
+ * name.
+ */
+bool ParseAdmission(const std::string &name, uWS::Group<uWS::SERVER>::Admission *action)
+{
+	if (name == "defer") {
+		*action = uWS::Group<uWS::SERVER>::DEFER_CONNECTION;
+	}
+	else if (name == "reject") {
+		*action = uWS::Group<uWS::SERVER>::REJECT_CONNECTION;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
 
+/**
+ * Reads a --backpressure policy name into policy; false if there is none
+ * of that name.
+ */
+bool ParseBackpressure(const std::string &name, uWS::Group<uWS::SERVER>::Backpressure *policy)
+{
+	if (name == "buffer") {
+		*policy = uWS::Group<uWS::SERVER>::BUFFER;
+	}
+	else if (name == "drop-oldest") {
+		*policy = uWS::Group<uWS::SERVER>::DROP_OLDEST;
+	}
+	else if (name == "coalesce") {
+		*policy = uWS::Group<uWS::SERVER>::COALESCE_LATEST;
+	}
+	else if (name == "disconnect") {
+		*policy = uWS::Group<uWS::SERVER>::DISCONNECT;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Reads a --cpus list into cpus: CPU numbers and ranges such as 0-3,8, and
+ * nodeN for all CPUs of NUMA node N as Linux lists them; false if it is
+ * malformed or names a node that does not exist.
+ */
+bool ParseCpuList(const std::string &list, std::vector<int> *cpus)
+{
+	size_t begin = 0;
+	while (begin <= list.length()) {
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos) {
+			end = list.length();
+		}
+		std::string item = list.substr(begin, end - begin);
+		begin = end + 1;
+		if (item.compare(0, 4, "node") == 0) {
+			std::string path = "/sys/devices/system/node/" + item + "/cpulist";
+			char line[4096];
+			FILE *file = fopen(path.c_str(), "r");
+			bool ok = file && fgets(line, sizeof(line), file);
+			if (file) {
+				fclose(file);
+			}
+			std::string node_list = ok ? std::string(line) : std::string();
+			while (!node_list.empty() && (node_list.back() == '\n' || node_list.back() == ' ')) {
+				node_list.pop_back();
+			}
+			if (node_list.empty() || node_list.find("node") != std::string::npos || !ParseCpuList(node_list, cpus)) {
+				return false;
+			}
+			continue;
+		}
+		char *rest;
+		long first = strtol(item.c_str(), &rest, 10);
+		long last = first;
+		if (*rest == '-') {
+			last = strtol(rest + 1, &rest, 10);
+		}
+		if (item.empty() || *rest || first < 0 || last < first) {
+			return false;
+		}
+		for (long cpu = first; cpu <= last; cpu++) {
+			cpus->push_back((int) cpu);
+		}
+	}
+	return !cpus->empty();
+}
+
+/**
+ * Answers one HTTP request with a body of the given content type.
+ */
+void Respond(uWS::HttpResponse *res, const char *status, const char *content_type, const std::string &body)
+{
+	std::string response = std::string("HTTP/1.1 ") + status + "\r\nContent-Type: " + content_type + "\r\nContent-Length: "
+		+ std::to_string(body.length()) + "\r\n\r\n" + body;
+	res->write(response.data(), response.length());
+	res->end(nullptr, 0);
+}
+
+/**
+ * Answers one HTTP request with a JSON body.
+ */
+void RespondJson(uWS::HttpResponse *res, const char *status, const std::string &body)
+{
+	Respond(res, status, "application/json", body);
+}
+
+/**
+ * Reads the host's count of connections that found a listen queue full,
+ * and of those dropped for it or otherwise, since boot (Linux).
+ */
+bool ReadListenOverflows(long long *overflows, long long *drops)
+{
+	// two lines of TcpExt: the field names, then their values
+	FILE *netstat = fopen("/proc/net/netstat", "r");
+	if (!netstat) {
+		return false;
+	}
+	char names[4096], values[4096];
+	bool found = false;
+	while (!found && fgets(names, sizeof(names), netstat) && fgets(values, sizeof(values), netstat)) {
+		if (strncmp(names, "TcpExt:", 7) != 0) {
+			continue;
+		}
+		*overflows = *drops = -1;
+		char *name_state, *value_state;
+		char *name = strtok_r(names, " \n", &name_state);
+		char *value = strtok_r(values, " \n", &value_state);
+		for (; name && value; name = strtok_r(nullptr, " \n", &name_state), value = strtok_r(nullptr, " \n", &value_state)) {
+			if (strcmp(name, "ListenOverflows") == 0) {
+				*overflows = atoll(value);
+			}
+			else if (strcmp(name, "ListenDrops") == 0) {
+				*drops = atoll(value);
+			}
+		}
+		found = *overflows >= 0 && *drops >= 0;
+	}
+	fclose(netstat);
+	return found;
+}
+
+/**
+ * The event loops' stats as a JSON array, h's or the acceptor's first. The
+ * utilization (the share of the time not spent waiting for events) and the
+ * events per iteration are over the time since the previous call, or since
+ * the loops started; the seconds, iterations and events count from then.
+ */
+std::string LoopsJson(const std::vector<uS::LoopStats> &loops)
+{
+	static std::mutex mutex;
+	static std::vector<uS::LoopStats> previous;
+	std::lock_guard<std::mutex> lock(mutex);
+	previous.resize(loops.size());
+	std::string json = "[";
+	for (size_t i = 0; i < loops.size(); i++) {
+		const uS::LoopStats &loop = loops[i], &last = previous[i];
+		const double seconds = loop.seconds - last.seconds;
+		const size_t iterations = loop.iterations - last.iterations;
+		if (i) {
+			json += ",";
+		}
+		json += "{\"seconds\":" + std::to_string(loop.seconds)
+			+ ",\"idle_seconds\":" + std::to_string(loop.idleSeconds)
+			+ ",\"utilization\":" + std::to_string(seconds > 0 ? std::max(0.0, 1 - (loop.idleSeconds - last.idleSeconds) / seconds) : 0)
+			+ ",\"iterations\":" + std::to_string(loop.iterations)
+			+ ",\"events\":" + std::to_string(loop.events)
+			+ ",\"events_per_iteration\":" + std::to_string(iterations ? double(loop.events - last.events) / iterations : 0)
+			+ ",\"pending_transfers\":" + std::to_string(loop.pendingTransfers)
+			+ ",\"queued_bytes\":" + std::to_string(loop.queuedBytes)
+			+ ",\"websockets\":" + std::to_string(loop.webSockets)
+			+ ",\"http_sockets\":" + std::to_string(loop.httpSockets)
+			+ ",\"compression_bytes\":" + std::to_string(loop.compressionBytes)
+			+ ",\"huge_page_bytes\":" + std::to_string(loop.hugePageBytes)
+			+ ",\"explicit_huge_pages\":" + (loop.explicitHugePages ? "true" : "false") + "}";
+		previous[i] = loop;
+	}
+	return json + "]";
+}
+
+/**
+ * The bytes queued on the sockets of all loops.
+ */
+size_t QueuedBytes(const std::vector<uS::LoopStats> &loops)
+{
+	size_t queued = 0;
+	for (const uS::LoopStats &loop : loops) {
+		queued += loop.queuedBytes;
+	}
+	return queued;
+}
+
+/**
+ * The event loops' and the accepting loop's numbers as OpenMetrics families,
+ * each loop labelled with its index in loops, h's or the acceptor's first.
+ */
+std::string LoopsOpenMetrics(const std::vector<uS::LoopStats> &loops, const uS::AcceptStats &accepts,
+                             const uS::ZeroCopyStats &zero_copy)
+{
+	struct Family {
+		const char *name, *type, *help;
+		double (*value)(const uS::LoopStats &);
+	};
+	static const Family families[] = {
+		{"ukf_loop_seconds", "counter", "Time since the loop started.", [](const uS::LoopStats &l) { return l.seconds; }},
+		{"ukf_loop_idle_seconds", "counter", "Time the loop spent waiting for events.", [](const uS::LoopStats &l) { return l.idleSeconds; }},
+		{"ukf_loop_iterations", "counter", "Iterations of the loop.", [](const uS::LoopStats &l) { return (double) l.iterations; }},
+		{"ukf_loop_events", "counter", "Events the loop handled.", [](const uS::LoopStats &l) { return (double) l.events; }},
+		{"ukf_loop_pending_transfers", "gauge", "Connections handed to the loop that it has not taken yet.", [](const uS::LoopStats &l) { return (double) l.pendingTransfers; }},
+		{"ukf_loop_queued_bytes", "gauge", "Bytes queued on the loop's sockets.", [](const uS::LoopStats &l) { return (double) l.queuedBytes; }},
+		{"ukf_loop_websockets", "gauge", "WebSockets of the loop.", [](const uS::LoopStats &l) { return (double) l.webSockets; }},
+		{"ukf_loop_http_sockets", "gauge", "HTTP connections of the loop.", [](const uS::LoopStats &l) { return (double) l.httpSockets; }},
+		{"ukf_loop_compression_bytes", "gauge", "Bytes of the loop's shared zlib streams and buffers.", [](const uS::LoopStats &l) { return (double) l.compressionBytes; }},
+		{"ukf_loop_huge_page_bytes", "gauge", "Bytes of the loop's buffers on huge pages.", [](const uS::LoopStats &l) { return (double) l.hugePageBytes; }},
+	};
+	std::string text;
+	char line[512];
+	for (const Family &family : families) {
+		const bool counter = family.type[0] == 'c';
+		snprintf(line, sizeof(line), "# TYPE %s %s\n# HELP %s %s\n", family.name, family.type, family.name, family.help);
+		text += line;
+		for (size_t i = 0; i < loops.size(); i++) {
+			snprintf(line, sizeof(line), "%s%s{loop=\"%zu\"} %.9g\n", family.name, counter ? "_total" : "", i, family.value(loops[i]));
+			text += line;
+		}
+	}
+	const struct {
+		const char *name, *help;
+		size_t value;
+	} totals[] = {
+		{"ukf_accepted", "Connections accepted.", accepts.accepted},
+		{"ukf_accept_errors", "Failed accepts.", accepts.errors},
+		{"ukf_accept_deferred", "Connections held unread by admission control.", accepts.deferred},
+		{"ukf_accept_rejected", "Connections turned away by admission control.", accepts.rejected},
+		{"ukf_zerocopy_sends", "Sends left in place until the kernel is done.", zero_copy.sends},
+	};
+	for (const auto &total : totals) {
+		snprintf(line, sizeof(line), "# TYPE %s counter\n# HELP %s %s\n%s_total %zu\n",
+		         total.name, total.name, total.help, total.name, total.value);
+		text += line;
+	}
+	return text;
+}
+
+/**
+ * The body of a configuration update, gathered from the parts of the
+ * request, up to kMaxConfigBody bytes.
+ */
+struct ConfigUpload {
+	static const size_t kMaxConfigBody = 4096;
+	std::string body;
+	bool too_large;
+};
+
+/**
+ * Answers an update of the /config API once all of its body has arrived.
+ */
+void UploadConfig(uWS::HttpResponse *res, const char *data, size_t length, size_t remainingBytes)
+{
+	ConfigUpload *upload = (ConfigUpload *) res->userData;
+	if (!upload->too_large && upload->body.length() + length + remainingBytes <= ConfigUpload::kMaxConfigBody) {
+		upload->body.append(data, length);
+	}
+	else {
+		upload->too_large = true;
+	}
+	if (remainingBytes) {
+		return;
+	}
+	res->userData = nullptr;
+	std::string error;
+	if (upload->too_large) {
+		RespondJson(res, "413 Payload Too Large", "{\"error\":\"configuration too large\"}");
+	}
+	else if (!ConfigRegistry::Update(upload->body, &error)) {
+		RespondJson(res, "400 Bad Request", "{\"error\":\"" + error + "\"}");
+	}
+	else {
+		RespondJson(res, "200 OK", ConfigRegistry::Json());
+	}
+	delete upload;
+}
+
+/**
+ * Serves the track state API of all sessions, whichever loop runs them:
+ *   /tracks        the live tracks: state, NIS and RMSE; with
+ *                  ?bbox=x0,y0,x1,y1 only those within that box in m, found
+ *                  in the TrackIndex
+ *   /tracks/<id>   one track, with its covariance
+ *   /tracks/<id>/history
+ *                  the recent estimates of a track kept with --history,
+ *                  those from ?from=<us> to ?to=<us>, or of the last
+ *                  ?last=<us> before its latest measurement
+ *   /stats         numbers of live tracks, their measurements, those shed
+ *                  under overload and the tracks whose radar NIS is out
+ *                  of bounds, the latency
+ *                  histograms of answering measurements, the messages
+ *                  reassembled from parts by h, or all loops of pool, the
+ *                  connections they accepted and the host's listen queue
+ *                  overflows, their zero-copy sends, how busy each loop
+ *                  is (see LoopsJson), the memory held for the clients
+ *                  (see MemoryAccount), and the numbers of full and resumed
+ *                  handshakes when serving TLS with tls
+ *   /metrics       the counters of the measurements, the latency histograms
+ *                  and the loops' numbers for Prometheus, in the
+ *                  OpenMetrics text format; summed from per-thread counters
+ *                  when scraped, without locking out the sessions
+ *   /config        the sensor profile of the filters (see config_registry.h);
+ *                  a POST or PUT of a JSON object of some of its values
+ *                  retunes the live sessions from their next step
+ *   /trace         the spans of the messages traced with --trace, as a
+ *                  Chrome trace (see LatencyStats::TraceJson)
+ *   /export/measurements, /export/estimates
+ *                  the measurement log at record_path and the estimate log
+ *                  at estimate_log_path as far as they are written, streamed
+ *                  (see LogExport); with ?track=<id> only the measurements,
+ *                  as the lines of --replay, or estimates of that track
+ *   /shadow        the filters of the sessions compared with those of
+ *                  --shadow (see ShadowFilter::Json)
+ */
+void ServeHttp(uWS::Hub &h, uS::TLS::Context tls = nullptr, uWS::HubPool *pool = nullptr,
+               const char *record_path = nullptr, const char *estimate_log_path = nullptr,
+               const ShadowFilter *shadow = nullptr)
+{
+	h.onHttpRequest([&h, tls, pool, record_path, estimate_log_path, shadow](uWS::HttpResponse *res, uWS::HttpRequest req,
+	                                                                        char *data, size_t length, size_t remainingBytes) {
+		uWS::Header url = req.getUrl();
+		std::string path(url.value, url.valueLength);
+		std::string track_query, bbox_query;
+		long long from_us = LLONG_MIN, to_us = LLONG_MAX, last_us = 0;
+		size_t query = path.find('?');
+		if (query != std::string::npos) {
+			static const char *const times[] = {"from=", "to=", "last="};
+			long long *values[] = {&from_us, &to_us, &last_us};
+			for (int t = 0; t < 3; t++) {
+				size_t value = path.find(times[t], query);
+				// the name and not the end of another
+				if (value != std::string::npos && (path[value - 1] == '?' || path[value - 1] == '&')) {
+					*values[t] = atoll(path.c_str() + value + strlen(times[t]));
 				}
 			}
-			else {
+			static const std::string track("track=");
+			size_t value = path.find(track, query);
+			if (value != std::string::npos) {
+				track_query = path.substr(value + track.length());
+				track_query.resize(std::min(track_query.find('&'), track_query.length()));
+			}
+			static const std::string bbox("bbox=");
+			value = path.find(bbox, query);
+			if (value != std::string::npos) {
+				bbox_query = path.substr(value + bbox.length());
+				bbox_query.resize(std::min(bbox_query.find('&'), bbox_query.length()));
+			}
+			path.resize(query);
+		}
 
-				std::string msg = "42[\"manual\",{}]";
-				ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+		static const std::string track_prefix("/tracks/");
+		if (path == "/") {
+			const std::string s = "<h1>Hello world!</h1>";
+			res->end(s.data(), s.length());
+		}
+		else if (path == "/tracks" && !bbox_query.empty()) {
+			double box[4];
+			if (TrackIndex::ParseBox(bbox_query.data(), bbox_query.data() + bbox_query.length(), box)) {
+				RespondJson(res, "200 OK", TrackRegistry::TracksJson(box));
+			}
+			else {
+				RespondJson(res, "400 Bad Request", "{\"error\":\"bbox is x0,y0,x1,y1 with x0 <= x1 and y0 <= y1\"}");
+			}
+		}
+		else if (path == "/tracks") {
+			RespondJson(res, "200 OK", TrackRegistry::TracksJson());
+		}
+		else if (path == "/stats") {
+			std::string stats = TrackRegistry::StatsJson();
+			stats.pop_back();
+			stats += ",\"latency\":" + LatencyStats::Json();
+			stats += ",\"metrics\":" + Metrics::Json();
+			uS::FragmentPool::Stats fragments = pool ? pool->getFragmentStats() : h.getFragmentPool().getStats();
+			stats += ",\"fragments\":{\"messages\":" + std::to_string(fragments.messages)
+				+ ",\"bytes\":" + std::to_string(fragments.bytes)
+				+ ",\"grows\":" + std::to_string(fragments.grows)
+				+ ",\"heap_allocations\":" + std::to_string(fragments.heapAllocations)
+				+ ",\"cached_bytes\":" + std::to_string(fragments.cachedBytes) + "}";
+			uS::AcceptStats accepts = pool ? pool->getAcceptStats() : h.getAcceptStats();
+			stats += ",\"accepts\":{\"accepted\":" + std::to_string(accepts.accepted)
+				+ ",\"wakeups\":" + std::to_string(accepts.wakeups)
+				+ ",\"budget_exhausted\":" + std::to_string(accepts.budgetExhausted)
+				+ ",\"errors\":" + std::to_string(accepts.errors)
+				+ ",\"max_batch\":" + std::to_string(accepts.maxBatch)
+				+ ",\"deferred\":" + std::to_string(accepts.deferred)
+				+ ",\"rejected\":" + std::to_string(accepts.rejected);
+			long long overflows, drops;
+			if (ReadListenOverflows(&overflows, &drops)) {
+				stats += ",\"listen_overflows\":" + std::to_string(overflows)
+					+ ",\"listen_drops\":" + std::to_string(drops);
 			}
+			stats += "}";
+			uS::ZeroCopyStats zero_copy = pool ? pool->getZeroCopyStats() : h.getZeroCopyStats();
+			stats += ",\"zerocopy\":{\"sends\":" + std::to_string(zero_copy.sends)
+				+ ",\"bytes\":" + std::to_string(zero_copy.bytes)
+				+ ",\"completions\":" + std::to_string(zero_copy.completions)
+				+ ",\"copied\":" + std::to_string(zero_copy.copied) + "}";
+			std::vector<uS::LoopStats> loops = pool ? pool->getLoopStats() : std::vector<uS::LoopStats>(1, h.getLoopStats());
+			stats += ",\"loops\":" + LoopsJson(loops);
+			stats += ",\"memory\":" + MemoryAccount::Json(QueuedBytes(loops));
+			stats += ",\"huge_pages\":" + HugePages::Json();
+			if (tls) {
+				uS::TLS::Context::Handshakes handshakes = tls.getHandshakes();
+				stats += ",\"tls_full_handshakes\":" + std::to_string(handshakes.full)
+					+ ",\"tls_resumed_handshakes\":" + std::to_string(handshakes.resumed);
+			}
+			RespondJson(res, "200 OK", stats + "}");
+		}
+		else if (path == "/metrics") {
+			std::vector<uS::LoopStats> loops = pool ? pool->getLoopStats() : std::vector<uS::LoopStats>(1, h.getLoopStats());
+			std::string text = Metrics::OpenMetrics() + LatencyStats::OpenMetrics()
+				+ LoopsOpenMetrics(loops, pool ? pool->getAcceptStats() : h.getAcceptStats(),
+				                   pool ? pool->getZeroCopyStats() : h.getZeroCopyStats())
+				+ MemoryAccount::OpenMetrics(QueuedBytes(loops));
+			Respond(res, "200 OK", "application/openmetrics-text; version=1.0.0; charset=utf-8", text + "# EOF\n");
+		}
+		else if (path == "/trace") {
+			RespondJson(res, "200 OK", LatencyStats::TraceJson());
+		}
+		else if (path == "/shadow") {
+			if (shadow) {
+				RespondJson(res, "200 OK", shadow->Json());
+			}
+			else {
+				RespondJson(res, "404 Not Found", "{\"error\":\"no shadow filters\"}");
+			}
+		}
+		else if (path == "/config") {
+			uWS::HttpMethod method = req.getMethod();
+			if (method == uWS::METHOD_GET) {
+				RespondJson(res, "200 OK", ConfigRegistry::Json());
+			}
+			else if (method == uWS::METHOD_POST || method == uWS::METHOD_PUT) {
+				res->userData = new ConfigUpload{std::string(), false};
+				UploadConfig(res, data, length, remainingBytes);
+			}
+			else {
+				RespondJson(res, "405 Method Not Allowed", "{\"error\":\"GET, POST or PUT the configuration\"}");
+			}
+		}
+		else if (path == "/export/measurements" || path == "/export/estimates") {
+			const bool measurements = path == "/export/measurements";
+			const char *log = measurements ? record_path : estimate_log_path;
+			const size_t log_length = log ? strlen(log) : 0;
+			const bool compressed = !measurements && log_length > 3 && strcmp(log + log_length - 3, ".gz") == 0;
+			const char *content_type = measurements ? "application/octet-stream" : compressed ? "application/gzip" : "text/plain";
+			char *end;
+			long track = strtol(track_query.c_str(), &end, 10);
+			if (!log) {
+				RespondJson(res, "404 Not Found", "{\"error\":\"not recorded\"}");
+			}
+			else if (!track_query.empty() && (*end || track < 0)) {
+				RespondJson(res, "400 Bad Request", "{\"error\":\"malformed track\"}");
+			}
+			else if (!track_query.empty() && compressed) {
+				RespondJson(res, "400 Bad Request", "{\"error\":\"a compressed log is only exported whole\"}");
+			}
+			else if (!(track_query.empty() ? LogExport::SendFile(res, log, content_type)
+			           : measurements ? LogExport::SendMeasurements(res, log, (uint32_t) track)
+			           : LogExport::SendEstimates(res, log, (int) track))) {
+				RespondJson(res, "503 Service Unavailable", "{\"error\":\"log cannot be read\"}");
+			}
+		}
+		else if (path.compare(0, track_prefix.length(), track_prefix) == 0) {
+			char *end;
+			const char *id = path.c_str() + track_prefix.length();
+			long track = strtol(id, &end, 10);
+			std::string json;
+			if (*id && !*end && TrackRegistry::TrackJson((int) track, &json)) {
+				RespondJson(res, "200 OK", json);
+			}
+			else if (*id && strcmp(end, "/history") == 0
+			         && TrackRegistry::HistoryJson((int) track, from_us, to_us, last_us, &json)) {
+				RespondJson(res, "200 OK", json);
+			}
+			else {
+				RespondJson(res, "404 Not Found", "{\"error\":\"no such track\"}");
+			}
+		}
+		else {
+			RespondJson(res, "404 Not Found", "{\"error\":\"not found\"}");
 		}
+	});
+	h.onHttpData([](uWS::HttpResponse *res, char *data, size_t length, size_t remainingBytes) {
+		if (res && res->userData) {
+			UploadConfig(res, data, length, remainingBytes);
+		}
+	});
+	h.onCancelledHttpRequest([](uWS::HttpResponse *res) {
+		delete (ConfigUpload *) res->userData;
+		res->userData = nullptr;
+		LogExport::Cancel(res);
+	});
+}
 
+/**
+ * Serves the node API of a router:
+ *   /nodes         the fusion nodes with the streams of each, and the
+ *                  frames forwarded, returned and dropped (see ShardRouter);
+ *                  a POST of /nodes?uri=<node> adds a node and moves the
+ *                  streams it owns to it, a DELETE removes one and moves its
+ *                  streams to the others
+ */
+void ServeRouterHttp(uWS::Hub &h, ShardRouter &router)
+{
+	h.onHttpRequest([&router](uWS::HttpResponse *res, uWS::HttpRequest req, char *data, size_t length,
+	                          size_t remainingBytes) {
+		uWS::Header url = req.getUrl();
+		std::string path(url.value, url.valueLength);
+		std::string node;
+		size_t query = path.find('?');
+		if (query != std::string::npos) {
+			static const std::string uri("uri=");
+			size_t value = path.find(uri, query);
+			if (value != std::string::npos) {
+				node = path.substr(value + uri.length());
+				node.resize(std::min(node.find('&'), node.length()));
+			}
+			path.resize(query);
+		}
+		if (path != "/nodes") {
+			RespondJson(res, "404 Not Found", "{\"error\":\"not found\"}");
+			return;
+		}
+		uWS::HttpMethod method = req.getMethod();
+		if (method == uWS::METHOD_GET) {
+			RespondJson(res, "200 OK", router.Json());
+		}
+		else if ((method == uWS::METHOD_POST || method == uWS::METHOD_DELETE) && node.empty()) {
+			RespondJson(res, "400 Bad Request", "{\"error\":\"no uri of a node\"}");
+		}
+		else if (method == uWS::METHOD_POST) {
+			if (router.Join(node)) {
+				RespondJson(res, "200 OK", router.Json());
+			}
+			else {
+				RespondJson(res, "409 Conflict", "{\"error\":\"node already routed to\"}");
+			}
+		}
+		else if (method == uWS::METHOD_DELETE) {
+			if (router.Leave(node)) {
+				RespondJson(res, "200 OK", router.Json());
+			}
+			else {
+				RespondJson(res, "404 Not Found", "{\"error\":\"no such node\"}");
+			}
+		}
+		else {
+			RespondJson(res, "405 Method Not Allowed", "{\"error\":\"GET, POST or DELETE the nodes\"}");
+		}
 	});
+}
 
-	// We don't need this since we're not using HTTP but if it's removed the program
-	// doesn't compile :-(
-	h.onHttpRequest([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data, size_t, size_t) {
-		const std::string s = "<h1>Hello world!</h1>";
-		if (req.getUrl().valueLength == 1)
+int main(int argc, char *argv[])
+{
+	// offline mode: replay a measurement file instead of serving the simulator
+	if (argc > 1 && std::string(argv[1]) == "--replay") {
+		int smooth_lag = 0;
+		bool imm = false;
+		ReplaySensors sensors = REPLAY_FUSED;
+		ReplayWindow window = {0, 0, 2000000, -1};
+		bool windowed = false;
+		bool perf_counters = false;
+		const char *report_path = nullptr;
+		bool valid = argc >= 4;
+		for (int i = 4; i < argc && valid; i++) {
+			std::string arg = argv[i];
+			if (arg == "--smooth" && i + 1 < argc && (smooth_lag = atoi(argv[i + 1])) >= 1) {
+				i++;
+			}
+			else if (arg == "--window" && i + 2 < argc) {
+				window.from_us = atoll(argv[++i]);
+				window.to_us = atoll(argv[++i]);
+				windowed = window.to_us >= window.from_us;
+				valid = windowed;
+			}
+			else if (arg == "--window-track" && i + 1 < argc && (window.track = atoll(argv[i + 1])) >= 0) {
+				i++;
+			}
+			else if (arg == "--warmup" && i + 1 < argc && (window.warmup_us = atoll(argv[i + 1])) >= 0) {
+				i++;
+			}
+			else if (arg == "--imm") {
+				imm = true;
+			}
+			else if (arg == "--perf-counters") {
+				perf_counters = true;
+			}
+			else if (arg == "--report" && i + 1 < argc) {
+				report_path = argv[++i];
+			}
+			else if (arg == "--sensors" && i + 1 < argc && std::string(argv[i + 1]) == "laser") {
+				sensors = REPLAY_LASER;
+				i++;
+			}
+			else if (arg == "--sensors" && i + 1 < argc && std::string(argv[i + 1]) == "radar") {
+				sensors = REPLAY_RADAR;
+				i++;
+			}
+			else {
+				valid = false;
+			}
+		}
+		if (!valid || (smooth_lag && imm) || (sensors != REPLAY_FUSED && (smooth_lag || imm))) {
+			std::cerr << "Usage: " << argv[0] << " --replay <input file> <output file> [--smooth <lag> | --imm]"
+				<< " [--sensors laser|radar] [--window <from us> <to us> [--window-track <id>] [--warmup <us>]]"
+				<< " [--perf-counters] [--report <JSON file>]" << std::endl;
+			return -1;
+		}
+		return RunReplay(argv[2], argv[3], smooth_lag, imm, sensors, windowed ? &window : nullptr, perf_counters,
+		                 report_path);
+	}
+
+	// offline mode: replay a measurement log of many sessions as one batch
+	if (argc > 1 && std::string(argv[1]) == "--replay-batch") {
+		long long deadline_us = 0;
+		if (!(argc == 3 || (argc == 5 && std::string(argv[3]) == "--deadline" && (deadline_us = atoll(argv[4])) >= 1))) {
+			std::cerr << "Usage: " << argv[0] << " --replay-batch <measurement log> [--deadline <us>]" << std::endl;
+			return -1;
+		}
+		return RunBatchReplay(argv[2], deadline_us);
+	}
+
+	// offline mode: smooth every track of a measurement log, however long
+	if (argc > 1 && std::string(argv[1]) == "--replay-smooth") {
+		int threads = 1;
+		const char *temp_directory = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+		bool valid = argc >= 4;
+		for (int i = 4; i < argc && valid; i++) {
+			std::string arg = argv[i];
+			if (arg == "--threads" && i + 1 < argc && (threads = atoi(argv[i + 1])) >= 1) {
+				i++;
+			}
+			else if (arg == "--temp-dir" && i + 1 < argc) {
+				temp_directory = argv[++i];
+			}
+			else {
+				valid = false;
+			}
+		}
+		if (!valid) {
+			std::cerr << "Usage: " << argv[0] << " --replay-smooth <measurement log> <output file>"
+				<< " [--threads <threads>] [--temp-dir <directory>]" << std::endl;
+			return -1;
+		}
+		return RunSmoothReplay(argv[2], argv[3], threads, temp_directory);
+	}
+
+	// offline mode: track the many unlabeled targets of a scene
+	if (argc > 1 && std::string(argv[1]) == "--track") {
+		int threads = 1;
+		if (!(argc == 4 || (argc == 6 && std::string(argv[4]) == "--threads" && (threads = atoi(argv[5])) >= 1))) {
+			std::cerr << "Usage: " << argv[0] << " --track <input file> <output file> [--threads <threads>]" << std::endl;
+			return -1;
+		}
+		return RunTrackReplay(argv[2], argv[3], threads);
+	}
+
+	// offline benchmark: replay many sequences at once across threads
+	if (argc > 1 && std::string(argv[1]) == "--replay-parallel") {
+		int threads;
+		if (argc < 4 || (threads = atoi(argv[2])) < 1) {
+			std::cerr << "Usage: " << argv[0] << " --replay-parallel <threads> <input file>..." << std::endl;
+			return -1;
+		}
+		return RunParallelReplay(std::vector<std::string>(argv + 3, argv + argc), threads);
+	}
+
+	// offline tuning: replay a corpus with many process noise levels at once
+	if (argc > 1 && std::string(argv[1]) == "--sweep") {
+		SweepOptions options;
+		std::vector<std::string> inputs;
+		bool valid = argc > 2 && (options.threads = atoi(argv[2])) >= 1;
+		for (int i = 3; i < argc && valid; i++) {
+			std::string arg = argv[i];
+			if ((arg == "--std-a" || arg == "--std-yawdd") && i + 3 < argc) {
+				double from = atof(argv[i + 1]);
+				double to = atof(argv[i + 2]);
+				int steps = atoi(argv[i + 3]);
+				valid = from > 0.0 && to >= from && steps >= 1;
+				(arg == "--std-a" ? options.std_a_from : options.std_yawdd_from) = from;
+				(arg == "--std-a" ? options.std_a_to : options.std_yawdd_to) = to;
+				(arg == "--std-a" ? options.std_a_steps : options.std_yawdd_steps) = steps;
+				i += 3;
+			}
+			else if (arg == "--random" && i + 1 < argc && (options.random = atoi(argv[i + 1])) >= 1) {
+				i++;
+			}
+			else if (arg == "--seed" && i + 1 < argc) {
+				options.seed = strtoull(argv[++i], nullptr, 10);
+			}
+			else if (arg.compare(0, 2, "--") != 0) {
+				inputs.push_back(arg);
+			}
+			else {
+				valid = false;
+			}
+		}
+		if (!valid || inputs.empty()) {
+			std::cerr << "Usage: " << argv[0] << " --sweep <threads> [--std-a <from> <to> <steps>]"
+			          << " [--std-yawdd <from> <to> <steps>] [--random <configurations>] [--seed <seed>]"
+			          << " <input file>..." << std::endl;
+			return -1;
+		}
+		return RunNoiseSweep(inputs, options);
+	}
+
+	// offline check: the float batch filter against the double one
+	if (argc > 1 && std::string(argv[1]) == "--precision-check") {
+		const bool approximate_radar = argc > 2 && std::string(argv[2]) == "--approximate-radar";
+		if (argc < 3 + approximate_radar) {
+			std::cerr << "Usage: " << argv[0] << " --precision-check [--approximate-radar] <input file>..." << std::endl;
+			return -1;
+		}
+		return RunPrecisionCheck(std::vector<std::string>(argv + 2 + approximate_radar, argv + argc), approximate_radar);
+	}
+
+	// offline check: a fast path against the reference filter, step by step
+	if (argc > 1 && std::string(argv[1]) == "--diff-check") {
+		double rmse_tolerance = 1e-3;
+		double nis_tolerance = 1e-2;
+		int first = 3;
+		if (argc > 5 && std::string(argv[3]) == "--tolerance") {
+			rmse_tolerance = atof(argv[4]);
+			nis_tolerance = atof(argv[5]);
+			first = 6;
+		}
+		if (argc <= first || rmse_tolerance < 0.0 || nis_tolerance < 0.0) {
+			std::cerr << "Usage: " << argv[0] << " --diff-check <ctrv|square-root|inverse|kernels|simplex|cubature"
+			          << "|linearized|batch|float-batch|approximate-radar|cuda> [--tolerance <rmse> <nis>]"
+			          << " <input file>..." << std::endl;
+			return -1;
+		}
+		return RunDiffCheck(std::vector<std::string>(argv + first, argv + argc), argv[2], rmse_tolerance, nis_tolerance);
+	}
+
+	// offline mode: write synthetic measurement files for large-scale tests
+	if (argc > 2 && std::string(argv[1]) == "--generate") {
+		GeneratorOptions options;
+		bool valid = true;
+		for (int i = 3; i < argc && valid; i++) {
+			std::string arg = argv[i];
+			if (arg == "--tracks" && i + 1 < argc && (options.tracks = atoi(argv[i + 1])) >= 1) {
+				i++;
+			}
+			else if (arg == "--measurements" && i + 1 < argc && (options.measurements = atoi(argv[i + 1])) >= 1) {
+				i++;
+			}
+			else if (arg == "--interval" && i + 1 < argc && (options.interval_us = atoll(argv[i + 1])) >= 1) {
+				i++;
+			}
+			else if (arg == "--seed" && i + 1 < argc) {
+				options.seed = strtoull(argv[++i], nullptr, 10);
+			}
+			else if (arg == "--threads" && i + 1 < argc && (options.threads = atoi(argv[i + 1])) >= 1) {
+				i++;
+			}
+			else if (arg == "--binary") {
+				options.binary = true;
+			}
+			else if (arg == "--scene") {
+				options.scene = true;
+			}
+			else if (arg == "--log") {
+				options.log = true;
+			}
+			else if (arg == "--compressed-log") {
+				options.log = true;
+				options.compress = true;
+			}
+			else {
+				valid = false;
+			}
+		}
+		if (!valid) {
+			std::cerr << "Usage: " << argv[0] << " --generate <output file> [--tracks <number>] [--measurements <per track>]"
+				<< " [--interval <us>] [--seed <number>] [--threads <number>] [--binary | --log | --compressed-log] [--scene]" << std::endl;
+			return -1;
+		}
+		return RunGenerate(options, argv[2]);
+	}
+
+	// --threads N spreads the connections over N worker loops, either handed
+	// over by one accepting thread or accepted by the workers themselves, on a
+	// SO_REUSEPORT port each with --reuse-port or from one listening socket
+	// with --shared-listen; --spin keeps idle loops polling for the given
+	// microseconds before they sleep (micro uUV builds); --deflate compresses
+	// the messages of clients offering permessage-deflate, each connection
+	// keeping a small window of its own; --backpressure picks what happens to
+	// the estimates and track events of a client that falls behind; --tls
+	// serves wss:// and https:// with the given certificate chain and key,
+	// encrypted by the kernel where it can with --ktls; --reorder filters
+	// measurements that arrive up to the given number of measurements late at
+	// their place in time, and --reorder-budget first holds each for up to the
+	// given ms to filter them in timestamp order (see ReorderBuffer); --record
+	// appends every measurement of every session to a measurement log,
+	// deflated block by block with --record-compress, and --estimate-log every
+	// estimate to a text file, compressed if its name ends in .gz;
+	// --receive-buffer sets the most one read of a socket takes in, in KB;
+	// --cpus pins the workers in turn to the listed CPUs, so that each
+	// allocates on its own NUMA node; --shed-backlog and --shed-lag have a
+	// session skip redundant and low-information measurements of a frame while
+	// more than the given number are left of it or it has taken longer than
+	// the given us (see LoadShedder); --checkpoint continues the tracks of the
+	// given checkpoint file if there is one and writes the live tracks to it
+	// every --checkpoint-interval ms (see session_checkpoint.h);
+	// --publish-rate sends viewers the estimates of all tracks the given times
+	// a second, one frame per topic, instead of each estimate as it is
+	// computed (see TrackPublisher), and with --publish-delta only the tracks
+	// that moved the given m since they were sent, with a keyframe of all
+	// every --publish-keyframe rounds; --shm serves sensor drivers on this
+	// host through the shared-memory channels <path>.0 to <path>.<N-1>, N
+	// given by --shm-channels, spread over the workers (see shm_channel.h);
+	// --udp takes datagrams of measurement records from sensors on the given
+	// port, on every worker (see UdpListener), and --udp-demote keeps the
+	// tracks of sensors silent for the given ms in compact form, without a
+	// session; --unix also listens on a Unix domain socket at the given path,
+	// for WebSocket and HTTP clients on this host; --listen-backlog sets the
+	// queue length of the listening sockets and --accept-budget the most
+	// connections a loop accepts from one of them per wakeup; --zerocopy sends
+	// the messages of plain connections that come to at least the given bytes
+	// with MSG_ZEROCOPY (micro uUV builds); --pipeline filters the
+	// measurements of every loop on the given number of filter threads, with
+	// the replies formatted on another (see Pipeline); --port listens on the
+	// given port instead of 4567; --route runs a router instead of the
+	// filters, forwarding every sensor stream to one of the listed nodes by
+	// consistent hashing (see ShardRouter); --rebalance checks the workers
+	// every given ms and moves live tracks from those with the most
+	// connections or the busiest loops to the least loaded one (see
+	// SessionBalancer); --relay forwards every estimate to the aggregator at
+	// the given URI, batched and compressed, over --relay-connections
+	// connections per loop, keeping up to --relay-buffer MB of it per loop
+	// while the aggregator cannot take it (see TrackRelay); --rate-limit and
+	// --rate-limit-bytes hold every client to the given messages and KB a
+	// second, with a second's worth of burst, and --rate-limit-action picks
+	// what happens to a message past them; --send-batch holds the replies to
+	// every client for up to the given us to send them in one write, earlier
+	// once --send-batch-bytes KB are held; --admit-connections and
+	// --admit-busy keep each loop from taking more connections past the given
+	// number of them or with its handlers busy for more than the given percent
+	// of its time, and --admit-action defers a connection until the loop is
+	// within them, for up to a second, or rejects it, either before its
+	// upgrade; --handoff takes the port and connections over from the server
+	// serving handoffs at the given path, if one is, and then serves them
+	// there to the next build in turn (see ProcessHandoff); --trace keeps the
+	// stages of one message in the given number on every thread as a timeline,
+	// served at /trace, and --trace-threshold writes it to a file when a
+	// traced message takes longer than the given us (see LatencyStats::Trace);
+	// --memory-budget keeps the memory held for the clients, their sessions
+	// and the bytes queued for them, within the given MB by dropping the
+	// sessions' histories, demoting quiet UDP sensors and at last
+	// disconnecting the clients holding the most (see MemoryGovernor);
+	// --qos-busy lowers the QoS tier of the sessions of a loop busy for more
+	// than the given percent of its time, background tracks first, as their
+	// clients ask with ?qos= (see QosGovernor); --shadow also runs every
+	// measurement through filters with the given profile, a JSON object as
+	// /config takes, the sigma points of --shadow-sigma, on --shadow-threads
+	// threads of their own pinned to --shadow-cpus, and compares them with the
+	// sessions' at /shadow (see ShadowFilter); --resume-grace keeps the track
+	// of a client that disconnects with a session token for the given ms, for
+	// it to go on with when it reconnects with the token (see
+	// SessionResumption); --geofence reports the tracks entering and leaving
+	// its zones, a JSON array as Geofence takes, on the topic geofence;
+	// --warmup creates that many sessions per loop up front and runs synthetic
+	// measurements through their filters, and faults in the loops' buffers and
+	// pools, before the first connection is taken (on --warmup-hugepages
+	// backed by transparent huge pages), for the first measurements after a
+	// start to take no longer than later ones; --history keeps that many KB of
+	// the recent estimates of every track for /tracks/<id>/history (see
+	// TrackHistory), with --history-every only one every so many ms, for the
+	// same memory to cover a long-running session; --track-table exports the
+	// latest state of every track to a shared-memory table at the given path,
+	// of --track-table-slots tracks, for consumers on this host to map and
+	// read (see shm_track_table.h); --dedup drops the measurements a session
+	// has just seen, as sent again over a redundant path (see
+	// DuplicateFilter); --hugepages puts the session arenas, the storage of
+	// batched filters and each loop's receive buffer and send pool on 2 MB
+	// pages, reserved ones with explicit and otherwise transparent ones (see
+	// HugePages)
+	int threads = 1;
+	uS::TLS::Context tls;
+	int listen_options = 0;
+	uWS::HubPool::Balance balance = uWS::HubPool::LEAST_CONNECTIONS;
+	int extension_options = 0;
+	uWS::Group<uWS::SERVER>::Backpressure policy = uWS::Group<uWS::SERVER>::COALESCE_LATEST;
+	int spin_micros = 0;
+	int reorder_depth = 0;
+	long long reorder_budget_us = 0;
+	const char *record_path = nullptr;
+	const char *estimate_log_path = nullptr;
+	bool record_compress = false;
+	int receive_buffer = uWS::Hub::LARGE_BUFFER_SIZE;
+	std::vector<int> cpus;
+	int shed_backlog = 0;
+	long long shed_lag_us = 0;
+	bool deduplicate = false;
+	const char *checkpoint_path = nullptr;
+	int checkpoint_interval = CheckpointWriter::kInterval;
+	int publish_rate = 0;
+	double publish_delta = 0.0;
+	int publish_keyframe = 10;
+	const char *shm_path = nullptr;
+	int shm_channels = 1;
+	int udp_port = 0;
+	int udp_demote_ms = 0;
+	const char *unix_path = nullptr;
+	int listen_backlog = 0;
+	int accept_budget = 0;
+	size_t zero_copy_threshold = 0;
+	int pipeline_workers = 0;
+	int port = 4567;
+	int rebalance_ms = 0;
+	const char *relay_uri = nullptr;
+	int relay_connections = 2;
+	int relay_buffer_mb = 16;
+	std::vector<std::string> route_nodes;
+	RateLimitOptions rate_limit = {0, 0, uWS::Group<uWS::SERVER>::DROP_MESSAGE};
+	SendBatchOptions send_batch = {0, 16 * 1024};
+	AdmissionOptions admission = {0, 0, uWS::Group<uWS::SERVER>::DEFER_CONNECTION};
+	double qos_busy = 0;
+	HugePages::Mode huge_pages_mode;
+	const char *handoff_path = nullptr;
+	int trace_every = 0;
+	long long trace_threshold_us = 0;
+	const char *shadow_profile = nullptr;
+	ShadowFilter::SigmaScheme shadow_scheme = ShadowFilter::SIGMA_SCALED;
+	int shadow_threads = 1;
+	std::vector<int> shadow_cpus;
+	int resume_grace_ms = 0;
+	const char *geofence_zones = nullptr;
+	int warmup_sessions = 0;
+	int history_kb = 0;
+	int history_every_ms = 0;
+	const char *track_table_path = nullptr;
+	int track_table_slots = shm_tracks::kDefaultSlots;
+	bool warmup_huge_pages = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc && (threads = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--reuse-port") {
+			balance = uWS::HubPool::REUSE_PORT;
+		}
+		else if (arg == "--shared-listen") {
+			balance = uWS::HubPool::SHARED_LISTEN;
+		}
+#ifdef USE_MICRO_UV
+		else if (arg == "--spin" && i + 1 < argc && (spin_micros = atoi(argv[i + 1])) >= 0) {
+			i++;
+		}
+		else if (arg == "--zerocopy" && i + 1 < argc && atoi(argv[i + 1]) >= 1) {
+			zero_copy_threshold = atoi(argv[++i]);
+		}
+#endif
+		else if (arg == "--deflate") {
+			extension_options = uWS::PERMESSAGE_DEFLATE | uWS::SLIDING_DEFLATE_WINDOW;
+		}
+		else if (arg == "--backpressure" && i + 1 < argc && ParseBackpressure(argv[i + 1], &policy)) {
+			i++;
+		}
+		else if (arg == "--tls" && i + 2 < argc) {
+			tls = uS::TLS::getContext(argv[i + 1], argv[i + 2]);
+			if (!tls) {
+				std::cerr << "Failed to load certificate " << argv[i + 1] << " and key " << argv[i + 2] << std::endl;
+				return -1;
+			}
+			i += 2;
+		}
+		else if (arg == "--ktls") {
+			listen_options |= uS::KERNEL_TLS;
+		}
+		else if (arg == "--reorder" && i + 1 < argc && (reorder_depth = atoi(argv[i + 1])) >= 0) {
+			i++;
+		}
+		else if (arg == "--reorder-budget" && i + 1 < argc && atof(argv[i + 1]) >= 0) {
+			reorder_budget_us = (long long) (atof(argv[++i]) * 1000);
+		}
+		else if (arg == "--record" && i + 1 < argc) {
+			record_path = argv[++i];
+		}
+		else if (arg == "--record-compress") {
+			record_compress = true;
+		}
+		else if (arg == "--estimate-log" && i + 1 < argc) {
+			estimate_log_path = argv[++i];
+		}
+		else if (arg == "--receive-buffer" && i + 1 < argc && atoi(argv[i + 1]) >= 4) {
+			receive_buffer = atoi(argv[++i]) * 1024;
+		}
+		else if (arg == "--cpus" && i + 1 < argc && ParseCpuList(argv[i + 1], &cpus)) {
+			i++;
+		}
+		else if (arg == "--shed-backlog" && i + 1 < argc && (shed_backlog = atoi(argv[i + 1])) >= 0) {
+			i++;
+		}
+		else if (arg == "--shed-lag" && i + 1 < argc && (shed_lag_us = atoll(argv[i + 1])) >= 0) {
+			i++;
+		}
+		else if (arg == "--dedup") {
+			deduplicate = true;
+		}
+		else if (arg == "--checkpoint" && i + 1 < argc) {
+			checkpoint_path = argv[++i];
+		}
+		else if (arg == "--checkpoint-interval" && i + 1 < argc && (checkpoint_interval = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--publish-rate" && i + 1 < argc && (publish_rate = atoi(argv[i + 1])) >= 1 && publish_rate <= 1000) {
+			i++;
+		}
+		else if (arg == "--publish-delta" && i + 1 < argc && (publish_delta = atof(argv[i + 1])) > 0.0) {
+			i++;
+		}
+		else if (arg == "--publish-keyframe" && i + 1 < argc && (publish_keyframe = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--shm" && i + 1 < argc) {
+			shm_path = argv[++i];
+		}
+		else if (arg == "--shm-channels" && i + 1 < argc && (shm_channels = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--udp" && i + 1 < argc && (udp_port = atoi(argv[i + 1])) >= 1 && udp_port <= 65535) {
+			i++;
+		}
+		else if (arg == "--udp-demote" && i + 1 < argc && (udp_demote_ms = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--unix" && i + 1 < argc) {
+			unix_path = argv[++i];
+		}
+		else if (arg == "--listen-backlog" && i + 1 < argc && (listen_backlog = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--accept-budget" && i + 1 < argc && (accept_budget = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--pipeline" && i + 1 < argc && (pipeline_workers = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--port" && i + 1 < argc && (port = atoi(argv[i + 1])) >= 1 && port <= 65535) {
+			i++;
+		}
+		else if (arg == "--rebalance" && i + 1 < argc && (rebalance_ms = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--relay" && i + 1 < argc) {
+			relay_uri = argv[++i];
+		}
+		else if (arg == "--relay-connections" && i + 1 < argc && (relay_connections = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--relay-buffer" && i + 1 < argc && (relay_buffer_mb = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--rate-limit" && i + 1 < argc && (rate_limit.messages = atof(argv[i + 1])) >= 0) {
+			i++;
+		}
+		else if (arg == "--rate-limit-bytes" && i + 1 < argc && atof(argv[i + 1]) >= 0) {
+			rate_limit.bytes = atof(argv[++i]) * 1024;
+		}
+		else if (arg == "--rate-limit-action" && i + 1 < argc && ParseRateLimitAction(argv[i + 1], &rate_limit.action)) {
+			i++;
+		}
+		else if (arg == "--send-batch" && i + 1 < argc && (send_batch.micros = atoi(argv[i + 1])) >= 0) {
+			i++;
+		}
+		else if (arg == "--send-batch-bytes" && i + 1 < argc && atoi(argv[i + 1]) >= 1) {
+			send_batch.bytes = atoi(argv[++i]) * 1024;
+		}
+		else if (arg == "--admit-connections" && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+			admission.connections = atoi(argv[++i]);
+		}
+		else if (arg == "--admit-busy" && i + 1 < argc && atof(argv[i + 1]) >= 0 && atof(argv[i + 1]) <= 100) {
+			admission.busy = atof(argv[++i]) / 100;
+		}
+		else if (arg == "--admit-action" && i + 1 < argc && ParseAdmission(argv[i + 1], &admission.action)) {
+			i++;
+		}
+		else if (arg == "--handoff" && i + 1 < argc) {
+			handoff_path = argv[++i];
+		}
+		else if (arg == "--trace" && i + 1 < argc && (trace_every = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--trace-threshold" && i + 1 < argc && (trace_threshold_us = atoll(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--memory-budget" && i + 1 < argc && atof(argv[i + 1]) > 0) {
+			MemoryAccount::set_budget((size_t) (atof(argv[++i]) * 1024 * 1024));
+		}
+		else if (arg == "--qos-busy" && i + 1 < argc && atof(argv[i + 1]) > 0 && atof(argv[i + 1]) <= 100) {
+			qos_busy = atof(argv[++i]) / 100;
+		}
+		else if (arg == "--shadow" && i + 1 < argc) {
+			shadow_profile = argv[++i];
+		}
+		else if (arg == "--shadow-sigma" && i + 1 < argc && ShadowFilter::ParseScheme(argv[i + 1], &shadow_scheme)) {
+			i++;
+		}
+		else if (arg == "--shadow-threads" && i + 1 < argc && (shadow_threads = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--shadow-cpus" && i + 1 < argc && ParseCpuList(argv[i + 1], &shadow_cpus)) {
+			i++;
+		}
+		else if (arg == "--resume-grace" && i + 1 < argc && (resume_grace_ms = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--geofence" && i + 1 < argc) {
+			geofence_zones = argv[++i];
+		}
+		else if (arg == "--warmup" && i + 1 < argc && (warmup_sessions = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--warmup-hugepages") {
+			warmup_huge_pages = true;
+		}
+		else if (arg == "--hugepages" && i + 1 < argc && HugePages::ParseMode(argv[i + 1], &huge_pages_mode)) {
+			HugePages::set_mode(huge_pages_mode);
+			i++;
+		}
+		else if (arg == "--history" && i + 1 < argc && (history_kb = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--history-every" && i + 1 < argc && (history_every_ms = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--track-table" && i + 1 < argc) {
+			track_table_path = argv[++i];
+		}
+		else if (arg == "--track-table-slots" && i + 1 < argc && (track_table_slots = atoi(argv[i + 1])) >= 1) {
+			i++;
+		}
+		else if (arg == "--route" && i + 1 < argc) {
+			std::string list = argv[++i];
+			for (size_t begin = 0, end; begin <= list.length(); begin = end + 1) {
+				end = std::min(list.find(',', begin), list.length());
+				if (end > begin) {
+					route_nodes.push_back(list.substr(begin, end - begin));
+				}
+			}
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--threads <number of worker threads> [--reuse-port | --shared-listen] [--rebalance <ms>]] [--deflate]"
+				<< " [--backpressure buffer|drop-oldest|coalesce|disconnect] [--tls <certificate chain> <key> [--ktls]]"
+				<< " [--reorder <depth>] [--reorder-budget <ms>] [--record <measurement log>] [--record-compress] [--estimate-log <file>]"
+				<< " [--receive-buffer <KB>] [--cpus <list, such as 0-3,8 or node1>]"
+				<< " [--shed-backlog <measurements>] [--shed-lag <us>] [--dedup]"
+				<< " [--checkpoint <file> [--checkpoint-interval <ms>]] [--publish-rate <Hz> [--publish-delta <m>] [--publish-keyframe <rounds>]]"
+				<< " [--shm <path> [--shm-channels <number>]] [--udp <port> [--udp-demote <ms>]] [--unix <socket path>]"
+				<< " [--listen-backlog <connections>] [--accept-budget <connections>]"
+				<< " [--pipeline <filter threads per loop>] [--port <port>] [--route <node URI>,...]"
+				<< " [--relay <aggregator URI> [--relay-connections <number>] [--relay-buffer <MB>]]"
+				<< " [--rate-limit <messages/s>] [--rate-limit-bytes <KB/s>] [--rate-limit-action drop|pause|disconnect]"
+				<< " [--send-batch <us> [--send-batch-bytes <KB>]] [--handoff <socket path>]"
+				<< " [--admit-connections <number>] [--admit-busy <percent>] [--admit-action defer|reject]"
+				<< " [--trace <every how many messages> [--trace-threshold <us>]] [--memory-budget <MB>]"
+				<< " [--qos-busy <percent>]"
+				<< " [--shadow <profile JSON> [--shadow-sigma scaled|simplex|cubature] [--shadow-threads <number>] [--shadow-cpus <list>]]"
+				<< " [--resume-grace <ms>] [--geofence <zones JSON>] [--warmup <sessions> [--warmup-hugepages]]"
+				<< " [--hugepages off|thp|explicit]"
+				<< " [--history <KB per track> [--history-every <ms>]]"
+				<< " [--track-table <path> [--track-table-slots <number>]]"
+#ifdef USE_MICRO_UV
+				<< " [--spin <microseconds>] [--zerocopy <bytes>]"
+#endif
+				<< std::endl;
+			return -1;
+		}
+	}
+
+	if (history_every_ms && !history_kb) {
+		std::cerr << "--history-every needs --history" << std::endl;
+		return -1;
+	}
+	if (history_kb) {
+		TrackRegistry::set_history(size_t(history_kb) << 10, history_every_ms * 1000LL);
+	}
+	ShmTrackTable track_table;
+	if (track_table_path) {
+		if (!track_table.Create(track_table_path, track_table_slots)) {
+			std::cerr << "Cannot create the track table " << track_table_path << std::endl;
+			return -1;
+		}
+		TrackRegistry::set_shm_table(&track_table);
+	}
+
+	if (pipeline_workers && publish_rate) {
+		std::cerr << "--pipeline and --publish-rate cannot be combined" << std::endl;
+		return -1;
+	}
+	if (rebalance_ms && pipeline_workers) {
+		std::cerr << "--pipeline and --rebalance cannot be combined" << std::endl;
+		return -1;
+	}
+	if (relay_uri && (pipeline_workers || !route_nodes.empty())) {
+		std::cerr << "--relay cannot be combined with --pipeline or --route" << std::endl;
+		return -1;
+	}
+	if (handoff_path && (threads != 1 || pipeline_workers || !route_nodes.empty() || shm_path || udp_port || unix_path)) {
+		std::cerr << "--handoff cannot be combined with --threads, --pipeline, --route, --shm, --udp or --unix" << std::endl;
+		return -1;
+	}
+	const size_t relay_buffer = size_t(relay_buffer_mb) << 20;
+	LatencyStats::SetTracing(trace_every, (uint64_t) trace_threshold_us * 1000);
+
+	// the estimate messages repeat within a few hundred bytes, so a 4 KB window
+	// compresses them about as well as the default 32 KB at an eighth of the memory
+	const int deflate_window_bits = 12;
+	const int deflate_mem_level = 5;
+	// over a thousand estimate messages a client has not read yet
+	const size_t high_watermark = 256 * 1024;
+
+	// recording only copies into a block; the log is written on a thread
+	// of its own
+	MeasurementLogRecorder recorder;
+	if (record_path && !recorder.Open(record_path, measurement_log::kDefaultBlockCapacity, 8, false, record_compress)) {
+		std::cerr << "Cannot create " << record_path << std::endl;
+		return -1;
+	}
+	MeasurementLogRecorder *session_recorder = record_path ? &recorder : nullptr;
+	EstimateLog estimate_log;
+	if (estimate_log_path && !estimate_log.Open(estimate_log_path)) {
+		std::cerr << "Cannot create " << estimate_log_path << std::endl;
+		return -1;
+	}
+	EstimateLog *session_estimate_log = estimate_log_path ? &estimate_log : nullptr;
+
+	// the shadow filters start from the default profile, with the values
+	// given
+	ShadowFilter shadow;
+	ShadowFilter *session_shadow = nullptr;
+	if (shadow_profile) {
+		std::string error;
+		const UKFConfig *config = ConfigRegistry::Parse(shadow_profile, UKFConfig::Default(), &error);
+		if (!config) {
+			std::cerr << "--shadow: " << error << std::endl;
+			return -1;
+		}
+		shadow.Start(config, shadow_scheme, shadow_threads, shadow_cpus);
+		session_shadow = &shadow;
+	}
+
+	Geofence geofence;
+	const Geofence *session_geofence = nullptr;
+	if (geofence_zones) {
+		std::string error;
+		if (!geofence.Parse(geofence_zones, &error)) {
+			std::cerr << "--geofence: " << error << std::endl;
+			return -1;
+		}
+		session_geofence = &geofence;
+	}
+
+	// shared by the loops, as a client may reconnect to another
+	SessionResumption resumption(resume_grace_ms);
+	SessionResumption *session_resumption = resume_grace_ms ? &resumption : nullptr;
+
+	// the tracks of the last run are mapped, and taken over by the sessions
+	// that get their ids
+	CheckpointReader restored;
+	CheckpointReader *session_checkpoint = nullptr;
+	CheckpointWriter checkpoints;
+	if (checkpoint_path) {
+		uint64_t start = LatencyStats::Now();
+		if (restored.Open(checkpoint_path)) {
+			session_checkpoint = &restored;
+			std::cout << "Restoring " << restored.size() << " tracks from " << checkpoint_path << " ("
+				<< (LatencyStats::Now() - start) / 1e6 << " ms)" << std::endl;
+		}
+		if (!checkpoints.Start(checkpoint_path, checkpoint_interval, session_checkpoint)) {
+			std::cerr << "Cannot write " << checkpoint_path << std::endl;
+			return -1;
+		}
+	}
+
+	// a router holds no sessions; its one loop only forwards frames
+	if (!route_nodes.empty()) {
+		uWS::Hub h(0, false, receive_buffer);
+		ShardRouter router(h, route_nodes);
+		ServeRouterHttp(h, router);
+		if (!h.listen(port, tls, listen_options)) {
+			std::cerr << "Failed to listen to port" << std::endl;
+			return -1;
+		}
+		std::cout << "Routing port " << port << " to " << route_nodes.size() << " nodes" << std::endl;
+		h.run();
+		return 0;
+	}
+
+	if (threads == 1) {
+		uWS::Hub h(extension_options, false, receive_buffer);
+		h.setDeflateOptions(deflate_window_bits, deflate_mem_level);
+		SpinLoop(h, spin_micros);
+		if (listen_backlog) {
+			h.setListenBacklog(listen_backlog);
+		}
+		if (accept_budget) {
+			h.setAcceptBudget(accept_budget);
+		}
+		h.setZeroCopyThreshold(zero_copy_threshold);
+
+		// every connection gets its own filter and statistics
+		SessionPool sessions;
+		sessions.set_reorder_depth(reorder_depth);
+		sessions.set_reorder_budget(reorder_budget_us);
+		sessions.set_recorder(session_recorder);
+		sessions.set_estimate_log(session_estimate_log);
+		sessions.set_shadow(session_shadow);
+		sessions.set_load_shedding(shed_backlog, shed_lag_us);
+		sessions.set_deduplication(deduplicate);
+		sessions.set_checkpoint(session_checkpoint);
+		sessions.set_resumption(session_resumption);
+		sessions.set_geofence(session_geofence);
+		Metrics::Local().set_shard(0);
+		std::unique_ptr<Pipeline> pipeline;
+		if (pipeline_workers) {
+			pipeline.reset(new Pipeline(h, sessions, pipeline_workers));
+		}
+		std::unique_ptr<TrackRelay> relay;
+		if (relay_uri) {
+			relay.reset(new TrackRelay(h, sessions, relay_uri, relay_connections, relay_buffer));
+		}
+		ServeSessions(h, sessions, high_watermark, policy, rate_limit, send_batch, admission, pipeline.get());
+		ServeHttp(h, tls, nullptr, record_path, estimate_log_path, session_shadow);
+		std::unique_ptr<TrackPublisher> publisher;
+		if (publish_rate) {
+			publisher.reset(new TrackPublisher(h, sessions, 1000 / publish_rate, publish_delta, publish_keyframe));
+		}
+		ShmTransport shm(h, sessions);
+		if (shm_path && !ServeShm(shm, shm_path, shm_channels, 0, 1)) {
+			return -1;
+		}
+		UdpListener udp(h, sessions);
+		udp.set_demote_after(udp_demote_ms);
+		if (udp_port && !udp.Listen(udp_port)) {
+			std::cerr << "Failed to listen to UDP port " << udp_port << std::endl;
+			return -1;
+		}
+		std::unique_ptr<MemoryGovernor> governor;
+		if (MemoryAccount::budget()) {
+			governor.reset(new MemoryGovernor(h, nullptr, sessions));
+			governor->set_udp(&udp);
+			governor->set_drop_histories(!pipeline);
+		}
+		std::unique_ptr<QosGovernor> qos_governor;
+		if (qos_busy > 0) {
+			qos_governor.reset(new QosGovernor(h, sessions, qos_busy));
+		}
+
+		UseHugePages(h);
+		if (warmup_sessions) {
+			WarmUp(h, sessions, warmup_sessions, warmup_huge_pages);
+		}
+
+		ProcessHandoff handoff(h, sessions);
+		if (handoff_path && handoff.TakeOver(handoff_path, tls, listen_options))
 		{
-			res->end(s.data(), s.length());
+			std::cout << "Took over the port and " << handoff.taken_over() << " connections from "
+				<< handoff_path << std::endl;
+		}
+		else if (h.listen(port, tls, listen_options))
+		{
+			std::cout << "Listening to port " << port << std::endl;
 		}
 		else
 		{
-			// i guess this should be done more gracefully?
-			res->end(nullptr, 0);
+			std::cerr << "Failed to listen to port" << std::endl;
+			return -1;
 		}
-	});
-
-	h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
-		std::cout << "Connected!!!" << std::endl;
-	});
+		if (unix_path && !ListenUnix(h.listenUnix(unix_path, tls, listen_options), unix_path)) {
+			return -1;
+		}
+		if (handoff_path && !handoff.Serve(handoff_path, tls, listen_options, [](int handed_over) {
+			// the new process has the tracks; the rest goes as with a kill
+			std::cout << "Handed over " << handed_over << " connections" << std::endl;
+			std::_Exit(0);
+		})) {
+			std::cerr << "Cannot serve handoffs at " << handoff_path << std::endl;
+			return -1;
+		}
+		h.run();
+		return 0;
+	}
 
-	h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> ws, int code, char *message, size_t length) {
-		ws.close();
-		std::cout << "Disconnected" << std::endl;
+	// one session pool per worker, only ever touched by the worker's thread
+	std::vector<SessionPool> sessions(threads);
+	for (SessionPool &worker_sessions : sessions) {
+		worker_sessions.set_reorder_depth(reorder_depth);
+		worker_sessions.set_reorder_budget(reorder_budget_us);
+		worker_sessions.set_recorder(session_recorder);
+		worker_sessions.set_estimate_log(session_estimate_log);
+		worker_sessions.set_shadow(session_shadow);
+		worker_sessions.set_load_shedding(shed_backlog, shed_lag_us);
+		worker_sessions.set_deduplication(deduplicate);
+		worker_sessions.set_checkpoint(session_checkpoint);
+		worker_sessions.set_resumption(session_resumption);
+		worker_sessions.set_geofence(session_geofence);
+	}
+	uWS::HubPool pool(threads, balance, extension_options, receive_buffer, cpus);
+	for (int i = 0; i < threads && !cpus.empty(); i++) {
+		if (pool.getCpu(i) < 0) {
+			std::cerr << "Cannot pin worker " << i << " to CPU " << cpus[i % cpus.size()] << std::endl;
+		}
+	}
+	pool.setDeflateOptions(deflate_window_bits, deflate_mem_level);
+	if (listen_backlog) {
+		pool.setListenBacklog(listen_backlog);
+	}
+	if (accept_budget) {
+		pool.setAcceptBudget(accept_budget);
+	}
+	pool.setZeroCopyThreshold(zero_copy_threshold);
+	// created on the workers' threads, and kept as long as their loops
+	std::vector<std::unique_ptr<TrackPublisher> > publishers(threads);
+	std::vector<std::unique_ptr<ShmTransport> > shm(threads);
+	std::vector<std::unique_ptr<UdpListener> > udp(threads);
+	std::vector<std::unique_ptr<Pipeline> > pipelines(threads);
+	std::vector<std::unique_ptr<SessionBalancer> > balancers(threads);
+	std::vector<std::unique_ptr<TrackRelay> > relays(threads);
+	std::vector<std::unique_ptr<MemoryGovernor> > governors(threads);
+	std::vector<std::unique_ptr<QosGovernor> > qos_governors(threads);
+	pool.onWorker([&pool, &sessions, &publishers, &shm, &udp, &pipelines, &balancers, &relays, &governors, &qos_governors, qos_busy, high_watermark, policy, &rate_limit, &send_batch, &admission, spin_micros, tls,
+	               publish_rate, publish_delta, publish_keyframe, shm_path, shm_channels, udp_port, udp_demote_ms, threads, pipeline_workers,
+	               rebalance_ms, relay_uri, relay_connections, relay_buffer, record_path,
+	               estimate_log_path, session_shadow, warmup_sessions, warmup_huge_pages](uWS::Hub &h, int index) {
+		// on the worker's thread, whose memory it is, before its loop runs
+		UseHugePages(h);
+		Metrics::Local().set_shard(index);
+		if (warmup_sessions) {
+			WarmUp(h, sessions[index], warmup_sessions, warmup_huge_pages);
+		}
+		SpinLoop(h, spin_micros);
+		if (pipeline_workers) {
+			pipelines[index].reset(new Pipeline(h, sessions[index], pipeline_workers));
+		}
+		if (relay_uri) {
+			relays[index].reset(new TrackRelay(h, sessions[index], relay_uri, relay_connections, relay_buffer));
+		}
+		ServeSessions(h, sessions[index], high_watermark, policy, rate_limit, send_batch, admission, pipelines[index].get());
+		ServeHttp(h, tls, &pool, record_path, estimate_log_path, session_shadow);
+		if (publish_rate) {
+			publishers[index].reset(new TrackPublisher(h, sessions[index], 1000 / publish_rate, publish_delta, publish_keyframe));
+		}
+		if (shm_path) {
+			shm[index].reset(new ShmTransport(h, sessions[index]));
+			ServeShm(*shm[index], shm_path, shm_channels, index, threads);
+		}
+		if (rebalance_ms && threads > 1) {
+			balancers[index].reset(new SessionBalancer(pool, h, index, sessions[index], rebalance_ms));
+		}
+		if (udp_port) {
+			udp[index].reset(new UdpListener(h, sessions[index]));
+			udp[index]->set_demote_after(udp_demote_ms);
+			if (!udp[index]->Listen(udp_port)) {
+				std::cerr << "Worker " << index << " failed to listen to UDP port " << udp_port << std::endl;
+			}
+		}
+		if (MemoryAccount::budget()) {
+			governors[index].reset(new MemoryGovernor(h, &pool, sessions[index]));
+			governors[index]->set_udp(udp[index].get());
+			governors[index]->set_drop_histories(!pipeline_workers);
+		}
+		if (qos_busy > 0) {
+			qos_governors[index].reset(new QosGovernor(h, sessions[index], qos_busy));
+		}
 	});
+	ServeHttp(pool.getAcceptor(), tls, &pool, record_path, estimate_log_path, session_shadow);
 
-	int port = 4567;
-	if (h.listen(port))
+	if (pool.listen(port, tls, listen_options))
 	{
-		std::cout << "Listening to port " << port << std::endl;
+		std::cout << "Listening to port " << port << " with " << threads << " worker threads" << std::endl;
 	}
 	else
 	{
 		std::cerr << "Failed to listen to port" << std::endl;
 		return -1;
 	}
-	h.run();
-}
\ No newline at end of file
+	if (unix_path && !ListenUnix(pool.listenUnix(unix_path, tls, listen_options), unix_path)) {
+		return -1;
+	}
+	pool.run();
+}
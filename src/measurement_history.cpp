@@ -0,0 +1,68 @@
+#include "measurement_history.h"
+
+MeasurementHistory::MeasurementHistory(size_t depth)
+	: entries_(depth > 0 ? depth : 1), head_(0), size_(0),
+	  refiltered_(0), too_late_(0) {
+	replay_.raw_measurements_ = MeasurementPackage::Vector::Zero(3);
+}
+
+void MeasurementHistory::Reset() {
+	head_ = 0;
+	size_ = 0;
+}
+
+void MeasurementHistory::Filter(CTRVUKF &ukf, Entry &entry) {
+	ukf.Save(&entry.before);
+	replay_.timestamp_ = entry.timestamp;
+	replay_.sensor_type_ = entry.sensor;
+	for (int i = 0; i < 3; i++) {
+		replay_.raw_measurements_(i) = entry.z[i];
+	}
+	ukf.ProcessMeasurement(replay_);
+}
+
+MeasurementHistory::Result MeasurementHistory::Process(CTRVUKF &ukf, const MeasurementPackage &meas_package) {
+	const long long timestamp = meas_package.timestamp_;
+
+	// the late measurement goes before the first later one, k
+	size_t k = size_;
+	while (k > 0 && at(k - 1).timestamp > timestamp) {
+		k--;
+	}
+	Result result = k == size_ ? IN_SEQUENCE : REFILTERED;
+	if (result == REFILTERED && ((k == 0 && size_ == entries_.size()) || at(k).before.time_us > timestamp)) {
+		// older than everything the history keeps, or than the state it
+		// would start from
+		too_late_++;
+		return TOO_LATE;
+	}
+
+	if (size_ == entries_.size()) {
+		head_ = (head_ + 1) % entries_.size();
+		size_--;
+		k--;
+	}
+	// make room at k by moving the later entries one place on
+	for (size_t i = size_; i > k; i--) {
+		at(i) = at(i - 1);
+	}
+	size_++;
+
+	Entry &entry = at(k);
+	entry.timestamp = timestamp;
+	entry.sensor = meas_package.sensor_type_;
+	const int n_z = meas_package.sensor_type_ == MeasurementPackage::RADAR ? 3 : 2;
+	for (int i = 0; i < 3; i++) {
+		entry.z[i] = i < n_z ? meas_package.raw_measurements_(i) : 0.0;
+	}
+	if (result == REFILTERED) {
+		// start from the state before the first later measurement, saved
+		// with it and now moved to k + 1
+		ukf.Restore(at(k + 1).before);
+		refiltered_++;
+	}
+	for (size_t i = k; i < size_; i++) {
+		Filter(ukf, at(i));
+	}
+	return result;
+}
@@ -0,0 +1,82 @@
+#ifndef MEASUREMENT_HISTORY_H_
+#define MEASUREMENT_HISTORY_H_
+
+#include "measurement_package.h"
+#include "ukf.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * Out-of-sequence measurement handling for one filter: a ring buffer of the
+ * last measurements, each with the filter's state from just before it. A
+ * measurement older than the newest is filtered from the checkpoint where it
+ * belongs, and the measurements after it are filtered again from there, so
+ * the state ends up as if they had all arrived in order. Memory is fixed at
+ * construction and processing does not allocate.
+ */
+class MeasurementHistory {
+public:
+  enum Result {
+    ///* no older than the newest measurement, filtered as usual
+    IN_SEQUENCE,
+    ///* late, filtered at its place with the later ones filtered again
+    REFILTERED,
+    ///* later than depth measurements or the oldest checkpoint, dropped
+    TOO_LATE
+  };
+
+  /**
+   * @param depth The most measurements that are filtered again for a late
+   * one, and the number kept
+   */
+  explicit MeasurementHistory(size_t depth);
+
+  /**
+   * Filters meas_package with ukf, which must only be run through this
+   * history. Afterwards the state and NIS are those of the newest
+   * measurement.
+   */
+  Result Process(CTRVUKF &ukf, const MeasurementPackage &meas_package);
+
+  ///* forgets the measurements, for a new track
+  void Reset();
+
+  size_t size() const { return size_; }
+  size_t depth() const { return entries_.size(); }
+
+  ///* bytes of its entries
+  size_t memory() const { return entries_.capacity() * sizeof(Entry); }
+
+  ///* late measurements filtered again, and dropped
+  long long refiltered() const { return refiltered_; }
+  long long too_late() const { return too_late_; }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  struct Entry {
+    ///* the filter before this measurement
+    CTRVUKF::Checkpoint before;
+    long long timestamp;
+    MeasurementPackage::SensorType sensor;
+    double z[3];
+  };
+
+  std::vector<Entry> entries_;
+  ///* oldest entry in the ring, and number of entries
+  size_t head_;
+  size_t size_;
+
+  ///* the measurements are filtered again from here, sized for radar
+  MeasurementPackage replay_;
+
+  long long refiltered_;
+  long long too_late_;
+
+  Entry &at(size_t i) { return entries_[(head_ + i) % entries_.size()]; }
+
+  ///* filters the measurement of entry, saving the state before it
+  void Filter(CTRVUKF &ukf, Entry &entry);
+};
+
+#endif /* MEASUREMENT_HISTORY_H_ */
@@ -0,0 +1,536 @@
+#include "measurement_log.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace measurement_log;
+
+namespace {
+
+const char kMagic[8] = {'U', 'K', 'F', 'C', 'L', 'O', 'G', '1'};
+const uint32_t kVersion = 1;
+const uint32_t kCompressedVersion = 2;
+
+///* offsets of the columns within a block of capacity measurements
+size_t TimestampColumn(size_t) { return kBlockHeaderSize; }
+size_t TrackColumn(size_t capacity) { return kBlockHeaderSize + 8 * capacity; }
+size_t SensorColumn(size_t capacity) { return kBlockHeaderSize + 12 * capacity; }
+size_t FlagsColumn(size_t capacity) { return kBlockHeaderSize + 13 * capacity; }
+size_t ZColumn(size_t capacity, int k) { return kBlockHeaderSize + (14 + 8 * k) * capacity; }
+size_t TruthColumn(size_t capacity, int k) { return kBlockHeaderSize + (38 + 8 * k) * capacity; }
+
+template <class T>
+void Store(char *p, T value) {
+	memcpy(p, &value, sizeof(value));
+}
+
+template <class T>
+T Load(const char *p) {
+	T value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+bool LittleEndian() {
+	const uint16_t one = 1;
+	return *reinterpret_cast<const unsigned char *>(&one) == 1;
+}
+
+bool WriteAll(int fd, const char *data, size_t length) {
+	while (length) {
+		const ssize_t written = write(fd, data, length);
+		if (written < 0) {
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+void EncodeHeader(char *header, bool compressed, uint32_t capacity, uint64_t blocks, uint64_t measurements,
+                  uint64_t index_offset, uint32_t tracks, uint32_t track_limit) {
+	memset(header, 0, kHeaderSize);
+	memcpy(header, kMagic, sizeof(kMagic));
+	Store<uint32_t>(header + 8, compressed ? kCompressedVersion : kVersion);
+	Store<uint32_t>(header + 12, capacity);
+	Store<uint64_t>(header + 16, blocks);
+	Store<uint64_t>(header + 24, measurements);
+	Store<uint64_t>(header + 32, index_offset);
+	if (compressed) {
+		Store<uint32_t>(header + 40, tracks);
+		Store<uint32_t>(header + 44, track_limit);
+	}
+}
+
+}
+
+MeasurementLogRecorder::MeasurementLogRecorder()
+	: fd_(-1), capacity_(0), block_size_(0), wait_when_full_(false), compress_(false), open_(nullptr),
+	  open_count_(0), closing_(false), blocks_(0), offset_(0), tracks_(0), failed_(false), recorded_(0),
+	  dropped_(0) {}
+
+MeasurementLogRecorder::~MeasurementLogRecorder() {
+	Close();
+}
+
+bool MeasurementLogRecorder::Open(const char *path, size_t block_capacity, size_t buffers,
+                                  bool wait_when_full, bool compress) {
+	Close();
+	fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd_ < 0) {
+		return false;
+	}
+	capacity_ = std::max<size_t>((block_capacity + 63) / 64 * 64, 64);
+	block_size_ = BlockSize(capacity_);
+	wait_when_full_ = wait_when_full;
+	compress_ = compress;
+	frame_.resize(compress ? kFrameHeaderSize + compressBound(block_size_) : 0);
+	delta_.resize(compress ? block_size_ / 8 : 0);
+	buffers_.assign(std::max<size_t>(buffers, 2), std::vector<uint64_t>(block_size_ / 8));
+	free_.clear();
+	for (size_t i = 0; i < buffers_.size(); i++) {
+		free_.push_back(reinterpret_cast<char *>(&buffers_[i][0]));
+	}
+	full_.clear();
+	open_ = nullptr;
+	open_count_ = 0;
+	closing_ = false;
+	index_.clear();
+	blocks_ = 0;
+	offset_ = kHeaderSize;
+	seen_.clear();
+	tracks_ = 0;
+	recorded_ = 0;
+	dropped_ = 0;
+
+	//the counts and the index offset are filled in when the log is closed
+	char header[kHeaderSize];
+	EncodeHeader(header, compress_, uint32_t(capacity_), 0, 0, 0, 0, 0);
+	failed_ = !WriteAll(fd_, header, kHeaderSize);
+	writer_ = std::thread(&MeasurementLogRecorder::Write, this);
+	return true;
+}
+
+bool MeasurementLogRecorder::Append(const MeasurementPackage &meas_package,
+                                    const Eigen::Vector4d *ground_truth, uint32_t track) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (fd_ < 0 || closing_) {
+		return false;
+	}
+	if (!open_) {
+		if (wait_when_full_) {
+			released_.wait(lock, [this] { return !free_.empty(); });
+		}
+		if (free_.empty()) {
+			dropped_++;
+			return false;
+		}
+		open_ = free_.back();
+		free_.pop_back();
+		open_count_ = 0;
+		memset(open_, 0, block_size_);
+	}
+
+	const size_t i = open_count_++;
+	const size_t n = capacity_;
+	const bool radar = meas_package.sensor_type_ == MeasurementPackage::RADAR;
+	Store<int64_t>(open_ + TimestampColumn(n) + 8 * i, meas_package.timestamp_);
+	Store<uint32_t>(open_ + TrackColumn(n) + 4 * i, track);
+	open_[SensorColumn(n) + i] = radar ? 1 : 0;
+	open_[FlagsColumn(n) + i] = ground_truth ? kHasGroundTruth : 0;
+	for (int k = 0; k < meas_package.raw_measurements_.size() && k < 3; k++) {
+		Store<double>(open_ + ZColumn(n, k) + 8 * i, meas_package.raw_measurements_(k));
+	}
+	if (ground_truth) {
+		for (int k = 0; k < 4; k++) {
+			Store<double>(open_ + TruthColumn(n, k) + 8 * i, (*ground_truth)(k));
+		}
+	}
+	if (i == 0 || meas_package.timestamp_ < Load<int64_t>(open_ + 8)) {
+		Store<int64_t>(open_ + 8, meas_package.timestamp_);
+	}
+	if (i == 0 || meas_package.timestamp_ > Load<int64_t>(open_ + 16)) {
+		Store<int64_t>(open_ + 16, meas_package.timestamp_);
+	}
+	Store<uint32_t>(open_, uint32_t(open_count_));
+	recorded_++;
+
+	if (open_count_ == capacity_) {
+		full_.push_back(open_);
+		open_ = nullptr;
+		ready_.notify_one();
+	}
+	return true;
+}
+
+void MeasurementLogRecorder::Write() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (;;) {
+		ready_.wait(lock, [this] { return !full_.empty() || closing_; });
+		if (full_.empty()) {
+			return;
+		}
+		char *block = full_.front();
+		full_.erase(full_.begin());
+		lock.unlock();
+		const bool ok = WriteBlock(block);
+		lock.lock();
+		failed_ = failed_ || !ok;
+		free_.push_back(block);
+		released_.notify_one();
+	}
+}
+
+bool MeasurementLogRecorder::WriteBlock(const char *block) {
+	const uint32_t count = Load<uint32_t>(block);
+	if (compress_) {
+		const uint32_t *track = reinterpret_cast<const uint32_t *>(block + TrackColumn(capacity_));
+		for (uint32_t i = 0; i < count; i++) {
+			if (track[i] >= seen_.size()) {
+				seen_.resize(size_t(track[i]) + 1, 0);
+			}
+			tracks_ += !seen_[track[i]];
+			seen_[track[i]] = 1;
+		}
+	}
+
+	const char *data = block;
+	size_t length = block_size_;
+	char entry[kIndexEntrySize];
+	memset(entry, 0, sizeof(entry));
+	Store<uint64_t>(entry, offset_);
+	memcpy(entry + 8, block, 4);
+	memcpy(entry + 16, block + 8, 16);
+	if (compress_) {
+		char *differences = reinterpret_cast<char *>(&delta_[0]);
+		memcpy(differences, block, block_size_);
+		int64_t *timestamp = reinterpret_cast<int64_t *>(differences + TimestampColumn(capacity_));
+		for (uint32_t i = count; i-- > 1;) {
+			timestamp[i] -= timestamp[i - 1];
+		}
+		uLongf deflated = frame_.size() - kFrameHeaderSize;
+		if (compress2(reinterpret_cast<Bytef *>(&frame_[kFrameHeaderSize]), &deflated,
+		              reinterpret_cast<const Bytef *>(differences), block_size_, Z_BEST_SPEED) != Z_OK) {
+			return false;
+		}
+		Store<uint32_t>(&frame_[0], uint32_t(deflated));
+		Store<uint32_t>(&frame_[4], count);
+		Store<uint32_t>(entry + 12, uint32_t(deflated));
+		data = frame_.data();
+		length = kFrameHeaderSize + deflated;
+	}
+	index_.insert(index_.end(), entry, entry + sizeof(entry));
+	blocks_++;
+	offset_ += length;
+	return WriteAll(fd_, data, length);
+}
+
+bool MeasurementLogRecorder::Close() {
+	if (fd_ < 0) {
+		return true;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (open_ && open_count_) {
+			full_.push_back(open_);
+			open_ = nullptr;
+		}
+		closing_ = true;
+		ready_.notify_one();
+	}
+	writer_.join();
+
+	//the writer has written every block; the index follows the last
+	const uint64_t index_offset = offset_;
+	bool ok = !failed_ && WriteAll(fd_, index_.data(), index_.size());
+	char header[kHeaderSize];
+	EncodeHeader(header, compress_, uint32_t(capacity_), blocks_, recorded_, index_offset, tracks_,
+	             uint32_t(seen_.size()));
+	ok = ok && pwrite(fd_, header, kHeaderSize, 0) == ssize_t(kHeaderSize);
+	ok = close(fd_) == 0 && ok;
+	fd_ = -1;
+	return ok;
+}
+
+long long MeasurementLogRecorder::recorded() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return recorded_;
+}
+
+long long MeasurementLogRecorder::dropped() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return dropped_;
+}
+
+MeasurementLog::MeasurementLog()
+	: data_(nullptr), length_(0), capacity_(0), compressed_(false), measurements_(0), tracks_(0), track_limit_(0) {}
+
+MeasurementLog::~MeasurementLog() {
+	if (data_) {
+		munmap(const_cast<char *>(data_), length_);
+	}
+}
+
+bool MeasurementLog::IsLog(const char *path) {
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	char magic[sizeof(kMagic)];
+	const bool log = read(fd, magic, sizeof(magic)) == ssize_t(sizeof(magic))
+		&& memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+	close(fd);
+	return log;
+}
+
+bool MeasurementLog::Open(const char *path) {
+	if (!LittleEndian()) {
+		return false;
+	}
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	void *mapped = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && size_t(st.st_size) >= kHeaderSize) {
+		mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+	if (data_) {
+		munmap(const_cast<char *>(data_), length_);
+	}
+	data_ = static_cast<const char *>(mapped);
+	length_ = st.st_size;
+	blocks_.clear();
+	frames_.clear();
+	reach_.clear();
+	earliest_.clear();
+	measurements_ = 0;
+	tracks_ = 0;
+	track_limit_ = 0;
+
+	size_t capacity;
+	uint64_t index_offset;
+	bool compressed;
+	if (!ParseHeader(data_, &capacity, &index_offset, &compressed)) {
+		return false;
+	}
+	capacity_ = capacity;
+	compressed_ = compressed;
+	if (compressed) {
+		return OpenFrames(index_offset);
+	}
+	const size_t block_size = BlockSize(capacity);
+
+	//the index of a closed log, or else every complete block in order
+	std::vector<uint64_t> offsets;
+	const uint64_t indexed = Load<uint64_t>(data_ + 16);
+	if (index_offset && index_offset <= length_ && indexed <= (length_ - index_offset) / kIndexEntrySize) {
+		for (uint64_t b = 0; b < indexed; b++) {
+			offsets.push_back(Load<uint64_t>(data_ + index_offset + b * kIndexEntrySize));
+		}
+	}
+	else {
+		for (uint64_t offset = kHeaderSize; offset + block_size <= length_; offset += block_size) {
+			offsets.push_back(offset);
+		}
+	}
+
+	std::vector<std::pair<int64_t, int64_t> > times;
+	for (uint64_t offset : offsets) {
+		if (offset % 64 || offset + block_size > length_) {
+			return false;
+		}
+		Block block;
+		if (!ParseBlock(data_ + offset, capacity, &block)) {
+			return false;
+		}
+		times.push_back(std::make_pair(Load<int64_t>(data_ + offset + 8), Load<int64_t>(data_ + offset + 16)));
+		for (size_t i = 0; i < block.count; i++) {
+			track_limit_ = std::max(track_limit_, block.track[i] + 1);
+		}
+		measurements_ += block.count;
+		blocks_.push_back(block);
+	}
+	std::vector<char> seen(track_limit_, 0);
+	for (const Block &block : blocks_) {
+		for (size_t i = 0; i < block.count; i++) {
+			tracks_ += !seen[block.track[i]];
+			seen[block.track[i]] = 1;
+		}
+	}
+	IndexTimes(times);
+	return true;
+}
+
+bool MeasurementLog::OpenFrames(uint64_t index_offset) {
+	//the index of a closed log, or else every complete frame in order
+	std::vector<std::pair<uint64_t, size_t> > frames;
+	const uint64_t indexed = Load<uint64_t>(data_ + 16);
+	const bool closed = index_offset && index_offset <= length_
+		&& indexed <= (length_ - index_offset) / kIndexEntrySize;
+	if (closed) {
+		for (uint64_t b = 0; b < indexed; b++) {
+			const char *entry = data_ + index_offset + b * kIndexEntrySize;
+			frames.push_back(std::make_pair(Load<uint64_t>(entry), size_t(Load<uint32_t>(entry + 12))));
+		}
+	}
+	else {
+		for (uint64_t offset = kHeaderSize; offset + kFrameHeaderSize <= length_;) {
+			const size_t length = Load<uint32_t>(data_ + offset);
+			if (length > length_ - offset - kFrameHeaderSize) {
+				break;
+			}
+			frames.push_back(std::make_pair(offset, length));
+			offset += kFrameHeaderSize + length;
+		}
+	}
+
+	for (size_t b = 0; b < frames.size(); b++) {
+		const uint64_t offset = frames[b].first;
+		if (offset < kHeaderSize || offset > length_ - kFrameHeaderSize
+		    || frames[b].second != Load<uint32_t>(data_ + offset)
+		    || frames[b].second > length_ - offset - kFrameHeaderSize) {
+			return false;
+		}
+		Block block;
+		memset(&block, 0, sizeof(block));
+		block.count = Load<uint32_t>(data_ + offset + 4);
+		if (block.count > capacity_) {
+			return false;
+		}
+		measurements_ += block.count;
+		blocks_.push_back(block);
+		frames_.push_back(std::make_pair(data_ + offset + kFrameHeaderSize, frames[b].second));
+	}
+
+	//the writer counted the tracks when it closed the log; otherwise every
+	//block is inflated to count them
+	std::vector<std::pair<int64_t, int64_t> > times;
+	if (closed && (Load<uint32_t>(data_ + 44) || !measurements_)) {
+		tracks_ = Load<uint32_t>(data_ + 40);
+		track_limit_ = Load<uint32_t>(data_ + 44);
+		for (uint64_t b = 0; b < indexed; b++) {
+			const char *entry = data_ + index_offset + b * kIndexEntrySize;
+			times.push_back(std::make_pair(Load<int64_t>(entry + 16), Load<int64_t>(entry + 24)));
+		}
+		IndexTimes(times);
+		return true;
+	}
+	std::vector<uint64_t> buffer(BlockSize(capacity_) / 8);
+	std::vector<char> seen;
+	for (size_t b = 0; b < blocks_.size(); b++) {
+		Block block;
+		if (!Inflate(b, reinterpret_cast<char *>(&buffer[0]), &block)) {
+			return false;
+		}
+		times.push_back(std::make_pair(Load<int64_t>(reinterpret_cast<const char *>(&buffer[1])),
+		                               Load<int64_t>(reinterpret_cast<const char *>(&buffer[2]))));
+		for (size_t i = 0; i < block.count; i++) {
+			if (block.track[i] >= seen.size()) {
+				seen.resize(size_t(block.track[i]) + 1, 0);
+			}
+			tracks_ += !seen[block.track[i]];
+			seen[block.track[i]] = 1;
+		}
+	}
+	track_limit_ = seen.size();
+	IndexTimes(times);
+	return true;
+}
+
+void MeasurementLog::IndexTimes(const std::vector<std::pair<int64_t, int64_t> > &times) {
+	reach_.resize(times.size());
+	earliest_.resize(times.size());
+	for (size_t b = 0; b < times.size(); b++) {
+		reach_[b] = b ? std::max(reach_[b - 1], times[b].second) : times[b].second;
+	}
+	for (size_t b = times.size(); b-- > 0;) {
+		earliest_[b] = b + 1 < times.size() ? std::min(earliest_[b + 1], times[b].first) : times[b].first;
+	}
+}
+
+void MeasurementLog::Span(int64_t from, int64_t to, size_t *begin, size_t *end) const {
+	//the first block with a measurement from from on, and the first from
+	//which on all are after to
+	*begin = std::lower_bound(reach_.begin(), reach_.end(), from) - reach_.begin();
+	*end = std::max<size_t>(*begin, std::upper_bound(earliest_.begin(), earliest_.end(), to) - earliest_.begin());
+}
+
+bool MeasurementLog::Inflate(size_t b, char *buffer, Block *block) const {
+	return InflateBlock(frames_[b].first, frames_[b].second, capacity_, buffer)
+		&& ParseBlock(buffer, capacity_, block) && block->count == blocks_[b].count;
+}
+
+bool MeasurementLog::InflateBlock(const char *frame, size_t length, size_t capacity, char *block) {
+	uLongf inflated = BlockSize(capacity);
+	if (uncompress(reinterpret_cast<Bytef *>(block), &inflated, reinterpret_cast<const Bytef *>(frame),
+	               length) != Z_OK || inflated != BlockSize(capacity)) {
+		return false;
+	}
+	const uint32_t count = std::min<uint32_t>(Load<uint32_t>(block), capacity);
+	int64_t *timestamp = reinterpret_cast<int64_t *>(block + TimestampColumn(capacity));
+	for (uint32_t i = 1; i < count; i++) {
+		timestamp[i] += timestamp[i - 1];
+	}
+	return true;
+}
+
+bool MeasurementLog::ParseHeader(const char *header, size_t *capacity, uint64_t *index_offset,
+                                 bool *compressed) {
+	*capacity = Load<uint32_t>(header + 12);
+	*index_offset = Load<uint64_t>(header + 32);
+	const uint32_t version = Load<uint32_t>(header + 8);
+	if (compressed) {
+		*compressed = version == kCompressedVersion;
+	}
+	return LittleEndian() && memcmp(header, kMagic, sizeof(kMagic)) == 0
+		&& (version == kVersion || (compressed && version == kCompressedVersion))
+		&& *capacity != 0 && *capacity % 64 == 0;
+}
+
+bool MeasurementLog::ParseBlock(const char *p, size_t capacity, Block *block) {
+	block->count = Load<uint32_t>(p);
+	if (block->count > capacity) {
+		return false;
+	}
+	block->timestamp = reinterpret_cast<const int64_t *>(p + TimestampColumn(capacity));
+	block->track = reinterpret_cast<const uint32_t *>(p + TrackColumn(capacity));
+	block->sensor = reinterpret_cast<const uint8_t *>(p + SensorColumn(capacity));
+	block->flags = reinterpret_cast<const uint8_t *>(p + FlagsColumn(capacity));
+	for (int k = 0; k < 3; k++) {
+		block->z[k] = reinterpret_cast<const double *>(p + ZColumn(capacity, k));
+	}
+	for (int k = 0; k < 4; k++) {
+		block->truth[k] = reinterpret_cast<const double *>(p + TruthColumn(capacity, k));
+	}
+	return true;
+}
+
+bool MeasurementLog::Get(const Block &block, size_t i, MeasurementPackage *meas_package,
+                         Eigen::Vector4d *ground_truth) {
+	meas_package->timestamp_ = block.timestamp[i];
+	const bool radar = block.sensor[i] != 0;
+	meas_package->sensor_type_ = radar ? MeasurementPackage::RADAR : MeasurementPackage::LASER;
+	const int n_z = radar ? 3 : 2;
+	meas_package->raw_measurements_.resize(n_z);
+	for (int k = 0; k < n_z; k++) {
+		meas_package->raw_measurements_(k) = block.z[k][i];
+	}
+	if (!(block.flags[i] & kHasGroundTruth)) {
+		return false;
+	}
+	for (int k = 0; k < 4; k++) {
+		(*ground_truth)(k) = block.truth[k][i];
+	}
+	return true;
+}
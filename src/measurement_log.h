@@ -0,0 +1,296 @@
+#ifndef MEASUREMENT_LOG_H_
+#define MEASUREMENT_LOG_H_
+
+#include "measurement_package.h"
+#include "Eigen/Dense"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Columnar measurement log, for recording sessions and replaying them
+ * without parsing. The file is a header, fixed-size blocks of up to
+ * block_capacity measurements and an index of the blocks:
+ *
+ *   header   64 bytes
+ *      0  char    magic[8]      "UKFCLOG1"
+ *      8  uint32  version       1
+ *     12  uint32  capacity      measurements per block, a multiple of 64
+ *     16  uint64  blocks
+ *     24  uint64  measurements
+ *     32  uint64  index_offset  0 until the log is closed
+ *   block    64 + 70 * capacity bytes, at 64 + b * block size
+ *      0  uint32  count         measurements in the block
+ *      8  int64   min, max      its earliest and latest timestamps
+ *     64  int64   timestamp[capacity]  in us
+ *         uint32  track[capacity]      the session's id
+ *         uint8   sensor[capacity]     0 = laser, 1 = radar
+ *         uint8   flags[capacity]      bit 0: ground truth is set
+ *         double  z[3][capacity]       as in measurement_record.h
+ *         double  truth[4][capacity]   x, y, vx, vy
+ *   index    32 bytes per block
+ *      0  uint64  offset, uint32 count, uint32 reserved, int64 min, max
+ *
+ * Every column is 64-byte aligned within a block, and blocks within the
+ * file, so that a mapped log is read in place. All fields are little-endian,
+ * so a log is only read on little-endian hosts. A log whose writer did not
+ * close it has no index; its complete blocks are still found at their fixed
+ * offsets.
+ *
+ * The blocks' timestamps are the time index: sessions interleave in a
+ * block, so its measurements are not in time order, but the latest
+ * timestamp of the blocks up to each, and the earliest of those from each
+ * on, only grow, and a binary search over them finds the blocks of a span
+ * of time (see MeasurementLog::Span). Logs written before held the first
+ * and last timestamp of a block instead, which are the same for a log of
+ * measurements in time order.
+ *
+ * A compressed log, version 2, has every block deflated with zlib on its
+ * own, with each timestamp but the first as the difference from the one
+ * before, which deflates to far less, as a frame right after the one
+ * before:
+ *
+ *   header   as above, and
+ *     40  uint32  tracks        distinct track ids, 0 until the log is closed
+ *     44  uint32  track_limit   one more than the largest
+ *   frame    8 bytes and the deflated block
+ *      0  uint32  length        bytes of the deflated block
+ *      4  uint32  count         measurements in the block
+ *   index    as above, with the frame's offset and the length in reserved
+ *
+ * so that its blocks can be inflated apart, on as many threads as there
+ * are (see replay.cpp), and the columns are used from there. The
+ * frames of a log without an index are found one after another.
+ */
+namespace measurement_log {
+
+const size_t kHeaderSize = 64;
+const size_t kBlockHeaderSize = 64;
+const size_t kIndexEntrySize = 32;
+const size_t kFrameHeaderSize = 8;
+const size_t kDefaultBlockCapacity = 4096;
+
+const unsigned char kHasGroundTruth = 1;
+
+///* bytes of a block of capacity measurements
+inline size_t BlockSize(size_t capacity) {
+  return kBlockHeaderSize + capacity * (8 + 4 + 1 + 1 + 3 * 8 + 4 * 8);
+}
+
+}
+
+/**
+ * Appends measurements to a log from the threads that receive them, and
+ * writes it on a thread of its own.
+ *
+ * Append copies a measurement into the open block under a short lock; full
+ * blocks are handed to the writer thread, so the caller never waits for the
+ * disk. Blocks come from a fixed set of buffers: when the disk falls so far
+ * behind that all are queued, Append drops the measurement and counts it,
+ * unless the recorder was opened to wait instead (for offline writers).
+ */
+class MeasurementLogRecorder {
+public:
+  MeasurementLogRecorder();
+
+  ///* closes the log
+  ~MeasurementLogRecorder();
+
+  /**
+   * Creates the log at path and starts the writer thread.
+   * @param block_capacity Measurements per block, rounded up to 64
+   * @param buffers Blocks that may be filled or waiting to be written
+   * @param wait_when_full Append waits for a free buffer instead of dropping
+   * @param compress Deflates every block on the writer thread (version 2)
+   * @return false if the file cannot be created
+   */
+  bool Open(const char *path, size_t block_capacity = measurement_log::kDefaultBlockCapacity,
+            size_t buffers = 8, bool wait_when_full = false, bool compress = false);
+
+  /**
+   * Appends one measurement of track, with ground truth if it is not null.
+   * @return false if the measurement was dropped or the log is not open
+   */
+  bool Append(const MeasurementPackage &meas_package, const Eigen::Vector4d *ground_truth,
+              uint32_t track);
+
+  /**
+   * Writes the open block and the index, and closes the file.
+   * @return false if a write failed at any time
+   */
+  bool Close();
+
+  ///* measurements appended, and dropped by Append
+  long long recorded() const;
+  long long dropped() const;
+
+private:
+  int fd_;
+  size_t capacity_;
+  size_t block_size_;
+  bool wait_when_full_;
+  bool compress_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable released_;
+  ///* the buffers, and those free, full (in order) and being filled
+  std::vector<std::vector<uint64_t> > buffers_;
+  std::vector<char *> free_;
+  std::vector<char *> full_;
+  char *open_;
+  size_t open_count_;
+  bool closing_;
+  std::thread writer_;
+
+  ///* written blocks, for the index, where the next goes, and the track
+  ///* ids seen; touched by the writer thread only
+  std::vector<char> index_;
+  uint64_t blocks_;
+  uint64_t offset_;
+  std::vector<char> seen_;
+  uint32_t tracks_;
+  bool failed_;
+  ///* a block with its timestamps as differences, and deflated with its
+  ///* frame header
+  std::vector<uint64_t> delta_;
+  std::vector<char> frame_;
+
+  long long recorded_;
+  long long dropped_;
+
+  void Write();
+  bool WriteBlock(const char *block);
+
+  MeasurementLogRecorder(const MeasurementLogRecorder &);
+  MeasurementLogRecorder &operator=(const MeasurementLogRecorder &);
+};
+
+/**
+ * A log mapped into memory for reading. A block's columns are used in
+ * place, or copied into packages for UKF::ProcessMeasurement and
+ * UKFBatch::ProcessMeasurements. The blocks of a compressed log are
+ * inflated first, with Inflate.
+ */
+class MeasurementLog {
+public:
+  ///* the columns of one block
+  struct Block {
+    size_t count;
+    const int64_t *timestamp;
+    const uint32_t *track;
+    const uint8_t *sensor;
+    const uint8_t *flags;
+    const double *z[3];
+    const double *truth[4];
+  };
+
+  MeasurementLog();
+  ~MeasurementLog();
+
+  /**
+   * Maps the log at path.
+   * @return false if it cannot be opened or is not a log
+   */
+  bool Open(const char *path);
+
+  /**
+   * Whether the file at path starts with the header of a log.
+   */
+  static bool IsLog(const char *path);
+
+  size_t blocks() const { return blocks_.size(); }
+  size_t size() const { return measurements_; }
+
+  ///* measurements per block
+  size_t capacity() const { return capacity_; }
+
+  ///* whether the blocks are deflated, and block() only has their counts
+  bool compressed() const { return compressed_; }
+
+  ///* the columns of block b, of an uncompressed log
+  const Block &block(size_t b) const { return blocks_[b]; }
+
+  /**
+   * Inflates block b into buffer, BlockSize(capacity()) bytes aligned to 8
+   * at least, and finds its columns there; from any thread.
+   * @return false if the frame is corrupt
+   */
+  bool Inflate(size_t b, char *buffer, Block *block) const;
+
+  /**
+   * The blocks [*begin, *end) holding every measurement with a timestamp
+   * in [from, to], by binary search over the time index; they may hold
+   * others as well, from sessions interleaved with those.
+   */
+  void Span(int64_t from, int64_t to, size_t *begin, size_t *end) const;
+
+  ///* distinct track ids, and one more than the largest
+  size_t tracks() const { return tracks_; }
+  uint32_t track_limit() const { return track_limit_; }
+
+  /**
+   * Copies measurement i of block into meas_package and its ground truth
+   * into ground_truth.
+   * @return Whether the measurement has ground truth
+   */
+  static bool Get(const Block &block, size_t i, MeasurementPackage *meas_package,
+                  Eigen::Vector4d *ground_truth);
+
+  /**
+   * Reads the header of a log, kHeaderSize bytes at header, for readers
+   * that go through the file a block at a time instead of mapping it.
+   * @param capacity Set to the measurements per block
+   * @param index_offset Set to where the index starts, 0 if there is none
+   * @param compressed Set to whether the blocks are frames (see above); a
+   * compressed log is refused without it
+   * @return false if it is not the header of a log this host reads
+   */
+  static bool ParseHeader(const char *header, size_t *capacity, uint64_t *index_offset,
+                          bool *compressed = nullptr);
+
+  /**
+   * Inflates the length bytes of a frame's deflated block at frame into
+   * block, BlockSize(capacity) bytes.
+   * @return false if they are not a deflated block of that size
+   */
+  static bool InflateBlock(const char *frame, size_t length, size_t capacity, char *block);
+
+  /**
+   * Finds the columns of the block at p, measurement_log::BlockSize(capacity)
+   * bytes aligned to 8 at least.
+   * @return false if it holds more than capacity measurements
+   */
+  static bool ParseBlock(const char *p, size_t capacity, Block *block);
+
+private:
+  const char *data_;
+  size_t length_;
+  size_t capacity_;
+  bool compressed_;
+  std::vector<Block> blocks_;
+  ///* the deflated blocks of a compressed log, and their lengths
+  std::vector<std::pair<const char *, size_t> > frames_;
+  size_t measurements_;
+  size_t tracks_;
+  uint32_t track_limit_;
+  ///* the time index: the latest timestamp of the blocks up to b, and the
+  ///* earliest of those from b on
+  std::vector<int64_t> reach_;
+  std::vector<int64_t> earliest_;
+
+  ///* Open for a compressed log, past the header
+  bool OpenFrames(uint64_t index_offset);
+
+  ///* the time index from the earliest and latest timestamp of each block
+  void IndexTimes(const std::vector<std::pair<int64_t, int64_t> > &times);
+
+  MeasurementLog(const MeasurementLog &);
+  MeasurementLog &operator=(const MeasurementLog &);
+};
+
+#endif /* MEASUREMENT_LOG_H_ */
@@ -5,14 +5,23 @@
 
 class MeasurementPackage {
 public:
-  long timestamp_;
+  ///* values of the largest measurement, radar's rho, phi and rho_dot
+  static const int kMaxSize = 3;
+
+  ///* a measurement's values, sized to the sensor's 2 or 3 but stored inline
+  ///* at the largest size, so that a package never allocates when it is
+  ///* filled, resized or copied
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 1, 0, kMaxSize, 1> Vector;
+
+  ///* in us
+  long long timestamp_;
 
   enum SensorType{
     LASER,
     RADAR
   } sensor_type_;
 
-  Eigen::VectorXd raw_measurements_;
+  Vector raw_measurements_;
 
 };
 
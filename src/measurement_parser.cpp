@@ -0,0 +1,443 @@
+#include "measurement_parser.h"
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace {
+
+inline const char *SkipBlanks(const char *p, const char *end) {
+	for (;;) {
+		if (p != end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+			p++;
+		}
+		else if (end - p >= 2 && p[0] == '\\' && (p[1] == 't' || p[1] == 'r' || p[1] == 'n')) {
+			p += 2;
+		}
+		else {
+			return p;
+		}
+	}
+}
+
+///* first occurrence of the n characters of needle in [p, end), or nullptr
+const char *Find(const char *p, const char *end, const char *needle, size_t n) {
+	while (end - p >= (ptrdiff_t)n) {
+		const char *c = static_cast<const char *>(memchr(p, needle[0], end - p - n + 1));
+		if (!c) {
+			return nullptr;
+		}
+		if (memcmp(c, needle, n) == 0) {
+			return c;
+		}
+		p = c + 1;
+	}
+	return nullptr;
+}
+
+inline bool IsDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+inline const char *SkipJsonBlanks(const char *p, const char *end) {
+	while (p != end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+		p++;
+	}
+	return p;
+}
+
+///* one past the closing quote of the string opening at p, or nullptr; with
+///* escaped set if it has escapes
+const char *SkipString(const char *p, const char *end, bool *escaped) {
+	for (p++; p != end && *p != '"'; p++) {
+		if (*p == '\\') {
+			*escaped = true;
+			if (++p == end) {
+				return nullptr;
+			}
+		}
+	}
+	return p == end ? nullptr : p + 1;
+}
+
+///* one past the JSON value at p, or nullptr; containers are only matched,
+///* and scalars end where the value does
+const char *SkipValue(const char *p, const char *end) {
+	int depth = 0;
+	bool escaped;
+	do {
+		p = SkipJsonBlanks(p, end);
+		if (p == end) {
+			return nullptr;
+		}
+		if (*p == '"') {
+			if (!(p = SkipString(p, end, &escaped))) {
+				return nullptr;
+			}
+		}
+		else if (*p == '[' || *p == '{') {
+			depth++;
+			p++;
+		}
+		else if (*p == ']' || *p == '}') {
+			if (--depth < 0) {
+				return nullptr;
+			}
+			p++;
+		}
+		else if (*p == ',' || *p == ':') {
+			if (!depth) {
+				return nullptr;
+			}
+			p++;
+		}
+		else {
+			const char *begin = p;
+			while (p != end && *p != ',' && *p != ':' && *p != ']' && *p != '}' && *p != '"'
+			       && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+				p++;
+			}
+			if (p == begin) {
+				return nullptr;
+			}
+		}
+	} while (depth);
+	return p;
+}
+
+///* powers of ten that are exact in a double
+const double kPow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+}
+
+const char *ParseDouble(const char *begin, const char *end, double *value) {
+	const char *p = SkipBlanks(begin, end);
+	bool negative = false;
+	if (p != end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+
+	//up to 19 significant digits fit the mantissa, the rest only scale it
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	for (; p != end && IsDigit(*p); p++) {
+		any = true;
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa) {
+				digits++;
+			}
+		}
+		else {
+			exponent++;
+		}
+	}
+	if (p != end && *p == '.') {
+		p++;
+		for (; p != end && IsDigit(*p); p++) {
+			any = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa) {
+					digits++;
+				}
+				exponent--;
+			}
+		}
+	}
+	if (!any) {
+		return nullptr;
+	}
+	if (p != end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool exponent_negative = false;
+		if (q != end && (*q == '-' || *q == '+')) {
+			exponent_negative = *q == '-';
+			q++;
+		}
+		if (q != end && IsDigit(*q)) {
+			int e = 0;
+			for (; q != end && IsDigit(*q); q++) {
+				if (e < 10000) {
+					e = e * 10 + (*q - '0');
+				}
+			}
+			exponent += exponent_negative ? -e : e;
+			p = q;
+		}
+	}
+
+	double result = double(mantissa);
+	if (exponent >= 0 && exponent <= 22) {
+		result *= kPow10[exponent];
+	}
+	else if (exponent < 0 && exponent >= -22) {
+		result /= kPow10[-exponent];
+	}
+	else {
+		result *= std::pow(10.0, exponent);
+	}
+	*value = negative ? -result : result;
+	return p;
+}
+
+const char *ParseInteger(const char *begin, const char *end, long long *value) {
+	const char *p = SkipBlanks(begin, end);
+	bool negative = false;
+	if (p != end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+	if (p == end || !IsDigit(*p)) {
+		return nullptr;
+	}
+	long long result = 0;
+	for (; p != end && IsDigit(*p); p++) {
+		//more digits than a long long holds, as istringstream's failbit
+		const int digit = *p - '0';
+		if (result > (LLONG_MAX - digit) / 10) {
+			return nullptr;
+		}
+		result = result * 10 + digit;
+	}
+	*value = negative ? -result : result;
+	return p;
+}
+
+bool ParseMeasurementLine(const char *begin, const char *end,
+                          MeasurementPackage *meas_package,
+                          Eigen::Vector4d *ground_truth) {
+	const char *p = SkipBlanks(begin, end);
+	if (p == end) {
+		return false;
+	}
+	int n_z;
+	if (*p == 'L') {
+		meas_package->sensor_type_ = MeasurementPackage::LASER;
+		n_z = 2;
+	}
+	else if (*p == 'R') {
+		meas_package->sensor_type_ = MeasurementPackage::RADAR;
+		n_z = 3;
+	}
+	else {
+		return false;
+	}
+	p++;
+
+	if (meas_package->raw_measurements_.size() != n_z) {
+		meas_package->raw_measurements_.resize(n_z);
+	}
+	for (int i = 0; i < n_z; i++) {
+		double z;
+		if (!(p = ParseDouble(p, end, &z))) {
+			return false;
+		}
+		meas_package->raw_measurements_(i) = z;
+	}
+	long long timestamp;
+	if (!(p = ParseInteger(p, end, &timestamp))) {
+		return false;
+	}
+	meas_package->timestamp_ = timestamp;
+
+	if (ground_truth) {
+		for (int i = 0; i < 4; i++) {
+			double g;
+			if (!(p = ParseDouble(p, end, &g))) {
+				return false;
+			}
+			(*ground_truth)(i) = g;
+		}
+	}
+	return true;
+}
+
+TelemetryMessage ParseTelemetry(const char *data, size_t length,
+                                MeasurementPackage *meas_package,
+                                Eigen::Vector4d *ground_truth,
+                                const char **lines) {
+	// "42" at the start of the message means there's a websocket message event.
+	// The 4 signifies a websocket message
+	// The 2 signifies a websocket event
+	if (length <= 2 || data[0] != '4' || data[1] != '2') {
+		return TELEMETRY_NOT_EVENT;
+	}
+	const char *end = data + length;
+
+	// an event without a JSON array, or with null data, asks for manual mode
+	const char *array = static_cast<const char *>(memchr(data, '[', length));
+	if (Find(data, end, "null", 4) || !array || !memchr(array, ']', end - array)) {
+		return TELEMETRY_MANUAL;
+	}
+
+	static const char kTelemetry[] = "\"telemetry\"";
+	const char *event = SkipBlanks(array + 1, end);
+	if (end - event < (ptrdiff_t)sizeof(kTelemetry) - 1
+		|| memcmp(event, kTelemetry, sizeof(kTelemetry) - 1) != 0) {
+		return TELEMETRY_OTHER_EVENT;
+	}
+
+	static const char kKey[] = "\"sensor_measurement\"";
+	const char *key = Find(event, end, kKey, sizeof(kKey) - 1);
+	if (!key) {
+		return TELEMETRY_MALFORMED;
+	}
+	const char *p = key + sizeof(kKey) - 1;
+	while (p != end && *p != '"' && *p != '[') {
+		p++;
+	}
+	if (p == end) {
+		return TELEMETRY_MALFORMED;
+	}
+	if (*p == '[') {
+		*lines = p + 1;
+		return TELEMETRY_MEASUREMENTS;
+	}
+	const char *begin = ++p;
+	while (p != end && *p != '"') {
+		p += *p == '\\' ? 2 : 1;
+	}
+	if (p >= end ||
+		!ParseMeasurementLine(begin, p, meas_package, ground_truth)) {
+		return TELEMETRY_MALFORMED;
+	}
+	return TELEMETRY_MEASUREMENT;
+}
+
+bool NextMeasurementLine(const char **lines, const char *end,
+                         MeasurementPackage *meas_package,
+                         Eigen::Vector4d *ground_truth) {
+	const char *p = SkipJsonBlanks(*lines, end);
+	if (p != end && *p == ',') {
+		p = SkipJsonBlanks(p + 1, end);
+	}
+	if (p == end || *p != '"') {
+		return false;
+	}
+	const char *begin = ++p;
+	while (p != end && *p != '"') {
+		p += *p == '\\' ? 2 : 1;
+	}
+	if (p >= end || !ParseMeasurementLine(begin, p, meas_package, ground_truth)) {
+		return false;
+	}
+	*lines = p + 1;
+	return true;
+}
+
+bool EventFields::Is(const char *name) const {
+	const size_t n = strlen(name);
+	return size_t(name_end - this->name) == n && memcmp(this->name, name, n) == 0;
+}
+
+bool EventFields::Get(const char *key, const char **begin, const char **end) const {
+	const size_t n = strlen(key);
+	for (int i = 0; i < count; i++) {
+		if (size_t(key_end[i] - this->key[i]) == n && memcmp(this->key[i], key, n) == 0) {
+			*begin = value[i];
+			*end = value_end[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ParseEvent(const char *data, size_t length, EventFields *event) {
+	if (length <= 2 || data[0] != '4' || data[1] != '2') {
+		return false;
+	}
+	const char *end = data + length;
+	bool escaped = false;
+
+	//["name",
+	const char *p = SkipJsonBlanks(data + 2, end);
+	if (p == end || *p != '[') {
+		return false;
+	}
+	p = SkipJsonBlanks(p + 1, end);
+	if (p == end || *p != '"') {
+		return false;
+	}
+	event->name = p + 1;
+	if (!(p = SkipString(p, end, &escaped))) {
+		return false;
+	}
+	event->name_end = p - 1;
+	p = SkipJsonBlanks(p, end);
+	if (p == end || *p != ',') {
+		return false;
+	}
+	p = SkipJsonBlanks(p + 1, end);
+	if (p == end || *p != '{') {
+		return false;
+	}
+
+	//{"key":value,...}
+	event->count = 0;
+	p = SkipJsonBlanks(p + 1, end);
+	if (p != end && *p == '}') {
+		p++;
+	}
+	else {
+		for (;;) {
+			if (p == end || *p != '"') {
+				return false;
+			}
+			const char *key = p + 1;
+			if (!(p = SkipString(p, end, &escaped))) {
+				return false;
+			}
+			const char *key_end = p - 1;
+			p = SkipJsonBlanks(p, end);
+			if (p == end || *p != ':') {
+				return false;
+			}
+			p = SkipJsonBlanks(p + 1, end);
+			if (p != end && *p == '"') {
+				if (event->count == EventFields::kMaxFields) {
+					return false;
+				}
+				const int i = event->count++;
+				event->key[i] = key;
+				event->key_end[i] = key_end;
+				event->value[i] = p + 1;
+				if (!(p = SkipString(p, end, &escaped))) {
+					return false;
+				}
+				event->value_end[i] = p - 1;
+			}
+			else if (!(p = SkipValue(p, end))) {
+				return false;
+			}
+			p = SkipJsonBlanks(p, end);
+			if (p != end && *p == '}') {
+				p++;
+				break;
+			}
+			if (p == end || *p != ',') {
+				return false;
+			}
+			p = SkipJsonBlanks(p + 1, end);
+		}
+	}
+
+	//any further arguments, then ]
+	for (;;) {
+		p = SkipJsonBlanks(p, end);
+		if (p != end && *p == ']') {
+			break;
+		}
+		if (p == end || *p != ',' || !(p = SkipValue(p + 1, end))) {
+			return false;
+		}
+	}
+	return !escaped && SkipJsonBlanks(p + 1, end) == end;
+}
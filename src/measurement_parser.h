@@ -0,0 +1,124 @@
+#ifndef MEASUREMENT_PARSER_H_
+#define MEASUREMENT_PARSER_H_
+
+#include "measurement_package.h"
+#include "Eigen/Dense"
+
+/**
+ * Parsers for the text measurement format shared by the simulator and the
+ * data files:
+ *
+ *   L p_x p_y timestamp x_gt y_gt vx_gt vy_gt [...]
+ *   R rho phi rho_dot timestamp x_gt y_gt vx_gt vy_gt [...]
+ *
+ * Fields are separated by blanks or by their JSON escapes (\t), so the
+ * measurement string of a simulator message can be parsed without unescaping
+ * it. All of them work on a [begin, end) character range in place: nothing is
+ * copied, the range does not need to be null-terminated and nothing past
+ * end is read.
+ */
+
+/**
+ * Parses a decimal floating point number after optional blanks.
+ * @return One past the last character of the number, or nullptr if the
+ * range does not start with a number
+ */
+const char *ParseDouble(const char *begin, const char *end, double *value);
+
+/**
+ * Parses a decimal integer after optional blanks.
+ * @return One past the last digit, or nullptr if there is none or the
+ * integer does not fit a long long
+ */
+const char *ParseInteger(const char *begin, const char *end, long long *value);
+
+/**
+ * Parses one measurement line (without its line break) into meas_package
+ * and, if ground_truth is not null, the ground truth [x, y, vx, vy] that
+ * follows it. Trailing fields are ignored.
+ * @return false if the line is not a valid laser or radar measurement
+ */
+bool ParseMeasurementLine(const char *begin, const char *end,
+                          MeasurementPackage *meas_package,
+                          Eigen::Vector4d *ground_truth);
+
+/**
+ * Kinds of simulator messages, see ParseTelemetry.
+ */
+enum TelemetryMessage {
+  ///* not a Socket.IO event ("42" prefix) at all
+  TELEMETRY_NOT_EVENT,
+  ///* an event without data, to be answered with the "manual" event
+  TELEMETRY_MANUAL,
+  ///* an event other than "telemetry"
+  TELEMETRY_OTHER_EVENT,
+  ///* a telemetry event whose measurement could not be parsed
+  TELEMETRY_MALFORMED,
+  ///* a telemetry event, parsed into the outputs
+  TELEMETRY_MEASUREMENT,
+  ///* a telemetry event with an array of measurement lines, none parsed
+  ///* yet, see NextMeasurementLine
+  TELEMETRY_MEASUREMENTS
+};
+
+/**
+ * Classifies a raw WebSocket message from the simulator, e.g.
+ *   42["telemetry",{"sensor_measurement":"L\t0.31\t0.58\t1477010443000000..."}]
+ * and for telemetry events parses the sensor_measurement string in place with
+ * ParseMeasurementLine. Clients that batch send an array of lines instead,
+ *   42["telemetry",{"sensor_measurement":["L\t0.31\t...","R\t1.01\t..."]}]
+ * which is left to NextMeasurementLine from *lines on.
+ */
+TelemetryMessage ParseTelemetry(const char *data, size_t length,
+                                MeasurementPackage *meas_package,
+                                Eigen::Vector4d *ground_truth,
+                                const char **lines);
+
+/**
+ * Parses the next line of a TELEMETRY_MEASUREMENTS message, as
+ * ParseTelemetry does a single one, and moves *lines past it; end is the end
+ * of the message.
+ * @return false at the end of the array, or at a line that cannot be parsed
+ */
+bool NextMeasurementLine(const char **lines, const char *end,
+                         MeasurementPackage *meas_package,
+                         Eigen::Vector4d *ground_truth);
+
+/**
+ * The name and string fields of a Socket.IO event whose data is an object,
+ * e.g.
+ *   42["subscribe",{"topic":"region/3/-1"}]
+ * Each is a [begin, end) range of the message it was parsed from, as
+ * ParseEvent finds them without building a JSON document.
+ */
+struct EventFields {
+  static const int kMaxFields = 8;
+
+  const char *name;
+  const char *name_end;
+  int count;
+  const char *key[kMaxFields];
+  const char *key_end[kMaxFields];
+  const char *value[kMaxFields];
+  const char *value_end[kMaxFields];
+
+  ///* whether the event is called name
+  bool Is(const char *name) const;
+
+  /**
+   * Finds the string field key.
+   * @return false if there is none
+   */
+  bool Get(const char *key, const char **begin, const char **end) const;
+};
+
+/**
+ * Parses an event for its name and the string fields of its data object in
+ * one pass over the message; fields of other types are skipped.
+ * @return false if the message is not such an event, or has a string with
+ * escapes or more than kMaxFields string fields, which only a JSON
+ * document can make sense of
+ */
+bool ParseEvent(const char *data, size_t length, EventFields *event);
+
+#endif /* MEASUREMENT_PARSER_H_ */
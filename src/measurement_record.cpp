@@ -0,0 +1,313 @@
+#include "measurement_record.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+namespace {
+
+//the format is little-endian, as are all hosts this server runs on; memcpy
+//keeps the accesses free of alignment assumptions
+inline double LoadDouble(const char *p) {
+	double a;
+	memcpy(&a, p, sizeof(a));
+	return a;
+}
+
+inline char *StoreDouble(char *p, double a) {
+	memcpy(p, &a, sizeof(a));
+	return p + sizeof(a);
+}
+
+inline char *StoreInt64(char *p, long long a) {
+	int64_t v = a;
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+inline char *StoreVarint(char *p, int64_t a) {
+	uint64_t v = (uint64_t(a) << 1) ^ uint64_t(a >> 63);
+	while (v >= 0x80) {
+		*p++ = char(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = char(v);
+	return p;
+}
+
+///* one past the varint at p, or nullptr if it does not end before end
+inline const char *LoadVarint(const char *p, const char *end, int64_t *a) {
+	uint64_t v = 0;
+	for (int shift = 0; p != end && shift < 64; shift += 7) {
+		const unsigned char byte = *p++;
+		v |= uint64_t(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*a = int64_t(v >> 1) ^ -int64_t(v & 1);
+			return p;
+		}
+	}
+	return nullptr;
+}
+
+///* round(a / kQuantum), within what a varint difference holds; NaN as 0
+inline int64_t Quantize(double a) {
+	const double limit = 1e15;
+	const double q = a / record::kQuantum;
+	if (q != q) {
+		return 0;
+	}
+	return llround(std::max(-limit, std::min(limit, q)));
+}
+
+const char *DecodeCompact(const char *begin, const char *end, MeasurementPackage *meas_package,
+                          Eigen::Vector4d *ground_truth, bool *has_ground_truth,
+                          record::DeltaState *delta) {
+	if (end - begin < 3) {
+		return nullptr;
+	}
+	const unsigned char sensor = begin[0] & ~record::kCompact;
+	const unsigned char flags = begin[1];
+	if (sensor > 1) {
+		return nullptr;
+	}
+	const int n_z = sensor == 0 ? 2 : 3;
+	const char *p = begin + 2;
+	int64_t step;
+	if (!(p = LoadVarint(p, end, &step))) {
+		return nullptr;
+	}
+	meas_package->sensor_type_ = sensor == 0 ? MeasurementPackage::LASER : MeasurementPackage::RADAR;
+	delta->timestamp += step;
+	meas_package->timestamp_ = delta->timestamp;
+	if (meas_package->raw_measurements_.size() != n_z) {
+		meas_package->raw_measurements_.resize(n_z);
+	}
+	if (flags & record::kQuantized) {
+		for (int i = 0; i < n_z; i++) {
+			if (!(p = LoadVarint(p, end, &step))) {
+				return nullptr;
+			}
+			delta->z[sensor][i] += step;
+			meas_package->raw_measurements_(i) = delta->z[sensor][i] * record::kQuantum;
+		}
+	}
+	else {
+		if (end - p < 8 * n_z) {
+			return nullptr;
+		}
+		for (int i = 0; i < n_z; i++, p += 8) {
+			meas_package->raw_measurements_(i) = LoadDouble(p);
+		}
+	}
+	*has_ground_truth = (flags & record::kHasGroundTruth) != 0;
+	if (*has_ground_truth) {
+		if (end - p < (ptrdiff_t)record::kGroundTruthSize) {
+			return nullptr;
+		}
+		for (int i = 0; i < 4; i++) {
+			(*ground_truth)(i) = LoadDouble(p + 8 * i);
+		}
+		p += record::kGroundTruthSize;
+	}
+	return p;
+}
+
+}
+
+namespace record {
+
+void DeltaState::Reset() {
+	timestamp = 0;
+	memset(z, 0, sizeof(z));
+}
+
+void EstimateDeltaState::Reset() {
+	timestamp = 0;
+	memset(values, 0, sizeof(values));
+}
+
+void StateDeltaState::Reset() {
+	timestamp = 0;
+	memset(values, 0, sizeof(values));
+}
+
+const char *DecodeMeasurement(const char *begin, const char *end,
+                              MeasurementPackage *meas_package,
+                              Eigen::Vector4d *ground_truth,
+                              bool *has_ground_truth,
+                              DeltaState *delta) {
+	if (delta && begin != end && (begin[0] & kCompact)) {
+		return DecodeCompact(begin, end, meas_package, ground_truth, has_ground_truth, delta);
+	}
+	if (end - begin < (ptrdiff_t)kMeasurementSize) {
+		return nullptr;
+	}
+	const unsigned char sensor = begin[0];
+	const unsigned char flags = begin[1];
+	if (sensor > 1) {
+		return nullptr;
+	}
+	const int n_z = sensor == 0 ? 2 : 3;
+	meas_package->sensor_type_ = sensor == 0 ? MeasurementPackage::LASER : MeasurementPackage::RADAR;
+
+	int64_t timestamp;
+	memcpy(&timestamp, begin + 8, sizeof(timestamp));
+	meas_package->timestamp_ = timestamp;
+
+	if (meas_package->raw_measurements_.size() != n_z) {
+		meas_package->raw_measurements_.resize(n_z);
+	}
+	for (int i = 0; i < n_z; i++) {
+		meas_package->raw_measurements_(i) = LoadDouble(begin + 16 + 8 * i);
+	}
+
+	const char *p = begin + kMeasurementSize;
+	*has_ground_truth = (flags & kHasGroundTruth) != 0;
+	if (*has_ground_truth) {
+		if (end - p < (ptrdiff_t)kGroundTruthSize) {
+			return nullptr;
+		}
+		for (int i = 0; i < 4; i++) {
+			(*ground_truth)(i) = LoadDouble(p + 8 * i);
+		}
+		p += kGroundTruthSize;
+	}
+	return p;
+}
+
+char *EncodeMeasurement(char *out, const MeasurementPackage &meas_package,
+                        const Eigen::Vector4d *ground_truth) {
+	memset(out, 0, kMeasurementSize);
+	out[0] = meas_package.sensor_type_ == MeasurementPackage::LASER ? 0 : 1;
+	out[1] = ground_truth ? kHasGroundTruth : 0;
+	StoreInt64(out + 8, meas_package.timestamp_);
+	for (int i = 0; i < meas_package.raw_measurements_.size() && i < 3; i++) {
+		StoreDouble(out + 16 + 8 * i, meas_package.raw_measurements_(i));
+	}
+	char *p = out + kMeasurementSize;
+	if (ground_truth) {
+		for (int i = 0; i < 4; i++) {
+			p = StoreDouble(p, (*ground_truth)(i));
+		}
+	}
+	return p;
+}
+
+char *EncodeCompactMeasurement(char *out, DeltaState *delta, const MeasurementPackage &meas_package,
+                               const Eigen::Vector4d *ground_truth, bool quantize) {
+	const int sensor = meas_package.sensor_type_ == MeasurementPackage::LASER ? 0 : 1;
+	out[0] = char(kCompact | sensor);
+	out[1] = char((ground_truth ? kHasGroundTruth : 0) | (quantize ? kQuantized : 0));
+	char *p = StoreVarint(out + 2, meas_package.timestamp_ - delta->timestamp);
+	delta->timestamp = meas_package.timestamp_;
+	const int n_z = sensor == 0 ? 2 : 3;
+	for (int i = 0; i < n_z; i++) {
+		const double z = i < meas_package.raw_measurements_.size() ? meas_package.raw_measurements_(i) : 0.0;
+		if (quantize) {
+			const int64_t q = llround(z / kQuantum);
+			p = StoreVarint(p, q - delta->z[sensor][i]);
+			delta->z[sensor][i] = q;
+		}
+		else {
+			p = StoreDouble(p, z);
+		}
+	}
+	if (ground_truth) {
+		for (int i = 0; i < 4; i++) {
+			p = StoreDouble(p, (*ground_truth)(i));
+		}
+	}
+	return p;
+}
+
+char *EncodeEstimate(char *out, long long timestamp, double p_x, double p_y,
+                     const Eigen::Vector4d &rmse) {
+	char *p = StoreInt64(out, timestamp);
+	p = StoreDouble(p, p_x);
+	p = StoreDouble(p, p_y);
+	for (int i = 0; i < 4; i++) {
+		p = StoreDouble(p, rmse(i));
+	}
+	return p;
+}
+
+const char *DecodeEstimate(const char *begin, long long *timestamp, double *p_x, double *p_y,
+                           Eigen::Vector4d *rmse) {
+	int64_t t;
+	memcpy(&t, begin, sizeof(t));
+	*timestamp = t;
+	*p_x = LoadDouble(begin + 8);
+	*p_y = LoadDouble(begin + 16);
+	for (int i = 0; i < 4; i++) {
+		(*rmse)(i) = LoadDouble(begin + 24 + 8 * i);
+	}
+	return begin + kEstimateSize;
+}
+
+char *EncodeCompactEstimate(char *out, EstimateDeltaState *delta, long long timestamp, double p_x, double p_y,
+                            const Eigen::Vector4d &rmse) {
+	char *p = StoreVarint(out, timestamp - delta->timestamp);
+	delta->timestamp = timestamp;
+	const double values[6] = {p_x, p_y, rmse(0), rmse(1), rmse(2), rmse(3)};
+	for (int i = 0; i < 6; i++) {
+		const int64_t q = Quantize(values[i]);
+		p = StoreVarint(p, q - delta->values[i]);
+		delta->values[i] = q;
+	}
+	return p;
+}
+
+const char *DecodeCompactEstimate(const char *begin, const char *end, EstimateDeltaState *delta,
+                                  long long *timestamp, double *p_x, double *p_y, Eigen::Vector4d *rmse) {
+	int64_t step;
+	const char *p = LoadVarint(begin, end, &step);
+	if (!p) {
+		return nullptr;
+	}
+	delta->timestamp += step;
+	double values[6];
+	for (int i = 0; i < 6; i++) {
+		if (!(p = LoadVarint(p, end, &step))) {
+			return nullptr;
+		}
+		delta->values[i] += step;
+		values[i] = delta->values[i] * kQuantum;
+	}
+	*timestamp = delta->timestamp;
+	*p_x = values[0];
+	*p_y = values[1];
+	*rmse = Eigen::Map<const Eigen::Vector4d>(values + 2);
+	return p;
+}
+
+char *EncodeCompactState(char *out, StateDeltaState *delta, long long timestamp, const double *values) {
+	char *p = StoreVarint(out, timestamp - delta->timestamp);
+	delta->timestamp = timestamp;
+	for (int i = 0; i < kStateValues; i++) {
+		const int64_t q = Quantize(values[i]);
+		p = StoreVarint(p, q - delta->values[i]);
+		delta->values[i] = q;
+	}
+	return p;
+}
+
+const char *DecodeCompactState(const char *begin, const char *end, StateDeltaState *delta,
+                               long long *timestamp, double *values) {
+	int64_t step;
+	const char *p = LoadVarint(begin, end, &step);
+	if (!p) {
+		return nullptr;
+	}
+	delta->timestamp += step;
+	for (int i = 0; i < kStateValues; i++) {
+		if (!(p = LoadVarint(p, end, &step))) {
+			return nullptr;
+		}
+		delta->values[i] += step;
+		values[i] = delta->values[i] * kQuantum;
+	}
+	*timestamp = delta->timestamp;
+	return p;
+}
+
+}
@@ -0,0 +1,200 @@
+#ifndef MEASUREMENT_RECORD_H_
+#define MEASUREMENT_RECORD_H_
+
+#include "measurement_package.h"
+#include "Eigen/Dense"
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Binary wire format for machine clients, sent as WebSocket BINARY frames.
+ * All fields are little-endian; doubles are IEEE 754. A frame carries one or
+ * more measurement records back to back, and the server answers with one
+ * frame holding an estimate record for each of them.
+ *
+ * Measurement record, 40 bytes, or 72 with ground truth:
+ *    0  uint8   sensor       0 = laser, 1 = radar
+ *    1  uint8   flags        bit 0: ground truth follows
+ *    2  uint8   reserved[6]  zero
+ *    8  int64   timestamp    in us
+ *   16  double  z[3]         p_x, p_y (laser) or rho, phi, rho_dot (radar)
+ *   40  double  truth[4]     x, y, vx, vy; only with flags bit 0
+ *
+ * Compact measurement record, for frames of many records of a stream: the
+ * timestamp as the difference from the compact record before in the frame,
+ * and the values, if quantized to kQuantum, as the difference from the last
+ * quantized values of the same sensor in the frame, in zigzag varints (LEB128 of 2v or
+ * -2v - 1), 11 bytes for a lidar measurement 50 ms after the one before:
+ *    0  uint8   sensor       0x80 | 0 = laser, 0x80 | 1 = radar
+ *    1  uint8   flags        bit 0: ground truth follows, bit 1: z quantized
+ *    2  varint  timestamp    difference in us, from 0 for the first record
+ *       varint  z[n_z]       differences of round(z / kQuantum), or
+ *    or double  z[n_z]       without flags bit 1
+ *       double  truth[4]     only with flags bit 0
+ * Every frame starts from 0 again, so frames decode on their own; records
+ * of both kinds mix within one, and the others do not count as the record
+ * before.
+ *
+ * Estimate record, 56 bytes:
+ *    0  int64   timestamp    of the measurement it answers
+ *    8  double  estimate[2]  p_x, p_y
+ *   24  double  rmse[4]      cumulative RMSE of x, y, vx, vy
+ *
+ * Compact estimate record, for a connection that negotiated delta-encoded
+ * replies (see Session::OutputFormat): every field as the zigzag varint
+ * difference from the record before in the frame, the values quantized to
+ * kQuantum, 12 to 16 bytes for a track at 50 ms intervals:
+ *       varint  timestamp    difference in us, from 0 for the first record
+ *       varint  estimate[2]  differences of round(p / kQuantum)
+ *       varint  rmse[4]      differences of round(rmse / kQuantum)
+ * As with measurements, every frame starts from 0 again.
+ *
+ * Compact state record, for the recent history of a track (see
+ * track_history.h): as the compact estimate record, with the CTRV state and
+ * the diagonal of its covariance in place of the estimate and the RMSE:
+ *       varint  timestamp    difference in us
+ *       varint  x[5]         differences of round(x / kQuantum)
+ *       varint  P[5]         differences of round(P_ii / kQuantum)
+ */
+namespace record {
+
+const size_t kMeasurementSize = 40;
+const size_t kGroundTruthSize = 32;
+const size_t kEstimateSize = 56;
+
+const unsigned char kHasGroundTruth = 1;
+const unsigned char kQuantized = 2;
+const unsigned char kCompact = 0x80;
+
+///* the step of quantized values: 10 um, 10 urad or 10 um/s, far below
+///* the sensors' noise
+const double kQuantum = 1e-5;
+
+///* the longest compact record
+const size_t kMaxCompactSize = 2 + 10 + 3 * 10 + kGroundTruthSize;
+
+///* the longest compact estimate record
+const size_t kMaxCompactEstimateSize = 7 * 10;
+
+///* the values of a compact state record, and its longest length
+const int kStateValues = 10;
+const size_t kMaxCompactStateSize = (kStateValues + 1) * 10;
+
+/**
+ * What the compact records of a frame are differences from: the timestamp
+ * of the record before and the quantized values of each sensor's last.
+ * Zero at the start of every frame.
+ */
+struct DeltaState {
+  int64_t timestamp;
+  int64_t z[2][3];
+
+  DeltaState() { Reset(); }
+  void Reset();
+};
+
+/**
+ * What the compact estimate records of a frame are differences from: the
+ * timestamp and quantized values of the record before. Zero at the start
+ * of every frame.
+ */
+struct EstimateDeltaState {
+  int64_t timestamp;
+  int64_t values[6];
+
+  EstimateDeltaState() { Reset(); }
+  void Reset();
+};
+
+///* what compact state records are differences from, as EstimateDeltaState
+struct StateDeltaState {
+  int64_t timestamp;
+  int64_t values[kStateValues];
+
+  StateDeltaState() { Reset(); }
+  void Reset();
+};
+
+/**
+ * Decodes the measurement record at begin.
+ * @param has_ground_truth Set to whether the record carried ground truth,
+ * which is then written to ground_truth
+ * @param delta The state of the frame, for compact records; without it
+ * they are not valid
+ * @return One past the record, or nullptr if [begin, end) does not hold a
+ * complete, valid record
+ */
+const char *DecodeMeasurement(const char *begin, const char *end,
+                              MeasurementPackage *meas_package,
+                              Eigen::Vector4d *ground_truth,
+                              bool *has_ground_truth,
+                              DeltaState *delta = nullptr);
+
+/**
+ * Encodes a measurement record, with ground truth if it is not null.
+ * @return One past the written record
+ */
+char *EncodeMeasurement(char *out, const MeasurementPackage &meas_package,
+                        const Eigen::Vector4d *ground_truth);
+
+/**
+ * Encodes a compact measurement record following those encoded with delta,
+ * with ground truth if it is not null and the values quantized if quantize.
+ * @return One past the written record, at most kMaxCompactSize bytes
+ */
+char *EncodeCompactMeasurement(char *out, DeltaState *delta, const MeasurementPackage &meas_package,
+                               const Eigen::Vector4d *ground_truth, bool quantize);
+
+/**
+ * Encodes an estimate record.
+ * @return One past the written record
+ */
+char *EncodeEstimate(char *out, long long timestamp, double p_x, double p_y,
+                     const Eigen::Vector4d &rmse);
+
+/**
+ * Decodes the estimate record at begin, which holds kEstimateSize bytes.
+ * @return One past the record
+ */
+const char *DecodeEstimate(const char *begin, long long *timestamp, double *p_x, double *p_y,
+                           Eigen::Vector4d *rmse);
+
+/**
+ * Encodes a compact estimate record following those encoded with delta.
+ * Values beyond the range of the quantized ones, as of a diverged filter,
+ * are clamped to it.
+ * @return One past the written record, at most kMaxCompactEstimateSize
+ * bytes
+ */
+char *EncodeCompactEstimate(char *out, EstimateDeltaState *delta, long long timestamp, double p_x, double p_y,
+                            const Eigen::Vector4d &rmse);
+
+/**
+ * Decodes the compact estimate record at begin, following those decoded
+ * with delta.
+ * @return One past the record, or nullptr if [begin, end) does not hold a
+ * complete one
+ */
+const char *DecodeCompactEstimate(const char *begin, const char *end, EstimateDeltaState *delta,
+                                  long long *timestamp, double *p_x, double *p_y, Eigen::Vector4d *rmse);
+
+/**
+ * Encodes a compact state record of the kStateValues values, the state and
+ * the covariance's diagonal, following those encoded with delta; clamped as
+ * estimates are.
+ * @return One past the written record, at most kMaxCompactStateSize bytes
+ */
+char *EncodeCompactState(char *out, StateDeltaState *delta, long long timestamp, const double *values);
+
+/**
+ * Decodes the compact state record at begin into timestamp and the
+ * kStateValues values, following those decoded with delta.
+ * @return One past the record, or nullptr if [begin, end) does not hold a
+ * complete one
+ */
+const char *DecodeCompactState(const char *begin, const char *end, StateDeltaState *delta,
+                               long long *timestamp, double *values);
+
+}
+
+#endif /* MEASUREMENT_RECORD_H_ */
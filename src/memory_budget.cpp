@@ -0,0 +1,121 @@
+#include "memory_budget.h"
+#include "metrics.h"
+#include "udp_listener.h"
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <utility>
+#include <vector>
+
+std::atomic<long long> MemoryAccount::bytes_[MEMORY_CATEGORIES];
+size_t MemoryAccount::budget_ = 0;
+
+const double MemoryGovernor::kRecovery = 0.8;
+const int MemoryGovernor::kInterval;
+const int MemoryGovernor::kPatience;
+
+std::string MemoryAccount::Json(size_t queued_bytes) {
+	std::string json = "{\"sessions\":" + std::to_string(Bytes(MEMORY_SESSIONS))
+		+ ",\"histories\":" + std::to_string(Bytes(MEMORY_HISTORIES))
+		+ ",\"queued\":" + std::to_string(queued_bytes);
+	if (budget_) {
+		json += ",\"budget\":" + std::to_string(budget_);
+	}
+	return json + "}";
+}
+
+std::string MemoryAccount::OpenMetrics(size_t queued_bytes) {
+	char line[512];
+	snprintf(line, sizeof(line), "# TYPE ukf_memory_bytes gauge\n# HELP ukf_memory_bytes Memory held for the clients, by what holds it.\n"
+	         "ukf_memory_bytes{holder=\"sessions\"} %zu\nukf_memory_bytes{holder=\"histories\"} %zu\n"
+	         "ukf_memory_bytes{holder=\"queued\"} %zu\n",
+	         Bytes(MEMORY_SESSIONS), Bytes(MEMORY_HISTORIES), queued_bytes);
+	std::string text = line;
+	if (budget_) {
+		snprintf(line, sizeof(line), "# TYPE ukf_memory_budget_bytes gauge\n# HELP ukf_memory_budget_bytes The budget the memory for the clients is kept within.\n"
+		         "ukf_memory_budget_bytes %zu\n", budget_);
+		text += line;
+	}
+	return text;
+}
+
+MemoryGovernor::MemoryGovernor(uWS::Hub &h, uWS::HubPool *pool, SessionPool &sessions)
+	: hub_(&h), pool_(pool), sessions_(&sessions), udp_(nullptr), timer_(new uv_timer_t), drop_histories_(true), over_(0), disconnected_(0) {
+	uv_timer_init(h.getLoop(), timer_);
+	timer_->data = this;
+	uv_timer_start(timer_, [](uv_timer_t *timer) {
+		static_cast<MemoryGovernor *>(timer->data)->Enforce();
+	}, kInterval, kInterval);
+}
+
+MemoryGovernor::~MemoryGovernor() {
+	uv_timer_stop(timer_);
+	uv_close(timer_, [](uv_handle_t *handle) {
+		delete (uv_timer_t *) handle;
+	});
+}
+
+size_t MemoryGovernor::Used() const {
+	size_t queued = 0;
+	if (pool_) {
+		std::vector<uS::LoopStats> loops = pool_->getLoopStats();
+		for (size_t i = 0; i < loops.size(); i++) {
+			queued += loops[i].queuedBytes;
+		}
+	}
+	else {
+		queued = hub_->getLoopStats().queuedBytes;
+	}
+	return MemoryAccount::Bytes(MEMORY_SESSIONS) + MemoryAccount::Bytes(MEMORY_HISTORIES) + queued;
+}
+
+void MemoryGovernor::Enforce() {
+	const size_t budget = MemoryAccount::budget();
+	size_t used = Used();
+	if (used <= budget) {
+		over_ = 0;
+		if (sessions_->histories_shed() && used < budget * kRecovery) {
+			sessions_->KeepHistories();
+		}
+		return;
+	}
+
+	if (drop_histories_ && !sessions_->histories_shed()) {
+		sessions_->ShedHistories();
+		Metrics::Local().Add(METRIC_MEMORY_HISTORIES_DROPPED);
+		std::cerr << "Memory over budget, dropping the sessions' histories" << std::endl;
+		used = Used();
+	}
+	if (udp_ && udp_->Demote(kInterval)) {
+		used = Used();
+	}
+	if (used <= budget || ++over_ < kPatience) {
+		return;
+	}
+	const int loops = pool_ ? pool_->getWorkers() : 1;
+	Disconnect((used - budget + loops - 1) / loops);
+}
+
+void MemoryGovernor::Disconnect(size_t bytes) {
+	// a socket cannot leave the group while it is being walked, so those to
+	// close are picked first
+	std::vector<std::pair<size_t, uWS::WebSocket<uWS::SERVER> > > clients;
+	hub_->getDefaultGroup<uWS::SERVER>().forEach([&clients](uWS::WebSocket<uWS::SERVER> ws) {
+		Session *session = static_cast<Session *>(ws.getUserData());
+		clients.push_back(std::make_pair(ws.getBufferedAmount() + (session ? session->memory() : 0), ws));
+	});
+	std::sort(clients.begin(), clients.end(), [](const std::pair<size_t, uWS::WebSocket<uWS::SERVER> > &a,
+	                                             const std::pair<size_t, uWS::WebSocket<uWS::SERVER> > &b) {
+		return a.first > b.first;
+	});
+	size_t freed = 0;
+	for (size_t i = 0; i < clients.size() && (!i || freed < bytes); i++) {
+		freed += clients[i].first;
+		clients[i].second.terminate();
+		disconnected_++;
+		Metrics::Local().Add(METRIC_MEMORY_DISCONNECTED);
+	}
+	if (!clients.empty()) {
+		std::cerr << "Memory over budget, disconnected clients holding " << freed << " bytes" << std::endl;
+	}
+}
@@ -0,0 +1,138 @@
+#ifndef MEMORY_BUDGET_H_
+#define MEMORY_BUDGET_H_
+
+#include <uWS/uWS.h>
+#include "session.h"
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+class UdpListener;
+
+/**
+ * The memory that grows with the clients, by what holds it; the bytes
+ * queued on sockets are counted by their loops (see uS::LoopStats).
+ */
+enum MemoryCategory {
+  ///* the sessions in use; released ones wait in their pool for reuse
+  MEMORY_SESSIONS,
+  ///* the MeasurementHistory and ReorderBuffer of sessions
+  MEMORY_HISTORIES,
+  MEMORY_CATEGORIES
+};
+
+/**
+ * The process's count of the bytes of each MemoryCategory, added to where
+ * they are taken and given back, which is seldom: as a pool hands out or
+ * takes back a session, and as a session's reordering is set up or
+ * dropped.
+ */
+class MemoryAccount {
+public:
+  ///* bytes allocated, or freed if negative
+  static void Add(MemoryCategory category, long long bytes) {
+    bytes_[category].fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  static size_t Bytes(MemoryCategory category) {
+    const long long bytes = bytes_[category].load(std::memory_order_relaxed);
+    return bytes > 0 ? (size_t) bytes : 0;
+  }
+
+  ///* the budget of the MemoryGovernors, 0 for none; set before they run
+  static void set_budget(size_t budget) { budget_ = budget; }
+  static size_t budget() { return budget_; }
+
+  ///* the categories and queued_bytes of the sockets as a JSON object
+  static std::string Json(size_t queued_bytes);
+
+  ///* the same as OpenMetrics gauges, and the budget unless there is none
+  static std::string OpenMetrics(size_t queued_bytes);
+
+private:
+  static std::atomic<long long> bytes_[MEMORY_CATEGORIES];
+  static size_t budget_;
+};
+
+/**
+ * Keeps the memory of the clients within MemoryAccount::budget, so that
+ * a flood of connections or slow readers costs some of them their service
+ * rather than the process being killed for running out. The bytes counted are
+ * those of MemoryAccount and the queues of the sockets of all loops; the
+ * rest of the process, its buffers and code, is about constant and left
+ * to the headroom between the budget and the limit.
+ *
+ * Every kInterval a timer on the loop compares them with the budget. Over
+ * it, the loop in turn
+ *   - drops the histories of its sessions (see Session::set_reorder_depth)
+ *     and has the pool hand out and take back sessions without one, so
+ *     late measurements are dropped instead of filtered at their place,
+ *     until the count is back under kRecovery of the budget
+ *   - demotes the tracks of its UDP sensors quiet for a kInterval (see
+ *     UdpListener::Demote), whose sessions go back to the pool
+ *   - if still over after kPatience intervals, disconnects the clients
+ *     holding the most, by bytes queued for them and their session's
+ *     memory, until its share of the excess is freed
+ * Each loop frees only what it holds, a share of the excess as large as
+ * its share of the workers.
+ *
+ * The sessions released stay in their pool's arena for the next clients,
+ * so that the budget bounds the arena's growth rather than shrinking it.
+ * A governor belongs to the loop's thread and must be created there.
+ */
+class MemoryGovernor {
+public:
+  ///* how often the loop checks, in ms
+  static const int kInterval = 250;
+
+  ///* intervals over the budget before clients are disconnected
+  static const int kPatience = 2;
+
+  ///* share of the budget under which sessions have histories again
+  static const double kRecovery;
+
+  /**
+   * @param pool The HubPool of h, for the queues of all its loops, or null
+   * if h is the only loop
+   */
+  MemoryGovernor(uWS::Hub &h, uWS::HubPool *pool, SessionPool &sessions);
+
+  ///* stops the timer
+  ~MemoryGovernor();
+
+  ///* the sensors demoted under pressure, or none; of the loop
+  void set_udp(UdpListener *udp) { udp_ = udp; }
+
+  ///* whether histories may be dropped: not while a Pipeline's threads
+  ///* filter the sessions
+  void set_drop_histories(bool drop) { drop_histories_ = drop; }
+
+  ///* the bytes counted against the budget, of the whole process
+  size_t Used() const;
+
+  ///* frees memory as above if the count is over the budget
+  void Enforce();
+
+  ///* clients disconnected for the budget
+  long long disconnected() const { return disconnected_; }
+
+private:
+  uWS::Hub *hub_;
+  uWS::HubPool *pool_;
+  SessionPool *sessions_;
+  UdpListener *udp_;
+  uv_timer_t *timer_;
+  bool drop_histories_;
+  ///* intervals over the budget in a row
+  int over_;
+  long long disconnected_;
+
+  ///* disconnects the clients of the loop holding the most until bytes are
+  ///* freed, at least one
+  void Disconnect(size_t bytes);
+
+  MemoryGovernor(const MemoryGovernor &);
+  MemoryGovernor &operator=(const MemoryGovernor &);
+};
+
+#endif /* MEMORY_BUDGET_H_ */
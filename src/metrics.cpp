@@ -0,0 +1,209 @@
+#include "metrics.h"
+#include "json.hpp"
+#include <cmath>
+#include <map>
+#include <stdio.h>
+#include <utility>
+
+// for convenience
+using json = nlohmann::json;
+
+const int Metrics::kNISBuckets;
+const double Metrics::kNISBounds[kNISBuckets - 1] = {0.103, 0.352, 0.711, 1.0, 2.0, 4.0, 5.991, 7.815, 12.0};
+
+std::atomic<Metrics *> Metrics::head_(nullptr);
+
+namespace {
+
+const char *kSensors[] = {"laser", "radar"};
+const char *kErrorComponents[] = {"p_x", "p_y", "v_x", "v_y"};
+
+}
+
+struct Metrics::Totals {
+	uint64_t nis_buckets[2][Metrics::kNISBuckets];
+	double nis_sum[2];
+	double squared_error[4];
+	uint64_t errors;
+	std::map<int, std::pair<uint64_t, uint64_t> > shards;
+
+	double RMSE(int component) const { return errors ? std::sqrt(squared_error[component] / errors) : 0.0; }
+};
+
+Metrics::Metrics() : allocations_(0), errors_(0), shard_(-1), next_(nullptr) {
+	for (int i = 0; i < METRIC_COUNTERS; i++) {
+		counters_[i].store(0, std::memory_order_relaxed);
+	}
+	for (int sensor = 0; sensor < 2; sensor++) {
+		for (int bucket = 0; bucket < kNISBuckets; bucket++) {
+			nis_buckets_[sensor][bucket].store(0, std::memory_order_relaxed);
+		}
+		nis_sum_[sensor].store(0.0, std::memory_order_relaxed);
+	}
+	for (int i = 0; i < 4; i++) {
+		squared_error_[i].store(0.0, std::memory_order_relaxed);
+	}
+}
+
+Metrics *Metrics::Register() {
+	Metrics *metrics = new Metrics();
+	metrics->next_ = head_.load(std::memory_order_relaxed);
+	while (!head_.compare_exchange_weak(metrics->next_, metrics, std::memory_order_release, std::memory_order_relaxed));
+	return metrics;
+}
+
+void Metrics::Sum(Totals *totals) {
+	for (Metrics *metrics = head_.load(std::memory_order_acquire); metrics; metrics = metrics->next_) {
+		for (int sensor = 0; sensor < 2; sensor++) {
+			for (int bucket = 0; bucket < kNISBuckets; bucket++) {
+				totals->nis_buckets[sensor][bucket] += metrics->nis_buckets_[sensor][bucket].load(std::memory_order_relaxed);
+			}
+			totals->nis_sum[sensor] += metrics->nis_sum_[sensor].load(std::memory_order_relaxed);
+		}
+		for (int i = 0; i < 4; i++) {
+			totals->squared_error[i] += metrics->squared_error_[i].load(std::memory_order_relaxed);
+		}
+		totals->errors += metrics->errors_.load(std::memory_order_relaxed);
+		const int shard = metrics->shard();
+		if (shard >= 0) {
+			std::pair<uint64_t, uint64_t> &measurements = totals->shards[shard];
+			measurements.first += metrics->counters_[METRIC_MEASUREMENTS_LASER].load(std::memory_order_relaxed);
+			measurements.second += metrics->counters_[METRIC_MEASUREMENTS_RADAR].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+std::string Metrics::Json() {
+	Totals totals = Totals();
+	Sum(&totals);
+	json nis;
+	for (int sensor = 0; sensor < 2; sensor++) {
+		uint64_t count = 0;
+		json buckets = json::array();
+		for (int bucket = 0; bucket < kNISBuckets; bucket++) {
+			count += totals.nis_buckets[sensor][bucket];
+			buckets.push_back(totals.nis_buckets[sensor][bucket]);
+		}
+		json histogram;
+		histogram["count"] = count;
+		histogram["mean"] = count ? totals.nis_sum[sensor] / count : 0.0;
+		histogram["buckets"] = buckets;
+		nis[kSensors[sensor]] = histogram;
+	}
+	nis["bounds"] = std::vector<double>(kNISBounds, kNISBounds + kNISBuckets - 1);
+	json rmse;
+	for (int i = 0; i < 4; i++) {
+		rmse[kErrorComponents[i]] = totals.RMSE(i);
+	}
+	rmse["count"] = totals.errors;
+	json shards = json::array();
+	for (std::map<int, std::pair<uint64_t, uint64_t> >::const_iterator it = totals.shards.begin(); it != totals.shards.end(); ++it) {
+		json shard;
+		shard["shard"] = it->first;
+		shard["laser"] = it->second.first;
+		shard["radar"] = it->second.second;
+		shards.push_back(shard);
+	}
+	json metrics;
+	metrics["nis"] = nis;
+	metrics["rmse"] = rmse;
+	metrics["shards"] = shards;
+	return metrics.dump();
+}
+
+std::string Metrics::OpenMetrics() {
+	uint64_t counters[METRIC_COUNTERS] = {};
+	long long allocations = 0;
+	for (Metrics *metrics = head_.load(std::memory_order_acquire); metrics; metrics = metrics->next_) {
+		for (int i = 0; i < METRIC_COUNTERS; i++) {
+			counters[i] += metrics->counters_[i].load(std::memory_order_relaxed);
+		}
+		allocations += metrics->allocations_.load(std::memory_order_relaxed);
+	}
+	Totals totals = Totals();
+	Sum(&totals);
+
+	struct Family {
+		const char *name, *help, *label;
+		MetricCounter first, second;
+	};
+	static const Family families[] = {
+		{"ukf_measurements", "Measurements taken by the filters.", "sensor", METRIC_MEASUREMENTS_LASER, METRIC_MEASUREMENTS_RADAR},
+		{"ukf_nis", "NIS values of the updates.", "sensor", METRIC_NIS_LASER, METRIC_NIS_RADAR},
+		{"ukf_nis_within", "NIS values within the 95% chi-square bounds.", "sensor", METRIC_NIS_LASER_WITHIN, METRIC_NIS_RADAR_WITHIN},
+		{"ukf_shed", "Measurements skipped under overload.", "reason", METRIC_SHED_REDUNDANT, METRIC_SHED_LOW_INFORMATION},
+		{"ukf_reorder_budget_exceeded", "Measurements the reorder buffer could not hold to its budget.", "reason",
+		 METRIC_REORDER_LATE, METRIC_REORDER_OVERFLOW},
+		{"ukf_track_tier_changes", "Tracks of quiet sensors saved compactly and taken up again.", "direction",
+		 METRIC_TRACKS_DEMOTED, METRIC_TRACKS_PROMOTED},
+		{"ukf_track_handoffs", "Tracks handed to another loop or node, and taken over from one.", "direction",
+		 METRIC_HANDOFFS_OUT, METRIC_HANDOFFS_IN},
+		{"ukf_relay_updates", "Estimates relayed to the aggregator, and dropped from a full queue.", "outcome",
+		 METRIC_RELAY_SENT, METRIC_RELAY_DROPPED},
+		{"ukf_radar_updates", "Radar updates by the way the measurement was predicted.", "path",
+		 METRIC_RADAR_UNSCENTED, METRIC_RADAR_LINEARIZED},
+		{"ukf_rate_limited", "Client messages past the rate limit, by the limit.", "limit",
+		 METRIC_RATE_LIMITED_MESSAGES, METRIC_RATE_LIMITED_BYTES},
+		{"ukf_memory_evictions", "What was given up over the memory budget: the histories of a loop, and clients.", "evicted",
+		 METRIC_MEMORY_HISTORIES_DROPPED, METRIC_MEMORY_DISCONNECTED},
+		{"ukf_session_resumptions", "Tracks kept for clients that disconnected with a token, by what became of them.", "outcome",
+		 METRIC_SESSIONS_RESUMED, METRIC_SESSIONS_EXPIRED},
+		{"ukf_geofence_events", "Tracks entering and leaving the zones of --geofence.", "event",
+		 METRIC_GEOFENCE_ENTERED, METRIC_GEOFENCE_LEFT},
+	};
+	static const char *values[][2] = {
+		{"laser", "radar"}, {"laser", "radar"}, {"laser", "radar"}, {"redundant", "low_information"}, {"late", "full"},
+		{"demoted", "promoted"}, {"out", "in"}, {"sent", "dropped"},
+		{"unscented", "linearized"}, {"messages", "bytes"}, {"histories", "clients"},
+		{"resumed", "expired"}, {"enter", "exit"}
+	};
+
+	std::string text;
+	char line[1024];
+	for (size_t i = 0; i < sizeof(families) / sizeof(families[0]); i++) {
+		const Family &family = families[i];
+		snprintf(line, sizeof(line), "# TYPE %s counter\n# HELP %s %s\n%s_total{%s=\"%s\"} %llu\n%s_total{%s=\"%s\"} %llu\n",
+		         family.name, family.name, family.help,
+		         family.name, family.label, values[i][0], (unsigned long long) counters[family.first],
+		         family.name, family.label, values[i][1], (unsigned long long) counters[family.second]);
+		text += line;
+	}
+	snprintf(line, sizeof(line), "# TYPE ukf_too_late counter\n# HELP ukf_too_late Measurements too late to reorder.\nukf_too_late_total %llu\n"
+	         "# TYPE ukf_reinitialized counter\n# HELP ukf_reinitialized Filters found diverged and started again.\nukf_reinitialized_total %llu\n"
+	         "# TYPE ukf_duplicates counter\n# HELP ukf_duplicates Measurements dropped as received before.\nukf_duplicates_total %llu\n"
+	         "# TYPE ukf_shed_mean_only counter\n# HELP ukf_shed_mean_only Measurements skipped between the updates of mean-only tracks.\nukf_shed_mean_only_total %llu\n"
+	         "# TYPE ukf_allocations counter\n# HELP ukf_allocations Heap allocations of the threads processing measurements.\nukf_allocations_total %lld\n",
+	         (unsigned long long) counters[METRIC_TOO_LATE], (unsigned long long) counters[METRIC_REINITIALIZED],
+	         (unsigned long long) counters[METRIC_DUPLICATES], (unsigned long long) counters[METRIC_SHED_MEAN_ONLY], allocations);
+	text += line;
+
+	text += "# TYPE ukf_nis_value histogram\n# HELP ukf_nis_value NIS values of the updates, by sensor.\n";
+	for (int sensor = 0; sensor < 2; sensor++) {
+		uint64_t below = 0;
+		for (int bucket = 0; bucket < kNISBuckets - 1; bucket++) {
+			below += totals.nis_buckets[sensor][bucket];
+			snprintf(line, sizeof(line), "ukf_nis_value_bucket{sensor=\"%s\",le=\"%g\"} %llu\n",
+			         kSensors[sensor], kNISBounds[bucket], (unsigned long long) below);
+			text += line;
+		}
+		below += totals.nis_buckets[sensor][kNISBuckets - 1];
+		snprintf(line, sizeof(line), "ukf_nis_value_bucket{sensor=\"%s\",le=\"+Inf\"} %llu\n"
+		         "ukf_nis_value_count{sensor=\"%s\"} %llu\nukf_nis_value_sum{sensor=\"%s\"} %.9g\n",
+		         kSensors[sensor], (unsigned long long) below, kSensors[sensor], (unsigned long long) below,
+		         kSensors[sensor], totals.nis_sum[sensor]);
+		text += line;
+	}
+	text += "# TYPE ukf_rmse gauge\n# HELP ukf_rmse RMSE of the estimates against the ground truth sent, over all tracks.\n";
+	for (int i = 0; i < 4; i++) {
+		snprintf(line, sizeof(line), "ukf_rmse{component=\"%s\"} %.9g\n", kErrorComponents[i], totals.RMSE(i));
+		text += line;
+	}
+	text += "# TYPE ukf_shard_measurements counter\n# HELP ukf_shard_measurements Measurements taken by the filters, by loop.\n";
+	for (std::map<int, std::pair<uint64_t, uint64_t> >::const_iterator it = totals.shards.begin(); it != totals.shards.end(); ++it) {
+		snprintf(line, sizeof(line), "ukf_shard_measurements_total{shard=\"%d\",sensor=\"laser\"} %llu\n"
+		         "ukf_shard_measurements_total{shard=\"%d\",sensor=\"radar\"} %llu\n",
+		         it->first, (unsigned long long) it->second.first, it->first, (unsigned long long) it->second.second);
+		text += line;
+	}
+	return text;
+}
@@ -0,0 +1,167 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "cache_aligned.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * The counters of the measurements sessions process, exported as
+ * ukf_<name>_total.
+ */
+enum MetricCounter {
+  ///* measurements taken, by sensor
+  METRIC_MEASUREMENTS_LASER,
+  METRIC_MEASUREMENTS_RADAR,
+  ///* NIS values, and of those the ones within the 95% bounds
+  METRIC_NIS_LASER,
+  METRIC_NIS_LASER_WITHIN,
+  METRIC_NIS_RADAR,
+  METRIC_NIS_RADAR_WITHIN,
+  ///* skipped under overload, see LoadShedder
+  METRIC_SHED_REDUNDANT,
+  METRIC_SHED_LOW_INFORMATION,
+  ///* too late to reorder, see MeasurementHistory
+  METRIC_TOO_LATE,
+  ///* past the budget of a ReorderBuffer: dropped as late, and released
+  ///* early from a full buffer
+  METRIC_REORDER_LATE,
+  METRIC_REORDER_OVERFLOW,
+  ///* tracks of quiet sensors saved compactly, and taken up again, see
+  ///* UdpListener
+  METRIC_TRACKS_DEMOTED,
+  METRIC_TRACKS_PROMOTED,
+  ///* tracks frozen for a handoff to another loop or node, and thawed
+  ///* from one, see Session::Freeze
+  METRIC_HANDOFFS_OUT,
+  METRIC_HANDOFFS_IN,
+  ///* estimates forwarded to an aggregator, and dropped while it could
+  ///* not take them, see TrackRelay
+  METRIC_RELAY_SENT,
+  METRIC_RELAY_DROPPED,
+  ///* radar updates through the sigma points, and through the Jacobian
+  ///* while the covariance is small, see UKFConfig::linearize_radar_
+  METRIC_RADAR_UNSCENTED,
+  METRIC_RADAR_LINEARIZED,
+  ///* client messages past the connection's limit on messages or bytes a
+  ///* second, see --rate-limit
+  METRIC_RATE_LIMITED_MESSAGES,
+  METRIC_RATE_LIMITED_BYTES,
+  ///* filters found diverged and started again, see UKF::reinitialized_
+  METRIC_REINITIALIZED,
+  ///* loops that dropped their sessions' histories, and clients
+  ///* disconnected, over the memory budget, see MemoryGovernor
+  METRIC_MEMORY_HISTORIES_DROPPED,
+  METRIC_MEMORY_DISCONNECTED,
+  ///* tracks a client reconnecting with its session token went on with,
+  ///* and those it came back for too late, see SessionResumption
+  METRIC_SESSIONS_RESUMED,
+  METRIC_SESSIONS_EXPIRED,
+  ///* tracks that entered and left a zone of the geofence, see Geofence
+  METRIC_GEOFENCE_ENTERED,
+  METRIC_GEOFENCE_LEFT,
+  ///* measurements dropped as one just seen, see DuplicateFilter
+  METRIC_DUPLICATES,
+  ///* measurements skipped as too soon after the last update of a
+  ///* session of QoS tier mean-only, see Session::QosTier
+  METRIC_SHED_MEAN_ONLY,
+  METRIC_COUNTERS
+};
+
+/**
+ * The counters of one thread, always on, in the manner of LatencyStats:
+ * every thread that counts gets its own the first time, on a cache line of
+ * its own and kept for the life of the process. Only its thread writes
+ * them, with relaxed loads and stores; a scrape sums those of all threads,
+ * so it takes no lock and the counting threads never wait for it.
+ *
+ * Besides the counters a thread keeps the NIS values of its updates in a
+ * histogram per sensor, and the squared errors of the estimates against
+ * the ground truth clients send, from which a scrape takes the RMSE over
+ * all tracks. A thread that serves a loop's sessions is given the loop's
+ * index as its shard, and the measurements are also exported by shard.
+ */
+class alignas(kCacheLineSize) Metrics {
+public:
+  CACHE_ALIGNED_OPERATOR_NEW
+
+  static Metrics &Local() {
+    static thread_local Metrics *local = Register();
+    return *local;
+  }
+
+  void Add(MetricCounter counter, uint64_t n = 1) {
+    counters_[counter].store(counters_[counter].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  /**
+   * Records the thread's count of heap allocations so far, from
+   * AllocationCounter::Count (zero unless built with UKF_CHECK_ALLOCATIONS).
+   */
+  void SetAllocations(long count) { allocations_.store(count, std::memory_order_relaxed); }
+
+  ///* upper bounds of the NIS buckets but the last, which has the rest:
+  ///* the 5% and 95% chi-square quantiles of 2 (laser) and 3 (radar)
+  ///* degrees of freedom among others
+  static const int kNISBuckets = 10;
+  static const double kNISBounds[kNISBuckets - 1];
+
+  void RecordNIS(bool radar, double nis) {
+    int bucket = 0;
+    while (bucket < kNISBuckets - 1 && nis > kNISBounds[bucket]) {
+      bucket++;
+    }
+    Increase(nis_buckets_[radar][bucket], uint64_t(1));
+    Increase(nis_sum_[radar], nis);
+  }
+
+  ///* the error of an estimate of p_x, p_y, v_x and v_y against the truth
+  void RecordError(const double *estimate, const double *truth) {
+    for (int i = 0; i < 4; i++) {
+      Increase(squared_error_[i], (estimate[i] - truth[i]) * (estimate[i] - truth[i]));
+    }
+    Increase(errors_, uint64_t(1));
+  }
+
+  ///* the loop whose sessions the thread processes, -1 for none
+  int shard() const { return shard_.load(std::memory_order_relaxed); }
+  void set_shard(int shard) { shard_.store(shard, std::memory_order_relaxed); }
+
+  /**
+   * The counters summed over all threads in the OpenMetrics text format,
+   * without the closing # EOF, for a scrape to add other families to.
+   */
+  static std::string OpenMetrics();
+
+  ///* the NIS histograms, RMSE and shards summed over all threads, as JSON
+  static std::string Json();
+
+private:
+  std::atomic<uint64_t> counters_[METRIC_COUNTERS];
+  std::atomic<long> allocations_;
+  std::atomic<uint64_t> nis_buckets_[2][kNISBuckets];
+  std::atomic<double> nis_sum_[2];
+  std::atomic<double> squared_error_[4];
+  std::atomic<uint64_t> errors_;
+  std::atomic<int> shard_;
+  Metrics *next_;
+
+  static std::atomic<Metrics *> head_;
+  static Metrics *Register();
+  ///* the NIS histograms, errors and measurements by shard of all threads
+  struct Totals;
+  static void Sum(Totals *totals);
+
+  ///* only ever written by the thread, so without a read-modify-write
+  template <class T>
+  static void Increase(std::atomic<T> &value, T n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  Metrics();
+  Metrics(const Metrics &);
+  Metrics &operator=(const Metrics &);
+};
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,33 @@
+#ifndef MOTION_MODELS_H_
+#define MOTION_MODELS_H_
+
+/**
+ * Process models of the IMM filter (see imm.h), all on the state
+ * (p_x, p_y, v, yaw, yawd, a) and propagated by PropagateCTRA. A model is
+ * the part of that state it lets change: components it leaves out are
+ * carried through and ignored, so that mixing the models needs no
+ * conversion between state spaces.
+ */
+
+///* straight line at constant speed: yaw, yaw rate and acceleration held
+struct ConstantVelocity {
+  static const bool kTurns = false;
+  static const bool kAccelerates = false;
+  static const char *Name() { return "CV"; }
+};
+
+///* constant turn rate and velocity, the model of UKF
+struct ConstantTurnRateVelocity {
+  static const bool kTurns = true;
+  static const bool kAccelerates = false;
+  static const char *Name() { return "CTRV"; }
+};
+
+///* constant turn rate and acceleration
+struct ConstantTurnRateAcceleration {
+  static const bool kTurns = true;
+  static const bool kAccelerates = true;
+  static const char *Name() { return "CTRA"; }
+};
+
+#endif /* MOTION_MODELS_H_ */
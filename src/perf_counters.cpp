@@ -0,0 +1,133 @@
+#include "perf_counters.h"
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char *const kNames[PerfCounters::EVENTS] = {
+	"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+#ifdef __linux__
+///* the perf_event_attr type and config of each Event
+void EventConfig(int event, perf_event_attr *attr) {
+	const uint64_t kReadMiss = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+	switch (event) {
+	case PerfCounters::CYCLES:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case PerfCounters::INSTRUCTIONS:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case PerfCounters::L1D_MISSES:
+		attr->type = PERF_TYPE_HW_CACHE;
+		attr->config = PERF_COUNT_HW_CACHE_L1D | kReadMiss;
+		break;
+	case PerfCounters::LLC_MISSES:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	default:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+		break;
+	}
+}
+#endif
+
+}
+
+PerfCounters::PerfCounters() {
+	for (int i = 0; i < EVENTS; i++) {
+		fds_[i] = -1;
+	}
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+	for (int i = 0; i < EVENTS; i++) {
+		if (fds_[i] >= 0) {
+			close(fds_[i]);
+		}
+	}
+#endif
+}
+
+bool PerfCounters::Open() {
+	bool any = false;
+#ifdef __linux__
+	for (int i = 0; i < EVENTS; i++) {
+		if (fds_[i] >= 0) {
+			any = true;
+			continue;
+		}
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		EventConfig(i, &attr);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		// each event on its own, so that one the PMU lacks leaves the others
+		fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		any = any || fds_[i] >= 0;
+	}
+#endif
+	return any;
+}
+
+void PerfCounters::Start() {
+#ifdef __linux__
+	for (int i = 0; i < EVENTS; i++) {
+		if (fds_[i] >= 0) {
+			ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+}
+
+void PerfCounters::Stop() {
+#ifdef __linux__
+	for (int i = 0; i < EVENTS; i++) {
+		if (fds_[i] >= 0) {
+			ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+#endif
+}
+
+uint64_t PerfCounters::Read(Event event) const {
+#ifdef __linux__
+	// value, time enabled, time running
+	uint64_t values[3];
+	if (fds_[event] < 0 || read(fds_[event], values, sizeof(values)) != sizeof(values)) {
+		return 0;
+	}
+	if (values[2] && values[2] < values[1]) {
+		return uint64_t(double(values[0]) * values[1] / values[2]);
+	}
+	return values[2] ? values[0] : 0;
+#else
+	(void) event;
+	return 0;
+#endif
+}
+
+double PerfCounters::IPC() const {
+	const uint64_t cycles = Read(CYCLES);
+	return cycles ? double(Read(INSTRUCTIONS)) / cycles : 0.0;
+}
+
+const char *PerfCounters::Name(Event event) {
+	return kNames[event];
+}
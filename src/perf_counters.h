@@ -0,0 +1,64 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <stdint.h>
+
+/**
+ * Hardware performance counters of the calling thread, for the benchmarks
+ * and replays to report what a change does to the caches and the pipeline
+ * and not only to the wall time.
+ *
+ * The counters are Linux perf events, counted in user space only; each one
+ * the kernel refuses (no PMU in a virtual machine, perf_event_paranoid
+ * above 2, another system) stays unavailable and the others still count.
+ * Elsewhere than on Linux none are.
+ */
+class PerfCounters {
+public:
+  enum Event {
+    CYCLES,
+    INSTRUCTIONS,
+    ///* L1 data cache read misses
+    L1D_MISSES,
+    ///* last-level cache misses
+    LLC_MISSES,
+    BRANCH_MISSES,
+    EVENTS
+  };
+
+  PerfCounters();
+  ~PerfCounters();
+
+  /**
+   * Opens the counters, stopped at zero.
+   * @return whether any of them is available
+   */
+  bool Open();
+
+  ///* zeroes and starts the counters
+  void Start();
+  ///* stops them, keeping the counts
+  void Stop();
+
+  bool available(Event event) const { return fds_[event] >= 0; }
+
+  /**
+   * The count of event since Start, also while running; 0 if unavailable.
+   * Counts the kernel had to multiplex are scaled to the whole time.
+   */
+  uint64_t Read(Event event) const;
+
+  ///* instructions per cycle, 0 without both counts
+  double IPC() const;
+
+  ///* the events' names, e.g. "l1d_misses"
+  static const char *Name(Event event);
+
+private:
+  int fds_[EVENTS];
+
+  PerfCounters(const PerfCounters &);
+  PerfCounters &operator=(const PerfCounters &);
+};
+
+#endif /* PERF_COUNTERS_H_ */
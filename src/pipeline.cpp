@@ -0,0 +1,314 @@
+#include "pipeline.h"
+#include "latency.h"
+#include "measurement_parser.h"
+#include "measurement_record.h"
+#include "metrics.h"
+#include <cstring>
+#include <functional>
+
+const size_t Pipeline::kJobs;
+const int Pipeline::kSpins;
+
+void Pipeline::Doorbell::Ring() {
+	// pairs with the fence in Wait: either the producer sees the consumer
+	// waiting or the consumer sees what was pushed
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiting.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(mutex);
+		rung.notify_one();
+	}
+}
+
+template <class Ready>
+void Pipeline::Doorbell::Wait(const Ready &ready) {
+	for (int i = 0; i < kSpins; i++) {
+		if (ready()) {
+			return;
+		}
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	waiting.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	rung.wait(lock, ready);
+	waiting.store(false, std::memory_order_relaxed);
+}
+
+Pipeline::Pipeline(uWS::Hub &h, SessionPool &sessions, int filter_workers)
+	: hub_(&h), sessions_(&sessions), shard_(Metrics::Local().shard()), jobs_(new Job[kJobs]), done_(kJobs), stop_(false), posted_(false),
+	  next_worker_(0) {
+	h.addMailbox();
+	free_.reserve(kJobs);
+	for (size_t i = 0; i < kJobs; i++) {
+		jobs_[i].count = 0;
+		free_.push_back(&jobs_[i]);
+	}
+	for (int i = 0; i < filter_workers; i++) {
+		workers_.emplace_back(new Worker());
+	}
+	for (size_t i = 0; i < workers_.size(); i++) {
+		workers_[i]->thread = std::thread(&Pipeline::Filter, this, std::ref(*workers_[i]));
+	}
+	serializer_ = std::thread(&Pipeline::Serialize, this);
+}
+
+Pipeline::~Pipeline() {
+	stop_.store(true);
+	for (size_t i = 0; i < workers_.size(); i++) {
+		workers_[i]->doorbell.Ring();
+		workers_[i]->thread.join();
+	}
+	serializer_doorbell_.Ring();
+	serializer_.join();
+}
+
+void Pipeline::Submit(Session *session, uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
+                      uWS::OpCode opCode) {
+	uint64_t start = LatencyStats::Now();
+	// all jobs in flight: the loop answers what is done until one is back
+	while (free_.empty()) {
+		if (!Complete()) {
+			std::this_thread::yield();
+		}
+	}
+	Job *job = free_.back();
+
+	Eigen::Vector4d ground_truth;
+	bool has_ground_truth = true;
+	job->count = 0;
+	job->lines = false;
+	if (opCode == uWS::OpCode::BINARY) {
+		const char *p = data;
+		const char *end = data + length;
+		record::DeltaState delta;
+		while (p != end) {
+			if (job->measurements.size() == job->count) {
+				job->measurements.resize(job->count + 1);
+			}
+			Measurement &m = job->measurements[job->count];
+			if (!(p = record::DecodeMeasurement(p, end, &m.package, &ground_truth, &has_ground_truth, &delta))) {
+				break;
+			}
+			Eigen::Map<Eigen::Vector4d>(m.ground_truth) = ground_truth;
+			m.has_ground_truth = has_ground_truth;
+			job->count++;
+		}
+	}
+	else {
+		if (job->measurements.empty()) {
+			job->measurements.resize(1);
+		}
+		Measurement &m = job->measurements[0];
+		const char *lines;
+		const TelemetryMessage kind = ParseTelemetry(data, length, &m.package, &ground_truth, &lines);
+		if (kind == TELEMETRY_MEASUREMENT) {
+			Eigen::Map<Eigen::Vector4d>(m.ground_truth) = ground_truth;
+			m.has_ground_truth = true;
+			job->count = 1;
+		}
+		else if (kind == TELEMETRY_MEASUREMENTS) {
+			const char *end = data + length;
+			for (;;) {
+				if (job->measurements.size() == job->count) {
+					job->measurements.resize(job->count + 1);
+				}
+				Measurement &line = job->measurements[job->count];
+				if (!NextMeasurementLine(&lines, end, &line.package, &ground_truth)) {
+					break;
+				}
+				Eigen::Map<Eigen::Vector4d>(line.ground_truth) = ground_truth;
+				line.has_ground_truth = true;
+				job->count++;
+			}
+		}
+		else {
+			session->OnEvent(*hub_, ws, data, length, kind);
+			return;
+		}
+		job->lines = kind == TELEMETRY_MEASUREMENTS;
+	}
+	if (!job->count) {
+		return;
+	}
+	// a traced frame is followed by the threads it goes on to
+	LatencyStats &latency = LatencyStats::Local();
+	job->traced = latency.Trace(session->id());
+	job->queued = latency.Record(LATENCY_PARSE, start);
+	latency.StopTrace();
+
+	free_.pop_back();
+	job->session = session;
+	job->ws = ws;
+	job->binary = opCode == uWS::OpCode::BINARY;
+	job->format = session->reply_format(job->binary);
+	job->start = start;
+	std::unordered_map<Session *, Flight>::iterator flight = flights_.find(session);
+	if (flight == flights_.end()) {
+		Flight f;
+		f.worker = next_worker_++ % (int) workers_.size();
+		f.jobs = 0;
+		f.closed = false;
+		flight = flights_.insert(std::make_pair(session, f)).first;
+	}
+	flight->second.jobs++;
+	Worker &worker = *workers_[flight->second.worker];
+	worker.pending.TryPush(job);
+	worker.doorbell.Ring();
+}
+
+void Pipeline::Release(Session *session) {
+	std::unordered_map<Session *, Flight>::iterator flight = flights_.find(session);
+	if (flight == flights_.end()) {
+		sessions_->Release(session);
+	}
+	else if (!flight->second.jobs) {
+		flights_.erase(flight);
+		sessions_->Release(session);
+	}
+	else {
+		flight->second.closed = true;
+	}
+}
+
+void Pipeline::Filter(Worker &worker) {
+	LatencyStats &latency = LatencyStats::Local();
+	Metrics::Local().set_shard(shard_);
+	for (;;) {
+		worker.doorbell.Wait([this, &worker] {
+			return !worker.pending.empty() || stop_.load(std::memory_order_relaxed);
+		});
+		if (stop_.load()) {
+			return;
+		}
+		Job *job;
+		while (worker.pending.TryPop(&job)) {
+			Session *session = job->session;
+			if (job->traced) {
+				latency.Follow(session->id());
+			}
+			latency.Record(LATENCY_QUEUE, job->queued);
+			if (job->estimates.size() < job->count) {
+				job->estimates.resize(job->count);
+			}
+			for (size_t i = 0; i < job->count; i++) {
+				const Measurement &m = job->measurements[i];
+				Eigen::Vector4d RMSE = session->Filter(m.package, m.has_ground_truth ? m.ground_truth : nullptr,
+				                                       job->count - i - 1,
+				                                       job->binary || job->lines ? job->start : 0);
+				Estimate &e = job->estimates[i];
+				e.timestamp = m.package.timestamp_;
+				Eigen::Map<CTRVUKF::StateVector>(e.x) = session->filter().x_;
+				Eigen::Map<Eigen::Vector4d>(e.rmse) = RMSE;
+			}
+			latency.StopTrace();
+			worker.filtered.TryPush(job);
+			serializer_doorbell_.Ring();
+		}
+	}
+}
+
+void Pipeline::Serialize() {
+	LatencyStats &latency = LatencyStats::Local();
+	for (;;) {
+		serializer_doorbell_.Wait([this] {
+			for (size_t i = 0; i < workers_.size(); i++) {
+				if (!workers_[i]->filtered.empty()) {
+					return true;
+				}
+			}
+			return stop_.load(std::memory_order_relaxed);
+		});
+		if (stop_.load()) {
+			return;
+		}
+		for (size_t i = 0; i < workers_.size(); i++) {
+			Job *job;
+			while (workers_[i]->filtered.TryPop(&job)) {
+				if (job->traced) {
+					latency.Follow(job->session->id());
+				}
+				uint64_t stage_start = LatencyStats::Now();
+				if (job->format != Session::OUTPUT_JSON) {
+					job->reply.clear();
+					record::EstimateDeltaState delta;
+					for (size_t k = 0; k < job->count; k++) {
+						const Estimate &e = job->estimates[k];
+						Session::AppendEstimate(&job->reply, job->format, &delta, e.timestamp, e.x[0], e.x[1],
+						                        Eigen::Map<const Eigen::Vector4d>(e.rmse));
+					}
+				}
+				else if (job->binary || job->lines) {
+					const Estimate &e = job->estimates[job->count - 1];
+					job->reply.resize(Session::MaxEstimateMarkers(job->count));
+					job->reply.resize(Session::FormatEstimateMarkers(&job->reply[0], &job->estimates[0].x[0],
+					                                                 &job->estimates[0].x[1],
+					                                                 sizeof(Estimate) / sizeof(double), job->count,
+					                                                 Eigen::Map<const Eigen::Vector4d>(e.rmse)));
+				}
+				else {
+					const Estimate &e = job->estimates[0];
+					job->reply.resize(Session::kMaxEstimateMarker);
+					job->reply.resize(Session::FormatEstimateMarker(&job->reply[0], e.x[0], e.x[1],
+					                                                Eigen::Map<const Eigen::Vector4d>(e.rmse)));
+				}
+				latency.Record(LATENCY_SERIALIZE, stage_start);
+				latency.StopTrace();
+				done_.TryPush(job);
+				// one Complete task for all jobs done until it runs
+				if (!posted_.exchange(true)) {
+					while (!hub_->post([this] { Complete(); })) {
+						std::this_thread::yield();
+					}
+				}
+			}
+		}
+	}
+}
+
+bool Pipeline::Complete() {
+	// acquires what the serializer pushed before its last exchange
+	posted_.exchange(false);
+	Job *job;
+	bool completed = false;
+	while (done_.TryPop(&job)) {
+		Send(job);
+		completed = true;
+	}
+	return completed;
+}
+
+void Pipeline::Send(Job *job) {
+	Session *session = job->session;
+	std::unordered_map<Session *, Flight>::iterator flight = flights_.find(session);
+	if (!flight->second.closed) {
+		LatencyStats &latency = LatencyStats::Local();
+		if (job->traced) {
+			latency.Follow(session->id());
+		}
+		uint64_t stage_start = LatencyStats::Now();
+		for (size_t i = 0; i < job->count; i++) {
+			const Estimate &e = job->estimates[i];
+			session->CheckGeofence(*hub_, e.timestamp, Eigen::Map<const CTRVUKF::StateVector>(e.x));
+			session->Publish(*hub_, e.timestamp, Eigen::Map<const CTRVUKF::StateVector>(e.x));
+		}
+		if (job->format != Session::OUTPUT_JSON) {
+			job->ws.send(&job->reply[0], job->reply.size(), uWS::OpCode::BINARY);
+		}
+		else {
+			// as on the loop's thread, a newer estimate supersedes one still
+			// waiting for a slow client, unless it answers a batch
+			const bool batch = job->binary || job->lines;
+			char *reply = job->ws.reserveSend(job->reply.size(), uWS::OpCode::TEXT, batch ? nullptr : session);
+			if (reply) {
+				memcpy(reply, &job->reply[0], job->reply.size());
+				job->ws.commitSend(job->reply.size());
+			}
+		}
+		latency.Record(LATENCY_SEND, stage_start);
+		latency.Record(LATENCY_TOTAL, job->start);
+	}
+	if (!--flight->second.jobs && flight->second.closed) {
+		flights_.erase(flight);
+		sessions_->Release(session);
+	}
+	free_.push_back(job);
+}
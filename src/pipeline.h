@@ -0,0 +1,195 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <uWS/uWS.h>
+#include "cache_aligned.h"
+#include "measurement_package.h"
+#include "session.h"
+#include "spsc_ring.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Runs the measurements of one event loop's sessions through stages on
+ * threads of their own, so that the loop stays free for network I/O while
+ * the filters work through a burst:
+ *   the loop's thread    reads and parses the frames
+ *   filter workers       filter the measurements, each session always on the
+ *                        same worker, dealt out in turn as sessions connect
+ *   the serializer       formats the replies
+ *   the loop's thread    publishes the estimates and sends the replies
+ * The stages hand each other jobs, one frame each, through bounded
+ * SpscRings and wake each other up only when the next one sleeps, so a
+ * session's frames are answered in the order they came. All kJobs jobs are
+ * made up front and reused; while all of them are in flight the loop stops
+ * reading and waits for replies, so a client sending faster than the
+ * filters keep up with is held back by TCP as it would be without the
+ * pipeline.
+ *
+ * Only the measurements go through the pipeline; the simulator's manual
+ * event and the viewer events are still answered on the loop's thread as
+ * they arrive. Sessions are published after every measurement, so the
+ * sessions of a pipeline may not be published by a TrackPublisher, which
+ * reads their filters from the loop's thread.
+ *
+ * The pipeline belongs to the loop's thread and must be created there,
+ * before its sessions connect; it gives the loop a mailbox.
+ */
+class Pipeline {
+public:
+  ///* frames in flight at most across all workers, and the capacity of every
+  ///* ring, so that a push never finds one full
+  static const size_t kJobs = 1024;
+
+  ///* times a stage polls its ring for more before it sleeps
+  static const int kSpins = 2000;
+
+  /**
+   * Starts filter_workers filter threads and the serializer for the
+   * sessions of h, which come from and go back to sessions.
+   */
+  Pipeline(uWS::Hub &h, SessionPool &sessions, int filter_workers);
+
+  ///* stops the threads; jobs in flight are abandoned
+  ~Pipeline();
+
+  /**
+   * Takes a measurement frame of session's connection ws into the pipeline
+   * (a TEXT telemetry event or a BINARY frame of measurement records) and
+   * answers the other events of TEXT frames right away.
+   */
+  void Submit(Session *session, uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode);
+
+  ///* Submit for the session of ws, if it has one; the message handler of
+  ///* the loop's group, bound with Group::onMessage<Pipeline, ...>
+  void OnMessage(uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode) {
+    if (Session *session = static_cast<Session *>(ws.getUserData())) {
+      Submit(session, ws, data, length, opCode);
+    }
+  }
+
+  /**
+   * The connection of session closed: it goes back to the pool once the
+   * frames it still has in flight are done, unanswered.
+   */
+  void Release(Session *session);
+
+  int filter_workers() const { return (int) workers_.size(); }
+
+  CACHE_ALIGNED_OPERATOR_NEW
+
+private:
+  ///* a measurement as parsed on the loop's thread
+  struct Measurement {
+    MeasurementPackage package;
+    double ground_truth[4];
+    bool has_ground_truth;
+  };
+
+  ///* what a filter worker gives back of a measurement
+  struct Estimate {
+    long long timestamp;
+    double x[5];
+    double rmse[4];
+  };
+
+  ///* one frame on its way through the stages; the vectors keep their
+  ///* storage for the frames after it
+  struct Job {
+    Session *session;
+    uWS::WebSocket<uWS::SERVER> ws;
+    bool binary;
+    ///* what the frame is answered in, see Session::reply_format
+    Session::OutputFormat format;
+    ///* a telemetry event of an array of lines, answered with one
+    ///* estimate_marker of them all
+    bool lines;
+    ///* when the frame arrived, and was handed to a filter thread, on
+    ///* the clock of LatencyStats::Now
+    uint64_t start;
+    uint64_t queued;
+    ///* sampled for a trace on the loop's thread
+    bool traced;
+    ///* the first count measurements and estimates are this frame's
+    size_t count;
+    std::vector<Measurement> measurements;
+    std::vector<Estimate> estimates;
+    std::vector<char> reply;
+  };
+
+  /**
+   * Where a thread waiting for a ring sleeps: the producer rings it after
+   * every push, which is one fence and a load unless the consumer sleeps.
+   */
+  struct Doorbell {
+    std::mutex mutex;
+    std::condition_variable rung;
+    std::atomic<bool> waiting;
+
+    Doorbell() : waiting(false) {}
+
+    void Ring();
+
+    ///* returns once ready() holds, polling kSpins times before sleeping
+    template <class Ready>
+    void Wait(const Ready &ready);
+  };
+
+  ///* a filter worker's rings from the loop and to the serializer
+  struct alignas(kCacheLineSize) Worker {
+    SpscRing<Job *> pending;
+    SpscRing<Job *> filtered;
+    Doorbell doorbell;
+    std::thread thread;
+
+    Worker() : pending(kJobs), filtered(kJobs) {}
+
+    CACHE_ALIGNED_OPERATOR_NEW
+  };
+
+  ///* the loop's view of a session in the pipeline
+  struct Flight {
+    int worker;
+    size_t jobs;
+    bool closed;
+  };
+
+  uWS::Hub *hub_;
+  SessionPool *sessions_;
+  ///* the loop's shard, for the Metrics of the filter threads
+  int shard_;
+
+  std::unique_ptr<Job[]> jobs_;
+  std::vector<std::unique_ptr<Worker> > workers_;
+  SpscRing<Job *> done_;
+  Doorbell serializer_doorbell_;
+  std::thread serializer_;
+  std::atomic<bool> stop_;
+
+  ///* whether a Complete task is waiting in the loop's mailbox
+  std::atomic<bool> posted_;
+
+  ///* touched by the loop's thread only
+  std::vector<Job *> free_;
+  std::unordered_map<Session *, Flight> flights_;
+  int next_worker_;
+
+  void Filter(Worker &worker);
+  void Serialize();
+
+  ///* on the loop's thread: sends the replies of the jobs done; false if
+  ///* there were none
+  bool Complete();
+  void Send(Job *job);
+
+  Pipeline(const Pipeline &);
+  Pipeline &operator=(const Pipeline &);
+};
+
+#endif /* PIPELINE_H_ */
@@ -0,0 +1,31 @@
+#ifndef PROBES_H_
+#define PROBES_H_
+
+/**
+ * Static tracepoints (USDT) of the filter, provider "ukf".
+ *
+ * When built with UKF_USDT (`cmake -DUKF_USDT=ON ..`, which needs
+ * <sys/sdt.h> from systemtap-sdt-dev) each probe is a single nop in the code
+ * and a note in the binary that bpftrace, bcc or perf attach a uprobe to;
+ * the arguments are only read while a tracer is attached. In regular builds
+ * the macros expand to nothing. The probes are:
+ *
+ *   process__entry(sensor, timestamp)  process__return(sensor)
+ *   predict__entry(timestamp)          predict__return()
+ *   update__lidar__entry()             update__lidar__return(rejected)
+ *   update__radar__entry()             update__radar__return(rejected)
+ *
+ * for instance `bpftrace -e 'usdt:./UnscentedKF:ukf:predict__entry { ... }'`.
+ */
+#ifdef UKF_USDT
+#include <sys/sdt.h>
+#define UKF_PROBE(name) DTRACE_PROBE(ukf, name)
+#define UKF_PROBE1(name, a) DTRACE_PROBE1(ukf, name, a)
+#define UKF_PROBE2(name, a, b) DTRACE_PROBE2(ukf, name, a, b)
+#else
+#define UKF_PROBE(name)
+#define UKF_PROBE1(name, a)
+#define UKF_PROBE2(name, a, b)
+#endif
+
+#endif /* PROBES_H_ */
@@ -0,0 +1,318 @@
+#include "process_handoff.h"
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+///* the address of path, false if it is too long for one
+bool UnixAddress(const char *path, sockaddr_un *address) {
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address->sun_path)) {
+		return false;
+	}
+	strcpy(address->sun_path, path);
+	return true;
+}
+
+bool ReadFull(int fd, char *data, size_t length) {
+	while (length) {
+		const ssize_t n = read(fd, data, length);
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		length -= n;
+	}
+	return true;
+}
+
+bool WriteFull(int fd, const char *data, size_t length) {
+	while (length) {
+		const ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		length -= n;
+	}
+	return true;
+}
+
+///* reads a record's header into header, and the descriptor that came
+///* with it into *passed, or -1
+bool ReceiveHeader(int fd, uint32_t header[3], int *passed) {
+	char control[CMSG_SPACE(sizeof(int))];
+	iovec buffer = {header, 3 * sizeof(uint32_t)};
+	msghdr message = {};
+	message.msg_iov = &buffer;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	*passed = -1;
+	const ssize_t n = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+	if (n <= 0) {
+		return false;
+	}
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+		memcpy(passed, CMSG_DATA(cmsg), sizeof(int));
+	}
+	//the descriptor comes with the first byte, the rest may follow
+	if (!ReadFull(fd, reinterpret_cast<char *>(header) + n, 3 * sizeof(uint32_t) - n)) {
+		if (*passed >= 0) {
+			close(*passed);
+		}
+		return false;
+	}
+	return true;
+}
+
+}
+
+const int ProcessHandoff::kRetryInterval;
+const int ProcessHandoff::kDrainTimeout;
+
+ProcessHandoff::ProcessHandoff(uWS::Hub &h, SessionPool &sessions)
+	: hub_(&h), sessions_(&sessions), tls_(nullptr), options_(0), listen_fd_(-1), poll_(nullptr), peer_fd_(-1),
+	  port_fd_(-1), timer_(nullptr), started_(0), handed_over_(0), taken_over_(0) {
+}
+
+ProcessHandoff::~ProcessHandoff() {
+	StopTimer();
+	if (poll_) {
+		uv_poll_stop(poll_);
+		uv_close(poll_, [](uv_handle_t *handle) {
+			delete (uv_poll_t *) handle;
+		});
+		close(listen_fd_);
+	}
+	if (peer_fd_ >= 0) {
+		close(peer_fd_);
+	}
+	if (port_fd_ >= 0) {
+		close(port_fd_);
+	}
+}
+
+bool ProcessHandoff::TakeOver(const char *path, uS::TLS::Context tls, int options) {
+	sockaddr_un address;
+	if (!UnixAddress(path, &address)) {
+		return false;
+	}
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return false;
+	}
+	if (connect(fd, (sockaddr *) &address, sizeof(address)) != 0) {
+		close(fd);
+		return false;
+	}
+
+	bool listening = false;
+	uint32_t header[3];
+	int passed;
+	while (ReceiveHeader(fd, header, &passed)) {
+		std::string state(header[2], '\0');
+		if (header[2] && !ReadFull(fd, &state[0], header[2])) {
+			if (passed >= 0) {
+				close(passed);
+			}
+			break;
+		}
+		if (header[0] == LISTEN && passed >= 0 && !listening) {
+			hub_->listenFd(passed, tls, options);
+			listening = true;
+		}
+		else if (header[0] == CONNECTION && passed >= 0) {
+			//thawed by the connection handler
+			hub_->adopt(passed, (int) header[1], new std::string(state));
+			taken_over_++;
+		}
+		else {
+			if (passed >= 0) {
+				close(passed);
+			}
+			if (header[0] == END) {
+				break;
+			}
+		}
+	}
+	close(fd);
+	return listening;
+}
+
+bool ProcessHandoff::Serve(const char *path, uS::TLS::Context tls, int options, std::function<void(int)> done) {
+	sockaddr_un address;
+	if (!UnixAddress(path, &address)) {
+		return false;
+	}
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	if (bind(fd, (sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 1) != 0) {
+		close(fd);
+		return false;
+	}
+	tls_ = tls;
+	options_ = options;
+	done_ = done;
+	listen_fd_ = fd;
+	poll_ = new uv_poll_t;
+	uv_poll_init_socket(hub_->getLoop(), poll_, fd);
+	poll_->data = this;
+	uv_poll_start(poll_, UV_READABLE, [](uv_poll_t *poll, int status, int events) {
+		static_cast<ProcessHandoff *>(poll->data)->Accept();
+	});
+	return true;
+}
+
+void ProcessHandoff::Accept() {
+	//the new process is answered blocking, as it waits for nothing else
+	const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	if (peer_fd_ >= 0) {
+		close(fd);
+		return;
+	}
+	peer_fd_ = fd;
+	handed_over_ = 0;
+	const int port = hub_->getListenSocket();
+	port_fd_ = port >= 0 ? fcntl(port, F_DUPFD_CLOEXEC, 0) : -1;
+	if (port_fd_ < 0 || !Send(LISTEN, port, 0, std::string())) {
+		Abort();
+		return;
+	}
+	hub_->getDefaultGroup<uWS::SERVER>().stopAccepting();
+	std::cout << "Handing over to a new process" << std::endl;
+	started_ = uv_now(hub_->getLoop());
+	Drain(false);
+}
+
+void ProcessHandoff::Drain(bool final) {
+	uWS::Group<uWS::SERVER> &group = hub_->getDefaultGroup<uWS::SERVER>();
+	std::vector<uWS::WebSocket<uWS::SERVER> > connections;
+	group.forEach([&connections](uWS::WebSocket<uWS::SERVER> ws) {
+		connections.push_back(ws);
+	});
+
+	int waiting = 0;
+	for (uWS::WebSocket<uWS::SERVER> ws : connections) {
+		Session *session = static_cast<Session *>(ws.getUserData());
+		if (group.isSubscribed(ws) || !session) {
+			ws.close(1001);
+			continue;
+		}
+		if (!ws.canHandOff()) {
+			if (final) {
+				ws.close(1001);
+			}
+			else {
+				waiting++;
+			}
+			continue;
+		}
+		std::string state;
+		session->Freeze(&state);
+		sessions_->Release(session);
+		ws.setUserData(nullptr);
+		int compression_options;
+		const int fd = ws.handOff(compression_options);
+		if (fd < 0) {
+			ws.close(1001);
+			continue;
+		}
+		const bool sent = Send(CONNECTION, fd, compression_options, state);
+		close(fd);
+		if (!sent) {
+			Abort();
+			return;
+		}
+		handed_over_++;
+	}
+
+	if (waiting) {
+		if (!timer_) {
+			timer_ = new uv_timer_t;
+			uv_timer_init(hub_->getLoop(), timer_);
+			timer_->data = this;
+			uv_timer_start(timer_, [](uv_timer_t *timer) {
+				ProcessHandoff *handoff = static_cast<ProcessHandoff *>(timer->data);
+				handoff->Drain(uv_now(handoff->hub_->getLoop()) - handoff->started_ >= (uint64_t) kDrainTimeout);
+			}, kRetryInterval, kRetryInterval);
+		}
+		return;
+	}
+	StopTimer();
+	Send(END, -1, 0, std::string());
+	close(peer_fd_);
+	peer_fd_ = -1;
+	close(port_fd_);
+	port_fd_ = -1;
+	done_(handed_over_);
+}
+
+bool ProcessHandoff::Send(Kind kind, int fd, int compression_options, const std::string &state) {
+	uint32_t header[3] = {(uint32_t) kind, (uint32_t) compression_options, (uint32_t) state.length()};
+	char control[CMSG_SPACE(sizeof(int))];
+	iovec buffer = {header, sizeof(header)};
+	msghdr message = {};
+	message.msg_iov = &buffer;
+	message.msg_iovlen = 1;
+	if (fd >= 0) {
+		memset(control, 0, sizeof(control));
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	const ssize_t n = sendmsg(peer_fd_, &message, MSG_NOSIGNAL);
+	if (n <= 0) {
+		return false;
+	}
+	return WriteFull(peer_fd_, reinterpret_cast<const char *>(header) + n, sizeof(header) - n)
+		&& WriteFull(peer_fd_, state.data(), state.length());
+}
+
+void ProcessHandoff::Abort() {
+	std::cerr << "The new process went away; serving on" << std::endl;
+	StopTimer();
+	if (port_fd_ >= 0) {
+		if (hub_->getListenSocket() < 0) {
+			hub_->listenFd(port_fd_, tls_, options_);
+		}
+		else {
+			close(port_fd_);
+		}
+		port_fd_ = -1;
+	}
+	close(peer_fd_);
+	peer_fd_ = -1;
+}
+
+void ProcessHandoff::StopTimer() {
+	if (!timer_) {
+		return;
+	}
+	uv_timer_stop(timer_);
+	uv_close(timer_, [](uv_handle_t *handle) {
+		delete (uv_timer_t *) handle;
+	});
+	timer_ = nullptr;
+}
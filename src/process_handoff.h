@@ -0,0 +1,110 @@
+#ifndef PROCESS_HANDOFF_H_
+#define PROCESS_HANDOFF_H_
+
+#include <uWS/uWS.h>
+#include "session.h"
+#include <cstdint>
+#include <functional>
+
+/**
+ * Hands a running server's port and connections over to a new build of it
+ * on the same host, so that a deploy neither drops the sensors nor makes
+ * their tracks converge again.
+ *
+ * The old process serves handoffs on a Unix domain socket. The new one
+ * connects to it before listening itself, and the old one then sends, as
+ * records over that connection with the descriptors attached (SCM_RIGHTS):
+ * its listening socket, which the new one accepts from from then on while
+ * the old one stops; then every connection with the frozen state of its
+ * track (see Session::Freeze), which the new one continues in its own Hub
+ * (see Hub::adopt) and thaws; and an end record, after which it exits. A
+ * record is a header of three uint32 in host order, its kind, the
+ * connection's extension options and the length of the state that
+ * follows.
+ *
+ * A connection goes over between two messages, with nothing left to send
+ * (see WebSocket::canHandOff); those that are not are tried again every
+ * kRetryInterval for kDrainTimeout. Those still not, viewers, whose
+ * subscriptions do not go over, and connections encrypted by this process
+ * or keeping a deflate context are closed with 1001, to connect again.
+ * Should the new process go away halfway, the old one listens on its
+ * socket again and serves on.
+ *
+ * Both belong to the loop's thread. The sessions must be filtered on the
+ * loop, not by a Pipeline.
+ */
+class ProcessHandoff {
+public:
+  ///* ms between passes over the connections not yet handed over, and
+  ///* the most ms spent on them
+  static const int kRetryInterval = 10;
+  static const int kDrainTimeout = 1000;
+
+  ProcessHandoff(uWS::Hub &h, SessionPool &sessions);
+
+  ///* stops serving handoffs
+  ~ProcessHandoff();
+
+  /**
+   * Takes the port and connections over from the process serving handoffs
+   * at path, if there is one, blocking until it is done; the connections
+   * go to h's connection handler with the frozen track as a std::string in
+   * their user data. tls and options are those of h.listen.
+   * @return false, with nothing taken over, if no process answered
+   */
+  bool TakeOver(const char *path, uS::TLS::Context tls, int options);
+
+  /**
+   * Serves the next process at path, replacing a socket file left there;
+   * done is called with the number of connections handed over, once the
+   * process has them.
+   * @return false if path cannot be bound
+   */
+  bool Serve(const char *path, uS::TLS::Context tls, int options, std::function<void(int handed_over)> done);
+
+  ///* connections taken over at the start
+  int taken_over() const { return taken_over_; }
+
+private:
+  enum Kind { LISTEN, CONNECTION, END };
+
+  uWS::Hub *hub_;
+  SessionPool *sessions_;
+  uS::TLS::Context tls_;
+  int options_;
+  std::function<void(int)> done_;
+
+  ///* the socket handoffs are served on, and the connection to the new
+  ///* process during one
+  int listen_fd_;
+  uv_poll_t *poll_;
+  int peer_fd_;
+
+  ///* a dup of the port's socket during a handoff, to listen on again if
+  ///* the new process goes away
+  int port_fd_;
+  uv_timer_t *timer_;
+  uint64_t started_;
+  int handed_over_;
+  int taken_over_;
+
+  ///* accepts the new process and starts handing over
+  void Accept();
+
+  ///* hands over the connections that can go now; all of them, closing
+  ///* the rest, once final
+  void Drain(bool final);
+
+  ///* sends a record to the new process; false if it is gone
+  bool Send(Kind kind, int fd, int compression_options, const std::string &state);
+
+  ///* the new process went away: serves on alone
+  void Abort();
+
+  void StopTimer();
+
+  ProcessHandoff(const ProcessHandoff &);
+  ProcessHandoff &operator=(const ProcessHandoff &);
+};
+
+#endif /* PROCESS_HANDOFF_H_ */
@@ -0,0 +1,46 @@
+#include "qos_governor.h"
+#include <iostream>
+
+const double QosGovernor::kRecovery = 0.75;
+const int QosGovernor::kInterval;
+
+QosGovernor::QosGovernor(uWS::Hub &h, SessionPool &sessions, double busy)
+	: hub_(&h), sessions_(&sessions), timer_(new uv_timer_t), busy_(busy), level_(0), seconds_(0), idle_seconds_(0) {
+	uv_timer_init(h.getLoop(), timer_);
+	timer_->data = this;
+	uv_timer_start(timer_, [](uv_timer_t *timer) {
+		static_cast<QosGovernor *>(timer->data)->Adjust();
+	}, kInterval, kInterval);
+}
+
+QosGovernor::~QosGovernor() {
+	uv_timer_stop(timer_);
+	uv_close(timer_, [](uv_handle_t *handle) {
+		delete (uv_timer_t *) handle;
+	});
+}
+
+void QosGovernor::Adjust() {
+	const uS::LoopStats loop = hub_->getLoopStats();
+	const double elapsed = loop.seconds - seconds_;
+	const double busy = elapsed > 0 ? 1.0 - (loop.idleSeconds - idle_seconds_) / elapsed : 0.0;
+	seconds_ = loop.seconds;
+	idle_seconds_ = loop.idleSeconds;
+
+	const int level = level_;
+	if (busy > busy_ && level_ < Session::kQosLevels - 1) {
+		level_++;
+	}
+	else if (busy < busy_ * kRecovery && level_ > 0) {
+		level_--;
+	}
+	if (level_ != level) {
+		std::cerr << "Loop " << int(100 * busy) << "% busy, QoS pressure level " << level_ << std::endl;
+	}
+
+	// every interval, for the sessions handed out since
+	const std::vector<Session *> &live = sessions_->live_sessions();
+	for (size_t i = 0; i < live.size(); i++) {
+		live[i]->set_qos_tier(Session::TierAt(live[i]->qos_class(), level_));
+	}
+}
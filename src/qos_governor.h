@@ -0,0 +1,57 @@
+#ifndef QOS_GOVERNOR_H_
+#define QOS_GOVERNOR_H_
+
+#include <uWS/uWS.h>
+#include "session.h"
+
+/**
+ * Keeps a loop's filtering within its time by lowering the QoS tier of its
+ * sessions while the loop is busy and raising it again once it is not (see
+ * Session::QosTier), so that tracks degrade by the class their clients
+ * asked for rather than all falling behind together.
+ *
+ * Every kInterval a timer on the loop takes the share of the time since
+ * that the loop spent running handlers rather than waiting for events.
+ * Over the busy limit, the loop's pressure level rises by one, below
+ * kRecovery of it, it falls by one, and in between it stays, so that the
+ * tiers do not flap around the limit; each live session is then moved to
+ * Session::TierAt of its class and the level. A governor belongs to the
+ * loop's thread and must be created there; the sessions it moves may be
+ * filtered on a Pipeline's threads, which take the tier at their next
+ * measurement.
+ */
+class QosGovernor {
+public:
+  ///* how often the loop checks, in ms
+  static const int kInterval = 250;
+
+  ///* share of the busy limit under which the level falls
+  static const double kRecovery;
+
+  ///* busy is the share of the loop's time, 0 to 1, over which it degrades
+  QosGovernor(uWS::Hub &h, SessionPool &sessions, double busy);
+
+  ///* stops the timer
+  ~QosGovernor();
+
+  ///* moves the level by the loop's busy share since the last check
+  void Adjust();
+
+  ///* the pressure level, 0 up to Session::kQosLevels - 1
+  int level() const { return level_; }
+
+private:
+  uWS::Hub *hub_;
+  SessionPool *sessions_;
+  uv_timer_t *timer_;
+  double busy_;
+  int level_;
+  ///* the loop's running and idle seconds at the last check
+  double seconds_;
+  double idle_seconds_;
+
+  QosGovernor(const QosGovernor &);
+  QosGovernor &operator=(const QosGovernor &);
+};
+
+#endif /* QOS_GOVERNOR_H_ */
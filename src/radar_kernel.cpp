@@ -0,0 +1,65 @@
+#include "radar_kernel.h"
+#include "simd.h"
+
+namespace {
+
+/**
+* Projects V::width states starting at index i; T is the lane type of V,
+* double or float. Approximate selects the bearing polynomial at compile
+* time, so that neither loop branches on it.
+*/
+template <class V, bool Approximate, class T>
+inline void ProjectLanes(const T *const in[4], T *const out[3], int i) {
+	typedef typename V::Vec Vec;
+	const Vec p_x = V::Load(in[0] + i);
+	const Vec p_y = V::Load(in[1] + i);
+	const Vec v = V::Load(in[2] + i);
+	const Vec yaw = V::Load(in[3] + i);
+
+	//avoid too small numbers, as lane::RadarMeasurement
+	const Vec range = V::Sqrt(V::MulAdd(p_x, p_x, V::Mul(p_y, p_y)));
+	const typename V::Mask near = V::Less(range, V::Set1(0.001));
+	const Vec rho = V::Select(near, V::Set1(0.001), range);
+	const Vec phi = Approximate ? simd::Atan2Approximate<V>(p_y, p_x) : simd::Atan2<V>(p_y, p_x);
+
+	Vec sin_yaw, cos_yaw;
+	simd::SinCos<V>(yaw, &sin_yaw, &cos_yaw);
+	const Vec radial = V::MulAdd(p_x, cos_yaw, V::Mul(p_y, sin_yaw));
+	V::Store(out[0] + i, rho);
+	V::Store(out[1] + i, V::Select(near, V::Set1(0.0), phi));
+	V::Store(out[2] + i, V::Div(V::Mul(radial, v), rho));
+}
+
+template <class V, class S, bool Approximate, class T>
+inline void ProjectAll(const T *const in[4], T *const out[3], int n) {
+	int i = 0;
+	for (; i + V::width <= n; i += V::width) {
+		ProjectLanes<V, Approximate>(in, out, i);
+	}
+	//remaining states with the same polynomials, one at a time
+	for (; i < n; i++) {
+		ProjectLanes<S, Approximate>(in, out, i);
+	}
+}
+
+}
+
+void ProjectRadar(const double *const in[4], double *const out[3], int n,
+                  bool approximate) {
+	if (approximate) {
+		ProjectAll<simd::NativeDouble, simd::ScalarDouble, true>(in, out, n);
+	}
+	else {
+		ProjectAll<simd::NativeDouble, simd::ScalarDouble, false>(in, out, n);
+	}
+}
+
+void ProjectRadar(const float *const in[4], float *const out[3], int n,
+                  bool approximate) {
+	if (approximate) {
+		ProjectAll<simd::NativeFloat, simd::ScalarFloat, true>(in, out, n);
+	}
+	else {
+		ProjectAll<simd::NativeFloat, simd::ScalarFloat, false>(in, out, n);
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef RADAR_KERNEL_H_
+#define RADAR_KERNEL_H_
+
+/**
+ * Projects n states into the radar measurement space, the counterpart of
+ * PropagateCTRV (see ctrv_kernel.h) for the radar update of the batched
+ * filter.
+ *
+ * The states are given component-wise: in[k][i] is component k
+ * (p_x, p_y, v, yaw) of state i, and out[0..2][i] receive its rho, phi and
+ * rho_dot as lane::RadarMeasurement computes them, rho held at 0.001 and phi
+ * 0 closer to the origin. States are evaluated simd::NativeDouble lanes at
+ * a time, rho with the square root instruction, phi with simd::Atan2 and
+ * the sine and cosine of yaw with simd::SinCos.
+ * @param in 4 input component arrays of n states each
+ * @param out 3 output component arrays of n states each, may not alias in
+ * @param n Number of states
+ * @param approximate Whether phi comes from simd::Atan2Approximate, within
+ * simd::kAtan2ApproximateError of the exact angle
+ */
+void ProjectRadar(const double *const in[4], double *const out[3], int n,
+                  bool approximate = false);
+
+/**
+ * The same in single precision, simd::NativeFloat lanes wide.
+ */
+void ProjectRadar(const float *const in[4], float *const out[3], int n,
+                  bool approximate = false);
+
+#endif /* RADAR_KERNEL_H_ */
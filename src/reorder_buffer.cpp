@@ -0,0 +1,74 @@
+#include "reorder_buffer.h"
+
+const size_t ReorderBuffer::kCapacity;
+
+ReorderBuffer::ReorderBuffer(long long budget_us, size_t capacity)
+	: budget_us_(budget_us), entries_(capacity > 0 ? capacity : 1), head_(0), size_(0),
+	  released_(false), released_timestamp_(0), late_(0), overflowed_(0) {}
+
+void ReorderBuffer::Reset() {
+	head_ = 0;
+	size_ = 0;
+	released_ = false;
+}
+
+bool ReorderBuffer::Push(const MeasurementPackage &meas_package, const Eigen::Vector4d *ground_truth,
+                         long long now_us) {
+	if (released_ && meas_package.timestamp_ < released_timestamp_) {
+		late_++;
+		return false;
+	}
+	if (size_ == entries_.size()) {
+		// Pop was not called since the last Push filled the buffer
+		overflowed_++;
+		return false;
+	}
+
+	// the new measurement goes after the last one no later than it; ties
+	// keep their order of arrival
+	size_t k = size_;
+	while (k > 0 && at(k - 1).meas_package.timestamp_ > meas_package.timestamp_) {
+		at(k) = at(k - 1);
+		k--;
+	}
+	Entry &entry = at(k);
+	entry.meas_package = meas_package;
+	entry.has_ground_truth = ground_truth != nullptr;
+	if (ground_truth) {
+		Eigen::Map<Eigen::Vector4d>(entry.ground_truth) = *ground_truth;
+	}
+	entry.due_us = now_us + budget_us_;
+	size_++;
+	return true;
+}
+
+bool ReorderBuffer::Pop(long long now_us, MeasurementPackage *meas_package, Eigen::Vector4d *ground_truth,
+                        bool *has_ground_truth) {
+	if (!size_) {
+		return false;
+	}
+	if (size_ == entries_.size()) {
+		overflowed_++;
+	}
+	else {
+		bool due = false;
+		for (size_t i = 0; i < size_ && !due; i++) {
+			due = at(i).due_us <= now_us;
+		}
+		if (!due) {
+			return false;
+		}
+	}
+
+	const Entry &entry = at(0);
+	*meas_package = entry.meas_package;
+	*has_ground_truth = entry.has_ground_truth;
+	if (entry.has_ground_truth) {
+		*ground_truth = Eigen::Map<const Eigen::Vector4d>(entry.ground_truth);
+	}
+	released_ = true;
+	released_timestamp_ = entry.meas_package.timestamp_;
+	head_ = (head_ + 1) % entries_.size();
+	size_--;
+	return true;
+}
@@ -0,0 +1,89 @@
+#ifndef REORDER_BUFFER_H_
+#define REORDER_BUFFER_H_
+
+#include "measurement_package.h"
+#include "Eigen/Dense"
+#include <cstddef>
+#include <vector>
+
+/**
+ * A short hold in front of a filter that puts the measurements of links
+ * with some jitter between them, such as a lidar's and a radar's, back in
+ * timestamp order, so that the filter never predicts backwards. Unlike
+ * MeasurementHistory nothing is filtered again: each measurement is held
+ * for up to a latency budget from its arrival, and whenever one is due it
+ * is released together with everything older than it, oldest first.
+ *
+ * A measurement older than one already released arrived later than the
+ * budget allows and is dropped (late); one that finds the buffer full
+ * pushes out the oldest before its time (overflowed). The entries are a
+ * ring of fixed capacity kept in timestamp order, so holding never
+ * allocates, and as measurements mostly arrive in order an insert usually
+ * lands at the end.
+ */
+class ReorderBuffer {
+public:
+  ///* measurements held at most, by default
+  static const size_t kCapacity = 64;
+
+  /**
+   * @param budget_us Longest a measurement is held, in us
+   * @param capacity Most measurements held at once
+   */
+  explicit ReorderBuffer(long long budget_us, size_t capacity = kCapacity);
+
+  /**
+   * Holds a measurement arriving at now_us, on any clock the caller keeps
+   * in us, with its ground truth or none; false if it is dropped as late.
+   * Calling Pop after every Push releases the oldest of a full buffer, so
+   * that a Push always finds room.
+   */
+  bool Push(const MeasurementPackage &meas_package, const Eigen::Vector4d *ground_truth, long long now_us);
+
+  /**
+   * Releases the oldest measurement held if the budget of any is up at
+   * now_us, or the buffer is full; false if none is to be released yet.
+   */
+  bool Pop(long long now_us, MeasurementPackage *meas_package, Eigen::Vector4d *ground_truth,
+           bool *has_ground_truth);
+
+  ///* drops the measurements held, for a new track; the counts stay
+  void Reset();
+
+  long long budget_us() const { return budget_us_; }
+  size_t size() const { return size_; }
+  size_t capacity() const { return entries_.size(); }
+
+  ///* bytes of its entries
+  size_t memory() const { return entries_.capacity() * sizeof(Entry); }
+
+  ///* measurements dropped as late, and released early from a full buffer
+  long long late() const { return late_; }
+  long long overflowed() const { return overflowed_; }
+
+private:
+  struct Entry {
+    MeasurementPackage meas_package;
+    double ground_truth[4];
+    bool has_ground_truth;
+    ///* when the budget is up
+    long long due_us;
+  };
+
+  long long budget_us_;
+  std::vector<Entry> entries_;
+  ///* oldest entry in the ring, and number of entries
+  size_t head_;
+  size_t size_;
+
+  ///* the timestamp of the last measurement released
+  bool released_;
+  long long released_timestamp_;
+
+  long long late_;
+  long long overflowed_;
+
+  Entry &at(size_t i) { return entries_[(head_ + i) % entries_.size()]; }
+};
+
+#endif /* REORDER_BUFFER_H_ */
@@ -0,0 +1,1820 @@
+#include "replay.h"
+#include "fixed_lag_smoother.h"
+#include "imm.h"
+#include "interval_smoother.h"
+#include "allocation_counter.h"
+#include "measurement_log.h"
+#include "measurement_parser.h"
+#include "perf_counters.h"
+#include "replay_report.h"
+#include "task_pool.h"
+#include "track_scheduler.h"
+#include "tracker.h"
+#include "tools.h"
+#include "ukf.h"
+#include "ukf_batch.h"
+#ifdef UKF_CUDA
+#include "ukf_batch_cuda.h"
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+///* read size of the chunked path and flush threshold of the output buffer
+const size_t kChunkSize = 1 << 20;
+
+///* largest differences between the float and the double UKFBatch that
+///* RunPrecisionCheck accepts, in the units of the RMSE and of the NIS
+const double kPrecisionRMSETolerance = 1e-3;
+const double kPrecisionNISTolerance = 1e-2;
+
+///* steps of the largest state divergence RunDiffCheck lists
+const size_t kDiffWorstSteps = 10;
+
+/**
+* Runs the measurements of one sequence through a filter of its own, with the
+* estimate lines written to out, or only the statistics kept if out is null.
+* With a smoothing lag the lines are the smoothed states instead, one per
+* timestamp, trailing the filter by that many steps. With imm the filter is a
+* MotionIMM instead of the Filter, a CTRV filter such as CTRVUKF, whose
+* combined estimate is written. Smoothing takes a CTRVUKF.
+*/
+template <class Filter>
+class FilterReplayer {
+public:
+	explicit FilterReplayer(FILE *out, size_t smooth_lag = 0, bool imm = false)
+		: imm_(imm ? new MotionIMM() : nullptr),
+		  radar_nis_(NISMonitor::Radar(100, 0.05)),
+		  laser_nis_(NISMonitor::Laser(100, 0.05)),
+		  smoother_(smooth_lag ? new FixedLagSmoother(smooth_lag) : nullptr),
+		  truths_(smooth_lag ? smooth_lag + 2 : 0), truth_head_(0), truth_size_(0),
+		  out_(out), buffer_(out ? kChunkSize + 256 : 0), used_(0),
+		  lines_(0), skipped_(0), lidar_(0), radar_(0), estimates_(nullptr), ground_truths_(nullptr) {}
+
+	/**
+	* Appends every estimate with ground truth and that ground truth to
+	* estimates and ground_truths, [p_x, p_y, v_x, v_y] each, for
+	* CalculateErrorStats; none are kept while they are null.
+	*/
+	void set_samples(std::vector<double> *estimates, std::vector<double> *ground_truths) {
+		estimates_ = estimates;
+		ground_truths_ = ground_truths;
+	}
+
+	/**
+	* Processes every complete line in [begin, end) and returns the start of
+	* the incomplete last line.
+	*/
+	const char *Consume(const char *begin, const char *end) {
+		const char *line = begin;
+		const char *newline;
+		while ((newline = static_cast<const char *>(memchr(line, '\n', end - line)))) {
+			ConsumeLine(line, newline);
+			line = newline + 1;
+		}
+		return line;
+	}
+
+	void ConsumeLine(const char *begin, const char *end) {
+		if (begin == end || *begin == '#' || *begin == '\r') {
+			return;
+		}
+		lines_++;
+		LatencyStats &latency = LatencyStats::Local();
+		const uint64_t start = LatencyStats::Now();
+		if (!ParseMeasurementLine(begin, end, &meas_package_, &ground_truth_)) {
+			skipped_++;
+			return;
+		}
+		latency.Record(LATENCY_PARSE, start);
+		Process(true);
+	}
+
+	///* a measurement of a log, with its ground truth if it has one
+	void ConsumeMeasurement(const MeasurementPackage &meas_package, const Eigen::Vector4d *ground_truth) {
+		lines_++;
+		meas_package_ = meas_package;
+		if (ground_truth) {
+			ground_truth_ = *ground_truth;
+		}
+		Process(ground_truth != nullptr);
+	}
+
+	/**
+	* A measurement before the replayed window of a log, which only brings
+	* the filter up to its start: nothing is written or counted.
+	*/
+	void WarmUp(const MeasurementPackage &meas_package) {
+		meas_package_ = meas_package;
+		if (imm_) {
+			imm_->ProcessMeasurement(meas_package_);
+		}
+		else if (smoother_) {
+			Smooth();
+		}
+		else {
+			ukf_.ProcessMeasurement(meas_package_);
+		}
+	}
+
+	void Process(bool has_ground_truth) {
+		bool was_initialized = imm_ ? imm_->is_initialized_ : ukf_.is_initialized_;
+		if (imm_) {
+			imm_->ProcessMeasurement(meas_package_);
+		}
+		else if (smoother_) {
+			if (has_ground_truth) {
+				PushTruth();
+			}
+			if (Smooth()) {
+				WriteSmoothed();
+			}
+		}
+		else {
+			ukf_.ProcessMeasurement(meas_package_);
+		}
+
+		const bool radar = meas_package_.sensor_type_ == MeasurementPackage::RADAR;
+		(radar ? radar_ : lidar_)++;
+		//both filters start their state with p_x p_y v yaw yaw_rate
+		const double *x = imm_ ? imm_->x_.data() : ukf_.x_.data();
+		const double nis = imm_ ? (radar ? imm_->NIS_radar_ : imm_->NIS_laser_)
+		                        : (radar ? ukf_.NIS_radar_ : ukf_.NIS_laser_);
+		if (was_initialized) {
+			(radar ? radar_nis_ : laser_nis_).Add(nis);
+		}
+
+		const Eigen::Vector4d estimate = CartesianEstimate(x);
+		if (has_ground_truth) {
+			rmse_.Add(estimate, ground_truth_);
+			if (estimates_) {
+				estimates_->insert(estimates_->end(), estimate.data(), estimate.data() + 4);
+				ground_truths_->insert(ground_truths_->end(), ground_truth_.data(), ground_truth_.data() + 4);
+			}
+		}
+		if (!out_ || smoother_) {
+			return;
+		}
+		const Eigen::Vector4d rmse = rmse_.RMSE();
+
+		char *p = &buffer_[used_];
+		p += sprintf(p, "%lld %c", meas_package_.timestamp_, radar ? 'R' : 'L');
+		for (int i = 0; i < 5; i++) {
+			*p++ = ' ';
+			p = FormatFixed(p, x[i]);
+		}
+		*p++ = ' ';
+		p = FormatFixed(p, nis);
+		for (int i = 0; i < 4; i++) {
+			*p++ = ' ';
+			p = FormatFixed(p, rmse(i));
+		}
+		*p++ = '\n';
+		used_ = p - &buffer_[0];
+		if (used_ >= kChunkSize) {
+			Flush();
+		}
+	}
+
+	/**
+	* The smoothed states still trailing the filter, at the end of the data
+	*/
+	void Finish() {
+		if (smoother_) {
+			while (smoother_->Drain(&smoothed_)) {
+				WriteSmoothed();
+			}
+		}
+	}
+
+	bool Flush() {
+		if (!out_) {
+			return true;
+		}
+		bool ok = fwrite(&buffer_[0], 1, used_, out_) == used_;
+		used_ = 0;
+		return ok;
+	}
+
+	void PrintSummary() const {
+		const Eigen::Vector4d rmse = rmse_.RMSE();
+		std::cout << "Replayed " << lines_ - skipped_ << " measurements";
+		if (skipped_) {
+			std::cout << " (" << skipped_ << " malformed lines skipped)";
+		}
+		std::cout << std::endl
+			<< "RMSE " << rmse(0) << " " << rmse(1) << " " << rmse(2) << " " << rmse(3) << std::endl;
+		if (smoother_) {
+			const Eigen::Vector4d smoothed = smoothed_rmse_.RMSE();
+			std::cout << "Smoothed RMSE (lag " << smoother_->lag() << ") " << smoothed(0) << " "
+				<< smoothed(1) << " " << smoothed(2) << " " << smoothed(3) << std::endl;
+		}
+		if (imm_) {
+			std::cout << "Model probabilities";
+			for (int j = 0; j < MotionIMM::n_models_; j++) {
+				std::cout << " " << MotionIMM::ModelName(j) << " " << imm_->mu_(j);
+			}
+			std::cout << std::endl;
+		}
+		std::cout
+			<< "Radar NIS within bounds: " << 100.0 * radar_nis_.TotalFraction() << "%" << std::endl
+			<< "Laser NIS within bounds: " << 100.0 * laser_nis_.TotalFraction() << "%" << std::endl;
+	}
+
+	size_t measurements() const { return lines_ - skipped_; }
+	size_t skipped() const { return skipped_; }
+
+	///* fills in the counts, RMSE and NIS consistency of report
+	void Report(ReplayReport *report) const {
+		report->measurements = measurements();
+		report->skipped = skipped_;
+		report->lidar_measurements = lidar_;
+		report->radar_measurements = radar_;
+		report->lidar_updates = laser_nis_.count();
+		report->radar_updates = radar_nis_.count();
+		Eigen::Map<Eigen::Vector4d>(report->rmse) = rmse_.RMSE();
+		report->radar_nis_within = radar_nis_.TotalFraction();
+		report->laser_nis_within = laser_nis_.TotalFraction();
+	}
+	Eigen::Vector4d RMSE() const { return rmse_.RMSE(); }
+	const NISMonitor &radar_nis() const { return radar_nis_; }
+	const NISMonitor &laser_nis() const { return laser_nis_; }
+
+	CACHE_ALIGNED_OPERATOR_NEW
+
+private:
+	///* ground truth of a timestamp, kept until its smoothed state is out
+	struct Truth {
+		long long timestamp;
+		double values[4];
+	};
+
+	Filter ukf_;
+	///* replaces ukf_ when set
+	std::unique_ptr<MotionIMM> imm_;
+	MeasurementPackage meas_package_;
+	Eigen::Vector4d ground_truth_;
+	RunningRMSE rmse_;
+	NISMonitor radar_nis_;
+	NISMonitor laser_nis_;
+
+	std::unique_ptr<FixedLagSmoother> smoother_;
+	FixedLagSmoother::SmoothedState smoothed_;
+	RunningRMSE smoothed_rmse_;
+	///* ring of the ground truths of the steps in the smoother's window
+	std::vector<Truth> truths_;
+	size_t truth_head_;
+	size_t truth_size_;
+
+	FILE *out_;
+	///* formatted output lines; one line is far shorter than the 256 spare bytes
+	std::vector<char> buffer_;
+	size_t used_;
+
+	size_t lines_;
+	size_t skipped_;
+	///* measurements of each sensor
+	size_t lidar_;
+	size_t radar_;
+
+	std::vector<double> *estimates_;
+	std::vector<double> *ground_truths_;
+
+	void PushTruth() {
+		Truth *last = truth_size_ ? &truths_[(truth_head_ + truth_size_ - 1) % truths_.size()] : nullptr;
+		if (!last || last->timestamp != meas_package_.timestamp_) {
+			if (truth_size_ == truths_.size()) {
+				//cannot happen: the smoother holds at most lag + 1 steps
+				truth_head_ = (truth_head_ + 1) % truths_.size();
+				truth_size_--;
+			}
+			last = &truths_[(truth_head_ + truth_size_++) % truths_.size()];
+			last->timestamp = meas_package_.timestamp_;
+		}
+		Eigen::Map<Eigen::Vector4d>(last->values) = ground_truth_;
+	}
+
+	///* steps the smoother with meas_package_; true if a smoothed state is out
+	bool Smooth();
+
+	void WriteSmoothed() {
+		const FixedLagSmoother::SmoothedState &s = smoothed_;
+		while (truth_size_ && truths_[truth_head_].timestamp < s.timestamp) {
+			truth_head_ = (truth_head_ + 1) % truths_.size();
+			truth_size_--;
+		}
+		Eigen::Vector4d estimate;
+		estimate << s.x(0), s.x(1), cos(s.x(3))*s.x(2), sin(s.x(3))*s.x(2);
+		if (truth_size_ && truths_[truth_head_].timestamp == s.timestamp) {
+			smoothed_rmse_.Add(estimate, Eigen::Map<const Eigen::Vector4d>(truths_[truth_head_].values));
+			truth_head_ = (truth_head_ + 1) % truths_.size();
+			truth_size_--;
+		}
+		if (!out_) {
+			return;
+		}
+		const Eigen::Vector4d rmse = smoothed_rmse_.RMSE();
+
+		char *p = &buffer_[used_];
+		p += sprintf(p, "%lld", s.timestamp);
+		for (int i = 0; i < 5; i++) {
+			*p++ = ' ';
+			p = FormatFixed(p, s.x(i));
+		}
+		for (int i = 0; i < 4; i++) {
+			*p++ = ' ';
+			p = FormatFixed(p, rmse(i));
+		}
+		*p++ = '\n';
+		used_ = p - &buffer_[0];
+		if (used_ >= kChunkSize) {
+			Flush();
+		}
+	}
+};
+
+template <>
+bool FilterReplayer<CTRVUKF>::Smooth() {
+	return smoother_->Process(ukf_, meas_package_, &smoothed_);
+}
+
+template <class Filter>
+bool FilterReplayer<Filter>::Smooth() {
+	return false;
+}
+
+typedef FilterReplayer<CTRVUKF> Replayer;
+
+/**
+* Runs the scans of a scene, consecutive lines of one sensor and timestamp,
+* through a Tracker and writes one line per detection with the track it went
+* to and that track's estimate:
+*
+*   timestamp sensor track p_x p_y v yaw yaw_rate
+*/
+class SceneReplayer {
+public:
+	explicit SceneReplayer(FILE *out)
+		: out_(out), buffer_(kChunkSize + 256), used_(0), lines_(0), skipped_(0),
+		  scans_(0), seconds_(0.0), last_allocating_scan_(0) {}
+
+	const char *Consume(const char *begin, const char *end) {
+		const char *line = begin;
+		const char *newline;
+		while ((newline = static_cast<const char *>(memchr(line, '\n', end - line)))) {
+			ConsumeLine(line, newline);
+			line = newline + 1;
+		}
+		return line;
+	}
+
+	void ConsumeLine(const char *begin, const char *end) {
+		if (begin == end || *begin == '#' || *begin == '\r') {
+			return;
+		}
+		lines_++;
+		MeasurementPackage meas_package;
+		Eigen::Vector4d ground_truth;
+		if (!ParseMeasurementLine(begin, end, &meas_package, &ground_truth)) {
+			skipped_++;
+			return;
+		}
+		lines_--;
+		ConsumeMeasurement(meas_package, &ground_truth);
+	}
+
+	void ConsumeMeasurement(const MeasurementPackage &meas_package, const Eigen::Vector4d *ground_truth) {
+		lines_++;
+		if (!scan_.empty() && (meas_package.timestamp_ != scan_[0].timestamp_
+		                       || meas_package.sensor_type_ != scan_[0].sensor_type_)) {
+			ProcessScan();
+		}
+		scan_.push_back(meas_package);
+		truths_.push_back(ground_truth ? *ground_truth : Eigen::Vector4d::Zero());
+		has_truth_.push_back(ground_truth != nullptr);
+	}
+
+	///* the last scan, at the end of the data
+	void Finish() {
+		if (!scan_.empty()) {
+			ProcessScan();
+		}
+	}
+
+	bool Flush() {
+		bool ok = fwrite(&buffer_[0], 1, used_, out_) == used_;
+		used_ = 0;
+		return ok;
+	}
+
+	void PrintSummary() const {
+		const Eigen::Vector4d rmse = rmse_.RMSE();
+		std::cout << "Tracked " << lines_ - skipped_ << " detections in " << scans_ << " scans";
+		if (skipped_) {
+			std::cout << " (" << skipped_ << " malformed lines skipped)";
+		}
+		std::cout << std::endl
+			<< "Assigned " << tracker_.assigned() << ", tracks started " << tracker_.spawned()
+			<< ", dropped " << tracker_.dropped() << ", live " << tracker_.size() << std::endl
+			<< "RMSE of the updated tracks " << rmse(0) << " " << rmse(1) << " " << rmse(2) << " " << rmse(3) << std::endl
+			<< "Tracker time per scan " << (scans_ ? 1e6 * seconds_ / scans_ : 0.0) << " us" << std::endl;
+#ifdef UKF_CHECK_ALLOCATIONS
+		std::cout << "Tracker allocation-free for the last " << scans_ - last_allocating_scan_
+			<< " scans, " << tracker_.pool().slots() << " tracks pooled" << std::endl;
+#endif
+	}
+
+	Tracker &tracker() { return tracker_; }
+
+private:
+	Tracker tracker_;
+	std::vector<MeasurementPackage> scan_;
+	std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > truths_;
+	std::vector<char> has_truth_;
+	RunningRMSE rmse_;
+
+	FILE *out_;
+	std::vector<char> buffer_;
+	size_t used_;
+
+	size_t lines_;
+	size_t skipped_;
+	size_t scans_;
+	double seconds_;
+	///* the last scan in which the tracker allocated, counted from 1
+	size_t last_allocating_scan_;
+
+	void ProcessScan() {
+		const long allocations = AllocationCounter::Count();
+		auto start = std::chrono::steady_clock::now();
+		tracker_.ProcessScan(&scan_[0], scan_.size());
+		seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		scans_++;
+		if (AllocationCounter::Count() != allocations) {
+			last_allocating_scan_ = scans_;
+		}
+
+		const bool radar = scan_[0].sensor_type_ == MeasurementPackage::RADAR;
+		const std::vector<const Track *> &tracks = tracker_.detection_tracks();
+		for (size_t d = 0; d < scan_.size(); d++) {
+			const Track &track = *tracks[d];
+			const CTRVUKF::StateVector &x = track.filter.x_;
+			if (track.hits > 1 && has_truth_[d]) {
+				rmse_.Add(CartesianEstimate(x.data()), truths_[d]);
+			}
+
+			char *p = &buffer_[used_];
+			p += sprintf(p, "%lld %c %d", scan_[d].timestamp_, radar ? 'R' : 'L', track.id);
+			for (int i = 0; i < 5; i++) {
+				*p++ = ' ';
+				p = FormatFixed(p, x(i));
+			}
+			*p++ = '\n';
+			used_ = p - &buffer_[0];
+			if (used_ >= kChunkSize) {
+				Flush();
+			}
+		}
+		scan_.clear();
+		truths_.clear();
+		has_truth_.clear();
+	}
+};
+
+/**
+* Reads the measurements of a sequence and their ground truth into memory,
+* for replaying it more than once.
+*/
+class SequenceReader {
+public:
+	SequenceReader() : lines_(0), skipped_(0) {}
+
+	const char *Consume(const char *begin, const char *end) {
+		const char *line = begin;
+		const char *newline;
+		while ((newline = static_cast<const char *>(memchr(line, '\n', end - line)))) {
+			ConsumeLine(line, newline);
+			line = newline + 1;
+		}
+		return line;
+	}
+
+	void ConsumeLine(const char *begin, const char *end) {
+		if (begin == end || *begin == '#' || *begin == '\r') {
+			return;
+		}
+		lines_++;
+		MeasurementPackage meas_package;
+		Eigen::Vector4d ground_truth;
+		if (!ParseMeasurementLine(begin, end, &meas_package, &ground_truth)) {
+			skipped_++;
+			return;
+		}
+		lines_--;
+		ConsumeMeasurement(meas_package, &ground_truth);
+	}
+
+	///* a measurement without ground truth is compared against zero
+	void ConsumeMeasurement(const MeasurementPackage &meas_package, const Eigen::Vector4d *ground_truth) {
+		lines_++;
+		measurements_.push_back(meas_package);
+		truths_.push_back(ground_truth ? *ground_truth : Eigen::Vector4d::Zero());
+	}
+
+	void Finish() {}
+
+	const std::vector<MeasurementPackage> &measurements() const { return measurements_; }
+	const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &truths() const { return truths_; }
+
+private:
+	std::vector<MeasurementPackage> measurements_;
+	std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > truths_;
+	size_t lines_;
+	size_t skipped_;
+};
+
+/**
+* Accuracy of one sequence replayed through a UKFBatch
+*/
+struct BatchAccuracy {
+	RunningRMSE rmse;
+	double radar_nis_sum;
+	double laser_nis_sum;
+	size_t radar_count;
+	size_t laser_count;
+
+	BatchAccuracy() : radar_nis_sum(0.0), laser_nis_sum(0.0), radar_count(0), laser_count(0) {}
+
+	double RadarNISMean() const { return radar_count ? radar_nis_sum / radar_count : 0.0; }
+	double LaserNISMean() const { return laser_count ? laser_nis_sum / laser_count : 0.0; }
+};
+
+/**
+* Accuracy of one sequence replayed with one configuration of a sweep
+*/
+struct SweepAccuracy {
+	RunningRMSE rmse;
+	size_t radar_within;
+	size_t laser_within;
+	size_t radar_count;
+	size_t laser_count;
+
+	SweepAccuracy() : radar_within(0), laser_within(0), radar_count(0), laser_count(0) {}
+};
+
+///* the covariances a batch factored one at a time (UKFBatch::indefinite_);
+///* the CUDA engine does not count them
+unsigned long long Indefinite(const DoubleUKFBatch &batch) {
+	return batch.indefinite_;
+}
+
+template <class Batch>
+unsigned long long Indefinite(const Batch &) {
+	return 0;
+}
+
+/**
+* Replays the sequences as the tracks of one Batch, every step taking the
+* next measurement of each sequence that has one, into the accuracy of each
+* sequence. Returns the seconds spent in the filter.
+*/
+template <class Batch>
+double ReplayBatch(const std::vector<SequenceReader> &sequences, std::vector<BatchAccuracy> *accuracy,
+                   bool approximate_radar = false) {
+	Batch batch(sequences.size());
+	batch.approximate_radar_ = approximate_radar;
+	size_t longest = 0;
+	for (size_t i = 0; i < sequences.size(); i++) {
+		batch.AddTrack();
+		longest = std::max(longest, sequences[i].measurements().size());
+	}
+	accuracy->assign(sequences.size(), BatchAccuracy());
+
+	std::vector<size_t> tracks;
+	std::vector<MeasurementPackage> step;
+	double seconds = 0.0;
+	for (size_t k = 0; k < longest; k++) {
+		tracks.clear();
+		step.clear();
+		for (size_t i = 0; i < sequences.size(); i++) {
+			if (k < sequences[i].measurements().size()) {
+				tracks.push_back(i);
+				step.push_back(sequences[i].measurements()[k]);
+			}
+		}
+		auto start = std::chrono::steady_clock::now();
+		batch.ProcessMeasurements(&tracks[0], &step[0], step.size());
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		for (size_t j = 0; j < tracks.size(); j++) {
+			const size_t i = tracks[j];
+			BatchAccuracy &a = (*accuracy)[i];
+			const Eigen::Matrix<double, 5, 1> x = batch.State(i);
+			const Eigen::Vector4d estimate = CartesianEstimate(x.data());
+			a.rmse.Add(estimate, sequences[i].truths()[k]);
+			//the first measurement of a track initializes it
+			if (k == 0) {
+				continue;
+			}
+			if (step[j].sensor_type_ == MeasurementPackage::RADAR) {
+				a.radar_nis_sum += batch.NIS_radar_[i];
+				a.radar_count++;
+			}
+			else {
+				a.laser_nis_sum += batch.NIS_laser_[i];
+				a.laser_count++;
+			}
+		}
+	}
+	return seconds;
+}
+
+/**
+* The filter of one side of a differential check (RunDiffCheck): a track per
+* sequence, stepped in lockstep as the tracks of ReplayBatch are.
+*/
+class LockstepFilter {
+public:
+	virtual ~LockstepFilter() {}
+
+	virtual void Step(const size_t *tracks, const MeasurementPackage *measurements, size_t count) = 0;
+	virtual Eigen::Matrix<double, 5, 1> State(size_t track) const = 0;
+	virtual double NIS(size_t track, MeasurementPackage::SensorType sensor) const = 0;
+};
+
+///* a Filter per track
+template <class Filter>
+class LockstepFilters : public LockstepFilter {
+public:
+	LockstepFilters(size_t tracks, const UKFConfig &config, bool square_root) {
+		for (size_t i = 0; i < tracks; i++) {
+			filters_.emplace_back(new Filter(config));
+			filters_.back()->use_square_root_ = square_root;
+		}
+	}
+
+	void Step(const size_t *tracks, const MeasurementPackage *measurements, size_t count) {
+		for (size_t j = 0; j < count; j++) {
+			filters_[tracks[j]]->ProcessMeasurement(measurements[j]);
+		}
+	}
+
+	Eigen::Matrix<double, 5, 1> State(size_t track) const {
+		return filters_[track]->x_;
+	}
+
+	double NIS(size_t track, MeasurementPackage::SensorType sensor) const {
+		return sensor == MeasurementPackage::RADAR ? filters_[track]->NIS_radar_ : filters_[track]->NIS_laser_;
+	}
+
+private:
+	std::vector<std::unique_ptr<Filter> > filters_;
+};
+
+///* UKFBatch::approximate_radar_, which the CUDA engine does not have
+void SetApproximateRadar(DoubleUKFBatch &batch, bool approximate_radar) {
+	batch.approximate_radar_ = approximate_radar;
+}
+
+void SetApproximateRadar(FloatUKFBatch &batch, bool approximate_radar) {
+	batch.approximate_radar_ = approximate_radar;
+}
+
+template <class Batch>
+void SetApproximateRadar(Batch &, bool) {}
+
+///* the tracks of one Batch
+template <class Batch>
+class LockstepBatch : public LockstepFilter {
+public:
+	LockstepBatch(size_t tracks, bool approximate_radar) : batch_(tracks) {
+		SetApproximateRadar(batch_, approximate_radar);
+		for (size_t i = 0; i < tracks; i++) {
+			batch_.AddTrack();
+		}
+	}
+
+	void Step(const size_t *tracks, const MeasurementPackage *measurements, size_t count) {
+		batch_.ProcessMeasurements(tracks, measurements, count);
+	}
+
+	Eigen::Matrix<double, 5, 1> State(size_t track) const {
+		return batch_.State(track);
+	}
+
+	double NIS(size_t track, MeasurementPackage::SensorType sensor) const {
+		return sensor == MeasurementPackage::RADAR ? batch_.NIS_radar_[track] : batch_.NIS_laser_[track];
+	}
+
+private:
+	Batch batch_;
+};
+
+///* the profile of the linearized candidate: the default one with
+///* linearize_radar_ at the 0.1 the README measures
+const UKFConfig &LinearizedConfig() {
+	const UKFConfig &d = UKFConfig::Default();
+	static const UKFConfig config(d.std_a_, d.std_yawdd_, d.std_laspx_, d.std_laspy_, d.std_radr_, d.std_radphi_,
+	                              d.std_radrd_, d.use_laser_, d.use_radar_, d.gate_laser_, d.gate_radar_, 0.1);
+	return config;
+}
+
+///* the fast path of RunDiffCheck named candidate, or null if there is none
+///* of that name in this build
+LockstepFilter *NewCandidate(const std::string &candidate, size_t tracks) {
+	const UKFConfig &config = UKFConfig::Default();
+	if (candidate == "ctrv") {
+		return new LockstepFilters<CTRVUKF>(tracks, config, false);
+	}
+	if (candidate == "square-root") {
+		return new LockstepFilters<UKF<5, 7> >(tracks, config, true);
+	}
+	if (candidate == "inverse") {
+		return new LockstepFilters<UKF<5, 7, InverseSolver> >(tracks, config, false);
+	}
+	if (candidate == "kernels") {
+		return new LockstepFilters<UKF<5, 7, SmallMatrixSolver, CTRVSigmaPoints> >(tracks, config, false);
+	}
+	if (candidate == "simplex") {
+		return new LockstepFilters<UKF<5, 7, LdltSolver, SimplexSigmaPoints<7> > >(tracks, config, false);
+	}
+	if (candidate == "cubature") {
+		return new LockstepFilters<UKF<5, 7, LdltSolver, CubatureSigmaPoints<7> > >(tracks, config, false);
+	}
+	if (candidate == "linearized") {
+		return new LockstepFilters<UKF<5, 7> >(tracks, LinearizedConfig(), false);
+	}
+	if (candidate == "batch") {
+		return new LockstepBatch<DoubleUKFBatch>(tracks, false);
+	}
+	if (candidate == "float-batch") {
+		return new LockstepBatch<FloatUKFBatch>(tracks, false);
+	}
+	if (candidate == "approximate-radar") {
+		return new LockstepBatch<DoubleUKFBatch>(tracks, true);
+	}
+#ifdef UKF_CUDA
+	if (candidate == "cuda" && DoubleCudaUKFBatch::Available()) {
+		return new LockstepBatch<DoubleCudaUKFBatch>(tracks, false);
+	}
+#endif
+	return nullptr;
+}
+
+///* a step of RunDiffCheck where the candidate's state diverged from the
+///* reference's
+struct Divergence {
+	double divergence;
+	size_t sequence;
+	size_t step;
+	int component;
+	double reference;
+	double candidate;
+
+	bool operator<(const Divergence &other) const { return divergence > other.divergence; }
+};
+
+/**
+* Replays a file that can be memory-mapped in one piece.
+*/
+template <class Replayer>
+bool ReplayMapped(int fd, size_t size, Replayer &replayer) {
+	void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+	const char *begin = static_cast<const char *>(data);
+	const char *end = begin + size;
+	const char *tail = replayer.Consume(begin, end);
+	replayer.ConsumeLine(tail, end);
+	munmap(data, size);
+	return true;
+}
+
+/**
+* Replays any readable descriptor chunk by chunk, carrying the incomplete
+* last line of each chunk over to the next.
+*/
+template <class Replayer>
+void ReplayChunked(int fd, Replayer &replayer) {
+	std::vector<char> chunk(2 * kChunkSize);
+	size_t carried = 0;
+	for (;;) {
+		if (carried == chunk.size()) {
+			//a line longer than the buffer, grow it
+			chunk.resize(2 * chunk.size());
+		}
+		ssize_t n = read(fd, &chunk[carried], chunk.size() - carried);
+		if (n <= 0) {
+			break;
+		}
+		const char *begin = &chunk[0];
+		const char *end = begin + carried + n;
+		const char *tail = replayer.Consume(begin, end);
+		carried = end - tail;
+		memmove(&chunk[0], tail, carried);
+	}
+	replayer.ConsumeLine(&chunk[0], &chunk[0] + carried);
+}
+
+/**
+* The blocks of a log in order, or those of a Span. Those of a compressed log are inflated a
+* window at a time, kWindow blocks per thread, on a TaskPool of all cores:
+* the next window on a thread of its own while the caller replays the one
+* before, so that inflating keeps up with the filter rather than holding it.
+*/
+class LogBlockReader {
+public:
+	static const size_t kWindow = 2;
+
+	explicit LogBlockReader(const MeasurementLog &log)
+		: LogBlockReader(log, 0, log.blocks()) {}
+
+	///* the blocks [begin, end)
+	LogBlockReader(const MeasurementLog &log, size_t begin, size_t end)
+		: log_(&log), window_(0), begin_(begin), end_(std::min(end, log.blocks())), next_(begin), window_begin_(begin),
+		  window_end_(begin), failed_(false) {
+		if (!log.compressed() || begin_ >= end_) {
+			return;
+		}
+		pool_.reset(new TaskPool(std::max(1u, std::thread::hardware_concurrency())));
+		window_ = kWindow * pool_->threads();
+		const size_t block_words = measurement_log::BlockSize(log.capacity()) / 8;
+		for (int w = 0; w < 2; w++) {
+			buffers_[w].resize(window_ * block_words);
+			blocks_[w].resize(window_);
+			inflated_[w].resize(window_);
+		}
+		Start(begin_);
+	}
+
+	~LogBlockReader() {
+		if (inflating_.joinable()) {
+			inflating_.join();
+		}
+	}
+
+	/**
+	* The next block, until the last; valid until the call after the next
+	* window is entered.
+	* @return null after the last, or where a block is corrupt (see failed)
+	*/
+	const MeasurementLog::Block *Next() {
+		if (next_ >= end_ || failed_) {
+			return nullptr;
+		}
+		if (!pool_) {
+			return &log_->block(next_++);
+		}
+		if (next_ == window_end_) {
+			//the window being inflated becomes current, and the one after
+			//starts in the buffers of the one replayed
+			inflating_.join();
+			window_begin_ = window_end_;
+			window_end_ = std::min(window_begin_ + window_, end_);
+			if (window_end_ < end_) {
+				Start(window_end_);
+			}
+		}
+		const size_t w = (window_begin_ - begin_) / window_ % 2;
+		const size_t i = next_ - window_begin_;
+		if (!inflated_[w][i]) {
+			failed_ = true;
+			return nullptr;
+		}
+		next_++;
+		return &blocks_[w][i];
+	}
+
+	///* whether a block could not be inflated
+	bool failed() const { return failed_; }
+
+private:
+	const MeasurementLog *log_;
+	std::unique_ptr<TaskPool> pool_;
+	std::thread inflating_;
+	size_t window_;
+	size_t begin_;
+	size_t end_;
+	///* the block Next returns, and the window it is in
+	size_t next_;
+	size_t window_begin_;
+	size_t window_end_;
+	bool failed_;
+	///* two windows, by their first block's window's parity
+	std::vector<uint64_t> buffers_[2];
+	std::vector<MeasurementLog::Block> blocks_[2];
+	std::vector<char> inflated_[2];
+
+	///* inflates the window starting at block begin on inflating_
+	void Start(size_t begin) {
+		inflating_ = std::thread([this, begin]() {
+			const size_t w = (begin - begin_) / window_ % 2;
+			const size_t end = std::min(begin + window_, end_);
+			const size_t block_words = measurement_log::BlockSize(log_->capacity()) / 8;
+			pool_->ParallelFor(end - begin, 1, [this, w, begin, block_words](size_t first, size_t last) {
+				for (size_t i = first; i < last; i++) {
+					char *buffer = reinterpret_cast<char *>(&buffers_[w][i * block_words]);
+					inflated_[w][i] = log_->Inflate(begin + i, buffer, &blocks_[w][i]);
+				}
+			});
+		});
+	}
+
+	LogBlockReader(const LogBlockReader &);
+	LogBlockReader &operator=(const LogBlockReader &);
+};
+
+const size_t LogBlockReader::kWindow;
+
+/**
+* Replays the measurement log at path, without parsing.
+*/
+template <class Replayer>
+bool ReplayLog(const char *path, Replayer &replayer) {
+	MeasurementLog log;
+	if (!log.Open(path)) {
+		return false;
+	}
+	MeasurementPackage meas_package;
+	Eigen::Vector4d ground_truth;
+	LogBlockReader blocks(log);
+	while (const MeasurementLog::Block *block = blocks.Next()) {
+		for (size_t i = 0; i < block->count; i++) {
+			const bool has_ground_truth = MeasurementLog::Get(*block, i, &meas_package, &ground_truth);
+			replayer.ConsumeMeasurement(meas_package, has_ground_truth ? &ground_truth : nullptr);
+		}
+	}
+	return !blocks.failed();
+}
+
+/**
+* Replays the measurements of window.track in the window of the measurement
+* log at path, the blocks found in its time index, after warming the filter
+* up on those of the warm-up before.
+*/
+template <class Replayer>
+bool ReplayLogWindow(const char *path, const ReplayWindow &window, Replayer &replayer) {
+	MeasurementLog log;
+	if (!log.Open(path)) {
+		return false;
+	}
+	const int64_t warm = window.from_us - window.warmup_us;
+	size_t begin, end;
+	log.Span(warm, window.to_us, &begin, &end);
+	MeasurementPackage meas_package;
+	Eigen::Vector4d ground_truth;
+	LogBlockReader blocks(log, begin, end);
+	while (const MeasurementLog::Block *block = blocks.Next()) {
+		for (size_t i = 0; i < block->count; i++) {
+			if ((window.track >= 0 && block->track[i] != window.track) || block->timestamp[i] < warm
+			    || block->timestamp[i] > window.to_us) {
+				continue;
+			}
+			const bool has_ground_truth = MeasurementLog::Get(*block, i, &meas_package, &ground_truth);
+			if (meas_package.timestamp_ < window.from_us) {
+				replayer.WarmUp(meas_package);
+			}
+			else {
+				replayer.ConsumeMeasurement(meas_package, has_ground_truth ? &ground_truth : nullptr);
+			}
+		}
+	}
+	return !blocks.failed();
+}
+
+/**
+* Replays the file at path, from memory if it can be mapped; a measurement
+* log is replayed from its columns.
+*/
+template <class Replayer>
+bool ReplayFile(const char *path, Replayer &replayer) {
+	if (strcmp(path, "-") != 0 && MeasurementLog::IsLog(path)) {
+		return ReplayLog(path, replayer);
+	}
+	int fd = strcmp(path, "-") == 0 ? 0 : open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0
+		|| !ReplayMapped(fd, st.st_size, replayer)) {
+		ReplayChunked(fd, replayer);
+	}
+	if (fd != 0) {
+		close(fd);
+	}
+	return true;
+}
+
+///* the counts of a replay of that many measurements, per measurement
+void PrintPerfCounters(const PerfCounters &counters, size_t measurements, std::ostream &out) {
+	out << "Per measurement:";
+	for (int i = 0; i < PerfCounters::EVENTS && measurements; i++) {
+		const PerfCounters::Event event = PerfCounters::Event(i);
+		if (counters.available(event)) {
+			out << " " << PerfCounters::Name(event) << " " << double(counters.Read(event)) / measurements;
+		}
+	}
+	if (counters.available(PerfCounters::CYCLES) && counters.available(PerfCounters::INSTRUCTIONS)) {
+		out << ", IPC " << counters.IPC();
+	}
+	out << std::endl;
+}
+
+///* RunReplay through a filter of type Filter
+template <class Filter>
+int RunFilterReplay(const char *input_path, const char *output_path, size_t smooth_lag, bool imm,
+                    const ReplayWindow *window, bool perf_counters, const char *report_path,
+                    const char *filter_name) {
+	if (window && (strcmp(input_path, "-") == 0 || !MeasurementLog::IsLog(input_path))) {
+		std::cerr << "A window is only replayed from a measurement log" << std::endl;
+		return 1;
+	}
+	if (strcmp(input_path, "-") != 0 && MeasurementLog::IsLog(input_path)) {
+		MeasurementLog log;
+		if (log.Open(input_path) && log.tracks() > 1 && !(window && window->track >= 0)) {
+			std::cerr << input_path << " records " << log.tracks() << " tracks, replay it with --replay-batch" << std::endl;
+			return 1;
+		}
+	}
+	FILE *out = strcmp(output_path, "-") == 0 ? stdout : fopen(output_path, "w");
+	if (!out) {
+		std::cerr << "Cannot open " << output_path << " for writing" << std::endl;
+		return 1;
+	}
+
+	FilterReplayer<Filter> replayer(out, smooth_lag, imm);
+	fputs(smooth_lag ? "# timestamp p_x p_y v yaw yaw_rate rmse_x rmse_y rmse_vx rmse_vy\n"
+	                 : "# timestamp sensor p_x p_y v yaw yaw_rate NIS rmse_x rmse_y rmse_vx rmse_vy\n", out);
+	PerfCounters counters;
+	if (perf_counters && !counters.Open()) {
+		std::cerr << "No hardware performance counters available" << std::endl;
+	}
+	const long allocations = AllocationCounter::Count();
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	counters.Start();
+	if (!(window ? ReplayLogWindow(input_path, *window, replayer) : ReplayFile(input_path, replayer))) {
+		std::cerr << "Cannot open " << input_path << std::endl;
+		if (out != stdout) {
+			fclose(out);
+		}
+		return 1;
+	}
+
+	replayer.Finish();
+	counters.Stop();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	bool ok = replayer.Flush();
+	if (out != stdout) {
+		ok = fclose(out) == 0 && ok;
+	}
+	else {
+		ok = fflush(out) == 0 && ok;
+	}
+	if (!ok) {
+		std::cerr << "Cannot write " << output_path << std::endl;
+		return 1;
+	}
+	if (out != stdout) {
+		replayer.PrintSummary();
+	}
+	if (perf_counters) {
+		PrintPerfCounters(counters, replayer.measurements(), out != stdout ? std::cout : std::cerr);
+	}
+	if (report_path) {
+		ReplayReport report;
+		report.input = input_path;
+		report.filter = imm ? "MotionIMM" : std::string(filter_name) + " with " + CTRVSigmaPoints::Name() + " sigma points";
+		if (smooth_lag) {
+			report.filter += ", smoothed with lag " + std::to_string(smooth_lag);
+		}
+		if (window) {
+			report.filter += ", window " + std::to_string(window->from_us) + " to " + std::to_string(window->to_us) + " us";
+		}
+		report.seconds = seconds;
+#ifdef UKF_CHECK_ALLOCATIONS
+		report.allocations = AllocationCounter::Count() - allocations;
+#else
+		(void) allocations;
+#endif
+		report.counters = counters.available(PerfCounters::CYCLES) || counters.available(PerfCounters::INSTRUCTIONS)
+			? &counters : nullptr;
+		replayer.Report(&report);
+		report.Print(out != stdout ? std::cout : std::cerr);
+		if (!report.Write(report_path)) {
+			std::cerr << "Cannot write " << report_path << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+}
+
+int RunReplay(const char *input_path, const char *output_path, size_t smooth_lag, bool imm, ReplaySensors sensors,
+              const ReplayWindow *window, bool perf_counters, const char *report_path) {
+	// the filters of one sensor are specialized for it (see sensor_set.h)
+	if (sensors == REPLAY_LASER) {
+		return RunFilterReplay<LaserCTRVUKF>(input_path, output_path, 0, imm, window, perf_counters, report_path,
+		                                     "LaserCTRVUKF");
+	}
+	if (sensors == REPLAY_RADAR) {
+		return RunFilterReplay<RadarCTRVUKF>(input_path, output_path, 0, imm, window, perf_counters, report_path,
+		                                     "RadarCTRVUKF");
+	}
+	return RunFilterReplay<CTRVUKF>(input_path, output_path, smooth_lag, imm, window, perf_counters, report_path,
+	                                "CTRVUKF");
+}
+
+int RunTrackReplay(const char *input_path, const char *output_path, int threads) {
+	FILE *out = strcmp(output_path, "-") == 0 ? stdout : fopen(output_path, "w");
+	if (!out) {
+		std::cerr << "Cannot open " << output_path << " for writing" << std::endl;
+		return 1;
+	}
+
+	std::unique_ptr<SceneReplayer> replayer(new SceneReplayer(out));
+	std::unique_ptr<TaskPool> pool;
+	if (threads > 1) {
+		pool.reset(new TaskPool(threads));
+		replayer->tracker().set_task_pool(pool.get());
+	}
+	fputs("# timestamp sensor track p_x p_y v yaw yaw_rate\n", out);
+	if (!ReplayFile(input_path, *replayer)) {
+		std::cerr << "Cannot open " << input_path << std::endl;
+		if (out != stdout) {
+			fclose(out);
+		}
+		return 1;
+	}
+
+	replayer->Finish();
+	bool ok = replayer->Flush();
+	if (out != stdout) {
+		ok = fclose(out) == 0 && ok;
+	}
+	else {
+		ok = fflush(out) == 0 && ok;
+	}
+	if (!ok) {
+		std::cerr << "Cannot write " << output_path << std::endl;
+		return 1;
+	}
+	if (out != stdout) {
+		replayer->PrintSummary();
+	}
+	return 0;
+}
+
+int RunParallelReplay(const std::vector<std::string> &input_paths, int threads) {
+	// all filters are allocated here, one after the other, as a server's
+	// sessions are, so that neighbours replayed on different threads share
+	// cache lines wherever the filter's layout lets them
+	std::vector<std::unique_ptr<Replayer> > replayers;
+	std::vector<std::vector<double> > estimates(input_paths.size());
+	std::vector<std::vector<double> > ground_truths(input_paths.size());
+	for (size_t i = 0; i < input_paths.size(); i++) {
+		replayers.emplace_back(new Replayer(nullptr));
+		replayers[i]->set_samples(&estimates[i], &ground_truths[i]);
+	}
+	std::vector<char> opened(input_paths.size(), 0);
+	std::vector<double> seconds(input_paths.size(), 0.0);
+
+	std::atomic<size_t> next_sequence(0);
+	auto replay = [&]() {
+		size_t i;
+		while ((i = next_sequence++) < input_paths.size()) {
+			auto start = std::chrono::steady_clock::now();
+			opened[i] = ReplayFile(input_paths[i].c_str(), *replayers[i]);
+			seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads && size_t(i) < input_paths.size(); i++) {
+		pool.emplace_back(replay);
+	}
+	replay();
+	for (std::thread &thread : pool) {
+		thread.join();
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int failed = 0;
+	size_t total = 0;
+	size_t consistent = 0;
+	for (size_t i = 0; i < input_paths.size(); i++) {
+		if (!opened[i]) {
+			std::cerr << "Cannot open " << input_paths[i] << std::endl;
+			failed++;
+			continue;
+		}
+		const Replayer &replayer = *replayers[i];
+		const Eigen::Vector4d rmse = replayer.RMSE();
+		const double radar_within = replayer.radar_nis().TotalFraction();
+		const double laser_within = replayer.laser_nis().TotalFraction();
+		printf("%s %zu %.4f %.4f %.4f %.4f %.1f%% %.1f%% %.2fms\n", input_paths[i].c_str(),
+		       replayer.measurements(), rmse(0), rmse(1), rmse(2), rmse(3),
+		       100.0 * radar_within, 100.0 * laser_within, 1000.0 * seconds[i]);
+		total += replayer.measurements();
+		// the bounds are the 5% and 95% points of chi-squared, so a consistent
+		// filter keeps about 90% of its NIS values within them
+		if (radar_within >= 0.85 && laser_within >= 0.85) {
+			consistent++;
+		}
+	}
+	printf("Replayed %zu measurements of %zu sequences on %d threads in %.3f s: %.0f measurements/s\n",
+	       total, input_paths.size() - failed, threads, wall, wall > 0.0 ? total / wall : 0.0);
+	printf("NIS consistent (at least 85%% within bounds): %zu of %zu sequences\n",
+	       consistent, input_paths.size() - failed);
+
+	//the errors of all estimates together, in sequence order
+	std::vector<double> all_estimates;
+	std::vector<double> all_ground_truths;
+	for (size_t i = 0; i < input_paths.size(); i++) {
+		all_estimates.insert(all_estimates.end(), estimates[i].begin(), estimates[i].end());
+		all_ground_truths.insert(all_ground_truths.end(), ground_truths[i].begin(), ground_truths[i].end());
+		std::vector<double>().swap(estimates[i]);
+		std::vector<double>().swap(ground_truths[i]);
+	}
+	const ErrorStats errors = CalculateErrorStats(all_estimates.data(), all_ground_truths.data(),
+	                                              all_estimates.size() / 4, threads);
+	printf("Errors of all %zu estimates with ground truth: p_x p_y v_x v_y\n", errors.count);
+	const Eigen::Vector4d *rows[] = {&errors.rmse, &errors.mae, &errors.max, &errors.p50, &errors.p95, &errors.p99};
+	const char *names[] = {"rmse", "mae", "max", "p50", "p95", "p99"};
+	for (int r = 0; r < 6; r++) {
+		const Eigen::Vector4d &row = *rows[r];
+		printf("  %-4s %.4f %.4f %.4f %.4f\n", names[r], row(0), row(1), row(2), row(3));
+	}
+	return failed ? 1 : 0;
+}
+
+int RunPrecisionCheck(const std::vector<std::string> &input_paths, bool approximate_radar) {
+	std::vector<SequenceReader> sequences(input_paths.size());
+	size_t total = 0;
+	for (size_t i = 0; i < input_paths.size(); i++) {
+		if (!ReplayFile(input_paths[i].c_str(), sequences[i])) {
+			std::cerr << "Cannot open " << input_paths[i] << std::endl;
+			return 1;
+		}
+		total += sequences[i].measurements().size();
+	}
+
+	std::vector<BatchAccuracy> reference, single;
+	const double double_seconds = ReplayBatch<DoubleUKFBatch>(sequences, &reference);
+	const double float_seconds = approximate_radar ? ReplayBatch<DoubleUKFBatch>(sequences, &single, true)
+	                                               : ReplayBatch<FloatUKFBatch>(sequences, &single);
+	const char *candidate = approximate_radar ? "approximate" : "float";
+
+	double worst_rmse = 0.0;
+	double worst_nis = 0.0;
+	for (size_t i = 0; i < sequences.size(); i++) {
+		const Eigen::Vector4d rmse = reference[i].rmse.RMSE();
+		const Eigen::Vector4d delta = (single[i].rmse.RMSE() - rmse).cwiseAbs();
+		const double nis_delta = std::max(fabs(single[i].RadarNISMean() - reference[i].RadarNISMean()),
+		                                  fabs(single[i].LaserNISMean() - reference[i].LaserNISMean()));
+		printf("%s %zu %.4f %.4f %.4f %.4f %.2e %.2e %.2e %.2e %.2e\n", input_paths[i].c_str(),
+		       sequences[i].measurements().size(), rmse(0), rmse(1), rmse(2), rmse(3),
+		       delta(0), delta(1), delta(2), delta(3), nis_delta);
+		worst_rmse = std::max(worst_rmse, delta.maxCoeff());
+		worst_nis = std::max(worst_nis, nis_delta);
+	}
+	printf("Replayed %zu measurements of %zu sequences: double %.0f measurements/s, %s %.0f measurements/s\n",
+	       total, sequences.size(), double_seconds > 0.0 ? total / double_seconds : 0.0,
+	       candidate, float_seconds > 0.0 ? total / float_seconds : 0.0);
+	const bool within = worst_rmse <= kPrecisionRMSETolerance && worst_nis <= kPrecisionNISTolerance;
+	printf("Largest %s - double RMSE difference %.2e (tolerance %.0e), mean NIS difference %.2e (tolerance %.0e): %s\n",
+	       candidate, worst_rmse, kPrecisionRMSETolerance, worst_nis, kPrecisionNISTolerance, within ? "pass" : "FAIL");
+	return within ? 0 : 1;
+}
+
+int RunDiffCheck(const std::vector<std::string> &input_paths, const std::string &candidate,
+                 double rmse_tolerance, double nis_tolerance) {
+	std::vector<SequenceReader> sequences(input_paths.size());
+	size_t total = 0;
+	size_t longest = 0;
+	for (size_t i = 0; i < input_paths.size(); i++) {
+		if (!ReplayFile(input_paths[i].c_str(), sequences[i])) {
+			std::cerr << "Cannot open " << input_paths[i] << std::endl;
+			return 1;
+		}
+		total += sequences[i].measurements().size();
+		longest = std::max(longest, sequences[i].measurements().size());
+	}
+	std::unique_ptr<LockstepFilter> fast(NewCandidate(candidate, sequences.size()));
+	if (!fast) {
+		std::cerr << "No fast path " << candidate << " in this build" << std::endl;
+		return 1;
+	}
+	// the filter of ukf.cpp as it is without any build option
+	LockstepFilters<UKF<5, 7> > reference(sequences.size(), UKFConfig::Default(), false);
+	LockstepFilter *sides[2] = {&reference, fast.get()};
+
+	std::vector<BatchAccuracy> accuracy[2];
+	accuracy[0].assign(sequences.size(), BatchAccuracy());
+	accuracy[1].assign(sequences.size(), BatchAccuracy());
+	std::vector<double> max_divergence(sequences.size(), 0.0), sum_divergence(sequences.size(), 0.0);
+	Eigen::Matrix<double, 5, 1> max_component = Eigen::Matrix<double, 5, 1>::Zero();
+	std::vector<Divergence> worst;
+	double seconds[2] = {0.0, 0.0};
+
+	std::vector<size_t> tracks;
+	std::vector<MeasurementPackage> step;
+	for (size_t k = 0; k < longest; k++) {
+		tracks.clear();
+		step.clear();
+		for (size_t i = 0; i < sequences.size(); i++) {
+			if (k < sequences[i].measurements().size()) {
+				tracks.push_back(i);
+				step.push_back(sequences[i].measurements()[k]);
+			}
+		}
+		for (int side = 0; side < 2; side++) {
+			auto start = std::chrono::steady_clock::now();
+			sides[side]->Step(&tracks[0], &step[0], step.size());
+			seconds[side] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		for (size_t j = 0; j < tracks.size(); j++) {
+			const size_t i = tracks[j];
+			const Eigen::Matrix<double, 5, 1> x[2] = {reference.State(i), fast->State(i)};
+			for (int side = 0; side < 2; side++) {
+				BatchAccuracy &a = accuracy[side][i];
+				a.rmse.Add(CartesianEstimate(x[side].data()), sequences[i].truths()[k]);
+				//the first measurement of a track initializes it
+				if (k == 0) {
+					continue;
+				}
+				const double nis = sides[side]->NIS(i, step[j].sensor_type_);
+				if (step[j].sensor_type_ == MeasurementPackage::RADAR) {
+					a.radar_nis_sum += nis;
+					a.radar_count++;
+				}
+				else {
+					a.laser_nis_sum += nis;
+					a.laser_count++;
+				}
+			}
+
+			Eigen::Matrix<double, 5, 1> delta = x[1] - x[0];
+			delta(3) = NormalizeAngle(delta(3));
+			delta = delta.cwiseAbs();
+			int component;
+			const double divergence = delta.maxCoeff(&component);
+			max_component = max_component.cwiseMax(delta);
+			sum_divergence[i] += divergence;
+			max_divergence[i] = std::max(max_divergence[i], divergence);
+			// the worst steps of all sequences, the smallest of them last
+			if (worst.size() < kDiffWorstSteps || divergence > worst.back().divergence) {
+				Divergence d = {divergence, i, k, component, x[0](component), x[1](component)};
+				worst.insert(std::upper_bound(worst.begin(), worst.end(), d), d);
+				if (worst.size() > kDiffWorstSteps) {
+					worst.pop_back();
+				}
+			}
+		}
+	}
+
+	double worst_rmse = 0.0;
+	double worst_nis = 0.0;
+	for (size_t i = 0; i < sequences.size(); i++) {
+		const size_t n = sequences[i].measurements().size();
+		const Eigen::Vector4d rmse = accuracy[0][i].rmse.RMSE();
+		const Eigen::Vector4d delta = (accuracy[1][i].rmse.RMSE() - rmse).cwiseAbs();
+		const double nis_delta = std::max(fabs(accuracy[1][i].RadarNISMean() - accuracy[0][i].RadarNISMean()),
+		                                  fabs(accuracy[1][i].LaserNISMean() - accuracy[0][i].LaserNISMean()));
+		printf("%s %zu %.2e %.2e %.4f %.4f %.4f %.4f %.2e %.2e %.2e %.2e %.2e\n", input_paths[i].c_str(), n,
+		       max_divergence[i], n ? sum_divergence[i] / n : 0.0, rmse(0), rmse(1), rmse(2), rmse(3),
+		       delta(0), delta(1), delta(2), delta(3), nis_delta);
+		worst_rmse = std::max(worst_rmse, delta.maxCoeff());
+		worst_nis = std::max(worst_nis, nis_delta);
+	}
+	printf("Replayed %zu measurements of %zu sequences: reference %.0f measurements/s, %s %.0f measurements/s\n",
+	       total, sequences.size(), seconds[0] > 0.0 ? total / seconds[0] : 0.0,
+	       candidate.c_str(), seconds[1] > 0.0 ? total / seconds[1] : 0.0);
+	printf("Largest state divergence p_x %.2e p_y %.2e v %.2e yaw %.2e yaw_rate %.2e\n",
+	       max_component(0), max_component(1), max_component(2), max_component(3), max_component(4));
+	const char *names[] = {"p_x", "p_y", "v", "yaw", "yaw_rate"};
+	printf("Worst steps: path step timestamp component reference %s\n", candidate.c_str());
+	for (const Divergence &d : worst) {
+		printf("  %s %zu %lld %s %.9g %.9g\n", input_paths[d.sequence].c_str(), d.step,
+		       (long long) sequences[d.sequence].measurements()[d.step].timestamp_, names[d.component],
+		       d.reference, d.candidate);
+	}
+	const bool within = worst_rmse <= rmse_tolerance && worst_nis <= nis_tolerance;
+	printf("Largest %s - reference RMSE difference %.2e (tolerance %.0e), mean NIS difference %.2e (tolerance %.0e): %s\n",
+	       candidate.c_str(), worst_rmse, rmse_tolerance, worst_nis, nis_tolerance, within ? "pass" : "FAIL");
+	return within ? 0 : 1;
+}
+
+int RunNoiseSweep(const std::vector<std::string> &input_paths, const SweepOptions &options) {
+	std::vector<SequenceReader> sequences(input_paths.size());
+	size_t total = 0;
+	for (size_t i = 0; i < input_paths.size(); i++) {
+		if (!ReplayFile(input_paths[i].c_str(), sequences[i])) {
+			std::cerr << "Cannot open " << input_paths[i] << std::endl;
+			return 1;
+		}
+		total += sequences[i].measurements().size();
+	}
+
+	const UKFConfig &defaults = UKFConfig::Default();
+	std::vector<std::unique_ptr<UKFConfig> > configs;
+	auto add = [&](double std_a, double std_yawdd) {
+		configs.emplace_back(new UKFConfig(std_a, std_yawdd, defaults.std_laspx_, defaults.std_laspy_,
+		                                   defaults.std_radr_, defaults.std_radphi_, defaults.std_radrd_));
+	};
+	if (options.random > 0) {
+		std::mt19937_64 random(options.seed);
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+		for (int i = 0; i < options.random; i++) {
+			const double std_a = options.std_a_from * pow(options.std_a_to / options.std_a_from, unit(random));
+			const double std_yawdd = options.std_yawdd_from
+			                         * pow(options.std_yawdd_to / options.std_yawdd_from, unit(random));
+			add(std_a, std_yawdd);
+		}
+	}
+	else {
+		for (int i = 0; i < options.std_a_steps; i++) {
+			const double std_a = options.std_a_steps > 1
+			                     ? options.std_a_from + (options.std_a_to - options.std_a_from) * i / (options.std_a_steps - 1)
+			                     : options.std_a_from;
+			for (int j = 0; j < options.std_yawdd_steps; j++) {
+				add(std_a, options.std_yawdd_steps > 1
+				           ? options.std_yawdd_from
+				             + (options.std_yawdd_to - options.std_yawdd_from) * j / (options.std_yawdd_steps - 1)
+				           : options.std_yawdd_from);
+			}
+		}
+	}
+
+	// one result per configuration and sequence, so the threads share
+	// nothing they write; the sequences themselves are only read
+	const size_t items = configs.size() * sequences.size();
+	std::vector<SweepAccuracy> accuracy(items);
+	std::atomic<size_t> next_item(0);
+	auto sweep = [&]() {
+		CTRVUKF ukf;
+		NISMonitor radar_nis = NISMonitor::Radar(1, 0.05);
+		NISMonitor laser_nis = NISMonitor::Laser(1, 0.05);
+		size_t k;
+		while ((k = next_item++) < items) {
+			const SequenceReader &sequence = sequences[k % sequences.size()];
+			SweepAccuracy &result = accuracy[k];
+			ukf.set_config(*configs[k / sequences.size()]);
+			ukf.Reset();
+			for (size_t j = 0; j < sequence.measurements().size(); j++) {
+				const MeasurementPackage &meas_package = sequence.measurements()[j];
+				const bool was_initialized = ukf.is_initialized_;
+				ukf.ProcessMeasurement(meas_package);
+				if (was_initialized && meas_package.sensor_type_ == MeasurementPackage::RADAR) {
+					result.radar_within += radar_nis.Add(ukf.NIS_radar_);
+					result.radar_count++;
+				}
+				else if (was_initialized) {
+					result.laser_within += laser_nis.Add(ukf.NIS_laser_);
+					result.laser_count++;
+				}
+				result.rmse.Add(CartesianEstimate(ukf.x_.data()), sequence.truths()[j]);
+			}
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (int i = 1; i < options.threads && size_t(i) < items; i++) {
+		pool.emplace_back(sweep);
+	}
+	sweep();
+	for (std::thread &thread : pool) {
+		thread.join();
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t best = 0;
+	double best_sum = 0.0;
+	bool best_consistent = false;
+	for (size_t c = 0; c < configs.size(); c++) {
+		//the squared errors of all sequences together
+		Eigen::Vector4d squares = Eigen::Vector4d::Zero();
+		size_t count = 0;
+		SweepAccuracy sum;
+		for (size_t i = 0; i < sequences.size(); i++) {
+			const SweepAccuracy &result = accuracy[c * sequences.size() + i];
+			squares += result.rmse.RMSE().cwiseAbs2() * double(result.rmse.count());
+			count += result.rmse.count();
+			sum.radar_within += result.radar_within;
+			sum.laser_within += result.laser_within;
+			sum.radar_count += result.radar_count;
+			sum.laser_count += result.laser_count;
+		}
+		const Eigen::Vector4d rmse = count ? Eigen::Vector4d((squares / double(count)).cwiseSqrt()) : squares;
+		const double radar_within = sum.radar_count ? double(sum.radar_within) / sum.radar_count : 0.0;
+		const double laser_within = sum.laser_count ? double(sum.laser_within) / sum.laser_count : 0.0;
+		printf("%.4f %.4f %.4f %.4f %.4f %.4f %.1f%% %.1f%%\n", configs[c]->std_a_, configs[c]->std_yawdd_,
+		       rmse(0), rmse(1), rmse(2), rmse(3), 100.0 * radar_within, 100.0 * laser_within);
+
+		const bool consistent = radar_within >= 0.85 && laser_within >= 0.85;
+		if (c == 0 || (consistent && !best_consistent) || (consistent == best_consistent && rmse.sum() < best_sum)) {
+			best = c;
+			best_sum = rmse.sum();
+			best_consistent = consistent;
+		}
+	}
+	printf("Swept %zu configurations over %zu sequences of %zu measurements on %d threads in %.3f s: "
+	       "%.0f measurements/s\n", configs.size(), sequences.size(), total, options.threads, wall,
+	       wall > 0.0 ? configs.size() * total / wall : 0.0);
+	if (!configs.empty()) {
+		printf("Best %s: std_a %.4f std_yawdd %.4f, summed RMSE %.4f\n",
+		       best_consistent ? "NIS consistent configuration" : "configuration (none NIS consistent)",
+		       configs[best]->std_a_, configs[best]->std_yawdd_, best_sum);
+	}
+	return 0;
+}
+
+/**
+* RunBatchReplay with a deadline: the measurements of every block of the log
+* arrive together and go through a TrackScheduler, which hands the most
+* urgent tracks to the batch kDispatchSize at a time.
+*/
+int ScheduledBatchReplay(const MeasurementLog &log, long long deadline_us) {
+	//a few blocks of the batch's lanes per ProcessMeasurements call
+	const size_t kDispatchSize = 8 * DoubleUKFBatch::kLanes;
+
+	DoubleUKFBatch batch(log.tracks());
+	TrackScheduler<DoubleUKFBatch> scheduler(batch, std::vector<long long>(1, deadline_us));
+	std::vector<size_t> track_of(log.track_limit(), ~size_t(0));
+	std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > truths;
+	std::vector<char> has_truth;
+	RunningRMSE rmse;
+	MeasurementPackage meas_package;
+
+	auto start = std::chrono::steady_clock::now();
+	LogBlockReader blocks(log);
+	while (const MeasurementLog::Block *block = blocks.Next()) {
+		truths.resize(block->count);
+		has_truth.resize(block->count);
+		const uint64_t arrival = LatencyStats::Now();
+		for (size_t i = 0; i < block->count; i++) {
+			const uint32_t id = block->track[i];
+			if (track_of[id] == ~size_t(0)) {
+				track_of[id] = scheduler.AddTrack(0);
+			}
+			has_truth[i] = MeasurementLog::Get(*block, i, &meas_package, &truths[i]);
+			scheduler.Submit(track_of[id], meas_package, arrival, i);
+		}
+		while (scheduler.Dispatch(kDispatchSize)) {
+			const std::vector<size_t> &tracks = scheduler.dispatched_tracks();
+			const std::vector<size_t> &tags = scheduler.dispatched_tags();
+			for (size_t j = 0; j < tracks.size(); j++) {
+				if (has_truth[tags[j]]) {
+					const Eigen::Matrix<double, 5, 1> x = batch.State(tracks[j]);
+					rmse.Add(CartesianEstimate(x.data()), truths[tags[j]]);
+				}
+			}
+		}
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (blocks.failed()) {
+		std::cerr << "A block of the log is corrupt" << std::endl;
+		return 1;
+	}
+
+	const Eigen::Vector4d total = rmse.RMSE();
+	printf("Replayed %zu measurements of %zu tracks in %zu blocks: %.0f measurements/s\n",
+	       log.size(), log.tracks(), log.blocks(), seconds > 0.0 ? log.size() / seconds : 0.0);
+	printf("RMSE %g %g %g %g\n", total(0), total(1), total(2), total(3));
+	if (Indefinite(batch)) {
+		printf("%llu covariances not positive definite, factored one at a time\n", Indefinite(batch));
+	}
+
+	const LatencyHistogram &latency = scheduler.latency();
+	size_t worst = 0;
+	for (size_t t = 0; t < batch.size(); t++) {
+		if (scheduler.metrics(t).MeanLatency() > scheduler.metrics(worst).MeanLatency()) {
+			worst = t;
+		}
+	}
+	printf("Deadline %lld us: %lld of %llu measurements missed (%.2f%%), latency mean %.1f p50 %.1f p99 %.1f max %.1f us\n",
+	       deadline_us, scheduler.missed(), (unsigned long long) latency.count(),
+	       latency.count() ? 100.0 * scheduler.missed() / latency.count() : 0.0, latency.Mean() / 1000.0,
+	       latency.Percentile(0.5) / 1000.0, latency.Percentile(0.99) / 1000.0, latency.max() / 1000.0);
+	if (batch.size()) {
+		const TrackScheduler<DoubleUKFBatch>::TrackMetrics &metrics = scheduler.metrics(worst);
+		printf("Slowest track %zu: mean latency %.1f us, max %.1f us, %lld of %lld missed\n",
+		       worst, metrics.MeanLatency() / 1000.0, metrics.max_latency_ns / 1000.0, metrics.missed, metrics.dispatched);
+	}
+	return 0;
+}
+
+/**
+* RunBatchReplay without a deadline: the log in waves of one measurement
+* per track through one Batch, UKFBatch or CudaUKFBatch.
+*/
+template <class Batch>
+int ReplayBatchLog(const MeasurementLog &log) {
+	//every track id of the log becomes a track of the batch
+	Batch batch(log.tracks());
+	std::vector<size_t> track_of(log.track_limit(), ~size_t(0));
+	std::vector<unsigned long> wave_of(log.track_limit(), 0);
+	unsigned long wave = 0;
+	std::vector<size_t> tracks;
+	std::vector<MeasurementPackage> measurements;
+	std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > truths;
+	std::vector<char> has_truth;
+	RunningRMSE rmse;
+
+	//a wave holds at most one measurement per track, so that the estimate
+	//after each measurement can be read when the wave is done
+	auto flush = [&]() {
+		batch.ProcessMeasurements(tracks.data(), measurements.data(), tracks.size());
+		for (size_t j = 0; j < tracks.size(); j++) {
+			if (has_truth[j]) {
+				const Eigen::Matrix<double, 5, 1> x = batch.State(tracks[j]);
+				rmse.Add(CartesianEstimate(x.data()), truths[j]);
+			}
+		}
+		tracks.clear();
+		measurements.clear();
+		truths.clear();
+		has_truth.clear();
+		wave++;
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	wave++;
+	LogBlockReader blocks(log);
+	while (const MeasurementLog::Block *block = blocks.Next()) {
+		for (size_t i = 0; i < block->count; i++) {
+			const uint32_t id = block->track[i];
+			if (track_of[id] == ~size_t(0)) {
+				track_of[id] = batch.AddTrack();
+			}
+			if (wave_of[id] == wave) {
+				flush();
+			}
+			wave_of[id] = wave;
+			tracks.push_back(track_of[id]);
+			measurements.resize(measurements.size() + 1);
+			truths.resize(truths.size() + 1);
+			has_truth.push_back(MeasurementLog::Get(*block, i, &measurements.back(), &truths.back()));
+		}
+	}
+	flush();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (blocks.failed()) {
+		std::cerr << "A block of the log is corrupt" << std::endl;
+		return 1;
+	}
+
+	const Eigen::Vector4d total = rmse.RMSE();
+	printf("Replayed %zu measurements of %zu tracks in %zu blocks: %.0f measurements/s\n",
+	       log.size(), log.tracks(), log.blocks(), seconds > 0.0 ? log.size() / seconds : 0.0);
+	printf("RMSE %g %g %g %g\n", total(0), total(1), total(2), total(3));
+	if (Indefinite(batch)) {
+		printf("%llu covariances not positive definite, factored one at a time\n", Indefinite(batch));
+	}
+	return 0;
+}
+
+int RunBatchReplay(const char *input_path, long long deadline_us) {
+	MeasurementLog log;
+	if (!log.Open(input_path)) {
+		std::cerr << "Cannot open " << input_path << " as a measurement log" << std::endl;
+		return 1;
+	}
+	if (deadline_us > 0) {
+		return ScheduledBatchReplay(log, deadline_us);
+	}
+
+#ifdef UKF_CUDA
+	if (DoubleCudaUKFBatch::Available()) {
+		return ReplayBatchLog<DoubleCudaUKFBatch>(log);
+	}
+	std::cerr << "No CUDA device, replaying on the CPU" << std::endl;
+#endif
+	return ReplayBatchLog<DoubleUKFBatch>(log);
+}
+
+int RunSmoothReplay(const char *input_path, const char *output_path, int threads, const char *temp_directory) {
+	MeasurementLog log;
+	if (!log.Open(input_path)) {
+		std::cerr << "Cannot open " << input_path << " as a measurement log" << std::endl;
+		return 1;
+	}
+	//a smoother for every thread, each with the tracks of its residue
+	std::vector<std::unique_ptr<IntervalSmoother> > shards;
+	for (int s = 0; s < threads; s++) {
+		shards.emplace_back(new IntervalSmoother());
+		if (!shards[s]->Open(temp_directory)) {
+			std::cerr << "Cannot create a temporary file in " << temp_directory << std::endl;
+			return 1;
+		}
+	}
+	FILE *out = strcmp(output_path, "-") == 0 ? stdout : fopen(output_path, "w");
+	if (!out) {
+		std::cerr << "Cannot open " << output_path << " for writing" << std::endl;
+		return 1;
+	}
+
+	TaskPool pool(threads);
+	auto start = std::chrono::steady_clock::now();
+	LogBlockReader blocks(log);
+	while (const MeasurementLog::Block *block = blocks.Next()) {
+		pool.ParallelFor(shards.size(), 1, [&](size_t begin, size_t end) {
+			MeasurementPackage meas_package;
+			Eigen::Vector4d truth;
+			for (size_t s = begin; s < end; s++) {
+				for (size_t i = 0; i < block->count; i++) {
+					if (block->track[i] % shards.size() == s) {
+						const bool has_truth = MeasurementLog::Get(*block, i, &meas_package, &truth);
+						shards[s]->Process(block->track[i], meas_package, has_truth ? &truth : nullptr);
+					}
+				}
+			}
+		});
+	}
+	const double forward = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::vector<char> smoothed(shards.size(), 0);
+	pool.ParallelFor(shards.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t s = begin; s < end; s++) {
+			smoothed[s] = shards[s]->Smooth();
+		}
+	});
+	const double backward = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() - forward;
+
+	fputs("# track timestamp p_x p_y v yaw yaw_rate\n", out);
+	//the filtered RMSE of the shards, summed back into squares
+	Eigen::Vector4d filtered_squares = Eigen::Vector4d::Zero();
+	size_t filtered_count = 0;
+	RunningRMSE smoothed_rmse;
+	size_t steps = 0;
+	size_t tracks = 0;
+	long long out_of_order = 0;
+	bool ok = !blocks.failed();
+	IntervalSmoother::SmoothedStep step;
+	for (size_t s = 0; s < shards.size(); s++) {
+		IntervalSmoother &shard = *shards[s];
+		ok = ok && smoothed[s];
+		while (ok && shard.Next(&step)) {
+			fprintf(out, "%u %lld %g %g %g %g %g\n", step.track, step.timestamp,
+			        step.x(0), step.x(1), step.x(2), step.x(3), step.x(4));
+			if (step.has_truth) {
+				smoothed_rmse.Add(CartesianEstimate(step.x.data()), step.truth);
+			}
+		}
+		ok = ok && !shard.failed();
+		const Eigen::Vector4d rmse = shard.filtered_rmse().RMSE();
+		filtered_squares += rmse.cwiseProduct(rmse) * double(shard.filtered_rmse().count());
+		filtered_count += shard.filtered_rmse().count();
+		steps += shard.steps();
+		tracks += shard.tracks();
+		out_of_order += shard.out_of_order();
+		shards[s].reset();
+	}
+	if (out != stdout) {
+		ok = fclose(out) == 0 && ok;
+	}
+	else {
+		ok = fflush(out) == 0 && ok;
+	}
+	if (blocks.failed()) {
+		std::cerr << "A block of the log is corrupt" << std::endl;
+		return 1;
+	}
+	if (!ok) {
+		std::cerr << "Cannot write " << output_path << " or the temporary files" << std::endl;
+		return 1;
+	}
+	if (out != stdout) {
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("Smoothed %zu steps of %zu tracks from %zu measurements on %d threads in %.3f s"
+		       " (forward %.3f s, backward %.3f s): %.0f measurements/s\n",
+		       steps, tracks, log.size(), threads, seconds, forward, backward, seconds > 0.0 ? log.size() / seconds : 0.0);
+		const Eigen::Vector4d filtered = (filtered_squares / double(std::max<size_t>(1, filtered_count))).cwiseSqrt();
+		const Eigen::Vector4d smoothed_total = smoothed_rmse.RMSE();
+		printf("Filtered RMSE %g %g %g %g\n", filtered(0), filtered(1), filtered(2), filtered(3));
+		printf("Smoothed RMSE %g %g %g %g\n", smoothed_total(0), smoothed_total(1), smoothed_total(2), smoothed_total(3));
+		if (out_of_order) {
+			printf("%lld measurements before their track's latest skipped\n", out_of_order);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,227 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Offline replay: streams a measurement file in the simulator's L/R line
+ * format through a CTRVUKF as fast as possible, without the WebSocket
+ * server, and writes one line per measurement to output_path:
+ *
+ *   timestamp sensor p_x p_y v yaw yaw_rate NIS rmse_x rmse_y rmse_vx rmse_vy
+ *
+ * The input is memory-mapped when possible and read in chunks otherwise (for
+ * example from a pipe). A summary with the final RMSE and NIS consistency is
+ * printed to stdout.
+ *
+ * With a smooth_lag the filter runs through a FixedLagSmoother and the lines
+ * are its smoothed states instead, one per timestamp, with the RMSE of the
+ * smoothed estimates:
+ *
+ *   timestamp p_x p_y v yaw yaw_rate rmse_x rmse_y rmse_vx rmse_vy
+ *
+ * With imm, and no smooth_lag, the filter is the CV/CTRV/CTRA MotionIMM
+ * instead, and the summary adds the final probability of each model.
+ *
+ * With sensors other than REPLAY_FUSED the filter is the one specialized for
+ * the sensor (see sensor_set.h): the other sensor's measurements only start
+ * the track, as in the laser-only and radar-only runs of readme.txt. Those
+ * replays are not smoothed.
+ *
+ * The input may also be a measurement log (see measurement_log.h) of one
+ * track, which is read from its columns instead of parsed; this holds for
+ * the inputs of the other replays below as well.
+ *
+ * With a window the input must be such a log, and only its measurements in
+ * the window are replayed, those of one track of a log of many if it names
+ * one. The blocks holding them are found in the log's time index instead of
+ * read through, and the filter first runs on the measurements of the
+ * warm-up before the window, without output, to be settled at its start.
+ *
+ * With perf_counters the replay, parsing and output included, is counted
+ * in the hardware counters of PerfCounters, and the counts per measurement
+ * and the IPC follow the summary.
+ *
+ * With a report_path the throughput, the latencies of the stages, the
+ * allocations and the updates of each sensor follow as well, and the whole
+ * profile, with the system and the build, is written to report_path as
+ * JSON (see ReplayReport).
+ *
+ * @return 0 on success, non-zero if a file cannot be opened or written
+ */
+enum ReplaySensors {
+  REPLAY_FUSED,
+  REPLAY_LASER,
+  REPLAY_RADAR
+};
+
+struct ReplayWindow {
+  ///* timestamps of the first and last measurement replayed, in us
+  int64_t from_us;
+  int64_t to_us;
+  ///* filtered without output before from_us
+  int64_t warmup_us;
+  ///* the track id replayed, or -1 for all
+  int64_t track;
+};
+
+int RunReplay(const char *input_path, const char *output_path, size_t smooth_lag = 0, bool imm = false,
+              ReplaySensors sensors = REPLAY_FUSED, const ReplayWindow *window = nullptr,
+              bool perf_counters = false, const char *report_path = nullptr);
+
+/**
+ * Replays a measurement log (see measurement_log.h) of any number of tracks
+ * through one DoubleUKFBatch, a track of the batch for every track id,
+ * straight from the log's columns. Prints the throughput and the RMSE over
+ * all measurements with ground truth.
+ *
+ * With a deadline_us the measurements of each block of the log arrive at
+ * once and a TrackScheduler hands them to the batch by deadline, the
+ * block's arrival plus deadline_us; the summary adds the deadline misses,
+ * the latency percentiles and the track with the longest mean latency.
+ * @return 0 on success, non-zero if the file is not a readable log
+ */
+int RunBatchReplay(const char *input_path, long long deadline_us = 0);
+
+/**
+ * Smooths every track of a measurement log of any length with all of its
+ * measurements, for analysis of archived drives: the tracks are dealt to
+ * threads IntervalSmoothers by their id, which filter them forwards and
+ * stream the steps to a temporary file each in temp_directory, then run
+ * the backward passes in parallel, so that memory grows with the tracks
+ * and not with the log. Writes one line per timestamp of a track to
+ * output_path, the tracks of each smoother in turn, each in time order,
+ *
+ *   track timestamp p_x p_y v yaw yaw_rate
+ *
+ * and prints the time of both passes and the RMSE of the filtered and of
+ * the smoothed estimates.
+ * @return 0 on success, non-zero if the log cannot be read or a file
+ * cannot be written
+ */
+int RunSmoothReplay(const char *input_path, const char *output_path, int threads = 1,
+                    const char *temp_directory = "/tmp");
+
+/**
+ * Replays a scene of many targets (see --generate --scene) through a
+ * Tracker: consecutive lines of the same sensor and timestamp form one scan
+ * of unlabeled detections. Writes one line per detection to output_path
+ * with the track it was assigned to or started and that track's estimate,
+ *
+ *   timestamp sensor track p_x p_y v yaw yaw_rate
+ *
+ * and prints the association counts, the RMSE of the updated tracks against
+ * the ground truth of their detections and the tracker's time per scan.
+ * With threads > 1 the tracks of a scan are filtered on a TaskPool of that
+ * many threads; the output is the same.
+ * @return 0 on success, non-zero if a file cannot be opened or written
+ */
+int RunTrackReplay(const char *input_path, const char *output_path, int threads = 1);
+
+/**
+ * Replays independent measurement files, each through a CTRVUKF of its own,
+ * on a pool of threads that take the next file as they finish one. Prints a
+ * line per file with its measurements, RMSE and the fractions of radar and
+ * laser NIS within bounds, then the aggregate throughput, for measuring how
+ * the filter scales across cores:
+ *
+ *   path measurements rmse_x rmse_y rmse_vx rmse_vy radar_nis% laser_nis% ms
+ *
+ * and last the RMSE, mean absolute error, largest error and error
+ * percentiles over the estimates of all files (CalculateErrorStats).
+ *
+ * @return 0 on success, non-zero if a file cannot be opened
+ */
+int RunParallelReplay(const std::vector<std::string> &input_paths, int threads);
+
+/**
+ * Checks the float UKFBatch against the double one: replays independent
+ * measurement files as the tracks of one batch in each precision and prints
+ * a line per file with its double RMSE and the absolute differences of the
+ * float RMSE and mean NIS from it,
+ *
+ *   path measurements rmse_x rmse_y rmse_vx rmse_vy d_rmse_x d_rmse_y d_rmse_vx d_rmse_vy d_nis
+ *
+ * then the throughput of both and whether the largest differences are
+ * within tolerance.
+ * @param approximate_radar Whether to check the double batch with
+ * UKFBatch::approximate_radar_ instead of the float one
+ * @return 0 if they are, non-zero if not or if a file cannot be opened
+ */
+int RunPrecisionCheck(const std::vector<std::string> &input_paths, bool approximate_radar = false);
+
+/**
+ * Checks a fast path against the reference filter, UKF<5, 7> of ukf.cpp
+ * without build options: replays independent measurement files as tracks
+ * of both in lockstep, compares their states after every step and prints a
+ * line per file with its largest and mean state divergence (the largest
+ * absolute difference of a state component, yaw wrapped), the reference
+ * RMSE and the candidate's differences in RMSE and mean NIS,
+ *
+ *   path measurements max_div mean_div rmse_x rmse_y rmse_vx rmse_vy d_rmse_x d_rmse_y d_rmse_vx d_rmse_vy d_nis
+ *
+ * then the throughput of both, the largest divergence of each component,
+ * the steps of the largest divergence in all files and whether the RMSE
+ * and NIS differences are within tolerance.
+ * @param candidate ctrv (CTRVUKF as built), square-root, inverse, kernels,
+ * simplex, cubature, linearized (the radar update of UKFConfig::
+ * linearize_radar_ at 0.1), batch, float-batch, approximate-radar or, with
+ * a CUDA device, cuda
+ * @return 0 if they are within tolerance, non-zero if not, if a file cannot
+ * be opened or if this build has no such candidate
+ */
+int RunDiffCheck(const std::vector<std::string> &input_paths, const std::string &candidate,
+                 double rmse_tolerance = 1e-3, double nis_tolerance = 1e-2);
+
+/**
+ * The noise parameters RunNoiseSweep tries: a grid of steps values of each
+ * from one end of its range to the other, or with random > 0 that many
+ * draws instead, of each uniform on a log scale over its range, as the
+ * values are scales. The other noise levels are those of UKFConfig::Default.
+ */
+struct SweepOptions {
+  ///* range of the longitudinal acceleration noise std_a_, in m/s^2
+  double std_a_from;
+  double std_a_to;
+  int std_a_steps;
+
+  ///* range of the yaw acceleration noise std_yawdd_, in rad/s^2
+  double std_yawdd_from;
+  double std_yawdd_to;
+  int std_yawdd_steps;
+
+  ///* random configurations, or 0 for the grid, and the seed of their draws
+  int random;
+  unsigned long long seed;
+
+  ///* threads replaying configurations in parallel
+  int threads;
+
+  SweepOptions()
+      : std_a_from(0.5), std_a_to(3.0), std_a_steps(6),
+        std_yawdd_from(0.25), std_yawdd_to(1.5), std_yawdd_steps(6),
+        random(0), seed(1), threads(1) {}
+};
+
+/**
+ * Tunes the process noise against recorded sequences: reads all the files
+ * into memory once, then replays every sequence through a CTRVUKF with each
+ * configuration of options on a pool of threads, which take the next
+ * configuration and sequence as they finish one, each with a filter of its
+ * own over the shared, read-only measurements. Prints a line per
+ * configuration with the RMSE over the estimates of all the sequences and
+ * the fractions of radar and laser NIS within bounds,
+ *
+ *   std_a std_yawdd rmse_x rmse_y rmse_vx rmse_vy radar_nis% laser_nis%
+ *
+ * then the throughput and the configuration of least summed RMSE among the
+ * NIS consistent ones (at least 85% of both within bounds, as in
+ * RunParallelReplay), or among all if none is.
+ * @return 0 on success, non-zero if a file cannot be opened
+ */
+int RunNoiseSweep(const std::vector<std::string> &input_paths, const SweepOptions &options);
+
+#endif /* REPLAY_H_ */
@@ -0,0 +1,174 @@
+#include "replay_report.h"
+#include "json.hpp"
+#include "latency.h"
+#include "simd.h"
+#include "ukf.h"
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <thread>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+// for convenience
+using json = nlohmann::json;
+
+namespace {
+
+///* the stages a replay goes through, in the order they are printed
+const LatencyStage kReplayStages[] = {LATENCY_PARSE, LATENCY_PREDICTION, LATENCY_UPDATE_LIDAR, LATENCY_UPDATE_RADAR};
+
+///* the model name of the first processor, or "" if it is not listed
+std::string CpuModel() {
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(cpuinfo, line)) {
+		if (line.compare(0, 10, "model name") == 0) {
+			const size_t colon = line.find(':');
+			return colon != std::string::npos && colon + 2 <= line.size() ? line.substr(colon + 2) : "";
+		}
+	}
+	return "";
+}
+
+json System() {
+	json system;
+	char host[256] = "";
+	gethostname(host, sizeof(host) - 1);
+	system["host"] = host;
+	struct utsname name;
+	if (uname(&name) == 0) {
+		system["os"] = std::string(name.sysname) + " " + name.release;
+		system["machine"] = name.machine;
+	}
+	system["cpu"] = CpuModel();
+	system["cpus"] = std::thread::hardware_concurrency();
+	return system;
+}
+
+json Build() {
+	json build;
+#ifdef __VERSION__
+	build["compiler"] = __VERSION__;
+#endif
+#ifdef NDEBUG
+	build["assertions"] = false;
+#else
+	build["assertions"] = true;
+#endif
+	const int lanes = simd::NativeDouble::width;
+	build["simd_double_lanes"] = lanes;
+#ifdef UKF_NATIVE_ARCH
+	build["native_arch"] = true;
+#else
+	build["native_arch"] = false;
+#endif
+	build["sigma_points"] = CTRVSigmaPoints::Name();
+#ifdef UKF_SMALL_MATRIX_KERNELS
+	build["small_matrix"] = "kernels";
+#else
+	build["small_matrix"] = "eigen";
+#endif
+#ifdef UKF_CHECK_ALLOCATIONS
+	build["allocation_counting"] = true;
+#else
+	build["allocation_counting"] = false;
+#endif
+	return build;
+}
+
+///* the current time in UTC, as ISO 8601
+std::string Now() {
+	const time_t now = time(nullptr);
+	struct tm utc;
+	char text[32];
+	strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &utc));
+	return text;
+}
+
+}
+
+ReplayReport::ReplayReport()
+	: seconds(0), measurements(0), skipped(0), lidar_measurements(0), radar_measurements(0),
+	  lidar_updates(0), radar_updates(0), allocations(-1), rmse(), radar_nis_within(0), laser_nis_within(0),
+	  counters(nullptr) {}
+
+std::string ReplayReport::Json() const {
+	json report;
+	report["time"] = Now();
+	report["input"] = input;
+	report["filter"] = filter;
+	report["system"] = System();
+	report["build"] = Build();
+	report["seconds"] = seconds;
+	report["measurements"] = measurements;
+	report["skipped"] = skipped;
+	report["measurements_per_second"] = seconds > 0 ? measurements / seconds : 0.0;
+
+	json latency = json::parse(LatencyStats::Json());
+	json stages = json::object();
+	for (LatencyStage stage : kReplayStages) {
+		stages[LatencyStats::StageName(stage)] = latency[LatencyStats::StageName(stage)];
+	}
+	report["latency"] = stages;
+	if (allocations >= 0) {
+		report["allocations"] = allocations;
+		report["allocations_per_measurement"] = measurements ? double(allocations) / measurements : 0.0;
+	}
+	else {
+		report["allocations"] = nullptr;
+	}
+	if (counters) {
+		json per_measurement;
+		for (int i = 0; i < PerfCounters::EVENTS; i++) {
+			const PerfCounters::Event event = PerfCounters::Event(i);
+			if (counters->available(event) && measurements) {
+				per_measurement[PerfCounters::Name(event)] = double(counters->Read(event)) / measurements;
+			}
+		}
+		report["perf_per_measurement"] = per_measurement;
+		if (counters->available(PerfCounters::CYCLES) && counters->available(PerfCounters::INSTRUCTIONS)) {
+			report["ipc"] = counters->IPC();
+		}
+	}
+
+	json sensors;
+	sensors["lidar"] = {{"measurements", lidar_measurements}, {"updates", lidar_updates},
+	                    {"nis_within", laser_nis_within}};
+	sensors["radar"] = {{"measurements", radar_measurements}, {"updates", radar_updates},
+	                    {"nis_within", radar_nis_within}};
+	report["sensors"] = sensors;
+	report["rmse"] = std::vector<double>(rmse, rmse + 4);
+	return report.dump(2);
+}
+
+void ReplayReport::Print(std::ostream &out) const {
+	out << "Throughput " << (seconds > 0 ? measurements / seconds : 0.0) << " measurements/s ("
+		<< measurements << " in " << seconds << " s)" << std::endl;
+	json latency = json::parse(LatencyStats::Json());
+	for (LatencyStage stage : kReplayStages) {
+		const json &histogram = latency[LatencyStats::StageName(stage)];
+		if (histogram["count"].get<uint64_t>() == 0) {
+			continue;
+		}
+		out << "  " << LatencyStats::StageName(stage) << ": p50 " << histogram["p50_us"].get<double>()
+			<< " us, p99 " << histogram["p99_us"].get<double>() << " us, p99.9 " << histogram["p999_us"].get<double>()
+			<< " us, max " << histogram["max_us"].get<double>() << " us (" << histogram["count"].get<uint64_t>() << ")"
+			<< std::endl;
+	}
+	out << "Lidar " << lidar_updates << " updates of " << lidar_measurements << " measurements, radar "
+		<< radar_updates << " of " << radar_measurements << std::endl;
+	if (allocations >= 0) {
+		out << "Allocations " << allocations << std::endl;
+	}
+	else {
+		out << "Allocations not counted (build with UKF_CHECK_ALLOCATIONS)" << std::endl;
+	}
+}
+
+bool ReplayReport::Write(const char *path) const {
+	std::ofstream file(path);
+	file << Json() << std::endl;
+	file.close();
+	return !file.fail();
+}
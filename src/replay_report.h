@@ -0,0 +1,56 @@
+#ifndef REPLAY_REPORT_H_
+#define REPLAY_REPORT_H_
+
+#include "perf_counters.h"
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+/**
+ * The performance profile of one replay (--replay --report), one artifact
+ * to attach to a change and to compare builds and hosts by: what was
+ * replayed, by which build on which machine, the throughput, the
+ * latencies of the filter stages as LatencyStats recorded them, the heap
+ * allocations (counted in UKF_CHECK_ALLOCATIONS builds only), the hardware
+ * counters if they were open, the measurements and updates of each sensor,
+ * the RMSE and the NIS consistency.
+ *
+ * The filter fills in the fields; Json renders them with the system and
+ * the build, and Print the same as a summary to read.
+ */
+struct ReplayReport {
+  std::string input;
+  ///* the filter and its options, such as "CTRVUKF with scaled sigma points, smoothed with lag 5"
+  std::string filter;
+  double seconds;
+  size_t measurements;
+  size_t skipped;
+  ///* measurements of each sensor, and the updates among them, which
+  ///* leave out those that started or restarted the filter
+  size_t lidar_measurements;
+  size_t radar_measurements;
+  size_t lidar_updates;
+  size_t radar_updates;
+  ///* operator new calls during the replay, or -1 if not counted
+  long allocations;
+  double rmse[4];
+  double radar_nis_within;
+  double laser_nis_within;
+  ///* the open counters, or null
+  const PerfCounters *counters;
+
+  ReplayReport();
+
+  ///* the report as a JSON object
+  std::string Json() const;
+
+  void Print(std::ostream &out) const;
+
+  /**
+   * Writes Json to path.
+   * @return false if it cannot be written
+   */
+  bool Write(const char *path) const;
+};
+
+#endif /* REPLAY_REPORT_H_ */
@@ -0,0 +1,123 @@
+#ifndef SENSOR_SET_H_
+#define SENSOR_SET_H_
+
+#include "latency.h"
+#include "measurement_package.h"
+#include "probes.h"
+#include "ukf_config.h"
+#include <cmath>
+#include <type_traits>
+
+/**
+ * The sensors a filter takes measurements of, as types, so that a filter
+ * built for some of them (see UKF) compiles the updates of those alone.
+ * A sensor type names its MeasurementPackage::SensorType and how it starts
+ * and updates a filter:
+ *   type_                        the measurements it reports
+ *   sigma_points_                whether its update reads the predicted
+ *                                sigma points
+ *   latency_                     the LatencyStage of its update
+ *   Enabled(config)              whether a sensor profile uses it
+ *   Initialize(filter, meas)     the position of the first state, and its
+ *                                covariance, from a measurement
+ *   Update(filter, meas)         the filter's update for it
+ * Adding a sensor is a type with these members in the sets that take it:
+ * SensorSet::Dispatch finds the sensor of a measurement by comparing its
+ * type with each of the set's in turn, unrolled when compiled, so there is
+ * no chain of ifs to grow and a set of one sensor compares once.
+ */
+struct LaserSensor {
+  static const MeasurementPackage::SensorType type_ = MeasurementPackage::LASER;
+  static const bool sigma_points_ = false;
+  static const LatencyStage latency_ = LATENCY_UPDATE_LIDAR;
+
+  static bool Enabled(const UKFConfig &config) { return config.use_laser_; }
+
+  template <class Filter>
+  static void Initialize(Filter &filter, const MeasurementPackage &meas_package) {
+    filter.x_(0) = meas_package.raw_measurements_[0];
+    filter.x_(1) = meas_package.raw_measurements_[1];
+    filter.P_(0, 0) = filter.config().R_laser_(0, 0);
+    filter.P_(1, 1) = filter.config().R_laser_(1, 1);
+    filter.NIS_laser_ = 0.0;
+  }
+
+  template <class Filter>
+  static void Update(Filter &filter, const MeasurementPackage &meas_package) {
+    UKF_PROBE(update__lidar__entry);
+    filter.UpdateLidar(meas_package);
+    UKF_PROBE1(update__lidar__return, (int) filter.rejected_);
+  }
+};
+
+struct RadarSensor {
+  static const MeasurementPackage::SensorType type_ = MeasurementPackage::RADAR;
+  static const bool sigma_points_ = true;
+  static const LatencyStage latency_ = LATENCY_UPDATE_RADAR;
+
+  static bool Enabled(const UKFConfig &config) { return config.use_radar_; }
+
+  template <class Filter>
+  static void Initialize(Filter &filter, const MeasurementPackage &meas_package) {
+    float rho = meas_package.raw_measurements_[1];
+    filter.x_(0) = meas_package.raw_measurements_[0] * cos(rho);
+    filter.x_(1) = meas_package.raw_measurements_[0] * sin(rho);
+    filter.P_(0, 0) = filter.config().R_radar_(0, 0)*0.5;
+    filter.P_(1, 1) = filter.config().R_radar_(0, 0)*0.5;
+    filter.NIS_radar_ = 0.0;
+  }
+
+  template <class Filter>
+  static void Update(Filter &filter, const MeasurementPackage &meas_package) {
+    UKF_PROBE(update__radar__entry);
+    filter.UpdateRadar(meas_package);
+    UKF_PROBE1(update__radar__return, (int) filter.rejected_);
+  }
+};
+
+/**
+ * A set of sensor types. Dispatch calls visitor.Visit<Sensor>() for the
+ * sensor of the set that reports measurements of the given type, and is
+ * false if none does; Contains<Sensor>::value whether it is in the set.
+ */
+template <class... Sensors>
+struct SensorSet;
+
+template <>
+struct SensorSet<> {
+  template <class Visitor>
+  static bool Dispatch(MeasurementPackage::SensorType type, const Visitor &visitor) { return false; }
+
+  template <class Sensor>
+  struct Contains {
+    static const bool value = false;
+  };
+};
+
+template <class Head, class... Tail>
+struct SensorSet<Head, Tail...> {
+  template <class Visitor>
+  static bool Dispatch(MeasurementPackage::SensorType type, const Visitor &visitor) {
+    if (type == Head::type_) {
+      visitor.template Visit<Head>();
+      return true;
+    }
+    return SensorSet<Tail...>::Dispatch(type, visitor);
+  }
+
+  template <class Sensor>
+  struct Contains {
+    static const bool value = std::is_same<Sensor, Head>::value
+      || SensorSet<Tail...>::template Contains<Sensor>::value;
+  };
+};
+
+///* the modes of readme.txt: both sensors, and either alone
+typedef SensorSet<LaserSensor, RadarSensor> FusedSensors;
+typedef SensorSet<LaserSensor> LaserOnlySensors;
+typedef SensorSet<RadarSensor> RadarOnlySensors;
+
+///* every sensor there is, any of which starts a track
+typedef FusedSensors KnownSensors;
+
+#endif /* SENSOR_SET_H_ */
@@ -0,0 +1,1163 @@
+#include "session.h"
+#include "allocation_counter.h"
+#include "config_registry.h"
+#include "geofence.h"
+#include "json.hpp"
+#include "latency.h"
+#include "measurement_parser.h"
+#include "measurement_record.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "session_resumption.h"
+#include "shadow_filter.h"
+#include "track_index.h"
+#include "track_relay.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// for convenience
+using json = nlohmann::json;
+
+namespace {
+
+/**
+* Appends a JSON number, or null where nlohmann::json would write one for a
+* non-finite value.
+*/
+char *FormatNumber(char *p, double a) {
+	if (!std::isfinite(a)) {
+		memcpy(p, "null", 4);
+		return p + 4;
+	}
+	return FormatFixed(p, a);
+}
+
+/**
+ * Parses an event that ParseEvent leaves, one with escapes in its strings
+ * say, into document, and points event at its name and string fields there.
+ * @return false if it is no event with an object for its data
+ */
+bool ParseEventDocument(const char *data, size_t length, json *document, EventFields *event) {
+	if (length <= 2 || data[0] != '4' || data[1] != '2') {
+		return false;
+	}
+	try {
+		*document = json::parse(std::string(data + 2, length - 2));
+	}
+	catch (const std::exception &) {
+		return false;
+	}
+	const json &array = *document;
+	if (!array.is_array() || array.size() < 2 || !array[0].is_string() || !array[1].is_object()) {
+		return false;
+	}
+	const std::string &name = array[0].get_ref<const std::string &>();
+	event->name = name.data();
+	event->name_end = name.data() + name.length();
+	event->count = 0;
+	for (json::const_iterator it = array[1].begin(); it != array[1].end() && event->count < EventFields::kMaxFields; ++it) {
+		if (it.value().is_string()) {
+			const std::string &key = it.key();
+			const std::string &value = it.value().get_ref<const std::string &>();
+			event->key[event->count] = key.data();
+			event->key_end[event->count] = key.data() + key.length();
+			event->value[event->count] = value.data();
+			event->value_end[event->count] = value.data() + value.length();
+			event->count++;
+		}
+	}
+	return true;
+}
+
+///* appends a string literal, without its terminating zero
+template <size_t N>
+char *Append(char *p, const char (&s)[N]) {
+	memcpy(p, s, N - 1);
+	return p + N - 1;
+}
+
+}
+
+const size_t Session::kNISWindow;
+const size_t Session::kMaxEstimateMarker;
+const size_t Session::kHandoffHeaderSize;
+const double Session::kRegionSize = 10.0;
+const int Session::kMaxRegionTopics;
+const long long Session::kMeanOnlyInterval;
+const int Session::kQosLevels;
+
+Session::Session()
+	: recorder_(nullptr),
+	  estimate_log_(nullptr),
+	  relay_(nullptr),
+	  shadow_(nullptr),
+	  geofence_(nullptr),
+	  id_(0),
+	  output_format_(OUTPUT_AUTO),
+	  qos_class_(QOS_STANDARD),
+	  qos_tier_(QOS_FULL),
+	  radar_nis_(NISMonitor::Radar(kNISWindow, 0.05)),
+	  laser_nis_(NISMonitor::Laser(kNISWindow, 0.05)),
+	  consistent_(true),
+	  track_state_(TrackRegistry::Acquire()),
+	  measurements_(0),
+	  shed_redundant_(0),
+	  shed_low_information_(0),
+	  restored_(false),
+	  fixed_rate_(false),
+	  updated_ns_(0),
+	  cost_ns_() {
+	// the state may have been another track's
+	if (TrackHistory *recent = track_state_->history()) {
+		recent->Clear();
+	}
+}
+
+Session::~Session() {
+	MemoryAccount::Add(MEMORY_HISTORIES, -(long long) history_memory());
+	TrackIndex::Remove(track_state_, &index_entry_);
+	TrackRegistry::Release(track_state_);
+}
+
+size_t Session::FormatEstimateMarker(char *reply, double estimate_x, double estimate_y, const Eigen::Vector4d &RMSE) {
+	// the fields in the order json::dump sorts them
+	static const char prefix[] = "42[\"estimate_marker\",{\"estimate_x\":";
+	char *p = Append(reply, prefix);
+	p = FormatNumber(p, estimate_x);
+	p = Append(p, ",\"estimate_y\":");
+	p = FormatNumber(p, estimate_y);
+	p = Append(p, ",\"rmse_vx\":");
+	p = FormatNumber(p, RMSE(2));
+	p = Append(p, ",\"rmse_vy\":");
+	p = FormatNumber(p, RMSE(3));
+	p = Append(p, ",\"rmse_x\":");
+	p = FormatNumber(p, RMSE(0));
+	p = Append(p, ",\"rmse_y\":");
+	p = FormatNumber(p, RMSE(1));
+	p = Append(p, "}]");
+	return p - reply;
+}
+
+size_t Session::FormatEstimateMarkers(char *reply, const double *x, const double *y, size_t stride, size_t count,
+                                      const Eigen::Vector4d &RMSE) {
+	static const char prefix[] = "42[\"estimate_marker\",{\"estimate_x\":[";
+	char *p = Append(reply, prefix);
+	for (size_t i = 0; i < count; i++) {
+		if (i) {
+			*p++ = ',';
+		}
+		p = FormatNumber(p, x[i * stride]);
+	}
+	p = Append(p, "],\"estimate_y\":[");
+	for (size_t i = 0; i < count; i++) {
+		if (i) {
+			*p++ = ',';
+		}
+		p = FormatNumber(p, y[i * stride]);
+	}
+	p = Append(p, "],\"rmse_vx\":");
+	p = FormatNumber(p, RMSE(2));
+	p = Append(p, ",\"rmse_vy\":");
+	p = FormatNumber(p, RMSE(3));
+	p = Append(p, ",\"rmse_x\":");
+	p = FormatNumber(p, RMSE(0));
+	p = Append(p, ",\"rmse_y\":");
+	p = FormatNumber(p, RMSE(1));
+	p = Append(p, "}]");
+	return p - reply;
+}
+
+Session::OutputFormat Session::ParseOutputFormat(const char *protocols, size_t length) {
+	static const struct {
+		const char *name;
+		OutputFormat format;
+	} formats[] = {{"ukf.json", OUTPUT_JSON}, {"ukf.binary", OUTPUT_BINARY}, {"ukf.delta", OUTPUT_DELTA}};
+	const char *end = protocols + length;
+	for (const char *p = protocols; p && p < end; ) {
+		while (p < end && (*p == ' ' || *p == ',')) {
+			p++;
+		}
+		const char *next = static_cast<const char *>(memchr(p, ',', end - p));
+		const char *last = next ? next : end;
+		while (last > p && last[-1] == ' ') {
+			last--;
+		}
+		for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+			if (size_t(last - p) == strlen(formats[i].name) && !memcmp(p, formats[i].name, last - p)) {
+				return formats[i].format;
+			}
+		}
+		p = next;
+	}
+	return OUTPUT_AUTO;
+}
+
+const char *Session::QosTierName(QosTier tier) {
+	static const char *names[QOS_TIERS] = {"full", "hybrid", "shed", "mean_only"};
+	return names[tier];
+}
+
+bool Session::ParseQosClass(const char *name, size_t length, QosClass *qos_class) {
+	static const struct {
+		const char *name;
+		QosClass qos_class;
+	} classes[] = {{"premium", QOS_PREMIUM}, {"standard", QOS_STANDARD}, {"background", QOS_BACKGROUND}};
+	for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+		if (length == strlen(classes[i].name) && !memcmp(name, classes[i].name, length)) {
+			*qos_class = classes[i].qos_class;
+			return true;
+		}
+	}
+	return false;
+}
+
+Session::QosTier Session::TierAt(QosClass qos_class, int level) {
+	switch (qos_class) {
+	case QOS_BACKGROUND:
+		return QosTier(std::min(level, int(QOS_MEAN_ONLY)));
+	case QOS_STANDARD:
+		return QosTier(std::min(std::max(level - 2, 0), int(QOS_SHED)));
+	default:
+		return QOS_FULL;
+	}
+}
+
+void Session::AppendEstimate(std::vector<char> *out, OutputFormat format, record::EstimateDeltaState *delta,
+                             long long timestamp, double p_x, double p_y, const Eigen::Vector4d &rmse) {
+	size_t used = out->size();
+	if (format == OUTPUT_DELTA) {
+		out->resize(used + record::kMaxCompactEstimateSize);
+		char *end = record::EncodeCompactEstimate(&(*out)[used], delta, timestamp, p_x, p_y, rmse);
+		out->resize(end - &(*out)[0]);
+	}
+	else {
+		out->resize(used + record::kEstimateSize);
+		record::EncodeEstimate(&(*out)[used], timestamp, p_x, p_y, rmse);
+	}
+}
+
+void Session::set_id(int id) {
+	id_ = id;
+	track_topic_ = "track/" + std::to_string(id);
+}
+
+void Session::set_reorder_depth(size_t depth) {
+	const size_t before = history_memory();
+	if (!depth) {
+		history_.reset();
+	}
+	else if (!history_ || history_->depth() != depth) {
+		history_.reset(new MeasurementHistory(depth));
+	}
+	MemoryAccount::Add(MEMORY_HISTORIES, (long long) history_memory() - (long long) before);
+}
+
+void Session::set_reorder_budget(long long budget_us) {
+	const size_t before = history_memory();
+	if (!budget_us) {
+		reorder_.reset();
+	}
+	else if (!reorder_ || reorder_->budget_us() != budget_us) {
+		reorder_.reset(new ReorderBuffer(budget_us));
+	}
+	MemoryAccount::Add(MEMORY_HISTORIES, (long long) history_memory() - (long long) before);
+}
+
+size_t Session::history_memory() const {
+	return (history_ ? sizeof(MeasurementHistory) + history_->memory() : 0)
+		+ (reorder_ ? sizeof(ReorderBuffer) + reorder_->memory() : 0);
+}
+
+size_t Session::memory() const {
+	return sizeof(Session) + history_memory() + binary_reply_.capacity() + marker_xy_.capacity() * sizeof(double);
+}
+
+Eigen::Vector4d Session::Arrive(bool has_ground_truth, bool overloaded) {
+	if (duplicates_ && duplicates_->Seen(meas_package_)) {
+		Metrics::Local().Add(METRIC_DUPLICATES);
+		return rmse_.RMSE();
+	}
+	if (!reorder_) {
+		return Process(has_ground_truth, overloaded);
+	}
+	Metrics &metrics = Metrics::Local();
+	const long long now_us = (long long) (LatencyStats::Now() / 1000);
+	if (!reorder_->Push(meas_package_, has_ground_truth ? &ground_truth_ : nullptr, now_us)) {
+		metrics.Add(METRIC_REORDER_LATE);
+	}
+	const MeasurementPackage arrived = meas_package_;
+	const Eigen::Vector4d arrived_ground_truth = ground_truth_;
+	const long long overflowed = reorder_->overflowed();
+	Eigen::Vector4d RMSE = rmse_.RMSE();
+	bool released_ground_truth;
+	while (reorder_->Pop(now_us, &meas_package_, &ground_truth_, &released_ground_truth)) {
+		RMSE = Process(released_ground_truth, overloaded);
+	}
+	metrics.Add(METRIC_REORDER_OVERFLOW, reorder_->overflowed() - overflowed);
+	meas_package_ = arrived;
+	ground_truth_ = arrived_ground_truth;
+	return RMSE;
+}
+
+Eigen::Vector4d Session::Process(bool has_ground_truth, bool overloaded) {
+	if (recorder_) {
+		recorder_->Append(meas_package_, has_ground_truth ? &ground_truth_ : nullptr, id_);
+	}
+	if (restored_) {
+		restored_ = false;
+		if (meas_package_.timestamp_ < ukf_.time_us_) {
+			Reset();
+		}
+	}
+
+	// a retuned profile takes effect from this step, with the state kept
+	ukf_.set_config(ConfigRegistry::Current());
+	const QosTier tier = qos_tier();
+	ukf_.always_linearize_ = tier >= QOS_HYBRID;
+
+	Metrics &metrics = Metrics::Local();
+	//Call ProcessMeasurment(meas_package) for Kalman filter
+	bool was_initialized = ukf_.is_initialized_;
+	bool dropped = false;
+	const uint64_t filter_ns = shadow_ ? FilterCost() : 0;
+	const LoadShedder::Decision decision = overloaded || tier >= QOS_SHED ? shedder_.Decide(ukf_, meas_package_)
+	                                                                      : LoadShedder::USE;
+	if (tier == QOS_MEAN_ONLY && ukf_.is_initialized_ && meas_package_.timestamp_ >= ukf_.time_us_
+	    && meas_package_.timestamp_ - ukf_.time_us_ < kMeanOnlyInterval) {
+		// as a shed one, too soon after the last update
+		dropped = true;
+		metrics.Add(METRIC_SHED_MEAN_ONLY);
+	}
+	else if (decision != LoadShedder::USE) {
+		// shed: nothing predicted, the next measurement used predicts over
+		// the interval; the estimate, NIS and RMSE stay as they were
+		dropped = true;
+		if (decision == LoadShedder::SHED_REDUNDANT) {
+			shed_redundant_++;
+			metrics.Add(METRIC_SHED_REDUNDANT);
+		}
+		else {
+			shed_low_information_++;
+			metrics.Add(METRIC_SHED_LOW_INFORMATION);
+		}
+	}
+	else if (!history_) {
+		ukf_.ProcessMeasurement(meas_package_);
+	}
+	else {
+		// a measurement too late to reorder leaves the estimate, NIS and
+		// RMSE as they were
+		dropped = history_->Process(ukf_, meas_package_) == MeasurementHistory::TOO_LATE;
+		if (dropped) {
+			metrics.Add(METRIC_TOO_LATE);
+		}
+	}
+	if (!dropped && (shedder_.enabled() || tier >= QOS_SHED)) {
+		shedder_.Used(meas_package_);
+	}
+	if (!dropped) {
+		updated_ns_ = LatencyStats::Now();
+		metrics.Add(meas_package_.sensor_type_ == MeasurementPackage::RADAR ? METRIC_MEASUREMENTS_RADAR : METRIC_MEASUREMENTS_LASER);
+	}
+	metrics.SetAllocations(AllocationCounter::Count());
+	const bool reinitialized = !dropped && ukf_.reinitialized_;
+	if (reinitialized) {
+		metrics.Add(METRIC_REINITIALIZED);
+		std::cerr << "Filter diverged, started again from the measurement at " << meas_package_.timestamp_ << std::endl;
+	}
+
+	//readme.txt: radar NIS within bounds in at least 80% of the steps; a
+	//filter started again has no NIS for the step
+	if (was_initialized && !dropped && !reinitialized) {
+		if (meas_package_.sensor_type_ == MeasurementPackage::RADAR) {
+			metrics.Add(METRIC_NIS_RADAR);
+			metrics.Add(METRIC_NIS_RADAR_WITHIN, radar_nis_.Add(ukf_.NIS_radar_));
+			metrics.RecordNIS(true, ukf_.NIS_radar_);
+			metrics.Add(ukf_.linearized_ ? METRIC_RADAR_LINEARIZED : METRIC_RADAR_UNSCENTED);
+		}
+		else {
+			metrics.Add(METRIC_NIS_LASER);
+			metrics.Add(METRIC_NIS_LASER_WITHIN, laser_nis_.Add(ukf_.NIS_laser_));
+			metrics.RecordNIS(false, ukf_.NIS_laser_);
+		}
+		bool now_consistent = radar_nis_.window_count() < kNISWindow || radar_nis_.WindowFraction() >= 0.8;
+		if (now_consistent != consistent_) {
+			consistent_ = now_consistent;
+			std::cerr << (consistent_ ? "Radar NIS back within bounds: " : "Radar NIS out of bounds, filter may diverge: ")
+				<< 100.0 * radar_nis_.WindowFraction() << "% of the last " << kNISWindow << " steps" << std::endl;
+		}
+	}
+
+	if (has_ground_truth && !dropped) {
+		Eigen::Vector4d estimate;
+		ukf_.CartesianEstimate(&estimate);
+		rmse_.Add(estimate, ground_truth_);
+		metrics.RecordError(estimate.data(), ground_truth_.data());
+	}
+	Eigen::Vector4d RMSE = rmse_.RMSE();
+
+	if (shadow_ && !dropped) {
+		ShadowMeasurement shadowed;
+		shadowed.id = id_;
+		shadowed.closed = false;
+		shadowed.sensor = meas_package_.sensor_type_;
+		shadowed.timestamp = meas_package_.timestamp_;
+		Eigen::Map<Eigen::VectorXd>(shadowed.z, meas_package_.raw_measurements_.size()) = meas_package_.raw_measurements_;
+		shadowed.has_ground_truth = has_ground_truth;
+		Eigen::Map<Eigen::Vector4d>(shadowed.ground_truth) = ground_truth_;
+		Eigen::Map<Eigen::Matrix<double, 5, 1> >(shadowed.x) = ukf_.x_;
+		shadowed.has_nis = was_initialized && !reinitialized;
+		shadowed.nis = meas_package_.sensor_type_ == MeasurementPackage::RADAR ? ukf_.NIS_radar_ : ukf_.NIS_laser_;
+		shadowed.filter_ns = FilterCost() - filter_ns;
+		shadow_->Submit(shadowed);
+	}
+
+	TrackSnapshot snapshot;
+	snapshot.id = id_;
+	snapshot.initialized = ukf_.is_initialized_;
+	snapshot.consistent = consistent_;
+	snapshot.timestamp = meas_package_.timestamp_;
+	snapshot.time_us = ukf_.time_us_;
+	snapshot.measurements = ++measurements_;
+	snapshot.shed_redundant = shed_redundant_;
+	snapshot.shed_low_information = shed_low_information_;
+	snapshot.qos_tier = tier;
+	Eigen::Map<Eigen::Matrix<double, 5, 1> >(snapshot.x) = ukf_.x_;
+	Eigen::Map<Eigen::Matrix<double, 5, 5, Eigen::RowMajor> >(snapshot.P) = ukf_.P_;
+	snapshot.nis_radar = ukf_.NIS_radar_;
+	snapshot.nis_laser = ukf_.NIS_laser_;
+	snapshot.radar_nis_within = radar_nis_.WindowFraction();
+	snapshot.laser_nis_within = laser_nis_.WindowFraction();
+	Eigen::Map<Eigen::Vector4d>(snapshot.rmse) = RMSE;
+	snapshot.rmse_count = rmse_.count();
+	std::copy(cost_ns_, cost_ns_ + LATENCY_STAGES, snapshot.cost_ns);
+	track_state_->Publish(snapshot);
+	if (snapshot.initialized) {
+		TrackIndex::Place(track_state_, snapshot.x[0], snapshot.x[1], &index_entry_);
+		if (TrackHistory *recent = track_state_->history()) {
+			const double P_diagonal[5] = {snapshot.P[0], snapshot.P[6], snapshot.P[12], snapshot.P[18], snapshot.P[24]};
+			recent->Append(snapshot.timestamp, snapshot.x, P_diagonal);
+		}
+	}
+
+	if (estimate_log_ || relay_) {
+		EstimateRecord record;
+		record.id = id_;
+		record.sensor = meas_package_.sensor_type_ == MeasurementPackage::RADAR ? 'R' : 'L';
+		record.timestamp = meas_package_.timestamp_;
+		Eigen::Map<Eigen::Matrix<double, 5, 1> >(record.x) = ukf_.x_;
+		record.nis = record.sensor == 'R' ? ukf_.NIS_radar_ : ukf_.NIS_laser_;
+		Eigen::Map<Eigen::Vector4d>(record.rmse) = RMSE;
+		if (estimate_log_) {
+			estimate_log_->Append(record);
+		}
+		if (relay_) {
+			relay_->Append(record);
+		}
+	}
+	return RMSE;
+}
+
+const std::vector<char> &Session::ProcessRecords(uWS::Group<uWS::SERVER> &group, const char *data,
+                                                size_t length, uint64_t start) {
+	LatencyStats::Attribution attribution(cost_ns_);
+	LatencyStats &latency = LatencyStats::Local();
+	binary_reply_.clear();
+	marker_xy_.clear();
+	const OutputFormat format = reply_format(true);
+	const char *p = data;
+	const char *end = data + length;
+	bool has_ground_truth;
+	record::DeltaState delta;
+	record::EstimateDeltaState estimate_delta;
+	Eigen::Vector4d RMSE;
+	uint64_t stage_start = start;
+	while (p != end && (p = record::DecodeMeasurement(p, end, &meas_package_, &ground_truth_, &has_ground_truth, &delta))) {
+		latency.Record(LATENCY_PARSE, stage_start);
+		// at most this many records are left of the batch
+		const bool overloaded = shedder_.enabled()
+			&& shedder_.Overloaded((end - p) / record::kMeasurementSize, LatencyStats::Now() - start);
+		RMSE = Arrive(has_ground_truth, overloaded);
+		CheckGeofence(group, meas_package_.timestamp_, ukf_.x_);
+		if (!fixed_rate_) {
+			Publish(group, meas_package_.timestamp_, ukf_.x_);
+		}
+		stage_start = LatencyStats::Now();
+		if (format == OUTPUT_JSON) {
+			marker_xy_.push_back(ukf_.x_(0));
+			marker_xy_.push_back(ukf_.x_(1));
+		}
+		else {
+			AppendEstimate(&binary_reply_, format, &estimate_delta, meas_package_.timestamp_, ukf_.x_(0), ukf_.x_(1),
+			               RMSE);
+		}
+		stage_start = latency.Record(LATENCY_SERIALIZE, stage_start);
+	}
+	// a client asking for JSON gets the one estimate_marker of them all
+	const size_t count = marker_xy_.size() / 2;
+	if (count) {
+		binary_reply_.resize(MaxEstimateMarkers(count));
+		binary_reply_.resize(FormatEstimateMarkers(&binary_reply_[0], &marker_xy_[0], &marker_xy_[1], 2, count, RMSE));
+		latency.Record(LATENCY_SERIALIZE, stage_start);
+	}
+	return binary_reply_;
+}
+
+void Session::OnMessage(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws,
+                        char *data, size_t length, uWS::OpCode opCode) {
+	LatencyStats::Attribution attribution(cost_ns_);
+	LatencyStats &latency = LatencyStats::Local();
+	uint64_t start = LatencyStats::Now();
+
+	// machine clients: a frame of binary measurement records, answered
+	// with one frame of estimate records
+	if (opCode == uWS::OpCode::BINARY) {
+		latency.Trace(id_);
+		const std::vector<char> &reply = ProcessRecords(group, data, length, start);
+		if (!reply.empty()) {
+			uint64_t stage_start = LatencyStats::Now();
+			ws.send(&reply[0], reply.size(),
+			        reply_format(true) == OUTPUT_JSON ? uWS::OpCode::TEXT : uWS::OpCode::BINARY);
+			latency.Record(LATENCY_SEND, stage_start);
+			latency.Record(LATENCY_TOTAL, start);
+		}
+		else {
+			latency.StopTrace();
+		}
+		return;
+	}
+
+	const char *lines;
+	const TelemetryMessage kind = ParseTelemetry(data, length, &meas_package_, &ground_truth_, &lines);
+	switch (kind) {
+	case TELEMETRY_MEASUREMENT: {
+		latency.Trace(id_);
+		latency.Record(LATENCY_PARSE, start);
+		Eigen::Vector4d RMSE = Arrive(true);
+		CheckGeofence(group, meas_package_.timestamp_, ukf_.x_);
+		if (!fixed_rate_) {
+			Publish(group, meas_package_.timestamp_, ukf_.x_);
+		}
+
+		uint64_t stage_start = LatencyStats::Now();
+		const OutputFormat format = reply_format(false);
+		if (format != OUTPUT_JSON) {
+			binary_reply_.clear();
+			record::EstimateDeltaState delta;
+			AppendEstimate(&binary_reply_, format, &delta, meas_package_.timestamp_, ukf_.x_(0), ukf_.x_(1), RMSE);
+			stage_start = latency.Record(LATENCY_SERIALIZE, stage_start);
+			ws.send(&binary_reply_[0], binary_reply_.size(), uWS::OpCode::BINARY);
+			latency.Record(LATENCY_SEND, stage_start);
+			latency.Record(LATENCY_TOTAL, start);
+			break;
+		}
+
+		// written straight into the frame, behind its header; a newer
+		// estimate supersedes one still waiting for a slow client
+		char *reply = ws.reserveSend(kMaxEstimateMarker, uWS::OpCode::TEXT, this);
+		if (reply) {
+			const size_t length = FormatEstimateMarker(reply, ukf_.x_(0), ukf_.x_(1), RMSE);
+			stage_start = latency.Record(LATENCY_SERIALIZE, stage_start);
+			ws.commitSend(length);
+		}
+		latency.Record(LATENCY_SEND, stage_start);
+		latency.Record(LATENCY_TOTAL, start);
+		break;
+	}
+	case TELEMETRY_MEASUREMENTS:
+		latency.Trace(id_);
+		OnMeasurementLines(group, ws, lines, data + length, start);
+		latency.StopTrace();
+		break;
+	default:
+		OnEvent(group, ws, data, length, kind);
+		break;
+	}
+}
+
+void Session::OnMeasurementLines(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws,
+                                 const char *lines, const char *end, uint64_t start) {
+	LatencyStats &latency = LatencyStats::Local();
+	marker_xy_.clear();
+	binary_reply_.clear();
+	const OutputFormat format = reply_format(false);
+	record::EstimateDeltaState delta;
+	Eigen::Vector4d RMSE;
+	uint64_t stage_start = start;
+	for (const char *line = lines; NextMeasurementLine(&lines, end, &meas_package_, &ground_truth_); line = lines) {
+		latency.Record(LATENCY_PARSE, stage_start);
+		// as for the records of a BINARY frame, the rest of the event is
+		// the backlog, in lines as long as this one
+		const bool overloaded = shedder_.enabled()
+			&& shedder_.Overloaded((end - lines) / (lines - line), LatencyStats::Now() - start);
+		RMSE = Arrive(true, overloaded);
+		CheckGeofence(group, meas_package_.timestamp_, ukf_.x_);
+		if (!fixed_rate_) {
+			Publish(group, meas_package_.timestamp_, ukf_.x_);
+		}
+		if (format == OUTPUT_JSON) {
+			marker_xy_.push_back(ukf_.x_(0));
+			marker_xy_.push_back(ukf_.x_(1));
+		}
+		else {
+			AppendEstimate(&binary_reply_, format, &delta, meas_package_.timestamp_, ukf_.x_(0), ukf_.x_(1), RMSE);
+		}
+		stage_start = LatencyStats::Now();
+	}
+	if (!binary_reply_.empty()) {
+		ws.send(&binary_reply_[0], binary_reply_.size(), uWS::OpCode::BINARY);
+		latency.Record(LATENCY_SEND, stage_start);
+		latency.Record(LATENCY_TOTAL, start);
+		return;
+	}
+	const size_t count = marker_xy_.size() / 2;
+	if (!count) {
+		return;
+	}
+
+	// every estimate of the event is in the reply, so no newer one may
+	// supersede it
+	stage_start = LatencyStats::Now();
+	char *reply = ws.reserveSend(MaxEstimateMarkers(count), uWS::OpCode::TEXT);
+	if (reply) {
+		const size_t length = FormatEstimateMarkers(reply, &marker_xy_[0], &marker_xy_[1], 2, count, RMSE);
+		stage_start = latency.Record(LATENCY_SERIALIZE, stage_start);
+		ws.commitSend(length);
+	}
+	latency.Record(LATENCY_SEND, stage_start);
+	latency.Record(LATENCY_TOTAL, start);
+}
+
+void Session::OnEvent(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws,
+                      const char *data, size_t length, TelemetryMessage kind) {
+	if (kind == TELEMETRY_MANUAL) {
+		// framed once per loop: a stalled simulator asks for it at its full
+		// rate
+		static const char manual[] = "42[\"manual\",{}]";
+		ws.sendPrepared(group.prepareConstant(manual, sizeof(manual) - 1, uWS::OpCode::TEXT));
+	}
+	else if (kind == TELEMETRY_OTHER_EVENT) {
+		OnViewerEvent(group, ws, data, length);
+	}
+}
+
+Eigen::Vector4d Session::Filter(const MeasurementPackage &measurement, const double *ground_truth,
+                                size_t backlog, uint64_t start) {
+	LatencyStats::Attribution attribution(cost_ns_);
+	meas_package_ = measurement;
+	if (ground_truth) {
+		ground_truth_ = Eigen::Map<const Eigen::Vector4d>(ground_truth);
+	}
+	const bool overloaded = start && shedder_.enabled()
+		&& shedder_.Overloaded(backlog, LatencyStats::Now() - start);
+	return Arrive(ground_truth != nullptr, overloaded);
+}
+
+void Session::WarmUp(int steps) {
+	ukf_.set_config(ConfigRegistry::Current());
+	MeasurementPackage measurement;
+	Eigen::Vector4d ground_truth;
+	char line[160];
+	char reply[kMaxEstimateMarker];
+	std::vector<char> records;
+	record::EstimateDeltaState delta;
+	delta.Reset();
+	for (int i = 0; i < steps; i++) {
+		// 10 m/s on a circle of 50 m, a measurement every 50 ms
+		const long long timestamp = 1477010443000000LL + 50000LL * i;
+		const double angle = 0.01 * i;
+		const double p_x = 50 * cos(angle), p_y = 50 * sin(angle);
+		const double v_x = -10 * sin(angle), v_y = 10 * cos(angle);
+		if (i % 2 == 0) {
+			snprintf(line, sizeof(line), "L\t%.6f\t%.6f\t%lld\t%.6f\t%.6f\t%.6f\t%.6f",
+			         p_x, p_y, timestamp, p_x, p_y, v_x, v_y);
+		}
+		else {
+			const double rho = sqrt(p_x * p_x + p_y * p_y);
+			snprintf(line, sizeof(line), "R\t%.6f\t%.6f\t%.6f\t%lld\t%.6f\t%.6f\t%.6f\t%.6f",
+			         rho, atan2(p_y, p_x), (p_x * v_x + p_y * v_y) / rho, timestamp, p_x, p_y, v_x, v_y);
+		}
+		if (!ParseMeasurementLine(line, line + strlen(line), &measurement, &ground_truth)) {
+			continue;
+		}
+		ukf_.ProcessMeasurement(measurement);
+		const Eigen::Vector4d RMSE = (ukf_.x_.head(2) - ground_truth.head(2)).cwiseAbs().replicate(2, 1);
+		records.clear();
+		AppendEstimate(&records, OUTPUT_DELTA, &delta, timestamp, ukf_.x_(0), ukf_.x_(1), RMSE);
+		FormatEstimateMarker(reply, ukf_.x_(0), ukf_.x_(1), RMSE);
+	}
+	ukf_.Reset();
+}
+
+void Session::CheckGeofence(uWS::Group<uWS::SERVER> &group, long long timestamp, const CTRVUKF::StateVector &x) {
+	// of x alone: with a Pipeline the filter may be on another thread
+	if (!geofence_) {
+		return;
+	}
+	zones_entered_.clear();
+	zones_left_.clear();
+	geofence_->Update(x(0), x(1), &zones_inside_, &zones_entered_, &zones_left_);
+	if (zones_entered_.empty() && zones_left_.empty()) {
+		return;
+	}
+	Metrics &metrics = Metrics::Local();
+	metrics.Add(METRIC_GEOFENCE_ENTERED, zones_entered_.size());
+	metrics.Add(METRIC_GEOFENCE_LEFT, zones_left_.size());
+	static const std::string topic("geofence");
+	if (!group.hasSubscribers(topic)) {
+		return;
+	}
+	for (int entered = 1; entered >= 0; entered--) {
+		const std::vector<int> &zones = entered ? zones_entered_ : zones_left_;
+		for (size_t i = 0; i < zones.size(); i++) {
+			json msgJson;
+			msgJson["event"] = entered ? "enter" : "exit";
+			msgJson["id"] = id_;
+			msgJson["timestamp"] = timestamp;
+			msgJson["x"] = x(0);
+			msgJson["y"] = x(1);
+			msgJson["zone"] = geofence_->name(zones[i]);
+			const std::string msg = "42[\"geofence\"," + msgJson.dump() + "]";
+			group.publish(topic, msg.data(), msg.length());
+		}
+	}
+}
+
+void Session::Publish(uWS::Group<uWS::SERVER> &group, long long timestamp, const CTRVUKF::StateVector &x) {
+	if (!group.hasTopics()) {
+		return;
+	}
+
+	char region_topic[64];
+	snprintf(region_topic, sizeof(region_topic), "region/%d/%d",
+	         (int) floor(x(0) / kRegionSize), (int) floor(x(1) / kRegionSize));
+	std::string region(region_topic);
+	static const std::string all_tracks("tracks");
+
+	bool to_track = group.hasSubscribers(track_topic_);
+	bool to_region = group.hasSubscribers(region);
+	bool to_all = group.hasSubscribers(all_tracks);
+	if (!to_track && !to_region && !to_all) {
+		return;
+	}
+
+	json msgJson;
+	msgJson["id"] = id_;
+	msgJson["timestamp"] = timestamp;
+	msgJson["x"] = x(0);
+	msgJson["y"] = x(1);
+	msgJson["v"] = x(2);
+	msgJson["yaw"] = x(3);
+	msgJson["yaw_rate"] = x(4);
+	auto msg = "42[\"track\"," + msgJson.dump() + "]";
+	if (to_track) {
+		group.publish(track_topic_, msg.data(), msg.length());
+	}
+	if (to_region) {
+		group.publish(region, msg.data(), msg.length());
+	}
+	if (to_all) {
+		group.publish(all_tracks, msg.data(), msg.length());
+	}
+}
+
+bool Session::EstimateAt(uint64_t now_ns, long long max_us, long long *timestamp, CTRVUKF::StateVector *x) const {
+	if (!ukf_.is_initialized_) {
+		return false;
+	}
+	long long elapsed_us = now_ns > updated_ns_ ? (long long) ((now_ns - updated_ns_) / 1000) : 0;
+	if (elapsed_us > max_us) {
+		elapsed_us = max_us;
+	}
+	*timestamp = ukf_.time_us_ + elapsed_us;
+	*x = ukf_.Extrapolate(*timestamp);
+	return true;
+}
+
+void Session::OnViewerEvent(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws,
+                            const char *data, size_t length) {
+	EventFields event;
+	json document;
+	if (!ParseEvent(data, length, &event) && !ParseEventDocument(data, length, &document, &event)) {
+		return;
+	}
+	const char *begin, *end;
+	if (event.Is("freeze") || event.Is("thaw")) {
+		const bool freeze = event.Is("freeze");
+		if (freeze) {
+			OnHandoffEvent(ws, true, nullptr, 0);
+		}
+		else if (event.Get("state", &begin, &end)) {
+			OnHandoffEvent(ws, false, begin, end - begin);
+		}
+		return;
+	}
+	if (event.Get("bbox", &begin, &end)) {
+		OnRegionEvent(group, ws, event.Is("subscribe"), begin, end);
+		return;
+	}
+	if (!event.Get("topic", &begin, &end)) {
+		return;
+	}
+
+	std::string topic(begin, end);
+	if (event.Is("subscribe")) {
+		group.subscribe(ws, topic);
+	}
+	else if (event.Is("unsubscribe")) {
+		group.unsubscribe(ws, topic);
+	}
+}
+
+void Session::OnRegionEvent(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws, bool subscribe,
+                            const char *bbox, const char *bbox_end) {
+	double box[4];
+	if (!TrackIndex::ParseBox(bbox, bbox_end, box)) {
+		return;
+	}
+	for (int i = 0; i < 4; i++) {
+		if (fabs(box[i]) > 1e9) {
+			return;
+		}
+	}
+	const int ix0 = (int) floor(box[0] / kRegionSize), ix1 = (int) floor(box[2] / kRegionSize);
+	const int iy0 = (int) floor(box[1] / kRegionSize), iy1 = (int) floor(box[3] / kRegionSize);
+	if ((long long) (ix1 - ix0 + 1) * (iy1 - iy0 + 1) > kMaxRegionTopics) {
+		return;
+	}
+	char region_topic[64];
+	for (int ix = ix0; ix <= ix1; ix++) {
+		for (int iy = iy0; iy <= iy1; iy++) {
+			snprintf(region_topic, sizeof(region_topic), "region/%d/%d", ix, iy);
+			if (subscribe) {
+				group.subscribe(ws, region_topic);
+			}
+			else {
+				group.unsubscribe(ws, region_topic);
+			}
+		}
+	}
+	// the tracks already there, as the region's estimates only come as
+	// they are updated
+	if (subscribe) {
+		const std::string reply = "42[\"tracks\"," + TrackRegistry::TracksJson(box) + "]";
+		ws.send(reply.data(), reply.length(), uWS::OpCode::TEXT);
+	}
+}
+
+void Session::OnHandoffEvent(uWS::WebSocket<uWS::SERVER> ws, bool freeze, const char *hex, size_t length) {
+	static const char digits[] = "0123456789abcdef";
+	if (freeze) {
+		std::string state;
+		Freeze(&state);
+		std::string reply = "42[\"frozen\",{\"state\":\"";
+		for (unsigned char c : state) {
+			reply += digits[c >> 4];
+			reply += digits[c & 15];
+		}
+		reply += "\"}]";
+		ws.send(reply.data(), reply.length(), uWS::OpCode::TEXT);
+		return;
+	}
+	bool valid = length % 2 == 0;
+	std::string state(length / 2, '\0');
+	for (size_t i = 0; valid && i < length; i += 2) {
+		const char *high = hex[i] ? strchr(digits, hex[i]) : nullptr;
+		const char *low = hex[i + 1] ? strchr(digits, hex[i + 1]) : nullptr;
+		valid = high && low;
+		if (valid) {
+			state[i / 2] = char((high - digits) << 4 | (low - digits));
+		}
+	}
+	if (!valid || !Thaw(state.data(), state.length())) {
+		std::cerr << "Ignoring a malformed track handoff" << std::endl;
+	}
+}
+
+void Session::Reset() {
+	if (shadow_ && measurements_) {
+		ShadowMeasurement closed;
+		closed.id = id_;
+		closed.closed = true;
+		shadow_->Submit(closed);
+	}
+	ukf_.Reset();
+	if (history_) {
+		history_->Reset();
+	}
+	if (reorder_) {
+		reorder_->Reset();
+	}
+	rmse_.Reset();
+	radar_nis_.Reset();
+	laser_nis_.Reset();
+	consistent_ = true;
+	track_state_->Withdraw();
+	TrackIndex::Remove(track_state_, &index_entry_);
+	if (TrackHistory *recent = track_state_->history()) {
+		recent->Clear();
+	}
+	zones_inside_.clear();
+	measurements_ = 0;
+	shedder_.Reset();
+	if (duplicates_) {
+		duplicates_->Reset();
+	}
+	shed_redundant_ = 0;
+	shed_low_information_ = 0;
+	restored_ = false;
+	std::fill(cost_ns_, cost_ns_ + LATENCY_STAGES, 0);
+	resume_token_.clear();
+	output_format_ = OUTPUT_AUTO;
+	qos_class_ = QOS_STANDARD;
+	set_qos_tier(QOS_FULL);
+}
+
+void Session::Restore(const TrackSnapshot &snapshot) {
+	CTRVUKF::Checkpoint checkpoint;
+	checkpoint.x = Eigen::Map<const Eigen::Matrix<double, 5, 1> >(snapshot.x);
+	checkpoint.P = Eigen::Map<const Eigen::Matrix<double, 5, 5, Eigen::RowMajor> >(snapshot.P);
+	checkpoint.S = checkpoint.P.llt().matrixL();
+	checkpoint.time_us = snapshot.time_us;
+	checkpoint.initialized = snapshot.initialized;
+	ukf_.Restore(checkpoint);
+	rmse_.Restore(Eigen::Map<const Eigen::Vector4d>(snapshot.rmse), size_t(snapshot.rmse_count));
+	consistent_ = snapshot.consistent;
+	measurements_ = snapshot.measurements;
+	shed_redundant_ = snapshot.shed_redundant;
+	shed_low_information_ = snapshot.shed_low_information;
+	restored_ = true;
+
+	TrackSnapshot restored = snapshot;
+	restored.id = id_;
+	restored.qos_tier = qos_tier();
+	std::copy(cost_ns_, cost_ns_ + LATENCY_STAGES, restored.cost_ns);
+	track_state_->Publish(restored);
+	if (restored.initialized) {
+		TrackIndex::Place(track_state_, restored.x[0], restored.x[1], &index_entry_);
+	}
+}
+
+template <class Scalar>
+void Session::Demote(ColdTrack<Scalar> *cold) {
+	if (reorder_) {
+		MeasurementPackage arrived = meas_package_;
+		bool has_ground_truth;
+		while (reorder_->Pop(LLONG_MAX, &meas_package_, &ground_truth_, &has_ground_truth)) {
+			Process(has_ground_truth);
+		}
+		meas_package_ = arrived;
+	}
+	cold->id = id_;
+	cold->initialized = ukf_.is_initialized_;
+	cold->consistent = consistent_;
+	cold->time_us = ukf_.time_us_;
+	cold->measurements = measurements_;
+	cold->shed_redundant = shed_redundant_;
+	cold->shed_low_information = shed_low_information_;
+	cold->rmse_count = (long long) rmse_.count();
+	for (int r = 0, e = 0; r < 5; r++) {
+		cold->x[r] = Scalar(ukf_.x_(r));
+		for (int c = r; c < 5; c++, e++) {
+			cold->P[e] = Scalar(ukf_.P_(r, c));
+		}
+	}
+	const Eigen::Vector4d RMSE = rmse_.RMSE();
+	for (int k = 0; k < 4; k++) {
+		cold->rmse[k] = Scalar(RMSE(k));
+	}
+}
+
+template <class Scalar>
+void Session::Promote(const ColdTrack<Scalar> &cold) {
+	set_id(cold.id);
+	TrackSnapshot snapshot = TrackSnapshot();
+	snapshot.id = cold.id;
+	snapshot.initialized = cold.initialized;
+	snapshot.consistent = cold.consistent;
+	snapshot.timestamp = cold.time_us;
+	snapshot.time_us = cold.time_us;
+	snapshot.measurements = cold.measurements;
+	snapshot.shed_redundant = cold.shed_redundant;
+	snapshot.shed_low_information = cold.shed_low_information;
+	snapshot.rmse_count = cold.rmse_count;
+	for (int r = 0, e = 0; r < 5; r++) {
+		snapshot.x[r] = cold.x[r];
+		for (int c = r; c < 5; c++, e++) {
+			snapshot.P[r * 5 + c] = snapshot.P[c * 5 + r] = cold.P[e];
+		}
+	}
+	for (int k = 0; k < 4; k++) {
+		snapshot.rmse[k] = cold.rmse[k];
+	}
+	Restore(snapshot);
+}
+
+void Session::Freeze(std::string *state) {
+	TrackSnapshot snapshot;
+	if (!track_state_->Read(&snapshot)) {
+		snapshot = TrackSnapshot();
+	}
+	snapshot.id = id_;
+	state->assign(session_checkpoint::kRecordSize + kHandoffHeaderSize, '\0');
+	session_checkpoint::EncodeRecord(&(*state)[0], snapshot);
+	uint32_t held = 0;
+	bool has_ground_truth;
+	while (reorder_ && reorder_->Pop(LLONG_MAX, &meas_package_, &ground_truth_, &has_ground_truth)) {
+		char measurement[record::kMeasurementSize + record::kGroundTruthSize];
+		const char *end = record::EncodeMeasurement(measurement, meas_package_, has_ground_truth ? &ground_truth_ : nullptr);
+		state->append(measurement, end - measurement);
+		held++;
+	}
+	for (int i = 0; i < 4; i++) {
+		(*state)[session_checkpoint::kRecordSize + i] = char(held >> (8 * i));
+	}
+	Metrics::Local().Add(METRIC_HANDOFFS_OUT);
+	Reset();
+}
+
+bool Session::Thaw(const char *state, size_t length) {
+	const size_t header = session_checkpoint::kRecordSize + kHandoffHeaderSize;
+	if (length < header) {
+		return false;
+	}
+	const unsigned char *count = reinterpret_cast<const unsigned char *>(state + session_checkpoint::kRecordSize);
+	const uint32_t held = uint32_t(count[0]) | uint32_t(count[1]) << 8 | uint32_t(count[2]) << 16 | uint32_t(count[3]) << 24;
+	const char *p = state + header;
+	const char *end = state + length;
+	bool has_ground_truth;
+	for (uint32_t i = 0; i < held && p; i++) {
+		p = record::DecodeMeasurement(p, end, &meas_package_, &ground_truth_, &has_ground_truth);
+	}
+	if (p != end) {
+		return false;
+	}
+
+	TrackSnapshot snapshot;
+	session_checkpoint::DecodeRecord(state, &snapshot);
+	set_id(snapshot.id);
+	if (snapshot.initialized) {
+		Restore(snapshot);
+		// the track goes on; its next measurement may be a late one
+		restored_ = false;
+	}
+	p = state + header;
+	for (uint32_t i = 0; i < held; i++) {
+		p = record::DecodeMeasurement(p, end, &meas_package_, &ground_truth_, &has_ground_truth);
+		Arrive(has_ground_truth);
+	}
+	Metrics::Local().Add(METRIC_HANDOFFS_IN);
+	return true;
+}
+
+template void Session::Demote(ColdTrack<float> *cold);
+template void Session::Demote(ColdTrack<double> *cold);
+template void Session::Promote(const ColdTrack<float> &cold);
+template void Session::Promote(const ColdTrack<double> &cold);
+
+SessionPool::SessionPool(size_t reserve)
+	: reorder_depth_(0), reorder_budget_us_(0), recorder_(nullptr), estimate_log_(nullptr), relay_(nullptr), shadow_(nullptr), geofence_(nullptr), shed_backlog_(0), shed_lag_us_(0),
+	  checkpoint_(nullptr), resumption_(nullptr), fixed_rate_(false), deduplicate_(false), histories_shed_(false) {
+	free_.reserve(reserve);
+	for (size_t i = 0; i < reserve; i++) {
+		free_.push_back(arena_.New<Session>());
+	}
+}
+
+SessionPool::~SessionPool() {
+	for (size_t i = 0; i < free_.size(); i++) {
+		free_[i]->~Session();
+	}
+}
+
+Session *SessionPool::Acquire() {
+	// track numbers run across all pools, as viewers may see several
+	static std::atomic<int> next_id(1);
+
+	Session *session;
+	if (free_.empty()) {
+		session = arena_.New<Session>();
+	}
+	else {
+		session = free_.back();
+		free_.pop_back();
+	}
+	session->set_id(next_id++);
+	session->set_reorder_depth(histories_shed_ ? 0 : reorder_depth_);
+	session->set_reorder_budget(reorder_budget_us_);
+	session->set_recorder(recorder_);
+	session->set_estimate_log(estimate_log_);
+	session->set_relay(relay_);
+	session->set_shadow(shadow_);
+	session->set_geofence(geofence_);
+	session->set_load_shedding(shed_backlog_, shed_lag_us_);
+	session->set_fixed_rate(fixed_rate_);
+	session->set_deduplication(deduplicate_);
+	TrackSnapshot snapshot;
+	if (checkpoint_ && checkpoint_->Take(session->id(), &snapshot)) {
+		session->Restore(snapshot);
+	}
+	live_.push_back(session);
+	MemoryAccount::Add(MEMORY_SESSIONS, sizeof(Session));
+	return session;
+}
+
+void SessionPool::Release(Session *session) {
+	if (!session) {
+		return;
+	}
+	MemoryAccount::Add(MEMORY_SESSIONS, -(long long) sizeof(Session));
+	if (resumption_ && !session->resume_token().empty() && session->measurements()) {
+		ColdTrack<double> cold;
+		session->Demote(&cold);
+		resumption_->Park(session->resume_token(), cold);
+	}
+	session->Reset();
+	if (histories_shed_) {
+		session->set_reorder_depth(0);
+	}
+	free_.push_back(session);
+	std::vector<Session *>::iterator live = std::find(live_.begin(), live_.end(), session);
+	if (live != live_.end()) {
+		*live = live_.back();
+		live_.pop_back();
+	}
+}
+
+void SessionPool::WarmUp(size_t sessions, int steps, bool huge_pages) {
+	if (free_.size() >= sessions) {
+		return;
+	}
+	arena_.Reserve((sessions - free_.size()) * sizeof(Session), huge_pages);
+	while (free_.size() < sessions) {
+		free_.push_back(arena_.New<Session>());
+	}
+	for (size_t i = 0; i < free_.size(); i++) {
+		free_[i]->WarmUp(steps);
+	}
+}
+
+bool SessionPool::Resume(Session *session, const std::string &token) {
+	if (!resumption_) {
+		return false;
+	}
+	session->set_resume_token(token);
+	ColdTrack<double> cold;
+	if (!resumption_->Take(token, &cold)) {
+		return false;
+	}
+	session->Promote(cold);
+	return true;
+}
+
+void SessionPool::ShedHistories() {
+	histories_shed_ = true;
+	for (size_t i = 0; i < live_.size(); i++) {
+		live_[i]->set_reorder_depth(0);
+	}
+}
@@ -0,0 +1,650 @@
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include <uWS/uWS.h>
+#include "arena.h"
+#include "cold_track.h"
+#include "duplicate_filter.h"
+#include "estimate_log.h"
+#include "load_shedder.h"
+#include "measurement_history.h"
+#include "measurement_log.h"
+#include "measurement_package.h"
+#include "measurement_parser.h"
+#include "measurement_record.h"
+#include "reorder_buffer.h"
+#include "session_checkpoint.h"
+#include "tools.h"
+#include "track_index.h"
+#include "track_state.h"
+#include "ukf.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Geofence;
+class SessionResumption;
+class ShadowFilter;
+class TrackRelay;
+
+/**
+ * State of one client connection: its own filter, RMSE and NIS statistics
+ * and reusable message buffers. Attached to the WebSocket with setUserData
+ * while the connection is open.
+ *
+ * A session is the suspended state of its connection's processing: the
+ * loop's frame parser calls OnMessage directly through the compile-time
+ * bound SessionPool::OnMessage, and the session, taken from its pool's
+ * arena, carries everything from one measurement to the next. Stages that
+ * hold measurements across messages, such as the reorder buffer, history
+ * and duplicate filter, are members set up once per session and kept as it
+ * is reused, so that no message allocates state or a callback for them.
+ *
+ * Every session is a track, and its estimates are published to viewers
+ * subscribed to any of the topics
+ *   track/<id>            the session's own estimates
+ *   region/<ix>/<iy>      estimates within the kRegionSize square at
+ *                         [ix, iy] * kRegionSize
+ *   tracks                all estimates
+ * as track events, 42["track",{"id":...,"timestamp":...,"x":...,...}],
+ * once for every subscribed topic the estimate falls under.
+ * Viewers subscribe and unsubscribe with the events
+ *   42["subscribe",{"topic":"track/3"}]
+ *   42["unsubscribe",{"topic":"track/3"}]
+ * and to the region topics a box x0,y0,x1,y1 in m overlaps, up to
+ * kMaxRegionTopics of them, with
+ *   42["subscribe",{"bbox":"-20,-20,20,20"}]
+ * which is answered with the tracks in the box as the HTTP API has them
+ * (see TrackIndex), 42["tracks",[...]].
+ *
+ * After every measurement the session also publishes a TrackSnapshot, which
+ * the HTTP API serves from any thread. With a geofence, a track entering or
+ * leaving one of its zones is published on the topic geofence as
+ *   42["geofence",{"event":"enter","id":3,"timestamp":...,"x":...,"y":...,"zone":"depot"}]
+ * or "exit", see CheckGeofence.
+ */
+class Session {
+public:
+  ///* number of recent NIS values the divergence warning is based on
+  static const size_t kNISWindow = 100;
+
+  ///* edge length of the region topics, in m
+  static const double kRegionSize;
+
+  ///* the most region topics a box subscribes to
+  static const int kMaxRegionTopics = 256;
+
+  ///* longest estimate_marker message: its fixed text and six numbers of at
+  ///* most 32 characters each
+  static const size_t kMaxEstimateMarker = 320;
+
+  ///* the count of held measurements behind the record of a Freeze
+  static const size_t kHandoffHeaderSize = 8;
+
+  /**
+   * Writes the Socket.IO estimate_marker event of an estimate and its RMSE
+   * to reply, as nlohmann::json would but with six decimals, and returns its
+   * length.
+   */
+  static size_t FormatEstimateMarker(char *reply, double estimate_x, double estimate_y, const Eigen::Vector4d &RMSE);
+
+  /**
+   * Writes the one estimate_marker event that answers a telemetry event of
+   * count measurement lines: estimate_x and estimate_y are arrays of the
+   * estimates in order, every stride doubles from x and y, and the RMSE is
+   * that after the last. Returns its length, at most
+   * MaxEstimateMarkers(count).
+   */
+  static size_t FormatEstimateMarkers(char *reply, const double *x, const double *y, size_t stride, size_t count,
+                                      const Eigen::Vector4d &RMSE);
+  static size_t MaxEstimateMarkers(size_t count) { return kMaxEstimateMarker + count * 2 * 33; }
+
+  /**
+   * How the estimates of a connection are answered, as its client asks with
+   * the WebSocket subprotocol ukf.json, ukf.binary or ukf.delta: Socket.IO
+   * estimate_marker events on TEXT frames, estimate records or compact
+   * estimate records (see measurement_record.h) on BINARY frames. Without
+   * one, OUTPUT_AUTO answers in the kind of frame the measurements came in,
+   * as the simulator expects.
+   */
+  enum OutputFormat { OUTPUT_AUTO, OUTPUT_JSON, OUTPUT_BINARY, OUTPUT_DELTA };
+
+  /**
+   * Reads the output format a client asks for from the Sec-WebSocket-Protocol
+   * header of its upgrade request, which may be null; OUTPUT_AUTO if it
+   * names none.
+   */
+  static OutputFormat ParseOutputFormat(const char *protocols, size_t length);
+
+  /**
+   * How much of the filter a session runs, from the full filter down to
+   * the cheapest, which a QosGovernor lowers under load:
+   *   - QOS_FULL, every measurement through the unscented updates
+   *   - QOS_HYBRID, every radar update linearized around the mean as by
+   *     an EKF (see UKF::always_linearize_); the lidar update is linear
+   *     anyway
+   *   - QOS_SHED, as hybrid, skipping the measurements an overloaded
+   *     session would at all times (see LoadShedder)
+   *   - QOS_MEAN_ONLY, as shed, updating at most once every
+   *     kMeanOnlyInterval of measurement time; the estimates between are
+   *     those of the last update, or its mean extrapolated for a fixed
+   *     rate (see EstimateAt)
+   */
+  enum QosTier { QOS_FULL, QOS_HYBRID, QOS_SHED, QOS_MEAN_ONLY, QOS_TIERS };
+
+  /**
+   * How far a session's tier may be lowered, as its client asks with
+   * ?qos=premium, standard or background in its URL: a premium track is
+   * always filtered in full, a standard one down to QOS_SHED and a
+   * background one, lowered first, down to QOS_MEAN_ONLY.
+   */
+  enum QosClass { QOS_PREMIUM, QOS_STANDARD, QOS_BACKGROUND };
+
+  ///* in us, the least time between the updates of QOS_MEAN_ONLY
+  static const long long kMeanOnlyInterval = 200000;
+
+  static const char *QosTierName(QosTier tier);
+
+  ///* reads the class of a ?qos= query value into qos_class; false if it
+  ///* names none
+  static bool ParseQosClass(const char *name, size_t length, QosClass *qos_class);
+
+  /**
+   * The tier of a session of qos_class at pressure level, 0 for none up to
+   * kQosLevels - 1: background sessions step down from level 1, standard
+   * ones from level 3, premium ones never.
+   */
+  static const int kQosLevels = 5;
+  static QosTier TierAt(QosClass qos_class, int level);
+
+  /**
+   * Appends the estimate record of format, OUTPUT_BINARY or OUTPUT_DELTA, to
+   * out; delta is the state of the frame for compact records.
+   */
+  static void AppendEstimate(std::vector<char> *out, OutputFormat format, record::EstimateDeltaState *delta,
+                             long long timestamp, double p_x, double p_y, const Eigen::Vector4d &rmse);
+
+  Session();
+  ~Session();
+
+  /**
+   * Handles one message of this session's connection: Socket.IO telemetry
+   * (the simulator) or viewer events on TEXT frames, measurement records on
+   * BINARY frames. Estimates are published on group's topics. A telemetry
+   * event of an array of lines is filtered as a batch, as the records of a
+   * BINARY frame are, and answered once.
+   */
+  void OnMessage(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws,
+                 char *data, size_t length, uWS::OpCode opCode);
+
+  /**
+   * Filters a batch of measurement records back to back (see
+   * measurement_record.h), as sent on BINARY frames or through a ShmChannel,
+   * and returns an estimate record for each of them, or their
+   * estimate_marker in the session's OUTPUT_JSON; start is when the batch
+   * arrived, on the clock of LatencyStats::Now.
+   */
+  const std::vector<char> &ProcessRecords(uWS::Group<uWS::SERVER> &group, const char *data,
+                                          size_t length, uint64_t start);
+
+  /**
+   * Answers the Socket.IO events of a TEXT frame other than measurements,
+   * of the given kind: manual mode and the viewer events.
+   */
+  void OnEvent(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws,
+               const char *data, size_t length, TelemetryMessage kind);
+
+  /**
+   * Filters one measurement parsed on another thread, as the filter workers
+   * of a Pipeline do, and returns the updated RMSE; ground_truth is null or
+   * the four values of the measurement's ground truth. A record of a binary
+   * frame that arrived at start may be shed with backlog records left of
+   * the frame, as in ProcessRecords; a start of 0 never sheds. Nothing is
+   * published: the estimate is that of filter() until the next call.
+   */
+  Eigen::Vector4d Filter(const MeasurementPackage &measurement, const double *ground_truth,
+                         size_t backlog, uint64_t start);
+
+  /**
+   * Publishes an estimate of this track, with its timestamp, to the topics
+   * that have subscribers.
+   */
+  void Publish(uWS::Group<uWS::SERVER> &group, long long timestamp, const CTRVUKF::StateVector &x);
+
+  /**
+   * Moves the track to the estimate x in the geofence, if there is one,
+   * and publishes the zones it entered and left on the topic geofence;
+   * after every estimate, on the session's loop, whether or not the
+   * estimates are published at a fixed rate.
+   */
+  void CheckGeofence(uWS::Group<uWS::SERVER> &group, long long timestamp, const CTRVUKF::StateVector &x);
+
+  /**
+   * Runs steps synthetic measurements of a target on a circle, laser and
+   * radar in turn, from their text lines through the filter to their
+   * estimate records and estimate_marker, then resets the filter: the code
+   * and scratch memory the first real measurements use are warm. Counts no
+   * metrics and publishes nothing; for a session not handed out yet.
+   */
+  void WarmUp(int steps);
+
+  const CTRVUKF &filter() const { return ukf_; }
+
+  int id() const { return id_; }
+  void set_id(int id);
+
+  ///* measurements the track has filtered, including those of a restored
+  ///* or thawed state
+  long long measurements() const { return measurements_; }
+
+  ///* the topic of the session's own estimates
+  const std::string &track_topic() const { return track_topic_; }
+
+  /**
+   * With fixed_rate, the estimates go to the viewers at the rate of a
+   * TrackPublisher rather than after every measurement; the client that
+   * sends the measurements is still answered each time.
+   */
+  void set_fixed_rate(bool fixed_rate) { fixed_rate_ = fixed_rate; }
+
+  /**
+   * The estimate now_ns (on the clock of LatencyStats::Now) would have: the
+   * state extrapolated from the last measurement by the time since it was
+   * filtered, at most max_us, and the timestamp of that state. False before
+   * the filter is initialized.
+   */
+  bool EstimateAt(uint64_t now_ns, long long max_us, long long *timestamp, CTRVUKF::StateVector *x) const;
+
+  /**
+   * With a depth, measurements arriving out of order are filtered at their
+   * place in time, as long as no more than depth measurements came after
+   * them (see MeasurementHistory); 0 filters everything as it arrives.
+   */
+  void set_reorder_depth(size_t depth);
+
+  /**
+   * With a budget, measurements are first held in a ReorderBuffer for up to
+   * budget_us from their arrival and filtered in timestamp order; one that
+   * stays held is answered with the estimate as it was. 0 holds nothing.
+   */
+  void set_reorder_budget(long long budget_us);
+
+  ///* bytes the session holds: itself, its reordering and its buffers
+  size_t memory() const;
+
+  /**
+   * Appends every measurement the session receives to recorder, with the
+   * session's id as its track, or to none if it is null. The recorder is
+   * not owned and may be shared by sessions on all threads.
+   */
+  void set_recorder(MeasurementLogRecorder *recorder) { recorder_ = recorder; }
+
+  /**
+   * Appends the estimate, NIS and RMSE after every measurement to
+   * estimate_log, or to none if it is null; not owned, and may be shared.
+   */
+  void set_estimate_log(EstimateLog *estimate_log) { estimate_log_ = estimate_log; }
+
+  /**
+   * Forwards the estimate after every measurement to relay, or to none if
+   * it is null; not owned, and of the session's loop.
+   */
+  void set_relay(TrackRelay *relay) { relay_ = relay; }
+
+  /**
+   * Submits every measurement the filter uses, with the filter's estimate,
+   * NIS and time for it, to shadow, or to none if it is null; not owned,
+   * and may be shared by sessions on all threads.
+   */
+  void set_shadow(ShadowFilter *shadow) { shadow_ = shadow; }
+
+  /**
+   * Reports the track entering and leaving the zones of geofence, or none
+   * if it is null; not owned, and may be shared by sessions on all
+   * threads. A track whose session ends leaves its zones without an event.
+   */
+  void set_geofence(const Geofence *geofence) { geofence_ = geofence; }
+
+  /**
+   * The token the client presented on connecting, under which the pool
+   * parks the track when the session is released (see SessionResumption);
+   * empty for none. Reset forgets it.
+   */
+  const std::string &resume_token() const { return resume_token_; }
+  void set_resume_token(const std::string &token) { resume_token_ = token; }
+
+  /**
+   * The output format the client negotiated on connecting; Reset returns
+   * it to OUTPUT_AUTO. reply_format is what a frame of measurements, binary
+   * or not, is answered in.
+   */
+  OutputFormat output_format() const { return output_format_; }
+  void set_output_format(OutputFormat format) { output_format_ = format; }
+  OutputFormat reply_format(bool binary) const {
+    return output_format_ != OUTPUT_AUTO ? output_format_ : binary ? OUTPUT_BINARY : OUTPUT_JSON;
+  }
+
+  /**
+   * Under a burst of binary measurement records, skips redundant and
+   * low-information measurements while more than backlog records are left
+   * of the frame or the frame has taken longer than lag_us (see
+   * LoadShedder); 0 for either turns that limit off. A skipped measurement
+   * is answered with the estimate as it was, like one too late to reorder.
+   */
+  void set_load_shedding(size_t backlog, long long lag_us) { shedder_.Configure(backlog, lag_us); }
+
+  QosClass qos_class() const { return qos_class_; }
+  void set_qos_class(QosClass qos_class) { qos_class_ = qos_class; }
+
+  ///* the tier the next measurement is filtered at; set from the loop's
+  ///* thread while a Pipeline's may be filtering
+  QosTier qos_tier() const { return QosTier(qos_tier_.load(std::memory_order_relaxed)); }
+  void set_qos_tier(QosTier tier) { qos_tier_.store(tier, std::memory_order_relaxed); }
+
+  /**
+   * With deduplicate, a measurement the session has just seen, of the same
+   * sensor, timestamp and values, is dropped before the reorder buffer and
+   * the filter (see DuplicateFilter) and answered with the estimate as it
+   * was, as a shed one is.
+   */
+  void set_deduplication(bool deduplicate) {
+    if (deduplicate != bool(duplicates_)) {
+      duplicates_.reset(deduplicate ? new DuplicateFilter() : nullptr);
+    }
+  }
+
+  /**
+   * Returns the session to its initial state for the next connection,
+   * keeping its buffers.
+   */
+  void Reset();
+
+  /**
+   * Continues the track of a checkpoint (see session_checkpoint.h): its
+   * filter state, measurement counts and RMSE, and publishes it. The NIS
+   * windows start empty. A first measurement from before the restored
+   * state is that of a client starting over, for which the session resets.
+   */
+  void Restore(const TrackSnapshot &snapshot);
+
+  /**
+   * Saves the track into a compact record before the session is released,
+   * for a sensor that has gone quiet; measurements still held for their
+   * order are filtered first. Promote continues it in a session acquired
+   * later, with the same track number, as Restore does from a checkpoint.
+   */
+  template <class Scalar>
+  void Demote(ColdTrack<Scalar> *cold);
+  template <class Scalar>
+  void Promote(const ColdTrack<Scalar> &cold);
+
+  /**
+   * Serializes the track for a handoff to a session of another loop or
+   * node, which continues it with Thaw instead of converging again: the
+   * checkpoint record of the track (see session_checkpoint.h), a uint32
+   * count of the measurements held for their order and four zero bytes,
+   * then those measurements, still unfiltered, as records of
+   * measurement_record.h with their ground truth where they have it. The
+   * session is reset afterwards, to be released.
+   */
+  void Freeze(std::string *state);
+
+  /**
+   * Continues the track of a Freeze under its number, filtering the
+   * measurements held in it in turn as they arrive here; the history for
+   * late measurements starts empty. False, leaving the session as it was,
+   * if state is not one.
+   */
+  bool Thaw(const char *state, size_t length);
+
+  CACHE_ALIGNED_OPERATOR_NEW
+
+private:
+  CTRVUKF ukf_;
+
+  ///* the recent measurements, only when reordering
+  std::unique_ptr<MeasurementHistory> history_;
+
+  ///* the measurements held for their order, only with a reorder budget
+  std::unique_ptr<ReorderBuffer> reorder_;
+
+  MeasurementLogRecorder *recorder_;
+  EstimateLog *estimate_log_;
+  TrackRelay *relay_;
+  ShadowFilter *shadow_;
+  const Geofence *geofence_;
+  ///* the zones the track is in, and those of the last estimate it entered
+  ///* and left
+  std::vector<int> zones_inside_;
+  std::vector<int> zones_entered_;
+  std::vector<int> zones_left_;
+
+  LoadShedder shedder_;
+  ///* null unless set_deduplication
+  std::unique_ptr<DuplicateFilter> duplicates_;
+
+  ///* track number, unique among the sessions of the process
+  int id_;
+  std::string track_topic_;
+  std::string resume_token_;
+  OutputFormat output_format_;
+  QosClass qos_class_;
+  std::atomic<int> qos_tier_;
+  ///* where the track is in the TrackIndex
+  TrackIndex::Entry index_entry_;
+
+  ///* bytes of history_ and reorder_, as counted in MemoryAccount
+  size_t history_memory() const;
+
+  ///* cumulative RMSE of the estimates
+  RunningRMSE rmse_;
+
+  ///* recent consistency of the filter, to notice divergence while it runs
+  NISMonitor radar_nis_;
+  NISMonitor laser_nis_;
+  bool consistent_;
+
+  ///* the snapshot of this track the HTTP API reads, and the measurements
+  ///* it counts
+  TrackState *track_state_;
+  long long measurements_;
+  long long shed_redundant_;
+  long long shed_low_information_;
+
+  ///* whether the track was restored and has not had a measurement since
+  bool restored_;
+
+  ///* published by a TrackPublisher, and when the last measurement was
+  ///* filtered
+  bool fixed_rate_;
+  uint64_t updated_ns_;
+
+  ///* the work of the track's messages on this thread, in ns by stage
+  ///* (see TrackSnapshot::cost_ns)
+  uint64_t cost_ns_[LATENCY_STAGES];
+
+  ///* of those, the filter's: its prediction and updates
+  uint64_t FilterCost() const {
+    return cost_ns_[LATENCY_PREDICTION] + cost_ns_[LATENCY_UPDATE_LIDAR] + cost_ns_[LATENCY_UPDATE_RADAR];
+  }
+
+  ///* reused for every message, so parsing does not allocate
+  MeasurementPackage meas_package_;
+  Eigen::Vector4d ground_truth_;
+  std::vector<char> binary_reply_;
+  ///* the estimates of a telemetry event of several lines, x and y
+  std::vector<double> marker_xy_;
+
+  /**
+   * Runs the filter on meas_package_ and returns the updated RMSE; the RMSE
+   * only advances for measurements that come with ground truth. While
+   * overloaded the measurement may be shed instead.
+   */
+  Eigen::Vector4d Process(bool has_ground_truth, bool overloaded = false);
+
+  /**
+   * Takes meas_package_ as Process does, through the reorder buffer if
+   * there is one: the measurements it releases are filtered, and
+   * meas_package_ is the arrived one again afterwards.
+   */
+  Eigen::Vector4d Arrive(bool has_ground_truth, bool overloaded = false);
+
+  /**
+   * Filters the lines of a TELEMETRY_MEASUREMENTS event, from lines to end,
+   * and answers them with FormatEstimateMarkers, or estimate records in a
+   * binary output format; start is when the event arrived.
+   */
+  void OnMeasurementLines(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws,
+                          const char *lines, const char *end, uint64_t start);
+
+  /**
+   * Applies a viewer's subscribe or unsubscribe event, or a router's
+   * handoff event, read with ParseEvent straight from the message; only one
+   * it cannot read goes through a JSON document.
+   */
+  void OnViewerEvent(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws,
+                     const char *data, size_t length);
+
+  ///* subscribes ws to, or unsubscribes it from, the region topics of the
+  ///* box [bbox, bbox_end) of a viewer's event
+  void OnRegionEvent(uWS::Group<uWS::SERVER> &group, uWS::WebSocket<uWS::SERVER> ws, bool subscribe,
+                     const char *bbox, const char *bbox_end);
+
+  /**
+   * Answers a router's freeze event with a frozen event whose state is the
+   * Freeze of the track in hexadecimal, and continues the track of a thaw
+   * event's state, for moving tracks between nodes (see ShardRouter).
+   */
+  void OnHandoffEvent(uWS::WebSocket<uWS::SERVER> ws, bool freeze, const char *hex, size_t length);
+
+  Session(const Session &);
+  Session &operator=(const Session &);
+};
+
+/**
+ * Recycles sessions between connections: released sessions are reset and
+ * kept on a free list for the next Acquire, so clients reconnecting do not
+ * go through the heap. The sessions themselves, with their filters, are
+ * placed one after another in the pool's Arena, so that the sessions of one
+ * event loop thread stay together in memory and go with the pool at once.
+ */
+class SessionPool {
+public:
+  /**
+   * @param reserve Number of sessions to create up front
+   */
+  explicit SessionPool(size_t reserve = 0);
+
+  ///* destroys the pooled sessions and frees the arena; all sessions must
+  ///* have been released
+  ~SessionPool();
+
+  Session *Acquire();
+  void Release(Session *session);
+
+  ///* Session::OnMessage for the session of ws, if it has one; the message
+  ///* handler of the loop's group, bound with Group::onMessage<SessionPool, ...>
+  void OnMessage(uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode) {
+    if (Session *session = static_cast<Session *>(ws.getUserData())) {
+      session->OnMessage(*uWS::getGroup<uWS::SERVER>(uS::Socket(ws.getPollHandle())), ws, data, length, opCode);
+    }
+  }
+
+  /**
+   * Creates sessions until the pool holds that many ready for reuse, in
+   * chunks of the arena faulted in beforehand (see Arena::Reserve), and
+   * warms each with steps synthetic measurements (see Session::WarmUp); on
+   * the pool's thread, before its loop takes connections.
+   */
+  void WarmUp(size_t sessions, int steps, bool huge_pages);
+
+  /**
+   * Gives session the client's token and, if a track is parked under it,
+   * continues that track as Promote does; false if there was none. A
+   * session released with a token parks its track until the client comes
+   * back or the grace period is over. Without set_resumption the token is
+   * ignored.
+   */
+  bool Resume(Session *session, const std::string &token);
+
+  ///* sessions in use, and released sessions ready for reuse
+  size_t live() const { return live_.size(); }
+  size_t pooled() const { return free_.size(); }
+
+  ///* the sessions in use, in no order
+  const std::vector<Session *> &live_sessions() const { return live_; }
+
+  ///* Session::set_reorder_depth of the sessions handed out from now on
+  void set_reorder_depth(size_t depth) { reorder_depth_ = depth; }
+
+  /**
+   * Drops the histories of the live sessions, and hands out and takes back
+   * sessions without one, until KeepHistories; for a MemoryGovernor.
+   */
+  void ShedHistories();
+  void KeepHistories() { histories_shed_ = false; }
+  bool histories_shed() const { return histories_shed_; }
+
+  ///* Session::set_reorder_budget of the sessions handed out from now on
+  void set_reorder_budget(long long budget_us) { reorder_budget_us_ = budget_us; }
+
+  ///* Session::set_recorder of the sessions handed out from now on
+  void set_recorder(MeasurementLogRecorder *recorder) { recorder_ = recorder; }
+
+  ///* Session::set_estimate_log of the sessions handed out from now on
+  void set_estimate_log(EstimateLog *estimate_log) { estimate_log_ = estimate_log; }
+
+  ///* Session::set_relay of the sessions handed out from now on
+  void set_relay(TrackRelay *relay) { relay_ = relay; }
+
+  ///* Session::set_shadow of the sessions handed out from now on
+  void set_shadow(ShadowFilter *shadow) { shadow_ = shadow; }
+
+  ///* Session::set_geofence of the sessions handed out from now on
+  void set_geofence(const Geofence *geofence) { geofence_ = geofence; }
+
+  ///* Session::set_load_shedding of the sessions handed out from now on
+  void set_load_shedding(size_t backlog, long long lag_us) {
+    shed_backlog_ = backlog;
+    shed_lag_us_ = lag_us;
+  }
+
+  ///* Session::set_fixed_rate of the sessions handed out from now on
+  void set_fixed_rate(bool fixed_rate) { fixed_rate_ = fixed_rate; }
+
+  ///* Session::set_deduplication of the sessions handed out from now on
+  void set_deduplication(bool deduplicate) { deduplicate_ = deduplicate; }
+
+  ///* where released sessions with a token park their tracks; not owned,
+  ///* and may be shared by the pools of all threads
+  void set_resumption(SessionResumption *resumption) { resumption_ = resumption; }
+
+  ///* a session handed out with the id of a track of checkpoint continues
+  ///* that track; not owned, and may be shared by the pools of all threads
+  void set_checkpoint(CheckpointReader *checkpoint) { checkpoint_ = checkpoint; }
+
+private:
+  Arena arena_;
+  std::vector<Session *> free_;
+  std::vector<Session *> live_;
+  size_t reorder_depth_;
+  long long reorder_budget_us_;
+  MeasurementLogRecorder *recorder_;
+  EstimateLog *estimate_log_;
+  TrackRelay *relay_;
+  ShadowFilter *shadow_;
+  const Geofence *geofence_;
+  size_t shed_backlog_;
+  long long shed_lag_us_;
+  CheckpointReader *checkpoint_;
+  SessionResumption *resumption_;
+  bool fixed_rate_;
+  bool deduplicate_;
+  bool histories_shed_;
+
+  SessionPool(const SessionPool &);
+  SessionPool &operator=(const SessionPool &);
+};
+
+#endif /* SESSION_H_ */
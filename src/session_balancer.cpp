@@ -0,0 +1,148 @@
+#include "session_balancer.h"
+#include <cmath>
+#include <iostream>
+#include <string>
+
+const double SessionBalancer::kMinUtilization = 0.5;
+const double SessionBalancer::kMargin = 0.2;
+const int SessionBalancer::kSettleIntervals;
+
+SessionBalancer::SessionBalancer(uWS::HubPool &pool, uWS::Hub &h, int index, SessionPool &sessions, int interval_ms)
+	: pool_(&pool), hub_(&h), index_(index), sessions_(&sessions), timer_(new uv_timer_t), moved_(0),
+	  moved_for_rate_(0), settling_(0) {
+	uv_timer_init(h.getLoop(), timer_);
+	timer_->data = this;
+	uv_timer_start(timer_, [](uv_timer_t *timer) {
+		static_cast<SessionBalancer *>(timer->data)->Balance();
+	}, interval_ms, interval_ms);
+}
+
+SessionBalancer::~SessionBalancer() {
+	uv_timer_stop(timer_);
+	uv_close(timer_, [](uv_handle_t *handle) {
+		delete (uv_timer_t *) handle;
+	});
+}
+
+void SessionBalancer::Balance() {
+	// the utilization of every loop over the interval, or -1 where it is not
+	// known yet
+	const int workers = pool_->getWorkers();
+	std::vector<uS::LoopStats> stats = pool_->getLoopStats();
+	std::vector<double> utilization(workers, -1);
+	if (busy_seconds_.size() != size_t(workers)) {
+		busy_seconds_.assign(workers, 0);
+		seconds_.assign(workers, 0);
+	}
+	for (int i = 0; i < workers; i++) {
+		const uS::LoopStats &loop = stats[i + 1];
+		const double busy = loop.seconds - loop.idleSeconds;
+		if (seconds_[i] > 0 && loop.seconds > seconds_[i]) {
+			utilization[i] = (busy - busy_seconds_[i]) / (loop.seconds - seconds_[i]);
+		}
+		busy_seconds_[i] = busy;
+		seconds_[i] = loop.seconds;
+	}
+
+	// the measurements each sensor filtered in the interval, or -1 for those
+	// not seen before; a session reused for another track starts over. A
+	// socket cannot leave the group while it is being walked, so the one to
+	// move is picked first
+	std::vector<std::pair<uWS::WebSocket<uWS::SERVER>, long long> > sensors;
+	std::unordered_map<Session *, Sample> samples;
+	long long total = 0;
+	hub_->getDefaultGroup<uWS::SERVER>().forEach([this, &sensors, &samples, &total](uWS::WebSocket<uWS::SERVER> ws) {
+		Session *session = static_cast<Session *>(ws.getUserData());
+		if (!session || !session->filter().is_initialized_) {
+			return;
+		}
+		Sample sample = {session->id(), session->measurements(), 0};
+		long long rate = -1;
+		std::unordered_map<Session *, Sample>::const_iterator it = samples_.find(session);
+		if (it != samples_.end() && it->second.id == sample.id && it->second.measurements <= sample.measurements) {
+			rate = sample.measurements - it->second.measurements;
+			sample.intervals = it->second.intervals + 1;
+			total += rate;
+		}
+		samples[session] = sample;
+		sensors.push_back(std::make_pair(ws, sample.intervals >= kSettleIntervals ? rate : -1));
+	});
+	samples_.swap(samples);
+	if (settling_ > 0) {
+		settling_--;
+	}
+	if (sensors.empty()) {
+		return;
+	}
+
+	// first the connections, with the quietest sensor, unless the worker
+	// with the fewest is the busier by the margin
+	int fewest = index_;
+	for (int i = 0; i < workers; i++) {
+		if (pool_->getConnections(i) < pool_->getConnections(fewest)) {
+			fewest = i;
+		}
+	}
+	if (pool_->getConnections(index_) - pool_->getConnections(fewest) >= 2
+	    && (utilization[index_] < 0 || utilization[fewest] < utilization[index_] + kMargin)) {
+		size_t quietest = 0;
+		for (size_t i = 1; i < sensors.size(); i++) {
+			if (sensors[i].second >= 0 && (sensors[quietest].second < 0 || sensors[i].second < sensors[quietest].second)) {
+				quietest = i;
+			}
+		}
+		Move(sensors[quietest].first, fewest);
+		return;
+	}
+
+	// then the utilization, with the sensor whose share of this loop's work
+	// leaves the two loops closest, if any brings them closer at all
+	if (settling_ > 0 || utilization[index_] < kMinUtilization || total <= 0) {
+		return;
+	}
+	int idlest = -1;
+	for (int i = 0; i < workers; i++) {
+		if (i != index_ && utilization[i] >= 0 && !stats[i + 1].pendingTransfers
+		    && (idlest < 0 || utilization[i] < utilization[idlest])) {
+			idlest = i;
+		}
+	}
+	if (idlest < 0) {
+		return;
+	}
+	const double gap = utilization[index_] - utilization[idlest];
+	if (gap < kMargin) {
+		return;
+	}
+	int best = -1;
+	double best_gap = gap;
+	for (size_t i = 0; i < sensors.size(); i++) {
+		if (sensors[i].second <= 0) {
+			continue;
+		}
+		const double share = utilization[index_] * sensors[i].second / total;
+		if (std::fabs(gap - 2 * share) < best_gap) {
+			best = int(i);
+			best_gap = std::fabs(gap - 2 * share);
+		}
+	}
+	if (best < 0) {
+		return;
+	}
+	Move(sensors[best].first, idlest);
+	moved_for_rate_++;
+	settling_ = kSettleIntervals;
+}
+
+void SessionBalancer::Move(uWS::WebSocket<uWS::SERVER> ws, int to) {
+	Session *session = static_cast<Session *>(ws.getUserData());
+	samples_.erase(session);
+	std::string *state = new std::string;
+	session->Freeze(state);
+	sessions_->Release(session);
+	//the worker taking the socket over thaws the state as it connects
+	ws.setUserData(state);
+	pool_->transfer(ws, index_, to);
+	moved_++;
+	std::cout << "Moved a track from worker " << index_ << " to worker " << to << std::endl;
+}
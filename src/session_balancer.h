@@ -0,0 +1,98 @@
+#ifndef SESSION_BALANCER_H_
+#define SESSION_BALANCER_H_
+
+#include <uWS/uWS.h>
+#include "session.h"
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Evens out the tracks of the worker loops of a HubPool as they run,
+ * rather than only as connections are accepted: sensors that connected
+ * together stay on one loop however long they stream, while the loops
+ * their neighbours were given may have emptied, and a few chatty sensors
+ * can keep one loop busy while the others idle with as many connections.
+ *
+ * Every interval a timer on one worker's loop compares the worker with the
+ * others. While it has at least two connections more than the one with
+ * the fewest, it hands a sensor over to that one. Otherwise, while its
+ * loop has been busy at least kMinUtilization of the last interval and
+ * kMargin more than the least busy loop, it hands over the busiest of its
+ * sensors whose share of the work, by the measurements each filtered in
+ * the interval, does not merely move the imbalance: the one that leaves
+ * the two loops closest. The session is frozen (see Session::Freeze) into
+ * the socket's user data, the socket transferred, and the track thawed on
+ * the other worker as it connects there, so that it continues with the
+ * same id and filter state and the sensor does not notice. Viewers, and
+ * sensors whose track has not started, are not moved.
+ *
+ * Against thrashing, a sensor is only moved by its rate once it has been
+ * on the loop for kSettleIntervals, a worker waits as long after moving
+ * one that way before it does again, for the utilization to show the
+ * move, and a loop with transfers still to take is not sent another. The
+ * utilization is that libuv measures as idle time, where the loop has it;
+ * without, only the connections are compared.
+ *
+ * The balancer belongs to the worker's thread and must be created there.
+ * The sessions of the loop must be filtered on it, not by a Pipeline.
+ */
+class SessionBalancer {
+public:
+  ///* the least utilization of a loop to move a sensor away for its rate
+  static const double kMinUtilization;
+
+  ///* how much busier than the least busy loop that must be
+  static const double kMargin;
+
+  ///* intervals a sensor stays before being moved for its rate, and a
+  ///* worker waits after such a move
+  static const int kSettleIntervals = 3;
+
+  SessionBalancer(uWS::HubPool &pool, uWS::Hub &h, int index, SessionPool &sessions, int interval_ms);
+
+  ///* stops the timer
+  ~SessionBalancer();
+
+  ///* moves one track to another worker if this one has two connections
+  ///* more than it, or is the busier by the margin
+  void Balance();
+
+  ///* tracks handed over, for the connection counts and for the rates
+  long long moved() const { return moved_; }
+  long long moved_for_rate() const { return moved_for_rate_; }
+
+private:
+  ///* a sensor's measurements when last seen, and for how many intervals
+  ///* it has been seen
+  struct Sample {
+    int id;
+    long long measurements;
+    int intervals;
+  };
+
+  uWS::HubPool *pool_;
+  uWS::Hub *hub_;
+  int index_;
+  SessionPool *sessions_;
+  uv_timer_t *timer_;
+  long long moved_;
+  long long moved_for_rate_;
+
+  ///* the loops' busy and running seconds at the last interval, from the
+  ///* first worker on
+  std::vector<double> busy_seconds_;
+  std::vector<double> seconds_;
+
+  std::unordered_map<Session *, Sample> samples_;
+
+  ///* intervals left before the next move for a rate
+  int settling_;
+
+  ///* hands the sensor of ws over to worker to
+  void Move(uWS::WebSocket<uWS::SERVER> ws, int to);
+
+  SessionBalancer(const SessionBalancer &);
+  SessionBalancer &operator=(const SessionBalancer &);
+};
+
+#endif /* SESSION_BALANCER_H_ */
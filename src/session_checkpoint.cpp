@@ -0,0 +1,256 @@
+#include "session_checkpoint.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace session_checkpoint;
+
+namespace {
+
+const char kMagic[8] = {'U', 'K', 'F', 'C', 'K', 'P', 'T', '1'};
+const uint32_t kVersion = 1;
+
+const uint32_t kInitialized = 1;
+const uint32_t kConsistent = 2;
+
+template <class T>
+void Store(char *p, T value) {
+	memcpy(p, &value, sizeof(value));
+}
+
+template <class T>
+T Load(const char *p) {
+	T value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+bool LittleEndian() {
+	const uint16_t one = 1;
+	return *reinterpret_cast<const unsigned char *>(&one) == 1;
+}
+
+bool WriteAll(int fd, const char *data, size_t length) {
+	while (length) {
+		const ssize_t written = write(fd, data, length);
+		if (written < 0) {
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+}
+
+namespace session_checkpoint {
+
+void EncodeRecord(char *p, const TrackSnapshot &snapshot) {
+	memset(p, 0, kRecordSize);
+	Store<int32_t>(p, snapshot.id);
+	Store<uint32_t>(p + 4, (snapshot.initialized ? kInitialized : 0) | (snapshot.consistent ? kConsistent : 0));
+	Store<int64_t>(p + 8, snapshot.time_us);
+	Store<int64_t>(p + 16, snapshot.measurements);
+	Store<int64_t>(p + 24, snapshot.shed_redundant);
+	Store<int64_t>(p + 32, snapshot.shed_low_information);
+	Store<int64_t>(p + 40, snapshot.rmse_count);
+	memcpy(p + 48, snapshot.x, sizeof(snapshot.x));
+	memcpy(p + 88, snapshot.P, sizeof(snapshot.P));
+	memcpy(p + 288, snapshot.rmse, sizeof(snapshot.rmse));
+}
+
+void DecodeRecord(const char *p, TrackSnapshot *snapshot) {
+	memset(snapshot, 0, sizeof(*snapshot));
+	snapshot->id = Load<int32_t>(p);
+	const uint32_t flags = Load<uint32_t>(p + 4);
+	snapshot->initialized = (flags & kInitialized) != 0;
+	snapshot->consistent = (flags & kConsistent) != 0;
+	snapshot->time_us = Load<int64_t>(p + 8);
+	snapshot->timestamp = snapshot->time_us;
+	snapshot->measurements = Load<int64_t>(p + 16);
+	snapshot->shed_redundant = Load<int64_t>(p + 24);
+	snapshot->shed_low_information = Load<int64_t>(p + 32);
+	snapshot->rmse_count = Load<int64_t>(p + 40);
+	memcpy(snapshot->x, p + 48, sizeof(snapshot->x));
+	memcpy(snapshot->P, p + 88, sizeof(snapshot->P));
+	memcpy(snapshot->rmse, p + 288, sizeof(snapshot->rmse));
+}
+
+}
+
+const int CheckpointWriter::kInterval;
+
+CheckpointWriter::CheckpointWriter()
+	: interval_ms_(kInterval), restored_(nullptr), stopping_(false), failed_(false), written_(0) {}
+
+CheckpointWriter::~CheckpointWriter() {
+	Stop();
+}
+
+bool CheckpointWriter::Write(const char *path, std::vector<TrackSnapshot> *snapshots) {
+	if (!LittleEndian()) {
+		return false;
+	}
+	std::sort(snapshots->begin(), snapshots->end(), [](const TrackSnapshot &a, const TrackSnapshot &b) {
+		return a.id < b.id;
+	});
+	std::vector<char> data(kHeaderSize + snapshots->size() * kRecordSize, 0);
+	memcpy(&data[0], kMagic, sizeof(kMagic));
+	Store<uint32_t>(&data[8], kVersion);
+	Store<uint32_t>(&data[12], uint32_t(kRecordSize));
+	Store<uint64_t>(&data[16], snapshots->size());
+	Store<int64_t>(&data[24], std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+	for (size_t i = 0; i < snapshots->size(); i++) {
+		EncodeRecord(&data[kHeaderSize + i * kRecordSize], (*snapshots)[i]);
+	}
+
+	//the previous checkpoint stays until this one is complete on disk
+	const std::string temporary = std::string(path) + ".tmp";
+	const int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	bool ok = WriteAll(fd, &data[0], data.size());
+	ok = fsync(fd) == 0 && ok;
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(temporary.c_str(), path) != 0) {
+		unlink(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool CheckpointWriter::Start(const char *path, int interval_ms, CheckpointReader *restored) {
+	Stop();
+	path_ = path;
+	interval_ms_ = interval_ms > 0 ? interval_ms : kInterval;
+	restored_ = restored;
+	stopping_ = false;
+	failed_ = false;
+	if (!WriteNow()) {
+		return false;
+	}
+	writer_ = std::thread(&CheckpointWriter::Run, this);
+	return true;
+}
+
+bool CheckpointWriter::WriteNow() {
+	TrackRegistry::CopyLive(&snapshots_);
+	if (restored_) {
+		restored_->CopyUntaken(&snapshots_);
+	}
+	const bool ok = Write(path_.c_str(), &snapshots_);
+	if (ok) {
+		written_.store(written_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+	return ok;
+}
+
+void CheckpointWriter::Run() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!stopping_) {
+		wake_.wait_for(lock, std::chrono::milliseconds(interval_ms_), [this]() { return stopping_; });
+		lock.unlock();
+		const bool ok = WriteNow();
+		lock.lock();
+		failed_ = failed_ || !ok;
+	}
+}
+
+bool CheckpointWriter::Stop() {
+	if (!writer_.joinable()) {
+		return true;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	//the writer wakes and writes the last checkpoint on its way out
+	wake_.notify_all();
+	writer_.join();
+	return !failed_;
+}
+
+CheckpointReader::CheckpointReader()
+	: data_(nullptr), length_(0), tracks_(0) {}
+
+CheckpointReader::~CheckpointReader() {
+	if (data_) {
+		munmap(const_cast<char *>(data_), length_);
+	}
+}
+
+bool CheckpointReader::Open(const char *path) {
+	if (!LittleEndian()) {
+		return false;
+	}
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	void *mapped = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && size_t(st.st_size) >= kHeaderSize) {
+		mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+	if (data_) {
+		munmap(const_cast<char *>(data_), length_);
+	}
+	data_ = static_cast<const char *>(mapped);
+	length_ = st.st_size;
+	tracks_ = 0;
+
+	const uint64_t tracks = Load<uint64_t>(data_ + 16);
+	if (memcmp(data_, kMagic, sizeof(kMagic)) != 0 || Load<uint32_t>(data_ + 8) != kVersion
+		|| Load<uint32_t>(data_ + 12) != kRecordSize || tracks > (length_ - kHeaderSize) / kRecordSize) {
+		return false;
+	}
+	tracks_ = tracks;
+	taken_.reset(new std::atomic<bool>[tracks_]);
+	for (size_t i = 0; i < tracks_; i++) {
+		taken_[i].store(false, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+bool CheckpointReader::Take(int id, TrackSnapshot *snapshot) {
+	//the records are in id order
+	size_t begin = 0;
+	size_t end = tracks_;
+	while (begin < end) {
+		const size_t middle = begin + (end - begin) / 2;
+		if (Load<int32_t>(data_ + kHeaderSize + middle * kRecordSize) < id) {
+			begin = middle + 1;
+		}
+		else {
+			end = middle;
+		}
+	}
+	const char *record = data_ + kHeaderSize + begin * kRecordSize;
+	if (begin == tracks_ || Load<int32_t>(record) != id || taken_[begin].exchange(true, std::memory_order_acq_rel)) {
+		return false;
+	}
+	DecodeRecord(record, snapshot);
+	return true;
+}
+
+void CheckpointReader::CopyUntaken(std::vector<TrackSnapshot> *snapshots) const {
+	TrackSnapshot snapshot;
+	for (size_t i = 0; i < tracks_; i++) {
+		if (!taken_[i].load(std::memory_order_acquire)) {
+			DecodeRecord(data_ + kHeaderSize + i * kRecordSize, &snapshot);
+			snapshots->push_back(snapshot);
+		}
+	}
+}
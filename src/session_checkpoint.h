@@ -0,0 +1,156 @@
+#ifndef SESSION_CHECKPOINT_H_
+#define SESSION_CHECKPOINT_H_
+
+#include "track_state.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Checkpoint of the filters of all sessions, so that a restarted server
+ * continues every track from its last state instead of converging again.
+ * The file is a header and one fixed-size record per track, in id order:
+ *
+ *   header   64 bytes
+ *      0  char    magic[8]      "UKFCKPT1"
+ *      8  uint32  version       1
+ *     12  uint32  record_size   320
+ *     16  uint64  tracks
+ *     24  int64   written       wall clock time of the checkpoint, in us
+ *   record   320 bytes
+ *      0  int32   id
+ *      4  uint32  flags         bit 0: initialized, bit 1: consistent
+ *      8  int64   time_us       time the state is true at
+ *     16  int64   measurements, shed_redundant, shed_low_information
+ *     40  int64   rmse_count
+ *     48  double  x[5]
+ *     88  double  P[25]         row major
+ *    288  double  rmse[4]
+ *
+ * All fields are little-endian, like those of measurement_log.h.
+ */
+namespace session_checkpoint {
+
+const size_t kHeaderSize = 64;
+const size_t kRecordSize = 320;
+
+///* writes the record of a track, kRecordSize bytes, at p
+void EncodeRecord(char *p, const TrackSnapshot &snapshot);
+
+///* reads the record at p; the NIS values are not kept, and come again
+///* with the next measurement
+void DecodeRecord(const char *p, TrackSnapshot *snapshot);
+
+}
+
+class CheckpointReader;
+
+/**
+ * Writes a checkpoint of the live tracks every interval on a thread of its
+ * own. The tracks are read from their TrackStates, which the sessions
+ * publish after every measurement anyway, so the event loops neither stop
+ * nor copy anything for it. Each checkpoint goes to a temporary file that
+ * replaces the previous one once it is complete, so a crash while writing
+ * leaves the last checkpoint in place. Tracks restored from a checkpoint
+ * that no session has taken over yet are written again, so that they
+ * survive a restart before their clients reconnect.
+ */
+class CheckpointWriter {
+public:
+  ///* in ms, by default
+  static const int kInterval = 1000;
+
+  CheckpointWriter();
+
+  ///* stops the writer, writing a last checkpoint
+  ~CheckpointWriter();
+
+  /**
+   * Writes a first checkpoint to path and then one every interval_ms.
+   * @param restored The checkpoint the server started from, or null; not
+   * owned, and it must outlive the writer
+   * @return false if the first checkpoint cannot be written
+   */
+  bool Start(const char *path, int interval_ms = kInterval, CheckpointReader *restored = nullptr);
+
+  ///* writes a last checkpoint and stops; false if any write failed
+  bool Stop();
+
+  /**
+   * Writes the snapshots to path at once, through a temporary file.
+   * @return false if it cannot be written
+   */
+  static bool Write(const char *path, std::vector<TrackSnapshot> *snapshots);
+
+  ///* checkpoints written
+  long long written() const { return written_.load(std::memory_order_relaxed); }
+
+private:
+  std::string path_;
+  int interval_ms_;
+  CheckpointReader *restored_;
+  std::thread writer_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_;
+  bool failed_;
+  std::atomic<long long> written_;
+
+  ///* the writer thread's
+  std::vector<TrackSnapshot> snapshots_;
+
+  ///* collects the tracks and writes one checkpoint
+  bool WriteNow();
+
+  void Run();
+
+  CheckpointWriter(const CheckpointWriter &);
+  CheckpointWriter &operator=(const CheckpointWriter &);
+};
+
+/**
+ * A checkpoint mapped into memory at startup, whose tracks the sessions
+ * take over as they are handed out: the session given a checkpointed id
+ * continues that track. Every track is taken once; Take is safe from all
+ * event loop threads.
+ */
+class CheckpointReader {
+public:
+  CheckpointReader();
+  ~CheckpointReader();
+
+  /**
+   * Maps the checkpoint at path.
+   * @return false if it cannot be opened or is not a checkpoint
+   */
+  bool Open(const char *path);
+
+  ///* tracks in the checkpoint
+  size_t size() const { return tracks_; }
+
+  /**
+   * Copies the checkpointed track id into snapshot, unless there is none
+   * or it was taken before.
+   */
+  bool Take(int id, TrackSnapshot *snapshot);
+
+  ///* appends the tracks not taken yet to snapshots
+  void CopyUntaken(std::vector<TrackSnapshot> *snapshots) const;
+
+private:
+  const char *data_;
+  size_t length_;
+  size_t tracks_;
+  std::unique_ptr<std::atomic<bool>[]> taken_;
+
+  CheckpointReader(const CheckpointReader &);
+  CheckpointReader &operator=(const CheckpointReader &);
+};
+
+#endif /* SESSION_CHECKPOINT_H_ */
@@ -0,0 +1,109 @@
+#include "session_resumption.h"
+#include "latency.h"
+#include "metrics.h"
+#include <cstring>
+
+namespace {
+
+///* takes [begin, end) as the token if it is one
+bool TakeToken(const char *begin, const char *end, std::string *token) {
+	if (begin == end || size_t(end - begin) > SessionResumption::kMaxToken) {
+		return false;
+	}
+	for (const char *c = begin; c != end; c++) {
+		if (!(('a' <= *c && *c <= 'z') || ('A' <= *c && *c <= 'Z') || ('0' <= *c && *c <= '9') || *c == '-' || *c == '_')) {
+			return false;
+		}
+	}
+	token->assign(begin, end);
+	return true;
+}
+
+}
+
+const size_t SessionResumption::kMaxToken;
+
+SessionResumption::SessionResumption(int grace_ms)
+	: grace_ns_(uint64_t(grace_ms) * 1000000), swept_ns_(0) {}
+
+bool SessionResumption::ParseToken(const char *url, size_t url_length, const char *protocols, size_t protocols_length,
+                                   std::string *token) {
+	static const char parameter[] = "session=";
+	const char *end = url + url_length;
+	const char *query = url ? static_cast<const char *>(memchr(url, '?', url_length)) : nullptr;
+	for (const char *p = query; p && p < end; ) {
+		const char *next = static_cast<const char *>(memchr(p + 1, '&', end - p - 1));
+		if (size_t(end - p - 1) >= sizeof(parameter) - 1 && !memcmp(p + 1, parameter, sizeof(parameter) - 1)) {
+			return TakeToken(p + sizeof(parameter), next ? next : end, token);
+		}
+		p = next;
+	}
+
+	static const char prefix[] = "session.";
+	end = protocols + protocols_length;
+	for (const char *p = protocols; p && p < end; ) {
+		while (p < end && (*p == ' ' || *p == ',')) {
+			p++;
+		}
+		const char *next = static_cast<const char *>(memchr(p, ',', end - p));
+		const char *last = next ? next : end;
+		while (last > p && last[-1] == ' ') {
+			last--;
+		}
+		if (size_t(last - p) >= sizeof(prefix) - 1 && !memcmp(p, prefix, sizeof(prefix) - 1)) {
+			return TakeToken(p + sizeof(prefix) - 1, last, token);
+		}
+		p = next;
+	}
+	return false;
+}
+
+void SessionResumption::Park(const std::string &token, const ColdTrack<double> &track) {
+	const uint64_t now = LatencyStats::Now();
+	std::lock_guard<std::mutex> lock(mutex_);
+	Sweep(now);
+	Parked &parked = parked_[token];
+	parked.track = track;
+	parked.expires_ns = now + grace_ns_;
+}
+
+bool SessionResumption::Take(const std::string &token, ColdTrack<double> *track) {
+	const uint64_t now = LatencyStats::Now();
+	std::lock_guard<std::mutex> lock(mutex_);
+	Sweep(now);
+	std::unordered_map<std::string, Parked>::iterator parked = parked_.find(token);
+	if (parked == parked_.end()) {
+		return false;
+	}
+	const bool live = now < parked->second.expires_ns;
+	if (live) {
+		*track = parked->second.track;
+		Metrics::Local().Add(METRIC_SESSIONS_RESUMED);
+	}
+	else {
+		Metrics::Local().Add(METRIC_SESSIONS_EXPIRED);
+	}
+	parked_.erase(parked);
+	return live;
+}
+
+size_t SessionResumption::parked() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return parked_.size();
+}
+
+void SessionResumption::Sweep(uint64_t now) {
+	if (now - swept_ns_ < 1000000000) {
+		return;
+	}
+	swept_ns_ = now;
+	for (std::unordered_map<std::string, Parked>::iterator it = parked_.begin(); it != parked_.end();) {
+		if (now >= it->second.expires_ns) {
+			Metrics::Local().Add(METRIC_SESSIONS_EXPIRED);
+			it = parked_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
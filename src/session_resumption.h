@@ -0,0 +1,71 @@
+#ifndef SESSION_RESUMPTION_H_
+#define SESSION_RESUMPTION_H_
+
+#include "cold_track.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * The tracks of clients that disconnected with a session token, kept for a
+ * grace period so that the client reconnecting with the same token goes on
+ * with its converged filter instead of starting over (see
+ * SessionPool::Resume). A client picks its own token and presents it on
+ * every upgrade, as ?session=<token> in the URL or as the subprotocol
+ * session.<token>; one seen for the first time just names the new session.
+ *
+ * A parked track is a ColdTrack in double, so the state and covariance
+ * come back as they were. The store is shared by the pools of all threads,
+ * as a reconnect may land on another loop, and takes a lock only on
+ * connection and disconnection of a client with a token.
+ */
+class SessionResumption {
+public:
+  ///* longest token taken; longer ones, or any with characters other than
+  ///* letters, digits, '-' and '_', are ignored
+  static const size_t kMaxToken = 64;
+
+  ///* @param grace_ms How long a track waits for its client to come back
+  explicit SessionResumption(int grace_ms);
+
+  /**
+   * Reads the token of an upgrade request from its URL or its
+   * Sec-WebSocket-Protocol header, either of which may be null; false if
+   * it has none.
+   */
+  static bool ParseToken(const char *url, size_t url_length, const char *protocols, size_t protocols_length,
+                         std::string *token);
+
+  ///* keeps track under token until the grace period is over, replacing a
+  ///* track parked under it before
+  void Park(const std::string &token, const ColdTrack<double> &track);
+
+  ///* moves the track parked under token to track; false if there is none,
+  ///* or its grace period is over
+  bool Take(const std::string &token, ColdTrack<double> *track);
+
+  ///* tracks waiting for their clients
+  size_t parked() const;
+
+private:
+  struct Parked {
+    ColdTrack<double> track;
+    uint64_t expires_ns;
+  };
+
+  const uint64_t grace_ns_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Parked> parked_;
+  ///* when the expired tracks were last dropped, on the clock of
+  ///* LatencyStats::Now
+  uint64_t swept_ns_;
+
+  ///* drops the tracks whose grace period is over, at most once a second
+  void Sweep(uint64_t now);
+
+  SessionResumption(const SessionResumption &);
+  SessionResumption &operator=(const SessionResumption &);
+};
+
+#endif /* SESSION_RESUMPTION_H_ */
@@ -0,0 +1,290 @@
+#include "shadow_filter.h"
+#include "latency.h"
+#include "ukf.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+#ifdef __linux
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+///* tells shadows apart in the threads' caches of their producers
+std::atomic<unsigned> next_serial(1);
+
+///* measurements a worker takes from a ring before it looks at the others
+const int kBatch = 256;
+
+///* how long a worker with nothing to do sleeps, in us
+const int kIdleSleep = 200;
+
+///* a shadow track: its filter and when it last had a measurement
+template <class Filter>
+struct Track {
+  Filter ukf;
+  std::chrono::steady_clock::time_point seen;
+
+  CACHE_ALIGNED_OPERATOR_NEW
+};
+
+///* the RMSE of both sides of the workers together, by their squares
+void AddSquares(const RunningRMSE &rmse, Eigen::Vector4d *squares, long long *count) {
+	const Eigen::Vector4d r = rmse.RMSE();
+	*squares += r.cwiseProduct(r) * double(rmse.count());
+	*count += rmse.count();
+}
+
+}
+
+const size_t ShadowFilter::kRingCapacity;
+const int ShadowFilter::kIdleTimeout;
+
+ShadowFilter::ShadowFilter()
+	: scheme_(SIGMA_SCALED), serial_(0), producers_(nullptr), stop_(false) {}
+
+ShadowFilter::~ShadowFilter() {
+	Stop();
+}
+
+const char *ShadowFilter::SchemeName(SigmaScheme scheme) {
+	static const char *const names[] = {"scaled", "simplex", "cubature"};
+	return names[scheme];
+}
+
+bool ShadowFilter::ParseScheme(const std::string &name, SigmaScheme *scheme) {
+	for (int s = SIGMA_SCALED; s <= SIGMA_CUBATURE; s++) {
+		if (name == SchemeName(SigmaScheme(s))) {
+			*scheme = SigmaScheme(s);
+			return true;
+		}
+	}
+	return false;
+}
+
+void ShadowFilter::Start(const UKFConfig *config, SigmaScheme scheme, int workers, const std::vector<int> &cpus) {
+	Stop();
+	config_.reset(config);
+	scheme_ = scheme;
+	stop_ = false;
+	workers_.clear();
+	for (int i = 0; i < workers; i++) {
+		workers_.emplace_back(new Worker());
+		workers_[i]->cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+	}
+	serial_ = next_serial++;
+	for (int i = 0; i < workers; i++) {
+		Worker *worker = workers_[i].get();
+		switch (scheme) {
+		case SIGMA_SCALED:
+			worker->thread = std::thread(&ShadowFilter::Run<UKF<5, 7> >, this, worker, size_t(i));
+			break;
+		case SIGMA_SIMPLEX:
+			worker->thread = std::thread(&ShadowFilter::Run<UKF<5, 7, LdltSolver, SimplexSigmaPoints<7> > >,
+			                             this, worker, size_t(i));
+			break;
+		case SIGMA_CUBATURE:
+			worker->thread = std::thread(&ShadowFilter::Run<UKF<5, 7, LdltSolver, CubatureSigmaPoints<7> > >,
+			                             this, worker, size_t(i));
+			break;
+		}
+	}
+}
+
+void ShadowFilter::Stop() {
+	if (!serial_) {
+		return;
+	}
+	serial_ = 0;
+	stop_.store(true, std::memory_order_release);
+	for (size_t i = 0; i < workers_.size(); i++) {
+		workers_[i]->thread.join();
+	}
+	Producer *producer = producers_.exchange(nullptr);
+	while (producer) {
+		Producer *next = producer->next;
+		delete producer;
+		producer = next;
+	}
+}
+
+bool ShadowFilter::Submit(const ShadowMeasurement &measurement) {
+	//every thread looks its rings up once, and again only for another start
+	static thread_local unsigned local_serial = 0;
+	static thread_local Producer *local = nullptr;
+	if (!serial_) {
+		return false;
+	}
+	if (local_serial != serial_) {
+		local = Register();
+		local_serial = serial_;
+	}
+	if (!local->rings[unsigned(measurement.id) % local->rings.size()]->TryPush(measurement)) {
+		local->dropped.store(local->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return false;
+	}
+	return true;
+}
+
+ShadowFilter::Producer *ShadowFilter::Register() {
+	Producer *producer = new Producer();
+	for (size_t i = 0; i < workers_.size(); i++) {
+		producer->rings.emplace_back(new SpscRing<ShadowMeasurement>(kRingCapacity));
+	}
+	producer->next = producers_.load(std::memory_order_relaxed);
+	while (!producers_.compare_exchange_weak(producer->next, producer, std::memory_order_release,
+	                                         std::memory_order_relaxed)) {
+	}
+	return producer;
+}
+
+template <class Filter>
+void ShadowFilter::Run(Worker *worker, size_t index) {
+#ifdef __linux
+	if (worker->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(worker->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+			std::fprintf(stderr, "Cannot pin shadow worker %zu to CPU %d\n", index, worker->cpu);
+		}
+	}
+#endif
+	LatencyStats::Unlisted();
+	typedef std::chrono::steady_clock Clock;
+	std::unordered_map<int, std::unique_ptr<Track<Filter> > > tracks;
+	NISMonitor radar_bounds = NISMonitor::Radar(1, 0.05);
+	NISMonitor laser_bounds = NISMonitor::Laser(1, 0.05);
+	Clock::time_point swept = Clock::now();
+	ShadowMeasurement m;
+	MeasurementPackage package;
+	Side primary, shadow;
+
+	while (!stop_.load(std::memory_order_acquire)) {
+		int popped = 0;
+		for (Producer *producer = producers_.load(std::memory_order_acquire); producer; producer = producer->next) {
+			SpscRing<ShadowMeasurement> &ring = *producer->rings[index];
+			for (int n = 0; n < kBatch && ring.TryPop(&m); n++, popped++) {
+				if (m.closed) {
+					tracks.erase(m.id);
+					continue;
+				}
+				std::unique_ptr<Track<Filter> > &track = tracks[m.id];
+				if (!track) {
+					track.reset(new Track<Filter>());
+					track->ukf.set_config(*config_);
+				}
+				track->seen = Clock::now();
+
+				package.sensor_type_ = m.sensor;
+				package.timestamp_ = m.timestamp;
+				const int size = m.sensor == MeasurementPackage::RADAR ? 3 : 2;
+				package.raw_measurements_ = Eigen::Map<const Eigen::VectorXd>(m.z, size);
+				const bool was_initialized = track->ukf.is_initialized_;
+				const uint64_t start = LatencyStats::Now();
+				track->ukf.ProcessMeasurement(package);
+				shadow.filter_ns += LatencyStats::Now() - start;
+				shadow.measurements++;
+				primary.filter_ns += m.filter_ns;
+				primary.measurements++;
+
+				//NIS of the steps both filters were initialized for
+				if (was_initialized && m.has_nis && !track->ukf.reinitialized_) {
+					const bool radar = m.sensor == MeasurementPackage::RADAR;
+					NISMonitor &bounds = radar ? radar_bounds : laser_bounds;
+					const double nis = radar ? track->ukf.NIS_radar_ : track->ukf.NIS_laser_;
+					(radar ? primary.radar_nis : primary.laser_nis)++;
+					(radar ? primary.radar_within : primary.laser_within) += bounds.Add(m.nis);
+					(radar ? shadow.radar_nis : shadow.laser_nis)++;
+					(radar ? shadow.radar_within : shadow.laser_within) += bounds.Add(nis);
+				}
+				if (m.has_ground_truth) {
+					const Eigen::Map<const Eigen::Vector4d> truth(m.ground_truth);
+					Eigen::Vector4d estimate;
+					track->ukf.CartesianEstimate(&estimate);
+					shadow.rmse.Add(estimate, truth);
+					primary.rmse.Add(CartesianEstimate(m.x), truth);
+				}
+			}
+		}
+
+		const Clock::time_point now = Clock::now();
+		if (now - swept > std::chrono::seconds(1)) {
+			swept = now;
+			for (auto it = tracks.begin(); it != tracks.end();) {
+				if (now - it->second->seen > std::chrono::milliseconds(kIdleTimeout)) {
+					it = tracks.erase(it);
+				}
+				else {
+					++it;
+				}
+			}
+		}
+
+		if (popped) {
+			std::lock_guard<std::mutex> lock(worker->mutex);
+			worker->primary = primary;
+			worker->shadow = shadow;
+			worker->tracks = tracks.size();
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::microseconds(kIdleSleep));
+		}
+	}
+}
+
+std::string ShadowFilter::Json() const {
+	long long dropped = 0;
+	for (Producer *producer = producers_.load(std::memory_order_acquire); producer; producer = producer->next) {
+		dropped += producer->dropped.load(std::memory_order_relaxed);
+	}
+	Side sides[2];
+	Eigen::Vector4d squares[2] = {Eigen::Vector4d::Zero(), Eigen::Vector4d::Zero()};
+	long long counts[2] = {0, 0};
+	size_t tracks = 0;
+	for (size_t i = 0; i < workers_.size(); i++) {
+		const Worker &worker = *workers_[i];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		const Side *own[2] = {&worker.primary, &worker.shadow};
+		for (int s = 0; s < 2; s++) {
+			sides[s].measurements += own[s]->measurements;
+			sides[s].radar_nis += own[s]->radar_nis;
+			sides[s].radar_within += own[s]->radar_within;
+			sides[s].laser_nis += own[s]->laser_nis;
+			sides[s].laser_within += own[s]->laser_within;
+			sides[s].filter_ns += own[s]->filter_ns;
+			AddSquares(own[s]->rmse, &squares[s], &counts[s]);
+		}
+		tracks += worker.tracks;
+	}
+
+	char text[1024];
+	std::string json = "{\"sigma_points\":\"" + std::string(SchemeName(scheme_)) + "\"";
+	if (config_) {
+		const UKFConfig &c = *config_;
+		snprintf(text, sizeof(text), ",\"config\":{\"std_a\":%g,\"std_yawdd\":%g,\"std_laspx\":%g,\"std_laspy\":%g,"
+		         "\"std_radr\":%g,\"std_radphi\":%g,\"std_radrd\":%g,\"use_laser\":%s,\"use_radar\":%s,"
+		         "\"gate_laser\":%g,\"gate_radar\":%g,\"linearize_radar\":%g}",
+		         c.std_a_, c.std_yawdd_, c.std_laspx_, c.std_laspy_, c.std_radr_, c.std_radphi_, c.std_radrd_,
+		         c.use_laser_ ? "true" : "false", c.use_radar_ ? "true" : "false", c.gate_laser_, c.gate_radar_,
+		         c.linearize_radar_);
+		json += text;
+	}
+	json += ",\"tracks\":" + std::to_string(tracks) + ",\"dropped\":" + std::to_string(dropped);
+	const char *names[2] = {"primary", "shadow"};
+	for (int s = 0; s < 2; s++) {
+		const Side &side = sides[s];
+		const Eigen::Vector4d rmse = counts[s] ? Eigen::Vector4d((squares[s] / double(counts[s])).cwiseSqrt())
+		                                       : Eigen::Vector4d::Zero();
+		snprintf(text, sizeof(text), ",\"%s\":{\"measurements\":%lld,\"rmse\":[%g,%g,%g,%g],"
+		         "\"radar_nis_within\":%g,\"laser_nis_within\":%g,\"filter_us\":%g}", names[s], side.measurements,
+		         rmse(0), rmse(1), rmse(2), rmse(3),
+		         side.radar_nis ? double(side.radar_within) / side.radar_nis : 0.0,
+		         side.laser_nis ? double(side.laser_within) / side.laser_nis : 0.0,
+		         side.measurements ? side.filter_ns / 1000.0 / side.measurements : 0.0);
+		json += text;
+	}
+	return json + "}";
+}
@@ -0,0 +1,169 @@
+#ifndef SHADOW_FILTER_H_
+#define SHADOW_FILTER_H_
+
+#include "cache_aligned.h"
+#include "measurement_package.h"
+#include "spsc_ring.h"
+#include "tools.h"
+#include "ukf_config.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A measurement as the filter of a session took it, and what that filter
+ * made of it, for a ShadowFilter to compare with.
+ */
+struct ShadowMeasurement {
+  ///* the session's id, which names the track
+  int id;
+  ///* the session was reset or closed: the shadow track ends, and the
+  ///* other members are not set
+  bool closed;
+  MeasurementPackage::SensorType sensor;
+  ///* in us
+  long long timestamp;
+  ///* the raw measurement, 2 values of a laser and 3 of a radar
+  double z[MeasurementPackage::kMaxSize];
+  bool has_ground_truth;
+  ///* p_x p_y v_x v_y
+  double ground_truth[4];
+  ///* the primary's estimate after the measurement, p_x p_y v yaw yaw_rate
+  double x[5];
+  ///* whether the primary filter had been initialized before, and so has
+  ///* a NIS for the measurement
+  bool has_nis;
+  double nis;
+  ///* ns the primary filter took for the measurement
+  uint64_t filter_ns;
+};
+
+/**
+ * Runs the measurements of all sessions through a second set of filters on
+ * threads of their own, with another sensor profile or sigma points, and
+ * compares them live with the sessions' own: RMSE, NIS consistency and time
+ * per measurement, served as JSON at /shadow. For trying a configuration on
+ * the live traffic without it answering any client.
+ *
+ * Every thread that submits gets a ring per shadow worker, and a track's
+ * measurements always go to the ring of the same worker (by id), so a
+ * worker owns its tracks and no lock is taken on either side. Submit costs
+ * the primary one copy into a ring; a ring that is full drops the
+ * measurement and counts it rather than wait, and the shadow track goes on
+ * without it. The shadow workers keep their durations
+ * out of the server's latency histograms (see LatencyStats::Unlisted).
+ *
+ * A shadow track ends when its session is reset or closed, or after
+ * kIdleTimeout without measurements.
+ */
+class ShadowFilter {
+public:
+  ///* sigma points of the shadow filters
+  enum SigmaScheme {
+    SIGMA_SCALED,
+    SIGMA_SIMPLEX,
+    SIGMA_CUBATURE
+  };
+
+  ///* measurements a submitting thread may have waiting for each worker
+  static const size_t kRingCapacity = 4096;
+
+  ///* in ms
+  static const int kIdleTimeout = 60000;
+
+  ShadowFilter();
+
+  ///* stops the workers
+  ~ShadowFilter();
+
+  /**
+   * Starts workers threads filtering with config and scheme.
+   * @param config The sensor profile, owned by the shadow from now on
+   * @param cpus CPUs to pin worker i to, cpus[i % size], or none
+   */
+  void Start(const UKFConfig *config, SigmaScheme scheme, int workers,
+             const std::vector<int> &cpus = std::vector<int>());
+
+  ///* stops the workers; measurements still queued are not filtered
+  void Stop();
+
+  /**
+   * Queues measurement for the shadow filters from any thread.
+   * @return false if it was dropped
+   */
+  bool Submit(const ShadowMeasurement &measurement);
+
+  /**
+   * Both filters side by side as a JSON object: the profile and sigma
+   * points of the shadow, its live tracks and the measurements dropped,
+   * then for "primary" and "shadow" the measurements filtered, the RMSE
+   * over those with ground truth, the fractions of radar and laser NIS
+   * within the 95% bounds and the mean filter time in us.
+   */
+  std::string Json() const;
+
+  ///* the name of scheme as --shadow-sigma takes it, and back; false if
+  ///* name is none of them
+  static const char *SchemeName(SigmaScheme scheme);
+  static bool ParseScheme(const std::string &name, SigmaScheme *scheme);
+
+private:
+  ///* what one filter did with the measurements of a worker's tracks
+  struct Side {
+    long long measurements;
+    RunningRMSE rmse;
+    long long radar_nis;
+    long long radar_within;
+    long long laser_nis;
+    long long laser_within;
+    uint64_t filter_ns;
+
+    Side() : measurements(0), radar_nis(0), radar_within(0), laser_nis(0), laser_within(0), filter_ns(0) {}
+  };
+
+  struct alignas(kCacheLineSize) Worker {
+    int cpu;
+    std::thread thread;
+    ///* guards the members below, which the worker updates after every
+    ///* batch it takes from the rings
+    mutable std::mutex mutex;
+    Side primary;
+    Side shadow;
+    size_t tracks;
+
+    Worker() : cpu(-1), tracks(0) {}
+
+    CACHE_ALIGNED_OPERATOR_NEW
+  };
+
+  ///* the rings of one submitting thread, one per worker
+  struct Producer {
+    std::vector<std::unique_ptr<SpscRing<ShadowMeasurement> > > rings;
+    std::atomic<long long> dropped;
+    Producer *next;
+
+    Producer() : dropped(0), next(nullptr) {}
+  };
+
+  std::unique_ptr<const UKFConfig> config_;
+  SigmaScheme scheme_;
+  std::vector<std::unique_ptr<Worker> > workers_;
+  ///* tells the threads' cached producers of an earlier start apart
+  unsigned serial_;
+  std::atomic<Producer *> producers_;
+  std::atomic<bool> stop_;
+
+  Producer *Register();
+
+  template <class Filter>
+  void Run(Worker *worker, size_t index);
+
+  ShadowFilter(const ShadowFilter &);
+  ShadowFilter &operator=(const ShadowFilter &);
+};
+
+#endif /* SHADOW_FILTER_H_ */
@@ -0,0 +1,322 @@
+#include "shard_router.h"
+#include "json.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using json = nlohmann::json;
+
+const int ShardRing::kVirtualNodes;
+const size_t ShardRouter::kMaxPending;
+
+namespace {
+
+const char kFrozenPrefix[] = "42[\"frozen\",";
+const char kThawPrefix[] = "42[\"thaw\",";
+
+}
+
+uint64_t ShardRing::Hash(const std::string &text) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : text) {
+		hash = (hash ^ c) * 1099511628211ULL;
+	}
+	// FNV-1a alone barely moves the high bits for keys that differ only in
+	// their last characters, as the points of one node and most keys do
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebULL;
+	return hash ^ (hash >> 31);
+}
+
+bool ShardRing::Add(const std::string &node) {
+	if (std::find(nodes_.begin(), nodes_.end(), node) != nodes_.end()) {
+		return false;
+	}
+	nodes_.push_back(node);
+	Rebuild();
+	return true;
+}
+
+bool ShardRing::Remove(const std::string &node) {
+	std::vector<std::string>::iterator it = std::find(nodes_.begin(), nodes_.end(), node);
+	if (it == nodes_.end()) {
+		return false;
+	}
+	nodes_.erase(it);
+	Rebuild();
+	return true;
+}
+
+const std::string &ShardRing::Owner(const std::string &key) const {
+	static const std::string none;
+	if (points_.empty()) {
+		return none;
+	}
+	std::vector<std::pair<uint64_t, size_t> >::const_iterator point =
+		std::lower_bound(points_.begin(), points_.end(), std::make_pair(Hash(key), size_t(0)));
+	return nodes_[(point == points_.end() ? points_.front() : *point).second];
+}
+
+void ShardRing::Rebuild() {
+	points_.clear();
+	for (size_t i = 0; i < nodes_.size(); i++) {
+		for (int v = 0; v < kVirtualNodes; v++) {
+			points_.push_back(std::make_pair(Hash(nodes_[i] + "#" + std::to_string(v)), i));
+		}
+	}
+	std::sort(points_.begin(), points_.end());
+}
+
+ShardRouter::ShardRouter(uWS::Hub &h, const std::vector<std::string> &nodes)
+	: hub_(&h), next_key_(0), forwarded_(0), returned_(0), dropped_(0), moved_(0), handed_over_(0) {
+	for (const std::string &node : nodes) {
+		ring_.Add(node);
+	}
+
+	h.onConnection([this](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+		uWS::Header url = req.getUrl();
+		std::string key(url.value, url.valueLength);
+		key.resize(std::min(key.find('?'), key.length()));
+		if (key.empty() || key == "/") {
+			key = "#" + std::to_string(next_key_++);
+		}
+		Stream *stream = new Stream{ws, key, std::string(), nullptr, nullptr, std::string(), {}};
+		ws.setUserData(stream);
+		streams_.push_back(stream);
+		Route(stream);
+	});
+
+	h.onMessage([this](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode) {
+		Stream *stream = static_cast<Stream *>(ws.getUserData());
+		if (!stream) {
+			return;
+		}
+		if (stream->link && stream->link->open && !stream->draining) {
+			stream->link->ws.send(data, length, opCode);
+			forwarded_++;
+			return;
+		}
+		if (stream->pending.size() == kMaxPending) {
+			stream->pending.pop_front();
+			dropped_++;
+		}
+		stream->pending.push_back(std::make_pair(std::string(data, length), opCode));
+	});
+
+	h.onDisconnection([this](uWS::WebSocket<uWS::SERVER> ws, int code, char *message, size_t length) {
+		Stream *stream = static_cast<Stream *>(ws.getUserData());
+		if (!stream) {
+			return;
+		}
+		ws.setUserData(nullptr);
+		Unlink(stream);
+		StopDraining(stream);
+		std::vector<Stream *>::iterator it = std::find(streams_.begin(), streams_.end(), stream);
+		*it = streams_.back();
+		streams_.pop_back();
+		delete stream;
+	});
+
+	h.onConnection([this](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+		Link *link = static_cast<Link *>(ws.getUserData());
+		link->ws = ws;
+		link->open = true;
+		if (!link->stream) {
+			ws.close();
+			return;
+		}
+		Flush(link->stream);
+	});
+
+	h.onMessage([this](uWS::WebSocket<uWS::CLIENT> ws, char *data, size_t length, uWS::OpCode opCode) {
+		Link *link = static_cast<Link *>(ws.getUserData());
+		if (!link || !link->stream) {
+			return;
+		}
+		Stream *stream = link->stream;
+		const size_t prefix = sizeof(kFrozenPrefix) - 1;
+		if (link->draining && opCode == uWS::OpCode::TEXT && length >= prefix
+		    && memcmp(data, kFrozenPrefix, prefix) == 0) {
+			stream->thaw = kThawPrefix + std::string(data + prefix, length - prefix);
+			handed_over_++;
+			StopDraining(stream);
+			Flush(stream);
+			return;
+		}
+		// the estimates the old node sends until it freezes the track still
+		// reach the sensor
+		stream->sensor.send(data, length, opCode);
+		returned_++;
+	});
+
+	h.onDisconnection([this](uWS::WebSocket<uWS::CLIENT> ws, int code, char *message, size_t length) {
+		Link *link = static_cast<Link *>(ws.getUserData());
+		ws.setUserData(nullptr);
+		if (link && link->stream) {
+			Close(link);
+		}
+		delete link;
+	});
+
+	h.onError([this](void *user) {
+		Link *link = static_cast<Link *>(user);
+		if (link->stream) {
+			Close(link);
+		}
+		delete link;
+	});
+}
+
+ShardRouter::~ShardRouter() {
+	for (Stream *stream : streams_) {
+		Unlink(stream);
+		StopDraining(stream);
+		stream->sensor.setUserData(nullptr);
+		delete stream;
+	}
+}
+
+bool ShardRouter::Join(const std::string &node) {
+	if (!ring_.Add(node)) {
+		return false;
+	}
+	std::cout << "Node " << node << " joined" << std::endl;
+	Rebalance();
+	return true;
+}
+
+bool ShardRouter::Leave(const std::string &node) {
+	if (!ring_.Remove(node)) {
+		return false;
+	}
+	std::cout << "Node " << node << " left" << std::endl;
+	Rebalance();
+	return true;
+}
+
+std::string ShardRouter::Json() const {
+	json object;
+	object["nodes"] = json::array();
+	size_t waiting = 0;
+	for (const std::string &node : ring_.nodes()) {
+		size_t count = 0;
+		for (const Stream *stream : streams_) {
+			count += stream->node == node;
+		}
+		object["nodes"].push_back({{"uri", node}, {"streams", count}});
+	}
+	for (const Stream *stream : streams_) {
+		waiting += stream->node.empty();
+	}
+	object["streams"] = streams_.size();
+	object["waiting"] = waiting;
+	object["forwarded"] = forwarded_;
+	object["returned"] = returned_;
+	object["dropped"] = dropped_;
+	object["moved"] = moved_;
+	object["handed_over"] = handed_over_;
+	return object.dump();
+}
+
+void ShardRouter::Route(Stream *stream) {
+	Unlink(stream, true);
+	const std::string &owner = ring_.Owner(stream->key);
+	if (!stream->node.empty() && !owner.empty() && owner != stream->node) {
+		moved_++;
+	}
+	stream->node = owner;
+	if (owner.empty()) {
+		return;
+	}
+	stream->link = new Link{stream, owner, uWS::WebSocket<uWS::CLIENT>(), false, false};
+	// a node that cannot be reached fails the link at once or later, and
+	// Lost routes the stream again
+	hub_->connect(owner, stream->link);
+}
+
+void ShardRouter::Unlink(Stream *stream, bool drain) {
+	Link *link = stream->link;
+	if (!link) {
+		return;
+	}
+	stream->link = nullptr;
+	// only one track is awaited; a stream that moves again meanwhile takes
+	// it on to its latest node
+	if (drain && link->open && !stream->draining) {
+		static const char freeze[] = "42[\"freeze\",{}]";
+		link->draining = true;
+		stream->draining = link;
+		link->ws.send(freeze, sizeof(freeze) - 1, uWS::OpCode::TEXT);
+		return;
+	}
+	link->stream = nullptr;
+	// closing runs the disconnection handler at once, which frees the link
+	if (link->open) {
+		uWS::WebSocket<uWS::CLIENT> ws = link->ws;
+		ws.close();
+	}
+}
+
+void ShardRouter::StopDraining(Stream *stream) {
+	Link *link = stream->draining;
+	if (!link) {
+		return;
+	}
+	stream->draining = nullptr;
+	link->stream = nullptr;
+	link->draining = false;
+	uWS::WebSocket<uWS::CLIENT> ws = link->ws;
+	ws.close();
+}
+
+void ShardRouter::Flush(Stream *stream) {
+	Link *link = stream->link;
+	if (!link || !link->open || stream->draining) {
+		return;
+	}
+	if (!stream->thaw.empty()) {
+		link->ws.send(stream->thaw.data(), stream->thaw.length(), uWS::OpCode::TEXT);
+		stream->thaw.clear();
+	}
+	while (!stream->pending.empty()) {
+		const std::pair<std::string, uWS::OpCode> &frame = stream->pending.front();
+		link->ws.send(frame.first.data(), frame.first.length(), frame.second);
+		forwarded_++;
+		stream->pending.pop_front();
+	}
+}
+
+void ShardRouter::Close(Link *link) {
+	Stream *stream = link->stream;
+	if (link->draining) {
+		// the track is lost with the old node, and the stream starts anew
+		stream->draining = nullptr;
+		link->stream = nullptr;
+		Flush(stream);
+		return;
+	}
+	Lost(link);
+}
+
+void ShardRouter::Rebalance() {
+	for (size_t i = 0; i < streams_.size(); i++) {
+		Stream *stream = streams_[i];
+		const std::string &owner = ring_.Owner(stream->key);
+		if (owner != stream->node || (!owner.empty() && !stream->link)) {
+			Route(stream);
+		}
+	}
+}
+
+void ShardRouter::Lost(Link *link) {
+	Stream *stream = link->stream;
+	stream->link = nullptr;
+	link->stream = nullptr;
+	if (ring_.Remove(link->node)) {
+		std::cerr << "Lost node " << link->node << std::endl;
+	}
+	Route(stream);
+	Rebalance();
+}
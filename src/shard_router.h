@@ -0,0 +1,161 @@
+#ifndef SHARD_ROUTER_H_
+#define SHARD_ROUTER_H_
+
+#include <uWS/uWS.h>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Consistent hashing of stream keys onto fusion nodes: every node is
+ * kVirtualNodes points on a ring of 64-bit hashes, and a key belongs to the
+ * node of the first point at or after its own hash. A node joining or
+ * leaving then moves only the keys between its points and their
+ * neighbours, about 1/N of them, while the others keep their node.
+ */
+class ShardRing {
+public:
+  static const int kVirtualNodes = 160;
+
+  ///* adds node, the URI its streams are forwarded to; false if it is in
+  bool Add(const std::string &node);
+
+  ///* removes node; false if it is not in
+  bool Remove(const std::string &node);
+
+  ///* the node key belongs to, or an empty string while there is none
+  const std::string &Owner(const std::string &key) const;
+
+  const std::vector<std::string> &nodes() const { return nodes_; }
+
+  ///* FNV-1a with a final mix, the hash of the keys and of the points
+  static uint64_t Hash(const std::string &text);
+
+private:
+  std::vector<std::string> nodes_;
+  ///* the points, sorted by hash, each with the index of its node
+  std::vector<std::pair<uint64_t, size_t> > points_;
+
+  void Rebuild();
+};
+
+/**
+ * Spreads sensor streams over several fusion nodes, each a server running
+ * the filter sessions as usual. A sensor connects to the router, and its
+ * stream is keyed by the URL it connects with (ws://router:4567/lidar-7 is
+ * "/lidar-7"; one without a path gets a key of its own), so that it keeps
+ * to one node across reconnects. The router opens a client connection of
+ * h to the owner of the key and forwards the frames both ways as they are,
+ * text telemetry as well as binary measurement records, without parsing
+ * them; frames sent before that connection is open wait, up to kMaxPending.
+ *
+ * When a node joins, the streams whose keys it now owns move to it, each
+ * on a new connection, and when one leaves, or its connection fails or is
+ * closed by the node, its streams move to their next owners. A stream that
+ * moves while its old node is reachable takes its track along: the router
+ * asks the old node to freeze it (42["freeze",{}], see Session::Freeze),
+ * holds the sensor's frames meanwhile, and opens the stream on the new node
+ * with the state it is sent back (42["thaw",{"state":...}]), so that the
+ * track continues there; one whose node was lost starts a new track. The
+ * router belongs to h's thread, whose WebSocket handlers it installs.
+ */
+class ShardRouter {
+public:
+  ///* frames that wait for a stream's node, the oldest dropped beyond
+  static const size_t kMaxPending = 1024;
+
+  ShardRouter(uWS::Hub &h, const std::vector<std::string> &nodes);
+
+  ///* closes the connections of the streams
+  ~ShardRouter();
+
+  ///* adds node and moves the streams it owns to it; false if it is in
+  bool Join(const std::string &node);
+
+  ///* removes node and moves its streams to their next owners; false if
+  ///* it is not in
+  bool Leave(const std::string &node);
+
+  ///* the nodes with the number of streams of each, and the counts below
+  std::string Json() const;
+
+  ///* streams connected, frames forwarded to the nodes and back, frames
+  ///* dropped while waiting, and moves of streams between nodes
+  size_t streams() const { return streams_.size(); }
+  long long forwarded() const { return forwarded_; }
+  long long returned() const { return returned_; }
+  long long dropped() const { return dropped_; }
+  long long moved() const { return moved_; }
+  ///* moves that took the track along
+  long long handed_over() const { return handed_over_; }
+
+private:
+  struct Link;
+
+  ///* a sensor's connection, and the one to its node
+  struct Stream {
+    uWS::WebSocket<uWS::SERVER> sensor;
+    std::string key;
+    std::string node;
+    ///* the connection to node, opening or open, if there is one
+    Link *link;
+    ///* the connection to the node the stream moves away from, while the
+    ///* router waits for the track it freezes there
+    Link *draining;
+    ///* the thaw event of the track for the new node, until it is sent
+    std::string thaw;
+    std::deque<std::pair<std::string, uWS::OpCode> > pending;
+  };
+
+  ///* one client connection to a node, the user data of its socket; a
+  ///* stream that closed or moved leaves it without one
+  struct Link {
+    Stream *stream;
+    std::string node;
+    uWS::WebSocket<uWS::CLIENT> ws;
+    bool open;
+    ///* the stream's frozen track is awaited on it
+    bool draining;
+  };
+
+  uWS::Hub *hub_;
+  ShardRing ring_;
+  std::vector<Stream *> streams_;
+  long long next_key_;
+  long long forwarded_;
+  long long returned_;
+  long long dropped_;
+  long long moved_;
+  long long handed_over_;
+
+  ///* connects stream to the owner of its key, or none while there are none
+  void Route(Stream *stream);
+
+  ///* leaves the stream's connection to close, if it has one, or with
+  ///* drain to give up the track first
+  void Unlink(Stream *stream, bool drain = false);
+
+  ///* closes the connection the stream moves away from, if it has one
+  void StopDraining(Stream *stream);
+
+  ///* sends the stream's new node the thaw event of its track if there is
+  ///* one, then the frames waiting, once it is connected and the track in
+  void Flush(Stream *stream);
+
+  ///* routes again the streams whose owner is no longer their node
+  void Rebalance();
+
+  ///* a node's connection failed or was closed under a stream, either the
+  ///* one it moves away from or its own
+  void Close(Link *link);
+
+  ///* a stream's own node's connection failed or was closed
+  void Lost(Link *link);
+
+  ShardRouter(const ShardRouter &);
+  ShardRouter &operator=(const ShardRouter &);
+};
+
+#endif /* SHARD_ROUTER_H_ */
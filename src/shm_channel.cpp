@@ -0,0 +1,281 @@
+#include "shm_channel.h"
+#include "measurement_record.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace shm_channel;
+
+namespace {
+
+const char kMagic[8] = {'U', 'K', 'F', 'S', 'H', 'M', '0', '1'};
+const uint32_t kVersion = 1;
+
+///* the slots start on a page of their own behind the header
+const size_t kSlotsOffset = 4096;
+
+static_assert(sizeof(Header) <= kSlotsOffset, "the header overlaps the slots");
+static_assert(kRequestSlotSize == record::kMeasurementSize + record::kGroundTruthSize,
+              "a request slot holds a measurement record with ground truth");
+static_assert(kReplySlotSize == record::kEstimateSize, "a reply slot holds an estimate record");
+
+size_t MappedLength(uint32_t slots) {
+	return kSlotsOffset + size_t(slots) * (kRequestSlotSize + kReplySlotSize);
+}
+
+std::string WakePath(const std::string &path) {
+	return path + ".wake";
+}
+
+///* not FUTEX_PRIVATE: the futex word is shared between processes
+long Futex(std::atomic<uint32_t> *address, int op, uint32_t value, const struct timespec *timeout) {
+	return syscall(SYS_futex, reinterpret_cast<uint32_t *>(address), op, value, timeout, nullptr, 0);
+}
+
+}
+
+ShmChannel::ShmChannel()
+	: header_(nullptr), length_(0), request_slots_(nullptr), reply_slots_(nullptr), wake_fd_(-1), server_(false) {}
+
+ShmChannel::~ShmChannel() {
+	Close();
+}
+
+void ShmChannel::Close() {
+	if (header_) {
+		munmap(header_, length_);
+		header_ = nullptr;
+	}
+	if (wake_fd_ >= 0) {
+		close(wake_fd_);
+		wake_fd_ = -1;
+	}
+	if (server_) {
+		unlink(path_.c_str());
+		unlink(WakePath(path_).c_str());
+		server_ = false;
+	}
+}
+
+bool ShmChannel::Map(const char *path, bool create, uint32_t slots) {
+	const int fd = create ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0600) : open(path, O_RDWR);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (create) {
+		length_ = MappedLength(slots);
+		if (ftruncate(fd, length_) != 0) {
+			close(fd);
+			return false;
+		}
+	}
+	else {
+		if (fstat(fd, &st) != 0 || size_t(st.st_size) < kSlotsOffset) {
+			close(fd);
+			return false;
+		}
+		length_ = st.st_size;
+	}
+	void *mapped = mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+	header_ = static_cast<Header *>(mapped);
+	if (create) {
+		//the file is all zeros, which is an empty ring to the atomics
+		memcpy(header_->magic, kMagic, sizeof(kMagic));
+		header_->version = kVersion;
+		header_->slots = slots;
+		//the server sleeps until the first request
+		header_->request.waiting.store(1, std::memory_order_release);
+	}
+	else if (memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0 || header_->version != kVersion
+		|| header_->slots == 0 || (header_->slots & (header_->slots - 1)) != 0
+		|| MappedLength(header_->slots) > length_) {
+		munmap(header_, length_);
+		header_ = nullptr;
+		return false;
+	}
+	request_slots_ = reinterpret_cast<char *>(header_) + kSlotsOffset;
+	reply_slots_ = request_slots_ + size_t(header_->slots) * kRequestSlotSize;
+	return true;
+}
+
+bool ShmChannel::Create(const char *path, uint32_t slots) {
+	Close();
+	if (slots == 0 || (slots & (slots - 1)) != 0) {
+		return false;
+	}
+	path_ = path;
+	const std::string wake = WakePath(path_);
+	unlink(wake.c_str());
+	//opened for writing as well, so that it neither blocks nor reads end
+	//of file while no driver has it open
+	if (mkfifo(wake.c_str(), 0600) != 0 || (wake_fd_ = open(wake.c_str(), O_RDWR | O_NONBLOCK)) < 0) {
+		unlink(wake.c_str());
+		return false;
+	}
+	server_ = true;
+	if (!Map(path, true, slots)) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool ShmChannel::Open(const char *path) {
+	Close();
+	path_ = path;
+	if (!Map(path, false, 0) || (wake_fd_ = open(WakePath(path_).c_str(), O_WRONLY | O_NONBLOCK)) < 0) {
+		Close();
+		return false;
+	}
+	//replies the previous driver left unread are not this one's; the server
+	//starts a new session when it sees the generation change
+	Ring &reply = header_->reply;
+	reply.tail.store(reply.head.load(std::memory_order_acquire), std::memory_order_release);
+	header_->generation.fetch_add(1, std::memory_order_acq_rel);
+	return true;
+}
+
+bool ShmChannel::Send(const MeasurementPackage &meas_package, const Eigen::Vector4d *ground_truth) {
+	Ring &ring = header_->request;
+	const uint64_t head = ring.head.load(std::memory_order_relaxed);
+	if (head - ring.tail.load(std::memory_order_acquire) >= header_->slots) {
+		return false;
+	}
+	record::EncodeMeasurement(request_slots_ + (head & (header_->slots - 1)) * kRequestSlotSize,
+	                          meas_package, ground_truth);
+	ring.head.store(head + 1, std::memory_order_release);
+
+	//the server sets waiting before it looks at head a last time: either it
+	//sees this record, or this sees the flag
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (ring.waiting.load(std::memory_order_relaxed) && ring.waiting.exchange(0, std::memory_order_acq_rel)) {
+		const char byte = 0;
+		//a full FIFO already holds a wakeup
+		if (write(wake_fd_, &byte, 1) < 0 && errno != EAGAIN) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ShmChannel::Receive(char *estimate, int timeout_ms) {
+	Ring &ring = header_->reply;
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	const uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+	for (;;) {
+		const uint32_t sequence = ring.sequence.load(std::memory_order_acquire);
+		if (ring.head.load(std::memory_order_acquire) != tail) {
+			break;
+		}
+		ring.waiting.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (ring.head.load(std::memory_order_acquire) != tail) {
+			ring.waiting.store(0, std::memory_order_relaxed);
+			break;
+		}
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		struct timespec timeout;
+		timeout.tv_sec = deadline.tv_sec - now.tv_sec;
+		timeout.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+		if (timeout.tv_nsec < 0) {
+			timeout.tv_sec--;
+			timeout.tv_nsec += 1000000000L;
+		}
+		if (timeout.tv_sec < 0) {
+			ring.waiting.store(0, std::memory_order_relaxed);
+			return false;
+		}
+		//returns at once if the server bumped the sequence since it was read
+		Futex(&ring.sequence, FUTEX_WAIT, sequence, &timeout);
+	}
+	memcpy(estimate, reply_slots_ + (tail & (header_->slots - 1)) * kReplySlotSize, kReplySlotSize);
+	ring.tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+uint32_t ShmChannel::generation() const {
+	return header_->generation.load(std::memory_order_acquire);
+}
+
+size_t ShmChannel::TakeRequests(std::vector<char> *records, size_t max_count) {
+	Ring &ring = header_->request;
+	const uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+	uint64_t count = ring.head.load(std::memory_order_acquire) - tail;
+	//a driver that went away may have left the ring in any state
+	if (count > header_->slots) {
+		ring.tail.store(ring.head.load(std::memory_order_relaxed), std::memory_order_release);
+		return 0;
+	}
+	if (count > max_count) {
+		count = max_count;
+	}
+	for (uint64_t i = 0; i < count; i++) {
+		const char *slot = request_slots_ + ((tail + i) & (header_->slots - 1)) * kRequestSlotSize;
+		const size_t length = (slot[1] & record::kHasGroundTruth) ? kRequestSlotSize : record::kMeasurementSize;
+		records->insert(records->end(), slot, slot + length);
+	}
+	ring.tail.store(tail + count, std::memory_order_release);
+	return count;
+}
+
+size_t ShmChannel::PutReplies(const char *estimates, size_t count) {
+	Ring &ring = header_->reply;
+	const uint64_t head = ring.head.load(std::memory_order_relaxed);
+	const uint64_t space = header_->slots - (head - ring.tail.load(std::memory_order_acquire));
+	if (count > space) {
+		count = space;
+	}
+	for (size_t i = 0; i < count; i++) {
+		memcpy(reply_slots_ + ((head + i) & (header_->slots - 1)) * kReplySlotSize,
+		       estimates + i * kReplySlotSize, kReplySlotSize);
+	}
+	ring.head.store(head + count, std::memory_order_release);
+	//ordered before the load of waiting, as Send orders its own
+	ring.sequence.fetch_add(1, std::memory_order_seq_cst);
+	if (ring.waiting.load(std::memory_order_seq_cst) && ring.waiting.exchange(0, std::memory_order_acq_rel)) {
+		Futex(&ring.sequence, FUTEX_WAKE, INT_MAX, nullptr);
+	}
+	return count;
+}
+
+bool ShmChannel::Sleep() {
+	char drain[64];
+	while (read(wake_fd_, drain, sizeof(drain)) > 0) {
+	}
+	Ring &ring = header_->request;
+	const uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+	ring.waiting.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (ring.head.load(std::memory_order_acquire) != tail) {
+		ring.waiting.store(0, std::memory_order_relaxed);
+		return false;
+	}
+	return true;
+}
+
+void ShmChannel::Reschedule() {
+	const char byte = 0;
+	if (write(wake_fd_, &byte, 1) < 0) {
+		//the FIFO is full of wakeups already
+	}
+}
@@ -0,0 +1,147 @@
+#ifndef SHM_CHANNEL_H_
+#define SHM_CHANNEL_H_
+
+#include "measurement_package.h"
+#include "Eigen/Dense"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Shared-memory transport between the server and a sensor driver on the
+ * same host, carrying the records of measurement_record.h without sockets
+ * or framing. A channel is a file, best under /dev/shm, that the server
+ * creates and both processes map:
+ *
+ *   header   4096 bytes
+ *      0  char    magic[8]      "UKFSHM01"
+ *      8  uint32  version       1
+ *     12  uint32  slots         per ring, a power of two
+ *     16  uint32  generation    bumped by every driver that opens it
+ *     64  ring    request       driver to server
+ *    256  ring    reply         server to driver
+ *   request slots   72 bytes each, a measurement record
+ *   reply slots     56 bytes each, an estimate record
+ *
+ * A ring is 192 bytes: uint64 head at 0, uint64 tail at 64, uint32 waiting
+ * at 128 and uint32 sequence at 132. Fields are in host byte order, as both
+ * sides run on one host; the records are those of the wire.
+ *
+ * Each ring is single-producer single-consumer: head, written by the
+ * producer, and tail, written by the consumer, count the slots pushed and
+ * popped, each on a cache line of its own. A consumer about to sleep sets
+ * the ring's waiting flag and checks the ring again; a producer that finds
+ * the flag set after a push wakes it. The server sleeps in its event loop,
+ * woken by a byte through the FIFO <path>.wake; the driver sleeps on a
+ * futex on the reply ring's sequence, which the server bumps after every
+ * batch of replies. No side wakes the other while it is busy.
+ *
+ * One channel is one client, as one WebSocket connection is: the server
+ * gives it a session of its own, and a new one when another driver opens
+ * the channel, which is for one driver at a time.
+ */
+namespace shm_channel {
+
+const uint32_t kDefaultSlots = 1024;
+const size_t kRequestSlotSize = 72;
+const size_t kReplySlotSize = 56;
+
+struct Ring {
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) std::atomic<uint32_t> waiting;
+  std::atomic<uint32_t> sequence;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slots;
+  std::atomic<uint32_t> generation;
+  alignas(64) Ring request;
+  Ring reply;
+};
+
+}
+
+class ShmChannel {
+public:
+  ShmChannel();
+
+  ///* unmaps the channel
+  ~ShmChannel();
+
+  /**
+   * Server: creates the channel at path with slots slots per ring, and its
+   * FIFO, replacing any left from before.
+   * @return false if they cannot be created
+   */
+  bool Create(const char *path, uint32_t slots = shm_channel::kDefaultSlots);
+
+  /**
+   * Driver: opens the channel a server created at path.
+   * @return false if there is none
+   */
+  bool Open(const char *path);
+
+  void Close();
+
+  /**
+   * Driver: queues a measurement, with ground truth if it is not null, and
+   * wakes the server if it sleeps.
+   * @return false if the request ring is full
+   */
+  bool Send(const MeasurementPackage &meas_package, const Eigen::Vector4d *ground_truth);
+
+  /**
+   * Driver: copies the next estimate record into estimate, waiting up to
+   * timeout_ms for it.
+   * @return false if none came
+   */
+  bool Receive(char *estimate, int timeout_ms);
+
+  ///* server: the FIFO to poll for wakeups, and the driver's generation
+  int wake_fd() const { return wake_fd_; }
+  uint32_t generation() const;
+
+  /**
+   * Server: appends up to max_count pending measurement records back to
+   * back to records and returns how many (see record::DecodeMeasurement).
+   */
+  size_t TakeRequests(std::vector<char> *records, size_t max_count);
+
+  /**
+   * Server: queues count estimate records and wakes the driver if it
+   * sleeps. Records that find the reply ring full are dropped.
+   * @return The number queued
+   */
+  size_t PutReplies(const char *estimates, size_t count);
+
+  /**
+   * Server: reads the wakeups off the FIFO and marks the server asleep,
+   * unless requests came meanwhile.
+   * @return false if there are requests to take
+   */
+  bool Sleep();
+
+  ///* server: has the FIFO wake the server again, to go on after other work
+  void Reschedule();
+
+private:
+  std::string path_;
+  shm_channel::Header *header_;
+  size_t length_;
+  char *request_slots_;
+  char *reply_slots_;
+  int wake_fd_;
+  bool server_;
+
+  bool Map(const char *path, bool create, uint32_t slots);
+
+  ShmChannel(const ShmChannel &);
+  ShmChannel &operator=(const ShmChannel &);
+};
+
+#endif /* SHM_CHANNEL_H_ */
@@ -0,0 +1,186 @@
+#include "shm_track_table.h"
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace shm_tracks;
+
+namespace {
+
+const char kMagic[8] = {'U', 'K', 'F', 'T', 'R', 'K', '0', '1'};
+const uint32_t kVersion = 1;
+const int kWords = sizeof(Track) / 8;
+
+static_assert(sizeof(Header) == 64, "the header is 64 bytes");
+static_assert(sizeof(Track) == 120 && sizeof(Buffer) == 128 && sizeof(Slot) == 256,
+              "the layout is that of shm_track_table.h");
+
+size_t MappedLength(uint32_t slots) {
+	return sizeof(Header) + size_t(slots) * sizeof(Slot);
+}
+
+}
+
+ShmTrackTable::ShmTrackTable()
+	: header_(nullptr), slots_(nullptr), length_(0) {}
+
+ShmTrackTable::~ShmTrackTable() {
+	Close();
+}
+
+bool ShmTrackTable::Create(const char *path, uint32_t slots) {
+	Close();
+	if (slots == 0) {
+		return false;
+	}
+	const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	length_ = MappedLength(slots);
+	if (ftruncate(fd, length_) != 0) {
+		close(fd);
+		return false;
+	}
+	void *mapped = mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+	//the file is all zeros: no slot written
+	header_ = static_cast<Header *>(mapped);
+	slots_ = reinterpret_cast<Slot *>(header_ + 1);
+	memcpy(header_->magic, kMagic, sizeof(kMagic));
+	header_->version = kVersion;
+	header_->slots = slots;
+	header_->slot_size = sizeof(Slot);
+	return true;
+}
+
+bool ShmTrackTable::Open(const char *path) {
+	Close();
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+		close(fd);
+		return false;
+	}
+	length_ = st.st_size;
+	void *mapped = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+	header_ = static_cast<Header *>(mapped);
+	slots_ = reinterpret_cast<Slot *>(header_ + 1);
+	if (memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0 || header_->version != kVersion
+		|| header_->slot_size != sizeof(Slot) || MappedLength(header_->slots) > length_) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void ShmTrackTable::Close() {
+	if (header_) {
+		munmap(header_, length_);
+	}
+	header_ = nullptr;
+	slots_ = nullptr;
+	length_ = 0;
+}
+
+void ShmTrackTable::Publish(int slot, const TrackSnapshot &snapshot) {
+	if (uint32_t(slot) >= header_->slots) {
+		static std::once_flag reported;
+		std::call_once(reported, [this] {
+			std::cerr << "More tracks than the " << header_->slots << " slots of the track table, the rest are not exported" << std::endl;
+		});
+		return;
+	}
+	Track track;
+	track.id = snapshot.id;
+	track.flags = kLive | (snapshot.initialized ? kInitialized : 0) | (snapshot.consistent ? kConsistent : 0);
+	track.timestamp = snapshot.timestamp;
+	track.time_us = snapshot.time_us;
+	for (int i = 0; i < 5; i++) {
+		track.x[i] = snapshot.x[i];
+		track.P_diagonal[i] = snapshot.P[6 * i];
+	}
+	track.nis_radar = snapshot.nis_radar;
+	track.nis_laser = snapshot.nis_laser;
+	Write(slot, track);
+
+	//a slot is used from the first publication on; slots are taken in order,
+	//so the mark seldom moves
+	uint32_t used = header_->used.load(std::memory_order_relaxed);
+	while (used <= uint32_t(slot)
+		&& !header_->used.compare_exchange_weak(used, slot + 1, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void ShmTrackTable::Withdraw(int slot) {
+	Track track;
+	//only this thread writes the slot, so its latest cannot change meanwhile
+	if (uint32_t(slot) >= header_->slots || !Read(slot, &track)) {
+		return;
+	}
+	track.flags &= ~kLive;
+	Write(slot, track);
+}
+
+void ShmTrackTable::Write(uint32_t slot, const Track &track) {
+	uint64_t words[kWords];
+	memcpy(words, &track, sizeof(track));
+
+	uint64_t sequence;
+	const int latest = Latest(slots_[slot], &sequence);
+	Buffer &buffer = slots_[slot].buffers[1 - latest];
+	buffer.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (int i = 0; i < kWords; i++) {
+		buffer.words[i].store(words[i], std::memory_order_relaxed);
+	}
+	buffer.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+int ShmTrackTable::Latest(const Slot &slot, uint64_t *sequence) {
+	const uint64_t sequences[2] = {slot.buffers[0].sequence.load(std::memory_order_acquire),
+	                               slot.buffers[1].sequence.load(std::memory_order_acquire)};
+	int latest = sequences[1] > sequences[0] ? 1 : 0;
+	//the newer one is being written: the other is the latest complete
+	if (sequences[latest] & 1) {
+		latest = 1 - latest;
+	}
+	*sequence = sequences[latest];
+	return latest;
+}
+
+bool ShmTrackTable::Read(uint32_t slot, Track *track) const {
+	if (slot >= header_->slots) {
+		return false;
+	}
+	uint64_t words[kWords];
+	for (;;) {
+		uint64_t sequence;
+		const Buffer &buffer = slots_[slot].buffers[Latest(slots_[slot], &sequence)];
+		if (sequence == 0) {
+			return false;
+		}
+		for (int i = 0; i < kWords; i++) {
+			words[i] = buffer.words[i].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (buffer.sequence.load(std::memory_order_relaxed) == sequence) {
+			break;
+		}
+	}
+	memcpy(track, words, sizeof(*track));
+	return (track->flags & kLive) != 0;
+}
@@ -0,0 +1,139 @@
+#ifndef SHM_TRACK_TABLE_H_
+#define SHM_TRACK_TABLE_H_
+
+#include "track_state.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * The latest state of every track of the process in shared memory, for
+ * consumers on this host that map it and read without a syscall or a
+ * message: the TrackStates of track_state.h, exported. The table is a file,
+ * best under /dev/shm, that the server creates and readers map read-only:
+ *
+ *   header   64 bytes
+ *      0  char    magic[8]      "UKFTRK01"
+ *      8  uint32  version       1
+ *     12  uint32  slots
+ *     16  uint32  slot_size     256
+ *     20  uint32  used          slots written so far, 0 to used-1
+ *   slots    slot_size bytes each, two buffers of 128:
+ *      0  uint64  sequence      odd while written
+ *      8  int32   id
+ *     12  uint32  flags         kLive | kInitialized | kConsistent
+ *     16  int64   timestamp     of the latest measurement, us
+ *     24  int64   time_us       the state is true at
+ *     32  double  x[5]          CTRV [p_x p_y v yaw yaw_rate]
+ *     72  double  P_diagonal[5]
+ *    112  double  nis_radar
+ *    120  double  nis_laser
+ *
+ * Fields are in host byte order. Slot i is the TrackState of slot() i:
+ * whichever session holds that state writes it, from its own thread, after
+ * every measurement it filters, and clears kLive when it lets the track go.
+ * Slots beyond the table's are not exported.
+ *
+ * The buffers of a slot take turns as those of TrackState do, versioned by
+ * their sequences: the writer fills the older buffer, numbering it after the
+ * newer one, so the buffer with the higher even sequence is the latest and
+ * one odd is being written. A reader copies the latest and retries only if
+ * its sequence changed meanwhile, which takes two publications; Read does
+ * this.
+ */
+namespace shm_tracks {
+
+const uint32_t kDefaultSlots = 65536;
+
+enum Flags { kLive = 1, kInitialized = 2, kConsistent = 4 };
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slots;
+  uint32_t slot_size;
+  std::atomic<uint32_t> used;
+  char reserved[40];
+};
+
+///* a buffer's content
+struct Track {
+  int32_t id;
+  uint32_t flags;
+  int64_t timestamp;
+  int64_t time_us;
+  double x[5];
+  double P_diagonal[5];
+  double nis_radar;
+  double nis_laser;
+};
+
+struct Buffer {
+  std::atomic<uint64_t> sequence;
+  std::atomic<uint64_t> words[sizeof(Track) / 8];
+};
+
+struct Slot {
+  Buffer buffers[2];
+};
+
+}
+
+class ShmTrackTable {
+public:
+  ShmTrackTable();
+
+  ///* unmaps the table
+  ~ShmTrackTable();
+
+  /**
+   * Server: creates the table at path with slots slots, replacing any left
+   * from before.
+   * @return false if it cannot be created
+   */
+  bool Create(const char *path, uint32_t slots = shm_tracks::kDefaultSlots);
+
+  /**
+   * Reader: maps the table a server created at path, read-only.
+   * @return false if there is none
+   */
+  bool Open(const char *path);
+
+  void Close();
+
+  /**
+   * Server: makes snapshot the latest of slot; from the thread of the
+   * session that holds the TrackState of that slot only.
+   */
+  void Publish(int slot, const TrackSnapshot &snapshot);
+
+  ///* server: clears kLive of slot, keeping the rest of its latest
+  void Withdraw(int slot);
+
+  /**
+   * Copies the latest of slot into track.
+   * @return false if the slot was never written or is not live
+   */
+  bool Read(uint32_t slot, shm_tracks::Track *track) const;
+
+  uint32_t slots() const { return header_ ? header_->slots : 0; }
+  uint32_t used() const { return header_ ? header_->used.load(std::memory_order_acquire) : 0; }
+
+private:
+  shm_tracks::Header *header_;
+  shm_tracks::Slot *slots_;
+  size_t length_;
+
+  ///* writes track to the older buffer of slot
+  void Write(uint32_t slot, const shm_tracks::Track &track);
+
+  ///* the index of the latest complete buffer of slot and its sequence,
+  ///* which is 0 if it was never written
+  static int Latest(const shm_tracks::Slot &slot, uint64_t *sequence);
+
+  ShmTrackTable(const ShmTrackTable &);
+  ShmTrackTable &operator=(const ShmTrackTable &);
+};
+
+#endif /* SHM_TRACK_TABLE_H_ */
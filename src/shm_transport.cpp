@@ -0,0 +1,77 @@
+#include "shm_transport.h"
+#include "latency.h"
+#include "measurement_record.h"
+
+const size_t ShmTransport::kBatch;
+const int ShmTransport::kRounds;
+
+ShmTransport::ShmTransport(uWS::Hub &h, SessionPool &pool)
+	: hub_(&h), pool_(&pool) {
+	records_.reserve(kBatch * shm_channel::kRequestSlotSize);
+}
+
+ShmTransport::~ShmTransport() {
+	for (size_t i = 0; i < channels_.size(); i++) {
+		Channel *channel = channels_[i].get();
+		pool_->Release(channel->session);
+		uv_poll_stop(channel->poll);
+		uv_close(channel->poll, [](uv_handle_t *handle) {
+			delete (uv_poll_t *) handle;
+		});
+	}
+}
+
+bool ShmTransport::Add(const char *path, uint32_t slots) {
+	std::unique_ptr<Channel> channel(new Channel);
+	if (!channel->channel.Create(path, slots)) {
+		return false;
+	}
+	channel->transport = this;
+	channel->session = nullptr;
+	channel->generation = channel->channel.generation();
+	channel->poll = new uv_poll_t;
+	uv_poll_init_socket(hub_->getLoop(), channel->poll, channel->channel.wake_fd());
+	channel->poll->data = channel.get();
+	uv_poll_start(channel->poll, UV_READABLE, [](uv_poll_t *poll, int status, int events) {
+		Channel *channel = static_cast<Channel *>(poll->data);
+		channel->transport->Serve(channel);
+	});
+	channels_.push_back(std::move(channel));
+	return true;
+}
+
+void ShmTransport::Serve(Channel *channel) {
+	//a driver that opens the channel is a new client
+	const uint32_t generation = channel->channel.generation();
+	if (generation != channel->generation || !channel->session) {
+		pool_->Release(channel->session);
+		channel->session = pool_->Acquire();
+		channel->generation = generation;
+	}
+
+	LatencyStats &latency = LatencyStats::Local();
+	uWS::Group<uWS::SERVER> &group = *hub_;
+	for (int round = 0; round < kRounds; round++) {
+		uint64_t start = LatencyStats::Now();
+		records_.clear();
+		if (!channel->channel.TakeRequests(&records_, kBatch)) {
+			if (channel->channel.Sleep()) {
+				return;
+			}
+			continue;
+		}
+		latency.Trace(channel->session->id());
+		const std::vector<char> &reply = channel->session->ProcessRecords(group, &records_[0], records_.size(), start);
+		if (!reply.empty()) {
+			uint64_t stage_start = LatencyStats::Now();
+			channel->channel.PutReplies(&reply[0], reply.size() / record::kEstimateSize);
+			latency.Record(LATENCY_SEND, stage_start);
+			latency.Record(LATENCY_TOTAL, start);
+		}
+		else {
+			latency.StopTrace();
+		}
+	}
+	//the sockets and other channels of the loop come first
+	channel->channel.Reschedule();
+}
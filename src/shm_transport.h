@@ -0,0 +1,57 @@
+#ifndef SHM_TRANSPORT_H_
+#define SHM_TRANSPORT_H_
+
+#include <uWS/uWS.h>
+#include "session.h"
+#include "shm_channel.h"
+#include <memory>
+#include <vector>
+
+/**
+ * Serves ShmChannels on an event loop, for sensor drivers on the same host:
+ * the measurement records a driver queues are filtered by a session of the
+ * loop's pool, like those of a BINARY frame, and the estimate records go
+ * back on the channel's reply ring. The loop sleeps on the channels' FIFOs
+ * along with its sockets, and is only woken while it has nothing to do.
+ *
+ * The transport belongs to the loop's thread and must be created there.
+ */
+class ShmTransport {
+public:
+  ///* records taken from a channel at once, and rounds before other work
+  static const size_t kBatch = 64;
+  static const int kRounds = 16;
+
+  ShmTransport(uWS::Hub &h, SessionPool &pool);
+
+  ///* releases the sessions and removes the channels
+  ~ShmTransport();
+
+  /**
+   * Creates the channel at path and serves it.
+   * @return false if it cannot be created
+   */
+  bool Add(const char *path, uint32_t slots = shm_channel::kDefaultSlots);
+
+private:
+  struct Channel {
+    ShmTransport *transport;
+    ShmChannel channel;
+    uv_poll_t *poll;
+    Session *session;
+    uint32_t generation;
+  };
+
+  uWS::Hub *hub_;
+  SessionPool *pool_;
+  std::vector<std::unique_ptr<Channel> > channels_;
+  std::vector<char> records_;
+
+  ///* takes and answers the requests of channel until it is empty
+  void Serve(Channel *channel);
+
+  ShmTransport(const ShmTransport &);
+  ShmTransport &operator=(const ShmTransport &);
+};
+
+#endif /* SHM_TRANSPORT_H_ */
@@ -0,0 +1,253 @@
+#ifndef SIGMA_POINTS_H_
+#define SIGMA_POINTS_H_
+
+#include "unscented_transform.h"
+#include "Eigen/Dense"
+#include <cmath>
+
+/**
+ * Sigma-point schemes of UKF for an N-dimensional augmented state, chosen
+ * by its Points parameter. A scheme lays its points out in unit form: sigma
+ * point i is mean + L * units.col(i) for a factor L of the covariance, and
+ * every point but the center (point 0, if the scheme has one) has the same
+ * weight, which the square-root filter relies on. A scheme provides
+ *   n_, n_points_    dimension and number of points
+ *   has_center_      whether point 0 is the mean itself
+ *   Propagated<NX>::value
+ *                    points Propagate sends through the process model, for
+ *                    a state of NX of the N dimensions
+ *   Set()            its units and weights, computed once
+ *   Draw(x_aug, L, std_noise, Xsig_aug)
+ *                    the augmented points for a block-diagonal covariance:
+ *                    factor L of the state block, noise standard deviations
+ *   Propagate<Process>(Xsig_aug, delta_t, Xsig_aug_t, Xsig_pred_t, Xsig_pred)
+ *                    the points through the process model, with scratch of
+ *                    Propagated<Process::n_x_>::value rows
+ *
+ * ScaledSigmaPoints is the 2N + 1 point set the filter always used;
+ * SimplexSigmaPoints (N + 2 points) and CubatureSigmaPoints (2N points)
+ * cost fewer propagations and projections per step.
+ */
+
+///* the units of a scheme and their weights
+template <int N, int P>
+struct SigmaPointSet {
+  Eigen::Matrix<double, N, P> units;
+  Eigen::Matrix<double, P, 1> weights;
+  ///* square-root mode: the root of the weight every point but the center
+  ///* shares, and of the center's absolute weight with its sign
+  double sqrt_weight;
+  double sqrt_weight0;
+  double weight0_sign;
+
+  ///* fills the square roots from the weights
+  void SetRoots(bool has_center) {
+    sqrt_weight = sqrt(weights(P - 1));
+    sqrt_weight0 = has_center ? sqrt(fabs(weights(0))) : 0.0;
+    weight0_sign = has_center && weights(0) < 0 ? -1.0 : 1.0;
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/**
+ * Draws the augmented points mean + [L 0; 0 diag(std_noise)] * units
+ * of any scheme.
+ */
+template <int N, int P, int NX>
+void DrawSigmaPoints(const SigmaPointSet<N, P> &set, const Eigen::Matrix<double, N, 1> &x_aug,
+                     const Eigen::Matrix<double, NX, NX> &L, const Eigen::Matrix<double, N - NX, 1> &std_noise,
+                     Eigen::Matrix<double, N, P> &Xsig_aug) {
+  Xsig_aug.template topRows<NX>().noalias() = L.lazyProduct(set.units.template topRows<NX>());
+  Xsig_aug.template topRows<NX>().colwise() += x_aug.template head<NX>();
+  Xsig_aug.template bottomRows<N - NX>() = std_noise.asDiagonal() * set.units.template bottomRows<N - NX>();
+}
+
+/**
+ * The scaled symmetric set: the center and +-sqrt(lambda + N) along every
+ * axis, lambda = 3 - N, with weights lambda / (lambda + N) and
+ * 1 / (2 (lambda + N)). Its points along the noise axes move no state, so
+ * Propagate only sends 2 n_x + 1 points through the process model (see
+ * PropagateBlockSigmaPoints).
+ */
+template <int N>
+struct ScaledSigmaPoints {
+  static const int n_ = N;
+  static const int n_points_ = 2 * N + 1;
+  static const bool has_center_ = true;
+
+  ///* the set's value of the UKF_SIGMA_POINTS build option
+  static const char *Name() { return "scaled"; }
+
+  static const SigmaPointSet<N, n_points_> &Set() {
+    static const SigmaPointSet<N, n_points_> set = MakeSet();
+    return set;
+  }
+
+  template <int NX>
+  static void Draw(const Eigen::Matrix<double, N, 1> &x_aug, const Eigen::Matrix<double, NX, NX> &L,
+                   const Eigen::Matrix<double, N - NX, 1> &std_noise, Eigen::Matrix<double, N, n_points_> &Xsig_aug) {
+    //along a state axis only the state moves, along a noise axis only
+    //that noise component
+    const double c = Set().units(0, 1);
+    Xsig_aug.col(0) = x_aug;
+    for (int i = 0; i < N; i++) {
+      Xsig_aug.col(i + 1) = x_aug;
+      Xsig_aug.col(i + 1 + N) = x_aug;
+      if (i < NX) {
+        Xsig_aug.col(i + 1).template head<NX>() += c * L.col(i);
+        Xsig_aug.col(i + 1 + N).template head<NX>() -= c * L.col(i);
+      }
+      else {
+        Xsig_aug(i, i + 1) = c * std_noise(i - NX);
+        Xsig_aug(i, i + 1 + N) = -c * std_noise(i - NX);
+      }
+    }
+  }
+
+  template <class Process, int NPROPAGATED>
+  static void Propagate(const Eigen::Matrix<double, N, n_points_> &Xsig_aug, double delta_t,
+                        Eigen::Matrix<double, NPROPAGATED, N> &Xsig_aug_t,
+                        Eigen::Matrix<double, NPROPAGATED, Process::n_x_> &Xsig_pred_t,
+                        Eigen::Matrix<double, Process::n_x_, n_points_> &Xsig_pred) {
+    PropagateBlockSigmaPoints<Process>(Xsig_aug, delta_t, Xsig_aug_t, Xsig_pred_t, Xsig_pred);
+  }
+
+  template <int NX>
+  struct Propagated {
+    static const int value = 2 * NX + 1;
+  };
+
+private:
+  static SigmaPointSet<N, n_points_> MakeSet() {
+    SigmaPointSet<N, n_points_> set;
+    const double lambda = 3.0 - N;
+    const double c = sqrt(lambda + N);
+    set.units.setZero();
+    set.weights.setConstant(0.5 / (lambda + N));
+    set.weights(0) = lambda / (lambda + N);
+    for (int i = 0; i < N; i++) {
+      set.units(i, i + 1) = c;
+      set.units(i, i + 1 + N) = -c;
+    }
+    set.SetRoots(true);
+    return set;
+  }
+};
+
+/**
+ * The spherical simplex set (Julier, 2003): the center with weight W0 and
+ * N + 1 points of weight (1 - W0) / (N + 1) on a sphere around it, the
+ * fewest points that match the mean and covariance. W0 = 1 / (N + 2) gives
+ * all points the same weight.
+ */
+template <int N>
+struct SimplexSigmaPoints {
+  static const int n_ = N;
+  static const int n_points_ = N + 2;
+  static const bool has_center_ = true;
+
+  ///* the set's value of the UKF_SIGMA_POINTS build option
+  static const char *Name() { return "simplex"; }
+
+  static const SigmaPointSet<N, n_points_> &Set() {
+    static const SigmaPointSet<N, n_points_> set = MakeSet();
+    return set;
+  }
+
+  template <int NX>
+  static void Draw(const Eigen::Matrix<double, N, 1> &x_aug, const Eigen::Matrix<double, NX, NX> &L,
+                   const Eigen::Matrix<double, N - NX, 1> &std_noise, Eigen::Matrix<double, N, n_points_> &Xsig_aug) {
+    DrawSigmaPoints(Set(), x_aug, L, std_noise, Xsig_aug);
+  }
+
+  template <class Process, int NPROPAGATED>
+  static void Propagate(const Eigen::Matrix<double, N, n_points_> &Xsig_aug, double delta_t,
+                        Eigen::Matrix<double, NPROPAGATED, N> &Xsig_aug_t,
+                        Eigen::Matrix<double, NPROPAGATED, Process::n_x_> &Xsig_pred_t,
+                        Eigen::Matrix<double, Process::n_x_, n_points_> &Xsig_pred) {
+    PropagateSigmaPoints<Process>(Xsig_aug, delta_t, Xsig_aug_t, Xsig_pred_t, Xsig_pred);
+  }
+
+  template <int NX>
+  struct Propagated {
+    static const int value = n_points_;
+  };
+
+private:
+  static SigmaPointSet<N, n_points_> MakeSet() {
+    SigmaPointSet<N, n_points_> set;
+    const double w0 = 1.0 / (N + 2);
+    const double w = (1.0 - w0) / (N + 1);
+    set.weights.setConstant(w);
+    set.weights(0) = w0;
+    //the simplex of dimension j extends that of j - 1 by a coordinate
+    set.units.setZero();
+    set.units(0, 1) = -1.0 / sqrt(2.0 * w);
+    set.units(0, 2) = 1.0 / sqrt(2.0 * w);
+    for (int j = 2; j <= N; j++) {
+      const double scale = 1.0 / sqrt(j * (j + 1.0) * w);
+      for (int i = 1; i <= j; i++) {
+        set.units(j - 1, i) = -scale;
+      }
+      set.units(j - 1, j + 1) = j * scale;
+    }
+    set.SetRoots(true);
+    return set;
+  }
+};
+
+/**
+ * The third-degree spherical-radial cubature set (Arasaratnam and Haykin,
+ * 2009): +-sqrt(N) along every axis with the same weight 1 / (2N) and no
+ * center, so that no weight is negative.
+ */
+template <int N>
+struct CubatureSigmaPoints {
+  static const int n_ = N;
+  static const int n_points_ = 2 * N;
+  static const bool has_center_ = false;
+
+  ///* the set's value of the UKF_SIGMA_POINTS build option
+  static const char *Name() { return "cubature"; }
+
+  static const SigmaPointSet<N, n_points_> &Set() {
+    static const SigmaPointSet<N, n_points_> set = MakeSet();
+    return set;
+  }
+
+  template <int NX>
+  static void Draw(const Eigen::Matrix<double, N, 1> &x_aug, const Eigen::Matrix<double, NX, NX> &L,
+                   const Eigen::Matrix<double, N - NX, 1> &std_noise, Eigen::Matrix<double, N, n_points_> &Xsig_aug) {
+    DrawSigmaPoints(Set(), x_aug, L, std_noise, Xsig_aug);
+  }
+
+  template <class Process, int NPROPAGATED>
+  static void Propagate(const Eigen::Matrix<double, N, n_points_> &Xsig_aug, double delta_t,
+                        Eigen::Matrix<double, NPROPAGATED, N> &Xsig_aug_t,
+                        Eigen::Matrix<double, NPROPAGATED, Process::n_x_> &Xsig_pred_t,
+                        Eigen::Matrix<double, Process::n_x_, n_points_> &Xsig_pred) {
+    PropagateSigmaPoints<Process>(Xsig_aug, delta_t, Xsig_aug_t, Xsig_pred_t, Xsig_pred);
+  }
+
+  template <int NX>
+  struct Propagated {
+    static const int value = n_points_;
+  };
+
+private:
+  static SigmaPointSet<N, n_points_> MakeSet() {
+    SigmaPointSet<N, n_points_> set;
+    const double c = sqrt(double(N));
+    set.units.setZero();
+    set.weights.setConstant(0.5 / N);
+    for (int i = 0; i < N; i++) {
+      set.units(i, i) = c;
+      set.units(i, i + N) = -c;
+    }
+    set.SetRoots(false);
+    return set;
+  }
+};
+
+#endif /* SIGMA_POINTS_H_ */
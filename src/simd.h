@@ -0,0 +1,430 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <cmath>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Thin wrappers over the vector instruction sets used by the filter kernels.
+ *
+ * Every backend exposes the same static interface on a register type Vec and
+ * a comparison mask type Mask, so a kernel written once as a template on the
+ * backend compiles to scalar, AVX2, AVX-512 or ARM64 NEON code. NativeDouble is
+ * the widest backend enabled by the compiler flags (see UKF_NATIVE_ARCH in
+ * CMakeLists.txt), NEON on every ARM64 build; kernels process their tails
+ * with ScalarDouble. The float
+ * backends (NativeFloat, ScalarFloat) have the same interface on single
+ * precision lanes, twice as many per register.
+ */
+namespace simd {
+
+struct ScalarDouble {
+  typedef double Vec;
+  typedef bool Mask;
+  static const int width = 1;
+
+  static Vec Load(const double *p) { return *p; }
+  static void Store(double *p, Vec a) { *p = a; }
+  static Vec Set1(double a) { return a; }
+  static Vec Add(Vec a, Vec b) { return a + b; }
+  static Vec Sub(Vec a, Vec b) { return a - b; }
+  static Vec Mul(Vec a, Vec b) { return a * b; }
+  static Vec Div(Vec a, Vec b) { return a / b; }
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return a * b + c; }
+  static Vec Sqrt(Vec a) { return std::sqrt(a); }
+  static Vec Abs(Vec a) { return std::fabs(a); }
+  static Vec Floor(Vec a) { return std::floor(a); }
+  static Vec Round(Vec a) { return std::nearbyint(a); }
+  static Vec Min(Vec a, Vec b) { return a < b ? a : b; }
+  static Vec Max(Vec a, Vec b) { return a > b ? a : b; }
+  static Mask Greater(Vec a, Vec b) { return a > b; }
+  static Mask Less(Vec a, Vec b) { return a < b; }
+  static Mask Equal(Vec a, Vec b) { return a == b; }
+  static Mask Or(Mask a, Mask b) { return a || b; }
+  static Mask And(Mask a, Mask b) { return a && b; }
+  ///* whether the mask is set in every lane
+  static bool All(Mask m) { return m; }
+  ///* a where mask is set, b elsewhere
+  static Vec Select(Mask m, Vec a, Vec b) { return m ? a : b; }
+};
+
+struct ScalarFloat {
+  typedef float Vec;
+  typedef bool Mask;
+  static const int width = 1;
+
+  static Vec Load(const float *p) { return *p; }
+  static void Store(float *p, Vec a) { *p = a; }
+  static Vec Set1(float a) { return a; }
+  static Vec Add(Vec a, Vec b) { return a + b; }
+  static Vec Sub(Vec a, Vec b) { return a - b; }
+  static Vec Mul(Vec a, Vec b) { return a * b; }
+  static Vec Div(Vec a, Vec b) { return a / b; }
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return a * b + c; }
+  static Vec Sqrt(Vec a) { return std::sqrt(a); }
+  static Vec Abs(Vec a) { return std::fabs(a); }
+  static Vec Floor(Vec a) { return std::floor(a); }
+  static Vec Round(Vec a) { return std::nearbyint(a); }
+  static Vec Min(Vec a, Vec b) { return a < b ? a : b; }
+  static Vec Max(Vec a, Vec b) { return a > b ? a : b; }
+  static Mask Greater(Vec a, Vec b) { return a > b; }
+  static Mask Less(Vec a, Vec b) { return a < b; }
+  static Mask Equal(Vec a, Vec b) { return a == b; }
+  static Mask Or(Mask a, Mask b) { return a || b; }
+  static Mask And(Mask a, Mask b) { return a && b; }
+  static bool All(Mask m) { return m; }
+  static Vec Select(Mask m, Vec a, Vec b) { return m ? a : b; }
+};
+
+#ifdef __AVX2__
+struct Avx2Double {
+  typedef __m256d Vec;
+  typedef __m256d Mask;
+  static const int width = 4;
+
+  static Vec Load(const double *p) { return _mm256_loadu_pd(p); }
+  static void Store(double *p, Vec a) { _mm256_storeu_pd(p, a); }
+  static Vec Set1(double a) { return _mm256_set1_pd(a); }
+  static Vec Add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+  static Vec Mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+  static Vec Div(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+#ifdef __FMA__
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return _mm256_fmadd_pd(a, b, c); }
+#else
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return _mm256_add_pd(_mm256_mul_pd(a, b), c); }
+#endif
+  static Vec Sqrt(Vec a) { return _mm256_sqrt_pd(a); }
+  static Vec Abs(Vec a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+  static Vec Floor(Vec a) { return _mm256_floor_pd(a); }
+  static Vec Round(Vec a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+  static Vec Min(Vec a, Vec b) { return _mm256_min_pd(a, b); }
+  static Vec Max(Vec a, Vec b) { return _mm256_max_pd(a, b); }
+  static Mask Greater(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+  static Mask Less(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+  static Mask Equal(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+  static Mask Or(Mask a, Mask b) { return _mm256_or_pd(a, b); }
+  static Mask And(Mask a, Mask b) { return _mm256_and_pd(a, b); }
+  static bool All(Mask m) { return _mm256_movemask_pd(m) == 0xf; }
+  static Vec Select(Mask m, Vec a, Vec b) { return _mm256_blendv_pd(b, a, m); }
+};
+#endif
+
+#ifdef __AVX2__
+struct Avx2Float {
+  typedef __m256 Vec;
+  typedef __m256 Mask;
+  static const int width = 8;
+
+  static Vec Load(const float *p) { return _mm256_loadu_ps(p); }
+  static void Store(float *p, Vec a) { _mm256_storeu_ps(p, a); }
+  static Vec Set1(float a) { return _mm256_set1_ps(a); }
+  static Vec Add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+  static Vec Mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+  static Vec Div(Vec a, Vec b) { return _mm256_div_ps(a, b); }
+#ifdef __FMA__
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+  static Vec Sqrt(Vec a) { return _mm256_sqrt_ps(a); }
+  static Vec Abs(Vec a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+  static Vec Floor(Vec a) { return _mm256_floor_ps(a); }
+  static Vec Round(Vec a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+  static Vec Min(Vec a, Vec b) { return _mm256_min_ps(a, b); }
+  static Vec Max(Vec a, Vec b) { return _mm256_max_ps(a, b); }
+  static Mask Greater(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static Mask Less(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static Mask Equal(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+  static Mask Or(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+  static Mask And(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+  static bool All(Mask m) { return _mm256_movemask_ps(m) == 0xff; }
+  static Vec Select(Mask m, Vec a, Vec b) { return _mm256_blendv_ps(b, a, m); }
+};
+#endif
+
+#ifdef __AVX512F__
+struct Avx512Double {
+  typedef __m512d Vec;
+  typedef __mmask8 Mask;
+  static const int width = 8;
+
+  static Vec Load(const double *p) { return _mm512_loadu_pd(p); }
+  static void Store(double *p, Vec a) { _mm512_storeu_pd(p, a); }
+  static Vec Set1(double a) { return _mm512_set1_pd(a); }
+  static Vec Add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm512_sub_pd(a, b); }
+  static Vec Mul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+  static Vec Div(Vec a, Vec b) { return _mm512_div_pd(a, b); }
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return _mm512_fmadd_pd(a, b, c); }
+  static Vec Sqrt(Vec a) { return _mm512_sqrt_pd(a); }
+  static Vec Abs(Vec a) { return _mm512_abs_pd(a); }
+  static Vec Floor(Vec a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+  static Vec Round(Vec a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+  static Vec Min(Vec a, Vec b) { return _mm512_min_pd(a, b); }
+  static Vec Max(Vec a, Vec b) { return _mm512_max_pd(a, b); }
+  static Mask Greater(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+  static Mask Less(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+  static Mask Equal(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+  static Mask Or(Mask a, Mask b) { return a | b; }
+  static Mask And(Mask a, Mask b) { return a & b; }
+  static bool All(Mask m) { return m == 0xff; }
+  static Vec Select(Mask m, Vec a, Vec b) { return _mm512_mask_blend_pd(m, b, a); }
+};
+
+struct Avx512Float {
+  typedef __m512 Vec;
+  typedef __mmask16 Mask;
+  static const int width = 16;
+
+  static Vec Load(const float *p) { return _mm512_loadu_ps(p); }
+  static void Store(float *p, Vec a) { _mm512_storeu_ps(p, a); }
+  static Vec Set1(float a) { return _mm512_set1_ps(a); }
+  static Vec Add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm512_sub_ps(a, b); }
+  static Vec Mul(Vec a, Vec b) { return _mm512_mul_ps(a, b); }
+  static Vec Div(Vec a, Vec b) { return _mm512_div_ps(a, b); }
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return _mm512_fmadd_ps(a, b, c); }
+  static Vec Sqrt(Vec a) { return _mm512_sqrt_ps(a); }
+  static Vec Abs(Vec a) { return _mm512_abs_ps(a); }
+  static Vec Floor(Vec a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+  static Vec Round(Vec a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+  static Vec Min(Vec a, Vec b) { return _mm512_min_ps(a, b); }
+  static Vec Max(Vec a, Vec b) { return _mm512_max_ps(a, b); }
+  static Mask Greater(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+  static Mask Less(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+  static Mask Equal(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+  static Mask Or(Mask a, Mask b) { return a | b; }
+  static Mask And(Mask a, Mask b) { return a & b; }
+  static bool All(Mask m) { return m == 0xffff; }
+  static Vec Select(Mask m, Vec a, Vec b) { return _mm512_mask_blend_ps(m, b, a); }
+};
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+///* ARM64 only: 32-bit NEON has no double lanes, nor division or rounding
+struct NeonDouble {
+  typedef float64x2_t Vec;
+  typedef uint64x2_t Mask;
+  static const int width = 2;
+
+  static Vec Load(const double *p) { return vld1q_f64(p); }
+  static void Store(double *p, Vec a) { vst1q_f64(p, a); }
+  static Vec Set1(double a) { return vdupq_n_f64(a); }
+  static Vec Add(Vec a, Vec b) { return vaddq_f64(a, b); }
+  static Vec Sub(Vec a, Vec b) { return vsubq_f64(a, b); }
+  static Vec Mul(Vec a, Vec b) { return vmulq_f64(a, b); }
+  static Vec Div(Vec a, Vec b) { return vdivq_f64(a, b); }
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return vfmaq_f64(c, a, b); }
+  static Vec Sqrt(Vec a) { return vsqrtq_f64(a); }
+  static Vec Abs(Vec a) { return vabsq_f64(a); }
+  static Vec Floor(Vec a) { return vrndmq_f64(a); }
+  static Vec Round(Vec a) { return vrndnq_f64(a); }
+  static Vec Min(Vec a, Vec b) { return vminq_f64(a, b); }
+  static Vec Max(Vec a, Vec b) { return vmaxq_f64(a, b); }
+  static Mask Greater(Vec a, Vec b) { return vcgtq_f64(a, b); }
+  static Mask Less(Vec a, Vec b) { return vcltq_f64(a, b); }
+  static Mask Equal(Vec a, Vec b) { return vceqq_f64(a, b); }
+  static Mask Or(Mask a, Mask b) { return vorrq_u64(a, b); }
+  static Mask And(Mask a, Mask b) { return vandq_u64(a, b); }
+  static bool All(Mask m) { return vminvq_u32(vreinterpretq_u32_u64(m)) == 0xffffffffu; }
+  static Vec Select(Mask m, Vec a, Vec b) { return vbslq_f64(m, a, b); }
+};
+
+struct NeonFloat {
+  typedef float32x4_t Vec;
+  typedef uint32x4_t Mask;
+  static const int width = 4;
+
+  static Vec Load(const float *p) { return vld1q_f32(p); }
+  static void Store(float *p, Vec a) { vst1q_f32(p, a); }
+  static Vec Set1(float a) { return vdupq_n_f32(a); }
+  static Vec Add(Vec a, Vec b) { return vaddq_f32(a, b); }
+  static Vec Sub(Vec a, Vec b) { return vsubq_f32(a, b); }
+  static Vec Mul(Vec a, Vec b) { return vmulq_f32(a, b); }
+  static Vec Div(Vec a, Vec b) { return vdivq_f32(a, b); }
+  static Vec MulAdd(Vec a, Vec b, Vec c) { return vfmaq_f32(c, a, b); }
+  static Vec Sqrt(Vec a) { return vsqrtq_f32(a); }
+  static Vec Abs(Vec a) { return vabsq_f32(a); }
+  static Vec Floor(Vec a) { return vrndmq_f32(a); }
+  static Vec Round(Vec a) { return vrndnq_f32(a); }
+  static Vec Min(Vec a, Vec b) { return vminq_f32(a, b); }
+  static Vec Max(Vec a, Vec b) { return vmaxq_f32(a, b); }
+  static Mask Greater(Vec a, Vec b) { return vcgtq_f32(a, b); }
+  static Mask Less(Vec a, Vec b) { return vcltq_f32(a, b); }
+  static Mask Equal(Vec a, Vec b) { return vceqq_f32(a, b); }
+  static Mask Or(Mask a, Mask b) { return vorrq_u32(a, b); }
+  static Mask And(Mask a, Mask b) { return vandq_u32(a, b); }
+  static bool All(Mask m) { return vminvq_u32(m) == 0xffffffffu; }
+  static Vec Select(Mask m, Vec a, Vec b) { return vbslq_f32(m, a, b); }
+};
+#endif
+
+#if defined(__AVX512F__)
+typedef Avx512Double NativeDouble;
+typedef Avx512Float NativeFloat;
+#elif defined(__AVX2__)
+typedef Avx2Double NativeDouble;
+typedef Avx2Float NativeFloat;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+typedef NeonDouble NativeDouble;
+typedef NeonFloat NativeFloat;
+#else
+typedef ScalarDouble NativeDouble;
+typedef ScalarFloat NativeFloat;
+#endif
+
+///* the Cephes polynomial of sin(r) - r over r^3, in z = r^2
+template <class V>
+inline typename V::Vec SinPolynomial(typename V::Vec z) {
+  typedef typename V::Vec Vec;
+  Vec ps = V::Set1(1.58962301576546568060E-10);
+  ps = V::MulAdd(ps, z, V::Set1(-2.50507477628578072866E-8));
+  ps = V::MulAdd(ps, z, V::Set1(2.75573136213857245213E-6));
+  ps = V::MulAdd(ps, z, V::Set1(-1.98412698295895385996E-4));
+  ps = V::MulAdd(ps, z, V::Set1(8.33333333332211858878E-3));
+  return V::MulAdd(ps, z, V::Set1(-1.66666666666666307295E-1));
+}
+
+///* and of cos(r) - 1 + r^2 / 2 over r^4
+template <class V>
+inline typename V::Vec CosPolynomial(typename V::Vec z) {
+  typedef typename V::Vec Vec;
+  Vec pc = V::Set1(-1.13585365213876817300E-11);
+  pc = V::MulAdd(pc, z, V::Set1(2.08757008419747316778E-9));
+  pc = V::MulAdd(pc, z, V::Set1(-2.75573141792967388112E-7));
+  pc = V::MulAdd(pc, z, V::Set1(2.48015872888517045348E-5));
+  pc = V::MulAdd(pc, z, V::Set1(-1.38888888888730564116E-3));
+  return V::MulAdd(pc, z, V::Set1(4.16666666666665929218E-2));
+}
+
+/**
+ * Branch-free sine and cosine of every lane (Cephes polynomials after a
+ * three-part Cody-Waite reduction by pi/2). Accurate to a few ulp for
+ * |x| < 1e8, which covers every angle the filter produces. The float
+ * backends evaluate the same polynomials in single precision.
+ */
+template <class V>
+inline void SinCos(typename V::Vec x, typename V::Vec *s, typename V::Vec *c) {
+  typedef typename V::Vec Vec;
+  const Vec q = V::Round(V::Mul(x, V::Set1(0.63661977236758134308)));
+  Vec r = V::MulAdd(q, V::Set1(-1.57079625129699707031E0), x);
+  r = V::MulAdd(q, V::Set1(-7.54978941586159635335E-8), r);
+  r = V::MulAdd(q, V::Set1(-5.39030285815811905290E-15), r);
+  const Vec z = V::Mul(r, r);
+
+  const Vec sin_r = V::MulAdd(V::Mul(r, z), SinPolynomial<V>(z), r);
+  const Vec cos_r = V::MulAdd(V::Mul(z, z), CosPolynomial<V>(z), V::MulAdd(z, V::Set1(-0.5), V::Set1(1.0)));
+
+  // quadrant q mod 4: 0 -> (s, c), 1 -> (c, -s), 2 -> (-s, -c), 3 -> (-c, s)
+  const Vec quadrant = V::Sub(q, V::Mul(V::Set1(4.0), V::Floor(V::Mul(q, V::Set1(0.25)))));
+  const typename V::Mask odd = V::Or(V::Equal(quadrant, V::Set1(1.0)), V::Equal(quadrant, V::Set1(3.0)));
+  const typename V::Mask sin_negative = V::Greater(quadrant, V::Set1(1.5));
+  const typename V::Mask cos_negative = V::Or(V::Equal(quadrant, V::Set1(1.0)), V::Equal(quadrant, V::Set1(2.0)));
+  const Vec sin_abs = V::Select(odd, cos_r, sin_r);
+  const Vec cos_abs = V::Select(odd, sin_r, cos_r);
+  *s = V::Select(sin_negative, V::Sub(V::Set1(0.0), sin_abs), sin_abs);
+  *c = V::Select(cos_negative, V::Sub(V::Set1(0.0), cos_abs), cos_abs);
+}
+
+///* the largest |x| SinCosM1 takes
+const double kSinCosM1Limit = 0.78539816339744830962;
+
+/**
+ * Sine and cosine minus one of lanes with |x| <= kSinCosM1Limit (pi/4):
+ * the polynomials of SinCos without its reduction. cos(x) - 1 comes out
+ * to full relative precision for small x, where 1 + cos(x) - 1 would not,
+ * for differences such as sin(a + x) - sin(a) = sin(a) (cos(x) - 1) +
+ * cos(a) sin(x).
+ */
+template <class V>
+inline void SinCosM1(typename V::Vec x, typename V::Vec *s, typename V::Vec *cm1) {
+  typedef typename V::Vec Vec;
+  const Vec z = V::Mul(x, x);
+  *s = V::MulAdd(V::Mul(x, z), SinPolynomial<V>(z), x);
+  *cm1 = V::MulAdd(V::Mul(z, z), CosPolynomial<V>(z), V::Mul(z, V::Set1(-0.5)));
+}
+
+///* a = min(|x|, |y|) / max(|x|, |y|) in [0, 1], 0 at the origin
+template <class V>
+inline typename V::Vec Atan2Ratio(typename V::Vec y, typename V::Vec x) {
+  const typename V::Vec ay = V::Abs(y);
+  const typename V::Vec ax = V::Abs(x);
+  const typename V::Vec hi = V::Max(ay, ax);
+  return V::Div(V::Min(ay, ax), V::Select(V::Greater(hi, V::Set1(0.0)), hi, V::Set1(1.0)));
+}
+
+/**
+ * The angle of (x, y) in [-pi, pi] from r = atan(a) of Atan2Ratio:
+ * pi/2 - r if |y| > |x|, then pi - r if x < 0, negated if y < 0.
+ */
+template <class V>
+inline typename V::Vec Atan2Quadrant(typename V::Vec y, typename V::Vec x, typename V::Vec atan_a) {
+  typedef typename V::Vec Vec;
+  const Vec zero = V::Set1(0.0);
+  Vec r = V::Select(V::Greater(V::Abs(y), V::Abs(x)), V::Sub(V::Set1(1.57079632679489661923), atan_a), atan_a);
+  r = V::Select(V::Less(x, zero), V::Sub(V::Set1(3.14159265358979323846), r), r);
+  return V::Select(V::Less(y, zero), V::Sub(zero, r), r);
+}
+
+/**
+ * Branch-free atan2 of every lane: the Cephes rational approximation of
+ * atan on [0, 0.66], and atan(a) = pi/4 + atan((a - 1) / (a + 1)) above.
+ * Within 2 ulp of std::atan2 in double; the float backends evaluate the same
+ * rational in single precision.
+ */
+template <class V>
+inline typename V::Vec Atan2(typename V::Vec y, typename V::Vec x) {
+  typedef typename V::Vec Vec;
+  const Vec a = Atan2Ratio<V>(y, x);
+  const typename V::Mask reduce = V::Greater(a, V::Set1(0.66));
+  const Vec t = V::Select(reduce, V::Div(V::Sub(a, V::Set1(1.0)), V::Add(a, V::Set1(1.0))), a);
+  const Vec z = V::Mul(t, t);
+  Vec p = V::Set1(-8.750608600031904122785E-1);
+  p = V::MulAdd(p, z, V::Set1(-1.615753718733365076637E1));
+  p = V::MulAdd(p, z, V::Set1(-7.500855792314704667340E1));
+  p = V::MulAdd(p, z, V::Set1(-1.228866684490136173410E2));
+  p = V::MulAdd(p, z, V::Set1(-6.485021904942025371773E1));
+  Vec q = V::Add(z, V::Set1(2.485846490142306297962E1));
+  q = V::MulAdd(q, z, V::Set1(1.650270098316988542046E2));
+  q = V::MulAdd(q, z, V::Set1(4.328810604912902668951E2));
+  q = V::MulAdd(q, z, V::Set1(4.853903996359136964868E2));
+  q = V::MulAdd(q, z, V::Set1(1.945506571482613964425E2));
+  const Vec atan_t = V::MulAdd(V::Mul(t, z), V::Div(p, q), t);
+  const Vec atan_a = V::Add(atan_t, V::Select(reduce, V::Set1(0.78539816339744830962), V::Set1(0.0)));
+  return Atan2Quadrant<V>(y, x, atan_a);
+}
+
+///* the largest difference of Atan2Approximate from atan2, in rad
+const double kAtan2ApproximateError = 1.2e-5;
+
+/**
+ * Atan2 with the odd degree 9 polynomial of Abramowitz and Stegun 4.4.49
+ * for atan on [0, 1]: no reduction and no division besides that of the
+ * ratio. Within kAtan2ApproximateError (measured by BM_ProjectRadar), a
+ * few thousandths of the 0.03 rad bearing noise of the radar.
+ */
+template <class V>
+inline typename V::Vec Atan2Approximate(typename V::Vec y, typename V::Vec x) {
+  typedef typename V::Vec Vec;
+  const Vec a = Atan2Ratio<V>(y, x);
+  const Vec z = V::Mul(a, a);
+  Vec p = V::Set1(0.0208351);
+  p = V::MulAdd(p, z, V::Set1(-0.0851330));
+  p = V::MulAdd(p, z, V::Set1(0.1801410));
+  p = V::MulAdd(p, z, V::Set1(-0.3302995));
+  p = V::MulAdd(p, z, V::Set1(0.9998660));
+  return Atan2Quadrant<V>(y, x, V::Mul(a, p));
+}
+
+}
+
+#endif /* SIMD_H_ */
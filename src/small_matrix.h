@@ -0,0 +1,116 @@
+#ifndef SMALL_MATRIX_H_
+#define SMALL_MATRIX_H_
+
+#include "Eigen/Dense"
+#include "simd.h"
+#include <cmath>
+
+/**
+ * Kernels for the few small shapes of the filter's updates, where Eigen's
+ * code for fixed sizes still loops and branches for any size: the closed-form
+ * inverse of the 2x2 and 3x3 innovation covariance, the Cholesky factor of
+ * the 5x5 state covariance, unrolled, and the symmetric covariance update
+ * P - T K^T in vector lanes. SmallMatrixSolver (see innovation_solver.h)
+ * puts them in a filter; ukf_bench compares each with Eigen's result and
+ * speed.
+ */
+namespace small_matrix {
+
+/**
+ * The inverse of the symmetric a by its adjugate, reading the lower
+ * triangle; a singular a gives infinities, as Eigen's inverse does.
+ */
+inline void SymmetricInverse(const Eigen::Matrix2d &a, Eigen::Matrix2d *inv) {
+  const double d = 1.0 / (a(0, 0) * a(1, 1) - a(1, 0) * a(1, 0));
+  (*inv)(0, 0) = a(1, 1) * d;
+  (*inv)(1, 1) = a(0, 0) * d;
+  (*inv)(1, 0) = (*inv)(0, 1) = -a(1, 0) * d;
+}
+
+inline void SymmetricInverse(const Eigen::Matrix3d &a, Eigen::Matrix3d *inv) {
+  const double c00 = a(1, 1) * a(2, 2) - a(2, 1) * a(2, 1);
+  const double c10 = a(2, 1) * a(2, 0) - a(1, 0) * a(2, 2);
+  const double c20 = a(1, 0) * a(2, 1) - a(1, 1) * a(2, 0);
+  const double d = 1.0 / (a(0, 0) * c00 + a(1, 0) * c10 + a(2, 0) * c20);
+  (*inv)(0, 0) = c00 * d;
+  (*inv)(1, 0) = (*inv)(0, 1) = c10 * d;
+  (*inv)(2, 0) = (*inv)(0, 2) = c20 * d;
+  (*inv)(1, 1) = (a(0, 0) * a(2, 2) - a(2, 0) * a(2, 0)) * d;
+  (*inv)(2, 1) = (*inv)(1, 2) = (a(1, 0) * a(2, 0) - a(0, 0) * a(2, 1)) * d;
+  (*inv)(2, 2) = (a(0, 0) * a(1, 1) - a(1, 0) * a(1, 0)) * d;
+}
+
+/**
+ * The lower Cholesky factor L of the symmetric positive definite a, reading
+ * its lower triangle, with the loops unrolled for N; the upper triangle of
+ * L is zeroed.
+ * @return false, with L undefined, if a pivot is not positive
+ */
+template <int N>
+inline bool Cholesky(const Eigen::Matrix<double, N, N> &a, Eigen::Matrix<double, N, N> *L) {
+  Eigen::Matrix<double, N, N> &l = *L;
+  for (int j = 0; j < N; j++) {
+    double pivot = a(j, j);
+    for (int k = 0; k < j; k++) {
+      pivot -= l(j, k) * l(j, k);
+    }
+    if (!(pivot > 0.0)) {
+      return false;
+    }
+    const double diagonal = std::sqrt(pivot);
+    const double inverse = 1.0 / diagonal;
+    l(j, j) = diagonal;
+    for (int i = j + 1; i < N; i++) {
+      double s = a(i, j);
+      for (int k = 0; k < j; k++) {
+        s -= l(i, k) * l(j, k);
+      }
+      l(i, j) = s * inverse;
+      l(j, i) = 0.0;
+    }
+  }
+  return true;
+}
+
+/**
+ * P -= T K^T for an update whose result is symmetric, as P - K S K^T with
+ * T = K S: the lower triangle is computed down each column, B::width rows at
+ * a time and the rest one by one, and mirrored to the upper.
+ */
+template <class B, int N, int M>
+inline void SubtractSymmetricProduct(Eigen::Matrix<double, N, N> *P, const Eigen::Matrix<double, N, M> &T,
+                                     const Eigen::Matrix<double, N, M> &K) {
+  double *p = P->data();
+  const double *t = T.data();
+  for (int j = 0; j < N; j++) {
+    int i = j;
+    for (; i + B::width <= N; i += B::width) {
+      typename B::Vec acc = B::Load(p + j * N + i);
+      for (int m = 0; m < M; m++) {
+        acc = B::MulAdd(B::Load(t + m * N + i), B::Set1(-K(j, m)), acc);
+      }
+      B::Store(p + j * N + i, acc);
+    }
+    for (; i < N; i++) {
+      double acc = p[j * N + i];
+      for (int m = 0; m < M; m++) {
+        acc -= t[m * N + i] * K(j, m);
+      }
+      p[j * N + i] = acc;
+    }
+    for (int k = j + 1; k < N; k++) {
+      p[k * N + j] = p[j * N + k];
+    }
+  }
+}
+
+///* the above in the widest lanes the build enables
+template <int N, int M>
+inline void SubtractSymmetricProduct(Eigen::Matrix<double, N, N> *P, const Eigen::Matrix<double, N, M> &T,
+                                     const Eigen::Matrix<double, N, M> &K) {
+  SubtractSymmetricProduct<simd::NativeDouble>(P, T, K);
+}
+
+}
+
+#endif /* SMALL_MATRIX_H_ */
@@ -0,0 +1,130 @@
+#include "spatial_grid.h"
+#include <cmath>
+
+namespace {
+
+///* buckets of an empty grid; always a power of two
+const size_t kMinBuckets = 64;
+
+///* buckets a query visits by cell before it walks them all instead
+const int kMaxQueryCells = 64;
+
+}
+
+SpatialGrid::SpatialGrid(double cell_size)
+	: cell_size_(cell_size), inverse_cell_size_(1.0 / cell_size), heads_(kMinBuckets, -1) {}
+
+long long SpatialGrid::CellCoordinate(double a) const {
+	return (long long) floor(a * inverse_cell_size_);
+}
+
+int SpatialGrid::Bucket(long long cx, long long cy) const {
+	//multiplicative hash of both coordinates, folded into the low bits
+	uint64_t h = uint64_t(cx) * 0x9E3779B97F4A7C15ULL ^ uint64_t(cy) * 0xC2B2AE3D27D4EB4FULL;
+	h ^= h >> 29;
+	return int(h & (heads_.size() - 1));
+}
+
+void SpatialGrid::Link(int slot, int bucket) {
+	slot_bucket_[slot] = bucket;
+	previous_[slot] = -1;
+	next_[slot] = heads_[bucket];
+	if (heads_[bucket] >= 0) {
+		previous_[heads_[bucket]] = slot;
+	}
+	heads_[bucket] = slot;
+}
+
+void SpatialGrid::Unlink(int slot) {
+	const int bucket = slot_bucket_[slot];
+	if (previous_[slot] >= 0) {
+		next_[previous_[slot]] = next_[slot];
+	}
+	else {
+		heads_[bucket] = next_[slot];
+	}
+	if (next_[slot] >= 0) {
+		previous_[next_[slot]] = previous_[slot];
+	}
+	slot_bucket_[slot] = -1;
+}
+
+void SpatialGrid::Reserve(int slot) {
+	if (size_t(slot) < slot_bucket_.size()) {
+		return;
+	}
+	const size_t slots = slot + 1;
+	slot_bucket_.resize(slots, -1);
+	next_.resize(slots, -1);
+	previous_.resize(slots, -1);
+	slot_x_.resize(slots, 0.0);
+	slot_y_.resize(slots, 0.0);
+	if (heads_.size() >= 2 * slots) {
+		return;
+	}
+	size_t buckets = heads_.size();
+	while (buckets < 2 * slots) {
+		buckets *= 2;
+	}
+	heads_.assign(buckets, -1);
+	for (size_t s = 0; s < slots; s++) {
+		if (slot_bucket_[s] >= 0) {
+			Link(int(s), Bucket(CellCoordinate(slot_x_[s]), CellCoordinate(slot_y_[s])));
+		}
+	}
+}
+
+void SpatialGrid::Update(int slot, double x, double y) {
+	Reserve(slot);
+	slot_x_[slot] = x;
+	slot_y_[slot] = y;
+	const int bucket = Bucket(CellCoordinate(x), CellCoordinate(y));
+	if (slot_bucket_[slot] == bucket) {
+		return;
+	}
+	if (slot_bucket_[slot] >= 0) {
+		Unlink(slot);
+	}
+	Link(slot, bucket);
+}
+
+void SpatialGrid::Remove(int slot) {
+	if (size_t(slot) < slot_bucket_.size() && slot_bucket_[slot] >= 0) {
+		Unlink(slot);
+	}
+}
+
+void SpatialGrid::Query(double x, double y, double radius, std::vector<int> *slots) const {
+	const long long x0 = CellCoordinate(x - radius);
+	const long long x1 = CellCoordinate(x + radius);
+	const long long y0 = CellCoordinate(y - radius);
+	const long long y1 = CellCoordinate(y + radius);
+	if (double(x1 - x0 + 1) * double(y1 - y0 + 1) > kMaxQueryCells) {
+		//a radius of many cells: every point is about as cheap
+		for (size_t s = 0; s < slot_bucket_.size(); s++) {
+			if (slot_bucket_[s] >= 0) {
+				slots->push_back(int(s));
+			}
+		}
+		return;
+	}
+	//cells of the square may share a bucket, which is then walked once
+	int visited[kMaxQueryCells];
+	int n_visited = 0;
+	for (long long cx = x0; cx <= x1; cx++) {
+		for (long long cy = y0; cy <= y1; cy++) {
+			const int bucket = Bucket(cx, cy);
+			bool seen = false;
+			for (int i = 0; i < n_visited && !seen; i++) {
+				seen = visited[i] == bucket;
+			}
+			if (seen) {
+				continue;
+			}
+			visited[n_visited++] = bucket;
+			for (int s = heads_[bucket]; s >= 0; s = next_[s]) {
+				slots->push_back(s);
+			}
+		}
+	}
+}
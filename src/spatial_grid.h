@@ -0,0 +1,67 @@
+#ifndef SPATIAL_GRID_H_
+#define SPATIAL_GRID_H_
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Uniform grid over points in the plane, hashed by cell, for finding the
+ * points near a position without looking at the others. Points are
+ * numbered slots 0, 1, ... that the user assigns and keeps stable; moving a
+ * point only touches the grid when it crosses into another cell, so
+ * points that move a little between updates, such as predicted track
+ * positions, cost one comparison each.
+ *
+ * The cells hash into a table of buckets, each the head of an intrusive
+ * list through the slots, so moving, adding and removing points never
+ * allocates. The table only grows, with the number of slots; cells that
+ * share a bucket just give a query some extra candidates.
+ */
+class SpatialGrid {
+public:
+  /**
+   * @param cell_size Edge of a cell in m; queries are cheapest with a
+   * radius of about half a cell
+   */
+  explicit SpatialGrid(double cell_size);
+
+  ///* places slot at (x, y), adding it if it is not in the grid
+  void Update(int slot, double x, double y);
+
+  ///* takes slot out of the grid
+  void Remove(int slot);
+
+  /**
+   * Appends to slots every slot of the cells that overlap the square of
+   * half-edge radius around (x, y): a superset of the points within radius,
+   * which the caller filters by their exact positions. Each slot is
+   * appended once.
+   */
+  void Query(double x, double y, double radius, std::vector<int> *slots) const;
+
+  double cell_size() const { return cell_size_; }
+
+private:
+  double cell_size_;
+  double inverse_cell_size_;
+
+  ///* first slot of each bucket, or -1
+  std::vector<int> heads_;
+  ///* per slot: its bucket or -1 outside the grid, and its list neighbours
+  std::vector<int> slot_bucket_;
+  std::vector<int> next_;
+  std::vector<int> previous_;
+  ///* a slot's position, to hash it again when the table grows
+  std::vector<double> slot_x_;
+  std::vector<double> slot_y_;
+
+  long long CellCoordinate(double a) const;
+  int Bucket(long long cx, long long cy) const;
+  void Link(int slot, int bucket);
+  void Unlink(int slot);
+
+  ///* makes room for slot, growing the table to twice the slots
+  void Reserve(int slot);
+};
+
+#endif /* SPATIAL_GRID_H_ */
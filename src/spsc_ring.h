@@ -0,0 +1,82 @@
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include "cache_aligned.h"
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Lock-free ring of a fixed number of items from one producer thread to one
+ * consumer thread. Each side owns one index, on a cache line of its own,
+ * and keeps a copy of the other's that it only reloads when the ring looks
+ * full or empty, so that a push or pop rarely touches the other side's line.
+ */
+template <class T>
+class alignas(kCacheLineSize) SpscRing {
+public:
+  ///* capacity is rounded up to a power of two
+  explicit SpscRing(size_t capacity)
+    : head_(0), cached_tail_(0), tail_(0), cached_head_(0) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    items_.resize(size);
+    mask_ = size - 1;
+  }
+
+  ///* producer: false if the ring is full
+  bool TryPush(const T &item) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - cached_tail_ > mask_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head - cached_tail_ > mask_) {
+        return false;
+      }
+    }
+    items_[head & mask_] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  ///* consumer: false if the ring is empty
+  bool TryPop(T *item) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == cached_head_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail == cached_head_) {
+        return false;
+      }
+    }
+    *item = items_[tail & mask_];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  ///* consumer: whether there is nothing to pop
+  bool empty() const {
+    return tail_.load(std::memory_order_relaxed) == head_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  CACHE_ALIGNED_OPERATOR_NEW
+
+private:
+  std::vector<T> items_;
+  size_t mask_;
+
+  ///* next item to push, and the producer's copy of tail_
+  alignas(kCacheLineSize) std::atomic<size_t> head_;
+  size_t cached_tail_;
+
+  ///* next item to pop, and the consumer's copy of head_
+  alignas(kCacheLineSize) std::atomic<size_t> tail_;
+  size_t cached_head_;
+
+  SpscRing(const SpscRing &);
+  SpscRing &operator=(const SpscRing &);
+};
+
+#endif /* SPSC_RING_H_ */
@@ -0,0 +1,127 @@
+#include "task_pool.h"
+#include "latency.h"
+
+TaskPool::TaskPool(int threads)
+	: threads_(threads < 1 ? 1 : threads), chunks_(new Chunks[threads_]), body_(nullptr), context_(nullptr),
+	  count_(0), chunk_(1), generation_(0), stop_(false), busy_(0) {
+	for (int i = 0; i < threads_; i++) {
+		chunks_[i].range.store(0, std::memory_order_relaxed);
+	}
+	for (int i = 1; i < threads_; i++) {
+		workers_.push_back(std::thread(&TaskPool::Serve, this, i));
+	}
+}
+
+TaskPool::~TaskPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+	for (size_t i = 0; i < workers_.size(); i++) {
+		workers_[i].join();
+	}
+}
+
+void TaskPool::Run(size_t count, size_t chunk, Body body, const void *context) {
+	if (!count) {
+		return;
+	}
+	chunk = chunk ? chunk : 1;
+	const uint64_t chunks = (count + chunk - 1) / chunk;
+	if (threads_ == 1 || chunks == 1) {
+		body(context, 0, count);
+		return;
+	}
+
+	//every thread gets an even share of the chunks, in order
+	body_ = body;
+	context_ = context;
+	count_ = count;
+	chunk_ = chunk;
+	for (int i = 0; i < threads_; i++) {
+		const uint64_t begin = chunks * i / threads_;
+		const uint64_t end = chunks * (i + 1) / threads_;
+		chunks_[i].range.store(begin | end << 32, std::memory_order_relaxed);
+	}
+	busy_.store(threads_ - 1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		generation_++;
+	}
+	wake_.notify_all();
+
+	Work(0);
+	//a thread still busy may be running a chunk it took last
+	while (busy_.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
+	}
+}
+
+void TaskPool::Serve(int index) {
+	// registers the thread's latency histograms before any filter runs here
+	LatencyStats::Local();
+
+	unsigned long seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+			if (stop_) {
+				return;
+			}
+			seen = generation_;
+		}
+		Work(index);
+		busy_.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+void TaskPool::Work(int index) {
+	uint32_t chunk;
+	for (;;) {
+		bool found = TakeFront(chunks_[index], &chunk);
+		//no chunks are added during a loop: once every run is empty at one
+		//look, there is nothing left to take
+		for (int k = 1; k < threads_ && !found; k++) {
+			found = TakeBack(chunks_[(index + k) % threads_], &chunk);
+		}
+		if (!found) {
+			return;
+		}
+		const size_t begin = size_t(chunk) * chunk_;
+		const size_t end = begin + chunk_ < count_ ? begin + chunk_ : count_;
+		body_(context_, begin, end);
+	}
+}
+
+bool TaskPool::TakeFront(Chunks &chunks, uint32_t *chunk) {
+	uint64_t range = chunks.range.load(std::memory_order_relaxed);
+	for (;;) {
+		const uint32_t next = uint32_t(range);
+		const uint32_t end = uint32_t(range >> 32);
+		if (next >= end) {
+			return false;
+		}
+		if (chunks.range.compare_exchange_weak(range, range + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+			*chunk = next;
+			return true;
+		}
+	}
+}
+
+bool TaskPool::TakeBack(Chunks &chunks, uint32_t *chunk) {
+	uint64_t range = chunks.range.load(std::memory_order_relaxed);
+	for (;;) {
+		const uint32_t next = uint32_t(range);
+		const uint32_t end = uint32_t(range >> 32);
+		if (next >= end) {
+			return false;
+		}
+		const uint64_t stolen = uint64_t(next) | uint64_t(end - 1) << 32;
+		if (chunks.range.compare_exchange_weak(range, stolen, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+			*chunk = end - 1;
+			return true;
+		}
+	}
+}
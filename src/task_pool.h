@@ -0,0 +1,96 @@
+#ifndef TASK_POOL_H_
+#define TASK_POOL_H_
+
+#include "cache_aligned.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Work-stealing pool for loops over independent items, such as the tracks
+ * of a scan. ParallelFor cuts the items into chunks and deals every thread
+ * a contiguous run of them; a thread works through its run from the front,
+ * and once it is done steals chunks from the back of the others' runs, so
+ * that threads whose items cost more (tracks with more detections, radar
+ * rather than lidar) are helped by those that finish early. The calling
+ * thread works along and ParallelFor returns once every chunk is done.
+ *
+ * A run is one atomic word holding its next and end chunk, which the owner
+ * advances and thieves pull back with compare-and-swap, so taking a chunk
+ * never locks. The pool's threads sleep between loops.
+ */
+class TaskPool {
+public:
+  ///* threads working on a loop, the caller included
+  explicit TaskPool(int threads);
+
+  ///* stops the threads; no loop may be running
+  ~TaskPool();
+
+  int threads() const { return threads_; }
+
+  /**
+   * Calls body(begin, end) for consecutive ranges of [0, count) of up to
+   * chunk items, on all threads, and returns once all have returned. Calls
+   * for different ranges may run at the same time.
+   */
+  template <class F>
+  void ParallelFor(size_t count, size_t chunk, const F &body) {
+    Run(count, chunk, &Invoke<F>, &body);
+  }
+
+private:
+  typedef void (*Body)(const void *body, size_t begin, size_t end);
+
+  ///* a thread's chunks, next in the low and end in the high 32 bits, on
+  ///* a cache line of its own
+  struct alignas(kCacheLineSize) Chunks {
+    std::atomic<uint64_t> range;
+
+    CACHE_ALIGNED_OPERATOR_NEW
+  };
+
+  int threads_;
+  std::unique_ptr<Chunks[]> chunks_;
+  std::vector<std::thread> workers_;
+
+  ///* the current loop
+  Body body_;
+  const void *context_;
+  size_t count_;
+  size_t chunk_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  unsigned long generation_;
+  bool stop_;
+  ///* pool threads not yet done with the current loop
+  std::atomic<int> busy_;
+
+  template <class F>
+  static void Invoke(const void *body, size_t begin, size_t end) {
+    (*static_cast<const F *>(body))(begin, end);
+  }
+
+  void Run(size_t count, size_t chunk, Body body, const void *context);
+
+  ///* runs chunks of the current loop as thread index until none is left
+  void Work(int index);
+
+  ///* takes the next chunk of a thread's own, or steals the last one
+  static bool TakeFront(Chunks &chunks, uint32_t *chunk);
+  static bool TakeBack(Chunks &chunks, uint32_t *chunk);
+
+  ///* a pool thread: waits for a loop, works on it, and again
+  void Serve(int index);
+
+  TaskPool(const TaskPool &);
+  TaskPool &operator=(const TaskPool &);
+};
+
+#endif /* TASK_POOL_H_ */
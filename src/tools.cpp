@@ -1,4 +1,8 @@
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
 #include "tools.h"
 
 using Eigen::VectorXd;
@@ -27,13 +31,9 @@ VectorXd Tools::CalculateRMSE(const vector<VectorXd> &estimations,
 	}
 
 	//accumulate squared residuals
+	//as one expression, without a temporary residual per element
 	for (unsigned int i = 0; i < estimations.size(); ++i) {
-
-		VectorXd residual = estimations[i] - ground_truth[i];
-
-		//coefficient-wise multiplication
-		residual = residual.array()*residual.array();
-		rmse += residual;
+		rmse += (estimations[i] - ground_truth[i]).array().square().matrix();
 	}
 
 	//calculate the mean
@@ -44,4 +44,307 @@ VectorXd Tools::CalculateRMSE(const vector<VectorXd> &estimations,
 
 	//return the result
 	return rmse;
-}
\ No newline at end of file
+}
+
+namespace {
+
+///* samples below which a slice is not worth a thread of its own
+const size_t kMinSlice = 1 << 14;
+
+///* sums over a slice of samples, by CalculateErrorStats' threads
+struct ErrorSums {
+	Eigen::Vector4d squares;
+	Eigen::Vector4d absolutes;
+	Eigen::Vector4d max;
+};
+
+/**
+* Sums the samples [begin, end) and stores their absolute errors in the
+* columns of errors, component c at errors[c * count + i].
+*/
+void SumErrors(const double *estimations, const double *ground_truth, size_t begin, size_t end,
+               size_t count, double *errors, ErrorSums *sums) {
+	Eigen::Vector4d squares = Eigen::Vector4d::Zero();
+	Eigen::Vector4d absolutes = Eigen::Vector4d::Zero();
+	Eigen::Vector4d max = Eigen::Vector4d::Zero();
+	for (size_t i = begin; i < end; i++) {
+		const Eigen::Array4d residual = Eigen::Map<const Eigen::Array4d>(estimations + 4 * i)
+		                              - Eigen::Map<const Eigen::Array4d>(ground_truth + 4 * i);
+		const Eigen::Array4d absolute = residual.abs();
+		squares += residual.square().matrix();
+		absolutes += absolute.matrix();
+		max = max.cwiseMax(absolute.matrix());
+		for (int c = 0; c < 4; c++) {
+			errors[c * count + i] = absolute(c);
+		}
+	}
+	sums->squares = squares;
+	sums->absolutes = absolutes;
+	sums->max = max;
+}
+
+///* index of the nearest rank of percentile p among count sorted samples
+size_t Rank(double p, size_t count) {
+	const size_t rank = size_t(ceil(p * count));
+	return rank ? rank - 1 : 0;
+}
+
+}
+
+ErrorStats CalculateErrorStats(const double *estimations, const double *ground_truth,
+                               size_t count, int threads) {
+	ErrorStats stats;
+	stats.count = count;
+	stats.rmse = stats.mae = stats.max = Eigen::Vector4d::Zero();
+	stats.p50 = stats.p95 = stats.p99 = Eigen::Vector4d::Zero();
+	if (count == 0) {
+		return stats;
+	}
+
+	size_t slices = threads > 1 ? size_t(threads) : 1;
+	slices = std::min(slices, (count + kMinSlice - 1) / kMinSlice);
+	std::vector<double> errors(4 * count);
+	std::vector<ErrorSums, Eigen::aligned_allocator<ErrorSums> > sums(slices);
+	std::vector<std::thread> pool;
+	for (size_t s = 1; s < slices; s++) {
+		pool.emplace_back(SumErrors, estimations, ground_truth, s * count / slices, (s + 1) * count / slices,
+		                  count, &errors[0], &sums[s]);
+	}
+	SumErrors(estimations, ground_truth, 0, count / slices, count, &errors[0], &sums[0]);
+	for (std::thread &thread : pool) {
+		thread.join();
+	}
+	pool.clear();
+
+	for (size_t s = 0; s < slices; s++) {
+		stats.rmse += sums[s].squares;
+		stats.mae += sums[s].absolutes;
+		stats.max = stats.max.cwiseMax(sums[s].max);
+	}
+	stats.rmse = (stats.rmse / double(count)).array().sqrt();
+	stats.mae /= double(count);
+
+	//each percentile is selected among the errors above the one before,
+	//which nth_element left behind it
+	const size_t r50 = Rank(0.50, count);
+	const size_t r95 = Rank(0.95, count);
+	const size_t r99 = Rank(0.99, count);
+	auto select = [&](int c) {
+		double *column = &errors[c * count];
+		double *end = column + count;
+		std::nth_element(column, column + r50, end);
+		stats.p50(c) = column[r50];
+		std::nth_element(column + r50, column + r95, end);
+		stats.p95(c) = column[r95];
+		std::nth_element(column + r95, column + r99, end);
+		stats.p99(c) = column[r99];
+	};
+	for (int c = 1; c < 4; c++) {
+		if (c < threads) {
+			pool.emplace_back(select, c);
+		}
+		else {
+			select(c);
+		}
+	}
+	select(0);
+	for (std::thread &thread : pool) {
+		thread.join();
+	}
+	return stats;
+}
+
+RunningRMSE::RunningRMSE() {
+	Reset();
+}
+
+void RunningRMSE::Add(const Eigen::Vector4d &estimation,
+                      const Eigen::Vector4d &ground_truth) {
+	sum_squares_ += (estimation - ground_truth).array().square().matrix();
+	count_++;
+}
+
+Eigen::Vector4d RunningRMSE::RMSE() const {
+	if (count_ == 0) {
+		return Eigen::Vector4d::Zero();
+	}
+	return (sum_squares_ / count_).array().sqrt();
+}
+
+void RunningRMSE::Reset() {
+	sum_squares_.fill(0.0);
+	count_ = 0;
+}
+
+void RunningRMSE::Restore(const Eigen::Vector4d &rmse, size_t count) {
+	sum_squares_ = rmse.array().square().matrix() * double(count);
+	count_ = count;
+}
+
+WindowedRMSE::WindowedRMSE(size_t window)
+	: squares_(4 * (window > 0 ? window : 1), 0.0), next_(0), count_(0) {
+	sum_squares_.fill(0.0);
+}
+
+void WindowedRMSE::Add(const Eigen::Vector4d &estimation,
+                       const Eigen::Vector4d &ground_truth) {
+	const size_t window = squares_.size() / 4;
+	Eigen::Map<Eigen::Vector4d> slot(&squares_[4 * next_]);
+	if (count_ == window) {
+		sum_squares_ -= slot;
+	}
+	else {
+		count_++;
+	}
+	slot = (estimation - ground_truth).array().square().matrix();
+	sum_squares_ += slot;
+
+	next_++;
+	if (next_ == window) {
+		next_ = 0;
+		//resum once per lap so the subtractions cannot accumulate drift
+		sum_squares_.fill(0.0);
+		for (size_t i = 0; i < count_; i++) {
+			sum_squares_ += Eigen::Map<const Eigen::Vector4d>(&squares_[4 * i]);
+		}
+	}
+}
+
+Eigen::Vector4d WindowedRMSE::RMSE() const {
+	if (count_ == 0) {
+		return Eigen::Vector4d::Zero();
+	}
+	return (sum_squares_ / count_).array().max(0.0).sqrt();
+}
+
+DecayingRMSE::DecayingRMSE(double alpha) : alpha_(alpha), empty_(true) {
+	mean_squares_.fill(0.0);
+}
+
+void DecayingRMSE::Add(const Eigen::Vector4d &estimation,
+                       const Eigen::Vector4d &ground_truth) {
+	const Eigen::Vector4d squares = (estimation - ground_truth).array().square().matrix();
+	if (empty_) {
+		mean_squares_ = squares;
+		empty_ = false;
+	}
+	else {
+		mean_squares_ += alpha_ * (squares - mean_squares_);
+	}
+}
+
+Eigen::Vector4d DecayingRMSE::RMSE() const {
+	return mean_squares_.array().sqrt();
+}
+
+NISMonitor::NISMonitor(double lower, double upper, size_t window, double alpha)
+	: lower_(lower), upper_(upper), alpha_(alpha),
+	  window_(window > 0 ? window : 1, 0.0), next_(0), window_count_(0),
+	  window_inside_(0), window_sum_(0.0), decaying_fraction_(0.0),
+	  decaying_mean_(0.0), total_count_(0), total_inside_(0) {}
+
+void NISMonitor::Reset() {
+	next_ = 0;
+	window_count_ = 0;
+	window_inside_ = 0;
+	window_sum_ = 0.0;
+	decaying_fraction_ = 0.0;
+	decaying_mean_ = 0.0;
+	total_count_ = 0;
+	total_inside_ = 0;
+}
+
+NISMonitor NISMonitor::Radar(size_t window, double alpha) {
+	return NISMonitor(0.352, 7.815, window, alpha);
+}
+
+NISMonitor NISMonitor::Laser(size_t window, double alpha) {
+	return NISMonitor(0.103, 5.991, window, alpha);
+}
+
+bool NISMonitor::Add(double nis) {
+	const bool inside = nis >= lower_ && nis <= upper_;
+
+	if (window_count_ == window_.size()) {
+		const double old = window_[next_];
+		window_sum_ -= old;
+		if (old >= lower_ && old <= upper_) {
+			window_inside_--;
+		}
+	}
+	else {
+		window_count_++;
+	}
+	window_[next_] = nis;
+	window_sum_ += nis;
+	if (inside) {
+		window_inside_++;
+	}
+	next_++;
+	if (next_ == window_.size()) {
+		next_ = 0;
+		//resum once per lap so the subtractions cannot accumulate drift
+		window_sum_ = 0.0;
+		for (size_t i = 0; i < window_count_; i++) {
+			window_sum_ += window_[i];
+		}
+	}
+
+	if (total_count_ == 0) {
+		decaying_fraction_ = inside ? 1.0 : 0.0;
+		decaying_mean_ = nis;
+	}
+	else {
+		decaying_fraction_ += alpha_ * ((inside ? 1.0 : 0.0) - decaying_fraction_);
+		decaying_mean_ += alpha_ * (nis - decaying_mean_);
+	}
+	total_count_++;
+	if (inside) {
+		total_inside_++;
+	}
+	return inside;
+}
+
+double NISMonitor::WindowFraction() const {
+	return window_count_ ? double(window_inside_) / window_count_ : 0.0;
+}
+
+double NISMonitor::WindowMean() const {
+	return window_count_ ? window_sum_ / window_count_ : 0.0;
+}
+
+double NISMonitor::TotalFraction() const {
+	return total_count_ ? double(total_inside_) / total_count_ : 0.0;
+}
+
+/**
+* Appends a with six decimals; falls back to printf for huge or non-finite
+* values.
+*/
+char *FormatFixed(char *p, double a) {
+	if (!(fabs(a) < 1e12)) {
+		return p + sprintf(p, "%.6e", a);
+	}
+	if (a < 0) {
+		*p++ = '-';
+		a = -a;
+	}
+	long long scaled = (long long)(a * 1e6 + 0.5);
+	long long integer = scaled / 1000000;
+	int fraction = (int)(scaled % 1000000);
+
+	char digits[20];
+	int n = 0;
+	do {
+		digits[n++] = char('0' + integer % 10);
+		integer /= 10;
+	} while (integer);
+	while (n) {
+		*p++ = digits[--n];
+	}
+	*p++ = '.';
+	for (int d = 100000; d; d /= 10) {
+		*p++ = char('0' + (fraction / d) % 10);
+	}
+	return p;
+}
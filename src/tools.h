@@ -26,4 +26,185 @@ public:
 
 };
 
+/**
+* The [p_x, p_y, v_x, v_y] estimate of a CTRV state [p_x p_y v yaw ...], as
+* the RMSE and the clients take it, with one sine and cosine of the yaw.
+*/
+inline Eigen::Vector4d CartesianEstimate(const double *x) {
+  const double c = cos(x[3]);
+  const double s = sin(x[3]);
+  return Eigen::Vector4d(x[0], x[1], c * x[2], s * x[2]);
+}
+
+/**
+* Errors of [p_x, p_y, v_x, v_y] estimates against their ground truth, per
+* component; the percentiles are of the absolute error, by nearest rank.
+*/
+struct ErrorStats {
+  size_t count;
+  Eigen::Vector4d rmse;
+  Eigen::Vector4d mae;
+  Eigen::Vector4d max;
+  Eigen::Vector4d p50;
+  Eigen::Vector4d p95;
+  Eigen::Vector4d p99;
+};
+
+/**
+* ErrorStats of count samples in contiguous arrays, sample i at
+* estimations[4 * i .. 4 * i + 3] and ground_truth[4 * i .. 4 * i + 3], as
+* an array of Eigen::Vector4d lays them out. For large offline evaluations:
+* up to threads threads each reduce a contiguous slice in one pass, which
+* also stores its absolute errors for the percentiles, then the components'
+* percentiles are selected in parallel. All zero if count is 0.
+*/
+ErrorStats CalculateErrorStats(const double *estimations, const double *ground_truth,
+                               size_t count, int threads = 1);
+
+/**
+* Cumulative RMSE of [p_x, p_y, v_x, v_y] estimates, updated one sample at a
+* time. Keeps only the running sums of squared residuals, so Add and RMSE
+* take constant time and memory; RMSE() equals Tools::CalculateRMSE over all
+* samples added so far.
+*/
+class RunningRMSE {
+public:
+  RunningRMSE();
+
+  /**
+  * Adds the residual of one estimate against its ground truth.
+  */
+  void Add(const Eigen::Vector4d &estimation, const Eigen::Vector4d &ground_truth);
+
+  /**
+  * RMSE over all samples added since construction or Reset, zero if none.
+  */
+  Eigen::Vector4d RMSE() const;
+
+  /**
+  * Number of samples added.
+  */
+  size_t count() const { return count_; }
+
+  void Reset();
+
+  /**
+  * Continues from an RMSE over count samples, as a restarted process does
+  * from a checkpoint.
+  */
+  void Restore(const Eigen::Vector4d &rmse, size_t count);
+
+private:
+  Eigen::Vector4d sum_squares_;
+  size_t count_;
+};
+
+/**
+* RMSE over the last window samples, kept in a ring buffer of squared
+* residuals allocated once at construction.
+*/
+class WindowedRMSE {
+public:
+  explicit WindowedRMSE(size_t window);
+
+  void Add(const Eigen::Vector4d &estimation, const Eigen::Vector4d &ground_truth);
+
+  /**
+  * RMSE over the samples in the window, zero if none.
+  */
+  Eigen::Vector4d RMSE() const;
+
+  /**
+  * Number of samples currently in the window.
+  */
+  size_t count() const { return count_; }
+
+private:
+  ///* squared residuals, sample i at squares_[4 * i .. 4 * i + 3]
+  std::vector<double> squares_;
+  Eigen::Vector4d sum_squares_;
+  size_t next_;
+  size_t count_;
+};
+
+/**
+* Exponentially weighted RMSE: every sample is blended into the mean square
+* residual with weight alpha, so older samples decay by (1 - alpha) per step.
+*/
+class DecayingRMSE {
+public:
+  explicit DecayingRMSE(double alpha);
+
+  void Add(const Eigen::Vector4d &estimation, const Eigen::Vector4d &ground_truth);
+
+  Eigen::Vector4d RMSE() const;
+
+private:
+  double alpha_;
+  Eigen::Vector4d mean_squares_;
+  bool empty_;
+};
+
+/**
+* Consistency statistics of a stream of NIS values: the fraction within the
+* chi-square bounds [lower, upper] and the mean, each over the last window
+* values, exponentially weighted with alpha, and over the whole stream.
+* Memory is fixed at construction.
+*/
+class NISMonitor {
+public:
+  NISMonitor(double lower, double upper, size_t window, double alpha);
+
+  /**
+  * Bounds of the central 95% of chi-square with 3 degrees of freedom, the
+  * 0.35 - 7.81 criterion for radar.
+  */
+  static NISMonitor Radar(size_t window, double alpha);
+
+  /**
+  * The same for the 2 degrees of freedom of a laser measurement.
+  */
+  static NISMonitor Laser(size_t window, double alpha);
+
+  ///* adds nis, returning whether it is within the bounds
+  bool Add(double nis);
+
+  double WindowFraction() const;
+  double WindowMean() const;
+  double DecayingFraction() const { return decaying_fraction_; }
+  double DecayingMean() const { return decaying_mean_; }
+  double TotalFraction() const;
+
+  ///* number of values in the window and in total
+  size_t window_count() const { return window_count_; }
+  size_t count() const { return total_count_; }
+
+  ///* forgets all values, keeping the bounds, window and alpha
+  void Reset();
+
+private:
+  double lower_;
+  double upper_;
+  double alpha_;
+
+  std::vector<double> window_;
+  size_t next_;
+  size_t window_count_;
+  size_t window_inside_;
+  double window_sum_;
+
+  double decaying_fraction_;
+  double decaying_mean_;
+
+  size_t total_count_;
+  size_t total_inside_;
+};
+
+/**
+* Appends a to p with six decimals, faster than printf's %f, and returns the
+* end; huge or non-finite values are printed with %e. Writes at most 32
+* characters.
+*/
+char *FormatFixed(char *p, double a);
+
 #endif /* TOOLS_H_ */
\ No newline at end of file
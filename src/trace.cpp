@@ -0,0 +1,44 @@
+#include "trace.h"
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+const int TraceBuffer::kCapacity;
+
+TraceBuffer::TraceBuffer() : written_(0) {
+	for (int i = 0; i < kCapacity; i++) {
+		spans_[i].begin.store(0, std::memory_order_relaxed);
+		spans_[i].end.store(0, std::memory_order_relaxed);
+		spans_[i].tag.store(0, std::memory_order_relaxed);
+	}
+}
+
+void TraceBuffer::Events(int tid, const char *const *names, std::string *events) const {
+	struct Copy {
+		uint64_t begin, end, tag;
+	};
+	const uint64_t written = written_.load(std::memory_order_acquire);
+	const uint64_t first = written > (uint64_t) kCapacity ? written - kCapacity : 0;
+	std::vector<Copy> copies;
+	copies.reserve(written - first);
+	for (uint64_t i = first; i < written; i++) {
+		const Span &span = spans_[i % kCapacity];
+		Copy copy = {span.begin.load(std::memory_order_relaxed), span.end.load(std::memory_order_relaxed),
+		             span.tag.load(std::memory_order_relaxed)};
+		copies.push_back(copy);
+	}
+	// the spans the thread went on to overwrite meanwhile are torn
+	std::atomic_thread_fence(std::memory_order_acquire);
+	const uint64_t now_written = written_.load(std::memory_order_relaxed);
+	const uint64_t valid = now_written > (uint64_t) kCapacity ? now_written - kCapacity : 0;
+
+	char event[256];
+	for (uint64_t i = std::max(first, valid); i < written; i++) {
+		const Copy &copy = copies[i - first];
+		snprintf(event, sizeof(event),
+		         "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"track\":%d}},",
+		         names[copy.tag & 0xff], copy.begin / 1000.0, (copy.end - copy.begin) / 1000.0, tid,
+		         (int) (uint32_t) (copy.tag >> 8));
+		*events += event;
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * The latest stages of the sampled messages of one thread, for the timeline
+ * of a latency outlier the histograms only count (see LatencyStats::Trace).
+ * A ring of kCapacity spans, the oldest overwritten first: written by its
+ * thread, read by any, without a lock. Every field is an atomic only
+ * updated with relaxed stores, and a reader drops the spans overwritten
+ * while it copied them.
+ */
+class TraceBuffer {
+public:
+  static const int kCapacity = 4096;
+
+  TraceBuffer();
+
+  ///* a stage of track from begin to end, on the clock of LatencyStats::Now
+  void Append(int stage, int track, uint64_t begin, uint64_t end) {
+    const uint64_t written = written_.load(std::memory_order_relaxed);
+    Span &span = spans_[written % kCapacity];
+    span.begin.store(begin, std::memory_order_relaxed);
+    span.end.store(end, std::memory_order_relaxed);
+    span.tag.store((uint64_t) (uint32_t) track << 8 | (uint64_t) stage, std::memory_order_relaxed);
+    written_.store(written + 1, std::memory_order_release);
+  }
+
+  /**
+   * Appends the spans held as complete events ("ph":"X") of the Chrome
+   * trace event format, each followed by a comma, named by names[stage],
+   * in thread tid and with the track in their args.
+   */
+  void Events(int tid, const char *const *names, std::string *events) const;
+
+private:
+  struct Span {
+    std::atomic<uint64_t> begin;
+    std::atomic<uint64_t> end;
+    ///* the track above the stage's 8 bits
+    std::atomic<uint64_t> tag;
+  };
+
+  Span spans_[kCapacity];
+  std::atomic<uint64_t> written_;
+
+  TraceBuffer(const TraceBuffer &);
+  TraceBuffer &operator=(const TraceBuffer &);
+};
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,110 @@
+#include "track_history.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+TrackHistory::TrackHistory(size_t bytes, long long interval_us)
+	: segments_(std::max<size_t>(2, (bytes + kSegmentSize - 1) / kSegmentSize)), interval_us_(interval_us),
+	  last_us_(LLONG_MIN), head_(0) {
+	ring_.reset(new Segment[segments_]);
+	for (size_t s = 0; s < segments_; s++) {
+		ring_[s].sequence.store(0, std::memory_order_relaxed);
+		for (int i = 0; i < kWords; i++) {
+			ring_[s].words[i].store(0, std::memory_order_relaxed);
+		}
+	}
+	Begin(0);
+}
+
+void TrackHistory::Begin(uint64_t generation) {
+	memset(current_, 0, sizeof(current_));
+	current_[0] = generation;
+	delta_.Reset();
+	Store(kHeaderWords, kHeaderWords);
+	head_.store(generation, std::memory_order_release);
+}
+
+void TrackHistory::Store(int from, int to) {
+	Segment &segment = ring_[current_[0] % segments_];
+	unsigned sequence = segment.sequence.load(std::memory_order_relaxed);
+	segment.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (int i = 0; i < kHeaderWords; i++) {
+		segment.words[i].store(current_[i], std::memory_order_relaxed);
+	}
+	for (int i = from; i < to; i++) {
+		segment.words[i].store(current_[i], std::memory_order_relaxed);
+	}
+	segment.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void TrackHistory::Append(long long timestamp, const double *x, const double *P_diagonal) {
+	// an earlier timestamp, of a track started again, is kept
+	if (interval_us_ && timestamp >= last_us_ && timestamp < last_us_ + interval_us_) {
+		return;
+	}
+	last_us_ = timestamp;
+	size_t used = current_[3] >> 32;
+	if (used + record::kMaxCompactStateSize > kDataSize) {
+		Begin(current_[0] + 1);
+		used = 0;
+	}
+	double values[record::kStateValues];
+	std::copy(x, x + 5, values);
+	std::copy(P_diagonal, P_diagonal + 5, values + 5);
+	char *data = reinterpret_cast<char *>(current_ + kHeaderWords);
+	const size_t end = record::EncodeCompactState(data + used, &delta_, timestamp, values) - data;
+
+	const uint64_t count = (current_[3] & 0xffffffff) + 1;
+	if (count == 1) {
+		current_[1] = uint64_t(timestamp);
+	}
+	current_[2] = uint64_t(timestamp);
+	current_[3] = count | uint64_t(end) << 32;
+	Store(kHeaderWords + int(used / 8), kHeaderWords + int((end + 7) / 8));
+}
+
+void TrackHistory::Clear() {
+	// past every generation in the ring, so readers skip them all
+	Begin(current_[0] + segments_);
+	last_us_ = LLONG_MIN;
+}
+
+void TrackHistory::Read(long long from_us, long long to_us, std::vector<Estimate> *estimates) const {
+	const uint64_t head = head_.load(std::memory_order_acquire);
+	const uint64_t oldest = head >= segments_ - 1 ? head - (segments_ - 1) : 0;
+	uint64_t words[kWords];
+	for (uint64_t generation = oldest; generation <= head; generation++) {
+		const Segment &segment = ring_[generation % segments_];
+		for (;;) {
+			unsigned sequence = segment.sequence.load(std::memory_order_acquire);
+			if (sequence & 1) {
+				continue;
+			}
+			for (int i = 0; i < kWords; i++) {
+				words[i] = segment.words[i].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (segment.sequence.load(std::memory_order_relaxed) == sequence) {
+				break;
+			}
+		}
+		// reused by a later generation, or not yet written or cleared
+		if (words[0] != generation || !(words[3] & 0xffffffff)
+		    || (long long) words[2] < from_us || (long long) words[1] > to_us) {
+			continue;
+		}
+		const char *p = reinterpret_cast<const char *>(words + kHeaderWords);
+		const char *end = p + (words[3] >> 32);
+		record::StateDeltaState delta;
+		Estimate estimate;
+		double values[record::kStateValues];
+		while (p != end && (p = record::DecodeCompactState(p, end, &delta, &estimate.timestamp, values))) {
+			if (estimate.timestamp >= from_us && estimate.timestamp <= to_us) {
+				std::copy(values, values + 5, estimate.x);
+				std::copy(values + 5, values + 10, estimate.P_diagonal);
+				estimates->push_back(estimate);
+			}
+		}
+	}
+}
@@ -0,0 +1,100 @@
+#ifndef TRACK_HISTORY_H_
+#define TRACK_HISTORY_H_
+
+#include "measurement_record.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * The recent estimates of one track, for queries of a span of time such as
+ * its last 30 s: the timestamp, state and covariance diagonal of each, as
+ * compact state records (see measurement_record.h) in a ring of fixed-size
+ * segments. The records of a segment are differences from its first, so
+ * every segment decodes on its own, and when the ring is full the oldest
+ * segment goes whole. Memory is fixed at construction and appending does
+ * not allocate.
+ *
+ * The track's session appends and any thread reads without locking it out:
+ * each segment is a sequence lock over relaxed atomic words, as the
+ * buffers of TrackState are, and a reader copies a segment again if it was
+ * written meanwhile and skips it if it was reused.
+ *
+ * With an interval only the first estimate of every interval is kept, so
+ * that the same memory covers a span that many times longer: days of a
+ * long-running session at one estimate a second rather than minutes at
+ * the sensors' rate.
+ */
+class TrackHistory {
+public:
+  ///* bytes of a segment, its header included
+  static const size_t kSegmentSize = 512;
+
+  struct Estimate {
+    long long timestamp;
+    ///* CTRV state [p_x p_y v yaw yaw_rate] and its covariance's diagonal
+    double x[5];
+    double P_diagonal[5];
+  };
+
+  /**
+   * @param bytes Bytes of estimates to keep at least, in whole segments,
+   * two or more
+   * @param interval_us Least time between the estimates kept, 0 for all
+   */
+  explicit TrackHistory(size_t bytes, long long interval_us = 0);
+
+  ///* from the owning session's thread only; skipped within the interval
+  ///* of the last estimate kept
+  void Append(long long timestamp, const double *x, const double *P_diagonal);
+
+  ///* forgets the estimates, for another track; from the owner only
+  void Clear();
+
+  /**
+   * Appends the kept estimates with timestamps from from_us to to_us, both
+   * included, to estimates, oldest first.
+   */
+  void Read(long long from_us, long long to_us, std::vector<Estimate> *estimates) const;
+
+  ///* bytes of its segments
+  size_t memory() const { return segments_ * sizeof(Segment); }
+
+private:
+  static const int kWords = kSegmentSize / 8;
+  ///* header words: generation, first and last timestamp, count and bytes
+  static const int kHeaderWords = 4;
+  static const size_t kDataSize = (kWords - kHeaderWords) * 8;
+
+  struct Segment {
+    ///* odd while the segment is written
+    std::atomic<unsigned> sequence;
+    std::atomic<uint64_t> words[kWords];
+  };
+
+  std::unique_ptr<Segment[]> ring_;
+  size_t segments_;
+  long long interval_us_;
+  ///* the owner's: timestamp of the last estimate kept
+  long long last_us_;
+  ///* generation of the segment appended to; segment g is ring_[g % segments_]
+  std::atomic<uint64_t> head_;
+
+  ///* the owner's copy of the segment appended to, and the state its
+  ///* records are differences from
+  uint64_t current_[kWords];
+  record::StateDeltaState delta_;
+
+  ///* starts the segment of generation, empty
+  void Begin(uint64_t generation);
+
+  ///* stores current_ words [from, to) and the header into the ring
+  void Store(int from, int to);
+
+  TrackHistory(const TrackHistory &);
+  TrackHistory &operator=(const TrackHistory &);
+};
+
+#endif /* TRACK_HISTORY_H_ */
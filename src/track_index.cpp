@@ -0,0 +1,87 @@
+#include "track_index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+
+const double TrackIndex::kCellSize = 50.0;
+
+namespace {
+
+struct SharedIndex {
+  std::mutex mutex;
+  SpatialGrid grid;
+  ///* the state in each slot of the grid
+  std::vector<TrackState *> states;
+
+  SharedIndex() : grid(TrackIndex::kCellSize) {}
+};
+
+SharedIndex &Shared() {
+	static SharedIndex index;
+	return index;
+}
+
+}
+
+void TrackIndex::Place(TrackState *state, double x, double y, Entry *entry) {
+	if (!std::isfinite(x) || !std::isfinite(y)) {
+		Remove(state, entry);
+		return;
+	}
+	const long long cx = (long long) floor(x / kCellSize);
+	const long long cy = (long long) floor(y / kCellSize);
+	if (entry->placed && entry->cx == cx && entry->cy == cy) {
+		return;
+	}
+	SharedIndex &index = Shared();
+	std::lock_guard<std::mutex> lock(index.mutex);
+	const size_t slot = state->slot();
+	if (index.states.size() <= slot) {
+		index.states.resize(slot + 1, nullptr);
+	}
+	index.states[slot] = state;
+	index.grid.Update(int(slot), x, y);
+	entry->cx = cx;
+	entry->cy = cy;
+	entry->placed = true;
+}
+
+void TrackIndex::Remove(TrackState *state, Entry *entry) {
+	if (!entry->placed) {
+		return;
+	}
+	SharedIndex &index = Shared();
+	std::lock_guard<std::mutex> lock(index.mutex);
+	index.grid.Remove(state->slot());
+	entry->placed = false;
+}
+
+void TrackIndex::Query(const double *box, std::vector<TrackState *> *states) {
+	// the square around the box's centre that covers it
+	const double x = 0.5 * (box[0] + box[2]);
+	const double y = 0.5 * (box[1] + box[3]);
+	const double radius = 0.5 * std::max(box[2] - box[0], box[3] - box[1]);
+	std::vector<int> slots;
+	SharedIndex &index = Shared();
+	std::lock_guard<std::mutex> lock(index.mutex);
+	index.grid.Query(x, y, radius, &slots);
+	for (size_t i = 0; i < slots.size(); i++) {
+		states->push_back(index.states[slots[i]]);
+	}
+}
+
+bool TrackIndex::ParseBox(const char *begin, const char *end, double *box) {
+	std::string text(begin, end);
+	const char *p = text.c_str();
+	for (int i = 0; i < 4; i++) {
+		char *number_end;
+		box[i] = strtod(p, &number_end);
+		if (number_end == p || !std::isfinite(box[i]) || *number_end != (i < 3 ? ',' : '\0')) {
+			return false;
+		}
+		p = number_end + 1;
+	}
+	return box[0] <= box[2] && box[1] <= box[3];
+}
@@ -0,0 +1,54 @@
+#ifndef TRACK_INDEX_H_
+#define TRACK_INDEX_H_
+
+#include "spatial_grid.h"
+#include "track_state.h"
+#include <vector>
+
+/**
+ * The positions of the live tracks of all sessions in a SpatialGrid, for
+ * the region queries of the HTTP API and of viewers (see Session) without
+ * reading every track. A session places its TrackState after every
+ * measurement, but only takes the index's lock when the track crosses into
+ * another cell, which at the speeds of road users is every few seconds at
+ * most; the TrackState's slot numbers it in the grid.
+ *
+ * A query yields the states of the cells a box overlaps, which the caller
+ * reads and filters by their exact positions, as the tracks keep moving.
+ */
+class TrackIndex {
+public:
+  ///* edge of a cell, in m, the size of a typical query's box
+  static const double kCellSize;
+
+  ///* the cell a session's track is in, so that moving within it takes no
+  ///* lock; placed is false while it is not in the index
+  struct Entry {
+    long long cx;
+    long long cy;
+    bool placed;
+
+    Entry() : cx(0), cy(0), placed(false) {}
+  };
+
+  ///* moves state to (x, y), or takes it out if that is not finite
+  static void Place(TrackState *state, double x, double y, Entry *entry);
+
+  ///* takes state out of the index, when its session is reset
+  static void Remove(TrackState *state, Entry *entry);
+
+  ///* appends the states of the cells that box, x0, y0, x1, y1, overlaps
+  static void Query(const double *box, std::vector<TrackState *> *states);
+
+  static bool Contains(const double *box, double x, double y) {
+    return box[0] <= x && x <= box[2] && box[1] <= y && y <= box[3];
+  }
+
+  /**
+   * Reads a box given as x0,y0,x1,y1 in m, as in /tracks?bbox=; false
+   * unless it is four numbers with x0 <= x1 and y0 <= y1.
+   */
+  static bool ParseBox(const char *begin, const char *end, double *box);
+};
+
+#endif /* TRACK_INDEX_H_ */
@@ -0,0 +1,146 @@
+#include "track_publisher.h"
+#include "json.hpp"
+#include "latency.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// for convenience
+using json = nlohmann::json;
+
+namespace {
+
+const char kFramePrefix[] = "42[\"tracks\",[";
+const char kDeltaPrefix[] = "42[\"tracks_delta\",[";
+const char kFrameSuffix[] = "]]";
+
+///* appends a track to the list of a frame being built
+void AppendTrack(std::string *frame, const char *prefix, const std::string &track) {
+	if (frame->empty()) {
+		*frame = prefix;
+	}
+	else {
+		*frame += ',';
+	}
+	*frame += track;
+}
+
+}
+
+const long long TrackPublisher::kMaxExtrapolation;
+
+TrackPublisher::TrackPublisher(uWS::Hub &h, SessionPool &pool, int interval_ms, double delta,
+                               int keyframe_rounds)
+	: hub_(&h), pool_(&pool), timer_(new uv_timer_t), rounds_(0), delta_(delta),
+	  keyframe_rounds_(std::max(keyframe_rounds, 1)), keyframes_(0), last_keyframe_(0), subscribe_count_(0) {
+	pool.set_fixed_rate(true);
+	uv_timer_init(h.getLoop(), timer_);
+	timer_->data = this;
+	uv_timer_start(timer_, [](uv_timer_t *timer) {
+		static_cast<TrackPublisher *>(timer->data)->Publish();
+	}, interval_ms, interval_ms);
+}
+
+TrackPublisher::~TrackPublisher() {
+	uv_timer_stop(timer_);
+	uv_close(timer_, [](uv_handle_t *handle) {
+		delete (uv_timer_t *) handle;
+	});
+}
+
+void TrackPublisher::Publish() {
+	rounds_++;
+	uWS::Group<uWS::SERVER> &group = *hub_;
+	if (!group.hasTopics()) {
+		return;
+	}
+	static const std::string all_tracks("tracks");
+	const bool to_all = group.hasSubscribers(all_tracks);
+
+	//without a delta every round is a keyframe
+	const bool keyframe = delta_ <= 0.0 || !keyframes_ || rounds_ - last_keyframe_ >= keyframe_rounds_
+		|| group.getSubscribeCount() != subscribe_count_;
+	const char *prefix = keyframe ? kFramePrefix : kDeltaPrefix;
+	if (keyframe) {
+		keyframes_++;
+		last_keyframe_ = rounds_;
+		subscribe_count_ = group.getSubscribeCount();
+		sent_.clear();
+	}
+
+	//the frames of the region topics are built up over all tracks; the
+	//buffers of the map stay for the next round, unless the tracks have
+	//left many regions behind
+	const std::vector<Session *> &sessions = pool_->live_sessions();
+	if (regions_.size() > 2 * sessions.size() + 64) {
+		regions_.clear();
+	}
+	all_.clear();
+	for (std::unordered_map<std::string, std::string>::iterator it = regions_.begin(); it != regions_.end(); ++it) {
+		it->second.clear();
+	}
+
+	const uint64_t now = LatencyStats::Now();
+	for (size_t i = 0; i < sessions.size(); i++) {
+		const Session &session = *sessions[i];
+		long long timestamp;
+		CTRVUKF::StateVector x;
+		if (!session.EstimateAt(now, kMaxExtrapolation, &timestamp, &x)) {
+			continue;
+		}
+		const int region_x = (int) floor(x(0) / Session::kRegionSize);
+		const int region_y = (int) floor(x(1) / Session::kRegionSize);
+		char region_topic[64];
+		snprintf(region_topic, sizeof(region_topic), "region/%d/%d", region_x, region_y);
+		std::string region(region_topic);
+		const bool to_track = group.hasSubscribers(session.track_topic());
+		const bool to_region = group.hasSubscribers(region);
+		if (!to_track && !to_region && !to_all) {
+			continue;
+		}
+		if (delta_ > 0.0) {
+			std::pair<std::unordered_map<int, Sent>::iterator, bool> known = sent_.insert(std::make_pair(session.id(), Sent()));
+			Sent &sent = known.first->second;
+			if (!keyframe && !known.second && std::hypot(x(0) - sent.x, x(1) - sent.y) < delta_ && std::fabs(x(2) - sent.v) < delta_
+			    && sent.region_x == region_x && sent.region_y == region_y) {
+				continue;
+			}
+			sent.x = x(0);
+			sent.y = x(1);
+			sent.v = x(2);
+			sent.region_x = region_x;
+			sent.region_y = region_y;
+		}
+
+		json msgJson;
+		msgJson["id"] = session.id();
+		msgJson["timestamp"] = timestamp;
+		msgJson["x"] = x(0);
+		msgJson["y"] = x(1);
+		msgJson["v"] = x(2);
+		msgJson["yaw"] = x(3);
+		msgJson["yaw_rate"] = x(4);
+		const std::string track = msgJson.dump();
+		if (to_track) {
+			track_ = prefix + track + kFrameSuffix;
+			group.publish(session.track_topic(), track_.data(), track_.length());
+		}
+		if (to_region) {
+			AppendTrack(&regions_[region], prefix, track);
+		}
+		if (to_all) {
+			AppendTrack(&all_, prefix, track);
+		}
+	}
+
+	for (std::unordered_map<std::string, std::string>::iterator it = regions_.begin(); it != regions_.end(); ++it) {
+		if (!it->second.empty()) {
+			it->second += kFrameSuffix;
+			group.publish(it->first, it->second.data(), it->second.length());
+		}
+	}
+	if (!all_.empty()) {
+		all_ += kFrameSuffix;
+		group.publish(all_tracks, all_.data(), all_.length());
+	}
+}
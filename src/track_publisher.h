@@ -0,0 +1,86 @@
+#ifndef TRACK_PUBLISHER_H_
+#define TRACK_PUBLISHER_H_
+
+#include <uWS/uWS.h>
+#include "session.h"
+#include <string>
+#include <unordered_map>
+
+/**
+ * Publishes the estimates of all sessions of one event loop to their
+ * viewers at a fixed rate rather than after every measurement, so that the
+ * messages viewers are sent no longer grow with the sensor rate. Every
+ * interval a timer on the loop extrapolates each track to the present (see
+ * Session::EstimateAt) and gives every subscribed topic one frame with all
+ * of its tracks,
+ *   42["tracks",[{"id":...,"timestamp":...,"x":...,...},...]]
+ * with the fields of the track events of Session, which outside of the
+ * publisher's sessions are not sent.
+ *
+ * With a delta, most rounds are delta frames instead,
+ *   42["tracks_delta",[{"id":...,...},...]]
+ * with only the tracks that moved or changed speed by at least delta (m,
+ * m/s), or changed region, since they were last sent; viewers update those
+ * and keep the rest. A topic without such tracks is not sent a frame. Every
+ * keyframe_rounds rounds, and the round after any connection subscribes, is
+ * a keyframe of all tracks as above, which replaces what viewers show and
+ * brings new subscribers up to date. The frames of a topic are shared by
+ * all its subscribers, so viewers are not acknowledged one by one.
+ *
+ * The publisher belongs to the loop's thread and must be created there,
+ * before its sessions connect.
+ */
+class TrackPublisher {
+public:
+  ///* longest a track is extrapolated past its last measurement, in us
+  static const long long kMaxExtrapolation = 1000000;
+
+  /**
+   * Starts publishing the sessions of pool on h every interval_ms; the
+   * sessions pool hands out from now on are published only here.
+   */
+  TrackPublisher(uWS::Hub &h, SessionPool &pool, int interval_ms, double delta = 0.0,
+                 int keyframe_rounds = 10);
+
+  ///* stops the timer
+  ~TrackPublisher();
+
+  ///* publishes all tracks once
+  void Publish();
+
+  ///* rounds published, and how many of them were keyframes
+  long long rounds() const { return rounds_; }
+  long long keyframes() const { return keyframes_; }
+
+private:
+  ///* a track as last sent
+  struct Sent {
+    double x;
+    double y;
+    double v;
+    int region_x;
+    int region_y;
+  };
+
+  uWS::Hub *hub_;
+  SessionPool *pool_;
+  uv_timer_t *timer_;
+  long long rounds_;
+  double delta_;
+  int keyframe_rounds_;
+  long long keyframes_;
+  long long last_keyframe_;
+  unsigned long long subscribe_count_;
+  ///* by track id, since the last keyframe
+  std::unordered_map<int, Sent> sent_;
+
+  ///* the tracks of a round, by topic; kept for the next round
+  std::string all_;
+  std::unordered_map<std::string, std::string> regions_;
+  std::string track_;
+
+  TrackPublisher(const TrackPublisher &);
+  TrackPublisher &operator=(const TrackPublisher &);
+};
+
+#endif /* TRACK_PUBLISHER_H_ */
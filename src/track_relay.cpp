@@ -0,0 +1,188 @@
+#include "track_relay.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <zlib.h>
+
+namespace {
+
+const size_t kFrameHeaderSize = 8;
+
+//little-endian, as measurement_record.h
+inline void StoreUint32(char *p, uint32_t a) {
+	memcpy(p, &a, sizeof(a));
+}
+
+inline uint32_t LoadUint32(const char *p) {
+	uint32_t a;
+	memcpy(&a, p, sizeof(a));
+	return a;
+}
+
+}
+
+const size_t TrackRelay::kUpdateSize;
+const size_t TrackRelay::kBatchSize;
+const int TrackRelay::kFlushInterval;
+const size_t TrackRelay::kMaxInFlight;
+const int TrackRelay::kMinBackoff;
+const int TrackRelay::kMaxBackoff;
+
+TrackRelay::TrackRelay(uWS::Hub &h, SessionPool &pool, const std::string &uri, int connections, size_t max_queued)
+	: hub_(&h), uri_(uri), max_queued_(max_queued), timer_(new uv_timer_t), next_link_(0), batch_count_(0),
+	  queued_bytes_(0), sent_(0), dropped_(0), connects_(0) {
+	batch_.reserve(kBatchSize + kUpdateSize);
+	pool.set_relay(this);
+
+	//a link whose relay is gone was left behind by the destructor, and goes
+	//with its connection
+	h.onConnection([](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+		Link *link = static_cast<Link *>(ws.getUserData());
+		if (!link->relay) {
+			ws.setUserData(nullptr);
+			delete link;
+			ws.close();
+			return;
+		}
+		link->ws = ws;
+		link->open = true;
+		link->connecting = false;
+		link->backoff_ms = kMinBackoff;
+		link->relay->connects_++;
+		link->relay->Drain();
+	});
+
+	h.onDisconnection([](uWS::WebSocket<uWS::CLIENT> ws, int code, char *message, size_t length) {
+		Link *link = static_cast<Link *>(ws.getUserData());
+		if (link) {
+			link->relay->Lost(link);
+		}
+	});
+
+	h.onError([](void *user) {
+		Link *link = static_cast<Link *>(user);
+		if (!link->relay) {
+			delete link;
+			return;
+		}
+		link->relay->Lost(link);
+	});
+
+	for (int i = 0; i < connections; i++) {
+		links_.push_back(new Link{this, i, uWS::WebSocket<uWS::CLIENT>(), false, false, kMinBackoff, 0});
+	}
+	Reconnect();
+
+	uv_timer_init(h.getLoop(), timer_);
+	timer_->data = this;
+	uv_timer_start(timer_, [](uv_timer_t *timer) {
+		TrackRelay *relay = static_cast<TrackRelay *>(timer->data);
+		relay->Flush();
+		relay->Reconnect();
+	}, kFlushInterval, kFlushInterval);
+}
+
+TrackRelay::~TrackRelay() {
+	uv_timer_stop(timer_);
+	uv_close(timer_, [](uv_handle_t *handle) {
+		delete (uv_timer_t *) handle;
+	});
+	for (Link *link : links_) {
+		if (link->connecting) {
+			link->relay = nullptr;
+			continue;
+		}
+		if (link->open) {
+			uWS::WebSocket<uWS::CLIENT> ws = link->ws;
+			ws.setUserData(nullptr);
+			ws.close();
+		}
+		delete link;
+	}
+}
+
+void TrackRelay::Append(const EstimateRecord &record) {
+	const size_t used = batch_.size();
+	batch_.resize(used + kUpdateSize);
+	char *p = &batch_[used];
+	memset(p, 0, kUpdateSize);
+	const int32_t id = record.id;
+	const int64_t timestamp = record.timestamp;
+	memcpy(p, &id, sizeof(id));
+	p[4] = record.sensor;
+	memcpy(p + 8, &timestamp, sizeof(timestamp));
+	memcpy(p + 16, record.x, sizeof(record.x));
+	memcpy(p + 56, &record.nis, sizeof(record.nis));
+	memcpy(p + 64, record.rmse, sizeof(record.rmse));
+	batch_count_++;
+	if (batch_.size() >= kBatchSize) {
+		Flush();
+	}
+}
+
+void TrackRelay::Flush() {
+	if (batch_count_) {
+		std::string frame(kFrameHeaderSize + compressBound(batch_.size()), '\0');
+		StoreUint32(&frame[0], uint32_t(batch_count_));
+		StoreUint32(&frame[4], uint32_t(batch_.size()));
+		uLongf compressed = frame.size() - kFrameHeaderSize;
+		compress2(reinterpret_cast<Bytef *>(&frame[kFrameHeaderSize]), &compressed,
+		          reinterpret_cast<const Bytef *>(batch_.data()), batch_.size(), Z_BEST_SPEED);
+		frame.resize(kFrameHeaderSize + compressed);
+		batch_.clear();
+		batch_count_ = 0;
+
+		//the oldest updates go first when the aggregator cannot keep up
+		queued_bytes_ += frame.size();
+		queue_.push_back(std::move(frame));
+		while (queued_bytes_ > max_queued_ && !queue_.empty()) {
+			const uint32_t count = LoadUint32(queue_.front().data());
+			dropped_ += count;
+			Metrics::Local().Add(METRIC_RELAY_DROPPED, count);
+			queued_bytes_ -= queue_.front().size();
+			queue_.pop_front();
+		}
+	}
+	Drain();
+}
+
+void TrackRelay::Drain() {
+	while (!queue_.empty()) {
+		Link *link = nullptr;
+		for (size_t i = 0; i < links_.size() && !link; i++) {
+			Link *candidate = links_[(next_link_ + i) % links_.size()];
+			if (candidate->open && candidate->ws.getBufferedAmount() < kMaxInFlight) {
+				link = candidate;
+			}
+		}
+		if (!link) {
+			return;
+		}
+		next_link_ = link->index + 1;
+		const std::string &frame = queue_.front();
+		link->ws.send(frame.data(), frame.length(), uWS::OpCode::BINARY);
+		const uint32_t count = LoadUint32(frame.data());
+		sent_ += count;
+		Metrics::Local().Add(METRIC_RELAY_SENT, count);
+		queued_bytes_ -= frame.size();
+		queue_.pop_front();
+	}
+}
+
+void TrackRelay::Reconnect() {
+	const uint64_t now = uv_now(hub_->getLoop());
+	for (Link *link : links_) {
+		if (!link->open && !link->connecting && now >= link->retry_at) {
+			link->connecting = true;
+			hub_->connect(uri_, link);
+		}
+	}
+}
+
+void TrackRelay::Lost(Link *link) {
+	link->open = false;
+	link->connecting = false;
+	link->retry_at = uv_now(hub_->getLoop()) + link->backoff_ms;
+	link->backoff_ms = std::min(2 * link->backoff_ms, kMaxBackoff);
+}
@@ -0,0 +1,123 @@
+#ifndef TRACK_RELAY_H_
+#define TRACK_RELAY_H_
+
+#include <uWS/uWS.h>
+#include "estimate_log.h"
+#include "session.h"
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * Forwards the estimates of all sessions of one event loop to a central
+ * aggregator, for edge nodes whose fused tracks are collected elsewhere.
+ * Every estimate is appended to a batch, which goes out as one BINARY
+ * frame once it holds kBatchSize bytes or kFlushInterval has passed:
+ *    0  uint32  count        of the updates in the frame
+ *    4  uint32  length       of the updates uncompressed, count * 96
+ *    8  the updates, compressed as one zlib stream
+ * with each update, little-endian as in measurement_record.h,
+ *    0  int32   id           of the track
+ *    4  uint8   sensor       'L' or 'R'
+ *    5  uint8   reserved[3]  zero
+ *    8  int64   timestamp    in us
+ *   16  double  x[5]         p_x p_y v yaw yaw_rate
+ *   56  double  nis          of the measurement's sensor
+ *   64  double  rmse[4]      cumulative, of p_x p_y v_x v_y
+ *
+ * The frames are spread over a few persistent connections to the
+ * aggregator, each given frames only while it has less than kMaxInFlight
+ * bytes unsent, so that a slow or lost connection holds back no more than
+ * that. The others stay queued in the relay, up to a bound past which the
+ * oldest are dropped and counted. A connection that fails or closes is
+ * opened again after a backoff that doubles from kMinBackoff up to
+ * kMaxBackoff, and starts over once it is open.
+ *
+ * The relay belongs to the loop's thread and must be created there, before
+ * its sessions connect; it installs the WebSocket client handlers of h,
+ * and cannot share the loop with a ShardRouter. The sessions must be
+ * filtered on the loop, not by a Pipeline.
+ */
+class TrackRelay {
+public:
+  static const size_t kUpdateSize = 96;
+  ///* uncompressed bytes of updates sent at once
+  static const size_t kBatchSize = 64 * 1024;
+  ///* longest an update waits for its batch, in ms
+  static const int kFlushInterval = 50;
+  ///* unsent bytes of a connection past which it is given no more frames
+  static const size_t kMaxInFlight = 256 * 1024;
+  ///* in ms
+  static const int kMinBackoff = 100;
+  static const int kMaxBackoff = 10000;
+
+  /**
+   * Starts relaying the sessions of pool on h to uri over connections
+   * connections; the sessions pool hands out from now on are relayed.
+   * @param max_queued Bytes of compressed frames kept while none of the
+   * connections takes them
+   */
+  TrackRelay(uWS::Hub &h, SessionPool &pool, const std::string &uri, int connections, size_t max_queued);
+
+  ///* stops the timer and closes the connections
+  ~TrackRelay();
+
+  ///* adds an estimate to the batch, sending it once it is full
+  void Append(const EstimateRecord &record);
+
+  ///* compresses the batch into a frame, if it holds any, and sends what
+  ///* the connections take
+  void Flush();
+
+  ///* updates handed to a connection, and dropped from a full queue
+  long long sent() const { return sent_; }
+  long long dropped() const { return dropped_; }
+  ///* connections opened, the first ones included
+  long long connects() const { return connects_; }
+
+private:
+  struct Link {
+    TrackRelay *relay;
+    int index;
+    uWS::WebSocket<uWS::CLIENT> ws;
+    ///* connected, or connecting
+    bool open;
+    bool connecting;
+    ///* the backoff before the next attempt, and when it is due, on the
+    ///* loop's clock
+    int backoff_ms;
+    uint64_t retry_at;
+  };
+
+  uWS::Hub *hub_;
+  std::string uri_;
+  size_t max_queued_;
+  uv_timer_t *timer_;
+  std::vector<Link *> links_;
+  ///* the link the next frame is offered to first
+  size_t next_link_;
+
+  std::string batch_;
+  size_t batch_count_;
+  ///* compressed frames not yet handed to a connection, oldest first
+  std::deque<std::string> queue_;
+  size_t queued_bytes_;
+
+  long long sent_;
+  long long dropped_;
+  long long connects_;
+
+  ///* hands queued frames to the connections that take them
+  void Drain();
+
+  ///* opens the connections whose backoff is over
+  void Reconnect();
+
+  ///* link's connection failed or closed; tries again after its backoff
+  void Lost(Link *link);
+
+  TrackRelay(const TrackRelay &);
+  TrackRelay &operator=(const TrackRelay &);
+};
+
+#endif /* TRACK_RELAY_H_ */
@@ -0,0 +1,111 @@
+#include "track_scheduler.h"
+#include "ukf_batch.h"
+
+template <class Batch>
+const size_t TrackScheduler<Batch>::kNone;
+
+template <class Batch>
+TrackScheduler<Batch>::TrackScheduler(Batch &batch, const std::vector<long long> &budgets_us)
+	: batch_(&batch), free_(kNone), pending_(0), missed_(0) {
+	for (size_t i = 0; i < budgets_us.size(); i++) {
+		budgets_ns_.push_back(uint64_t(budgets_us[i]) * 1000);
+	}
+}
+
+template <class Batch>
+size_t TrackScheduler<Batch>::AddTrack(int priority_class) {
+	const size_t track = batch_->AddTrack();
+	if (queues_.size() <= track) {
+		queues_.resize(track + 1);
+		track_metrics_.resize(track + 1);
+	}
+	Queue &queue = queues_[track];
+	queue.budget_ns = budgets_ns_[priority_class];
+	queue.head = kNone;
+	queue.tail = kNone;
+	return track;
+}
+
+template <class Batch>
+void TrackScheduler<Batch>::Submit(size_t track, const MeasurementPackage &meas_package, uint64_t arrival_ns, size_t tag) {
+	size_t n = free_;
+	if (n == kNone) {
+		n = nodes_.size();
+		nodes_.resize(n + 1);
+	}
+	else {
+		free_ = nodes_[n].next;
+	}
+	Queue &queue = queues_[track];
+	Node &node = nodes_[n];
+	node.measurement = meas_package;
+	node.arrival_ns = arrival_ns;
+	node.deadline_ns = arrival_ns + queue.budget_ns;
+	node.tag = tag;
+	node.next = kNone;
+	if (queue.head == kNone) {
+		queue.head = n;
+		due_.push(Due(node.deadline_ns, track));
+	}
+	else {
+		nodes_[queue.tail].next = n;
+	}
+	queue.tail = n;
+	pending_++;
+}
+
+template <class Batch>
+size_t TrackScheduler<Batch>::Dispatch(size_t max_count) {
+	tracks_.clear();
+	tags_.clear();
+	measurements_.clear();
+	taken_.clear();
+	while (tracks_.size() < max_count && !due_.empty()) {
+		const size_t track = due_.top().second;
+		due_.pop();
+		const size_t n = queues_[track].head;
+		tracks_.push_back(track);
+		tags_.push_back(nodes_[n].tag);
+		measurements_.push_back(nodes_[n].measurement);
+		taken_.push_back(n);
+	}
+	if (tracks_.empty()) {
+		return 0;
+	}
+	batch_->ProcessMeasurements(tracks_.data(), measurements_.data(), tracks_.size());
+	const uint64_t done = LatencyStats::Now();
+
+	//the taken nodes go back to the pool, and their tracks back in line
+	//with their next measurement
+	for (size_t i = 0; i < taken_.size(); i++) {
+		const size_t track = tracks_[i];
+		Node &node = nodes_[taken_[i]];
+		const uint64_t latency = done - node.arrival_ns;
+		const bool missed = done > node.deadline_ns;
+		TrackMetrics &metrics = track_metrics_[track];
+		metrics.dispatched++;
+		metrics.missed += missed;
+		metrics.total_latency_ns += latency;
+		if (latency > metrics.max_latency_ns) {
+			metrics.max_latency_ns = latency;
+		}
+		latency_.Record(latency);
+		missed_ += missed;
+
+		Queue &queue = queues_[track];
+		queue.head = node.next;
+		if (queue.head == kNone) {
+			queue.tail = kNone;
+		}
+		else {
+			due_.push(Due(nodes_[queue.head].deadline_ns, track));
+		}
+		node.next = free_;
+		free_ = taken_[i];
+	}
+	pending_ -= taken_.size();
+	return taken_.size();
+}
+
+template class TrackScheduler<DoubleUKFBatch>;
+template class TrackScheduler<FloatUKFBatch>;
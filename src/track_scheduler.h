@@ -0,0 +1,132 @@
+#ifndef TRACK_SCHEDULER_H_
+#define TRACK_SCHEDULER_H_
+
+#include "latency.h"
+#include "measurement_package.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/**
+ * Hands the pending measurements of many tracks to a UKFBatch by deadline
+ * rather than in arrival order. Every track belongs to a priority class with
+ * a latency budget, and a measurement is due its budget after it arrived; a
+ * track is as urgent as its oldest pending measurement. Dispatch takes the
+ * most urgent tracks, one measurement each so that its estimate can be read
+ * afterwards, and processes them in one ProcessMeasurements call, in which
+ * the batch groups them into blocks of its lanes. The measurements of a
+ * track are always processed in the order they were submitted.
+ *
+ * A measurement whose dispatch returns after its deadline counts as a miss.
+ * The scheduler keeps the latency from arrival to the end of its dispatch
+ * and the misses per track and over all tracks, to tune the budgets and
+ * batch sizes against.
+ *
+ * Pending measurements live in a pool of nodes that only grows to the most
+ * ever pending; one thread submits and dispatches.
+ */
+template <class Batch>
+class TrackScheduler {
+public:
+  ///* what the scheduler measured of one track
+  struct TrackMetrics {
+    long long dispatched;
+    long long missed;
+    uint64_t total_latency_ns;
+    uint64_t max_latency_ns;
+
+    TrackMetrics() : dispatched(0), missed(0), total_latency_ns(0), max_latency_ns(0) {}
+
+    double MeanLatency() const { return dispatched ? total_latency_ns / double(dispatched) : 0.0; }
+  };
+
+  /**
+   * @param batch The filters, which the scheduler adds its tracks to; it
+   * must outlive the scheduler
+   * @param budgets_us Latency budget of every priority class, in us
+   */
+  TrackScheduler(Batch &batch, const std::vector<long long> &budgets_us);
+
+  /**
+   * Adds a track of a priority class, an index into the budgets, to the
+   * batch and returns its index there.
+   */
+  size_t AddTrack(int priority_class);
+
+  /**
+   * Queues a measurement of track that arrived at arrival_ns (on the clock
+   * of LatencyStats::Now). Its tag is reported with it once dispatched.
+   */
+  void Submit(size_t track, const MeasurementPackage &meas_package, uint64_t arrival_ns, size_t tag = 0);
+
+  /**
+   * Processes the pending measurements of up to max_count tracks, those
+   * due first, one measurement each.
+   * @return The number of measurements processed
+   */
+  size_t Dispatch(size_t max_count);
+
+  ///* measurements waiting
+  size_t pending() const { return pending_; }
+
+  ///* the tracks and tags of the measurements of the last Dispatch
+  const std::vector<size_t> &dispatched_tracks() const { return tracks_; }
+  const std::vector<size_t> &dispatched_tags() const { return tags_; }
+
+  const TrackMetrics &metrics(size_t track) const { return track_metrics_[track]; }
+
+  ///* latency of every measurement from arrival to the end of its dispatch,
+  ///* and the misses of all tracks
+  const LatencyHistogram &latency() const { return latency_; }
+  long long missed() const { return missed_; }
+
+private:
+  static const size_t kNone = ~size_t(0);
+
+  ///* a pending measurement, in the list of its track
+  struct Node {
+    MeasurementPackage measurement;
+    uint64_t arrival_ns;
+    uint64_t deadline_ns;
+    size_t tag;
+    size_t next;
+  };
+
+  ///* a track's pending list, oldest first
+  struct Queue {
+    uint64_t budget_ns;
+    size_t head;
+    size_t tail;
+  };
+
+  ///* tracks with pending measurements by the deadline of the oldest, the
+  ///* earliest on top
+  typedef std::pair<uint64_t, size_t> Due;
+  typedef std::priority_queue<Due, std::vector<Due>, std::greater<Due> > DueQueue;
+
+  Batch *batch_;
+  std::vector<uint64_t> budgets_ns_;
+  std::vector<Queue> queues_;
+  std::vector<TrackMetrics> track_metrics_;
+  std::vector<Node> nodes_;
+  size_t free_;
+  size_t pending_;
+  DueQueue due_;
+
+  ///* the last dispatch, and the nodes it took
+  std::vector<size_t> tracks_;
+  std::vector<size_t> tags_;
+  std::vector<MeasurementPackage> measurements_;
+  std::vector<size_t> taken_;
+
+  LatencyHistogram latency_;
+  long long missed_;
+
+  TrackScheduler(const TrackScheduler &);
+  TrackScheduler &operator=(const TrackScheduler &);
+};
+
+#endif /* TRACK_SCHEDULER_H_ */
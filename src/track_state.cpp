@@ -0,0 +1,274 @@
+#include "track_state.h"
+#include "json.hpp"
+#include "session.h"
+#include "shm_track_table.h"
+#include "track_index.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <utility>
+
+// for convenience
+using json = nlohmann::json;
+
+std::atomic<TrackState *> TrackRegistry::head_(nullptr);
+std::atomic<int> TrackRegistry::states_(0);
+size_t TrackRegistry::history_bytes_ = 0;
+long long TrackRegistry::history_interval_us_ = 0;
+ShmTrackTable *TrackRegistry::shm_table_ = nullptr;
+const size_t TrackRegistry::kCostliest;
+
+TrackState::TrackState()
+	: current_(0), live_(false), in_use_(true), next_(nullptr), slot_(0) {
+	for (int b = 0; b < 2; b++) {
+		buffers_[b].sequence.store(0, std::memory_order_relaxed);
+		for (int i = 0; i < kWords; i++) {
+			buffers_[b].words[i].store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+void TrackState::Publish(const TrackSnapshot &snapshot) {
+	uint64_t words[kWords] = {};
+	memcpy(words, &snapshot, sizeof(snapshot));
+
+	// readers are sent to the other buffer, so this one is normally free
+	int next = 1 - current_.load(std::memory_order_relaxed);
+	Buffer &buffer = buffers_[next];
+	unsigned sequence = buffer.sequence.load(std::memory_order_relaxed);
+	buffer.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (int i = 0; i < kWords; i++) {
+		buffer.words[i].store(words[i], std::memory_order_relaxed);
+	}
+	buffer.sequence.store(sequence + 2, std::memory_order_release);
+	current_.store(next, std::memory_order_release);
+	live_.store(true, std::memory_order_release);
+	if (ShmTrackTable *table = TrackRegistry::shm_table()) {
+		table->Publish(slot_, snapshot);
+	}
+}
+
+void TrackState::Withdraw() {
+	live_.store(false, std::memory_order_release);
+	if (ShmTrackTable *table = TrackRegistry::shm_table()) {
+		table->Withdraw(slot_);
+	}
+}
+
+bool TrackState::Read(TrackSnapshot *snapshot) const {
+	uint64_t words[kWords];
+	for (;;) {
+		if (!live_.load(std::memory_order_acquire)) {
+			return false;
+		}
+		const Buffer &buffer = buffers_[current_.load(std::memory_order_acquire)];
+		unsigned sequence = buffer.sequence.load(std::memory_order_acquire);
+		if (sequence & 1) {
+			continue;
+		}
+		for (int i = 0; i < kWords; i++) {
+			words[i] = buffer.words[i].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (buffer.sequence.load(std::memory_order_relaxed) == sequence) {
+			break;
+		}
+	}
+	memcpy(snapshot, words, sizeof(*snapshot));
+	return true;
+}
+
+TrackState *TrackRegistry::Acquire() {
+	for (TrackState *state = head_.load(std::memory_order_acquire); state; state = state->next_) {
+		bool free = false;
+		if (state->in_use_.compare_exchange_strong(free, true, std::memory_order_acq_rel)) {
+			return state;
+		}
+	}
+
+	TrackState *state = new TrackState();
+	state->slot_ = states_.fetch_add(1, std::memory_order_relaxed);
+	if (history_bytes_) {
+		state->history_.reset(new TrackHistory(history_bytes_, history_interval_us_));
+	}
+	state->next_ = head_.load(std::memory_order_relaxed);
+	while (!head_.compare_exchange_weak(state->next_, state, std::memory_order_release, std::memory_order_relaxed));
+	return state;
+}
+
+void TrackRegistry::Release(TrackState *state) {
+	if (!state) {
+		return;
+	}
+	state->Withdraw();
+	state->in_use_.store(false, std::memory_order_release);
+}
+
+template <class F>
+void TrackRegistry::ForEachLive(F visit) {
+	TrackSnapshot snapshot;
+	for (TrackState *state = head_.load(std::memory_order_acquire); state; state = state->next_) {
+		if (state->Read(&snapshot)) {
+			visit(snapshot);
+		}
+	}
+}
+
+///* the work of the stages a track's messages go through on a thread,
+///* which leaves out LATENCY_TOTAL, their sum, and LATENCY_QUEUE, a wait
+static const LatencyStage kCostStages[] = {
+	LATENCY_PARSE, LATENCY_PREDICTION, LATENCY_UPDATE_LIDAR, LATENCY_UPDATE_RADAR, LATENCY_SERIALIZE, LATENCY_SEND
+};
+
+static uint64_t CostNs(const TrackSnapshot &snapshot) {
+	uint64_t cost = 0;
+	for (LatencyStage stage : kCostStages) {
+		cost += snapshot.cost_ns[stage];
+	}
+	return cost;
+}
+
+static json SnapshotJson(const TrackSnapshot &snapshot, bool covariance) {
+	json track;
+	track["id"] = snapshot.id;
+	track["timestamp"] = snapshot.timestamp;
+	track["measurements"] = snapshot.measurements;
+	track["shed_redundant"] = snapshot.shed_redundant;
+	track["shed_low_information"] = snapshot.shed_low_information;
+	track["qos"] = Session::QosTierName(Session::QosTier(snapshot.qos_tier));
+	track["initialized"] = snapshot.initialized;
+	track["x"] = std::vector<double>(snapshot.x, snapshot.x + 5);
+	if (covariance) {
+		track["P"] = std::vector<double>(snapshot.P, snapshot.P + 25);
+	}
+	track["nis_radar"] = snapshot.nis_radar;
+	track["nis_laser"] = snapshot.nis_laser;
+	track["radar_nis_within"] = snapshot.radar_nis_within;
+	track["laser_nis_within"] = snapshot.laser_nis_within;
+	track["consistent"] = snapshot.consistent;
+	track["rmse"] = std::vector<double>(snapshot.rmse, snapshot.rmse + 4);
+	track["cost_us"] = CostNs(snapshot) / 1e3;
+	if (covariance) {
+		json stages;
+		for (LatencyStage stage : kCostStages) {
+			stages[LatencyStats::StageName(stage)] = snapshot.cost_ns[stage] / 1e3;
+		}
+		track["cost_stages_us"] = stages;
+	}
+	return track;
+}
+
+std::string TrackRegistry::TracksJson() {
+	json tracks = json::array();
+	ForEachLive([&tracks](const TrackSnapshot &snapshot) {
+		tracks.push_back(SnapshotJson(snapshot, false));
+	});
+	return tracks.dump();
+}
+
+std::string TrackRegistry::TracksJson(const double *box) {
+	std::vector<TrackState *> states;
+	TrackIndex::Query(box, &states);
+	json tracks = json::array();
+	TrackSnapshot snapshot;
+	for (size_t i = 0; i < states.size(); i++) {
+		// the index has whole cells, and the state may have moved on since
+		if (states[i]->Read(&snapshot) && snapshot.initialized && TrackIndex::Contains(box, snapshot.x[0], snapshot.x[1])) {
+			tracks.push_back(SnapshotJson(snapshot, false));
+		}
+	}
+	return tracks.dump();
+}
+
+bool TrackRegistry::TrackJson(int id, std::string *json_text) {
+	bool found = false;
+	ForEachLive([id, json_text, &found](const TrackSnapshot &snapshot) {
+		if (!found && snapshot.id == id) {
+			*json_text = SnapshotJson(snapshot, true).dump();
+			found = true;
+		}
+	});
+	return found;
+}
+
+bool TrackRegistry::HistoryJson(int id, long long from_us, long long to_us, long long last_us,
+                                std::string *json_text) {
+	TrackSnapshot snapshot;
+	for (TrackState *state = head_.load(std::memory_order_acquire); state; state = state->next_) {
+		if (!state->history_ || !state->Read(&snapshot) || snapshot.id != id) {
+			continue;
+		}
+		if (last_us > 0) {
+			from_us = std::max(from_us, snapshot.timestamp - last_us);
+		}
+		std::vector<TrackHistory::Estimate> estimates;
+		state->history_->Read(from_us, to_us, &estimates);
+		json history;
+		history["id"] = id;
+		json list = json::array();
+		for (const TrackHistory::Estimate &estimate : estimates) {
+			json entry;
+			entry["timestamp"] = estimate.timestamp;
+			entry["x"] = std::vector<double>(estimate.x, estimate.x + 5);
+			entry["P_diagonal"] = std::vector<double>(estimate.P_diagonal, estimate.P_diagonal + 5);
+			list.push_back(entry);
+		}
+		history["estimates"] = list;
+		*json_text = history.dump();
+		return true;
+	}
+	return false;
+}
+
+std::string TrackRegistry::StatsJson() {
+	long long tracks = 0, measurements = 0, inconsistent = 0, shed_redundant = 0, shed_low_information = 0;
+	long long qos_tiers[Session::QOS_TIERS] = {};
+	uint64_t cost_ns[LATENCY_STAGES] = {};
+	// the costliest tracks, by their cost in ns
+	std::vector<std::pair<uint64_t, int> > costliest;
+	ForEachLive([&](const TrackSnapshot &snapshot) {
+		tracks++;
+		measurements += snapshot.measurements;
+		inconsistent += !snapshot.consistent;
+		shed_redundant += snapshot.shed_redundant;
+		shed_low_information += snapshot.shed_low_information;
+		qos_tiers[snapshot.qos_tier]++;
+		for (LatencyStage stage : kCostStages) {
+			cost_ns[stage] += snapshot.cost_ns[stage];
+		}
+		costliest.push_back(std::make_pair(CostNs(snapshot), snapshot.id));
+	});
+	const size_t top = std::min(costliest.size(), kCostliest);
+	std::partial_sort(costliest.begin(), costliest.begin() + top, costliest.end(),
+	                  std::greater<std::pair<uint64_t, int> >());
+	json stages;
+	for (LatencyStage stage : kCostStages) {
+		stages[LatencyStats::StageName(stage)] = cost_ns[stage] / 1e3;
+	}
+	json costliest_tracks = json::array();
+	for (size_t i = 0; i < top; i++) {
+		costliest_tracks.push_back({{"id", costliest[i].second}, {"cost_us", costliest[i].first / 1e3}});
+	}
+	json stats;
+	stats["tracks"] = tracks;
+	stats["measurements"] = measurements;
+	stats["inconsistent"] = inconsistent;
+	stats["shed_redundant"] = shed_redundant;
+	stats["shed_low_information"] = shed_low_information;
+	json tiers;
+	for (int tier = 0; tier < Session::QOS_TIERS; tier++) {
+		tiers[Session::QosTierName(Session::QosTier(tier))] = qos_tiers[tier];
+	}
+	stats["qos_tiers"] = tiers;
+	stats["cost_stages_us"] = stages;
+	stats["costliest"] = costliest_tracks;
+	return stats.dump();
+}
+
+void TrackRegistry::CopyLive(std::vector<TrackSnapshot> *snapshots) {
+	snapshots->clear();
+	ForEachLive([snapshots](const TrackSnapshot &snapshot) {
+		snapshots->push_back(snapshot);
+	});
+}
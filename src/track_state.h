@@ -0,0 +1,182 @@
+#ifndef TRACK_STATE_H_
+#define TRACK_STATE_H_
+
+#include "latency.h"
+#include "track_history.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ShmTrackTable;
+
+/**
+ * What the HTTP API reports of one session's filter, copied out of it after
+ * every measurement.
+ */
+struct TrackSnapshot {
+  int id;
+  ///* whether the filter has taken its first measurement
+  bool initialized;
+  ///* whether the radar NIS is within bounds often enough, see Session
+  bool consistent;
+  long long timestamp;
+  ///* time the filter's state is true at, in us (UKF::time_us_)
+  long long time_us;
+  long long measurements;
+  ///* of those, the ones skipped under overload as redundant or of little
+  ///* information (see LoadShedder)
+  long long shed_redundant;
+  long long shed_low_information;
+  ///* the Session::QosTier its last measurement was filtered at
+  int qos_tier;
+  ///* CTRV state [p_x p_y v yaw yaw_rate] and its covariance, row major
+  double x[5];
+  double P[25];
+  ///* the latest NIS values and the fractions of the recent ones within
+  ///* the 95% bounds
+  double nis_radar;
+  double nis_laser;
+  double radar_nis_within;
+  double laser_nis_within;
+  double rmse[4];
+  ///* estimates with ground truth the RMSE is over
+  long long rmse_count;
+  ///* the work of the track's messages in this process, in ns by stage
+  ///* (see LatencyStats::Attribution), up to its latest update: the
+  ///* serialization and sending of that measurement's answer follow it
+  uint64_t cost_ns[LATENCY_STAGES];
+};
+
+/**
+ * The latest TrackSnapshot of a session, which its loop's thread publishes
+ * and any thread reads without locking. Two buffers take turns: the session
+ * writes the one readers were not sent to, and a reader only retries if it
+ * was overtaken by two publications while copying. Each buffer is a
+ * sequence lock over relaxed atomic words, so the copying is free of data
+ * races.
+ */
+class TrackState {
+public:
+  TrackState();
+
+  /**
+   * Makes snapshot the latest and the track live; from the owning session's
+   * thread only.
+   */
+  void Publish(const TrackSnapshot &snapshot);
+
+  ///* hides the track until the next Publish, when its session is released
+  void Withdraw();
+
+  /**
+   * Copies the latest snapshot; false if the track is not live.
+   */
+  bool Read(TrackSnapshot *snapshot) const;
+
+  ///* the state's number, 0, 1, ... in the order they were made; kept
+  ///* when another session takes the state over
+  int slot() const { return slot_; }
+
+  ///* the recent estimates of the track, which the session appends to and
+  ///* clears for another track; null unless TrackRegistry::set_history
+  ///* was called before the state was made
+  TrackHistory *history() const { return history_.get(); }
+
+private:
+  friend class TrackRegistry;
+
+  static const int kWords = (sizeof(TrackSnapshot) + 7) / 8;
+
+  struct Buffer {
+    ///* odd while the buffer is written
+    std::atomic<unsigned> sequence;
+    std::atomic<uint64_t> words[kWords];
+  };
+
+  Buffer buffers_[2];
+  std::atomic<int> current_;
+  std::atomic<bool> live_;
+
+  ///* registry bookkeeping: taken by a session, and the next state
+  std::atomic<bool> in_use_;
+  TrackState *next_;
+  int slot_;
+  std::unique_ptr<TrackHistory> history_;
+
+  TrackState(const TrackState &);
+  TrackState &operator=(const TrackState &);
+};
+
+/**
+ * The TrackStates of all sessions of the process, whichever thread runs
+ * them. States are never freed: a session gives its state back when it is
+ * deleted and the next new session takes it over, so readers can walk the
+ * list at any time.
+ */
+class TrackRegistry {
+public:
+  static TrackState *Acquire();
+  static void Release(TrackState *state);
+
+  /**
+   * The JSON documents of the HTTP API: all live tracks or those in a
+   * region, one track (false if no live track has that id) and totals over
+   * the live tracks.
+   */
+  static std::string TracksJson();
+  ///* the live tracks whose position is within box, x0, y0, x1, y1, as
+  ///* found in the TrackIndex
+  static std::string TracksJson(const double *box);
+  static bool TrackJson(int id, std::string *json_text);
+
+  /**
+   * The kept estimates of the live track id with timestamps from from_us
+   * to to_us, or with last_us > 0 those of the last last_us before its
+   * latest measurement, as {"id", "estimates": [{"timestamp", "x",
+   * "P_diagonal"}, ...]}; false if there is no such track or no histories
+   * are kept.
+   */
+  static bool HistoryJson(int id, long long from_us, long long to_us, long long last_us,
+                          std::string *json_text);
+
+  /**
+   * Gives every TrackState made from now on a TrackHistory of bytes, which
+   * keeps an estimate every interval_us, for HistoryJson; before the first
+   * session.
+   */
+  static void set_history(size_t bytes, long long interval_us = 0) {
+    history_bytes_ = bytes;
+    history_interval_us_ = interval_us;
+  }
+  static std::string StatsJson();
+
+  /**
+   * Exports every Publish and Withdraw of the states to table as well, to
+   * the slot of the state's slot(); before the first session.
+   */
+  static void set_shm_table(ShmTrackTable *table) { shm_table_ = table; }
+  static ShmTrackTable *shm_table() { return shm_table_; }
+
+  ///* the most tracks StatsJson lists by their cost
+  static const size_t kCostliest = 10;
+
+  /**
+   * Copies the snapshots of all live tracks into snapshots, in no order,
+   * for a checkpoint (see session_checkpoint.h).
+   */
+  static void CopyLive(std::vector<TrackSnapshot> *snapshots);
+
+private:
+  static std::atomic<TrackState *> head_;
+  static std::atomic<int> states_;
+  static size_t history_bytes_;
+  static long long history_interval_us_;
+  static ShmTrackTable *shm_table_;
+
+  template <class F>
+  static void ForEachLive(F visit);
+};
+
+#endif /* TRACK_STATE_H_ */
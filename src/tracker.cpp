@@ -0,0 +1,319 @@
+#include "tracker.h"
+#include "angle.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+///* the 99% points of chi-square with 2 and 3 degrees of freedom: a
+///* detection of the track passes its gate 99 times in 100
+const double kLidarGate = 9.210;
+const double kRadarGate = 11.345;
+
+///* detections after which a track's velocity is trusted in the gate
+const int kConfirmHits = 4;
+
+///* cost of a pair outside the gate, far above any within one
+const double kUngated = 1e9;
+
+///* tracks or detections a thread of the pool takes at a time
+const size_t kChunk = 16;
+
+///* body(begin, end) over [0, count), on pool if there is one
+template <class F>
+void ForEach(TaskPool *pool, size_t count, const F &body) {
+	if (pool) {
+		pool->ParallelFor(count, kChunk, body);
+	}
+	else {
+		body(0, count);
+	}
+}
+
+///* largest eigenvalue of a symmetric 2x2 matrix
+double LargestEigenvalue(double a, double b, double c) {
+	const double half_difference = 0.5 * (a - c);
+	return 0.5 * (a + c) + sqrt(half_difference*half_difference + b*b);
+}
+
+}
+
+TrackPool::TrackPool(const UKFConfig &config) : config_(&config) {}
+
+TrackPool::~TrackPool() {
+	for (size_t i = 0; i < tracks_.size(); i++) {
+		tracks_[i]->~Track();
+	}
+}
+
+Track *TrackPool::Acquire() {
+	Track *track;
+	if (free_.empty()) {
+		track = arena_.New<Track>(*config_, int(tracks_.size()));
+		tracks_.push_back(track);
+		free_.reserve(tracks_.size());
+		return track;
+	}
+	track = free_.back();
+	free_.pop_back();
+	track->id = 0;
+	track->hits = 0;
+	track->misses = 0;
+	track->last_update_us = 0;
+	track->filter.Reset();
+	return track;
+}
+
+void TrackPool::Release(Track *track) {
+	free_.push_back(track);
+}
+
+Tracker::Tracker(const UKFConfig &config, int max_misses, double cell_size, long long max_age_us)
+	: config_(&config), task_pool_(nullptr), max_misses_(max_misses), max_age_us_(max_age_us), next_id_(0),
+	  pool_(config), grid_(cell_size), assigned_(0), spawned_(0), dropped_(0) {}
+
+void Tracker::ProcessScan(const MeasurementPackage *detections, size_t count) {
+	GateDetections(detections, count);
+	Associate(count);
+
+	//updates, then the tracks that missed the scan
+	const long long timestamp = count ? detections[0].timestamp_ : 0;
+	updated_.assign(slot_tracks_.size(), 0);
+	detection_tracks_.assign(count, nullptr);
+	//every detection updates a track of its own
+	ForEach(task_pool_, count, [&](size_t begin, size_t end) {
+		for (size_t d = begin; d < end; d++) {
+			if (detection_track_[d] >= 0) {
+				slot_tracks_[detection_track_[d]]->filter.ProcessMeasurement(detections[d]);
+			}
+		}
+	});
+	for (size_t d = 0; d < count; d++) {
+		const int slot = detection_track_[d];
+		if (slot >= 0) {
+			Track &track = *slot_tracks_[slot];
+			track.hits++;
+			track.last_update_us = timestamp;
+			updated_[slot] = 1;
+			detection_tracks_[d] = &track;
+			assigned_++;
+		}
+	}
+	size_t kept = 0;
+	for (size_t t = 0; t < tracks_.size(); t++) {
+		Track *track = tracks_[t];
+		track->misses = updated_[track->slot] ? 0 : track->misses + 1;
+		if (track->misses > max_misses_ || timestamp - track->last_update_us > max_age_us_) {
+			grid_.Remove(track->slot);
+			slot_tracks_[track->slot] = nullptr;
+			pool_.Release(track);
+			dropped_++;
+			continue;
+		}
+		tracks_[kept++] = track;
+	}
+	tracks_.resize(kept);
+
+	//a detection no track explains starts one
+	for (size_t d = 0; d < count; d++) {
+		if (detection_track_[d] >= 0) {
+			continue;
+		}
+		Track *track = pool_.Acquire();
+		track->id = next_id_++;
+		track->hits = 1;
+		track->last_update_us = timestamp;
+		track->filter.ProcessMeasurement(detections[d]);
+		if (pool_.slots() > slot_tracks_.size()) {
+			slot_tracks_.resize(pool_.slots(), nullptr);
+		}
+		slot_tracks_[track->slot] = track;
+		grid_.Update(track->slot, track->filter.x_(0), track->filter.x_(1));
+		detection_tracks_[d] = track;
+		tracks_.push_back(track);
+		spawned_++;
+	}
+}
+
+void Tracker::PredictGate(Track &track, bool radar, MeasurementPackage::SensorType sensor, long long timestamp) {
+	CTRVUKF &filter = track.filter;
+	Gate &gate = gates_[track.slot];
+	Eigen::Matrix3d S;
+	gate.n_z = filter.PredictMeasurement(sensor, timestamp, &gate.z_pred, &S);
+	//a young track's speed and heading are still the guesses it started
+	//with, so its gate leaves out the range rate
+	if (track.hits < kConfirmHits) {
+		gate.n_z = 2;
+	}
+	gate.threshold = gate.n_z == 2 ? kLidarGate : kRadarGate;
+	gate.p_x = filter.x_(0);
+	gate.p_y = filter.x_(1);
+
+	//a radius around the predicted position that holds the gate: the
+	//position uncertainty plus the sensor's, the radar's from range and
+	//bearing at the predicted range
+	const double position_variance = LargestEigenvalue(filter.P_(0, 0), filter.P_(0, 1), filter.P_(1, 1));
+	double sensor_variance;
+	if (radar) {
+		const double rho2 = gate.p_x*gate.p_x + gate.p_y*gate.p_y;
+		sensor_variance = config_->std_radr_*config_->std_radr_
+			+ rho2 * config_->std_radphi_*config_->std_radphi_;
+	}
+	else {
+		sensor_variance = std::max(config_->std_laspx_*config_->std_laspx_,
+		                           config_->std_laspy_*config_->std_laspy_);
+	}
+	gate.radius = sqrt(gate.threshold * (position_variance + sensor_variance));
+
+	//S^-1 and log det S, closed form for these sizes
+	if (gate.n_z == 2) {
+		const Eigen::Matrix2d S2 = S.topLeftCorner<2, 2>();
+		gate.Si.setZero();
+		gate.Si.topLeftCorner<2, 2>() = S2.inverse();
+		gate.log_det = log(S2.determinant());
+	}
+	else {
+		gate.Si = S.inverse();
+		gate.log_det = log(S.determinant());
+	}
+}
+
+void Tracker::GateDetections(const MeasurementPackage *detections, size_t count) {
+	candidates_.clear();
+	if (!count) {
+		return;
+	}
+	const bool radar = detections[0].sensor_type_ == MeasurementPackage::RADAR;
+	const long long timestamp = detections[0].timestamp_;
+	const MeasurementPackage::SensorType sensor = detections[0].sensor_type_;
+
+	//every track predicts into the scan, then moves in the grid
+	gates_.resize(slot_tracks_.size());
+	ForEach(task_pool_, tracks_.size(), [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; t++) {
+			PredictGate(*tracks_[t], radar, sensor, timestamp);
+		}
+	});
+	double max_radius = 0.0;
+	for (size_t t = 0; t < tracks_.size(); t++) {
+		const Gate &gate = gates_[tracks_[t]->slot];
+		grid_.Update(tracks_[t]->slot, gate.p_x, gate.p_y);
+		max_radius = std::max(max_radius, gate.radius);
+	}
+
+	//every detection looks at the tracks in the cells around it
+	for (size_t d = 0; d < count; d++) {
+		const MeasurementPackage::Vector &z = detections[d].raw_measurements_;
+		const double x = radar ? z(0) * cos(z(1)) : z(0);
+		const double y = radar ? z(0) * sin(z(1)) : z(1);
+		nearby_.clear();
+		grid_.Query(x, y, max_radius, &nearby_);
+		for (int slot : nearby_) {
+			const Gate &gate = gates_[slot];
+			if (fabs(x - gate.p_x) > gate.radius || fabs(y - gate.p_y) > gate.radius) {
+				continue;
+			}
+			Eigen::Vector3d residual = Eigen::Vector3d::Zero();
+			residual.head(gate.n_z) = z.head(gate.n_z) - gate.z_pred.head(gate.n_z);
+			if (radar) {
+				residual(RadarMeasurementModel::angle_) = NormalizeAngle(residual(RadarMeasurementModel::angle_));
+			}
+			const double distance = residual.dot(gate.Si * residual);
+			if (distance <= gate.threshold) {
+				Candidate candidate;
+				candidate.track = slot;
+				candidate.detection = int(d);
+				candidate.cluster = 0;
+				candidate.cost = distance + gate.log_det;
+				candidates_.push_back(candidate);
+			}
+		}
+	}
+}
+
+int Tracker::Find(int i) {
+	while (parent_[i] != i) {
+		parent_[i] = parent_[parent_[i]];
+		i = parent_[i];
+	}
+	return i;
+}
+
+void Tracker::Associate(size_t count) {
+	const int n_tracks = int(slot_tracks_.size());
+	detection_track_.assign(count, -1);
+	if (candidates_.empty()) {
+		return;
+	}
+
+	//clusters: the tracks and detections connected by candidates
+	parent_.resize(n_tracks + count);
+	for (size_t i = 0; i < parent_.size(); i++) {
+		parent_[i] = int(i);
+	}
+	for (const Candidate &candidate : candidates_) {
+		const int a = Find(candidate.track);
+		const int b = Find(n_tracks + candidate.detection);
+		if (a != b) {
+			parent_[a] = b;
+		}
+	}
+	for (Candidate &candidate : candidates_) {
+		candidate.cluster = Find(candidate.track);
+	}
+	std::sort(candidates_.begin(), candidates_.end(),
+	          [](const Candidate &a, const Candidate &b) { return a.cluster < b.cluster; });
+
+	local_.assign(n_tracks + count, -1);
+	size_t begin = 0;
+	while (begin < candidates_.size()) {
+		size_t end = begin + 1;
+		while (end < candidates_.size() && candidates_[end].cluster == candidates_[begin].cluster) {
+			end++;
+		}
+
+		cluster_tracks_.clear();
+		cluster_detections_.clear();
+		for (size_t i = begin; i < end; i++) {
+			const Candidate &candidate = candidates_[i];
+			if (local_[candidate.track] < 0) {
+				local_[candidate.track] = int(cluster_tracks_.size());
+				cluster_tracks_.push_back(candidate.track);
+			}
+			if (local_[n_tracks + candidate.detection] < 0) {
+				local_[n_tracks + candidate.detection] = int(cluster_detections_.size());
+				cluster_detections_.push_back(candidate.detection);
+			}
+		}
+		const int rows = int(cluster_tracks_.size());
+		const int cols = int(cluster_detections_.size());
+
+		if (end - begin == 1) {
+			//a lone pair, the common case for separated targets
+			detection_track_[candidates_[begin].detection] = candidates_[begin].track;
+		}
+		else {
+			cost_.assign(size_t(rows) * cols, kUngated);
+			for (size_t i = begin; i < end; i++) {
+				const Candidate &candidate = candidates_[i];
+				cost_[size_t(local_[candidate.track]) * cols + local_[n_tracks + candidate.detection]] = candidate.cost;
+			}
+			row_to_col_.resize(rows);
+			solver_.Solve(&cost_[0], rows, cols, &row_to_col_[0]);
+			for (int r = 0; r < rows; r++) {
+				const int c = row_to_col_[r];
+				if (c >= 0 && cost_[size_t(r) * cols + c] < kUngated) {
+					detection_track_[cluster_detections_[c]] = cluster_tracks_[r];
+				}
+			}
+		}
+
+		for (int t : cluster_tracks_) {
+			local_[t] = -1;
+		}
+		for (int d : cluster_detections_) {
+			local_[n_tracks + d] = -1;
+		}
+		begin = end;
+	}
+}
@@ -0,0 +1,200 @@
+#ifndef TRACKER_H_
+#define TRACKER_H_
+
+#include "arena.h"
+#include "assignment.h"
+#include "cache_aligned.h"
+#include "measurement_package.h"
+#include "spatial_grid.h"
+#include "task_pool.h"
+#include "ukf.h"
+#include "ukf_config.h"
+#include <vector>
+
+/**
+ * One target of a Tracker
+ */
+struct Track {
+  int id;
+  ///* index of the track in the pool, stable across its reuses; it keys the
+  ///* track in the tracker's grid and gates
+  int slot;
+  ///* detections assigned, and scans in a row without one
+  int hits;
+  int misses;
+  ///* time of the last detection, in us; the track expires at
+  ///* last_update_us plus the tracker's max age
+  long long last_update_us;
+  CTRVUKF filter;
+
+  Track(const UKFConfig &config, int slot)
+    : id(0), slot(slot), hits(0), misses(0), last_update_us(0), filter(config) {}
+
+  CACHE_ALIGNED_OPERATOR_NEW
+};
+
+/**
+ * Recycles tracks: a dropped track is kept on a free list and reset when it
+ * is acquired again, with UKF::Reset instead of a new filter, so that a
+ * tracker whose targets come and go stops allocating once the pool holds
+ * as many tracks as were ever live at once. Tracks are placed in slot order
+ * in an Arena, so the per-track loops of a scan walk memory in order.
+ */
+class TrackPool {
+public:
+  explicit TrackPool(const UKFConfig &config);
+
+  ///* destroys all tracks, acquired or not, and frees the arena
+  ~TrackPool();
+
+  ///* a track reset to before its first measurement, with id 0
+  Track *Acquire();
+  void Release(Track *track);
+
+  ///* tracks in use, and tracks ever created: the slots are 0 .. slots - 1
+  size_t live() const { return tracks_.size() - free_.size(); }
+  size_t slots() const { return tracks_.size(); }
+
+private:
+  const UKFConfig *config_;
+  Arena arena_;
+  ///* every track created, by slot, and the free ones
+  std::vector<Track *> tracks_;
+  std::vector<Track *> free_;
+
+  TrackPool(const TrackPool &);
+  TrackPool &operator=(const TrackPool &);
+};
+
+/**
+ * Multi-target tracker: one CTRVUKF per target, fed with scans of
+ * unlabeled detections. Every scan is predicted into each track, which
+ * gates the detections by their Mahalanobis distance under the track's
+ * predicted measurement and innovation covariance (UKF::PredictMeasurement)
+ * and then assigns them by global nearest neighbour. The gated pairs split
+ * into independent clusters of tracks and detections, and each cluster is
+ * solved with the Hungarian method on the cost d^2 + log det S, so that the
+ * exact assignment stays cheap while clusters stay small. A detection left
+ * over starts a track; a track missing max_misses scans in a row, or
+ * without a detection for longer than the max age, is dropped. Tracks come
+ * from a TrackPool and every scratch array is kept at its largest size, so
+ * with steady turnover a scan does not allocate.
+ *
+ * Gating only pairs a detection with the tracks near it: the predicted
+ * positions of all tracks are kept in a SpatialGrid, moved as each track
+ * predicts into the scan, and every detection queries it within the
+ * largest gate radius of the scan, a bound on the gate from the track's
+ * position and sensor uncertainty. A scan thus costs about
+ * O(tracks + detections) for targets spread out over the grid, rather than
+ * O(tracks x detections).
+ *
+ * With a TaskPool the tracks predict into the scan and the assigned ones
+ * update in parallel, which they may as the filters are independent
+ * between association stages; the estimates are the same as without.
+ */
+class Tracker {
+public:
+  /**
+   * @param config The sensors and noise of all tracks, which must outlive
+   * the tracker
+   * @param max_misses Scans in a row a track may go without a detection
+   * @param cell_size Cell edge of the grid of predicted positions in m,
+   * about twice a typical gate radius
+   * @param max_age_us Longest time a track may go without a detection, in us
+   */
+  explicit Tracker(const UKFConfig &config = UKFConfig::Default(), int max_misses = 5,
+                   double cell_size = 4.0, long long max_age_us = 1000000);
+
+  /**
+   * Associates and filters one scan: detections of one sensor taken at the
+   * same time, later than those of the scan before.
+   */
+  void ProcessScan(const MeasurementPackage *detections, size_t count);
+
+  /**
+   * Runs the per-track work of every scan on pool, or on the calling thread
+   * if it is null. The pool is not owned.
+   */
+  void set_task_pool(TaskPool *pool) { task_pool_ = pool; }
+
+  ///* the live tracks
+  size_t size() const { return tracks_.size(); }
+  const TrackPool &pool() const { return pool_; }
+  const Track &track(size_t i) const { return *tracks_[i]; }
+
+  ///* the track each detection of the last scan updated or started
+  const std::vector<const Track *> &detection_tracks() const { return detection_tracks_; }
+
+  ///* detections of all scans assigned to an existing track, tracks
+  ///* started and tracks dropped
+  long long assigned() const { return assigned_; }
+  long long spawned() const { return spawned_; }
+  long long dropped() const { return dropped_; }
+
+private:
+  ///* a track's predicted measurement and gate in the current scan
+  struct Gate {
+    double p_x;
+    double p_y;
+    ///* bound on the gate around the predicted position
+    double radius;
+    int n_z;
+    double threshold;
+    double log_det;
+    Eigen::Vector3d z_pred;
+    Eigen::Matrix3d Si;
+  };
+
+  ///* a track (by slot) and a detection within its gate
+  struct Candidate {
+    int track;
+    int detection;
+    int cluster;
+    double cost;
+  };
+
+  const UKFConfig *config_;
+  TaskPool *task_pool_;
+  int max_misses_;
+  long long max_age_us_;
+  int next_id_;
+  TrackPool pool_;
+  std::vector<Track *> tracks_;
+  ///* the live track in each slot of the pool, or null
+  std::vector<Track *> slot_tracks_;
+  SpatialGrid grid_;
+  std::vector<const Track *> detection_tracks_;
+  long long assigned_;
+  long long spawned_;
+  long long dropped_;
+
+  ///* scratch of ProcessScan, kept at its largest size, by slot
+  std::vector<Gate> gates_;
+  std::vector<int> nearby_;
+  std::vector<Candidate> candidates_;
+  ///* union-find over slots, then detections, for the clusters
+  std::vector<int> parent_;
+  ///* index of a slot or detection within its cluster's cost matrix
+  std::vector<int> local_;
+  std::vector<int> cluster_tracks_;
+  std::vector<int> cluster_detections_;
+  std::vector<double> cost_;
+  std::vector<int> row_to_col_;
+  std::vector<int> detection_track_;
+  std::vector<char> updated_;
+  AssignmentSolver solver_;
+
+  ///* predicts track into the scan and fills its gate, from any thread
+  void PredictGate(Track &track, bool radar, MeasurementPackage::SensorType sensor, long long timestamp);
+
+  ///* gates the detections for every track into candidates_
+  void GateDetections(const MeasurementPackage *detections, size_t count);
+
+  ///* assigns within every cluster of candidates_ into detection_track_,
+  ///* the slot of each detection's track or -1
+  void Associate(size_t count);
+
+  int Find(int i);
+};
+
+#endif /* TRACKER_H_ */
@@ -76,8 +76,9 @@ ExtensionsParser::ExtensionsParser(const char *data, size_t length) {
 }
 
 template <bool isServer>
-ExtensionsNegotiator<isServer>::ExtensionsNegotiator(int wantedOptions) {
+ExtensionsNegotiator<isServer>::ExtensionsNegotiator(int wantedOptions, int serverWindowBits) {
     options = wantedOptions;
+    this->serverWindowBits = serverWindowBits;
 }
 
 template <bool isServer>
@@ -93,6 +94,10 @@ std::string ExtensionsNegotiator<isServer>::generateOffer() {
         if (options & Options::SERVER_NO_CONTEXT_TAKEOVER) {
             extensionsOffer += "; server_no_context_takeover";
         }
+
+        if (serverWindowBits < 15) {
+            extensionsOffer += "; server_max_window_bits=" + std::to_string(serverWindowBits);
+        }
     }
 
     return extensionsOffer;
@@ -107,10 +112,14 @@ void ExtensionsNegotiator<isServer>::readOffer(std::string offer) {
                 options |= CLIENT_NO_CONTEXT_TAKEOVER;
             }
 
-            if (extensionsParser.serverNoContextTakeover) {
+            // the server may always drop its own context, asked to or not
+            if (extensionsParser.serverNoContextTakeover || (options & SERVER_NO_CONTEXT_TAKEOVER)) {
                 options |= SERVER_NO_CONTEXT_TAKEOVER;
-            } else {
-                options &= ~SERVER_NO_CONTEXT_TAKEOVER;
+            }
+
+            // a smaller window than ours cannot be honoured by the shared streams
+            if (extensionsParser.serverMaxWindowBits > 1 && extensionsParser.serverMaxWindowBits < serverWindowBits) {
+                options &= ~PERMESSAGE_DEFLATE;
             }
         } else {
             options &= ~PERMESSAGE_DEFLATE;
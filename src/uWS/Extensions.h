@@ -10,15 +10,20 @@ enum Options : unsigned int {
     PERMESSAGE_DEFLATE = 1,
     SERVER_NO_CONTEXT_TAKEOVER = 2,
     CLIENT_NO_CONTEXT_TAKEOVER = 4,
-    NO_DELAY = 8
+    NO_DELAY = 8,
+    // keeps the deflate contexts between messages where the peer allows it,
+    // at the cost of a stream per connection
+    SLIDING_DEFLATE_WINDOW = 16
 };
 
 template <bool isServer>
 class ExtensionsNegotiator {
 private:
     int options;
+    int serverWindowBits;
 public:
-    ExtensionsNegotiator(int wantedOptions);
+    // serverWindowBits below 15 is announced as server_max_window_bits
+    ExtensionsNegotiator(int wantedOptions, int serverWindowBits = 15);
     std::string generateOffer();
     void readOffer(std::string offer);
     int getNegotiatedOptions();
@@ -1,5 +1,6 @@
 #include "Group.h"
 #include "Hub.h"
+#include <chrono>
 
 namespace uWS {
 
@@ -17,19 +18,28 @@ template <bool isServer>
 void Group<isServer>::timerCallback(uv_timer_t *timer) {
     Group<isServer> *group = (Group<isServer> *) timer->data;
 
-    group->forEach([](uWS::WebSocket<isServer> ws) {
-        typename uWS::WebSocket<isServer>::Data *webSocketData = (typename uWS::WebSocket<isServer>::Data *) ws.getSocketData();
-        if (webSocketData->hasOutstandingPong) {
+    // a round covers the WebSockets there are as it starts; those connecting
+    // meanwhile are added behind the cursor
+    if (!group->pingTick) {
+        group->pingCursor = group->webSockets.size();
+        group->pingSlice = (group->webSockets.size() + AUTO_PING_SLICES - 1) / AUTO_PING_SLICES;
+    }
+    group->pingTick = (group->pingTick + 1) % AUTO_PING_SLICES;
+
+    for (size_t visits = 0; visits < group->pingSlice && group->pingCursor; visits++) {
+        WebSocket<isServer> ws(group->webSockets.sockets[--group->pingCursor]);
+
+        typename WebSocket<isServer>::Data *webSocketData = (typename WebSocket<isServer>::Data *) ws.getSocketData();
+        if (!webSocketData->silent) {
+            // an active connection proves itself alive
+            webSocketData->silent = true;
+            webSocketData->pinged = false;
+        } else if (webSocketData->pinged) {
             ws.terminate();
         } else {
-            webSocketData->hasOutstandingPong = true;
+            webSocketData->pinged = true;
+            ws.sendPrepared(group->pingMessage);
         }
-    });
-
-    if (group->userPingMessage.length()) {
-        group->broadcast(group->userPingMessage.data(), group->userPingMessage.length(), OpCode::TEXT);
-    } else {
-        group->broadcast(nullptr, 0, OpCode::PING);
     }
 }
 
@@ -38,111 +48,91 @@ void Group<isServer>::startAutoPing(int intervalMs, std::string userMessage) {
     timer = new uv_timer_t;
     uv_timer_init(loop, timer);
     timer->data = this;
-    uv_timer_start(timer, timerCallback, intervalMs, intervalMs);
+    int tickMs = std::max(1, intervalMs / AUTO_PING_SLICES);
+    uv_timer_start(timer, timerCallback, tickMs, tickMs);
     userPingMessage = userMessage;
+    if (pingMessage) {
+        WebSocket<isServer>::finalizeMessage(pingMessage);
+    }
+    pingMessage = WebSocket<isServer>::prepareMessage((char *) userPingMessage.data(), userPingMessage.length(),
+                                                      userPingMessage.length() ? OpCode::TEXT : OpCode::PING, false);
 }
 
-// WIP
 template <bool isServer>
 void Group<isServer>::addHttpSocket(uv_poll_t *httpSocket) {
-
-    // always clear last chain!
-    ((uS::SocketData *) httpSocket->data)->next = nullptr;
-    ((uS::SocketData *) httpSocket->data)->prev = nullptr;
-
-    if (httpSocketHead) {
-        uS::SocketData *nextData = (uS::SocketData *) httpSocketHead->data;
-        nextData->prev = httpSocket;
-        uS::SocketData *data = (uS::SocketData *) httpSocket->data;
-        data->next = httpSocketHead;
-    } else {
+    if (httpSockets.empty()) {
         httpTimer = new uv_timer_t;
         uv_timer_init(hub->getLoop(), httpTimer);
         httpTimer->data = this;
         uv_timer_start(httpTimer, [](uv_timer_t *httpTimer) {
             Group<isServer> *group = (Group<isServer> *) httpTimer->data;
-            group->forEachHttpSocket([](HttpSocket<isServer> httpSocket) {
-                if (httpSocket.getData()->missedDeadline) {
+            group->forEachHttpSocket([group](HttpSocket<isServer> httpSocket) {
+                typename HttpSocket<isServer>::Data *httpData = httpSocket.getData();
+                if (httpData->outstandingResponsesHead) {
+                    httpData->idleTicks = 0;
+                } else if (++httpData->idleTicks > (httpData->keepAlive ? group->httpKeepAlive : 1)) {
                     // recursive? don't think so!
                     httpSocket.terminate();
-                } else if (!httpSocket.getData()->outstandingResponsesHead) {
-                    httpSocket.getData()->missedDeadline = true;
                 }
             });
         }, 1000, 1000);
     }
-    httpSocketHead = httpSocket;
+    httpSockets.add(httpSocket);
+    httpSocketCount++;
 }
 
-// WIP
 template <bool isServer>
 void Group<isServer>::removeHttpSocket(uv_poll_t *httpSocket) {
-    uS::SocketData *socketData = (uS::SocketData *) httpSocket->data;
-    if (iterators.size()) {
-        iterators.top() = socketData->next;
+    httpSockets.remove(httpSocket);
+    httpSocketCount--;
+    for (size_t i = 0; i < deferredSockets.size(); i++) {
+        if (deferredSockets[i].first == httpSocket) {
+            deferredSockets.erase(deferredSockets.begin() + i);
+            break;
+        }
     }
-    if (socketData->prev == socketData->next) {
-        httpSocketHead = (uv_poll_t *) nullptr;
-
+    if (httpSockets.empty()) {
         uv_timer_stop(httpTimer);
         uv_close(httpTimer, [](uv_handle_t *handle) {
             delete (uv_timer_t *) handle;
         });
-
-    } else {
-        if (socketData->prev) {
-            ((uS::SocketData *) socketData->prev->data)->next = socketData->next;
-        } else {
-            httpSocketHead = socketData->next;
-        }
-        if (socketData->next) {
-            ((uS::SocketData *) socketData->next->data)->prev = socketData->prev;
-        }
     }
 }
 
 template <bool isServer>
 void Group<isServer>::addWebSocket(uv_poll_t *webSocket) {
-
-    // always clear last chain!
-    ((uS::SocketData *) webSocket->data)->next = nullptr;
-    ((uS::SocketData *) webSocket->data)->prev = nullptr;
-
-    if (webSocketHead) {
-        uS::SocketData *nextData = (uS::SocketData *) webSocketHead->data;
-        nextData->prev = webSocket;
-        uS::SocketData *data = (uS::SocketData *) webSocket->data;
-        data->next = webSocketHead;
-    }
-    webSocketHead = webSocket;
+    webSockets.add(webSocket);
+    webSocketCount++;
 }
 
 template <bool isServer>
 void Group<isServer>::removeWebSocket(uv_poll_t *webSocket) {
+    if (!subscriptions.empty()) {
+        unsubscribeAll(webSocket);
+    }
+
     uS::SocketData *socketData = (uS::SocketData *) webSocket->data;
-    if (iterators.size()) {
-        iterators.top() = socketData->next;
+    // a closing WebSocket reads the peer's close, and one handed to another
+    // loop goes on there unlimited by this group's timer
+    if (socketData->readPaused) {
+        resumeReading(webSocket);
     }
-    if (socketData->prev == socketData->next) {
-        webSocketHead = (uv_poll_t *) nullptr;
-    } else {
-        if (socketData->prev) {
-            ((uS::SocketData *) socketData->prev->data)->next = socketData->next;
-        } else {
-            webSocketHead = socketData->next;
-        }
-        if (socketData->next) {
-            ((uS::SocketData *) socketData->next->data)->prev = socketData->prev;
-        }
+    // what it holds is sent by close or transfer, or lost with the socket
+    if (((typename WebSocket<isServer>::Data *) socketData)->batched) {
+        releaseBatch(webSocket);
     }
+    webSockets.remove(webSocket);
+    webSocketCount--;
 }
 
 template <bool isServer>
 Group<isServer>::Group(int extensionOptions, Hub *hub, uS::NodeData *nodeData) : uS::NodeData(*nodeData), hub(hub), extensionOptions(extensionOptions) {
+    webSockets.cursors.push_back(&pingCursor);
     connectionHandler = [](WebSocket<isServer>, HttpRequest) {};
     messageHandler = [](WebSocket<isServer>, char *, size_t, OpCode) {};
     disconnectionHandler = [](WebSocket<isServer>, int, char *, size_t) {};
     pingHandler = pongHandler = [](WebSocket<isServer>, char *, size_t) {};
+    transferHandler = [](WebSocket<isServer>) {};
     errorHandler = [](errorType) {};
     httpRequestHandler = [](HttpResponse *, HttpRequest, char *, size_t, size_t) {};
     httpConnectionHandler = [](HttpSocket<isServer>) {};
@@ -150,14 +140,18 @@ Group<isServer>::Group(int extensionOptions, Hub *hub, uS::NodeData *nodeData) :
     httpCancelledRequestHandler = [](HttpResponse *) {};
     httpDataHandler = [](HttpResponse *, char *, size_t, size_t) {};
 
-    this->extensionOptions |= CLIENT_NO_CONTEXT_TAKEOVER | SERVER_NO_CONTEXT_TAKEOVER;
+    if (!(extensionOptions & SLIDING_DEFLATE_WINDOW)) {
+        this->extensionOptions |= CLIENT_NO_CONTEXT_TAKEOVER | SERVER_NO_CONTEXT_TAKEOVER;
+    }
 }
 
 template <bool isServer>
-void Group<isServer>::stopListening() {
+void Group<isServer>::stopAccepting() {
     if (isServer) {
         uS::ListenData *listenData = (uS::ListenData *) user;
-        if (listenData) {
+        user = nullptr;
+        while (listenData) {
+            uS::ListenData *next = listenData->next;
             if (listenData->listenPoll)
                 uS::Socket(listenData->listenPoll).close();
             else if (listenData->listenTimer) {
@@ -175,14 +169,58 @@ void Group<isServer>::stopListening() {
                 });
             }
             delete listenData;
+            listenData = next;
         }
     }
+}
+
+template <bool isServer>
+void Group<isServer>::stopListening() {
+    stopAccepting();
 
     if (async) {
         uv_close(async, [](uv_handle_t *h) {
             delete (uv_async_t *) h;
         });
     }
+
+    // messages still queued keep references of their own
+    for (auto &constant : constantMessages) {
+        WebSocket<isServer>::finalizeMessage(constant.second);
+    }
+    constantMessages.clear();
+
+    if (rateLimitTimer) {
+        uv_timer_stop(rateLimitTimer);
+        uv_close(rateLimitTimer, [](uv_handle_t *h) {
+            delete (uv_timer_t *) h;
+        });
+        rateLimitTimer = nullptr;
+    }
+
+    if (batchTimer) {
+        uv_timer_stop(batchTimer);
+        uv_close(batchTimer, [](uv_handle_t *h) {
+            delete (uv_timer_t *) h;
+        });
+        batchTimer = nullptr;
+    }
+
+    if (admissionTimer) {
+        uv_timer_stop(admissionTimer);
+        uv_close(admissionTimer, [](uv_handle_t *h) {
+            delete (uv_timer_t *) h;
+        });
+        admissionTimer = nullptr;
+    }
+
+    if (topicFlusher) {
+        uv_idle_stop(topicFlusher);
+        uv_close(topicFlusher, [](uv_handle_t *h) {
+            delete (uv_idle_t *) h;
+        });
+        topicFlusher = nullptr;
+    }
 }
 
 template <bool isServer>
@@ -193,6 +231,7 @@ void Group<isServer>::onConnection(std::function<void (WebSocket<isServer>, Http
 template <bool isServer>
 void Group<isServer>::onMessage(std::function<void (WebSocket<isServer>, char *, size_t, OpCode)> handler) {
     messageHandler = handler;
+    boundMessageHandler = nullptr;
 }
 
 template <bool isServer>
@@ -210,6 +249,11 @@ void Group<isServer>::onPong(std::function<void (WebSocket<isServer>, char *, si
     pongHandler = handler;
 }
 
+template <bool isServer>
+void Group<isServer>::onTransfer(std::function<void (WebSocket<isServer>)> handler) {
+    transferHandler = handler;
+}
+
 template <bool isServer>
 void Group<isServer>::onError(std::function<void (typename Group::errorType)> handler) {
     errorHandler = handler;
@@ -245,6 +289,303 @@ void Group<isServer>::onHttpUpgrade(std::function<void(HttpSocket<isServer>, Htt
     httpUpgradeHandler = handler;
 }
 
+template <bool isServer>
+void Group<isServer>::setBackpressure(size_t highWatermark, Backpressure policy) {
+    this->highWatermark = highWatermark;
+    backpressurePolicy = policy;
+}
+
+template <bool isServer>
+void Group<isServer>::onBackpressure(std::function<void(WebSocket<isServer>, size_t)> handler) {
+    backpressureHandler = handler;
+}
+
+template <bool isServer>
+void Group<isServer>::setRateLimit(double messagesPerSecond, double bytesPerSecond, RateLimitAction action, double burstSeconds) {
+    messageRate = messagesPerSecond;
+    byteRate = bytesPerSecond;
+    rateLimitAction = action;
+    rateBurst = burstSeconds;
+}
+
+template <bool isServer>
+void Group<isServer>::setBulkLength(size_t bulkLength) {
+    this->bulkLength = bulkLength;
+}
+
+template <bool isServer>
+void Group<isServer>::setCompressionThreshold(size_t minLength, double minSavings, double maxNanosPerSavedByte) {
+    deflateMinLength = minLength;
+    deflateMinSavings = (float) minSavings;
+    deflateMaxNanos = (float) maxNanosPerSavedByte;
+}
+
+template <bool isServer>
+void Group<isServer>::setAdmission(size_t maxConnections, double maxBusy, Admission action) {
+    admissionConnections = maxConnections;
+    admissionBusy = (float) maxBusy;
+    admissionAction = action;
+}
+
+template <bool isServer>
+bool Group<isServer>::admits() {
+    if (admissionConnections && getWebSocketCount() + getHttpSocketCount() - deferredSockets.size() >= admissionConnections) {
+        return false;
+    }
+#if defined(USE_MICRO_UV) || UV_VERSION_HEX >= 0x012d00
+    if (admissionBusy > 0) {
+        // measured at most once a window, over the time since it last was
+        uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (now - busySampled >= ADMISSION_WINDOW_MS * 1000000ull) {
+            uint64_t idle = uv_metrics_idle_time(loop);
+            if (busySampled) {
+                loopBusy = 1 - (float) (idle - idleSampled) / (now - busySampled);
+            }
+            busySampled = now;
+            idleSampled = idle;
+        }
+        return loopBusy <= admissionBusy;
+    }
+#endif
+    return true;
+}
+
+// a connection not admitted is one accepted from the queue all the same,
+// so that it learns of it rather than waiting on its SYN to time out
+template <bool isServer>
+bool Group<isServer>::admitConnection(uv_poll_t *socket) {
+    if (!admissionLimited() || admits()) {
+        return true;
+    }
+
+    uS::SocketData *socketData = (uS::SocketData *) socket->data;
+    if (admissionAction == REJECT_CONNECTION) {
+        rejectConnection(socket);
+        uS::Socket(socket).close();
+        return false;
+    }
+
+    // taken up unread, as the HttpSocket copies these over
+    socketData->readPaused = true;
+    socketData->poll = 0;
+    deferredSockets.push_back(std::make_pair(socket, uv_now(loop) + ADMISSION_WAIT_MS));
+    acceptCounters->add(acceptCounters->deferred, 1);
+    if (!admissionTimer) {
+        admissionTimer = new uv_timer_t;
+        uv_timer_init(loop, admissionTimer);
+        admissionTimer->data = this;
+    }
+    if (deferredSockets.size() == 1) {
+        uv_timer_start(admissionTimer, admissionCallback, ADMISSION_WINDOW_MS, ADMISSION_WINDOW_MS);
+    }
+    return true;
+}
+
+// a plain connection is told with one send, into the empty socket buffer
+// of a connection just made; a TLS one has no session to tell it in yet
+template <bool isServer>
+void Group<isServer>::rejectConnection(uv_poll_t *socket) {
+    static const char response[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    uS::Socket s(socket);
+    if (!s.getSocketData()->ssl) {
+        ::send(s.getFd(), response, sizeof(response) - 1, MSG_NOSIGNAL);
+    }
+    acceptCounters->add(acceptCounters->rejected, 1);
+}
+
+// admits the deferred connections in order while the loop is within its
+// limits, and rejects those that waited ADMISSION_WAIT_MS
+template <bool isServer>
+void Group<isServer>::admissionCallback(uv_timer_t *timer) {
+    Group<isServer> *group = (Group<isServer> *) timer->data;
+    uint64_t now = uv_now(group->loop);
+    while (!group->deferredSockets.empty()) {
+        uv_poll_t *httpSocket = group->deferredSockets.front().first;
+        if (group->admits()) {
+            group->deferredSockets.erase(group->deferredSockets.begin());
+            HttpSocket<isServer>(httpSocket).getData()->idleTicks = 0;
+            uS::Socket(httpSocket).resumeReading();
+        } else if (group->deferredSockets.front().second <= now) {
+            group->rejectConnection(httpSocket);
+            // takes it off the list
+            HttpSocket<isServer>(httpSocket).terminate();
+        } else {
+            break;
+        }
+    }
+    // the rest wait on, and the HTTP timer is not to end them meanwhile
+    for (auto &deferred : group->deferredSockets) {
+        HttpSocket<isServer>(deferred.first).getData()->idleTicks = 0;
+    }
+    if (group->deferredSockets.empty()) {
+        uv_timer_stop(timer);
+    }
+}
+
+template <bool isServer>
+void Group<isServer>::setSendBatching(int budgetMicros, size_t flushBytes) {
+    batchMicros = budgetMicros;
+    batchBytes = flushBytes;
+}
+
+template <bool isServer>
+void Group<isServer>::onRateLimit(std::function<void(WebSocket<isServer>, RateLimit)> handler) {
+    rateLimitHandler = handler;
+}
+
+template <bool isServer>
+void Group<isServer>::refillBuckets(typename WebSocket<isServer>::Data *webSocketData) {
+    uint64_t now = uv_now(loop);
+    if (!webSocketData->rateStarted) {
+        webSocketData->rateStarted = true;
+        webSocketData->messageTokens = messageRate * rateBurst;
+        webSocketData->byteTokens = byteRate * rateBurst;
+    } else if (now > webSocketData->rateRefilled) {
+        double seconds = (now - webSocketData->rateRefilled) / 1000.0;
+        webSocketData->messageTokens = std::min(messageRate * rateBurst, webSocketData->messageTokens + messageRate * seconds);
+        webSocketData->byteTokens = std::min(byteRate * rateBurst, webSocketData->byteTokens + byteRate * seconds);
+    }
+    webSocketData->rateRefilled = now;
+}
+
+template <bool isServer>
+bool Group<isServer>::admitMessage(uv_poll_t *webSocket, size_t length) {
+    typename WebSocket<isServer>::Data *webSocketData = (typename WebSocket<isServer>::Data *) webSocket->data;
+    refillBuckets(webSocketData);
+    webSocketData->messageTokens -= 1;
+    webSocketData->byteTokens -= length;
+
+    RateLimit limit;
+    if (messageRate > 0 && webSocketData->messageTokens < 0) {
+        limit = MESSAGE_RATE;
+    } else if (byteRate > 0 && webSocketData->byteTokens < 0) {
+        limit = BYTE_RATE;
+    } else {
+        return true;
+    }
+
+    uS::Socket s(webSocket);
+    if (rateLimitHandler) {
+        rateLimitHandler(WebSocket<isServer>(webSocket), limit);
+        if (s.isClosed() || s.isShuttingDown()) {
+            return false;
+        }
+    }
+
+    switch (rateLimitAction) {
+    case PAUSE_READING:
+        if (!s.isReadingPaused()) {
+            s.pauseReading();
+            pausedWebSockets.push_back(webSocket);
+            if (!rateLimitTimer) {
+                rateLimitTimer = new uv_timer_t;
+                uv_timer_init(loop, rateLimitTimer);
+                rateLimitTimer->data = this;
+            }
+            if (pausedWebSockets.size() == 1) {
+                uv_timer_start(rateLimitTimer, rateLimitCallback, RATE_LIMIT_TICK_MS, RATE_LIMIT_TICK_MS);
+            }
+        }
+        return true;
+    case DISCONNECT_SENDER:
+        WebSocket<isServer>(webSocket).close(1008);
+        return false;
+    default:
+        webSocketData->messageTokens += 1;
+        webSocketData->byteTokens += length;
+        return false;
+    }
+}
+
+template <bool isServer>
+void Group<isServer>::rateLimitCallback(uv_timer_t *timer) {
+    Group<isServer> *group = (Group<isServer> *) timer->data;
+    for (size_t i = 0; i < group->pausedWebSockets.size(); ) {
+        uv_poll_t *webSocket = group->pausedWebSockets[i];
+        typename WebSocket<isServer>::Data *webSocketData = (typename WebSocket<isServer>::Data *) webSocket->data;
+        group->refillBuckets(webSocketData);
+        if (webSocketData->messageTokens >= 0 && webSocketData->byteTokens >= 0) {
+            // takes it off the list, in its place
+            group->resumeReading(webSocket);
+        } else {
+            i++;
+        }
+    }
+}
+
+// in us of the steady clock, finer than the loop's
+static uint64_t batchClock() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <bool isServer>
+void Group<isServer>::holdBatch(uv_poll_t *webSocket, int budgetMicros) {
+    typename WebSocket<isServer>::Data *webSocketData = (typename WebSocket<isServer>::Data *) webSocket->data;
+    webSocketData->batched = true;
+    webSocketData->batchDeadline = batchClock() + budgetMicros;
+    batchedWebSockets.push_back(webSocket);
+    if (!batchTimer) {
+        batchTimer = new uv_timer_t;
+        uv_timer_init(loop, batchTimer);
+        batchTimer->data = this;
+    }
+    if (batchedWebSockets.size() == 1) {
+        uv_timer_start(batchTimer, batchCallback, BATCH_TICK_MS, BATCH_TICK_MS);
+    }
+}
+
+template <bool isServer>
+void Group<isServer>::batchCallback(uv_timer_t *timer) {
+    Group<isServer> *group = (Group<isServer> *) timer->data;
+    // one due before the next tick goes now rather than a tick late
+    uint64_t due = batchClock() + BATCH_TICK_MS * 1000;
+    for (size_t i = 0; i < group->batchedWebSockets.size(); ) {
+        uv_poll_t *webSocket = group->batchedWebSockets[i];
+        if (((typename WebSocket<isServer>::Data *) webSocket->data)->batchDeadline < due) {
+            // takes it off the list, in its place
+            group->flushBatch(webSocket);
+        } else {
+            i++;
+        }
+    }
+}
+
+template <bool isServer>
+void Group<isServer>::releaseBatch(uv_poll_t *webSocket) {
+    ((typename WebSocket<isServer>::Data *) webSocket->data)->batched = false;
+    batchedWebSockets.erase(std::find(batchedWebSockets.begin(), batchedWebSockets.end(), webSocket));
+    if (batchedWebSockets.empty()) {
+        uv_timer_stop(batchTimer);
+    }
+}
+
+template <bool isServer>
+void Group<isServer>::flushBatch(uv_poll_t *webSocket) {
+    releaseBatch(webSocket);
+    uS::Socket(webSocket).uncorkWrites();
+}
+
+template <bool isServer>
+void Group<isServer>::resumeReading(uv_poll_t *webSocket) {
+    pausedWebSockets.erase(std::find(pausedWebSockets.begin(), pausedWebSockets.end(), webSocket));
+    uS::Socket(webSocket).resumeReading();
+    if (pausedWebSockets.empty()) {
+        uv_timer_stop(rateLimitTimer);
+    }
+}
+
+template <bool isServer>
+typename WebSocket<isServer>::PreparedMessage *Group<isServer>::prepareConstant(const char *data, size_t length, OpCode opCode) {
+    for (auto &constant : constantMessages) {
+        if (constant.first == data) {
+            return constant.second;
+        }
+    }
+    typename WebSocket<isServer>::PreparedMessage *preparedMessage = WebSocket<isServer>::prepareMessage((char *) data, length, opCode, false);
+    constantMessages.push_back(std::make_pair(data, preparedMessage));
+    return preparedMessage;
+}
+
 template <bool isServer>
 void Group<isServer>::broadcast(const char *message, size_t length, OpCode opCode) {
     typename WebSocket<isServer>::PreparedMessage *preparedMessage = WebSocket<isServer>::prepareMessage((char *) message, length, opCode, false);
@@ -254,6 +595,133 @@ void Group<isServer>::broadcast(const char *message, size_t length, OpCode opCod
     WebSocket<isServer>::finalizeMessage(preparedMessage);
 }
 
+template <bool isServer>
+void Group<isServer>::subscribe(WebSocket<isServer> webSocket, const std::string &topic) {
+    Topic *subscribed = &topics[topic];
+    subscribed->name = topic;
+
+    std::vector<Topic *> &socketTopics = subscriptions[webSocket.getPollHandle()];
+    if (std::find(socketTopics.begin(), socketTopics.end(), subscribed) == socketTopics.end()) {
+        socketTopics.push_back(subscribed);
+        subscribed->subscribers.push_back(webSocket.getPollHandle());
+        subscribeCount++;
+    }
+}
+
+template <bool isServer>
+void Group<isServer>::unsubscribe(WebSocket<isServer> webSocket, const std::string &topic) {
+    typename std::unordered_map<std::string, Topic>::iterator subscribed = topics.find(topic);
+    typename std::unordered_map<uv_poll_t *, std::vector<Topic *>>::iterator socketTopics = subscriptions.find(webSocket.getPollHandle());
+    if (subscribed == topics.end() || socketTopics == subscriptions.end()) {
+        return;
+    }
+
+    std::vector<Topic *> &list = socketTopics->second;
+    typename std::vector<Topic *>::iterator it = std::find(list.begin(), list.end(), &subscribed->second);
+    if (it != list.end()) {
+        list.erase(it);
+        if (list.empty()) {
+            subscriptions.erase(socketTopics);
+        }
+        removeSubscriber(&subscribed->second, webSocket.getPollHandle());
+    }
+}
+
+template <bool isServer>
+void Group<isServer>::unsubscribeAll(uv_poll_t *webSocket) {
+    typename std::unordered_map<uv_poll_t *, std::vector<Topic *>>::iterator socketTopics = subscriptions.find(webSocket);
+    if (socketTopics == subscriptions.end()) {
+        return;
+    }
+
+    for (Topic *topic : socketTopics->second) {
+        removeSubscriber(topic, webSocket);
+    }
+    subscriptions.erase(socketTopics);
+}
+
+template <bool isServer>
+void Group<isServer>::removeSubscriber(Topic *topic, uv_poll_t *webSocket) {
+    std::vector<uv_poll_t *> &subscribers = topic->subscribers;
+    subscribers.erase(std::find(subscribers.begin(), subscribers.end(), webSocket));
+
+    // a topic with publications pending goes away in the next flush
+    if (subscribers.empty() && topic->pending.empty()) {
+        topics.erase(topics.find(topic->name));
+    }
+}
+
+template <bool isServer>
+void Group<isServer>::publish(const std::string &topic, const char *message, size_t length, OpCode opCode) {
+    typename std::unordered_map<std::string, Topic>::iterator published = topics.find(topic);
+    if (published == topics.end()) {
+        return;
+    }
+
+    Topic *pending = &published->second;
+    if (pending->pending.empty()) {
+        if (pendingTopics.empty()) {
+            if (!topicFlusher) {
+                topicFlusher = new uv_idle_t;
+                topicFlusher->data = this;
+                uv_idle_init(loop, topicFlusher);
+            }
+            uv_idle_start(topicFlusher, [](uv_idle_t *topicFlusher) {
+                ((Group<isServer> *) topicFlusher->data)->flushTopics();
+            });
+        }
+        pendingTopics.push_back(pending);
+    }
+
+    std::string &buffer = pending->pending;
+    size_t offset = buffer.length();
+    buffer.resize(offset + length + WebSocketProtocol<!isServer>::LONG_MESSAGE_HEADER);
+    buffer.resize(offset + WebSocketProtocol<isServer>::formatMessage(&buffer[offset], message, length, opCode, length, false));
+}
+
+template <bool isServer>
+void Group<isServer>::flushTopics() {
+    // buffers that grew for a burst are not kept around
+    static const size_t MAX_KEPT_PENDING = 64 * 1024;
+
+    if (topicFlusher) {
+        uv_idle_stop(topicFlusher);
+    }
+
+    std::vector<Topic *> flushed;
+    flushed.swap(pendingTopics);
+    for (Topic *topic : flushed) {
+        if (!topic->subscribers.empty()) {
+            typename WebSocket<isServer>::PreparedMessage *preparedMessage = new typename WebSocket<isServer>::PreparedMessage;
+            preparedMessage->buffer = new char[topic->pending.length()];
+            memcpy(preparedMessage->buffer, topic->pending.data(), topic->pending.length());
+            preparedMessage->length = topic->pending.length();
+            preparedMessage->references = 1;
+            preparedMessage->callback = nullptr;
+            preparedMessage->stateKey = topic;
+            // a subscriber closed for backpressure leaves the list meanwhile
+            for (size_t i = 0; i < topic->subscribers.size(); ) {
+                uv_poll_t *subscriber = topic->subscribers[i];
+                WebSocket<isServer>(subscriber).sendPrepared(preparedMessage);
+                if (i < topic->subscribers.size() && topic->subscribers[i] == subscriber) {
+                    i++;
+                }
+            }
+            WebSocket<isServer>::finalizeMessage(preparedMessage);
+        }
+
+        if (topic->pending.capacity() > MAX_KEPT_PENDING) {
+            std::string().swap(topic->pending);
+        } else {
+            topic->pending.clear();
+        }
+
+        if (topic->subscribers.empty()) {
+            topics.erase(topics.find(topic->name));
+        }
+    }
+}
+
 template <bool isServer>
 void Group<isServer>::terminate() {
     forEach([](uWS::WebSocket<isServer> ws) {
@@ -273,6 +741,8 @@ void Group<isServer>::close(int code, char *message, size_t length) {
         uv_close(timer, [](uv_handle_t *handle) {
             delete (uv_timer_t *) handle;
         });
+        WebSocket<isServer>::finalizeMessage(pingMessage);
+        pingMessage = nullptr;
     }
 }
 
@@ -4,21 +4,93 @@
 #include "WebSocket.h"
 #include "HTTPSocket.h"
 #include "Extensions.h"
+#include <atomic>
 #include <functional>
-#include <stack>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace uWS {
 
 struct Hub;
 
+// the sockets of one kind in a group, one after another in an array, so a
+// walk over them reads the handles in order instead of chasing a list
+// through the sockets' own data. A removed socket's place is taken by
+// another from further back. Walks may remove any socket as they go: each
+// walk runs from the back and keeps a cursor, all before it still to be
+// visited, and a removal hands down the sockets so that every cursor's
+// unvisited ones stay before it. Sockets added meanwhile go behind all
+// cursors, so the walks in progress do not visit them
+struct SocketList {
+    std::vector<uv_poll_t *> sockets;
+    std::vector<size_t *> cursors;
+
+    size_t size() const {return sockets.size();}
+    bool empty() const {return sockets.empty();}
+
+    void add(uv_poll_t *p) {
+        ((uS::SocketData *) p->data)->groupIndex = sockets.size();
+        sockets.push_back(p);
+    }
+
+    void remove(uv_poll_t *p) {
+        size_t hole = ((uS::SocketData *) p->data)->groupIndex;
+        // the nearest cursor past the hole fills it with its last unvisited
+        // socket, which leaves the hole before the next cursor
+        while (true) {
+            size_t *nearest = nullptr;
+            for (size_t *cursor : cursors) {
+                if (*cursor > hole && (!nearest || *cursor < *nearest)) {
+                    nearest = cursor;
+                }
+            }
+            if (!nearest) {
+                break;
+            }
+            move(--*nearest, hole);
+            hole = *nearest;
+        }
+        move(sockets.size() - 1, hole);
+        sockets.pop_back();
+    }
+
+    // calls cb with every socket there is as it starts, newest first
+    template <class F>
+    void forEach(const F &cb) {
+        size_t cursor = sockets.size();
+        cursors.push_back(&cursor);
+        while (cursor) {
+            cb(sockets[--cursor]);
+        }
+        cursors.pop_back();
+    }
+
+private:
+    // the socket at from, which may be the hole itself, goes to the hole
+    void move(size_t from, size_t to) {
+        if (from != to) {
+            sockets[to] = sockets[from];
+            ((uS::SocketData *) sockets[to]->data)->groupIndex = to;
+        }
+    }
+};
+
 template <bool isServer>
 struct WIN32_EXPORT Group : uS::NodeData {
     friend struct Hub;
+    friend struct HubPool;
     std::function<void(WebSocket<isServer>, HttpRequest)> connectionHandler;
     std::function<void(WebSocket<isServer>, char *message, size_t length, OpCode opCode)> messageHandler;
+    // the message handler bound at compile time by onMessage<T, handler>,
+    // which takes the place of messageHandler: a plain function that calls
+    // handler on its object, inlined into it
+    void (*boundMessageHandler)(void *object, WebSocket<isServer>, char *message, size_t length, OpCode opCode) = nullptr;
+    void *boundMessageObject = nullptr;
     std::function<void(WebSocket<isServer>, int code, char *message, size_t length)> disconnectionHandler;
     std::function<void(WebSocket<isServer>, char *, size_t)> pingHandler;
     std::function<void(WebSocket<isServer>, char *, size_t)> pongHandler;
+    std::function<void(WebSocket<isServer>)> transferHandler;
 
     std::function<void(HttpSocket<isServer>)> httpConnectionHandler;
     std::function<void(HttpResponse *, HttpRequest, char *, size_t, size_t)> httpRequestHandler;
@@ -35,6 +107,17 @@ struct WIN32_EXPORT Group : uS::NodeData {
     int extensionOptions;
     uv_timer_t *timer = nullptr;
     std::string userPingMessage;
+    // the ping the timer sends, framed once: userPingMessage, or an empty
+    // PING without one
+    typename WebSocket<isServer>::PreparedMessage *pingMessage = nullptr;
+    // auto-ping goes round the WebSockets once per interval of
+    // AUTO_PING_SLICES ticks, a slice of them per tick down from pingCursor,
+    // a cursor of webSockets, pinging those that have been silent for a
+    // round and terminating those still silent the round after
+    static const int AUTO_PING_SLICES = 16;
+    size_t pingCursor = 0;
+    size_t pingSlice = 0;
+    int pingTick = 0;
 
     // todo: cannot be named user, collides with parent!
     void *userData = nullptr;
@@ -43,16 +126,157 @@ struct WIN32_EXPORT Group : uS::NodeData {
     void startAutoPing(int intervalMs, std::string userMessage = "");
     static void timerCallback(uv_timer_t *timer);
 
-    uv_poll_t *webSocketHead = nullptr, *httpSocketHead = nullptr;
+    SocketList webSockets, httpSockets;
     void addWebSocket(uv_poll_t *webSocket);
     void removeWebSocket(uv_poll_t *webSocket);
 
     uv_timer_t *httpTimer = nullptr;
+    // seconds an answered connection may wait for its next request; one
+    // that has sent none is ended after a second or two
+    unsigned int httpKeepAlive = 10;
     void addHttpSocket(uv_poll_t *httpSocket);
     void removeHttpSocket(uv_poll_t *httpSocket);
 
+    // the sockets in the lists, counted by the loop's thread and read from any
+    std::atomic<size_t> webSocketCount{0}, httpSocketCount{0};
+    size_t getWebSocketCount() const {return webSocketCount.load(std::memory_order_relaxed);}
+    size_t getHttpSocketCount() const {return httpSocketCount.load(std::memory_order_relaxed);}
+
+    // publish/subscribe: publications are framed into their topic's pending
+    // buffer and go out once per loop iteration, as one prepared message per
+    // topic shared by all of its subscribers
+    struct Topic {
+        std::string name;
+        std::vector<uv_poll_t *> subscribers;
+        std::string pending;
+    };
+    // by value: the map's nodes stay put, so topics are referred to by address
+    std::unordered_map<std::string, Topic> topics;
+    std::unordered_map<uv_poll_t *, std::vector<Topic *>> subscriptions;
+    std::vector<Topic *> pendingTopics;
+    uv_idle_t *topicFlusher = nullptr;
+    unsigned long long subscribeCount = 0;
+    void unsubscribeAll(uv_poll_t *webSocket);
+
+    // the messages of prepareConstant by the address of their payload; the
+    // group holds a reference to each until it stops listening
+    std::vector<std::pair<const char *, typename WebSocket<isServer>::PreparedMessage *>> constantMessages;
+    void removeSubscriber(Topic *topic, uv_poll_t *webSocket);
+
+    // what happens when a data message is sent on a WebSocket with more than
+    // the high watermark queued; state messages are those of sendState and
+    // the topic publications, keyed by their topic
+    enum Backpressure {
+        // queue it anyway
+        BUFFER,
+        // drop queued state messages, oldest first, down to the watermark
+        DROP_OLDEST,
+        // drop the queued state messages with the new message's key, so only
+        // the latest state of each waits
+        COALESCE_LATEST,
+        // close the WebSocket with 1008 instead
+        DISCONNECT
+    };
+    size_t highWatermark = 0;
+    Backpressure backpressurePolicy = BUFFER;
+    std::function<void(WebSocket<isServer>, size_t bufferedAmount)> backpressureHandler;
 
-    std::stack<uv_poll_t *> iterators;
+    // what happens to a message that comes in past a WebSocket's rate limit,
+    // a token bucket each on its messages and bytes a second
+    enum RateLimitAction {
+        // discard it unread; it is not charged
+        DROP_MESSAGE,
+        // take it, and stop reading the socket until the buckets have
+        // refilled what it overdrew
+        PAUSE_READING,
+        // close the WebSocket with 1008 instead
+        DISCONNECT_SENDER
+    };
+    // which of the limits a message went past
+    enum RateLimit {
+        MESSAGE_RATE,
+        BYTE_RATE
+    };
+    double messageRate = 0, byteRate = 0, rateBurst = 1;
+    RateLimitAction rateLimitAction = DROP_MESSAGE;
+    std::function<void(WebSocket<isServer>, RateLimit limit)> rateLimitHandler;
+    // the WebSockets paused by PAUSE_READING, which the timer checks on
+    // every RATE_LIMIT_TICK_MS while there are any
+    static const int RATE_LIMIT_TICK_MS = 10;
+    std::vector<uv_poll_t *> pausedWebSockets;
+    uv_timer_t *rateLimitTimer = nullptr;
+    static void rateLimitCallback(uv_timer_t *timer);
+    void refillBuckets(typename WebSocket<isServer>::Data *webSocketData);
+    void resumeReading(uv_poll_t *webSocket);
+    // charges a complete message of length bytes, as it came off the wire,
+    // to the WebSocket's buckets before it is inflated or handled; false if
+    // it is not to be handled, dropped or with the WebSocket closed
+    bool admitMessage(uv_poll_t *webSocket, size_t length);
+    bool rateLimited() const {return messageRate > 0 || byteRate > 0;}
+
+    // what happens to a connection accepted while the loop is past its
+    // admission limits (see setAdmission), before a TLS handshake or a byte
+    // of its request is read
+    enum Admission {
+        // hold it unread until the loop is within the limits again, for up
+        // to ADMISSION_WAIT_MS, then reject it
+        DEFER_CONNECTION,
+        // reject it right away: a plain connection is answered 503 with a
+        // Retry-After, a TLS one just closed
+        REJECT_CONNECTION
+    };
+    // connections, upgraded or on the way, and the fraction of the last
+    // ADMISSION_WINDOW_MS the loop spent running handlers, past which new
+    // ones are not admitted; 0 for no limit
+    size_t admissionConnections = 0;
+    float admissionBusy = 0;
+    Admission admissionAction = DEFER_CONNECTION;
+    static const int ADMISSION_WINDOW_MS = 100;
+    static const int ADMISSION_WAIT_MS = 1000;
+    // the loop's busy fraction as last measured, and the steady clock and
+    // idle time in ns it was measured from
+    float loopBusy = 0;
+    uint64_t busySampled = 0, idleSampled = 0;
+    // the deferred connections, oldest first, with when their wait is up in
+    // ms of the loop's clock; the timer checks them every ADMISSION_WINDOW_MS
+    std::vector<std::pair<uv_poll_t *, uint64_t>> deferredSockets;
+    uv_timer_t *admissionTimer = nullptr;
+    static void admissionCallback(uv_timer_t *timer);
+    bool admissionLimited() const {return admissionConnections || admissionBusy > 0;}
+    // whether the loop is within the limits, for one more connection
+    bool admits();
+    // for a connection just accepted: false if it is not admitted, rejected
+    // or deferred as the action says
+    bool admitConnection(uv_poll_t *socket);
+    void rejectConnection(uv_poll_t *httpSocket);
+
+    // data messages of at least bulkLength bytes queue in the bulk lane,
+    // behind the others (see uS::SocketData::Queue); 0 queues them all in
+    // the order they are sent
+    size_t bulkLength = 0;
+
+    // data messages shorter than deflateMinLength go out uncompressed, and
+    // so do a WebSocket's while deflating them has lately saved less than
+    // deflateMinSavings of their bytes or cost more than deflateMaxNanos
+    // per byte saved (0 for either leaves it out), all but one in every
+    // DEFLATE_PROBE_INTERVAL, which is deflated to measure again
+    size_t deflateMinLength = 0;
+    float deflateMinSavings = 0, deflateMaxNanos = 0;
+    static const int DEFLATE_PROBE_INTERVAL = 64;
+
+    // WebSockets that batch their sends (see setSendBatching) hold them
+    // corked until batchDeadline or batchBytes; the timer flushes those due
+    // before its next tick, every BATCH_TICK_MS while there are any
+    int batchMicros = 0;
+    size_t batchBytes = 16 * 1024;
+    static const int BATCH_TICK_MS = 1;
+    std::vector<uv_poll_t *> batchedWebSockets;
+    uv_timer_t *batchTimer = nullptr;
+    static void batchCallback(uv_timer_t *timer);
+    void holdBatch(uv_poll_t *webSocket, int budgetMicros);
+    // takes the WebSocket off the list, and flushBatch sends what it holds
+    void releaseBatch(uv_poll_t *webSocket);
+    void flushBatch(uv_poll_t *webSocket);
 
 protected:
     Group(int extensionOptions, Hub *hub, uS::NodeData *nodeData);
@@ -61,9 +285,29 @@ protected:
 public:
     void onConnection(std::function<void(WebSocket<isServer>, HttpRequest)> handler);
     void onMessage(std::function<void(WebSocket<isServer>, char *, size_t, OpCode)> handler);
+    // handler, a member function of T, handles the messages on object; it is
+    // bound at compile time, so each message costs one call of a plain
+    // function with handler inlined into it, instead of std::function's
+    // calls through its invoker and stored callable
+    template <class T, void (T::*handler)(WebSocket<isServer>, char *, size_t, OpCode)>
+    void onMessage(T *object) {
+        boundMessageObject = object;
+        boundMessageHandler = [](void *object, WebSocket<isServer> webSocket, char *message, size_t length, OpCode opCode) {
+            (static_cast<T *>(object)->*handler)(webSocket, message, length, opCode);
+        };
+    }
+    // the frame parser's call for each complete message
+    void handleMessage(WebSocket<isServer> webSocket, char *message, size_t length, OpCode opCode) {
+        if (boundMessageHandler) {
+            boundMessageHandler(boundMessageObject, webSocket, message, length, opCode);
+        } else {
+            messageHandler(webSocket, message, length, opCode);
+        }
+    }
     void onDisconnection(std::function<void(WebSocket<isServer>, int code, char *message, size_t length)> handler);
     void onPing(std::function<void(WebSocket<isServer>, char *, size_t)> handler);
     void onPong(std::function<void(WebSocket<isServer>, char *, size_t)> handler);
+    void onTransfer(std::function<void(WebSocket<isServer>)> handler);
     void onError(std::function<void(errorType)> handler);
 
     void onHttpConnection(std::function<void(HttpSocket<isServer>)> handler);
@@ -73,44 +317,93 @@ public:
     void onCancelledHttpRequest(std::function<void(HttpResponse *)> handler);
     void onHttpUpgrade(std::function<void(HttpSocket<isServer>, HttpRequest)> handler);
 
+    // a watermark of 0, the default, leaves the queues unbounded; the handler
+    // fires once as a WebSocket goes past it, and may close but not
+    // terminate the WebSocket
+    void setBackpressure(size_t highWatermark, Backpressure policy = BUFFER);
+    void onBackpressure(std::function<void(WebSocket<isServer>, size_t bufferedAmount)> handler);
+
+    // limits every WebSocket to messagesPerSecond and bytesPerSecond (0
+    // leaves either unlimited), each with a burst of burstSeconds' worth;
+    // the handler fires for every message past a limit before action is
+    // taken, and may close but not terminate the WebSocket
+    void setRateLimit(double messagesPerSecond, double bytesPerSecond, RateLimitAction action = DROP_MESSAGE, double burstSeconds = 1);
+    void onRateLimit(std::function<void(WebSocket<isServer>, RateLimit limit)> handler);
+
+    // admission control at accept time: past maxConnections WebSockets and
+    // connections on their way to one, or with the loop busy running
+    // handlers for more than maxBusy of its time (0 to 1, needs the micro
+    // uUV loop or libuv 1.45), a new connection is deferred or rejected
+    // before its handshake and upgrade add to the load of the connections
+    // it has; 0 leaves either unlimited
+    void setAdmission(size_t maxConnections, double maxBusy, Admission action = DEFER_CONNECTION);
+
+    // lets smaller data messages and control frames overtake queued data
+    // messages of at least bulkLength bytes, between whole frames; not on a
+    // WebSocket deflating with a kept context, where the order is the
+    // stream's
+    void setBulkLength(size_t bulkLength);
+
+    // where permessage-deflate was negotiated, sends data messages shorter
+    // than minLength uncompressed, where zlib's setup and flush cost more
+    // than the few bytes it saves; with minSavings or maxNanosPerSavedByte,
+    // each WebSocket also measures what deflating its messages saves and
+    // costs, and stops while they are not worth it, trying again now and
+    // then. The defaults deflate every data message
+    void setCompressionThreshold(size_t minLength, double minSavings = 0, double maxNanosPerSavedByte = 0);
+
+    // holds what a WebSocket sends for up to budgetMicros, corked, to send
+    // it in one write, earlier once flushBytes are held; 0, the default,
+    // sends it at the end of the read it answers or right away. The loop's
+    // timer ticks in ms, so a budget is kept to within one. WebSockets may
+    // set their own, see WebSocket::setSendBatching
+    void setSendBatching(int budgetMicros, size_t flushBytes = 16 * 1024);
+
 
     void broadcast(const char *message, size_t length, OpCode opCode);
+
+    // the message of a payload that stays unchanged at data for the life of
+    // the group, a string literal say, framed the first time it is asked
+    // for: sendPrepared then sends it on any of the group's WebSockets
+    // without framing or copying it again
+    typename WebSocket<isServer>::PreparedMessage *prepareConstant(const char *data, size_t length, OpCode opCode);
+
+    // a WebSocket leaves its topics by itself when it leaves the group
+    void subscribe(WebSocket<isServer> webSocket, const std::string &topic);
+    void unsubscribe(WebSocket<isServer> webSocket, const std::string &topic);
+    bool hasTopics() const {return !topics.empty();}
+    bool hasSubscribers(const std::string &topic) const {return topics.count(topic) != 0;}
+    bool isSubscribed(WebSocket<isServer> webSocket) const {return subscriptions.count(webSocket.getPollHandle()) != 0;}
+    // subscriptions made so far, for publishers that send new subscribers
+    // the whole state
+    unsigned long long getSubscribeCount() const {return subscribeCount;}
+    // queues the message for the topic's subscribers, if it has any
+    void publish(const std::string &topic, const char *message, size_t length, OpCode opCode = OpCode::TEXT);
+    // sends what is pending now instead of at the end of the iteration
+    void flushTopics();
+
     void terminate();
     void close(int code = 1000, char *message = nullptr, size_t length = 0);
+    // closes the sockets the group listens on and leaves its connections be
+    void stopAccepting();
     using NodeData::addAsync;
+    using NodeData::addMailbox;
+    using NodeData::post;
 
-    // todo: handle nested forEachs with removeWebSocket
+    // cb may close or terminate any WebSocket, nested walks included (see
+    // SocketList)
     template <class F>
     void forEach(const F &cb) {
-        uv_poll_t *iterator = webSocketHead;
-        iterators.push(iterator);
-        while (iterator) {
-            uv_poll_t *lastIterator = iterator;
-            cb(WebSocket<isServer>(iterator));
-            iterator = iterators.top();
-            if (lastIterator == iterator) {
-                iterator = ((uS::SocketData *) iterator->data)->next;
-                iterators.top() = iterator;
-            }
-        }
-        iterators.pop();
+        webSockets.forEach([&cb](uv_poll_t *p) {
+            cb(WebSocket<isServer>(p));
+        });
     }
 
-    // duplicated code for now!
     template <class F>
     void forEachHttpSocket(const F &cb) {
-        uv_poll_t *iterator = httpSocketHead;
-        iterators.push(iterator);
-        while (iterator) {
-            uv_poll_t *lastIterator = iterator;
-            cb(HttpSocket<isServer>(iterator));
-            iterator = iterators.top();
-            if (lastIterator == iterator) {
-                iterator = ((uS::SocketData *) iterator->data)->next;
-                iterators.top() = iterator;
-            }
-        }
-        iterators.pop();
+        httpSockets.forEach([&cb](uv_poll_t *p) {
+            cb(HttpSocket<isServer>(p));
+        });
     }
 };
 
@@ -1,7 +1,13 @@
 #include "HTTPSocket.h"
 #include "Group.h"
+#include "Hub.h"
 #include "Extensions.h"
 #include <cstdio>
+#include <strings.h>
+
+#if defined(__SHA__) && defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
 
 #define MAX_HEADERS 100
 #define MAX_HEADER_BUFFER_SIZE 4096
@@ -11,8 +17,28 @@
 
 namespace uWS {
 
+// which known header a lowercased key is, telling them apart by length
+static inline int knownHeader(const char *key, unsigned int length) {
+    switch (length) {
+    case 7:
+        return memcmp(key, "upgrade", 7) ? -1 : HEADER_UPGRADE;
+    case 10:
+        return memcmp(key, "connection", 10) ? -1 : HEADER_CONNECTION;
+    case 14:
+        return memcmp(key, "content-length", 14) ? -1 : HEADER_CONTENT_LENGTH;
+    case 17:
+        return memcmp(key, "sec-websocket-key", 17) ? -1 : HEADER_SEC_WEBSOCKET_KEY;
+    case 22:
+        return memcmp(key, "sec-websocket-protocol", 22) ? -1 : HEADER_SEC_WEBSOCKET_PROTOCOL;
+    case 24:
+        return memcmp(key, "sec-websocket-extensions", 24) ? -1 : HEADER_SEC_WEBSOCKET_EXTENSIONS;
+    }
+    return -1;
+}
+
 // UNSAFETY NOTE: assumes *end == '\r' (might unref end pointer)
-char *getHeaders(char *buffer, char *end, Header *headers, size_t maxHeaders) {
+char *getHeaders(char *buffer, char *end, Header *headers, size_t maxHeaders, Header **known) {
+    std::fill(known, known + KNOWN_HEADERS, nullptr);
     for (unsigned int i = 0; i < maxHeaders; i++) {
         for (headers->key = buffer; (*buffer != ':') & (*buffer > 32); *(buffer++) |= 32);
         if (*buffer == '\r') {
@@ -30,6 +56,11 @@ char *getHeaders(char *buffer, char *end, Header *headers, size_t maxHeaders) {
             if (buffer /*!= end*/ && buffer[1] == '\n') {
                 headers->valueLength = buffer - headers->value;
                 buffer += 2;
+                // the request line is no header
+                int header;
+                if (i && (header = knownHeader(headers->key, headers->keyLength)) != -1 && !known[header]) {
+                    known[header] = headers;
+                }
                 headers++;
             } else {
                 return nullptr;
@@ -54,32 +85,137 @@ static void base64(unsigned char *src, char *dst) {
     *dst++ = '=';
 }
 
+// the accept key is the SHA-1 of the client's 24 byte key and this GUID: as
+// the input is always 60 bytes, it is kept padded to its two blocks, and
+// only the key is copied in
+static const unsigned char SHA1_INPUT_TEMPLATE[128] = {
+    'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X',
+    'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X', 'X',
+    '2', '5', '8', 'E', 'A', 'F', 'A', '5', '-', 'E', '9', '1', '4', '-', '4', '7',
+    'D', 'A', '-', '9', '5', 'C', 'A', '-', 'C', '5', 'A', 'B', '0', 'D', 'C', '8', '5', 'B', '1', '1',
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    // the length in bits, big-endian
+    0, 0, 0, 0, 0, 0, 480 >> 8, 480 & 255
+};
+
+#if defined(__SHA__) && defined(__SSE4_1__)
+// four of the 80 rounds of a block with the SHA extensions, group g of 20:
+// e holds E0 and E1, which take turns, and msg the message schedule, each
+// word of it made from those before in the groups ahead of its use
+template <int g>
+static inline void sha1Rounds(__m128i &abcd, __m128i *e, __m128i *msg) {
+    __m128i &current = e[g % 2], &m = msg[g % 4];
+    current = g ? _mm_sha1nexte_epu32(current, m) : _mm_add_epi32(current, m);
+    e[(g + 1) % 2] = abcd;
+    if (g >= 3 && g <= 18) {
+        msg[(g + 1) % 4] = _mm_sha1msg2_epu32(msg[(g + 1) % 4], m);
+    }
+    abcd = _mm_sha1rnds4_epu32(abcd, current, g / 5);
+    if (g >= 1 && g <= 16) {
+        msg[(g + 3) % 4] = _mm_sha1msg1_epu32(msg[(g + 3) % 4], m);
+    }
+    if (g >= 2 && g <= 17) {
+        msg[(g + 2) % 4] = _mm_xor_si128(msg[(g + 2) % 4], m);
+    }
+}
+
+template <int g>
+struct Sha1Groups {
+    static inline void run(__m128i &abcd, __m128i *e, __m128i *msg) {
+        sha1Rounds<g>(abcd, e, msg);
+        Sha1Groups<g + 1>::run(abcd, e, msg);
+    }
+};
+
+template <>
+struct Sha1Groups<20> {
+    static inline void run(__m128i &abcd, __m128i *e, __m128i *msg) {}
+};
+
+// SHA-1 of the padded input, in the CPU's SHA extensions
+static void sha1(const unsigned char *input, unsigned char *digest) {
+    const __m128i byteOrder = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    // A in the top lane, E in the top lane of its own
+    __m128i abcd = _mm_set_epi32(0x67452301, (int) 0xEFCDAB89, (int) 0x98BADCFE, 0x10325476);
+    __m128i e[2] = {_mm_set_epi32((int) 0xC3D2E1F0, 0, 0, 0), _mm_setzero_si128()};
+    for (int block = 0; block < 2; block++, input += 64) {
+        __m128i abcdSaved = abcd, eSaved = e[0];
+        __m128i msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (input + 16 * i)), byteOrder);
+        }
+        Sha1Groups<0>::run(abcd, e, msg);
+        e[0] = _mm_sha1nexte_epu32(e[0], eSaved);
+        abcd = _mm_add_epi32(abcd, abcdSaved);
+    }
+    _mm_storeu_si128((__m128i *) digest, _mm_shuffle_epi8(abcd, byteOrder));
+    uint32_t h4 = _mm_extract_epi32(e[0], 3);
+    for (int i = 0; i < 4; i++) {
+        digest[16 + i] = h4 >> (24 - 8 * i);
+    }
+}
+#else
+static void sha1(const unsigned char *input, unsigned char *digest) {
+    SHA1(input, 60, digest);
+}
+#endif
+
+// whether a request asks for its connection to be closed after the
+// response: HTTP/1.1 with Connection: close, HTTP/1.0 without keep-alive.
+// Takes the request line before its version is cut off
+static inline bool closesConnection(Header &requestLine, Header connection) {
+    bool http10 = requestLine.valueLength >= 8 && !memcmp(requestLine.value + requestLine.valueLength - 8, "HTTP/1.0", 8);
+    if (!connection) {
+        return http10;
+    } else if (http10) {
+        return connection.valueLength != 10 || strncasecmp(connection.value, "keep-alive", 10);
+    }
+    return connection.valueLength == 5 && !strncasecmp(connection.value, "close", 5);
+}
+
+// sends what the responses to a read have collected, unless the socket
+// went with them
+static inline void uncorkUnlessClosed(uS::Socket s) {
+    if (!s.isClosed()) {
+        s.uncorkWrites();
+    }
+}
+
 template <bool isServer>
 void HttpSocket<isServer>::onData(uS::Socket s, char *data, int length) {
     HttpSocket httpSocket(s);
     HttpSocket::Data *httpData = httpSocket.getData();
 
-    httpSocket.cork(true);
+    // the responses to all requests of one read go out in one send
+    if (isServer) {
+        s.corkWrites();
+    }
 
     if (httpData->contentLength) {
-        httpData->missedDeadline = false;
+        httpData->idleTicks = 0;
         if (httpData->contentLength >= length) {
             getGroup<isServer>(s)->httpDataHandler(httpData->outstandingResponsesTail, data, length, httpData->contentLength -= length);
+            uncorkUnlessClosed(s);
             return;
         } else {
             getGroup<isServer>(s)->httpDataHandler(httpData->outstandingResponsesTail, data, httpData->contentLength, 0);
             data += httpData->contentLength;
             length -= httpData->contentLength;
             httpData->contentLength = 0;
+            if (s.isClosed()) {
+                return;
+            }
         }
     }
 
-    if (FORCE_SLOW_PATH || httpData->httpBuffer.length()) {
-        if (httpData->httpBuffer.length() + length > MAX_HEADER_BUFFER_SIZE) {
-            httpSocket.onEnd(s);
-            return;
-        }
+    // nothing is read past a request that closes the connection
+    if (httpData->closeAfterResponses) {
+        s.uncorkWrites();
+        return;
+    }
 
+    if (FORCE_SLOW_PATH || httpData->httpBuffer.length()) {
         httpData->httpBuffer.reserve(httpData->httpBuffer.length() + length + WebSocketProtocol<uWS::CLIENT>::CONSUME_POST_PADDING);
         httpData->httpBuffer.append(data, length);
         data = (char *) httpData->httpBuffer.data();
@@ -90,33 +226,43 @@ void HttpSocket<isServer>::onData(uS::Socket s, char *data, int length) {
     char *cursor = data;
     *end = '\r';
     Header headers[MAX_HEADERS];
+    Header *known[KNOWN_HEADERS];
     do {
         char *lastCursor = cursor;
-        if ((cursor = getHeaders(cursor, end, headers, MAX_HEADERS))) {
-            HttpRequest req(headers);
+        if ((cursor = getHeaders(cursor, end, headers, MAX_HEADERS, known))) {
+            HttpRequest req(headers, known);
 
             if (isServer) {
+                bool close = closesConnection(*headers, req.getHeader(HEADER_CONNECTION));
                 headers->valueLength = std::max<int>(0, headers->valueLength - 9);
-                httpData->missedDeadline = false;
-                if (req.getHeader("upgrade", 7)) {
+                httpData->idleTicks = 0;
+                if (req.getHeader(HEADER_UPGRADE)) {
                     if (getGroup<SERVER>(s)->httpUpgradeHandler) {
+                        s.uncorkWrites();
                         getGroup<SERVER>(s)->httpUpgradeHandler(HttpSocket<isServer>(s), req);
                     } else {
-                        Header secKey = req.getHeader("sec-websocket-key", 17);
-                        Header extensions = req.getHeader("sec-websocket-extensions", 24);
-                        Header subprotocol = req.getHeader("sec-websocket-protocol", 22);
+                        Header secKey = req.getHeader(HEADER_SEC_WEBSOCKET_KEY);
+                        Header extensions = req.getHeader(HEADER_SEC_WEBSOCKET_EXTENSIONS);
+                        Header subprotocol = req.getHeader(HEADER_SEC_WEBSOCKET_PROTOCOL);
                         if (secKey.valueLength == 24) {
-                            bool perMessageDeflate;
+                            // the 101 and whatever the connection handler
+                            // sends go out in one send, the cork buffer
+                            // moving to the WebSocket's data
+                            int compressionOptions;
                             httpSocket.upgrade(secKey.value, extensions.value, extensions.valueLength,
-                                               subprotocol.value, subprotocol.valueLength, &perMessageDeflate);
+                                               subprotocol.value, subprotocol.valueLength, &compressionOptions);
                             getGroup<SERVER>(s)->removeHttpSocket(s);
-                            s.enterState<WebSocket<SERVER>>(new WebSocket<SERVER>::Data(perMessageDeflate, httpData));
+                            std::string corkBuffer;
+                            corkBuffer.swap(httpData->corkBuffer);
+                            WebSocket<SERVER>::Data *webSocketData = new WebSocket<SERVER>::Data(compressionOptions, httpData);
+                            webSocketData->corkBuffer.swap(corkBuffer);
+                            s.enterState<WebSocket<SERVER>>(webSocketData);
                             getGroup<SERVER>(s)->addWebSocket(s);
-                            s.cork(true);
                             getGroup<SERVER>(s)->connectionHandler(WebSocket<SERVER>(s), req);
-                            s.cork(false);
+                            uncorkUnlessClosed(s);
                             delete httpData;
                         } else {
+                            s.uncorkWrites();
                             httpSocket.onEnd(s);
                         }
                     }
@@ -131,9 +277,13 @@ void HttpSocket<isServer>::onData(uS::Socket s, char *data, int length) {
                             httpData->outstandingResponsesHead = res;
                         }
                         httpData->outstandingResponsesTail = res;
+                        httpData->keepAlive = true;
+                        // set first, for the response to shut the socket down
+                        // if it ends right away
+                        httpData->closeAfterResponses = close;
 
                         Header contentLength;
-                        if (req.getMethod() != HttpMethod::METHOD_GET && (contentLength = req.getHeader("content-length", 14))) {
+                        if (req.getMethod() != HttpMethod::METHOD_GET && (contentLength = req.getHeader(HEADER_CONTENT_LENGTH))) {
                             httpData->contentLength = atoi(contentLength.value);
                             size_t bytesToRead = std::min<int>(httpData->contentLength, end - cursor);
                             getGroup<SERVER>(s)->httpRequestHandler(res, req, cursor, bytesToRead, httpData->contentLength -= bytesToRead);
@@ -145,13 +295,16 @@ void HttpSocket<isServer>::onData(uS::Socket s, char *data, int length) {
                         if (s.isClosed() || s.isShuttingDown()) {
                             return;
                         }
+                        if (close) {
+                            break;
+                        }
                     } else {
                         httpSocket.onEnd(s);
                         return;
                     }
                 }
             } else {
-                if (req.getHeader("upgrade", 7)) {
+                if (req.getHeader(HEADER_UPGRADE)) {
                     s.enterState<WebSocket<CLIENT>>(new WebSocket<CLIENT>::Data(false, httpData));
 
                     httpSocket.cancelTimeout();
@@ -173,73 +326,113 @@ void HttpSocket<isServer>::onData(uS::Socket s, char *data, int length) {
                 return;
             }
         } else {
-            if (!httpData->httpBuffer.length()) {
-                if (length > MAX_HEADER_BUFFER_SIZE) {
-                    httpSocket.onEnd(s);
-                } else {
-                    httpData->httpBuffer.append(lastCursor, end - lastCursor);
-                }
+            // the requests before lastCursor are done with; only the one
+            // still coming is kept, and only while its head is in bounds
+            size_t remaining = end - lastCursor;
+            s.uncorkWrites();
+            if (remaining > MAX_HEADER_BUFFER_SIZE) {
+                httpSocket.onEnd(s);
+            } else if (httpData->httpBuffer.length()) {
+                httpData->httpBuffer.erase(0, lastCursor - data);
+            } else {
+                httpData->httpBuffer.append(lastCursor, remaining);
             }
             return;
         }
     } while(cursor != end);
 
-    httpSocket.cork(false);
+    s.uncorkWrites();
     httpData->httpBuffer.clear();
 }
 
-// todo: make this into a transformer and make use of sendTransformed
 template <bool isServer>
-void HttpSocket<isServer>::upgrade(const char *secKey, const char *extensions, size_t extensionsLength,
-                                   const char *subprotocol, size_t subprotocolLength, bool *perMessageDeflate) {
+void HttpSocket<isServer>::shutdownAfterResponses() {
+    uncorkWrites();
+    if (getData()->messageQueue.empty()) {
+        shutdown();
+        return;
+    }
+    uS::SocketData::Queue::Message *messagePtr = allocMessage(0);
+    sendMessage(messagePtr, [](void *p, void *data, bool cancelled, void *reserved) {
+        if (!cancelled) {
+            uS::Socket((uv_poll_t *) p).shutdown();
+        }
+    }, nullptr);
+}
 
-    uS::SocketData::Queue::Message *messagePtr;
+// the 101 response up to the negotiated headers, with room for the accept
+// key at UPGRADE_ACCEPT_OFFSET
+static const char UPGRADE_RESPONSE_TEMPLATE[] = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                                                "Connection: Upgrade\r\nSec-WebSocket-Accept: XXXXXXXXXXXXXXXXXXXXXXXXXXXX\r\n"
+                                                "Sec-WebSocket-Version: 13\r\nWebSocket-Server: uWebSockets\r\n";
+static const size_t UPGRADE_ACCEPT_OFFSET = 97;
+
+template <bool isServer>
+void HttpSocket<isServer>::upgrade(const char *secKey, const char *extensions, size_t extensionsLength,
+                                   const char *subprotocol, size_t subprotocolLength, int *compressionOptions) {
 
     if (isServer) {
-        *perMessageDeflate = false;
+        *compressionOptions = 0;
         std::string extensionsResponse;
         if (extensionsLength) {
             Group<isServer> *group = getGroup<isServer>(*this);
-            ExtensionsNegotiator<uWS::SERVER> extensionsNegotiator(group->extensionOptions);
+            ExtensionsNegotiator<uWS::SERVER> extensionsNegotiator(group->extensionOptions, group->hub->getDeflateWindowBits());
             extensionsNegotiator.readOffer(std::string(extensions, extensionsLength));
             extensionsResponse = extensionsNegotiator.generateOffer();
             if (extensionsNegotiator.getNegotiatedOptions() & PERMESSAGE_DEFLATE) {
-                *perMessageDeflate = true;
+                *compressionOptions = extensionsNegotiator.getNegotiatedOptions();
             }
         }
 
-        unsigned char shaInput[] = "XXXXXXXXXXXXXXXXXXXXXXXX258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        // of the subprotocols offered, the first is selected, as one of the
+        // list is all a client accepts back
+        const char *comma = subprotocol ? (const char *) memchr(subprotocol, ',', subprotocolLength) : nullptr;
+        if (comma) {
+            subprotocolLength = comma - subprotocol;
+        }
+        while (subprotocolLength && subprotocol[subprotocolLength - 1] == ' ') {
+            subprotocolLength--;
+        }
+
+        unsigned char shaInput[sizeof(SHA1_INPUT_TEMPLATE)];
+        memcpy(shaInput, SHA1_INPUT_TEMPLATE, sizeof(shaInput));
         memcpy(shaInput, secKey, 24);
         unsigned char shaDigest[SHA_DIGEST_LENGTH];
-        SHA1(shaInput, sizeof(shaInput) - 1, shaDigest);
+        sha1(shaInput, shaDigest);
 
-        char upgradeBuffer[1024];
-        memcpy(upgradeBuffer, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ", 97);
-        base64(shaDigest, upgradeBuffer + 97);
-        memcpy(upgradeBuffer + 125, "\r\n", 2);
-        size_t upgradeResponseLength = 127;
+        // written in place, into the cork buffer when corked
+        size_t upgradeResponseLength = sizeof(UPGRADE_RESPONSE_TEMPLATE) - 1 + 2;
         if (extensionsResponse.length()) {
-            memcpy(upgradeBuffer + upgradeResponseLength, "Sec-WebSocket-Extensions: ", 26);
-            memcpy(upgradeBuffer + upgradeResponseLength + 26, extensionsResponse.data(), extensionsResponse.length());
-            memcpy(upgradeBuffer + upgradeResponseLength + 26 + extensionsResponse.length(), "\r\n", 2);
             upgradeResponseLength += 26 + extensionsResponse.length() + 2;
         }
         if (subprotocolLength) {
-            memcpy(upgradeBuffer + upgradeResponseLength, "Sec-WebSocket-Protocol: ", 24);
-            memcpy(upgradeBuffer + upgradeResponseLength + 24, subprotocol, subprotocolLength);
-            memcpy(upgradeBuffer + upgradeResponseLength + 24 + subprotocolLength, "\r\n", 2);
             upgradeResponseLength += 24 + subprotocolLength + 2;
         }
-        static char stamp[] = "Sec-WebSocket-Version: 13\r\nWebSocket-Server: uWebSockets\r\n\r\n";
-        memcpy(upgradeBuffer + upgradeResponseLength, stamp, sizeof(stamp) - 1);
-        upgradeResponseLength += sizeof(stamp) - 1;
-
-        messagePtr = allocMessage(upgradeResponseLength, upgradeBuffer);
-    } else {
-        messagePtr = allocMessage(getData()->httpBuffer.length(), getData()->httpBuffer.data());
-        getData()->httpBuffer.clear();
+        char *upgradeBuffer = reserveWrite(upgradeResponseLength);
+        char *cursor = upgradeBuffer;
+        memcpy(cursor, UPGRADE_RESPONSE_TEMPLATE, sizeof(UPGRADE_RESPONSE_TEMPLATE) - 1);
+        base64(shaDigest, cursor + UPGRADE_ACCEPT_OFFSET);
+        cursor += sizeof(UPGRADE_RESPONSE_TEMPLATE) - 1;
+        if (extensionsResponse.length()) {
+            memcpy(cursor, "Sec-WebSocket-Extensions: ", 26);
+            memcpy(cursor + 26, extensionsResponse.data(), extensionsResponse.length());
+            memcpy(cursor + 26 + extensionsResponse.length(), "\r\n", 2);
+            cursor += 26 + extensionsResponse.length() + 2;
+        }
+        if (subprotocolLength) {
+            memcpy(cursor, "Sec-WebSocket-Protocol: ", 24);
+            memcpy(cursor + 24, subprotocol, subprotocolLength);
+            memcpy(cursor + 24 + subprotocolLength, "\r\n", 2);
+            cursor += 24 + subprotocolLength + 2;
+        }
+        memcpy(cursor, "\r\n", 2);
+        commitWrite(0, upgradeResponseLength, nullptr, nullptr, nullptr);
+        return;
     }
 
+    uS::SocketData::Queue::Message *messagePtr = allocMessage(getData()->httpBuffer.length(), getData()->httpBuffer.data());
+    getData()->httpBuffer.clear();
+
     bool wasTransferred;
     if (write(messagePtr, wasTransferred)) {
         if (!wasTransferred) {
@@ -266,24 +459,34 @@ void HttpSocket<isServer>::onEnd(uS::Socket s) {
     Data *httpSocketData = (Data *) s.getSocketData();
 
     s.close();
+    uS::Socket::releaseZeroCopied(httpSocketData);
+    uS::Socket::uncountQueued(httpSocketData, httpSocketData->messageQueue.bufferedAmount);
 
     while (!httpSocketData->messageQueue.empty()) {
         uS::SocketData::Queue::Message *message = httpSocketData->messageQueue.front();
         if (message->callback) {
             message->callback(nullptr, message->callbackData, true, nullptr);
         }
-        httpSocketData->messageQueue.pop();
+        httpSocketData->messageQueue.pop(httpSocketData->nodeData);
     }
 
     while (httpSocketData->outstandingResponsesHead) {
         getGroup<isServer>(s)->httpCancelledRequestHandler(httpSocketData->outstandingResponsesHead);
+        uS::SocketData::Queue::Message *messagePtr = httpSocketData->outstandingResponsesHead->messageQueue;
+        while (messagePtr) {
+            uS::SocketData::Queue::Message *nextMessage = messagePtr->nextMessage;
+            uS::SocketData::Queue::freeMessage(messagePtr, httpSocketData->nodeData);
+            messagePtr = nextMessage;
+        }
         HttpResponse *next = httpSocketData->outstandingResponsesHead->next;
         delete httpSocketData->outstandingResponsesHead;
         httpSocketData->outstandingResponsesHead = next;
     }
 
-    if (httpSocketData->preAllocatedResponse) {
-        delete httpSocketData->preAllocatedResponse;
+    while (httpSocketData->freeResponses) {
+        HttpResponse *next = httpSocketData->freeResponses->next;
+        delete httpSocketData->freeResponses;
+        httpSocketData->freeResponses = next;
     }
 
     if (!isServer) {
@@ -3,6 +3,9 @@
 
 #include "Socket.h"
 #include <string>
+#ifdef __linux
+#include <sys/sendfile.h>
+#endif
 // #include <experimental/string_view>
 
 #include <iostream>
@@ -36,13 +39,37 @@ enum HttpMethod {
     METHOD_INVALID
 };
 
+// the headers the server itself reads, picked out as a request is parsed
+enum KnownHeader {
+    HEADER_UPGRADE,
+    HEADER_CONTENT_LENGTH,
+    HEADER_SEC_WEBSOCKET_KEY,
+    HEADER_SEC_WEBSOCKET_PROTOCOL,
+    HEADER_SEC_WEBSOCKET_EXTENSIONS,
+    HEADER_CONNECTION,
+    KNOWN_HEADERS
+};
+
 struct HttpRequest {
     Header *headers;
+    // where each known header is among headers, nullptr for those missing
+    Header **known;
     Header getHeader(const char *key) {
         return getHeader(key, strlen(key));
     }
 
-    HttpRequest(Header *headers = nullptr) : headers(headers) {}
+    HttpRequest(Header *headers = nullptr, Header **known = nullptr) : headers(headers), known(known) {}
+
+    // the first header of that name, without searching for it
+    Header getHeader(KnownHeader header) {
+        if (known) {
+            return known[header] ? *known[header] : Header {nullptr, nullptr, 0, 0};
+        }
+        static const char *names[KNOWN_HEADERS] = {"upgrade", "content-length", "sec-websocket-key",
+                                                   "sec-websocket-protocol", "sec-websocket-extensions",
+                                                   "connection"};
+        return getHeader(names[header]);
+    }
 
     Header getHeader(const char *key, size_t length) {
         if (headers) {
@@ -113,11 +140,19 @@ struct WIN32_EXPORT HttpSocket : private uS::Socket {
         std::string httpBuffer;
         size_t contentLength = 0;
         void *httpUser;
-        bool missedDeadline = false;
+        // ticks of the group's HTTP timer without a request; a connection
+        // that has had one waits the group's httpKeepAlive for the next
+        unsigned int idleTicks = 0;
+        bool keepAlive = false;
+        // the last request asked for the connection to be closed: no more
+        // are read, and it is shut down once the responses are sent
+        bool closeAfterResponses = false;
 
         HttpResponse *outstandingResponsesHead = nullptr;
         HttpResponse *outstandingResponsesTail = nullptr;
-        HttpResponse *preAllocatedResponse = nullptr;
+        // ended responses kept for the next requests, linked by next
+        HttpResponse *freeResponses = nullptr;
+        unsigned int freeResponseCount = 0;
 
         Data(uS::SocketData *socketData) : uS::SocketData(*socketData) {}
     };
@@ -144,12 +179,14 @@ struct WIN32_EXPORT HttpSocket : private uS::Socket {
 
     void upgrade(const char *secKey, const char *extensions,
                  size_t extensionsLength, const char *subprotocol,
-                 size_t subprotocolLength, bool *perMessageDeflate);
+                 size_t subprotocolLength, int *compressionOptions);
 
 private:
     friend class uS::Socket;
     friend struct HttpResponse;
     friend struct Hub;
+    // shuts the socket down once what is queued has been sent
+    void shutdownAfterResponses();
     static void onData(uS::Socket s, char *data, int length);
     static void onEnd(uS::Socket s);
 };
@@ -168,11 +205,16 @@ struct HttpResponse {
 
     }
 
+    // responses kept per connection, as deep as pipelines usually go
+    static const unsigned int MAX_KEPT_RESPONSES = 8;
+
     template <bool isServer>
     static HttpResponse *allocateResponse(HttpSocket<isServer> httpSocket, typename HttpSocket<isServer>::Data *httpData) {
-        if (httpData->preAllocatedResponse) {
-            HttpResponse *ret = httpData->preAllocatedResponse;
-            httpData->preAllocatedResponse = nullptr;
+        if (httpData->freeResponses) {
+            HttpResponse *ret = httpData->freeResponses;
+            httpData->freeResponses = ret->next;
+            httpData->freeResponseCount--;
+            *ret = HttpResponse(httpSocket);
             return ret;
         } else {
             return new HttpResponse(httpSocket);
@@ -181,11 +223,31 @@ struct HttpResponse {
 
     //template <bool isServer>
     void freeResponse(typename HttpSocket<true>::Data *httpData) {
-        if (httpData->preAllocatedResponse) {
+        if (httpData->freeResponseCount == MAX_KEPT_RESPONSES) {
             delete this;
         } else {
-            httpData->preAllocatedResponse = this;
+            next = httpData->freeResponses;
+            httpData->freeResponses = this;
+            httpData->freeResponseCount++;
+        }
+    }
+
+    // keeps a message of a response behind the head of the pipeline until
+    // the responses before it have ended, in the order written
+    void queueMessage(uS::SocketData::Queue::Message *messagePtr) {
+        messagePtr->nextMessage = nullptr;
+        uS::SocketData::Queue::Message **last = &messageQueue;
+        while (*last) {
+            last = &(*last)->nextMessage;
         }
+        *last = messagePtr;
+    }
+
+    // sends what the socket has collected for the responses of this read
+    // now: a body paced by the socket draining has to be, or its parts all
+    // end up collected at once
+    void flush() {
+        httpSocket.uncorkWrites();
     }
 
     void write(const char *message, size_t length = 0,
@@ -203,10 +265,73 @@ struct HttpResponse {
             }
         };
 
-        httpSocket.sendTransformed<NoopTransformer>(message, length, callback, callbackData, 0);
+        if (httpSocket.getData()->outstandingResponsesHead != this) {
+            uS::SocketData::Queue::Message *messagePtr = httpSocket.allocMessage(length, message);
+            messagePtr->callback = callback;
+            messagePtr->callbackData = callbackData;
+            queueMessage(messagePtr);
+        } else {
+            httpSocket.sendTransformed<NoopTransformer>(message, length, callback, callbackData, 0);
+        }
+        hasHead = true;
+    }
+
+    // sends length bytes as one chunk of a body with Transfer-Encoding:
+    // chunked, after a head written with write; end("0\r\n\r\n", 5) ends the
+    // body. An empty chunk would end it too, so none is sent
+    void writeChunk(const char *message, size_t length,
+                    void(*callback)(void *httpSocket, void *data, bool cancelled, void *reserved) = nullptr,
+                    void *callbackData = nullptr) {
+
+        struct ChunkedTransformer {
+            static size_t estimate(const char *data, size_t length) {
+                return length + 20;
+            }
+
+            static size_t transform(const char *src, char *dst, size_t length, int transformData) {
+                int offset = std::sprintf(dst, "%zx\r\n", length);
+                memcpy(dst + offset, src, length);
+                memcpy(dst + offset + length, "\r\n", 2);
+                return offset + length + 2;
+            }
+        };
+
+        if (!length) {
+            if (callback) {
+                callback(httpSocket, callbackData, false, nullptr);
+            }
+            return;
+        }
+        httpSocket.sendTransformed<ChunkedTransformer>(message, length, callback, callbackData, 0);
         hasHead = true;
     }
 
+    // sends up to length bytes of the file fd from *offset on as the next
+    // bytes of this response, straight from the page cache with sendfile
+    // (Linux), and advances *offset past them. Returns the bytes the kernel
+    // took, 0 once it takes no more for now or where the file cannot be
+    // sent so: over TLS that the kernel does not encrypt, behind messages
+    // still queued or corked, or behind an earlier response of a pipeline.
+    // A caller that got 0 writes the next part itself, to be called back
+    // once the socket drains
+    size_t sendFile(int fd, off_t *offset, size_t length) {
+#ifdef __linux
+        typename HttpSocket<true>::Data *httpData = httpSocket.getData();
+        if ((httpData->ssl && httpData->kernelTls != uS::KERNEL_TLS_SEND) || httpData->corked
+            || !httpData->messageQueue.empty() || httpData->outstandingResponsesHead != this) {
+            return 0;
+        }
+        ssize_t sent = ::sendfile(httpSocket.getFd(), fd, offset, length);
+        if (sent <= 0) {
+            return 0;
+        }
+        hasHead = true;
+        return sent;
+#else
+        return 0;
+#endif
+    }
+
     // todo: maybe this function should have a fast path for 0 length?
     void end(const char *message = nullptr, size_t length = 0,
              void(*callback)(void *httpResponse, void *data, bool cancelled, void *reserved) = nullptr,
@@ -236,8 +361,7 @@ struct HttpResponse {
             messagePtr->length = HttpTransformer::transform(message, (char *) messagePtr->data, length, transformData);
             messagePtr->callback = callback;
             messagePtr->callbackData = callbackData;
-            messagePtr->nextMessage = messageQueue;
-            messageQueue = messagePtr;
+            queueMessage(messagePtr);
             hasEnded = true;
         } else {
             httpSocket.sendTransformed<HttpTransformer>(message, length, callback, callbackData, transformData);
@@ -246,24 +370,26 @@ struct HttpResponse {
             while (head) {
                 // empty message queue
                 uS::SocketData::Queue::Message *messagePtr = head->messageQueue;
+                head->messageQueue = nullptr;
                 while (messagePtr) {
                     uS::SocketData::Queue::Message *nextMessage = messagePtr->nextMessage;
+                    void(*messageCallback)(void *, void *, bool, void *) = messagePtr->callback;
+                    void *messageCallbackData = messagePtr->callbackData;
 
                     bool wasTransferred;
                     if (httpSocket.write(messagePtr, wasTransferred)) {
                         if (!wasTransferred) {
                             httpSocket.freeMessage(messagePtr);
-                            if (callback) {
-                                callback(this, callbackData, false, nullptr);
+                            if (messageCallback) {
+                                messageCallback(httpSocket.getPollHandle(), messageCallbackData, false, nullptr);
                             }
-                        } else {
-                            messagePtr->callback = callback;
-                            messagePtr->callbackData = callbackData;
                         }
                     } else {
+                        // the rest go with the responses, when the socket ends
+                        head->messageQueue = nextMessage;
                         httpSocket.freeMessage(messagePtr);
-                        if (callback) {
-                            callback(this, callbackData, true, nullptr);
+                        if (messageCallback) {
+                            messageCallback(httpSocket.getPollHandle(), messageCallbackData, true, nullptr);
                         }
                         goto updateHead;
                     }
@@ -282,6 +408,9 @@ struct HttpResponse {
             httpSocket.getData()->outstandingResponsesHead = head;
             if (!head) {
                 httpSocket.getData()->outstandingResponsesTail = nullptr;
+                if (httpSocket.getData()->closeAfterResponses) {
+                    httpSocket.shutdownAfterResponses();
+                }
             }
 
             freeResponse(httpSocket.getData());
@@ -1,49 +1,240 @@
 #include "Hub.h"
 #include "HTTPSocket.h"
 #include <openssl/sha.h>
+#include <chrono>
 
 static const int INFLATE_LESS_THAN_ROUGHLY = 16777216;
 
 namespace uWS {
 
-char *Hub::inflate(char *data, size_t &length) {
-    dynamicInflationBuffer.clear();
+// number of messages using an eighth of a grown buffer before it shrinks back
+static const int SHRINK_INFLATION_BUFFER_AFTER = 64;
 
-    inflationStream.next_in = (Bytef *) data;
-    inflationStream.avail_in = length;
+// the empty block ending every message of a sync flushed stream, which the
+// sender strips and a sliding stream needs back to stay in step
+static const char DEFLATE_TAIL[] = {0x00, 0x00, (char) 0xff, (char) 0xff};
 
+// deflation output starts in a small buffer, which goes back to this size
+// after a message that grew it past LARGE_BUFFER_SIZE
+static const size_t SMALL_DEFLATION_BUFFER_SIZE = 16 * 1024;
+
+char *Hub::inflate(char *data, size_t &length, z_stream *slidingStream) {
+    UWS_PROBE1(inflate__entry, length);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (smallInflations == SHRINK_INFLATION_BUFFER_AFTER) {
+        delete [] inflationBuffer;
+        inflationBuffer = nullptr;
+        smallInflations = 0;
+    }
+    if (!inflationBuffer) {
+        allocateInflationBuffer();
+    }
+    if (!slidingStream && !inflationStream.state) {
+        inflateInit2(&inflationStream, -15);
+        countCompressionMemory();
+    }
+
+    z_stream *stream = slidingStream ? slidingStream : &inflationStream;
+    stream->next_in = (Bytef *) data;
+    stream->avail_in = length;
+
+    // a stream kept for later messages must not be told it is finishing
+    int flush = slidingStream ? Z_SYNC_FLUSH : Z_FINISH;
+    size_t inflated = 0;
+    bool tooLarge = false, tailed = !slidingStream;
     int err;
-    do {
-        inflationStream.next_out = (Bytef *) inflationBuffer;
-        inflationStream.avail_out = LARGE_BUFFER_SIZE;
-        err = ::inflate(&inflationStream, Z_FINISH);
-        if (!inflationStream.avail_in) {
+    while (true) {
+        stream->next_out = (Bytef *) inflationBuffer + inflated;
+        stream->avail_out = inflationBufferSize - inflated;
+        err = ::inflate(stream, flush);
+        inflated = inflationBufferSize - stream->avail_out;
+        if (err != Z_OK && err != Z_BUF_ERROR) {
             break;
         }
+        if (stream->avail_out) {
+            if (tailed) {
+                break;
+            }
+            stream->next_in = (Bytef *) DEFLATE_TAIL;
+            stream->avail_in = sizeof(DEFLATE_TAIL);
+            tailed = true;
+            continue;
+        }
 
-        dynamicInflationBuffer.append(inflationBuffer, LARGE_BUFFER_SIZE - inflationStream.avail_out);
-    } while (err == Z_BUF_ERROR && dynamicInflationBuffer.length() <= INFLATE_LESS_THAN_ROUGHLY);
+        // out of room with output pending: grow, keeping what is inflated
+        if (inflationBufferSize > INFLATE_LESS_THAN_ROUGHLY) {
+            tooLarge = true;
+            break;
+        }
+        char *grown = new char[inflationBufferSize * 2];
+        memcpy(grown, inflationBuffer, inflated);
+        delete [] inflationBuffer;
+        inflationBuffer = grown;
+        inflationBufferSize *= 2;
+        countCompressionMemory();
+    }
 
-    inflateReset(&inflationStream);
+    // a peer ending its stream starts over with the next message
+    if (!slidingStream || err == Z_STREAM_END) {
+        inflateReset(stream);
+    }
+
+    if (inflationBufferSize > (size_t) LARGE_BUFFER_SIZE) {
+        smallInflations = inflated > inflationBufferSize / 8 ? 0 : smallInflations + 1;
+    }
 
-    if ((err != Z_BUF_ERROR && err != Z_OK) || dynamicInflationBuffer.length() > INFLATE_LESS_THAN_ROUGHLY) {
+    compressionStats.inflatedMessages++;
+    compressionStats.inflatedBytesIn += length;
+    compressionStats.inflatedBytesOut += inflated;
+    compressionStats.inflateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    UWS_PROBE1(inflate__return, inflated);
+
+    if ((err != Z_BUF_ERROR && err != Z_OK && err != Z_STREAM_END) || tooLarge) {
         length = 0;
         return nullptr;
     }
 
-    if (dynamicInflationBuffer.length()) {
-        dynamicInflationBuffer.append(inflationBuffer, LARGE_BUFFER_SIZE - inflationStream.avail_out);
+    length = inflated;
+    return inflationBuffer;
+}
 
-        length = dynamicInflationBuffer.length();
-        return (char *) dynamicInflationBuffer.data();
+char *Hub::deflate(const char *data, size_t &length, z_stream *slidingStream) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!slidingStream && !deflationStream.state) {
+        deflateInit2(&deflationStream, deflateLevel, Z_DEFLATED, -deflateWindowBits, deflateMemLevel, Z_DEFAULT_STRATEGY);
+        countCompressionMemory();
+    }
+    // the previous message is sent by now, so a buffer grown for it can go
+    if (deflationBufferSize > (size_t) LARGE_BUFFER_SIZE) {
+        delete [] deflationBuffer;
+        deflationBuffer = nullptr;
+    }
+    if (!deflationBuffer) {
+        deflationBufferSize = SMALL_DEFLATION_BUFFER_SIZE;
+        deflationBuffer = new char[deflationBufferSize];
+        countCompressionMemory();
     }
 
-    length = LARGE_BUFFER_SIZE - inflationStream.avail_out;
-    return inflationBuffer;
+    z_stream *stream = slidingStream ? slidingStream : &deflationStream;
+    stream->next_in = (Bytef *) data;
+    stream->avail_in = length;
+
+    size_t deflated = 0;
+    int err;
+    while (true) {
+        stream->next_out = (Bytef *) deflationBuffer + deflated;
+        stream->avail_out = deflationBufferSize - deflated;
+        err = ::deflate(stream, Z_SYNC_FLUSH);
+        deflated = deflationBufferSize - stream->avail_out;
+        if ((err != Z_OK && err != Z_BUF_ERROR) || stream->avail_out) {
+            break;
+        }
+
+        // the shared stream gives up once the output is no smaller than the
+        // input; a sliding stream has to deliver what it took in
+        if (!slidingStream && deflated >= length) {
+            break;
+        }
+        char *grown = new char[deflationBufferSize * 2];
+        memcpy(grown, deflationBuffer, deflated);
+        delete [] deflationBuffer;
+        deflationBuffer = grown;
+        deflationBufferSize *= 2;
+        countCompressionMemory();
+    }
+
+    if (!slidingStream) {
+        deflateReset(stream);
+    }
+
+    if (deflated >= sizeof(DEFLATE_TAIL) && !memcmp(deflationBuffer + deflated - sizeof(DEFLATE_TAIL), DEFLATE_TAIL, sizeof(DEFLATE_TAIL))) {
+        deflated -= sizeof(DEFLATE_TAIL);
+    }
+
+    compressionStats.deflateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if ((err != Z_OK && err != Z_BUF_ERROR) || (!slidingStream && deflated >= length)) {
+        return nullptr;
+    }
+
+    compressionStats.deflatedMessages++;
+    compressionStats.deflatedBytesIn += length;
+    compressionStats.deflatedBytesOut += deflated;
+
+    length = deflated;
+    return deflationBuffer;
+}
+
+void Hub::setDeflateOptions(int windowBits, int memLevel, int level) {
+    deflateWindowBits = std::max(9, std::min(15, windowBits));
+    deflateMemLevel = std::max(1, std::min(9, memLevel));
+    deflateLevel = level;
+    // the shared stream is set up again on next use
+    deflateEnd(&deflationStream);
+    deflationStream = {};
+    countCompressionMemory();
+}
+
+void Hub::prefault() {
+    uS::Node::prefault();
+    if (Group<SERVER>::extensionOptions & PERMESSAGE_DEFLATE) {
+        if (!inflationBuffer) {
+            allocateInflationBuffer();
+        }
+        memset(inflationBuffer, 0, inflationBufferSize);
+    }
+}
+
+bool Hub::useHugePages(bool explicitPages) {
+    if (!uS::Node::useHugePages(explicitPages)) {
+        return false;
+    }
+    uS::NodeData *groups[] = {&getDefaultGroup<SERVER>(), &getDefaultGroup<CLIENT>()};
+    for (uS::NodeData *group : groups) {
+        group->recvBufferMemoryBlock = nodeData->recvBufferMemoryBlock;
+        group->recvBuffer = nodeData->recvBuffer;
+    }
+    return true;
+}
+
+void Hub::allocateInflationBuffer() {
+    inflationBuffer = new char[LARGE_BUFFER_SIZE];
+    inflationBufferSize = LARGE_BUFFER_SIZE;
+    countCompressionMemory();
+}
+
+void Hub::countCompressionMemory() {
+    size_t bytes = (inflationBuffer ? inflationBufferSize : 0) + (deflationBuffer ? deflationBufferSize : 0);
+    // zconf.h: an inflate stream of 15 window bits takes its 32 KB window
+    // and about 7 KB more, a deflate stream 2^(windowBits + 2) +
+    // 2^(memLevel + 9) bytes
+    if (inflationStream.state) {
+        bytes += (1 << 15) + 7 * 1024;
+    }
+    if (deflationStream.state) {
+        bytes += ((size_t) 1 << (deflateWindowBits + 2)) + ((size_t) 1 << (deflateMemLevel + 9));
+    }
+    compressionMemory.store(bytes, std::memory_order_relaxed);
+}
+
+z_stream *Hub::createDeflationStream() {
+    z_stream *stream = new z_stream();
+    deflateInit2(stream, deflateLevel, Z_DEFLATED, -deflateWindowBits, deflateMemLevel, Z_DEFAULT_STRATEGY);
+    return stream;
+}
+
+z_stream *Hub::createInflationStream() {
+    z_stream *stream = new z_stream();
+    inflateInit2(stream, -15);
+    return stream;
 }
 
 void Hub::onServerAccept(uS::Socket s) {
     uS::SocketData *socketData = s.getSocketData();
+    if (!((Group<SERVER> *) socketData->nodeData)->admitConnection(s)) {
+        delete socketData;
+        return;
+    }
     s.enterState<HttpSocket<SERVER>>(new HttpSocket<SERVER>::Data(socketData));
     ((Group<SERVER> *) socketData->nodeData)->addHttpSocket(s);
     ((Group<SERVER> *) socketData->nodeData)->httpConnectionHandler(s);
@@ -79,6 +270,34 @@ bool Hub::listen(int port, uS::TLS::Context sslContext, int options, Group<SERVE
     return listen(nullptr, port, sslContext, options, eh);
 }
 
+#ifndef _WIN32
+bool Hub::listenUnix(const char *path, uS::TLS::Context sslContext, int options, Group<SERVER> *eh) {
+    if (!eh) {
+        eh = (Group<SERVER> *) this;
+    }
+
+    if (uS::Node::listenUnix<onServerAccept>(path, sslContext, options, (uS::NodeData *) eh)) {
+        eh->errorHandler(0);
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool Hub::listenShared(Group<SERVER> *listening, int options, Group<SERVER> *eh) {
+    if (!eh) {
+        eh = (Group<SERVER> *) this;
+    }
+
+    uS::ListenData *listenData = (uS::ListenData *) ((uS::NodeData *) listening)->user;
+    uv_os_sock_t listenFd;
+    if (!listenData || (listenFd = dup(listenData->sock)) == SOCKET_ERROR) {
+        return false;
+    }
+    uS::Node::listenOn<onServerAccept>(listenFd, listenData->sslContext, options, (uS::NodeData *) eh);
+    return true;
+}
+
 void Hub::connect(std::string uri, void *user, int timeoutMs, Group<CLIENT> *eh, std::string subprotocol) {
     if (!eh) {
         eh = (Group<CLIENT> *) this;
@@ -131,16 +350,44 @@ void Hub::connect(std::string uri, void *user, int timeoutMs, Group<CLIENT> *eh,
                                      + optionalSubprotocol +
                                      "Sec-WebSocket-Version: 13\r\n\r\n";
 
-        uS::Socket s = uS::Node::connect<onClientConnection>(hostname.c_str(), port, secure, httpSocketData);
-        if (s) {
-            s.startTimeout<HttpSocket<CLIENT>::onEnd>(timeoutMs);
-            // getGroup<CLIENT>(s)->addHttpSocket(s);
-        }
+        uS::Node::connect<onClientConnection, HttpSocket<CLIENT>::onEnd>(hostname.c_str(), port, secure, httpSocketData, timeoutMs);
     } else {
         eh->errorHandler(user);
     }
 }
 
+#ifndef _WIN32
+void Hub::listenFd(uv_os_sock_t fd, uS::TLS::Context sslContext, int options, Group<SERVER> *eh) {
+    if (!eh) {
+        eh = (Group<SERVER> *) this;
+    }
+    uS::Node::listenOn<onServerAccept>(fd, sslContext, options, (uS::NodeData *) eh);
+}
+
+uv_os_sock_t Hub::getListenSocket(Group<SERVER> *eh) {
+    if (!eh) {
+        eh = (Group<SERVER> *) this;
+    }
+    uS::ListenData *listenData = (uS::ListenData *) ((uS::NodeData *) eh)->user;
+    return listenData ? listenData->sock : SOCKET_ERROR;
+}
+
+void Hub::adopt(uv_os_sock_t fd, int compressionOptions, void *user, Group<SERVER> *serverGroup) {
+    if (!serverGroup) {
+        serverGroup = &getDefaultGroup<SERVER>();
+    }
+
+    uS::Socket s = uS::Socket::init((uS::NodeData *) serverGroup, fd, nullptr);
+    uS::SocketData *socketData = s.getSocketData();
+    WebSocket<SERVER>::Data *webSocketData = new WebSocket<SERVER>::Data(compressionOptions, socketData);
+    delete socketData;
+    webSocketData->user = user;
+    s.enterState<WebSocket<SERVER>>(webSocketData);
+    serverGroup->addWebSocket(s);
+    serverGroup->connectionHandler(WebSocket<SERVER>(s), HttpRequest({}));
+}
+#endif
+
 void Hub::upgrade(uv_os_sock_t fd, const char *secKey, SSL *ssl, const char *extensions, size_t extensionsLength, const char *subprotocol, size_t subprotocolLength, Group<SERVER> *serverGroup) {
     if (!serverGroup) {
         serverGroup = &getDefaultGroup<SERVER>();
@@ -152,9 +399,9 @@ void Hub::upgrade(uv_os_sock_t fd, const char *secKey, SSL *ssl, const char *ext
     delete socketData;
     s.enterState<HttpSocket<SERVER>>(temporaryHttpData);
 
-    bool perMessageDeflate;
-    HttpSocket<SERVER>(s).upgrade(secKey, extensions, extensionsLength, subprotocol, subprotocolLength, &perMessageDeflate);
-    s.enterState<WebSocket<SERVER>>(new WebSocket<SERVER>::Data(perMessageDeflate, s.getSocketData()));
+    int compressionOptions;
+    HttpSocket<SERVER>(s).upgrade(secKey, extensions, extensionsLength, subprotocol, subprotocolLength, &compressionOptions);
+    s.enterState<WebSocket<SERVER>>(new WebSocket<SERVER>::Data(compressionOptions, s.getSocketData()));
     serverGroup->addWebSocket(s);
     serverGroup->connectionHandler(WebSocket<SERVER>(s), HttpRequest({}));
     delete temporaryHttpData;
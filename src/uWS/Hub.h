@@ -29,33 +29,145 @@ struct WIN32_EXPORT Hub : private uS::Node, public Group<SERVER>, public Group<C
         Group<CLIENT> *group;
     };
 
+    // set up by the first message inflated with it, as a Hub whose clients
+    // do not compress never needs it
     z_stream inflationStream = {};
-    char *inflationBuffer;
-    char *inflate(char *data, size_t &length);
-    std::string dynamicInflationBuffer;
+    // messages are inflated straight into this buffer, which is allocated
+    // with the first one, grows for large ones and goes back to
+    // LARGE_BUFFER_SIZE after a run of small ones
+    char *inflationBuffer = nullptr;
+    size_t inflationBufferSize = 0;
+    int smallInflations = 0;
+    // inflates into inflationBuffer with slidingStream, which keeps its context,
+    // or with the shared inflationStream, reset after every message
+    char *inflate(char *data, size_t &length, z_stream *slidingStream = nullptr);
     static const int LARGE_BUFFER_SIZE = 300 * 1024;
 
+    // outgoing messages are deflated into deflationBuffer, with slidingStream
+    // or with the shared deflationStream; a message that does not shrink on
+    // the shared stream is left uncompressed and nullptr is returned
+    z_stream deflationStream = {};
+    char *deflationBuffer = nullptr;
+    size_t deflationBufferSize = 0;
+    char *deflate(const char *data, size_t &length, z_stream *slidingStream = nullptr);
+
+    // window bits (9 to 15, announced to the peer when below 15), memory level
+    // (1 to 9) and compression level of the streams deflating from now on;
+    // each stream takes about 2^(windowBits + 2) + 2^(memLevel + 9) bytes
+    void setDeflateOptions(int windowBits, int memLevel = 8, int level = Z_DEFAULT_COMPRESSION);
+    int getDeflateWindowBits() const {return deflateWindowBits;}
+    z_stream *createDeflationStream();
+    z_stream *createInflationStream();
+
+    struct CompressionStats {
+        size_t deflatedMessages = 0, deflatedBytesIn = 0, deflatedBytesOut = 0;
+        size_t inflatedMessages = 0, inflatedBytesIn = 0, inflatedBytesOut = 0;
+        // time spent in zlib
+        double deflateSeconds = 0, inflateSeconds = 0;
+    };
+    const CompressionStats &getCompressionStats() const {return compressionStats;}
+
+    // bytes held by the shared streams and buffers, none until the first
+    // compressed message; the streams as zconf.h estimates them; from any
+    // thread
+    size_t getCompressionMemory() const {return compressionMemory.load(std::memory_order_relaxed);}
+
     static void onServerAccept(uS::Socket s);
     static void onClientConnection(uS::Socket s, bool error);
 
     bool listen(int port, uS::TLS::Context sslContext = nullptr, int options = 0, Group<SERVER> *eh = nullptr);
     bool listen(const char *host, int port, uS::TLS::Context sslContext = nullptr, int options = 0, Group<SERVER> *eh = nullptr);
+#ifndef _WIN32
+    // listens on a Unix domain socket at path as well as, or instead of, a
+    // port, for clients on the same host
+    bool listenUnix(const char *path, uS::TLS::Context sslContext = nullptr, int options = 0, Group<SERVER> *eh = nullptr);
+#endif
+    // listens on a dup of the socket that another Hub's group listens on,
+    // becoming one of several loops accepting from it
+    bool listenShared(Group<SERVER> *listening, int options = 0, Group<SERVER> *eh = nullptr);
+    // never blocks the loop: a host name is resolved on a thread of its own
+    // and the socket connects without blocking; the error handler fires with
+    // user if the name does not resolve, the connect fails, or the upgrade
+    // is not through within timeoutMs of the call
     void connect(std::string uri, void *user, int timeoutMs = 5000, Group<CLIENT> *eh = nullptr, std::string subprotocol = "");
     void upgrade(uv_os_sock_t fd, const char *secKey, SSL *ssl, const char *extensions, size_t extensionsLength, const char *subprotocol, size_t subprotocolLength, Group<SERVER> *serverGroup = nullptr);
+#ifndef _WIN32
+    // accepts from a socket that is listening already, such as one handed
+    // over by another process; the Hub takes it over
+    void listenFd(uv_os_sock_t fd, uS::TLS::Context sslContext = nullptr, int options = 0, Group<SERVER> *eh = nullptr);
+    // the socket the group started listening on last, SOCKET_ERROR if none
+    uv_os_sock_t getListenSocket(Group<SERVER> *eh = nullptr);
+    // continues on fd a WebSocket connection that another process took
+    // through its upgrade, with the extension options negotiated there (see
+    // WebSocket::handOff); the connection handler fires with user as the
+    // WebSocket's user data and without request headers
+    void adopt(uv_os_sock_t fd, int compressionOptions, void *user, Group<SERVER> *serverGroup = nullptr);
+#endif
 
-    Hub(int extensionOptions = 0, bool useDefaultLoop = false) : uS::Node(LARGE_BUFFER_SIZE, WebSocketProtocol<SERVER>::CONSUME_PRE_PADDING, WebSocketProtocol<SERVER>::CONSUME_POST_PADDING, useDefaultLoop),
+    // recvLength is the size of the loop's receive buffer, the most one read
+    // of a socket takes in
+    Hub(int extensionOptions = 0, bool useDefaultLoop = false, int recvLength = LARGE_BUFFER_SIZE) : uS::Node(recvLength, WebSocketProtocol<SERVER>::CONSUME_PRE_PADDING, WebSocketProtocol<SERVER>::CONSUME_POST_PADDING, useDefaultLoop),
                                              Group<SERVER>(extensionOptions, this, nodeData), Group<CLIENT>(0, this, nodeData) {
-        inflateInit2(&inflationStream, -15);
-        inflationBuffer = new char[LARGE_BUFFER_SIZE];
     }
 
     ~Hub() {
         inflateEnd(&inflationStream);
+        deflateEnd(&deflationStream);
         delete [] inflationBuffer;
+        delete [] deflationBuffer;
+        delete Group<SERVER>::mailbox;
+        delete Group<CLIENT>::mailbox;
     }
 
     using uS::Node::run;
     using uS::Node::getLoop;
+    using uS::Node::setListenBacklog;
+    using uS::Node::setAcceptBudget;
+    using uS::Node::getAcceptStats;
+    using uS::Node::setZeroCopyThreshold;
+    using uS::Node::getZeroCopyStats;
+
+    // Node::prefault and, if the server offers permessage-deflate, the
+    // buffer of inflated messages
+    void prefault();
+
+    // Node::useHugePages, with the default groups' copies of the buffers;
+    // before other groups are created
+    bool useHugePages(bool explicitPages);
+
+    // Node::getLoopStats with the sockets of the default server group and
+    // the compression memory
+    uS::LoopStats getLoopStats() const {
+        uS::LoopStats stats = uS::Node::getLoopStats();
+        stats.webSockets = Group<SERVER>::getWebSocketCount();
+        stats.httpSockets = Group<SERVER>::getHttpSocketCount();
+        stats.compressionBytes = getCompressionMemory();
+        return stats;
+    }
+
+    // the default server group's mailbox, for handing work to this Hub's
+    // loop from other threads: addMailbox on the loop's thread, before it
+    // runs, then post from any until the group closes; a task may capture
+    // up to uS::Mailbox::TASK_SIZE bytes and is run on the loop's thread
+    void addMailbox(size_t capacity = 1024) {
+        Group<SERVER>::addMailbox(capacity);
+    }
+
+    template <class F>
+    bool post(F &&task) {
+        return Group<SERVER>::post(std::forward<F>(task));
+    }
+
+    // recycles the queued messages and send buffers of all groups of this Hub
+    uS::MemoryPool &getMemoryPool() {
+        return *nodeData->memoryPool;
+    }
+
+    // reassembles the messages of all groups of this Hub that arrive in parts
+    uS::FragmentPool &getFragmentPool() {
+        return *nodeData->fragmentPool;
+    }
+
     using Group<SERVER>::onConnection;
     using Group<CLIENT>::onConnection;
     using Group<SERVER>::onMessage;
@@ -66,6 +178,8 @@ struct WIN32_EXPORT Hub : private uS::Node, public Group<SERVER>, public Group<C
     using Group<CLIENT>::onPing;
     using Group<SERVER>::onPong;
     using Group<CLIENT>::onPong;
+    using Group<SERVER>::onTransfer;
+    using Group<CLIENT>::onTransfer;
     using Group<SERVER>::onError;
     using Group<CLIENT>::onError;
     using Group<SERVER>::onHttpRequest;
@@ -74,6 +188,13 @@ struct WIN32_EXPORT Hub : private uS::Node, public Group<SERVER>, public Group<C
     using Group<SERVER>::onHttpDisconnection;
     using Group<SERVER>::onHttpUpgrade;
     using Group<SERVER>::onCancelledHttpRequest;
+
+private:
+    int deflateWindowBits = 15, deflateMemLevel = 8, deflateLevel = Z_DEFAULT_COMPRESSION;
+    CompressionStats compressionStats;
+    std::atomic<size_t> compressionMemory {0};
+    void allocateInflationBuffer();
+    void countCompressionMemory();
 };
 
 }
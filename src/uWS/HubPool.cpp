@@ -0,0 +1,285 @@
+#include "HubPool.h"
+#ifdef __linux
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace uWS {
+
+HubPool::HubPool(int workers, Balance balance, int extensionOptions, int recvLength, const std::vector<int> &cpus) : acceptor(extensionOptions, false, recvLength), balance(balance), extensionOptions(extensionOptions), recvLength(recvLength) {
+    // the workers own their Hubs, so each loop is created on the thread that
+    // runs it; they are started one at a time as loop creation is not thread safe
+    for (int i = 0; i < workers; i++) {
+        Worker *worker = new Worker;
+        worker->index = i;
+        worker->connections = 0;
+        if (!cpus.empty()) {
+            worker->cpu = cpus[i % cpus.size()];
+        }
+        this->workers.push_back(worker);
+
+        std::unique_lock<std::mutex> lock(startMutex);
+        worker->thread = std::thread(&HubPool::workerMain, this, worker);
+        startCondition.wait(lock, [worker] {return worker->hub != nullptr;});
+    }
+
+    acceptor.onConnection([this](WebSocket<SERVER> ws, HttpRequest req) {
+        Worker *worker = pick();
+        worker->connections++;
+        ws.transfer(&worker->hub->getDefaultGroup<SERVER>());
+    });
+}
+
+HubPool::~HubPool() {
+    {
+        std::lock_guard<std::mutex> lock(startMutex);
+        cancelled = true;
+    }
+    startCondition.notify_all();
+
+    for (Worker *worker : workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+        delete worker;
+    }
+}
+
+void HubPool::onWorker(std::function<void(Hub &, int)> handler) {
+    workerHandler = handler;
+}
+
+bool HubPool::listen(int port, uS::TLS::Context sslContext, int options) {
+    if (balance != REUSE_PORT && balance != SHARED_LISTEN) {
+        return acceptor.listen(port, sslContext, options);
+    }
+
+    // the workers wait for run, so their loops can be set up from here
+    std::lock_guard<std::mutex> lock(startMutex);
+    for (Worker *worker : workers) {
+        bool listening;
+        if (balance == REUSE_PORT) {
+            listening = worker->hub->listen(port, sslContext, options | uS::REUSE_PORT);
+        } else if (worker == workers[0]) {
+            listening = worker->hub->listen(port, sslContext, options | uS::EXCLUSIVE_POLL);
+        } else {
+            listening = worker->hub->listenShared(&workers[0]->hub->getDefaultGroup<SERVER>(), options | uS::EXCLUSIVE_POLL);
+        }
+        if (!listening) {
+            for (Worker *listening : workers) {
+                if (listening == worker) {
+                    break;
+                }
+                listening->hub->getDefaultGroup<SERVER>().stopListening();
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifndef _WIN32
+bool HubPool::listenUnix(const char *path, uS::TLS::Context sslContext, int options) {
+    if (balance != REUSE_PORT && balance != SHARED_LISTEN) {
+        return acceptor.listenUnix(path, sslContext, options);
+    }
+
+    std::lock_guard<std::mutex> lock(startMutex);
+    if (!workers[0]->hub->listenUnix(path, sslContext, options | uS::EXCLUSIVE_POLL)) {
+        return false;
+    }
+    // the newest listener of the first worker's group is the one shared
+    for (Worker *worker : workers) {
+        if (worker != workers[0] && !worker->hub->listenShared(&workers[0]->hub->getDefaultGroup<SERVER>(), options | uS::EXCLUSIVE_POLL)) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+void HubPool::setDeflateOptions(int windowBits, int memLevel, int level) {
+    acceptor.setDeflateOptions(windowBits, memLevel, level);
+    std::lock_guard<std::mutex> lock(startMutex);
+    for (Worker *worker : workers) {
+        worker->hub->setDeflateOptions(windowBits, memLevel, level);
+    }
+}
+
+void HubPool::run() {
+    {
+        std::lock_guard<std::mutex> lock(startMutex);
+        started = true;
+    }
+    startCondition.notify_all();
+
+    if (balance == REUSE_PORT || balance == SHARED_LISTEN) {
+        // nothing to accept here; the workers run until their owner stops them
+        for (Worker *worker : workers) {
+            worker->thread.join();
+        }
+        return;
+    }
+
+    acceptor.run();
+
+    for (Worker *worker : workers) {
+        uv_async_send(worker->stop);
+    }
+    for (Worker *worker : workers) {
+        worker->thread.join();
+    }
+}
+
+uS::FragmentPool::Stats HubPool::getFragmentStats() {
+    uS::FragmentPool::Stats stats = acceptor.getFragmentPool().getStats();
+    std::lock_guard<std::mutex> lock(startMutex);
+    for (Worker *worker : workers) {
+        if (worker->hub) {
+            stats += worker->hub->getFragmentPool().getStats();
+        }
+    }
+    return stats;
+}
+
+void HubPool::setListenBacklog(int backlog) {
+    acceptor.setListenBacklog(backlog);
+    std::lock_guard<std::mutex> lock(startMutex);
+    for (Worker *worker : workers) {
+        worker->hub->setListenBacklog(backlog);
+    }
+}
+
+void HubPool::setAcceptBudget(int budget) {
+    acceptor.setAcceptBudget(budget);
+    std::lock_guard<std::mutex> lock(startMutex);
+    for (Worker *worker : workers) {
+        worker->hub->setAcceptBudget(budget);
+    }
+}
+
+uS::AcceptStats HubPool::getAcceptStats() {
+    uS::AcceptStats stats = acceptor.getAcceptStats();
+    std::lock_guard<std::mutex> lock(startMutex);
+    for (Worker *worker : workers) {
+        if (worker->hub) {
+            stats += worker->hub->getAcceptStats();
+        }
+    }
+    return stats;
+}
+
+void HubPool::setZeroCopyThreshold(size_t threshold) {
+    acceptor.setZeroCopyThreshold(threshold);
+    std::lock_guard<std::mutex> lock(startMutex);
+    for (Worker *worker : workers) {
+        worker->hub->setZeroCopyThreshold(threshold);
+    }
+}
+
+uS::ZeroCopyStats HubPool::getZeroCopyStats() {
+    uS::ZeroCopyStats stats = acceptor.getZeroCopyStats();
+    std::lock_guard<std::mutex> lock(startMutex);
+    for (Worker *worker : workers) {
+        if (worker->hub) {
+            stats += worker->hub->getZeroCopyStats();
+        }
+    }
+    return stats;
+}
+
+std::vector<uS::LoopStats> HubPool::getLoopStats() {
+    std::vector<uS::LoopStats> stats(1, acceptor.getLoopStats());
+    std::lock_guard<std::mutex> lock(startMutex);
+    for (Worker *worker : workers) {
+        stats.push_back(worker->hub ? worker->hub->getLoopStats() : uS::LoopStats());
+    }
+    return stats;
+}
+
+void HubPool::workerMain(Worker *worker) {
+#ifdef __linux
+    if (worker->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            worker->cpu = -1;
+        }
+    }
+#else
+    worker->cpu = -1;
+#endif
+    Hub hub(extensionOptions, false, recvLength);
+    Group<SERVER> &group = hub.getDefaultGroup<SERVER>();
+    group.addAsync();
+
+    worker->stop = new uv_async_t;
+    worker->stop->data = &hub;
+    uv_async_init(hub.getLoop(), worker->stop, [](uv_async_t *stop) {
+        ((Hub *) stop->data)->getDefaultGroup<SERVER>().close();
+        uv_close(stop, [](uv_handle_t *h) {
+            delete (uv_async_t *) h;
+        });
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(startMutex);
+        worker->hub = &hub;
+        startCondition.notify_all();
+        startCondition.wait(lock, [this] {return started || cancelled;});
+        if (!started) {
+            worker->hub = nullptr;
+            return;
+        }
+    }
+
+    if (workerHandler) {
+        workerHandler(hub, worker->index);
+    }
+
+    // sockets only arrive once the loop runs, after the handlers are in place;
+    // a transferred one was counted when it was handed over
+    std::function<void(WebSocket<SERVER>, HttpRequest)> connectionHandler = group.connectionHandler;
+    group.onTransfer([connectionHandler](WebSocket<SERVER> ws) {
+        connectionHandler(ws, HttpRequest());
+    });
+    if (balance == REUSE_PORT || balance == SHARED_LISTEN) {
+        group.onConnection([worker, connectionHandler](WebSocket<SERVER> ws, HttpRequest req) {
+            worker->connections++;
+            connectionHandler(ws, req);
+        });
+    }
+    std::function<void(WebSocket<SERVER>, int, char *, size_t)> disconnectionHandler = group.disconnectionHandler;
+    group.onDisconnection([worker, disconnectionHandler](WebSocket<SERVER> ws, int code, char *message, size_t length) {
+        disconnectionHandler(ws, code, message, length);
+        worker->connections--;
+    });
+
+    hub.run();
+
+    std::lock_guard<std::mutex> lock(startMutex);
+    worker->hub = nullptr;
+}
+
+void HubPool::transfer(WebSocket<SERVER> ws, int from, int to) {
+    workers[from]->connections--;
+    workers[to]->connections++;
+    ws.transfer(&workers[to]->hub->getDefaultGroup<SERVER>());
+}
+
+HubPool::Worker *HubPool::pick() {
+    Worker *worker = workers[next++ % workers.size()];
+    if (balance == LEAST_CONNECTIONS) {
+        // ties go round robin, starting from the next worker in turn
+        for (size_t i = 1; i < workers.size(); i++) {
+            Worker *other = workers[(next - 1 + i) % workers.size()];
+            if (other->connections < worker->connections) {
+                worker = other;
+            }
+        }
+    }
+    return worker;
+}
+
+}
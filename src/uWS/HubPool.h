@@ -0,0 +1,126 @@
+#ifndef HUBPOOL_UWS_H
+#define HUBPOOL_UWS_H
+
+#include "Hub.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace uWS {
+
+// Accepts WebSocket connections on one Hub and hands each of them to one of
+// several worker Hubs, every one running its own loop on its own thread.
+// Handlers and any per-worker state are installed in onWorker, on the worker's
+// thread; a transferred connection then fires the worker's connection
+// handler, without the upgrade request's headers.
+struct WIN32_EXPORT HubPool {
+    enum Balance {
+        ROUND_ROBIN,
+        LEAST_CONNECTIONS,
+        // every worker listens on the port itself with SO_REUSEPORT (Linux)
+        // and the kernel spreads the connections: nothing is transferred, and
+        // connections and HTTP requests are handled by the workers entirely
+        REUSE_PORT,
+        // like REUSE_PORT, but the workers accept from one shared socket,
+        // whichever is free first; with the micro uUV loop on Linux, each
+        // connection wakes only one of them
+        SHARED_LISTEN
+    };
+
+    // recvLength is the receive buffer of every loop, the most one read of a
+    // socket takes in. With cpus, worker i runs pinned to cpus[i % size]
+    // (Linux), from before its Hub is created: its loop, receive buffer and
+    // whatever its handlers allocate are then first touched, and so placed,
+    // on that CPU's NUMA node
+    HubPool(int workers, Balance balance = LEAST_CONNECTIONS, int extensionOptions = 0, int recvLength = Hub::LARGE_BUFFER_SIZE,
+            const std::vector<int> &cpus = std::vector<int>());
+    ~HubPool();
+
+    void onWorker(std::function<void(Hub &worker, int index)> handler);
+
+    // the accepting Hub, for listening and plain HTTP requests; unused with
+    // REUSE_PORT and SHARED_LISTEN
+    Hub &getAcceptor() {return acceptor;}
+    bool listen(int port, uS::TLS::Context sslContext = nullptr, int options = 0);
+#ifndef _WIN32
+    // Hub::listenUnix on the acceptor; with REUSE_PORT and SHARED_LISTEN the
+    // workers accept from the one socket, as Unix domain sockets are not
+    // spread by the kernel
+    bool listenUnix(const char *path, uS::TLS::Context sslContext = nullptr, int options = 0);
+#endif
+
+    // Hub::setDeflateOptions on the acceptor, which negotiates, and on the
+    // workers, which deflate; to be called before run
+    void setDeflateOptions(int windowBits, int memLevel = 8, int level = Z_DEFAULT_COMPRESSION);
+
+    // the fragment reassembly of the acceptor and all workers, from any thread
+    uS::FragmentPool::Stats getFragmentStats();
+
+    // Node::setListenBacklog and setAcceptBudget on the acceptor and the
+    // workers, to be called before listen
+    void setListenBacklog(int backlog);
+    void setAcceptBudget(int budget);
+
+    // the connections accepted by the acceptor and all workers, from any thread
+    uS::AcceptStats getAcceptStats();
+
+    // Node::setZeroCopyThreshold on the acceptor and the workers
+    void setZeroCopyThreshold(size_t threshold);
+
+    // the zero-copy sends of the acceptor and all workers, from any thread
+    uS::ZeroCopyStats getZeroCopyStats();
+
+    // Hub::getLoopStats of the acceptor and then of each worker, from any
+    // thread
+    std::vector<uS::LoopStats> getLoopStats();
+
+    // starts the workers and runs the accepting loop on the calling thread;
+    // when it ends, the workers close their connections and are joined
+    void run();
+
+    // hands a connection of worker from over to worker to, on from's thread:
+    // it leaves from's loop with its user data and unsent messages, and
+    // fires to's connection handler there, as the acceptor's connections do
+    void transfer(WebSocket<SERVER> ws, int from, int to);
+
+    int getWorkers() const {return (int) workers.size();}
+    int getConnections(int index) const {return workers[index]->connections;}
+    // the CPU worker index runs on, or -1 if it is not pinned; set once the
+    // worker is up, which the constructor waits for
+    int getCpu(int index) const {return workers[index]->cpu;}
+
+private:
+    struct Worker {
+        int index;
+        // -1 if not pinned
+        int cpu = -1;
+        Hub *hub = nullptr;
+        uv_async_t *stop = nullptr;
+        std::atomic<int> connections;
+        std::thread thread;
+    };
+
+    Hub acceptor;
+    std::vector<Worker *> workers;
+    Balance balance;
+    int extensionOptions;
+    int recvLength;
+    unsigned int next = 0;
+
+    std::function<void(Hub &, int)> workerHandler;
+    std::mutex startMutex;
+    std::condition_variable startCondition;
+    bool started = false, cancelled = false;
+
+    void workerMain(Worker *worker);
+    Worker *pick();
+
+    HubPool(const HubPool &);
+    HubPool &operator=(const HubPool &);
+};
+
+}
+
+#endif // HUBPOOL_UWS_H
@@ -1,4 +1,5 @@
 #include "Networking.h"
+#include <map>
 
 namespace uS {
 
@@ -10,13 +11,18 @@ Context::Context(const Context &other)
         context = other.context;
         SSL_CTX_up_ref(context);
     }
+    password = other.password;
 }
 
 Context &Context::operator=(const Context &other) {
     if (other.context) {
-        context = other.context;
-        SSL_CTX_up_ref(context);
+        SSL_CTX_up_ref(other.context);
+    }
+    if (context) {
+        SSL_CTX_free(context);
     }
+    context = other.context;
+    password = other.password;
     return *this;
 }
 
@@ -27,6 +33,16 @@ Context::~Context()
     }
 }
 
+Context::Handshakes Context::getHandshakes() const
+{
+    Handshakes handshakes = {0, 0};
+    if (context) {
+        handshakes.resumed = SSL_CTX_sess_hits(context);
+        handshakes.full = SSL_CTX_sess_accept_good(context) - handshakes.resumed;
+    }
+    return handshakes;
+}
+
 struct Init {
     Init() {SSL_library_init();}
     ~Init() {/*EVP_cleanup();*/}
@@ -46,6 +62,14 @@ Context createContext(std::string certChainFileName, std::string keyFileName, st
     }
 
     SSL_CTX_set_options(context.context, SSL_OP_NO_SSLv3);
+    SSL_CTX_set_mode(context.context, SSL_MODE_RELEASE_BUFFERS);
+
+    // session tickets are on by default and sealed with keys of this context;
+    // the cache additionally serves clients that resume by session id
+    static const unsigned char sessionIdContext[] = "uWS";
+    SSL_CTX_set_session_id_context(context.context, sessionIdContext, sizeof(sessionIdContext) - 1);
+    SSL_CTX_set_session_cache_mode(context.context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(context.context, 16384);
 
     if (SSL_CTX_use_certificate_chain_file(context.context, certChainFileName.c_str()) != 1) {
         return nullptr;
@@ -56,6 +80,40 @@ Context createContext(std::string certChainFileName, std::string keyFileName, st
     return context;
 }
 
+Context getContext(std::string certChainFileName, std::string keyFileName, std::string keyFilePassword)
+{
+    static std::mutex cacheMutex;
+    static std::map<std::pair<std::string, std::string>, Context> cache;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    Context &cached = cache[std::make_pair(certChainFileName, keyFileName)];
+    if (!cached) {
+        cached = createContext(certChainFileName, keyFileName, keyFilePassword);
+    }
+    return cached;
+}
+
+}
+
+std::atomic<size_t> Slab::bytes {0};
+
+Slab::Block *Slab::refill(int index) {
+    // the slabs are reachable from here until the process exits
+    static std::mutex slabsMutex;
+    static std::vector<char *> slabs;
+
+    size_t blockSize = (index + 1) * granularity;
+    char *slab = new char[blockSize * slabBlocks];
+    {
+        std::lock_guard<std::mutex> lock(slabsMutex);
+        slabs.push_back(slab);
+    }
+    bytes.fetch_add(blockSize * slabBlocks, std::memory_order_relaxed);
+    for (int i = 0; i < slabBlocks - 1; i++) {
+        ((Block *) (slab + i * blockSize))->next = (Block *) (slab + (i + 1) * blockSize);
+    }
+    ((Block *) (slab + (slabBlocks - 1) * blockSize))->next = nullptr;
+    return (Block *) slab;
 }
 
 #ifndef _WIN32
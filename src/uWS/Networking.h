@@ -44,6 +44,10 @@ inline SOCKET dup(SOCKET socket) {
 }
 #else
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <cstring>
@@ -54,11 +58,40 @@ inline SOCKET dup(SOCKET socket) {
 
 #include "uUV.h"
 #include <openssl/ssl.h>
+// OpenSSL 3 built with kernel TLS support
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+#define UWS_KERNEL_TLS
+#endif
+// sends that leave the data in place until the kernel reports it done on the
+// error queue, a POLLERR that only the micro uUV loop keeps polling after
+#if defined(USE_MICRO_UV) && defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#define UWS_ZERO_COPY
+#endif
+// static tracepoints of provider "uws" when built with UWS_USDT (needs
+// <sys/sdt.h>): a nop each, for uprobes to attach to, and nothing otherwise
+//   websocket__data(fd, length)      websocket__send(fd, length, opCode)
+//   inflate__entry(length)           inflate__return(length)
+//   socket__transfer(fd, queuedBytes)
+#ifdef UWS_USDT
+#include <sys/sdt.h>
+#define UWS_PROBE1(name, a) DTRACE_PROBE1(uws, name, a)
+#define UWS_PROBE2(name, a, b) DTRACE_PROBE2(uws, name, a, b)
+#define UWS_PROBE3(name, a, b, c) DTRACE_PROBE3(uws, name, a, b, c)
+#else
+#define UWS_PROBE1(name, a)
+#define UWS_PROBE2(name, a, b)
+#define UWS_PROBE3(name, a, b, c)
+#endif
 #include <vector>
 #include <string>
 #include <mutex>
+#include <atomic>
 #include <algorithm>
+#include <cstddef>
 #include <memory>
+#include <new>
+#include <utility>
 
 namespace uS {
 
@@ -88,30 +121,647 @@ public:
     Context(const Context &other);
     Context &operator=(const Context &other);
     ~Context();
-    operator bool() {
+    operator bool() const {
         return context;
     }
 
     SSL_CTX *getNativeContext() {
         return context;
     }
+
+    // handshakes completed on the server side, and those of them that resumed
+    // an earlier session instead of running the key exchange again
+    struct Handshakes {
+        long full, resumed;
+    };
+    Handshakes getHandshakes() const;
 };
 
+// a new context, which keeps the sessions of its clients for resumption, by
+// session ticket or from its cache, for as long as it is in use
 Context createContext(std::string certChainFileName, std::string keyFileName, std::string keyFilePassword = std::string());
 
+// the context created for these files before, or a new one: every listening
+// socket using it resumes the sessions of the others, so clients reconnecting
+// to another Hub or after the server listens again skip the full handshake
+Context getContext(std::string certChainFileName, std::string keyFileName, std::string keyFilePassword = std::string());
+
 }
 
 struct SocketData;
 
+// Free lists of small blocks in size classes of 16 bytes, for queued messages
+// and send buffers. Freed blocks are kept for reuse, up to depth blocks per
+// class; only the ones beyond that go back to the heap. Given a slab, new
+// blocks are cut from it before the heap, and those are always kept. A pool
+// belongs to one loop and is not thread safe.
+struct WIN32_EXPORT MemoryPool {
+    static const int maxSize = 1024;
+    static const int classes = (maxSize >> 4) + 1;
+    static const int defaultDepth = 32;
+
+    struct Stats {
+        // blocks handed out, and those of them that had to come from the heap
+        size_t allocations = 0, heapAllocations = 0;
+        // blocks returned, and those of them that went back to the heap
+        size_t frees = 0, heapFrees = 0;
+        // blocks currently kept for reuse, and their size in bytes
+        size_t cached = 0, cachedBytes = 0;
+    };
+
+    MemoryPool(int depth = defaultDepth) : depth(depth) {
+        for (int i = 0; i < classes; i++) {
+            freeList[i] = nullptr;
+            cached[i] = 0;
+        }
+    }
+
+    ~MemoryPool() {
+        setDepth(0);
+    }
+
+    char *get(int index) {
+        stats.allocations++;
+        if (Block *block = freeList[index]) {
+            freeList[index] = block->next;
+            cached[index]--;
+            stats.cached--;
+            stats.cachedBytes -= blockSize(index);
+            return (char *) block;
+        }
+        if (slabUsed + blockSize(index) <= slabLength) {
+            slabUsed += blockSize(index);
+            return slab + slabUsed - blockSize(index);
+        }
+        stats.heapAllocations++;
+        return new char[blockSize(index)];
+    }
+
+    void free(char *memory, int index) {
+        stats.frees++;
+        if (cached[index] < depth || inSlab(memory)) {
+            Block *block = (Block *) memory;
+            block->next = freeList[index];
+            freeList[index] = block;
+            cached[index]++;
+            stats.cached++;
+            stats.cachedBytes += blockSize(index);
+        } else {
+            stats.heapFrees++;
+            delete [] memory;
+        }
+    }
+
+    // trims the free lists right away when the depth shrinks
+    void setDepth(int depth) {
+        this->depth = depth;
+        for (int i = 0; i < classes; i++) {
+            while (cached[i] > depth) {
+                Block *block = freeList[i];
+                freeList[i] = block->next;
+                cached[i]--;
+                stats.cached--;
+                stats.cachedBytes -= blockSize(i);
+                // one of the slab is only unlinked
+                if (!inSlab((char *) block)) {
+                    delete [] (char *) block;
+                }
+            }
+        }
+    }
+
+    // memory to cut blocks from, such as the rest of a huge page, which the
+    // pool does not own and which must outlive it
+    void setSlab(char *memory, size_t length) {
+        slab = memory;
+        slabLength = length;
+        slabUsed = 0;
+    }
+
+    int getDepth() const {return depth;}
+    const Stats &getStats() const {return stats;}
+
+    // fills every free list to its depth with blocks written through once,
+    // so the first messages take blocks that are already faulted in
+    void fill() {
+        for (int i = 0; i < classes; i++) {
+            while (cached[i] < depth) {
+                char *memory;
+                if (slabUsed + blockSize(i) <= slabLength) {
+                    memory = slab + slabUsed;
+                    slabUsed += blockSize(i);
+                } else {
+                    memory = new char[blockSize(i)];
+                }
+                memset(memory, 0, blockSize(i));
+                Block *block = (Block *) memory;
+                block->next = freeList[i];
+                freeList[i] = block;
+                cached[i]++;
+                stats.cached++;
+                stats.cachedBytes += blockSize(i);
+            }
+        }
+    }
+
+private:
+    struct Block {
+        Block *next;
+    };
+
+    // every block is large enough to link it into its free list
+    static size_t blockSize(int index) {
+        return index ? index << 4 : 16;
+    }
+
+    bool inSlab(char *memory) const {
+        return memory >= slab && memory < slab + slabLength;
+    }
+
+    Block *freeList[classes];
+    int cached[classes];
+    int depth;
+    Stats stats;
+    char *slab = nullptr;
+    size_t slabLength = 0, slabUsed = 0;
+};
+
+// Buffers in power of two size classes from 4 KB to 16 MB, the largest
+// payload accepted, for reassembling messages that arrive in parts. A socket
+// takes a buffer for its partial message and gives it back once the message
+// is complete, so idle sockets hold none. Up to depth buffers per class are
+// kept for reuse. A pool belongs to one loop; its counters are atomics that
+// only the loop's thread writes, so that any thread can read the stats.
+struct WIN32_EXPORT FragmentPool {
+    static const int minShift = 12;
+    static const int classes = 24 - minShift + 1;
+    static const int defaultDepth = 4;
+
+    struct Stats {
+        // messages reassembled, and their bytes
+        size_t messages = 0, bytes = 0;
+        // partial messages that outgrew their buffer and were moved to a
+        // larger one
+        size_t grows = 0;
+        // buffers handed out, and those of them that had to come from the heap
+        size_t allocations = 0, heapAllocations = 0;
+        // buffers currently kept for reuse, and their size in bytes
+        size_t cached = 0, cachedBytes = 0;
+
+        Stats &operator+=(const Stats &other) {
+            messages += other.messages;
+            bytes += other.bytes;
+            grows += other.grows;
+            allocations += other.allocations;
+            heapAllocations += other.heapAllocations;
+            cached += other.cached;
+            cachedBytes += other.cachedBytes;
+            return *this;
+        }
+    };
+
+    FragmentPool(int depth = defaultDepth) : depth(depth) {
+        for (int i = 0; i < classes; i++) {
+            freeList[i] = nullptr;
+            cached[i] = 0;
+        }
+    }
+
+    ~FragmentPool() {
+        setDepth(0);
+    }
+
+    // a buffer of at least length bytes, whose size is returned in capacity
+    char *get(size_t length, size_t &capacity) {
+        add(allocations, 1);
+        int index = sizeClass(length);
+        if (index < 0) {
+            add(heapAllocations, 1);
+            capacity = length;
+            return new char[length];
+        }
+        capacity = (size_t) 1 << (index + minShift);
+        if (Block *block = freeList[index]) {
+            freeList[index] = block->next;
+            cached[index]--;
+            add(cachedBuffers, -1);
+            add(cachedBytes, -(long) capacity);
+            return (char *) block;
+        }
+        add(heapAllocations, 1);
+        return new char[capacity];
+    }
+
+    void free(char *memory, size_t capacity) {
+        int index = sizeClass(capacity);
+        if (index < 0 || ((size_t) 1 << (index + minShift)) != capacity || cached[index] >= depth) {
+            delete [] memory;
+            return;
+        }
+        Block *block = (Block *) memory;
+        block->next = freeList[index];
+        freeList[index] = block;
+        cached[index]++;
+        add(cachedBuffers, 1);
+        add(cachedBytes, (long) capacity);
+    }
+
+    // a message of length bytes was reassembled, after grows moves
+    void reassembled(size_t length, int grows) {
+        add(messages, 1);
+        add(bytes, (long) length);
+        add(this->grows, grows);
+    }
+
+    // trims the free lists right away when the depth shrinks
+    void setDepth(int depth) {
+        this->depth = depth;
+        for (int i = 0; i < classes; i++) {
+            while (cached[i] > depth) {
+                Block *block = freeList[i];
+                freeList[i] = block->next;
+                cached[i]--;
+                add(cachedBuffers, -1);
+                add(cachedBytes, -(long) ((size_t) 1 << (i + minShift)));
+                delete [] (char *) block;
+            }
+        }
+    }
+
+    int getDepth() const {return depth;}
+
+    // fills the free list of the class of length bytes to its depth, as
+    // MemoryPool::fill does
+    void fill(size_t length) {
+        int index = sizeClass(length);
+        if (index < 0) {
+            return;
+        }
+        size_t capacity = (size_t) 1 << (index + minShift);
+        while (cached[index] < depth) {
+            char *memory = new char[capacity];
+            memset(memory, 0, capacity);
+            Block *block = (Block *) memory;
+            block->next = freeList[index];
+            freeList[index] = block;
+            cached[index]++;
+            add(cachedBuffers, 1);
+            add(cachedBytes, (long) capacity);
+        }
+    }
+
+    Stats getStats() const {
+        Stats stats;
+        stats.messages = messages.load(std::memory_order_relaxed);
+        stats.bytes = bytes.load(std::memory_order_relaxed);
+        stats.grows = grows.load(std::memory_order_relaxed);
+        stats.allocations = allocations.load(std::memory_order_relaxed);
+        stats.heapAllocations = heapAllocations.load(std::memory_order_relaxed);
+        stats.cached = cachedBuffers.load(std::memory_order_relaxed);
+        stats.cachedBytes = cachedBytes.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    struct Block {
+        Block *next;
+    };
+
+    // the class of buffers of at least length bytes, -1 past the largest
+    static int sizeClass(size_t length) {
+        int index = 0;
+        while (((size_t) 1 << (index + minShift)) < length) {
+            if (++index == classes) {
+                return -1;
+            }
+        }
+        return index;
+    }
+
+    // only the loop's thread writes, so a load and a store suffice
+    static void add(std::atomic<size_t> &counter, long value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    Block *freeList[classes];
+    int cached[classes];
+    int depth;
+    std::atomic<size_t> messages {0}, bytes {0}, grows {0}, allocations {0}, heapAllocations {0}, cachedBuffers {0}, cachedBytes {0};
+};
+
+// a queue the loop's thread drains and any thread pushes to, without locks:
+// pushing links onto a stack, draining takes all of it at once and visits it
+// in the order it was pushed in; a copy, as every Group makes of its Hub's
+// NodeData before use, starts out empty
+template <class T>
+struct MpscQueue {
+    MpscQueue() : head(nullptr) {}
+    MpscQueue(const MpscQueue &) : head(nullptr) {}
+
+    ~MpscQueue() {
+        drain([](T &) {});
+    }
+
+    void push(const T &value) {
+        Link *link = new Link {value, head.load(std::memory_order_relaxed)};
+        length.fetch_add(1, std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(link->next, link, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // what is pushed and not yet drained, from any thread
+    size_t size() const {
+        return length.load(std::memory_order_relaxed);
+    }
+
+    // what is pushed meanwhile, also by the handler, waits for the next drain
+    template <class F>
+    void drain(F handler) {
+        Link *pushed = head.exchange(nullptr, std::memory_order_acquire), *ordered = nullptr;
+        while (pushed) {
+            Link *next = pushed->next;
+            pushed->next = ordered;
+            ordered = pushed;
+            pushed = next;
+        }
+        while (ordered) {
+            Link *next = ordered->next;
+            length.fetch_sub(1, std::memory_order_relaxed);
+            handler(ordered->value);
+            delete ordered;
+            ordered = next;
+        }
+    }
+
+private:
+    struct Link {
+        T value;
+        Link *next;
+    };
+
+    std::atomic<Link *> head;
+    std::atomic<size_t> length{0};
+
+    MpscQueue &operator=(const MpscQueue &);
+};
+
+// whether the loop is already being woken, and like the queues clear in a copy
+struct WakeupFlag {
+    std::atomic<bool> pending;
+
+    WakeupFlag() : pending(false) {}
+    WakeupFlag(const WakeupFlag &) : pending(false) {}
+
+private:
+    WakeupFlag &operator=(const WakeupFlag &);
+};
+
+// a bounded ring of tasks for the loop's thread, which any thread posts to
+// without locks or allocations: a task, any callable, is moved into a slot
+// and run and destroyed there; the slots are claimed in turn, each marked
+// by a sequence number as free for a lap of the ring or filled
+class WIN32_EXPORT Mailbox {
+public:
+    // what a task, together with what it captures, may take up
+    static const size_t TASK_SIZE = 112;
+
+    // capacity is rounded up to a power of two
+    explicit Mailbox(size_t capacity) {
+        size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots = new Slot[size];
+        for (size_t i = 0; i < size; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    // tasks still waiting are destroyed without running
+    ~Mailbox() {
+        for (; slots[head & (size - 1)].sequence.load(std::memory_order_acquire) == head + 1; head++) {
+            Slot &slot = slots[head & (size - 1)];
+            slot.run(slot.task, false);
+        }
+        delete [] slots;
+    }
+
+    // false while the ring is full
+    template <class F>
+    bool push(F &&task) {
+        typedef typename std::decay<F>::type Task;
+        static_assert(sizeof(Task) <= TASK_SIZE, "task captures too much for a Mailbox slot");
+        static_assert(alignof(Task) <= alignof(std::max_align_t), "task is overaligned for a Mailbox slot");
+
+        size_t position = tail.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;) {
+            slot = &slots[position & (size - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            if (sequence == position) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if ((ptrdiff_t) (sequence - position) < 0) {
+                // still filled from the lap before
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+        new (slot->task) Task(std::forward<F>(task));
+        slot->run = &Mailbox::run<Task>;
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // runs the tasks posted so far, at most a ring's worth; true if more
+    // are waiting. A task posting to its own mailbox is run by this drain
+    // or the next, never within itself
+    bool drain() {
+        if (draining) {
+            return false;
+        }
+        draining = true;
+        for (size_t i = 0; i < size && slots[head & (size - 1)].sequence.load(std::memory_order_acquire) == head + 1; i++) {
+            Slot &slot = slots[head & (size - 1)];
+            slot.run(slot.task, true);
+            slot.sequence.store(head + size, std::memory_order_release);
+            head++;
+        }
+        draining = false;
+        return slots[head & (size - 1)].sequence.load(std::memory_order_acquire) == head + 1;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        void (*run)(void *task, bool execute);
+        alignas(std::max_align_t) unsigned char task[TASK_SIZE];
+    };
+
+    template <class Task>
+    static void run(void *storage, bool execute) {
+        Task *task = (Task *) storage;
+        if (execute) {
+            (*task)();
+        }
+        task->~Task();
+    }
+
+    Slot *slots;
+    size_t size;
+    std::atomic<size_t> tail;
+    // only the loop's thread drains
+    size_t head = 0;
+    bool draining = false;
+
+    Mailbox(const Mailbox &);
+    Mailbox &operator=(const Mailbox &);
+};
+
+// what the listening sockets of a loop accepted; as in FragmentPool, the
+// counters are atomics only the loop's thread writes
+struct AcceptStats {
+    // connections accepted, and the readiness events they were taken in
+    size_t accepted = 0, wakeups = 0;
+    // events that stopped at the accept budget, leaving connections queued
+    size_t budgetExhausted = 0;
+    // accepts that failed other than on an empty queue, such as for want of
+    // file descriptors
+    size_t errors = 0;
+    // the most connections one event took
+    size_t maxBatch = 0;
+    // connections held unread, and turned away, by admission control (see
+    // uWS::Group::setAdmission)
+    size_t deferred = 0, rejected = 0;
+
+    AcceptStats &operator+=(const AcceptStats &other) {
+        accepted += other.accepted;
+        wakeups += other.wakeups;
+        budgetExhausted += other.budgetExhausted;
+        errors += other.errors;
+        deferred += other.deferred;
+        rejected += other.rejected;
+        maxBatch = std::max(maxBatch, other.maxBatch);
+        return *this;
+    }
+};
+
+// how a loop listens and accepts, shared by its groups, which copy the
+// loop's NodeData
+struct AcceptCounters {
+    // the queue length of the sockets listened on from now on, and the most
+    // connections accepted per readiness event of one
+    int listenBacklog = 512;
+    int acceptBudget = 256;
+
+    std::atomic<size_t> accepted{0}, wakeups{0}, budgetExhausted{0}, errors{0}, maxBatch{0};
+    std::atomic<size_t> deferred{0}, rejected{0};
+
+    void add(std::atomic<size_t> &counter, size_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    AcceptStats getStats() const {
+        AcceptStats stats;
+        stats.accepted = accepted.load(std::memory_order_relaxed);
+        stats.wakeups = wakeups.load(std::memory_order_relaxed);
+        stats.budgetExhausted = budgetExhausted.load(std::memory_order_relaxed);
+        stats.errors = errors.load(std::memory_order_relaxed);
+        stats.maxBatch = maxBatch.load(std::memory_order_relaxed);
+        stats.deferred = deferred.load(std::memory_order_relaxed);
+        stats.rejected = rejected.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
+struct ZeroCopyStats {
+    // zero-copy sends and their bytes, those the kernel reported done, and
+    // those of them it copied after all, as it does on loopback
+    size_t sends = 0, bytes = 0, completions = 0, copied = 0;
+
+    ZeroCopyStats &operator+=(const ZeroCopyStats &other) {
+        sends += other.sends;
+        bytes += other.bytes;
+        completions += other.completions;
+        copied += other.copied;
+        return *this;
+    }
+};
+
+// how a loop sends large messages without copying them (MSG_ZEROCOPY, with
+// the micro uUV loop on Linux), shared by its groups like AcceptCounters
+struct ZeroCopyCounters {
+    // plain sockets send what they have queued with MSG_ZEROCOPY once it
+    // comes to this many bytes; 0 copies all
+    size_t threshold = 0;
+
+    std::atomic<size_t> sends{0}, bytes{0}, completions{0}, copied{0};
+
+    void add(std::atomic<size_t> &counter, size_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    ZeroCopyStats getStats() const {
+        ZeroCopyStats stats;
+        stats.sends = sends.load(std::memory_order_relaxed);
+        stats.bytes = bytes.load(std::memory_order_relaxed);
+        stats.completions = completions.load(std::memory_order_relaxed);
+        stats.copied = copied.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
+struct LoopStats {
+    // seconds since the loop started running, and those of them it waited
+    // for events in rather than running handlers
+    double seconds = 0, idleSeconds = 0;
+    // its iterations and the events they handled
+    size_t iterations = 0, events = 0;
+    // sockets handed over to the loop that it has yet to take, and the bytes
+    // its sockets have queued that the kernel did not take yet
+    size_t pendingTransfers = 0, queuedBytes = 0;
+    // the sockets of its default server group
+    size_t webSockets = 0, httpSockets = 0;
+    // bytes of its Hub's shared zlib streams and buffers (see
+    // Hub::getCompressionMemory)
+    size_t compressionBytes = 0;
+    // bytes of its buffers on huge pages (see Node::useHugePages), and
+    // whether they are reserved ones rather than transparent ones advised
+    size_t hugePageBytes = 0;
+    bool explicitHugePages = false;
+};
+
+// what a loop keeps of its own state for LoopStats, shared by its groups like
+// AcceptCounters and written by its thread only
+struct LoopCounters {
+    // when the loop started running, in steady clock nanoseconds
+    std::atomic<uint64_t> started{0};
+    std::atomic<size_t> queuedBytes{0};
+
+    void add(std::atomic<size_t> &counter, size_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
 struct WIN32_EXPORT NodeData {
     char *recvBufferMemoryBlock;
     char *recvBuffer;
     int recvLength;
+    // the mapping the receive buffer and the memory pool's slab are on, if
+    // any, see Node::useHugePages
+    char *hugePages = nullptr;
+    size_t hugePagesLength = 0;
+    bool explicitHugePages = false;
     uv_loop_t *loop;
     void *user = nullptr;
-    static const int preAllocMaxSize = 1024;
-    char **preAlloc;
-    SSL_CTX *clientContext;
+    static const int preAllocMaxSize = MemoryPool::maxSize;
+    MemoryPool *memoryPool;
+    FragmentPool *fragmentPool;
+    AcceptCounters *acceptCounters;
+    ZeroCopyCounters *zeroCopyCounters;
+    LoopCounters *loopCounters;
 
     uv_async_t *async = nullptr;
     pthread_t tid;
@@ -130,35 +780,132 @@ struct WIN32_EXPORT NodeData {
         uv_async_init(loop, async, NodeData::asyncCallback);
     }
 
-    std::mutex *asyncMutex;
-    std::vector<TransferData> transferQueue;
-    std::vector<uv_poll_t *> changePollQueue;
+    MpscQueue<TransferData> transferQueue;
+    MpscQueue<uv_poll_t *> changePollQueue;
     static void asyncCallback(uv_async_t *async);
 
+    // for other threads, after pushing to the queues: a burst of pushes
+    // costs one wakeup, as only the first since the loop last took them
+    // signals it
+    void wakeup() {
+        if (!wakeupFlag.pending.exchange(true)) {
+            uv_async_send(async);
+        }
+    }
+
+    WakeupFlag wakeupFlag;
+
+    // tasks posted from other threads, once addMailbox has been called on
+    // the loop's; drained along with the transfers, and deleted by the Hub
+    Mailbox *mailbox = nullptr;
+
+    void addMailbox(size_t capacity) {
+        if (!async) {
+            addAsync();
+        }
+        mailbox = new Mailbox(capacity);
+    }
+
+    // from any thread, while the group has a mailbox: has task run on the
+    // loop's thread; false, and task left alone, while the mailbox is full
+    template <class F>
+    bool post(F &&task) {
+        if (!mailbox->push(std::forward<F>(task))) {
+            return false;
+        }
+        wakeup();
+        return true;
+    }
+
     static int getMemoryBlockIndex(size_t length) {
         return (length >> 4) + bool(length & 15);
     }
 
     char *getSmallMemoryBlock(int index) {
-        if (preAlloc[index]) {
-            char *memory = preAlloc[index];
-            preAlloc[index] = nullptr;
-            return memory;
-        } else {
-            return new char[index << 4];
-        }
+        return memoryPool->get(index);
     }
 
     void freeSmallMemoryBlock(char *memory, int index) {
-        if (!preAlloc[index]) {
-            preAlloc[index] = memory;
-        } else {
-            delete [] memory;
+        memoryPool->free(memory, index);
+    }
+};
+
+// fixed size blocks for what every connection allocates and frees again: its
+// poll handle and its SocketData, and the HttpSocket and WebSocket states
+// that take the SocketData's place. Blocks come in size classes of
+// granularity bytes up to maxSize, cut slabBlocks at a time from slabs that
+// stay until the process exits, and go back to a free list of the thread
+// freeing them: each loop recycles the blocks of the connections it closes
+// without the heap, also those of sockets handed to it by another loop.
+// Larger sizes come from the heap
+struct WIN32_EXPORT Slab {
+    static const size_t granularity = 64;
+    static const size_t maxSize = 1024;
+    static const int classes = maxSize / granularity;
+    static const int slabBlocks = 64;
+
+    static void *allocate(size_t size) {
+        if (size > maxSize) {
+            return ::operator new(size);
+        }
+        Block *&freeList = freeLists()[sizeClass(size)];
+        if (!freeList) {
+            freeList = refill(sizeClass(size));
         }
+        Block *block = freeList;
+        freeList = block->next;
+        return block;
     }
+
+    static void free(void *memory, size_t size) {
+        if (size > maxSize) {
+            ::operator delete(memory);
+            return;
+        }
+        Block *block = (Block *) memory;
+        Block *&freeList = freeLists()[sizeClass(size)];
+        block->next = freeList;
+        freeList = block;
+    }
+
+    // bytes of all slabs so far, from any thread
+    static size_t getBytes() {return bytes.load(std::memory_order_relaxed);}
+
+private:
+    struct Block {
+        Block *next;
+    };
+
+    static int sizeClass(size_t size) {
+        return size ? (int) ((size - 1) / granularity) : 0;
+    }
+
+    static Block **freeLists() {
+        static thread_local Block *lists[classes];
+        return lists;
+    }
+
+    // a new slab of the class, its blocks linked up
+    static Block *refill(int index);
+    static std::atomic<size_t> bytes;
 };
 
+// the poll handles of sockets, listening ones included, from the Slab
+inline uv_poll_t *newPoll() {
+    return new (Slab::allocate(sizeof(uv_poll_t))) uv_poll_t;
+}
+
+inline void deletePoll(uv_poll_t *p) {
+    p->~uv_poll_t();
+    Slab::free(p, sizeof(uv_poll_t));
+}
+
 struct SocketData {
+    // from the Slab, as are the states derived from it; a state deleted as
+    // its base goes to a smaller class, which its block still fits
+    static void *operator new(size_t size) {return Slab::allocate(size);}
+    static void operator delete(void *memory, size_t size) {Slab::free(memory, size);}
+
     NodeData *nodeData;
     SSL *ssl;
     void *user = nullptr;
@@ -167,37 +914,153 @@ struct SocketData {
     int poll;
     bool shuttingDown = false;
 
+    // writes collected while corked, see Socket::corkWrites
+    bool corked = false;
+    // not read until Socket::resumeReading, see Socket::pauseReading
+    bool readPaused = false;
+    // a KernelTls: whether the kernel encrypts what is sent, so the socket is
+    // written like a plain one
+    unsigned char kernelTls = 0;
+    std::string corkBuffer;
+
     SocketData(NodeData *nodeData) : nodeData(nodeData) {
 
     }
 
     struct Queue {
+        // where insert puts a message: the messages behind the front one, the
+        // one being sent, are kept in lane order and each lane in the order
+        // it was queued, so a message overtakes those of later lanes at
+        // their frame boundaries
+        enum Lane : unsigned char {
+            // control frames
+            LANE_CONTROL,
+            LANE_DEFAULT,
+            // large frames whose latency matters less, and a close frame,
+            // which must follow all the others
+            LANE_BULK,
+            LANES
+        };
+
         struct Message {
             const char *data;
             size_t length;
             Message *nextMessage = nullptr;
             void (*callback)(void *socket, void *data, bool cancelled, void *reserved) = nullptr;
             void *callbackData = nullptr, *reserved = nullptr;
+            // size class of the block the message lives in, or -1 if it was
+            // too large for the memory pool
+            int memoryIndex;
+            // set on messages that only carry the latest state of something:
+            // while queued, they may be dropped for a newer one
+            const void *stateKey;
+            // whether a zero-copy send took part of the message, whose memory
+            // then stays until the kernel is done with send zeroCopyId, the
+            // last that did
+            bool zeroCopied;
+            uint32_t zeroCopyId;
+            // a Lane
+            unsigned char lane;
         };
 
+        static void freeMessage(Message *message, NodeData *nodeData) {
+            if (message->memoryIndex >= 0) {
+                nodeData->freeSmallMemoryBlock((char *) message, message->memoryIndex);
+            } else {
+                delete [] (char *) message;
+            }
+        }
+
         Message *head = nullptr, *tail = nullptr;
-        void pop()
+        // the last message of each lane behind the front one, if it has any
+        Message *lastInLane[LANES] = {};
+        // the bytes of all queued messages not yet sent
+        size_t bufferedAmount = 0;
+        void pop(NodeData *nodeData)
         {
+            bufferedAmount -= head->length;
             Message *nextMessage;
             if ((nextMessage = head->nextMessage)) {
-                delete [] (char *) head;
+                freeMessage(head, nodeData);
                 head = nextMessage;
+                toFront(head);
             } else {
-                delete [] (char *) head;
+                freeMessage(head, nodeData);
                 head = tail = nullptr;
             }
         }
 
+        // the message behind the front one moved up to it, and is no longer
+        // a lane's to overtake
+        void toFront(Message *message) {
+            if (lastInLane[message->lane] == message) {
+                lastInLane[message->lane] = nullptr;
+            }
+        }
+
         bool empty() {return head == nullptr;}
         Message *front() {return head;}
 
+        // the front message went out partly
+        void advance(size_t sent) {
+            head->data += sent;
+            head->length -= sent;
+            bufferedAmount -= sent;
+        }
+
+        // unlinks the front message, to be freed by the caller
+        Message *take() {
+            Message *message = head;
+            bufferedAmount -= message->length;
+            if (!(head = message->nextMessage)) {
+                tail = nullptr;
+            } else {
+                toFront(head);
+            }
+            return message;
+        }
+
+        // unlinks the message after previous, to be freed by the caller
+        Message *unlinkAfter(Message *previous) {
+            Message *message = previous->nextMessage;
+            previous->nextMessage = message->nextMessage;
+            if (tail == message) {
+                tail = previous;
+            }
+            if (lastInLane[message->lane] == message) {
+                lastInLane[message->lane] = previous != head && previous->lane == message->lane ? previous : nullptr;
+            }
+            bufferedAmount -= message->length;
+            return message;
+        }
+
+        // queues the message behind those of its lane and the ones before
+        void insert(Message *message)
+        {
+            if (!head) {
+                push(message);
+                return;
+            }
+            Message *previous = head;
+            for (int lane = message->lane; lane >= 0; lane--) {
+                if (lastInLane[lane]) {
+                    previous = lastInLane[lane];
+                    break;
+                }
+            }
+            bufferedAmount += message->length;
+            message->nextMessage = previous->nextMessage;
+            previous->nextMessage = message;
+            if (tail == previous) {
+                tail = message;
+            }
+            lastInLane[message->lane] = message;
+        }
+
+        // queues the message last, for a queue that keeps no lanes
         void push(Message *message)
         {
+            bufferedAmount += message->length;
             message->nextMessage = nullptr;
             if (tail) {
                 tail->nextMessage = message;
@@ -209,7 +1072,22 @@ struct SocketData {
         }
     } messageQueue;
 
-    uv_poll_t *next = nullptr, *prev = nullptr;
+    // messages sent zero-copy that the kernel has not reported done with,
+    // oldest first; their callbacks run once it has
+    Queue zeroCopyQueue;
+    // the id the kernel gives the socket's next zero-copy send, and the one
+    // before which it has reported all done
+    uint32_t zeroCopyNext = 0, zeroCopyDone = 0;
+    // a ZeroCopy
+    unsigned char zeroCopy = 0;
+
+    // the message being written in place since Socket::reserveWrite, or null
+    // while it is in the cork buffer from reservedOffset on
+    Queue::Message *reservedMessage = nullptr;
+    size_t reservedOffset = 0;
+
+    // where the socket is in its group's SocketList
+    size_t groupIndex = 0;
 };
 
 struct ListenData : SocketData {
@@ -222,6 +1100,25 @@ struct ListenData : SocketData {
     uv_timer_t *listenTimer = nullptr;
     uv_os_sock_t sock;
     uS::TLS::Context sslContext;
+    int listenEvents = UV_READABLE;
+    bool kernelTls = false;
+    // the group's listener before this one; a group can listen on several
+    // sockets, such as a port and a Unix domain socket
+    ListenData *next = nullptr;
+};
+
+enum KernelTls : unsigned char {
+    KERNEL_TLS_OFF,
+    // asked for, and known once the handshake is done
+    KERNEL_TLS_PENDING,
+    KERNEL_TLS_SEND
+};
+
+enum ZeroCopy : unsigned char {
+    // not tried yet on the socket
+    ZERO_COPY_UNKNOWN,
+    ZERO_COPY_ON,
+    ZERO_COPY_OFF
 };
 
 enum SocketState : unsigned char {
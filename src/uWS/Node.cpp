@@ -1,4 +1,10 @@
 #include "Node.h"
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 namespace uS {
 
@@ -6,24 +12,42 @@ void NodeData::asyncCallback(uv_async_t *async)
 {
     NodeData *nodeData = (NodeData *) async->data;
 
-    nodeData->asyncMutex->lock();
-    for (TransferData transferData : nodeData->transferQueue) {
+    // pushes from here on wake the loop again
+    nodeData->wakeupFlag.pending = false;
+    nodeData->transferQueue.drain([nodeData](TransferData &transferData) {
         uv_poll_init_socket(nodeData->loop, transferData.p, transferData.fd);
         transferData.p->data = transferData.socketData;
         transferData.socketData->nodeData = nodeData;
+        Socket::countQueued(transferData.socketData, transferData.socketData->messageQueue.bufferedAmount);
         uv_poll_start(transferData.p, transferData.socketData->poll, transferData.pollCb);
 
         transferData.cb(transferData.p);
-    }
+    });
 
-    for (uv_poll_t *p : nodeData->changePollQueue) {
+    nodeData->changePollQueue.drain([](uv_poll_t *p) {
         SocketData *socketData = (SocketData *) p->data;
         uv_poll_start(p, socketData->poll, /*p->poll_cb*/ Socket(p).getPollCallback());
+    });
+
+    // a full ring's worth at a time, so other events get their turn
+    if (nodeData->mailbox && nodeData->mailbox->drain()) {
+        nodeData->wakeup();
     }
+}
 
-    nodeData->changePollQueue.clear();
-    nodeData->transferQueue.clear();
-    nodeData->asyncMutex->unlock();
+void Resolution::start() {
+    std::thread([this]() {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(addrinfo));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(hostname.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+            result = nullptr;
+        }
+        // the last the thread touches of the Resolution, which the loop may
+        // delete from here on
+        uv_async_send(async);
+    }).detach();
 }
 
 Node::Node(int recvLength, int prePadding, int postPadding, bool useDefaultLoop) {
@@ -41,35 +65,133 @@ Node::Node(int recvLength, int prePadding, int postPadding, bool useDefaultLoop)
     }
 
     nodeData->loop = loop;
-    nodeData->asyncMutex = &asyncMutex;
 
-    int indices = NodeData::getMemoryBlockIndex(NodeData::preAllocMaxSize) + 1;
-    nodeData->preAlloc = new char*[indices];
-    for (int i = 0; i < indices; i++) {
-        nodeData->preAlloc[i] = nullptr;
+    nodeData->memoryPool = new MemoryPool;
+    nodeData->fragmentPool = new FragmentPool;
+    nodeData->acceptCounters = new AcceptCounters;
+    nodeData->zeroCopyCounters = new ZeroCopyCounters;
+    nodeData->loopCounters = new LoopCounters;
+
+#if !defined(USE_MICRO_UV) && UV_VERSION_HEX >= 0x012d00
+    uv_loop_configure(loop, UV_METRICS_IDLE_TIME);
+#endif
+}
+
+static uint64_t steadyNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Node::prefault() {
+    memset(nodeData->recvBuffer, 0, nodeData->recvLength);
+    nodeData->memoryPool->fill();
+    // the smallest class, which holds most messages that arrive in parts
+    nodeData->fragmentPool->fill(1);
+}
+
+bool Node::useHugePages(bool explicitPages) {
+#ifdef __linux__
+    static const size_t hugePageSize = 2 << 20;
+    if (nodeData->hugePages) {
+        return true;
+    }
+    int recvBlockLength = nodeData->recvLength + int(nodeData->recvBuffer - nodeData->recvBufferMemoryBlock);
+    size_t length = (recvBlockLength + hugePageSize - 1) & ~(hugePageSize - 1);
+    char *pages = nullptr;
+    bool explicitHugePages = false;
+    if (explicitPages) {
+        void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapped != MAP_FAILED) {
+            pages = (char *) mapped;
+            explicitHugePages = true;
+        }
+    }
+    if (!pages) {
+        // a huge page more, trimmed to the alignment the kernel backs whole
+        char *area = (char *) mmap(nullptr, length + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (area == MAP_FAILED) {
+            return false;
+        }
+        pages = (char *) (((uintptr_t) area + hugePageSize - 1) & ~(uintptr_t) (hugePageSize - 1));
+        if (pages != area) {
+            munmap(area, pages - area);
+        }
+        munmap(pages + length, area + hugePageSize - pages);
+        if (madvise(pages, length, MADV_HUGEPAGE)) {
+            munmap(pages, length);
+            return false;
+        }
     }
 
-    nodeData->clientContext = SSL_CTX_new(SSLv23_client_method());
-    SSL_CTX_set_options(nodeData->clientContext, SSL_OP_NO_SSLv3);
+    ptrdiff_t prePadding = nodeData->recvBuffer - nodeData->recvBufferMemoryBlock;
+    delete [] nodeData->recvBufferMemoryBlock;
+    nodeData->recvBufferMemoryBlock = pages;
+    nodeData->recvBuffer = pages + prePadding;
+    // blocks of 16 bytes and more, on their natural alignment
+    size_t slabOffset = (recvBlockLength + 63) & ~(size_t) 63;
+    nodeData->memoryPool->setSlab(pages + slabOffset, length - slabOffset);
+    nodeData->hugePages = pages;
+    nodeData->hugePagesLength = length;
+    nodeData->explicitHugePages = explicitHugePages;
+    return true;
+#else
+    return false;
+#endif
+}
+
+LoopStats Node::getLoopStats() const {
+    LoopStats stats;
+    uint64_t started = nodeData->loopCounters->started.load(std::memory_order_relaxed);
+    if (started) {
+        stats.seconds = (steadyNanoseconds() - started) / 1e9;
+    }
+#if defined(USE_MICRO_UV) || UV_VERSION_HEX >= 0x012d00
+    uv_metrics_t metrics;
+    if (uv_metrics_info(loop, &metrics) == 0) {
+        stats.iterations = metrics.loop_count;
+        stats.events = metrics.events;
+    }
+    stats.idleSeconds = uv_metrics_idle_time(loop) / 1e9;
+#endif
+    stats.pendingTransfers = nodeData->transferQueue.size();
+    stats.queuedBytes = nodeData->loopCounters->queuedBytes.load(std::memory_order_relaxed);
+    stats.hugePageBytes = nodeData->hugePagesLength;
+    stats.explicitHugePages = nodeData->explicitHugePages;
+    return stats;
+}
+
+SSL_CTX *Node::getClientContext() {
+    // made on the first connection of any Node, by whichever thread, and
+    // kept until the process exits
+    static SSL_CTX *clientContext = [] {
+        SSL_CTX *context = SSL_CTX_new(SSLv23_client_method());
+        SSL_CTX_set_options(context, SSL_OP_NO_SSLv3);
+        return context;
+    }();
+    return clientContext;
 }
 
 void Node::run() {
     nodeData->tid = pthread_self();
+    nodeData->loopCounters->started.store(steadyNanoseconds(), std::memory_order_relaxed);
 
     uv_run(loop, UV_RUN_DEFAULT);
 }
 
 Node::~Node() {
+    // the pool first, which may hold blocks of the huge pages
+    delete nodeData->memoryPool;
+#ifdef __linux__
+    if (nodeData->hugePages) {
+        munmap(nodeData->hugePages, nodeData->hugePagesLength);
+        nodeData->recvBufferMemoryBlock = nullptr;
+    }
+#endif
     delete [] nodeData->recvBufferMemoryBlock;
-    SSL_CTX_free(nodeData->clientContext);
 
-    int indices = NodeData::getMemoryBlockIndex(NodeData::preAllocMaxSize) + 1;
-    for (int i = 0; i < indices; i++) {
-        if (nodeData->preAlloc[i]) {
-            delete [] nodeData->preAlloc[i];
-        }
-    }
-    delete [] nodeData->preAlloc;
+    delete nodeData->fragmentPool;
+    delete nodeData->acceptCounters;
+    delete nodeData->zeroCopyCounters;
+    delete nodeData->loopCounters;
 
     delete nodeData;
 
@@ -4,19 +4,48 @@
 #include "Socket.h"
 #include <vector>
 #include <mutex>
+#include <string>
 
 namespace uS {
 
 enum ListenOptions : int {
     REUSE_PORT = 1,
-    ONLY_IPV4 = 2
+    ONLY_IPV4 = 2,
+    // where several loops listen on one socket, each connection wakes only
+    // one of them (the micro uUV loop on Linux)
+    EXCLUSIVE_POLL = 4,
+    // with TLS, has the kernel encrypt the records sent once the handshake is
+    // done (OpenSSL 3 with kTLS, Linux 4.13), so the connection is written
+    // with plain sends; connections keep encrypting in OpenSSL where the
+    // kernel or cipher is not supported
+    KERNEL_TLS = 8
+};
+
+// a host name that Node::connect resolves on a thread of its own, so that a
+// slow or failing resolver never stalls the loop; the thread leaves the
+// result here and signals async, whose callback on the loop's thread takes
+// it up and deletes the Resolution. A timeout that fires first fails the
+// connection right away, and the result is thrown away when it comes
+struct Resolution {
+    uv_async_t *async;
+    uv_timer_t *timer;
+    std::string hostname;
+    int port;
+    bool secure;
+    SocketData *socketData;
+    // of the whole connect, and when it started, in ms of the loop's clock
+    int timeoutMs;
+    uint64_t started;
+    addrinfo *result = nullptr;
+
+    // on the loop's thread, once async and timer are set up
+    void start();
 };
 
 class WIN32_EXPORT Node {
 protected:
     uv_loop_t *loop;
     NodeData *nodeData;
-    std::mutex asyncMutex;
 
 public:
     Node(int recvLength = 1024, int prePadding = 0, int postPadding = 0, bool useDefaultLoop = false);
@@ -27,31 +56,96 @@ public:
         return loop;
     }
 
+    // the queue length of the sockets listened on from now on, 512 by
+    // default; the kernel caps it at net.core.somaxconn
+    void setListenBacklog(int backlog) {
+        nodeData->acceptCounters->listenBacklog = backlog;
+    }
+
+    // the most connections taken from a listening socket per readiness
+    // event, 256 by default
+    void setAcceptBudget(int budget) {
+        nodeData->acceptCounters->acceptBudget = budget;
+    }
+
+    // from any thread
+    AcceptStats getAcceptStats() const {
+        return nodeData->acceptCounters->getStats();
+    }
+
+    // has plain sockets send messages of at least threshold bytes with
+    // MSG_ZEROCOPY, 0 to copy all; only the micro uUV loop on Linux can
+    void setZeroCopyThreshold(size_t threshold) {
+        nodeData->zeroCopyCounters->threshold = threshold;
+    }
+
+    // from any thread
+    ZeroCopyStats getZeroCopyStats() const {
+        return nodeData->zeroCopyCounters->getStats();
+    }
+
+    // how busy the loop is and what waits on it, from any thread; the idle
+    // time, iterations and events need the micro uUV loop or libuv 1.45
+    LoopStats getLoopStats() const;
+
+    // writes through the receive buffer once and fills the send and
+    // reassembly pools, so the first messages after a start do not fault
+    // in their memory; on the loop's thread, before it runs
+    void prefault();
+
+    // moves the receive buffer onto huge pages, with the rest of them a slab
+    // for the memory pool, so the loop's hottest memory takes a TLB entry or
+    // two; reserved pages (MAP_HUGETLB) with explicitPages, falling back to
+    // advising transparent ones. False if neither could be had, the buffers
+    // staying where they are. On the loop's thread, before it runs and
+    // before prefault; Linux only
+    bool useHugePages(bool explicitPages);
+
+    // the context all outgoing TLS connections share, across Nodes
+    static SSL_CTX *getClientContext();
+
+    // a failed connect closes the socket and reports it, as one that never
+    // got a socket, with p still holding the SocketData
     template <void C(Socket p, bool error)>
     static void connect_cb(uv_poll_t *p, int status, int events) {
-        C(p, status < 0);
+        int error = 0;
+        socklen_t errorLength = sizeof(error);
+        if (status >= 0 && getsockopt(Socket(p).getFd(), SOL_SOCKET, SO_ERROR, (char *) &error, &errorLength)) {
+            error = -1;
+        }
+        if (status < 0 || error) {
+            Socket s(p);
+            s.cancelTimeout();
+            s.close();
+            s.getSocketData()->ssl = nullptr;
+        }
+        C(p, status < 0 || error);
     }
 
+    // for a connection that did not get as far as a socket
     template <void C(Socket p, bool error)>
-    uS::Socket connect(const char *hostname, int port, bool secure, uS::SocketData *socketData) {
-        uv_poll_t *p = new uv_poll_t;
+    static void connectFailed(SocketData *socketData) {
+        uv_poll_t *p = newPoll();
         p->data = socketData;
+        C(p, true);
+        deletePoll(p);
+    }
 
-        addrinfo hints, *result;
-        memset(&hints, 0, sizeof(addrinfo));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_STREAM;
-        if (getaddrinfo(hostname, std::to_string(port).c_str(), &hints, &result) != 0) {
-            C(p, true);
-            delete p;
-            return nullptr;
+    // connects to the address without blocking, and has T end the socket if
+    // it is not through by timeoutMs; the HTTP upgrade is C's to send
+    template <void C(Socket p, bool error), void T(Socket s)>
+    static void connectTo(const addrinfo *address, const char *hostname, bool secure, SocketData *socketData, int timeoutMs) {
+#ifdef __linux
+        uv_os_sock_t fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+#else
+        uv_os_sock_t fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd != INVALID_SOCKET) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
         }
-
-        uv_os_sock_t fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-        if (fd == -1) {
-            C(p, true);
-            delete p;
-            return nullptr;
+#endif
+        if (fd == INVALID_SOCKET) {
+            connectFailed<C>(socketData);
+            return;
         }
 
 #ifdef __APPLE__
@@ -59,12 +153,14 @@ public:
         setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigpipe, sizeof(int));
 #endif
 
-        ::connect(fd, result->ai_addr, result->ai_addrlen);
-        freeaddrinfo(result);
+        if (::connect(fd, address->ai_addr, address->ai_addrlen) && errno != EINPROGRESS) {
+            ::close(fd);
+            connectFailed<C>(socketData);
+            return;
+        }
 
-        NodeData *nodeData = socketData->nodeData;
         if (secure) {
-            socketData->ssl = SSL_new(nodeData->clientContext);
+            socketData->ssl = SSL_new(getClientContext());
             SSL_set_fd(socketData->ssl, fd);
             SSL_set_connect_state(socketData->ssl);
             SSL_set_mode(socketData->ssl, SSL_MODE_RELEASE_BUFFERS);
@@ -73,12 +169,85 @@ public:
             socketData->ssl = nullptr;
         }
 
+        uv_poll_t *p = newPoll();
+        p->data = socketData;
         socketData->poll = UV_READABLE;
-        uv_poll_init_socket(loop, p, fd);
+        uv_poll_init_socket(socketData->nodeData->loop, p, fd);
         uv_poll_start(p, UV_WRITABLE, connect_cb<C>);
-        return p;
+        Socket(p).startTimeout<T>(timeoutMs);
     }
 
+    // connects to hostname and port without blocking the loop: a numeric
+    // address right away, a name once a thread of its own has resolved it.
+    // C gets the connected socket, or an error if the name does not
+    // resolve, the connect fails or timeoutMs passes before it is through;
+    // once it is, T ends the socket if it is still there at timeoutMs
+    template <void C(Socket p, bool error), void T(Socket s)>
+    void connect(const char *hostname, int port, bool secure, SocketData *socketData, int timeoutMs) {
+        addrinfo hints, *result;
+        memset(&hints, 0, sizeof(addrinfo));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_NUMERICHOST;
+        if (getaddrinfo(hostname, std::to_string(port).c_str(), &hints, &result) == 0) {
+            connectTo<C, T>(result, hostname, secure, socketData, timeoutMs);
+            freeaddrinfo(result);
+            return;
+        }
+
+        Resolution *resolution = new Resolution;
+        resolution->hostname = hostname;
+        resolution->port = port;
+        resolution->secure = secure;
+        resolution->socketData = socketData;
+        resolution->timeoutMs = timeoutMs;
+        resolution->started = uv_now(loop);
+
+        resolution->async = new uv_async_t;
+        resolution->async->data = resolution;
+        uv_async_init(loop, resolution->async, [](uv_async_t *async) {
+            Resolution *resolution = (Resolution *) async->data;
+            uv_close(async, [](uv_handle_t *h) {
+                delete (uv_async_t *) h;
+            });
+            // timed out already, and reported
+            if (!resolution->timer) {
+                if (resolution->result) {
+                    freeaddrinfo(resolution->result);
+                }
+                delete resolution;
+                return;
+            }
+
+            uv_timer_stop(resolution->timer);
+            uv_close(resolution->timer, [](uv_handle_t *h) {
+                delete (uv_timer_t *) h;
+            });
+            if (resolution->result) {
+                int elapsed = (int) (uv_now(resolution->socketData->nodeData->loop) - resolution->started);
+                connectTo<C, T>(resolution->result, resolution->hostname.c_str(), resolution->secure,
+                                resolution->socketData, std::max(1, resolution->timeoutMs - elapsed));
+                freeaddrinfo(resolution->result);
+            } else {
+                connectFailed<C>(resolution->socketData);
+            }
+            delete resolution;
+        });
+
+        resolution->timer = new uv_timer_t;
+        resolution->timer->data = resolution;
+        uv_timer_init(loop, resolution->timer);
+        uv_timer_start(resolution->timer, [](uv_timer_t *timer) {
+            Resolution *resolution = (Resolution *) timer->data;
+            uv_close(timer, [](uv_handle_t *h) {
+                delete (uv_timer_t *) h;
+            });
+            resolution->timer = nullptr;
+            connectFailed<C>(resolution->socketData);
+        }, timeoutMs, 0);
+
+        resolution->start();
+    }
     template <void A(Socket s)>
     static void accept_poll_cb(uv_poll_t *p, int status, int events) {
         ListenData *listenData = (ListenData *) p->data;
@@ -91,11 +260,28 @@ public:
         accept_cb<A, true>(listenData);
     }
 
+    // a connection from the queue of serverFd, non-blocking and closed on
+    // exec from the start where accept4 can (Linux)
+    static uv_os_sock_t acceptSocket(uv_os_sock_t serverFd) {
+#ifdef __linux
+        return accept4(serverFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        return accept(serverFd, nullptr, nullptr);
+#endif
+    }
+
+    // takes up to the node's accept budget of queued connections per event,
+    // so that a reconnect storm is absorbed in few loop iterations without
+    // starving the connections already open
     template <void A(Socket s), bool TIMER>
     static void accept_cb(ListenData *listenData) {
         uv_os_sock_t serverFd = listenData->sock;
-        uv_os_sock_t clientFd = accept(serverFd, nullptr, nullptr);
+        NodeData *nodeData = listenData->nodeData;
+        uv_os_sock_t clientFd = acceptSocket(serverFd);
         if (clientFd == INVALID_SOCKET) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                nodeData->acceptCounters->add(nodeData->acceptCounters->errors, 1);
+            }
             /*
             * If accept is failing, the pending connection won't be removed and the
             * polling will cause the server to spin, using 100% cpu. Switch to a timer
@@ -104,7 +290,7 @@ public:
             if (!TIMER && errno != EAGAIN && errno != EWOULDBLOCK) {
                 uv_poll_stop(listenData->listenPoll);
                 uv_close(listenData->listenPoll, [](uv_handle_t *handle) {
-                    delete handle;
+                    deletePoll((uv_poll_t *) handle);
                 });
                 listenData->listenPoll = nullptr;
 
@@ -121,11 +307,13 @@ public:
             });
             listenData->listenTimer = nullptr;
 
-            listenData->listenPoll = new uv_poll_t;
+            listenData->listenPoll = newPoll();
             listenData->listenPoll->data = listenData;
             uv_poll_init_socket(listenData->nodeData->loop, listenData->listenPoll, serverFd);
-            uv_poll_start(listenData->listenPoll, UV_READABLE, accept_poll_cb<A>);
+            uv_poll_start(listenData->listenPoll, listenData->listenEvents, accept_poll_cb<A>);
         }
+        const size_t budget = nodeData->acceptCounters->acceptBudget > 0 ? nodeData->acceptCounters->acceptBudget : 1;
+        size_t accepted = 0;
         do {
     #ifdef __APPLE__
         int noSigpipe = 1;
@@ -138,12 +326,18 @@ public:
             SSL_set_fd(ssl, clientFd);
             SSL_set_accept_state(ssl);
             SSL_set_mode(ssl, SSL_MODE_RELEASE_BUFFERS);
+#ifdef UWS_KERNEL_TLS
+            if (listenData->kernelTls) {
+                SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+            }
+#endif
         }
 
         SocketData *socketData = new SocketData(listenData->nodeData);
         socketData->ssl = ssl;
+        Socket::checkKernelTls(socketData);
 
-        uv_poll_t *clientPoll = new uv_poll_t;
+        uv_poll_t *clientPoll = newPoll();
 #ifdef USE_MICRO_UV
         uv_poll_init_socket(listenData->listenPoll->get_loop(), clientPoll, clientFd);
 #else
@@ -153,10 +347,24 @@ public:
 
         socketData->poll = UV_READABLE;
         A(clientPoll);
-        } while ((clientFd = accept(serverFd, nullptr, nullptr)) != INVALID_SOCKET);
+        } while (++accepted < budget && (clientFd = acceptSocket(serverFd)) != INVALID_SOCKET);
+
+        AcceptCounters &counters = *nodeData->acceptCounters;
+        if (accepted < budget && errno != EAGAIN && errno != EWOULDBLOCK) {
+            counters.add(counters.errors, 1);
+        }
+        counters.add(counters.accepted, accepted);
+        counters.add(counters.wakeups, 1);
+        if (accepted == budget) {
+            // the rest stay queued for the next iteration of the loop
+            counters.add(counters.budgetExhausted, 1);
+        }
+        if (accepted > counters.maxBatch.load(std::memory_order_relaxed)) {
+            counters.maxBatch.store(accepted, std::memory_order_relaxed);
+        }
     }
 
-    // todo: hostname, backlog
+    // todo: hostname
     template <void A(Socket s)>
     bool listen(const char *host, int port, uS::TLS::Context sslContext, int options, uS::NodeData *nodeData, void *user) {
         addrinfo hints, *result;
@@ -205,17 +413,64 @@ public:
         int enabled = true;
         setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
 
-        if (bind(listenFd, listenAddr->ai_addr, listenAddr->ai_addrlen) || ::listen(listenFd, 512)) {
+        if (bind(listenFd, listenAddr->ai_addr, listenAddr->ai_addrlen) || ::listen(listenFd, nodeData->acceptCounters->listenBacklog)) {
             ::close(listenFd);
             freeaddrinfo(result);
             return true;
         }
 
+        freeaddrinfo(result);
+        listenOn<A>(listenFd, sslContext, options, nodeData);
+        return false;
+    }
+
+#ifndef _WIN32
+    // listens on a Unix domain stream socket at path, replacing a socket file
+    // left there before; the connections go through the same HTTP and
+    // WebSocket handling as those of a port, without the TCP stack
+    template <void A(Socket s)>
+    bool listenUnix(const char *path, uS::TLS::Context sslContext, int options, uS::NodeData *nodeData) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(address.sun_path)) {
+            return true;
+        }
+        strcpy(address.sun_path, path);
+
+        uv_os_sock_t listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd == SOCKET_ERROR) {
+            return true;
+        }
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path);
+        }
+        if (bind(listenFd, (sockaddr *) &address, sizeof(address)) || ::listen(listenFd, nodeData->acceptCounters->listenBacklog)) {
+            ::close(listenFd);
+            return true;
+        }
+
+        listenOn<A>(listenFd, sslContext, options, nodeData);
+        return false;
+    }
+#endif
+
+    // accepts from a socket that is listening already, such as a dup of
+    // another loop's; the node takes it over
+    template <void A(Socket s)>
+    void listenOn(uv_os_sock_t listenFd, uS::TLS::Context sslContext, int options, uS::NodeData *nodeData) {
         ListenData *listenData = new ListenData(nodeData);
         listenData->sslContext = sslContext;
         listenData->nodeData = nodeData;
+        listenData->kernelTls = options & KERNEL_TLS;
+#ifdef USE_MICRO_UV
+        if (options & EXCLUSIVE_POLL) {
+            listenData->listenEvents |= UV_EXCLUSIVE;
+        }
+#endif
 
-        uv_poll_t *listenPoll = new uv_poll_t;
+        uv_poll_t *listenPoll = newPoll();
         listenPoll->data = listenData;
 
         listenData->listenPoll = listenPoll;
@@ -223,12 +478,11 @@ public:
         listenData->ssl = nullptr;
 
         uv_poll_init_socket(loop, listenPoll, listenFd);
-        uv_poll_start(listenPoll, UV_READABLE, accept_poll_cb<A>);
+        uv_poll_start(listenPoll, listenData->listenEvents, accept_poll_cb<A>);
 
-        // should be vector of listen data! one group can have many listeners!
+        // the group's listeners, the newest first
+        listenData->next = (ListenData *) nodeData->user;
         nodeData->user = listenData;
-        freeaddrinfo(result);
-        return false;
     }
 };
 
@@ -14,6 +14,11 @@ Socket::Address Socket::getAddress()
 
     static __thread char buf[INET6_ADDRSTRLEN];
 
+#ifndef _WIN32
+    if (addr.ss_family == AF_UNIX) {
+        return {0, "", "Unix"};
+    }
+#endif
     if (addr.ss_family == AF_INET) {
         sockaddr_in *ipv4 = (sockaddr_in *) &addr;
         inet_ntop(AF_INET, &ipv4->sin_addr, buf, sizeof(buf));
@@ -23,35 +23,43 @@ public:
     }
 
     void transfer(NodeData *nodeData, void (*cb)(uv_poll_t *)) {
+        // the receiving loop takes the socket uncorked, also at the TCP level:
+        // once the poll is closed below, a later cork(false) has no fd to reach
+        uncorkWrites();
+        cork(false);
         SocketData *socketData = getSocketData();
+        // once queued, the receiving thread may take the socket over at any time
+        bool sameThread = socketData->nodeData->tid == nodeData->tid;
+        uncountQueued(socketData, socketData->messageQueue.bufferedAmount);
+        UWS_PROBE2(socket__transfer, getFd(), socketData->messageQueue.bufferedAmount);
 
-        nodeData->asyncMutex->lock();
-        nodeData->transferQueue.push_back({new uv_poll_t, getFd(), socketData, getPollCallback(), cb});
-        nodeData->asyncMutex->unlock();
+        nodeData->transferQueue.push({newPoll(), getFd(), socketData, getPollCallback(), cb});
 
-        if (socketData->nodeData->tid != nodeData->tid) {
-            uv_async_send(nodeData->async);
+        if (!sameThread) {
+            nodeData->wakeup();
         } else {
             NodeData::asyncCallback(nodeData->async);
         }
 
         uv_poll_stop(p);
         uv_close(p, [](uv_handle_t *h) {
-            delete (uv_poll_t *) h;
+            deletePoll((uv_poll_t *) h);
         });
     }
 
     static uv_poll_t *init(NodeData *nodeData, uv_os_sock_t fd, SSL *ssl) {
-        if (ssl) {
+        // an upgraded connection keeps its BIO, which may be a kernel TLS one
+        if (ssl && SSL_get_fd(ssl) != fd) {
             SSL_set_fd(ssl, fd);
             SSL_set_mode(ssl, SSL_MODE_RELEASE_BUFFERS);
         }
 
         SocketData *socketData = new SocketData(nodeData);
         socketData->ssl = ssl;
+        checkKernelTls(socketData);
         socketData->poll = UV_READABLE;
 
-        uv_poll_t *p = new uv_poll_t;
+        uv_poll_t *p = newPoll();
         uv_poll_init_socket(nodeData->loop, p, fd);
         p->data = socketData;
         return p;
@@ -99,6 +107,12 @@ public:
         return getSocketData()->shuttingDown;
     }
 
+    // the bytes written but not yet taken by the socket
+    size_t getBufferedAmount() {
+        SocketData *socketData = getSocketData();
+        return socketData->messageQueue.bufferedAmount + socketData->corkBuffer.length();
+    }
+
     struct Address {
         unsigned int port;
         const char *address;
@@ -121,6 +135,93 @@ public:
 #endif
     }
 
+    // whether writes go through OpenSSL, or are encrypted by the kernel
+    static bool sslWrites(SocketData *socketData) {
+        return socketData->ssl && socketData->kernelTls != KERNEL_TLS_SEND;
+    }
+
+    // settles a pending KERNEL_TLS once the handshake is done, and only
+    // when nothing OpenSSL has to write is left, so raw sends cannot
+    // overtake its records
+    static void checkKernelTls(SocketData *socketData) {
+#ifdef UWS_KERNEL_TLS
+        SSL *ssl = socketData->ssl;
+        if (!ssl || socketData->kernelTls == KERNEL_TLS_SEND || !(SSL_get_options(ssl) & SSL_OP_ENABLE_KTLS)) {
+            return;
+        }
+        socketData->kernelTls = KERNEL_TLS_PENDING;
+        if (SSL_is_init_finished(ssl) && SSL_want(ssl) == SSL_NOTHING && socketData->messageQueue.empty()) {
+            socketData->kernelTls = BIO_get_ktls_send(SSL_get_wbio(ssl)) ? KERNEL_TLS_SEND : KERNEL_TLS_OFF;
+        }
+#endif
+    }
+
+    // Until uncorked, messages written while nothing is queued are collected
+    // in the socket's cork buffer instead of being sent one by one; their
+    // send callbacks run right away, as the data has been copied.
+    void corkWrites() {
+        getSocketData()->corked = true;
+    }
+
+    // sends everything collected since corkWrites in one go, queueing what
+    // the socket does not take
+    void uncorkWrites() {
+        SocketData *socketData = getSocketData();
+        socketData->corked = false;
+        if (socketData->corkBuffer.empty()) {
+            return;
+        }
+
+        const char *data = socketData->corkBuffer.data();
+        size_t length = socketData->corkBuffer.length();
+        if (!sslWrites(socketData)) {
+            ssize_t sent = ::send(getFd(), data, length, MSG_NOSIGNAL);
+            if (sent == (ssize_t) length) {
+                releaseCorkBuffer(socketData);
+                return;
+            } else if (sent == SOCKET_ERROR) {
+                if (errno != EWOULDBLOCK) {
+                    // the poll reports the error
+                    releaseCorkBuffer(socketData);
+                    return;
+                }
+            } else {
+                data += sent;
+                length -= sent;
+            }
+        }
+
+        SocketData::Queue::Message *messagePtr = allocMessage(length, data);
+        releaseCorkBuffer(socketData);
+        bool wasTransferred;
+        if (write(messagePtr, wasTransferred) && wasTransferred) {
+            messagePtr->callback = nullptr;
+        } else {
+            freeMessage(messagePtr);
+        }
+    }
+
+    // stops reading the socket until resumeReading, whatever it sends
+    // meanwhile: the kernel's receive buffer fills and TCP holds the peer
+    // back. Writing goes on
+    void pauseReading() {
+        SocketData *socketData = getSocketData();
+        socketData->readPaused = true;
+        socketData->poll &= ~UV_READABLE;
+        changePoll(socketData);
+    }
+
+    void resumeReading() {
+        SocketData *socketData = getSocketData();
+        socketData->readPaused = false;
+        socketData->poll |= UV_READABLE;
+        changePoll(socketData);
+    }
+
+    bool isReadingPaused() {
+        return getSocketData()->readPaused;
+    }
+
     void setNoDelay(int enable) {
         setsockopt(getFd(), IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
     }
@@ -164,6 +265,63 @@ public:
         }
     }
 
+    // writes queued messages to a socket the kernel takes plain data on, as
+    // many as it takes; false if the socket ended
+    template <class STATE>
+    static bool sendQueued(uv_poll_t *p) {
+        SocketData *socketData = Socket(p).getSocketData();
+        while (true) {
+            bool zeroCopied;
+            ssize_t sent = sendQueue(Socket(p).getFd(), socketData, zeroCopied);
+            if (sent == SOCKET_ERROR) {
+                if (errno != EWOULDBLOCK) {
+                    STATE::onEnd(p);
+                    return false;
+                }
+                return true;
+            }
+            uncountQueued(socketData, sent);
+
+            // completes the messages that went out whole, in order, but for
+            // those of zero-copy sends, held until the kernel is done
+            bool partial = false;
+            while (!socketData->messageQueue.empty()) {
+                SocketData::Queue::Message *messagePtr = socketData->messageQueue.front();
+                if ((size_t) sent < messagePtr->length) {
+                    socketData->messageQueue.advance(sent);
+                    if (zeroCopied && sent) {
+                        messagePtr->zeroCopied = true;
+                        messagePtr->zeroCopyId = socketData->zeroCopyNext - 1;
+                    }
+                    partial = true;
+                    break;
+                }
+                sent -= messagePtr->length;
+                if (zeroCopied) {
+                    messagePtr->zeroCopied = true;
+                    messagePtr->zeroCopyId = socketData->zeroCopyNext - 1;
+                }
+                if (messagePtr->zeroCopied) {
+                    socketData->zeroCopyQueue.push(socketData->messageQueue.take());
+                    continue;
+                }
+                if (messagePtr->callback) {
+                    messagePtr->callback(p, messagePtr->callbackData, false, messagePtr->reserved);
+                }
+                socketData->messageQueue.pop(socketData->nodeData);
+            }
+
+            if (socketData->messageQueue.empty()) {
+                // todo, remove bit, don't set directly
+                socketData->poll = socketData->readPaused ? 0 : UV_READABLE;
+                uv_poll_start(p, socketData->poll, Socket(p).getPollCallback());
+                return true;
+            } else if (partial) {
+                return true;
+            }
+        }
+    }
+
     template <class STATE>
     static void ssl_io_cb(uv_poll_t *p, int status, int events) {
         SocketData *socketData = Socket(p).getSocketData();
@@ -175,7 +333,11 @@ public:
             return;
         }
 
-        if (!socketData->messageQueue.empty() && ((events & UV_WRITABLE) || SSL_want(socketData->ssl) == SSL_READING)) {
+        if (socketData->kernelTls == KERNEL_TLS_SEND) {
+            if ((events & UV_WRITABLE) && !socketData->messageQueue.empty() && !sendQueued<STATE>(p)) {
+                return;
+            }
+        } else if (!socketData->messageQueue.empty() && ((events & UV_WRITABLE) || SSL_want(socketData->ssl) == SSL_READING)) {
             Socket(p).cork(true);
             while (true) {
                 SocketData::Queue::Message *messagePtr = socketData->messageQueue.front();
@@ -184,12 +346,13 @@ public:
                     if (messagePtr->callback) {
                         messagePtr->callback(p, messagePtr->callbackData, false, messagePtr->reserved);
                     }
-                    socketData->messageQueue.pop();
+                    uncountQueued(socketData, messagePtr->length);
+                    socketData->messageQueue.pop(socketData->nodeData);
                     if (socketData->messageQueue.empty()) {
                         if ((socketData->poll & UV_WRITABLE) && SSL_want(socketData->ssl) != SSL_WRITING) {
                             // todo, remove bit, don't set directly
-                            socketData->poll = UV_READABLE;
-                            uv_poll_start(p, UV_READABLE, Socket(p).getPollCallback());
+                            socketData->poll = socketData->readPaused ? 0 : UV_READABLE;
+                            uv_poll_start(p, socketData->poll, Socket(p).getPollCallback());
                         }
                         break;
                     }
@@ -226,12 +389,21 @@ public:
                             uv_poll_start(p, socketData->poll, Socket(p).getPollCallback());
                         }
                         break;
+                    case SSL_ERROR_ZERO_RETURN:
+                        // a clean close: answering it keeps the session in the
+                        // context's cache for the client to resume
+                        SSL_shutdown(ssl);
+                        STATE::onEnd(p);
+                        return;
                     default:
                         STATE::onEnd(p);
                         return;
                     }
                     break;
                 } else {
+                    if (socketData->kernelTls == KERNEL_TLS_PENDING) {
+                        checkKernelTls(socketData);
+                    }
                     STATE::onData(p, nodeData->recvBuffer, length);
                     if (Socket(p).isClosed() || Socket(p).isShuttingDown()) {
                         return;
@@ -241,47 +413,75 @@ public:
         }
     }
 
+    // runs the callbacks of the zero-copy sent messages that the kernel
+    // reports done with on the socket's error queue, which raises a poll
+    // error; false if the socket has a real one
+    static bool completeZeroCopies(uv_poll_t *p) {
+#ifdef UWS_ZERO_COPY
+        SocketData *socketData = Socket(p).getSocketData();
+        if (socketData->zeroCopy != ZERO_COPY_ON) {
+            return false;
+        }
+
+        ZeroCopyCounters &counters = *socketData->nodeData->zeroCopyCounters;
+        char control[128];
+        while (true) {
+            msghdr message = {};
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            if (::recvmsg(Socket(p).getFd(), &message, MSG_ERRQUEUE) == SOCKET_ERROR) {
+                break;
+            }
+            for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+                if (!(header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) &&
+                    !(header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR)) {
+                    continue;
+                }
+                sock_extended_err *error = (sock_extended_err *) CMSG_DATA(header);
+                if (error->ee_errno || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                // sends ee_info to ee_data are done; TCP reports them in order
+                uint32_t completed = error->ee_data - error->ee_info + 1;
+                counters.add(counters.completions, completed);
+                if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    counters.add(counters.copied, completed);
+                }
+                if ((int32_t) (error->ee_data + 1 - socketData->zeroCopyDone) > 0) {
+                    socketData->zeroCopyDone = error->ee_data + 1;
+                }
+            }
+        }
+
+        SocketData::Queue &queue = socketData->zeroCopyQueue;
+        while (!queue.empty() && (int32_t) (queue.front()->zeroCopyId - socketData->zeroCopyDone) < 0) {
+            SocketData::Queue::Message *messagePtr = queue.front();
+            if (messagePtr->callback) {
+                messagePtr->callback(p, messagePtr->callbackData, false, messagePtr->reserved);
+            }
+            queue.pop(socketData->nodeData);
+        }
+
+        int error = 0;
+        socklen_t errorLength = sizeof(error);
+        return getsockopt(Socket(p).getFd(), SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 && !error;
+#else
+        return false;
+#endif
+    }
+
     template <class STATE>
     static void io_cb(uv_poll_t *p, int status, int events) {
         SocketData *socketData = Socket(p).getSocketData();
         NodeData *nodeData = socketData->nodeData;
 
-        if (status < 0) {
+        if (status < 0 && !completeZeroCopies(p)) {
             STATE::onEnd(p);
             return;
         }
 
-        if (events & UV_WRITABLE) {
-            if (!socketData->messageQueue.empty() && (events & UV_WRITABLE)) {
-                Socket(p).cork(true);
-                while (true) {
-                    SocketData::Queue::Message *messagePtr = socketData->messageQueue.front();
-                    ssize_t sent = ::send(Socket(p).getFd(), messagePtr->data, messagePtr->length, MSG_NOSIGNAL);
-                    if (sent == (ssize_t) messagePtr->length) {
-                        if (messagePtr->callback) {
-                            messagePtr->callback(p, messagePtr->callbackData, false, messagePtr->reserved);
-                        }
-                        socketData->messageQueue.pop();
-                        if (socketData->messageQueue.empty()) {
-                            // todo, remove bit, don't set directly
-                            socketData->poll = UV_READABLE;
-                            uv_poll_start(p, UV_READABLE, Socket(p).getPollCallback());
-                            break;
-                        }
-                    } else if (sent == SOCKET_ERROR) {
-                        if (errno != EWOULDBLOCK) {
-                            STATE::onEnd(p);
-                            return;
-                        }
-                        break;
-                    } else {
-                        messagePtr->length -= sent;
-                        messagePtr->data += sent;
-                        break;
-                    }
-                }
-                Socket(p).cork(false);
-            }
+        if ((events & UV_WRITABLE) && !socketData->messageQueue.empty() && !sendQueued<STATE>(p)) {
+            return;
         }
 
         if (events & UV_READABLE) {
@@ -330,23 +530,81 @@ public:
         }
 
         uv_close(p, [](uv_handle_t *h) {
-            delete (uv_poll_t *) h;
+            deletePoll((uv_poll_t *) h);
         });
     }
 
+    // completes the messages still held for zero-copy sends as the socket
+    // closes, without it: the kernel may yet send from their memory, which
+    // their callbacks and the pool are free to reuse
+    static void releaseZeroCopied(SocketData *socketData) {
+        while (!socketData->zeroCopyQueue.empty()) {
+            SocketData::Queue::Message *messagePtr = socketData->zeroCopyQueue.front();
+            if (messagePtr->callback) {
+                messagePtr->callback(nullptr, messagePtr->callbackData, false, messagePtr->reserved);
+            }
+            socketData->zeroCopyQueue.pop(socketData->nodeData);
+        }
+    }
+
     bool hasEmptyQueue() {
         return getSocketData()->messageQueue.empty();
     }
 
     void enqueue(SocketData::Queue::Message *message) {
-        getSocketData()->messageQueue.push(message);
+        countQueued(getSocketData(), message->length);
+        getSocketData()->messageQueue.insert(message);
+    }
+
+    // keeps the loop's total of queued bytes in step with the socket's queue
+    static void countQueued(SocketData *socketData, size_t bytes) {
+        LoopCounters &counters = *socketData->nodeData->loopCounters;
+        counters.add(counters.queuedBytes, bytes);
+    }
+
+    static void uncountQueued(SocketData *socketData, size_t bytes) {
+        countQueued(socketData, -bytes);
+    }
+
+    // drops queued state messages oldest first, those of stateKey or any if
+    // it is null, until no more than limit bytes are queued; the front
+    // message may be partly sent and always stays. Their callbacks are
+    // cancelled.
+    void dropQueued(const void *stateKey, size_t limit) {
+        SocketData::Queue &queue = getSocketData()->messageQueue;
+        SocketData::Queue::Message *previous = queue.front();
+        while (previous && previous->nextMessage && queue.bufferedAmount > limit) {
+            SocketData::Queue::Message *messagePtr = previous->nextMessage;
+            if (messagePtr->stateKey && (!stateKey || messagePtr->stateKey == stateKey)) {
+                queue.unlinkAfter(previous);
+                uncountQueued(getSocketData(), messagePtr->length);
+                if (messagePtr->callback) {
+                    messagePtr->callback(p, messagePtr->callbackData, true, messagePtr->reserved);
+                }
+                freeMessage(messagePtr);
+            } else {
+                previous = messagePtr;
+            }
+        }
     }
 
     SocketData::Queue::Message *allocMessage(size_t length, const char *data = 0) {
-        SocketData::Queue::Message *messagePtr = (SocketData::Queue::Message *) new char[sizeof(SocketData::Queue::Message) + length];
+        size_t memoryLength = sizeof(SocketData::Queue::Message) + length;
+        SocketData::Queue::Message *messagePtr;
+        if (memoryLength <= NodeData::preAllocMaxSize) {
+            int memoryIndex = NodeData::getMemoryBlockIndex(memoryLength);
+            messagePtr = (SocketData::Queue::Message *) getSocketData()->nodeData->getSmallMemoryBlock(memoryIndex);
+            messagePtr->memoryIndex = memoryIndex;
+        } else {
+            messagePtr = (SocketData::Queue::Message *) new char[memoryLength];
+            messagePtr->memoryIndex = -1;
+        }
         messagePtr->length = length;
         messagePtr->data = ((char *) messagePtr) + sizeof(SocketData::Queue::Message);
         messagePtr->nextMessage = nullptr;
+        messagePtr->stateKey = nullptr;
+        messagePtr->zeroCopied = false;
+        messagePtr->lane = SocketData::Queue::LANE_DEFAULT;
 
         if (data) {
             memcpy((char *) messagePtr->data, data, messagePtr->length);
@@ -356,26 +614,105 @@ public:
     }
 
     void freeMessage(SocketData::Queue::Message *message) {
-        delete [] (char *) message;
+        SocketData::Queue::freeMessage(message, getSocketData()->nodeData);
+    }
+
+    // keeps the buffer's memory for the next batch, unless a burst made it large
+    static void releaseCorkBuffer(SocketData *socketData) {
+        static const size_t MAX_KEPT_CORK_BUFFER = 64 * 1024;
+        if (socketData->corkBuffer.capacity() > MAX_KEPT_CORK_BUFFER) {
+            std::string().swap(socketData->corkBuffer);
+        } else {
+            socketData->corkBuffer.clear();
+        }
     }
 
     void changePoll(SocketData *socketData) {
         if (socketData->nodeData->tid != pthread_self()) {
-            socketData->nodeData->asyncMutex->lock();
-            socketData->nodeData->changePollQueue.push_back(p);
-            socketData->nodeData->asyncMutex->unlock();
-            uv_async_send(socketData->nodeData->async);
+            socketData->nodeData->changePollQueue.push(p);
+            socketData->nodeData->wakeup();
         } else {
             uv_poll_start(p, socketData->poll, getPollCallback());
         }
     }
 
+#ifdef UWS_ZERO_COPY
+    // whether length bytes go out zero-copy, which plain sockets try to turn
+    // on the first time
+    static bool zeroCopies(uv_os_sock_t fd, SocketData *socketData, size_t length) {
+        size_t threshold = socketData->nodeData->zeroCopyCounters->threshold;
+        if (!threshold || length < threshold || socketData->ssl || socketData->zeroCopy == ZERO_COPY_OFF) {
+            return false;
+        }
+        if (socketData->zeroCopy == ZERO_COPY_UNKNOWN) {
+            int enable = 1;
+            socketData->zeroCopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) ? ZERO_COPY_OFF : ZERO_COPY_ON;
+        }
+        return socketData->zeroCopy == ZERO_COPY_ON;
+    }
+
+    // sends zero-copy, as the socket's send zeroCopyNext - 1 once it took
+    // any, or by copy when the kernel cannot pin more of the process' memory
+    static ssize_t sendZeroCopy(uv_os_sock_t fd, SocketData *socketData, msghdr *message, bool &zeroCopied) {
+        ssize_t sent = ::sendmsg(fd, message, MSG_NOSIGNAL | MSG_ZEROCOPY);
+        zeroCopied = sent > 0;
+        if (zeroCopied) {
+            ZeroCopyCounters &counters = *socketData->nodeData->zeroCopyCounters;
+            counters.add(counters.sends, 1);
+            counters.add(counters.bytes, sent);
+            socketData->zeroCopyNext++;
+        } else if (sent == SOCKET_ERROR && errno == ENOBUFS) {
+            sent = ::sendmsg(fd, message, MSG_NOSIGNAL);
+        }
+        return sent;
+    }
+#endif
+
+    // sends the front of the queue in one call, at most SEND_QUEUE_BATCH
+    // messages gathered straight from where they lie, per-socket frames and
+    // shared prepared ones alike, zero-copy once they come to the threshold;
+    // returns the bytes sent or SOCKET_ERROR
+    static const int SEND_QUEUE_BATCH = 64;
+    static ssize_t sendQueue(uv_os_sock_t fd, SocketData *socketData, bool &zeroCopied) {
+        SocketData::Queue &queue = socketData->messageQueue;
+        zeroCopied = false;
+#ifdef _WIN32
+        SocketData::Queue::Message *messagePtr = queue.front();
+        return ::send(fd, messagePtr->data, messagePtr->length, MSG_NOSIGNAL);
+#else
+        iovec buffers[SEND_QUEUE_BATCH];
+        int count = 0;
+        size_t length = 0;
+        for (SocketData::Queue::Message *messagePtr = queue.front(); messagePtr && count < SEND_QUEUE_BATCH; messagePtr = messagePtr->nextMessage) {
+            buffers[count].iov_base = (void *) messagePtr->data;
+            buffers[count++].iov_len = messagePtr->length;
+            length += messagePtr->length;
+        }
+
+        msghdr message = {};
+        message.msg_iov = buffers;
+        message.msg_iovlen = count;
+#ifdef UWS_ZERO_COPY
+        if (zeroCopies(fd, socketData, length)) {
+            return sendZeroCopy(fd, socketData, &message, zeroCopied);
+        }
+#endif
+        return ::sendmsg(fd, &message, MSG_NOSIGNAL);
+#endif
+    }
+
     bool write(SocketData::Queue::Message *message, bool &wasTransferred) {
         ssize_t sent = 0;
         SocketData *socketData = getSocketData();
         if (socketData->messageQueue.empty()) {
 
-            if (socketData->ssl) {
+            if (socketData->corked) {
+                socketData->corkBuffer.append(message->data, message->length);
+                wasTransferred = false;
+                return true;
+            }
+
+            if (sslWrites(socketData)) {
                 sent = SSL_write(socketData->ssl, message->data, message->length);
                 if (sent == (ssize_t) message->length) {
                     wasTransferred = false;
@@ -395,7 +732,31 @@ public:
                     }
                 }
             } else {
+#ifdef UWS_ZERO_COPY
+                bool zeroCopied = false;
+                if (zeroCopies(getFd(), socketData, message->length)) {
+                    iovec buffer = {(void *) message->data, message->length};
+                    msghdr header = {};
+                    header.msg_iov = &buffer;
+                    header.msg_iovlen = 1;
+                    sent = sendZeroCopy(getFd(), socketData, &header, zeroCopied);
+                } else {
+                    sent = ::send(getFd(), message->data, message->length, MSG_NOSIGNAL);
+                }
+                if (zeroCopied) {
+                    message->zeroCopied = true;
+                    message->zeroCopyId = socketData->zeroCopyNext - 1;
+                    if (sent == (ssize_t) message->length) {
+                        // held, with the callback the caller sets on it,
+                        // until the kernel is done with it
+                        socketData->zeroCopyQueue.push(message);
+                        wasTransferred = true;
+                        return true;
+                    }
+                }
+#else
                 sent = ::send(getFd(), message->data, message->length, MSG_NOSIGNAL);
+#endif
                 if (sent == (ssize_t) message->length) {
                     wasTransferred = false;
                     return true;
@@ -414,64 +775,108 @@ public:
                 }
             }
         }
-        socketData->messageQueue.push(message);
+        countQueued(socketData, message->length);
+        socketData->messageQueue.insert(message);
         wasTransferred = true;
         return true;
     }
 
     template <class T, class D>
-    void sendTransformed(const char *message, size_t length, void(*callback)(void *httpSocket, void *data, bool cancelled, void *reserved), void *callbackData, D transformData) {
-        size_t estimatedLength = T::estimate(message, length) + sizeof(uS::SocketData::Queue::Message);
+    void sendTransformed(const char *message, size_t length, void(*callback)(void *httpSocket, void *data, bool cancelled, void *reserved), void *callbackData, D transformData, const void *stateKey = nullptr,
+                         unsigned char lane = SocketData::Queue::LANE_DEFAULT) {
+        SocketData *socketData = getSocketData();
+        if (socketData->corked && socketData->messageQueue.empty()) {
+            // framed straight into the cork buffer
+            std::string &buffer = socketData->corkBuffer;
+            size_t offset = buffer.length();
+            buffer.resize(offset + T::estimate(message, length));
+            buffer.resize(offset + T::transform(message, &buffer[offset], length, transformData));
+            if (callback) {
+                callback(*this, callbackData, false, nullptr);
+            }
+            return;
+        }
+
+        // small messages come from the node's memory pool, also when queued
+        uS::SocketData::Queue::Message *messagePtr = allocMessage(T::estimate(message, length));
+        messagePtr->length = T::transform(message, (char *) messagePtr->data, length, transformData);
+        messagePtr->stateKey = stateKey;
+        messagePtr->lane = lane;
+        sendMessage(messagePtr, callback, callbackData);
+    }
+
+    // room for a message of up to maxLength bytes that the caller writes in
+    // place and commitWrite sends: at the end of the cork buffer, or in a
+    // message of its own; nothing else may be sent on the socket until then
+    char *reserveWrite(size_t maxLength) {
+        SocketData *socketData = getSocketData();
+        if (socketData->corked && socketData->messageQueue.empty()) {
+            std::string &buffer = socketData->corkBuffer;
+            socketData->reservedMessage = nullptr;
+            socketData->reservedOffset = buffer.length();
+            buffer.resize(buffer.length() + maxLength);
+            return &buffer[socketData->reservedOffset];
+        }
+        socketData->reservedMessage = allocMessage(maxLength);
+        return (char *) socketData->reservedMessage->data;
+    }
 
+    // sends the length bytes written skip bytes into the reserved room
+    void commitWrite(size_t skip, size_t length, const void *stateKey, void(*callback)(void *socket, void *data, bool cancelled, void *reserved), void *callbackData,
+                     unsigned char lane = SocketData::Queue::LANE_DEFAULT) {
+        SocketData *socketData = getSocketData();
+        SocketData::Queue::Message *messagePtr = socketData->reservedMessage;
+        if (!messagePtr) {
+            std::string &buffer = socketData->corkBuffer;
+            if (skip) {
+                memmove(&buffer[socketData->reservedOffset], &buffer[socketData->reservedOffset + skip], length);
+            }
+            buffer.resize(socketData->reservedOffset + length);
+            if (callback) {
+                callback(*this, callbackData, false, nullptr);
+            }
+            return;
+        }
+        socketData->reservedMessage = nullptr;
+        messagePtr->data += skip;
+        messagePtr->length = length;
+        messagePtr->stateKey = stateKey;
+        messagePtr->lane = lane;
+        sendMessage(messagePtr, callback, callbackData);
+    }
+
+    // gives the reserved room back unsent
+    void cancelWrite() {
+        SocketData *socketData = getSocketData();
+        if (socketData->reservedMessage) {
+            freeMessage(socketData->reservedMessage);
+            socketData->reservedMessage = nullptr;
+        } else {
+            socketData->corkBuffer.resize(socketData->reservedOffset);
+        }
+    }
+
+    // writes a framed message, or queues it behind those already queued
+    void sendMessage(SocketData::Queue::Message *messagePtr, void(*callback)(void *socket, void *data, bool cancelled, void *reserved), void *callbackData) {
         if (hasEmptyQueue()) {
-            if (estimatedLength <= uS::NodeData::preAllocMaxSize) {
-                int memoryLength = estimatedLength;
-                int memoryIndex = getSocketData()->nodeData->getMemoryBlockIndex(memoryLength);
-
-                uS::SocketData::Queue::Message *messagePtr = (uS::SocketData::Queue::Message *) getSocketData()->nodeData->getSmallMemoryBlock(memoryIndex);
-                messagePtr->data = ((char *) messagePtr) + sizeof(uS::SocketData::Queue::Message);
-                messagePtr->length = T::transform(message, (char *) messagePtr->data, length, transformData);
-
-                bool wasTransferred;
-                if (write(messagePtr, wasTransferred)) {
-                    if (!wasTransferred) {
-                        getSocketData()->nodeData->freeSmallMemoryBlock((char *) messagePtr, memoryIndex);
-                        if (callback) {
-                            callback(*this, callbackData, false, nullptr);
-                        }
-                    } else {
-                        messagePtr->callback = callback;
-                        messagePtr->callbackData = callbackData;
-                    }
-                } else {
+            bool wasTransferred;
+            if (write(messagePtr, wasTransferred)) {
+                if (!wasTransferred) {
+                    freeMessage(messagePtr);
                     if (callback) {
-                        callback(*this, callbackData, true, nullptr);
+                        callback(*this, callbackData, false, nullptr);
                     }
+                } else {
+                    messagePtr->callback = callback;
+                    messagePtr->callbackData = callbackData;
                 }
             } else {
-                uS::SocketData::Queue::Message *messagePtr = allocMessage(estimatedLength - sizeof(uS::SocketData::Queue::Message));
-                messagePtr->length = T::transform(message, (char *) messagePtr->data, length, transformData);
-
-                bool wasTransferred;
-                if (write(messagePtr, wasTransferred)) {
-                    if (!wasTransferred) {
-                        freeMessage(messagePtr);
-                        if (callback) {
-                            callback(*this, callbackData, false, nullptr);
-                        }
-                    } else {
-                        messagePtr->callback = callback;
-                        messagePtr->callbackData = callbackData;
-                    }
-                } else {
-                    if (callback) {
-                        callback(*this, callbackData, true, nullptr);
-                    }
+                freeMessage(messagePtr);
+                if (callback) {
+                    callback(*this, callbackData, true, nullptr);
                 }
             }
         } else {
-            uS::SocketData::Queue::Message *messagePtr = allocMessage(estimatedLength - sizeof(uS::SocketData::Queue::Message));
-            messagePtr->length = T::transform(message, (char *) messagePtr->data, length, transformData);
             messagePtr->callback = callback;
             messagePtr->callbackData = callbackData;
             enqueue(messagePtr);
@@ -1,15 +1,182 @@
 #include "WebSocket.h"
 #include "Group.h"
+#include "Hub.h"
 
 namespace uWS {
 
 template <bool isServer>
 void WebSocket<isServer>::send(const char *message, size_t length, OpCode opCode, void(*callback)(void *webSocket, void *data, bool cancelled, void *reserved), void *callbackData) {
+    sendData(message, length, opCode, callback, callbackData, nullptr);
+}
+
+template <bool isServer>
+void WebSocket<isServer>::sendState(const char *message, size_t length, OpCode opCode, const void *stateKey) {
+    sendData(message, length, opCode, nullptr, nullptr, stateKey);
+}
+
+template <bool isServer>
+void WebSocket<isServer>::sendData(const char *message, size_t length, OpCode opCode, void(*callback)(void *webSocket, void *data, bool cancelled, void *reserved), void *callbackData, const void *stateKey) {
+    UWS_PROBE3(websocket__send, getFd(), length, (int) opCode);
+    bool isData = opCode == OpCode::TEXT || opCode == OpCode::BINARY;
+    if (isData && !applyBackpressure(stateKey)) {
+        if (callback) {
+            callback(*this, callbackData, true, nullptr);
+        }
+        return;
+    }
+    sendAccepted(message, length, opCode, callback, callbackData, stateKey);
+    checkBatch();
+}
+
+template <bool isServer>
+char *WebSocket<isServer>::reserveSend(size_t maxLength, OpCode opCode, const void *stateKey) {
+    bool isData = opCode == OpCode::TEXT || opCode == OpCode::BINARY;
+    if (isData && !applyBackpressure(stateKey)) {
+        return nullptr;
+    }
+
+    holdWrites();
+    Data *webSocketData = (Data *) getSocketData();
+    webSocketData->reservedOpCode = opCode;
+    webSocketData->reservedStateKey = stateKey;
+    if (isData && deflates(stateKey, maxLength)) {
+        webSocketData->reservedHeader = 0;
+        webSocketData->reservedMessage = allocMessage(maxLength);
+        return (char *) webSocketData->reservedMessage->data;
+    }
+
+    // a shorter message than maxLength may need less header; commitWrite
+    // then skips the difference
+    webSocketData->reservedHeader = WebSocketProtocol<isServer>::headerLength(maxLength);
+    return reserveWrite(webSocketData->reservedHeader + maxLength) + webSocketData->reservedHeader;
+}
+
+template <bool isServer>
+void WebSocket<isServer>::commitSend(size_t length) {
+    Data *webSocketData = (Data *) getSocketData();
+    if (!webSocketData->reservedHeader) {
+        uS::SocketData::Queue::Message *messagePtr = webSocketData->reservedMessage;
+        webSocketData->reservedMessage = nullptr;
+        sendAccepted(messagePtr->data, length, webSocketData->reservedOpCode, nullptr, nullptr, webSocketData->reservedStateKey);
+        freeMessage(messagePtr);
+        checkBatch();
+        return;
+    }
+
+    size_t headerLength = WebSocketProtocol<isServer>::headerLength(length);
+    size_t skip = webSocketData->reservedHeader - headerLength;
+    char *frame = (webSocketData->reservedMessage ? (char *) webSocketData->reservedMessage->data
+                                                  : &webSocketData->corkBuffer[webSocketData->reservedOffset]) + skip;
+    char mask[4];
+    WebSocketProtocol<isServer>::formatHeader(frame, length, webSocketData->reservedOpCode, false, mask);
+    if (!isServer) {
+        WebSocketProtocol<isServer>::maskPayload(frame + headerLength, length, mask);
+    }
+    commitWrite(skip, headerLength + length, webSocketData->reservedStateKey, nullptr, nullptr, lane(webSocketData->reservedOpCode, length));
+    checkBatch();
+}
+
+// data messages go out deflated where permessage-deflate was negotiated,
+// but state messages not with a kept context, which would miss any that
+// get dropped, and none shorter than the group's threshold
+template <bool isServer>
+bool WebSocket<isServer>::deflates(const void *stateKey, size_t length) {
+    Data *webSocketData = (Data *) getSocketData();
+    return (webSocketData->compressionOptions & PERMESSAGE_DEFLATE) && !(stateKey && webSocketData->slidingDeflate())
+           && length >= getGroup<isServer>(*this)->deflateMinLength;
+}
+
+// a message sent uncompressed is always valid, also between deflated ones
+// of a kept context, which just does not see it
+template <bool isServer>
+bool WebSocket<isServer>::worthDeflating() {
+    Group<isServer> *group = getGroup<isServer>(*this);
+    Data *webSocketData = (Data *) getSocketData();
+    if (webSocketData->deflateSavings >= group->deflateMinSavings
+        && (!group->deflateMaxNanos || webSocketData->deflateNanos <= group->deflateMaxNanos)) {
+        return true;
+    }
+    if (++webSocketData->deflateSkips < Group<isServer>::DEFLATE_PROBE_INTERVAL) {
+        return false;
+    }
+    webSocketData->deflateSkips = 0;
+    return true;
+}
+
+// averaged over about the last 8 messages deflated
+template <bool isServer>
+void WebSocket<isServer>::measureDeflate(size_t length, size_t deflatedLength, double seconds) {
+    Data *webSocketData = (Data *) getSocketData();
+    size_t saved = deflatedLength < length ? length - deflatedLength : 0;
+    float savings = length ? (float) saved / length : 0;
+    float nanos = (float) (seconds * 1e9 / std::max<size_t>(saved, 1));
+    webSocketData->deflateSavings += (savings - webSocketData->deflateSavings) / 8;
+    webSocketData->deflateNanos += (nanos - webSocketData->deflateNanos) / 8;
+}
+
+// pings and pongs go ahead of the data, and a close frame behind all of it;
+// large data messages wait behind the rest unless a kept deflate context
+// needs them in order
+template <bool isServer>
+unsigned char WebSocket<isServer>::lane(OpCode opCode, size_t length) {
+    if (opCode == OpCode::PING || opCode == OpCode::PONG) {
+        return uS::SocketData::Queue::LANE_CONTROL;
+    } else if (opCode == OpCode::CLOSE) {
+        return uS::SocketData::Queue::LANE_BULK;
+    }
+    size_t bulkLength = getGroup<isServer>(*this)->bulkLength;
+    if (bulkLength && length >= bulkLength && !((Data *) getSocketData())->slidingDeflate()) {
+        return uS::SocketData::Queue::LANE_BULK;
+    }
+    return uS::SocketData::Queue::LANE_DEFAULT;
+}
+
+template <bool isServer>
+void WebSocket<isServer>::setSendBatching(int budgetMicros) {
+    Data *webSocketData = (Data *) getSocketData();
+    webSocketData->batchMicros = budgetMicros;
+    if (webSocketData->batched && !batchBudget()) {
+        getGroup<isServer>(*this)->flushBatch(p);
+    }
+}
+
+template <bool isServer>
+int WebSocket<isServer>::batchBudget() {
+    int batchMicros = ((Data *) getSocketData())->batchMicros;
+    return batchMicros < 0 ? getGroup<isServer>(*this)->batchMicros : batchMicros;
+}
+
+// a read corks the writes it answers anyway and decides at its end, see
+// onData; a closing WebSocket sends its close frame right away
+template <bool isServer>
+void WebSocket<isServer>::holdWrites() {
+    Data *webSocketData = (Data *) getSocketData();
+    if (webSocketData->corked || isShuttingDown() || !webSocketData->messageQueue.empty()) {
+        return;
+    }
+    if (int budget = batchBudget()) {
+        corkWrites();
+        getGroup<isServer>(*this)->holdBatch(p, budget);
+    }
+}
+
+template <bool isServer>
+void WebSocket<isServer>::checkBatch() {
+    Data *webSocketData = (Data *) getSocketData();
+    if (webSocketData->batched && webSocketData->corkBuffer.length() >= getGroup<isServer>(*this)->batchBytes) {
+        getGroup<isServer>(*this)->flushBatch(p);
+    }
+}
+
+template <bool isServer>
+void WebSocket<isServer>::sendAccepted(const char *message, size_t length, OpCode opCode, void(*callback)(void *webSocket, void *data, bool cancelled, void *reserved), void *callbackData, const void *stateKey) {
     const int HEADER_LENGTH = WebSocketProtocol<!isServer>::LONG_MESSAGE_HEADER;
+    holdWrites();
 
     struct TransformData {
         OpCode opCode;
-    } transformData = {opCode};
+        bool compressed;
+    } transformData = {opCode, false};
 
     struct WebSocketTransformer {
         static size_t estimate(const char *data, size_t length) {
@@ -17,11 +184,78 @@ void WebSocket<isServer>::send(const char *message, size_t length, OpCode opCode
         }
 
         static size_t transform(const char *src, char *dst, size_t length, TransformData transformData) {
-            return WebSocketProtocol<isServer>::formatMessage(dst, src, length, transformData.opCode, length, false);
+            return WebSocketProtocol<isServer>::formatMessage(dst, src, length, transformData.opCode, length, transformData.compressed);
         }
     };
 
-    sendTransformed<WebSocketTransformer>((char *) message, length, callback, callbackData, transformData);
+    // the lane goes by the length before deflating, the work the message is
+    unsigned char messageLane = lane(opCode, length);
+
+    // the deflated copy lives in the Hub until the next message
+    bool isData = opCode == OpCode::TEXT || opCode == OpCode::BINARY;
+    Data *webSocketData = (Data *) getSocketData();
+    if (isData && deflates(stateKey, length) && worthDeflating()) {
+        Hub *hub = getGroup<isServer>(*this)->hub;
+        if (webSocketData->slidingDeflate() && !webSocketData->deflationStream) {
+            webSocketData->deflationStream = hub->createDeflationStream();
+        }
+        // the Hub times zlib already
+        double deflateSeconds = hub->getCompressionStats().deflateSeconds;
+        size_t deflatedLength = length;
+        const char *deflated = hub->deflate(message, deflatedLength, webSocketData->deflationStream);
+        measureDeflate(length, deflated ? deflatedLength : length, hub->getCompressionStats().deflateSeconds - deflateSeconds);
+        if (deflated) {
+            message = deflated;
+            length = deflatedLength;
+            transformData.compressed = true;
+        }
+    }
+
+    sendTransformed<WebSocketTransformer>((char *) message, length, callback, callbackData, transformData, stateKey, messageLane);
+}
+
+// past the group's high watermark, fires its handler once and applies its
+// policy; returns whether the message is still to be sent
+template <bool isServer>
+bool WebSocket<isServer>::applyBackpressure(const void *stateKey) {
+    Group<isServer> *group = getGroup<isServer>(*this);
+    if (!group->highWatermark || isShuttingDown()) {
+        return true;
+    }
+
+    Data *webSocketData = (Data *) getSocketData();
+    size_t bufferedAmount = getBufferedAmount();
+    if (bufferedAmount <= group->highWatermark) {
+        webSocketData->backpressured = false;
+        return true;
+    }
+
+    if (!webSocketData->backpressured) {
+        webSocketData->backpressured = true;
+        if (group->backpressureHandler) {
+            group->backpressureHandler(*this, bufferedAmount);
+            if (isClosed() || isShuttingDown()) {
+                return false;
+            }
+        }
+    }
+
+    switch (group->backpressurePolicy) {
+    case Group<isServer>::DROP_OLDEST:
+        dropQueued(nullptr, group->highWatermark);
+        break;
+    case Group<isServer>::COALESCE_LATEST:
+        if (stateKey) {
+            dropQueued(stateKey, 0);
+        }
+        break;
+    case Group<isServer>::DISCONNECT:
+        close(1008);
+        return false;
+    default:
+        break;
+    }
+    return true;
 }
 
 template <bool isServer>
@@ -59,6 +293,15 @@ typename WebSocket<isServer>::PreparedMessage *WebSocket<isServer>::prepareMessa
 // todo: see if this can be made a transformer instead
 template <bool isServer>
 void WebSocket<isServer>::sendPrepared(typename WebSocket<isServer>::PreparedMessage *preparedMessage, void *callbackData) {
+    // as in sendData, control frames (opcodes 8 to 10) are never held back
+    bool isData = !(preparedMessage->buffer[0] & 8);
+    if (isData && !applyBackpressure(preparedMessage->stateKey)) {
+        if (preparedMessage->callback) {
+            preparedMessage->callback(*this, callbackData, true, (void *) false);
+        }
+        return;
+    }
+
     preparedMessage->references++;
     void (*callback)(void *webSocket, void *userData, bool cancelled, void *reserved) = [](void *webSocket, void *userData, bool cancelled, void *reserved) {
         PreparedMessage *preparedMessage = (PreparedMessage *) userData;
@@ -74,18 +317,18 @@ void WebSocket<isServer>::sendPrepared(typename WebSocket<isServer>::PreparedMes
         }
     };
 
-    // candidate for fixed size pool allocator
-    int memoryLength = sizeof(uS::SocketData::Queue::Message);
-    int memoryIndex = getSocketData()->nodeData->getMemoryBlockIndex(memoryLength);
-
-    uS::SocketData::Queue::Message *messagePtr = (uS::SocketData::Queue::Message *) getSocketData()->nodeData->getSmallMemoryBlock(memoryIndex);
+    // only the message header, from the node's memory pool
+    uS::SocketData::Queue::Message *messagePtr = allocMessage(0);
     messagePtr->data = preparedMessage->buffer;
     messagePtr->length = preparedMessage->length;
+    messagePtr->stateKey = preparedMessage->stateKey;
+    messagePtr->lane = lane((OpCode) (preparedMessage->buffer[0] & 15), preparedMessage->length);
 
+    holdWrites();
     bool wasTransferred;
     if (write(messagePtr, wasTransferred)) {
         if (!wasTransferred) {
-            getSocketData()->nodeData->freeSmallMemoryBlock((char *) messagePtr, memoryIndex);
+            freeMessage(messagePtr);
             if (callback) {
                 callback(*this, preparedMessage, false, callbackData);
             }
@@ -94,7 +337,9 @@ void WebSocket<isServer>::sendPrepared(typename WebSocket<isServer>::PreparedMes
             messagePtr->callbackData = preparedMessage;
             messagePtr->reserved = callbackData;
         }
+        checkBatch();
     } else {
+        freeMessage(messagePtr);
         if (callback) {
             callback(*this, preparedMessage, true, callbackData);
         }
@@ -111,19 +356,53 @@ void WebSocket<isServer>::finalizeMessage(typename WebSocket<isServer>::Prepared
 
 template <bool isServer>
 void WebSocket<isServer>::onData(uS::Socket s, char *data, int length) {
+    UWS_PROBE2(websocket__data, s.getFd(), length);
     Data *webSocketData = (Data *) s.getSocketData();
-    webSocketData->hasOutstandingPong = false;
+    webSocketData->silent = false;
     if (!s.isShuttingDown()) {
-        s.cork(true);
+        // whatever the handlers send for this read goes out in one send
+        s.corkWrites();
         ((WebSocketProtocol<isServer> *) webSocketData)->consume(data, length, s);
         if (!s.isClosed()) {
-            s.cork(false);
+            // unless the WebSocket batches its sends and has room for more
+            // of them, held until its deadline
+            WebSocket<isServer> webSocket(s);
+            Group<isServer> *group = getGroup<isServer>(s);
+            int budget;
+            if (!s.isShuttingDown() && !webSocketData->corkBuffer.empty()
+                && webSocketData->corkBuffer.length() < group->batchBytes && (budget = webSocket.batchBudget())) {
+                if (!webSocketData->batched) {
+                    group->holdBatch(webSocket.getPollHandle(), budget);
+                }
+            } else if (webSocketData->batched) {
+                group->flushBatch(webSocket.getPollHandle());
+            } else {
+                s.uncorkWrites();
+            }
         }
     }
 }
 
+template <bool isServer>
+bool WebSocket<isServer>::canHandOff() {
+    Data *webSocketData = (Data *) getSocketData();
+    return !getBufferedAmount() && webSocketData->zeroCopyQueue.empty() && webSocketData->atMessageBoundary()
+           && !webSocketData->ssl && !webSocketData->slidingDeflate() && !webSocketData->slidingInflate();
+}
+
+template <bool isServer>
+uv_os_sock_t WebSocket<isServer>::handOff(int &compressionOptions) {
+    uv_os_sock_t fd = fcntl(getFd(), F_DUPFD_CLOEXEC, 0);
+    if (fd != SOCKET_ERROR) {
+        compressionOptions = ((Data *) getSocketData())->compressionOptions;
+        terminate();
+    }
+    return fd;
+}
+
 template <bool isServer>
 void WebSocket<isServer>::terminate() {
+    uncorkWrites();
     WebSocket<isServer>::onEnd(*this);
 }
 
@@ -131,6 +410,8 @@ template <bool isServer>
 void WebSocket<isServer>::close(int code, const char *message, size_t length) {
     static const int MAX_CLOSE_PAYLOAD = 123;
     length = std::min<size_t>(MAX_CLOSE_PAYLOAD, length);
+    // the close frame's callback shuts the socket down, after anything corked
+    uncorkWrites();
     getGroup<isServer>(*this)->removeWebSocket(*this);
     getGroup<isServer>(*this)->disconnectionHandler(*this, code, (char *) message, length);
     getSocketData()->shuttingDown = true;
@@ -160,13 +441,15 @@ void WebSocket<isServer>::onEnd(uS::Socket s) {
     Data *webSocketData = (Data *) s.getSocketData();
 
     s.close();
+    uS::Socket::releaseZeroCopied(webSocketData);
+    uS::Socket::uncountQueued(webSocketData, webSocketData->messageQueue.bufferedAmount);
 
     while (!webSocketData->messageQueue.empty()) {
         uS::SocketData::Queue::Message *message = webSocketData->messageQueue.front();
         if (message->callback) {
             message->callback(nullptr, message->callbackData, true, nullptr);
         }
-        webSocketData->messageQueue.pop();
+        webSocketData->messageQueue.pop(webSocketData->nodeData);
     }
 
     delete webSocketData;
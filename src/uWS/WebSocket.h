@@ -3,6 +3,8 @@
 
 #include "WebSocketProtocol.h"
 #include "Socket.h"
+#include "Extensions.h"
+#include <zlib.h>
 
 namespace uWS {
 
@@ -12,16 +14,109 @@ struct Group;
 template <const bool isServer>
 struct WIN32_EXPORT WebSocket : protected uS::Socket {
     struct Data : uS::SocketData, WebSocketProtocol<isServer> {
-        std::string fragmentBuffer, controlBuffer;
+        std::string controlBuffer;
+        // a message arriving in parts, in a buffer of the loop's FragmentPool
+        // that goes back to it once the message is complete
+        char *fragmentBuffer = nullptr;
+        size_t fragmentLength = 0, fragmentCapacity = 0;
+        int fragmentGrows = 0;
         enum CompressionStatus : char {
             DISABLED,
             ENABLED,
             COMPRESSED_FRAME
         } compressionStatus;
-        bool hasOutstandingPong = false;
+        // nothing arrived since auto-ping last came round, and it pinged the
+        // socket then as it had been silent for the round before
+        bool silent = false, pinged = false;
+        // past the group's high watermark since the last message sent
+        bool backpressured = false;
+        // the group's rate limit buckets (see Group::setRateLimit): the
+        // messages and bytes the client may still send, filled up to when
+        // rateRefilled says, in ms of the loop's clock; full until its first
+        // message. Negative while reading is paused to pay off a debt
+        double messageTokens = 0, byteTokens = 0;
+        uint64_t rateRefilled = 0;
+        bool rateStarted = false;
+        // the send batching budget in us, -1 for the group's (see
+        // Group::setSendBatching), and while the group holds the writes
+        // corked, when they are due out, in us of its clock
+        int batchMicros = -1;
+        bool batched = false;
+        uint64_t batchDeadline = 0;
+
+        // the message between reserveSend and commitSend: its frame, the
+        // header room in front of the payload (0 if it goes out deflated)
+        // and its state key
+        OpCode reservedOpCode;
+        unsigned char reservedHeader;
+        const void *reservedStateKey;
+
+        // what deflating the data messages has saved and cost lately, as the
+        // fraction of their bytes saved and ns per byte saved, and while it
+        // is not worth it, the messages sent uncompressed since it was
+        // measured (see Group::setCompressionThreshold)
+        float deflateSavings = 1, deflateNanos = 0;
+        unsigned short deflateSkips = 0;
+
+        // the negotiated extension options, without PERMESSAGE_DEFLATE if none
+        int compressionOptions;
+        // own streams, kept between messages where the context is taken over;
+        // created on first use, otherwise the Hub's shared streams are used
+        z_stream *deflationStream = nullptr, *inflationStream = nullptr;
+
+        Data(int compressionOptions, uS::SocketData *socketData) : uS::SocketData(*socketData), compressionOptions(compressionOptions) {
+            compressionStatus = (compressionOptions & PERMESSAGE_DEFLATE) ? CompressionStatus::ENABLED : CompressionStatus::DISABLED;
+        }
+
+        ~Data() {
+            releaseFragmentBuffer();
+            if (deflationStream) {
+                deflateEnd(deflationStream);
+                delete deflationStream;
+            }
+            if (inflationStream) {
+                inflateEnd(inflationStream);
+                delete inflationStream;
+            }
+        }
+
+        // room for length more bytes of the partial message, and 4 to spare
+        // for inflating it; the buffer grows to the next size class, which
+        // happens only when a message comes in several frames, as a frame's
+        // length is known from its header
+        void reserveFragment(size_t length) {
+            size_t needed = fragmentLength + length + 4;
+            if (needed <= fragmentCapacity) {
+                return;
+            }
+            uS::FragmentPool &pool = *nodeData->fragmentPool;
+            size_t capacity;
+            char *buffer = pool.get(needed, capacity);
+            if (fragmentBuffer) {
+                memcpy(buffer, fragmentBuffer, fragmentLength);
+                pool.free(fragmentBuffer, fragmentCapacity);
+                fragmentGrows++;
+            }
+            fragmentBuffer = buffer;
+            fragmentCapacity = capacity;
+        }
+
+        void releaseFragmentBuffer() {
+            if (fragmentBuffer) {
+                nodeData->fragmentPool->free(fragmentBuffer, fragmentCapacity);
+                fragmentBuffer = nullptr;
+            }
+            fragmentLength = fragmentCapacity = 0;
+            fragmentGrows = 0;
+        }
+
+        // whether the context of this side's, or the peer's, messages is kept
+        bool slidingDeflate() const {
+            return (compressionOptions & PERMESSAGE_DEFLATE) && !(compressionOptions & (isServer ? SERVER_NO_CONTEXT_TAKEOVER : CLIENT_NO_CONTEXT_TAKEOVER));
+        }
 
-        Data(bool perMessageDeflate, uS::SocketData *socketData) : uS::SocketData(*socketData) {
-            compressionStatus = perMessageDeflate ? CompressionStatus::ENABLED : CompressionStatus::DISABLED;
+        bool slidingInflate() const {
+            return (compressionOptions & PERMESSAGE_DEFLATE) && !(compressionOptions & (isServer ? CLIENT_NO_CONTEXT_TAKEOVER : SERVER_NO_CONTEXT_TAKEOVER));
         }
     };
 
@@ -34,27 +129,57 @@ struct WIN32_EXPORT WebSocket : protected uS::Socket {
         size_t length;
         int references;
         void(*callback)(void *webSocket, void *data, bool cancelled, void *reserved);
+        // only compared: the key of a state message, see Group::Backpressure
+        const void *stateKey = nullptr;
     };
 
     using uS::Socket::getUserData;
     using uS::Socket::setUserData;
     using uS::Socket::getAddress;
     using uS::Socket::Address;
+    using uS::Socket::corkWrites;
+    using uS::Socket::uncorkWrites;
+    using uS::Socket::getBufferedAmount;
 
     void transfer(Group<isServer> *group) {
         ((Group<isServer> *) getSocketData()->nodeData)->removeWebSocket(p);
         uS::Socket::transfer((uS::NodeData *) group, [](uv_poll_t *p) {
             uS::Socket s(p);
-            ((Group<isServer> *) s.getSocketData()->nodeData)->addWebSocket(s);
+            Group<isServer> *group = (Group<isServer> *) s.getSocketData()->nodeData;
+            group->addWebSocket(s);
+            group->transferHandler(WebSocket<isServer>(s));
         });
     }
 
     uv_poll_t *getPollHandle() const {return p;}
+    // this WebSocket's own send batching budget, in place of the group's: 0
+    // sends right away, -1 goes back to the group's
+    void setSendBatching(int budgetMicros);
+    // whether the connection could go on in another process as it stands:
+    // nothing left to send, no message partly read, not encrypted here and
+    // without a kept deflate context, which stays behind
+    bool canHandOff();
+    // a dup of the socket for another process to continue the connection
+    // on with Hub::adopt, and the extension options it needs, or
+    // SOCKET_ERROR; the WebSocket then ends here, without a close frame, as
+    // if the peer went away, while the connection stays open
+    uv_os_sock_t handOff(int &compressionOptions);
     void terminate();
     void close(int code = 1000, const char *message = nullptr, size_t length = 0);
     void ping(const char *message) {send(message, OpCode::PING);}
     void send(const char *message, OpCode opCode = OpCode::TEXT) {send(message, strlen(message), opCode);}
     void send(const char *message, size_t length, OpCode opCode, void(*callback)(void *webSocket, void *data, bool cancelled, void *reserved) = nullptr, void *callbackData = nullptr);
+    // a message that only carries the latest state of stateKey, which the
+    // group's backpressure policy may drop for a newer one while it is queued
+    void sendState(const char *message, size_t length, OpCode opCode, const void *stateKey);
+    // where to write the payload of a message of up to maxLength bytes that
+    // commitSend sends: room for it in the socket's outgoing data, with its
+    // frame header framed in front, so the payload is written once; null if
+    // the backpressure policy drops the message. Nothing else may be sent on
+    // the socket in between. A message that is deflated is written into a
+    // buffer of its own instead and compressed from there
+    char *reserveSend(size_t maxLength, OpCode opCode, const void *stateKey = nullptr);
+    void commitSend(size_t length);
     static PreparedMessage *prepareMessage(char *data, size_t length, OpCode opCode, bool compressed, void(*callback)(void *webSocket, void *data, bool cancelled, void *reserved) = nullptr);
     static PreparedMessage *prepareMessageBatch(std::vector<std::string> &messages, std::vector<int> &excludedMessages, OpCode opCode, bool compressed, void(*callback)(void *webSocket, void *data, bool cancelled, void *reserved) = nullptr);
     void sendPrepared(PreparedMessage *preparedMessage, void *callbackData = nullptr);
@@ -67,6 +192,23 @@ private:
     template <bool> friend struct Group;
     static void onData(uS::Socket s, char *data, int length);
     static void onEnd(uS::Socket s);
+    void sendData(const char *message, size_t length, OpCode opCode, void(*callback)(void *webSocket, void *data, bool cancelled, void *reserved), void *callbackData, const void *stateKey);
+    // sendData after the backpressure policy let the message through
+    void sendAccepted(const char *message, size_t length, OpCode opCode, void(*callback)(void *webSocket, void *data, bool cancelled, void *reserved), void *callbackData, const void *stateKey);
+    bool applyBackpressure(const void *stateKey);
+    // whether a data message of up to length bytes may go out deflated
+    bool deflates(const void *stateKey, size_t length);
+    // whether the next such message is to be deflated, as measured so far,
+    // and the measure of one that was
+    bool worthDeflating();
+    void measureDeflate(size_t length, size_t deflatedLength, double seconds);
+    // the send queue lane of a message of length bytes
+    unsigned char lane(OpCode opCode, size_t length);
+    int batchBudget();
+    // before a send: holds the writes corked if the WebSocket batches them
+    void holdWrites();
+    // after a send: sends what is held once it reaches the group's flush size
+    void checkBatch();
 };
 
 }
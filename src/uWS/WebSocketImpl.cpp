@@ -2,6 +2,42 @@
 
 namespace uWS {
 
+// inflates one message on the connection's own stream if the peer keeps its
+// context, on the Hub's shared stream otherwise
+template <const bool isServer>
+static char *inflateMessage(typename WebSocket<isServer>::Data *webSocketData, char *data, size_t &length) {
+    Hub *hub = ((Group<isServer> *) webSocketData->nodeData)->hub;
+    if (webSocketData->slidingInflate() && !webSocketData->inflationStream) {
+        webSocketData->inflationStream = hub->createInflationStream();
+    }
+    return hub->inflate(data, length, webSocketData->inflationStream);
+}
+
+// charges a complete message, as it came in, to the group's rate limit
+// before it is inflated or handled: 1 to handle it, 0 if it is dropped, -1
+// if the WebSocket is gone. A dropped message deflated with the context of
+// those before it is still inflated, for those after it
+template <const bool isServer>
+static int admitMessage(uv_poll_t *p, char *data, size_t length) {
+    uS::Socket s(p);
+    Group<isServer> *group = (Group<isServer> *) s.getSocketData()->nodeData;
+    if (group->admitMessage(p, length)) {
+        return 1;
+    }
+    if (s.isClosed() || s.isShuttingDown()) {
+        return -1;
+    }
+    typename WebSocket<isServer>::Data *webSocketData = (typename WebSocket<isServer>::Data *) s.getSocketData();
+    if (webSocketData->compressionStatus == WebSocket<isServer>::Data::CompressionStatus::COMPRESSED_FRAME) {
+        webSocketData->compressionStatus = WebSocket<isServer>::Data::CompressionStatus::ENABLED;
+        if (webSocketData->slidingInflate() && !inflateMessage<isServer>(webSocketData, data, length)) {
+            WebSocket<isServer>(p).terminate();
+            return -1;
+        }
+    }
+    return 0;
+}
+
 template <const bool isServer>
 bool WebSocketProtocol<isServer>::setCompressed(void *user) {
     uS::Socket s((uv_poll_t *) user);
@@ -31,11 +67,17 @@ bool WebSocketProtocol<isServer>::handleFragment(char *data, size_t length, unsi
     typename WebSocket<isServer>::Data *webSocketData = (typename WebSocket<isServer>::Data *) s.getSocketData();
 
     if (opCode < 3) {
-        if (!remainingBytes && fin && !webSocketData->fragmentBuffer.length()) {
+        if (!remainingBytes && fin && !webSocketData->fragmentLength) {
+            if (((Group<isServer> *) s.getSocketData()->nodeData)->rateLimited()) {
+                int admitted = admitMessage<isServer>((uv_poll_t *) user, data, length);
+                if (admitted <= 0) {
+                    return admitted < 0;
+                }
+            }
+
             if (webSocketData->compressionStatus == WebSocket<isServer>::Data::CompressionStatus::COMPRESSED_FRAME) {
                 webSocketData->compressionStatus = WebSocket<isServer>::Data::CompressionStatus::ENABLED;
-                Hub *hub = ((Group<isServer> *) s.getSocketData()->nodeData)->hub;
-                data = hub->inflate(data, length);
+                data = inflateMessage<isServer>(webSocketData, data, length);
                 if (!data) {
                     forceClose(user);
                     return true;
@@ -47,25 +89,39 @@ bool WebSocketProtocol<isServer>::handleFragment(char *data, size_t length, unsi
                 return true;
             }
 
-            ((Group<isServer> *) s.getSocketData()->nodeData)->messageHandler(WebSocket<isServer>(s), data, length, (OpCode) opCode);
+            ((Group<isServer> *) s.getSocketData()->nodeData)->handleMessage(WebSocket<isServer>(s), data, length, (OpCode) opCode);
             if (s.isClosed() || s.isShuttingDown()) {
                 return true;
             }
         } else {
-            webSocketData->fragmentBuffer.append(data, length);
+            // the rest of this frame is reserved with its first part
+            webSocketData->reserveFragment(length + remainingBytes);
+            memcpy(webSocketData->fragmentBuffer + webSocketData->fragmentLength, data, length);
+            webSocketData->fragmentLength += length;
             if (!remainingBytes && fin) {
-                length = webSocketData->fragmentBuffer.length();
+                length = webSocketData->fragmentLength;
+                ((Group<isServer> *) s.getSocketData()->nodeData)->fragmentPool->reassembled(length, webSocketData->fragmentGrows);
+                if (((Group<isServer> *) s.getSocketData()->nodeData)->rateLimited()) {
+                    memcpy(webSocketData->fragmentBuffer + length, "....", 4);
+                    int admitted = admitMessage<isServer>((uv_poll_t *) user, webSocketData->fragmentBuffer, length);
+                    if (admitted < 0) {
+                        return true;
+                    }
+                    if (!admitted) {
+                        webSocketData->releaseFragmentBuffer();
+                        return false;
+                    }
+                }
                 if (webSocketData->compressionStatus == WebSocket<isServer>::Data::CompressionStatus::COMPRESSED_FRAME) {
                     webSocketData->compressionStatus = WebSocket<isServer>::Data::CompressionStatus::ENABLED;
-                    Hub *hub = ((Group<isServer> *) s.getSocketData()->nodeData)->hub;
-                    webSocketData->fragmentBuffer.append("....");
-                    data = hub->inflate((char *) webSocketData->fragmentBuffer.data(), length);
+                    memcpy(webSocketData->fragmentBuffer + length, "....", 4);
+                    data = inflateMessage<isServer>(webSocketData, webSocketData->fragmentBuffer, length);
                     if (!data) {
                         forceClose(user);
                         return true;
                     }
                 } else {
-                    data = (char *) webSocketData->fragmentBuffer.data();
+                    data = webSocketData->fragmentBuffer;
                 }
 
                 if (opCode == 1 && !isValidUtf8((unsigned char *) data, length)) {
@@ -73,11 +129,11 @@ bool WebSocketProtocol<isServer>::handleFragment(char *data, size_t length, unsi
                     return true;
                 }
 
-                ((Group<isServer> *) s.getSocketData()->nodeData)->messageHandler(WebSocket<isServer>(s), data, length, (OpCode) opCode);
+                ((Group<isServer> *) s.getSocketData()->nodeData)->handleMessage(WebSocket<isServer>(s), data, length, (OpCode) opCode);
                 if (s.isClosed() || s.isShuttingDown()) {
                     return true;
                 }
-                webSocketData->fragmentBuffer.clear();
+                webSocketData->releaseFragmentBuffer();
             }
         }
     } else {
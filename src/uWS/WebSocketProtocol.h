@@ -6,6 +6,14 @@
 
 #include <cstring>
 #include <cstdlib>
+#include <cstdint>
+#include <random>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace uWS {
 
@@ -38,16 +46,44 @@ private:
     static inline bool rsv1(frameFormat &frame) {return frame & 64;}
     static inline bool getMask(frameFormat &frame) {return frame & 32768;}
 
-    static inline void unmaskImprecise(char *dst, char *src, char *mask, unsigned int length)
+    // XORs length bytes, a multiple of 4, with the mask repeated; dst may be
+    // src itself or lie before it, as every block is read before it is written
+    static inline void unmaskWords(char *dst, char *src, char *mask, unsigned int length)
     {
-        for (unsigned int n = (length >> 2) + 1; n; n--) {
-            *(dst++) = *(src++) ^ mask[0];
-            *(dst++) = *(src++) ^ mask[1];
-            *(dst++) = *(src++) ^ mask[2];
-            *(dst++) = *(src++) ^ mask[3];
+        uint32_t mask32;
+        memcpy(&mask32, mask, 4);
+#if defined(__SSE2__)
+        __m128i mask128 = _mm_set1_epi32((int) mask32);
+        for (; length >= 16; length -= 16, src += 16, dst += 16) {
+            _mm_storeu_si128((__m128i *) dst, _mm_xor_si128(_mm_loadu_si128((__m128i *) src), mask128));
+        }
+#elif defined(__ARM_NEON)
+        uint32x4_t mask128 = vdupq_n_u32(mask32);
+        for (; length >= 16; length -= 16, src += 16, dst += 16) {
+            vst1q_u32((uint32_t *) dst, veorq_u32(vld1q_u32((uint32_t *) src), mask128));
+        }
+#endif
+        uint64_t mask64 = ((uint64_t) mask32 << 32) | mask32;
+        for (; length >= 8; length -= 8, src += 8, dst += 8) {
+            uint64_t word;
+            memcpy(&word, src, 8);
+            word ^= mask64;
+            memcpy(dst, &word, 8);
+        }
+        if (length) {
+            uint32_t word;
+            memcpy(&word, src, 4);
+            word ^= mask32;
+            memcpy(dst, &word, 4);
         }
     }
 
+    // unmasks at least length bytes, rounded up to whole mask periods
+    static inline void unmaskImprecise(char *dst, char *src, char *mask, unsigned int length)
+    {
+        unmaskWords(dst, src, mask, ((length >> 2) + 1) * 4);
+    }
+
     static inline void unmaskImpreciseCopyMask(char *dst, char *src, char *maskPtr, unsigned int length)
     {
         char mask[4] = {maskPtr[0], maskPtr[1], maskPtr[2], maskPtr[3]};
@@ -65,11 +101,8 @@ private:
 
     static inline void unmaskInplace(char *data, char *stop, char *mask)
     {
-        while (data < stop) {
-            *(data++) ^= mask[0];
-            *(data++) ^= mask[1];
-            *(data++) ^= mask[2];
-            *(data++) ^= mask[3];
+        if (data < stop) {
+            unmaskWords(data, data, mask, stop - data);
         }
     }
 
@@ -195,6 +228,11 @@ public:
 
     }
 
+    // between messages, with no part of a frame held
+    bool atMessageBoundary() const {
+        return state == READ_HEAD && !spillLength && opStack == -1;
+    }
+
     // Based on utf8_check.c by Markus Kuhn, 2005
     // https://www.cl.cam.ac.uk/~mgk25/ucs/utf8_check.c
     // Optimized for predominantly 7-bit content, 2016
@@ -264,8 +302,15 @@ public:
         return 0;
     }
 
-    static inline size_t formatMessage(char *dst, const char *src, size_t length, OpCode opCode, size_t reportedLength, bool compressed) {
-        size_t messageLength;
+    // the length of the frame header of a message of reportedLength bytes
+    static inline size_t headerLength(size_t reportedLength) {
+        return (reportedLength < 126 ? 2 : reportedLength <= UINT16_MAX ? 4 : 10) + (isServer ? 0 : 4);
+    }
+
+    // writes the frame header of a message of reportedLength bytes to dst and
+    // returns its length; a client's header ends in the mask, also copied to
+    // mask
+    static inline size_t formatHeader(char *dst, size_t reportedLength, OpCode opCode, bool compressed, char *mask) {
         size_t headerLength;
         if (reportedLength < 126) {
             headerLength = 2;
@@ -286,32 +331,77 @@ public:
             dst[0] |= opCode;
         }
 
-        char mask[4];
         if (!isServer) {
             dst[1] |= 0x80;
-            uint32_t random = rand();
+            uint32_t random = maskKey();
             memcpy(mask, &random, 4);
             memcpy(dst + headerLength, &random, 4);
             headerLength += 4;
         }
+        return headerLength;
+    }
 
-        messageLength = headerLength + length;
-        memcpy(dst + headerLength, src, length);
+    // a client's mask key for the next frame, from a xorshift64* generator
+    // per thread seeded once from the system's entropy: no syscall or lock
+    // per frame, and as unpredictable to the page's script as the RFC needs,
+    // since the script never sees the seed
+    static inline uint32_t maskKey() {
+        static thread_local uint64_t state = 0;
+        if (!state) {
+            std::random_device device;
+            state = ((uint64_t) device() << 32 | device()) | 1;
+        }
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (uint32_t) ((state * 0x2545F4914F6CDD1DULL) >> 32);
+    }
 
-        if (!isServer) {
+    // copies length bytes from src to dst XORed with the mask repeated, in
+    // blocks while they last, and neither reads nor writes past either end;
+    // dst may be src itself
+    static inline void maskCopy(char *dst, const char *src, size_t length, const char *mask) {
+        uint32_t mask32;
+        memcpy(&mask32, mask, 4);
+#if defined(__SSE2__)
+        __m128i mask128 = _mm_set1_epi32((int) mask32);
+        for (; length >= 16; length -= 16, src += 16, dst += 16) {
+            _mm_storeu_si128((__m128i *) dst, _mm_xor_si128(_mm_loadu_si128((const __m128i *) src), mask128));
+        }
+#elif defined(__ARM_NEON)
+        uint32x4_t mask128 = vdupq_n_u32(mask32);
+        for (; length >= 16; length -= 16, src += 16, dst += 16) {
+            vst1q_u32((uint32_t *) dst, veorq_u32(vld1q_u32((const uint32_t *) src), mask128));
+        }
+#endif
+        uint64_t mask64 = ((uint64_t) mask32 << 32) | mask32;
+        for (; length >= 8; length -= 8, src += 8, dst += 8) {
+            uint64_t word;
+            memcpy(&word, src, 8);
+            word ^= mask64;
+            memcpy(dst, &word, 8);
+        }
+        // the blocks took whole mask periods, so the tail starts on mask[0]
+        for (size_t i = 0; i < length; i++) {
+            dst[i] = src[i] ^ mask[i % 4];
+        }
+    }
 
-            // overwrites up to 3 bytes outside of the given buffer!
-            //WebSocketProtocol<isServer>::unmaskInplace(dst + headerLength, dst + headerLength + length, mask);
+    // masks a client's payload in place
+    static inline void maskPayload(char *start, size_t length, const char *mask) {
+        maskCopy(start, start, length, mask);
+    }
 
-            // this is not optimal
-            char *start = dst + headerLength;
-            char *stop = start + length;
-            int i = 0;
-            while (start != stop) {
-                (*start++) ^= mask[i++ % 4];
-            }
+    // a client's payload is masked as it is copied in, in one pass
+    static inline size_t formatMessage(char *dst, const char *src, size_t length, OpCode opCode, size_t reportedLength, bool compressed) {
+        char mask[4];
+        size_t headerLength = formatHeader(dst, reportedLength, opCode, compressed, mask);
+        if (isServer) {
+            memcpy(dst + headerLength, src, length);
+        } else {
+            maskCopy(dst + headerLength, src, length, mask);
         }
-        return messageLength;
+        return headerLength + length;
     }
 
     void consume(char *src, unsigned int length, void *user) {
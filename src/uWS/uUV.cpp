@@ -29,37 +29,390 @@ bool uv_is_closing(uv_timer_t *handle) {
 #else
 
 #include <sys/eventfd.h>
+#include <atomic>
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstring>
+#endif
 
 //namespace uUV {
 
 uv_loop_t *loops[128];
-int loopHead = 0;
+std::atomic<int> loopHead(0);
 
 #define CALLBACK_ARR_SIZE 128
 uv_async_cb async_callbacks[CALLBACK_ARR_SIZE];
-int asyncCbHead = 0;
+std::atomic<int> asyncCbHead(0);
 uv_idle_cb idle_callbacks[CALLBACK_ARR_SIZE];
-int idleCbHead = 0;
+std::atomic<int> idleCbHead(0);
 uv_poll_cb poll_callbacks[CALLBACK_ARR_SIZE];
-int pollCbHead = 0;
+std::atomic<int> pollCbHead(0);
 uv_timer_cb timer_callbacks[CALLBACK_ARR_SIZE];
-int timerCbHead = 0;
+std::atomic<int> timerCbHead(0);
+
+// the callback tables are shared by the loops of all threads: lookups are
+// lock free, new callbacks are appended under a lock and published by the head
+std::mutex callbackMutex;
+
+template <class Callback>
+int callbackIndex(Callback *callbacks, std::atomic<int> &head, Callback cb) {
+    int n = head.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        if (callbacks[i] == cb) {
+            return i;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(callbackMutex);
+    n = head.load(std::memory_order_relaxed);
+    for (int i = 0; i < n; i++) {
+        if (callbacks[i] == cb) {
+            return i;
+        }
+    }
+    callbacks[n] = cb;
+    head.store(n + 1, std::memory_order_release);
+    return n;
+}
 
 uv_loop_t *uv_handle_t::get_loop() const {
     return loops[loopIndex];
 }
 
+static uint64_t uv_metrics_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void uv_metrics_add(std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static void uv_metrics_wait(uv_loop_t *loop) {
+    loop->waitStart.store(uv_metrics_now(), std::memory_order_relaxed);
+}
+
+// ends the wait with events ready; a reader meanwhile may miss the wait, but
+// never counts it twice
+static void uv_metrics_ready(uv_loop_t *loop, int events) {
+    uint64_t waited = uv_metrics_now() - loop->waitStart.load(std::memory_order_relaxed);
+    loop->waitStart.store(0, std::memory_order_relaxed);
+    uv_metrics_add(loop->idleTime, waited);
+    uv_metrics_add(loop->eventCount, events);
+}
+
+// takes one wakeup off the semaphore eventfd; false if there was none left,
+// as when another wakeup of the same sends already took it
+static bool uv_take_wakeup(uv_loop_t *loop) {
+    std::lock_guard<std::mutex> lock(loop->async_mutex);
+    uint64_t val;
+    return read(loop->asyncWakeupFd, &val, sizeof(val)) == sizeof(val);
+}
+
+#ifdef USE_IO_URING
+// the submission and completion queues a loop shares with its io_uring;
+// without SQPOLL the kernel only reads them in io_uring_enter, which the
+// loop's own thread alone calls
+struct uv_ring {
+    int fd;
+    unsigned sqEntries;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    // queued since the last io_uring_enter
+    unsigned unsubmitted;
+    // completions moved off a full queue to make room, handled first
+    std::vector<io_uring_cqe> backlog;
+    // closed polls waiting for their requests to complete
+    std::vector<std::pair<uv_poll_t *, uv_close_cb>> closingPolls;
+};
+
+// the user_data of the requests that are not a poll's; the generation of a
+// poll's request takes the top byte, which user space addresses leave free
+static const uint64_t UV_RING_WAKEUP = 1;
+static const uint64_t UV_RING_REMOVAL = 2;
+static const int UV_RING_GEN_SHIFT = 56;
+
+static uint64_t uv_ring_tag(uv_poll_t *poll) {
+    return (uint64_t) (uintptr_t) poll | ((uint64_t) poll->armGen << UV_RING_GEN_SHIFT);
+}
+
+static void uv_ring_delete(uv_ring *ring) {
+    if (ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->cqRing != MAP_FAILED) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing != MAP_FAILED) {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    close(ring->fd);
+    delete ring;
+}
+
+// nullptr where io_uring is missing, not allowed or too old to wait with a
+// timeout, and the loop stays with epoll
+static uv_ring *uv_ring_new(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    uv_ring *ring = new uv_ring;
+    ring->fd = fd;
+    ring->sqEntries = params.sq_entries;
+    ring->unsubmitted = 0;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqRing = mmap(nullptr, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cqRing = mmap(nullptr, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring->sqes = (io_uring_sqe *) mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (!(params.features & IORING_FEAT_EXT_ARG) || ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uv_ring_delete(ring);
+        return nullptr;
+    }
+
+    char *sq = (char *) ring->sqRing;
+    ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+    char *cq = (char *) ring->cqRing;
+    ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+    return ring;
+}
+
+// submits what is queued and, for a minComplete, waits up to timeout
+// milliseconds, or without a limit for -1, until that many have completed
+static void uv_ring_enter(uv_ring *ring, unsigned minComplete, int timeout) {
+    if (!ring->unsubmitted && !minComplete) {
+        return;
+    }
+
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000LL;
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+    }
+    unsigned flags = IORING_ENTER_EXT_ARG | (minComplete ? IORING_ENTER_GETEVENTS : 0);
+    int submitted = (int) syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, minComplete, flags, &arg, sizeof(arg));
+    if (submitted > 0) {
+        ring->unsubmitted -= submitted;
+    }
+}
+
+static bool uv_ring_ready(uv_ring *ring) {
+    return !ring->backlog.empty() || *ring->cqHead != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+}
+
+static bool uv_ring_pop(uv_ring *ring, io_uring_cqe *cqe) {
+    unsigned head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *cqe = ring->cqes[head & *ring->cqMask];
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// the next submission entry, cleared, to be queued by uv_ring_push; a full
+// queue is handed to the kernel early, and should it take nothing, as its
+// completions have nowhere to go, those are set aside to make room
+static io_uring_sqe *uv_ring_sqe(uv_ring *ring) {
+    unsigned tail = *ring->sqTail;
+    while (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->sqEntries) {
+        uv_ring_enter(ring, 0, 0);
+        if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->sqEntries) {
+            io_uring_cqe cqe;
+            while (uv_ring_pop(ring, &cqe)) {
+                ring->backlog.push_back(cqe);
+            }
+        }
+    }
+    io_uring_sqe *sqe = &ring->sqes[tail & *ring->sqMask];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    return sqe;
+}
+
+static void uv_ring_push(uv_ring *ring, io_uring_sqe *sqe) {
+    unsigned tail = *ring->sqTail;
+    ring->sqArray[tail & *ring->sqMask] = (unsigned) (sqe - ring->sqes);
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->unsubmitted++;
+}
+
+// a one-shot poll, which completes at once if the fd is ready already: re-armed
+// as it completes, it reports readiness the way level-triggered epoll does
+static void uv_ring_poll_add(uv_ring *ring, int fd, int events, uint64_t userData) {
+    io_uring_sqe *sqe = uv_ring_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | ((unsigned) events >> 16);
+#endif
+    sqe->poll32_events = events;
+    sqe->user_data = userData;
+    uv_ring_push(ring, sqe);
+}
+
+static void uv_ring_arm(uv_ring *ring, uv_poll_t *poll) {
+    // only one loop is polling, so there is no one to wake exclusively
+    int events = poll->event.events & ~UV_EXCLUSIVE;
+    uv_ring_poll_add(ring, poll->fd, events, uv_ring_tag(poll));
+    poll->armedEvents = events;
+    poll->inflight++;
+}
+
+// drops the poll's request; it completes cancelled, as one of a generation
+// since passed
+static void uv_ring_disarm(uv_ring *ring, uv_poll_t *poll) {
+    if (!poll->armedEvents) {
+        return;
+    }
+    io_uring_sqe *sqe = uv_ring_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = uv_ring_tag(poll);
+    sqe->user_data = UV_RING_REMOVAL;
+    uv_ring_push(ring, sqe);
+    poll->armGen++;
+    poll->armedEvents = 0;
+}
+
+static void uv_ring_complete(uv_loop_t *loop, uint64_t userData, int res) {
+    uv_ring *ring = loop->ring;
+    if (userData == UV_RING_REMOVAL) {
+        return;
+    }
+    if (userData == UV_RING_WAKEUP) {
+        uv_take_wakeup(loop);
+        uv_ring_poll_add(ring, loop->asyncWakeupFd, EPOLLIN, UV_RING_WAKEUP);
+        return;
+    }
+
+    uv_poll_t *poll = (uv_poll_t *) (uintptr_t) (userData & (((uint64_t) 1 << UV_RING_GEN_SHIFT) - 1));
+    poll->inflight--;
+    if (poll->fd == -1) {
+        // the kernel is done with it once its last request is
+        if (!poll->inflight) {
+            for (size_t i = 0; i < ring->closingPolls.size(); i++) {
+                if (ring->closingPolls[i].first == poll) {
+                    loop->closing.push_back({(uv_handle_t *) poll, ring->closingPolls[i].second});
+                    ring->closingPolls.erase(ring->closingPolls.begin() + i);
+                    break;
+                }
+            }
+        }
+        return;
+    }
+    if ((unsigned char) (userData >> UV_RING_GEN_SHIFT) != poll->armGen) {
+        return;
+    }
+
+    // what the interest is now: it may have narrowed since the poll was armed
+    poll->armedEvents = 0;
+    int events = res < 0 ? EPOLLERR : res & (poll->event.events | EPOLLERR | EPOLLHUP);
+    if (events) {
+        poll_callbacks[poll->cbIndex](poll, -bool(events & EPOLLERR), events);
+    }
+    if (poll->fd != -1 && !poll->armedEvents && (poll->event.events & ~UV_EXCLUSIVE)) {
+        uv_ring_arm(ring, poll);
+    }
+}
+
+// the io_uring counterpart of uv_epoll_run: the polls armed since the last
+// iteration are submitted along with the wait
+static void uv_ring_run(uv_loop_t *loop, int delay) {
+    uv_ring *ring = loop->ring;
+    uv_metrics_wait(loop);
+    if (uv_ring_ready(ring) || !delay) {
+        uv_ring_enter(ring, 0, 0);
+    } else if (loop->spinMicros) {
+        // nothing ready: keep looking for a while, which costs no system
+        // calls here, then sleep out the rest
+        uv_ring_enter(ring, 0, 0);
+        std::chrono::steady_clock::time_point spinStart = std::chrono::steady_clock::now();
+        std::chrono::microseconds spun(0), spin(loop->spinMicros);
+        if (delay > 0) {
+            spin = std::min<std::chrono::microseconds>(spin, std::chrono::milliseconds(delay));
+        }
+        while (!uv_ring_ready(ring) && spun < spin) {
+            spun = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - spinStart);
+        }
+        if (!uv_ring_ready(ring)) {
+            int rest = delay < 0 ? -1 : std::max<int>(delay - std::chrono::duration_cast<std::chrono::milliseconds>(spun).count(), 0);
+            uv_ring_enter(ring, 1, rest);
+        }
+    } else {
+        uv_ring_enter(ring, 1, delay);
+    }
+
+    std::vector<io_uring_cqe> backlog;
+    backlog.swap(ring->backlog);
+    uv_metrics_ready(loop, (int) backlog.size());
+    for (io_uring_cqe &cqe : backlog) {
+        uv_ring_complete(loop, cqe.user_data, cqe.res);
+    }
+    int maxEvents = (int) loop->readyEvents.size();
+    io_uring_cqe cqe;
+    int events = 0;
+    for (; events < maxEvents && uv_ring_pop(ring, &cqe); events++) {
+        uv_ring_complete(loop, cqe.user_data, cqe.res);
+    }
+    uv_metrics_add(loop->eventCount, events);
+}
+#endif
+
 inline uv_loop_t *uv_loop_helper() {
     uv_loop_t *loop = new uv_loop_t;
     loop->efd = epoll_create(1);
     loop->index = loopHead++;
     loop->numEvents = 0;
 
+    loop->readyEvents.resize(1024);
+    loop->spinMicros = 0;
+    loop->loopCount.store(0);
+    loop->eventCount.store(0);
+    loop->idleTime.store(0);
+    loop->waitStart.store(0);
+
+    loop->timepoint = std::chrono::steady_clock::now();
+    loop->timerTick = 0;
+    loop->numTimers = 0;
+    for (int level = 0; level < UV_TIMER_LEVELS; level++) {
+        for (int slot = 0; slot < UV_TIMER_SLOTS; slot++) {
+            uv_timer_link *list = &loop->timerWheel[level][slot];
+            list->prev = list->next = list;
+        }
+    }
+
     loop->asyncWakeupFd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
-    struct epoll_event wakeupEvents;
-    wakeupEvents.events = EPOLLHUP | EPOLLERR | EPOLLIN | EPOLLET;
-    wakeupEvents.data.ptr = nullptr;
-    epoll_ctl(loop->efd, EPOLL_CTL_ADD, loop->asyncWakeupFd, &wakeupEvents);
+#ifdef USE_IO_URING
+    loop->ring = uv_ring_new(4096);
+    if (loop->ring) {
+        uv_ring_poll_add(loop->ring, loop->asyncWakeupFd, EPOLLIN, UV_RING_WAKEUP);
+    } else
+#endif
+    {
+        struct epoll_event wakeupEvents;
+        wakeupEvents.events = EPOLLHUP | EPOLLERR | EPOLLIN | EPOLLET;
+        wakeupEvents.data.ptr = nullptr;
+        epoll_ctl(loop->efd, EPOLL_CTL_ADD, loop->asyncWakeupFd, &wakeupEvents);
+    }
 
     loops[loop->index] = loop;
     return loop;
@@ -83,26 +436,46 @@ uv_loop_t *uv_loop_new() {
 }
 
 void uv_loop_delete(uv_loop_t *loop) {
+#ifdef USE_IO_URING
+    if (loop->ring) {
+        uv_ring_delete(loop->ring);
+    }
+#endif
     epoll_ctl(loop->efd, EPOLL_CTL_DEL, loop->asyncWakeupFd, nullptr);
     close(loop->efd);
     loops[loop->index] = nullptr;
     delete loop;
 }
 
+void uv_loop_set_max_events(uv_loop_t *loop, int maxEvents) {
+    loop->readyEvents.resize(std::max(maxEvents, 1));
+}
+
+void uv_loop_set_spin(uv_loop_t *loop, int spinMicros) {
+    loop->spinMicros = std::max(spinMicros, 0);
+}
+
+int uv_metrics_info(uv_loop_t *loop, uv_metrics_t *metrics) {
+    metrics->loop_count = loop->loopCount.load(std::memory_order_relaxed);
+    metrics->events = loop->eventCount.load(std::memory_order_relaxed);
+    return 0;
+}
+
+uint64_t uv_metrics_idle_time(uv_loop_t *loop) {
+    uint64_t waitStart = loop->waitStart.load(std::memory_order_relaxed);
+    uint64_t idleTime = loop->idleTime.load(std::memory_order_relaxed);
+    if (waitStart) {
+        uint64_t now = uv_metrics_now();
+        idleTime += now > waitStart ? now - waitStart : 0;
+    }
+    return idleTime;
+}
+
 void uv_async_init(uv_loop_t *loop, uv_async_t *async, uv_async_cb cb) {
     async->loopIndex = loop->index;
     loop->numEvents++;
 
-    async->cbIndex = asyncCbHead;
-    for (int i = 0; i < asyncCbHead; i++) {
-        if (async_callbacks[i] == cb) {
-            async->cbIndex = i;
-            break;
-        }
-    }
-    if (async->cbIndex == asyncCbHead) {
-        async_callbacks[asyncCbHead++] = cb;
-    }
+    async->cbIndex = callbackIndex(async_callbacks, asyncCbHead, cb);
 
     loop->asyncs.insert(async);
 }
@@ -135,16 +508,7 @@ void uv_idle_init(uv_loop_t *loop, uv_idle_t *idle) {
 }
 
 void uv_idle_start(uv_idle_t *idle, uv_idle_cb cb) {
-    idle->cbIndex = idleCbHead;
-    for (int i = 0; i < idleCbHead; i++) {
-        if (idle_callbacks[i] == cb) {
-            idle->cbIndex = i;
-            break;
-        }
-    }
-    if (idle->cbIndex == idleCbHead) {
-        idle_callbacks[idleCbHead++] = cb;
-    }
+    idle->cbIndex = callbackIndex(idle_callbacks, idleCbHead, cb);
 
     idle->get_loop()->idlers.insert(idle);
 }
@@ -172,9 +536,8 @@ int uv_poll_init_socket(uv_loop_t *loop, uv_poll_t *poll, uv_os_sock_t socket) {
     if (flags == -1) {
         return -1;
     }
-    flags |= O_NONBLOCK;
-    flags = fcntl (socket, F_SETFL, flags);
-    if (flags == -1) {
+    // accepted with accept4, a socket is non-blocking already
+    if (!(flags & O_NONBLOCK) && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == -1) {
         return -1;
     }
 
@@ -183,25 +546,44 @@ int uv_poll_init_socket(uv_loop_t *loop, uv_poll_t *poll, uv_os_sock_t socket) {
     poll->event.events = 0;
     poll->event.data.ptr = poll;
     loop->numEvents++;
+#ifdef USE_IO_URING
+    poll->armGen = poll->inflight = 0;
+    poll->armedEvents = 0;
+    if (loop->ring) {
+        return 0;
+    }
+#endif
     return epoll_ctl(loop->efd, EPOLL_CTL_ADD, socket, &poll->event);
 }
 
 int uv_poll_start(uv_poll_t *poll, int events, uv_poll_cb cb) {
     poll->event.events = events;
-    poll->cbIndex = pollCbHead;
-    for (int i = 0; i < pollCbHead; i++) {
-        if (poll_callbacks[i] == cb) {
-            poll->cbIndex = i;
-            break;
+    poll->cbIndex = callbackIndex(poll_callbacks, pollCbHead, cb);
+#ifdef USE_IO_URING
+    if (uv_ring *ring = poll->get_loop()->ring) {
+        // a narrower interest is applied as the request completes
+        if (events & ~UV_EXCLUSIVE & ~poll->armedEvents) {
+            uv_ring_disarm(ring, poll);
+            uv_ring_arm(ring, poll);
         }
+        return 0;
     }
-    if (poll->cbIndex == pollCbHead) {
-        poll_callbacks[pollCbHead++] = cb;
+#endif
+    if (events & UV_EXCLUSIVE) {
+        // exclusive wakeups can only be asked for as the fd is added
+        epoll_ctl(poll->get_loop()->efd, EPOLL_CTL_DEL, poll->fd, &poll->event);
+        return epoll_ctl(poll->get_loop()->efd, EPOLL_CTL_ADD, poll->fd, &poll->event);
     }
     return epoll_ctl(poll->get_loop()->efd, EPOLL_CTL_MOD, poll->fd, &poll->event);
 }
 
 int uv_poll_stop(uv_poll_t *poll) {
+#ifdef USE_IO_URING
+    if (uv_ring *ring = poll->get_loop()->ring) {
+        uv_ring_disarm(ring, poll);
+        return 0;
+    }
+#endif
     return epoll_ctl(poll->get_loop()->efd, EPOLL_CTL_DEL, poll->fd, &poll->event);
 }
 
@@ -211,6 +593,16 @@ void uv_close(uv_poll_t *handle, uv_close_cb cb) {
     uv_poll_t *poll = (uv_poll_t *) handle;
     poll->fd = -1;
 
+#ifdef USE_IO_URING
+    if (loop->ring) {
+        // its requests may still complete; the handle must outlive them
+        uv_ring_disarm(loop->ring, poll);
+        if (poll->inflight) {
+            loop->ring->closingPolls.push_back({poll, cb});
+            return;
+        }
+    }
+#endif
     loop->closing.push_back({(uv_handle_t *) handle, cb});
 }
 
@@ -225,54 +617,147 @@ int uv_fileno(uv_poll_t *handle) {
 void uv_timer_init(uv_loop_t *loop, uv_timer_t *timer) {
     timer->loopIndex = loop->index;
     loop->numEvents++;
-    loop->timepoint = std::chrono::system_clock::now();
 }
 
-void uv_timer_enqueue(uv_timer_t *timer, int timeout) {
-    timer->timepoint = timer->get_loop()->timepoint + std::chrono::milliseconds(timeout);
-    // sort timers from farthest to soonest so we can pop from back in O(1)
-    uv_loop_t *loop = timer->get_loop();
-    if (loop->timers.size() && timeout) {
-        loop->timers.insert(
-            std::upper_bound(loop->timers.begin(), loop->timers.end(), timer, [](uv_timer_t* a, uv_timer_t* b) {
-                return a->timepoint > b->timepoint;
-            }),
-            timer   
-        );
+// the loop's time in ticks, which the wheel may not have caught up with yet
+static uint64_t uv_timer_now(uv_loop_t *loop) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - loop->timepoint).count();
+}
+
+static void uv_timer_link_push(uv_timer_link *list, uv_timer_link *link) {
+    link->prev = list->prev;
+    link->next = list;
+    list->prev->next = link;
+    list->prev = link;
+}
+
+static void uv_timer_link_remove(uv_timer_link *link) {
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->prev = link->next = nullptr;
+}
+
+// moves all timers of a slot to list, which takes over its place
+static void uv_timer_link_take(uv_timer_link *slot, uv_timer_link *list) {
+    if (slot->next == slot) {
+        list->prev = list->next = list;
+        return;
+    }
+    list->next = slot->next;
+    list->prev = slot->prev;
+    list->next->prev = list->prev->next = list;
+    slot->prev = slot->next = slot;
+}
+
+// links the timer into the slot of the lowest level whose span from the
+// current tick reaches its expiry; an overdue timer goes to the current tick
+static void uv_timer_enqueue(uv_loop_t *loop, uv_timer_t *timer) {
+    static const uint64_t REACH = (uint64_t) 1 << (UV_TIMER_LEVELS * UV_TIMER_SLOT_BITS);
+    uint64_t delta = timer->expiry > loop->timerTick ? std::min(timer->expiry - loop->timerTick, REACH - 1) : 0;
+    int level = 0;
+    while (delta >> ((level + 1) * UV_TIMER_SLOT_BITS)) {
+        level++;
+    }
+    uint64_t slot = ((loop->timerTick + delta) >> (level * UV_TIMER_SLOT_BITS)) & (UV_TIMER_SLOTS - 1);
+    uv_timer_link_push(&loop->timerWheel[level][slot], timer);
+}
+
+// runs the timers of the current tick; those started meanwhile, even for
+// this tick, wait for the next advance
+static void uv_timer_expire(uv_loop_t *loop, uint64_t now) {
+    uv_timer_link expired;
+    uv_timer_link_take(&loop->timerWheel[0][loop->timerTick & (UV_TIMER_SLOTS - 1)], &expired);
+    while (expired.next != &expired) {
+        uv_timer_t *timer = static_cast<uv_timer_t *>(expired.next);
+        uv_timer_link_remove(timer);
+        if (timer->repeat) {
+            timer->expiry = now + timer->repeat;
+            uv_timer_enqueue(loop, timer);
+        } else {
+            timer->flags &= ~UV_HANDLE_RUNNING;
+            loop->numTimers--;
+        }
+        timer_callbacks[timer->cbIndex](timer);
     }
-    else
-        loop->timers.push_back(timer);
 }
-void uv_timer_start(uv_timer_t *timer, uv_timer_cb cb, int timeout, int repeat) {
-    timer->cbIndex = timerCbHead;
-    for (int i = 0; i < timerCbHead; i++) {
-        if (timer_callbacks[i] == cb) {
-            timer->cbIndex = i;
-            break;
+
+// steps the wheel up to now; where a level comes round, the next slot of
+// the level above is spread over it, the topmost first
+static void uv_timer_advance(uv_loop_t *loop, uint64_t now) {
+    if (!loop->numTimers) {
+        loop->timerTick = std::max(loop->timerTick, now);
+        return;
+    }
+
+    uv_timer_expire(loop, now);
+    while (loop->timerTick < now) {
+        uint64_t tick = ++loop->timerTick;
+        int level = 0;
+        while (level + 1 < UV_TIMER_LEVELS && !(tick & (((uint64_t) 1 << ((level + 1) * UV_TIMER_SLOT_BITS)) - 1))) {
+            level++;
+        }
+        for (; level > 0; level--) {
+            uv_timer_link cascaded;
+            uv_timer_link_take(&loop->timerWheel[level][(tick >> (level * UV_TIMER_SLOT_BITS)) & (UV_TIMER_SLOTS - 1)], &cascaded);
+            while (cascaded.next != &cascaded) {
+                uv_timer_t *timer = static_cast<uv_timer_t *>(cascaded.next);
+                uv_timer_link_remove(timer);
+                uv_timer_enqueue(loop, timer);
+            }
+        }
+        uv_timer_expire(loop, now);
+    }
+}
+
+// milliseconds until the wheel has to advance next: when something is due
+// within level 0 its exact expiry, else when the first slot above that
+// holds a timer gets spread out; -1 without timers
+static int uv_timer_delay(uv_loop_t *loop, uint64_t now) {
+    if (!loop->numTimers) {
+        return -1;
+    }
+
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < UV_TIMER_LEVELS; level++) {
+        // the current slot of a level above was spread out as it came round,
+        // so what it holds now is a lap away
+        uint64_t position = loop->timerTick >> (level * UV_TIMER_SLOT_BITS);
+        for (uint64_t k = level ? 1 : 0; k < (uint64_t) UV_TIMER_SLOTS + (level ? 1 : 0); k++) {
+            uv_timer_link *slot = &loop->timerWheel[level][(position + k) & (UV_TIMER_SLOTS - 1)];
+            if (slot->next != slot) {
+                next = std::min(next, (position + k) << (level * UV_TIMER_SLOT_BITS));
+                break;
+            }
         }
     }
-    if (timer->cbIndex == timerCbHead) {
-        timer_callbacks[timerCbHead++] = cb;
+    return next <= now ? 0 : (int) std::min<uint64_t>(next - now, INT32_MAX);
+}
+
+void uv_timer_start(uv_timer_t *timer, uv_timer_cb cb, int timeout, int repeat) {
+    uv_loop_t *loop = timer->get_loop();
+    if (timer->flags & UV_HANDLE_RUNNING) {
+        uv_timer_stop(timer);
     }
+    timer->cbIndex = callbackIndex(timer_callbacks, timerCbHead, cb);
 
     timer->repeat = repeat;
-    timer->flags = UV_HANDLE_RUNNING;
-    uv_timer_enqueue(timer, timeout);
+    timer->flags |= UV_HANDLE_RUNNING;
+    timer->expiry = uv_timer_now(loop) + timeout;
+    loop->numTimers++;
+    uv_timer_enqueue(loop, timer);
 }
 
 void uv_timer_stop(uv_timer_t *timer) {
-    timer->flags &= ~UV_HANDLE_RUNNING;
-    uv_loop_t *loop = timer->get_loop();
-    for (int i = 0; i < loop->timers.size(); ++i)
-        if (loop->timers[i] == timer)
-        {
-            loop->timers.erase(loop->timers.begin() + i);
-            break;
-        }
+    if (timer->flags & UV_HANDLE_RUNNING) {
+        timer->flags &= ~UV_HANDLE_RUNNING;
+        timer->get_loop()->numTimers--;
+        uv_timer_link_remove(timer);
+    }
 }
 
 void uv_close(uv_timer_t *handle, uv_close_cb cb) {
     uv_loop_t *loop = handle->get_loop();
+    uv_timer_stop(handle);
     handle->flags |= UV_HANDLE_CLOSING;
     loop->closing.push_back({(uv_handle_t *) handle, cb});
 }
@@ -281,12 +766,49 @@ bool uv_is_closing(uv_timer_t *handle) {
     return handle->flags & (UV_HANDLE_CLOSING | UV_HANDLE_CLOSED);
 }
 
+// waits up to delay milliseconds, or without a limit for -1, and handles
+// the polls that got ready
+static void uv_epoll_run(uv_loop_t *loop, int delay) {
+    epoll_event *readyEvents = loop->readyEvents.data();
+    int maxEvents = (int) loop->readyEvents.size();
+    uv_metrics_wait(loop);
+    int numFdReady = epoll_wait(loop->efd, readyEvents, maxEvents, loop->spinMicros ? 0 : delay);
+    if (numFdReady == 0 && loop->spinMicros && delay) {
+        // nothing ready: keep looking for a while, then sleep out the rest
+        std::chrono::steady_clock::time_point spinStart = std::chrono::steady_clock::now();
+        std::chrono::microseconds spun(0), spin(loop->spinMicros);
+        if (delay > 0) {
+            spin = std::min<std::chrono::microseconds>(spin, std::chrono::milliseconds(delay));
+        }
+        while (numFdReady == 0 && spun < spin) {
+            numFdReady = epoll_wait(loop->efd, readyEvents, maxEvents, 0);
+            spun = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - spinStart);
+        }
+        if (numFdReady == 0) {
+            int rest = delay < 0 ? -1 : std::max<int>(delay - std::chrono::duration_cast<std::chrono::milliseconds>(spun).count(), 0);
+            numFdReady = epoll_wait(loop->efd, readyEvents, maxEvents, rest);
+        }
+    }
+    uv_metrics_ready(loop, std::max(numFdReady, 0));
+
+    // Handle polling events
+    for (int i = 0; i < numFdReady; i++) {
+        uv_poll_t *poll = (uv_poll_t *) readyEvents[i].data.ptr;
+        if (poll) {
+            int status = -bool(readyEvents[i].events & EPOLLERR);
+            poll_callbacks[poll->cbIndex](poll, status, readyEvents[i].events);
+        } else { // async wakeup event has nullptr
+            uv_take_wakeup(loop);
+        }
+    }
+}
+
 void uv_run(uv_loop_t *loop, int mode) {
-    loop->timepoint = std::chrono::system_clock::now();
     signal(SIGPIPE, SIG_IGN);
     int iter = 0;
     while (loop->numEvents) {
         ++iter;
+        uv_metrics_add(loop->loopCount, 1);
         // Close any events that are ready to close
         if (loop->closing.size()) {
             // Make a copy so that its ok to call uv_close in the callbacks
@@ -299,32 +821,25 @@ void uv_run(uv_loop_t *loop, int mode) {
                 c.first->flags |= UV_HANDLE_CLOSED;
                 c.second(c.first);
             }
+            // nothing left to wait for
+            if (!loop->numEvents) {
+                break;
+            }
         }
 
         // Wait for events to be ready
-        loop->timepoint = std::chrono::system_clock::now();
         int delay = -1;
         if (loop->idlers.size()) {
             delay = 0;
-        } else if (loop->timers.size()) {
-            delay = std::max<int>(std::chrono::duration_cast<std::chrono::milliseconds>(loop->timers.back()->timepoint - loop->timepoint).count(), 0);
-        }
-        epoll_event readyEvents[1024];
-        int numFdReady = epoll_wait(loop->efd, readyEvents, 1024, delay);
-
-        // Handle polling events
-        for (int i = 0; i < numFdReady; i++) {
-            uv_poll_t *poll = (uv_poll_t *) readyEvents[i].data.ptr;
-            if (poll) {
-                int status = -bool(readyEvents[i].events & EPOLLERR);
-                poll_callbacks[poll->cbIndex](poll, status, readyEvents[i].events);
-            } else { // async wakeup event has nullptr
-                loop->async_mutex.lock();
-                uint64_t val;
-                int r = read(loop->asyncWakeupFd, &val, sizeof(val));
-                loop->async_mutex.unlock();
-            }
+        } else if (loop->numTimers) {
+            delay = uv_timer_delay(loop, uv_timer_now(loop));
         }
+#ifdef USE_IO_URING
+        if (loop->ring) {
+            uv_ring_run(loop, delay);
+        } else
+#endif
+        uv_epoll_run(loop, delay);
 
         // Handle async events
         if (loop->asyncs.size()) {
@@ -350,24 +865,7 @@ void uv_run(uv_loop_t *loop, int mode) {
         }
 
         // Handle timer events
-        if (loop->timers.size()) {
-            loop->timepoint = std::chrono::system_clock::now();
-            // Copy ready timers to separate vector so callbacks can safely modify the original
-            std::vector<uv_timer_t *> readyTimers;
-            while (loop->timers.size() && std::chrono::duration_cast<std::chrono::milliseconds>(loop->timers.back()->timepoint - loop->timepoint).count() <= 0) {
-                readyTimers.push_back(loop->timers.back());
-                loop->timers.pop_back();
-            }
-            for (uv_timer_t* timer : readyTimers) {
-                if (timer->flags & UV_HANDLE_RUNNING) {
-                    timer_callbacks[timer->cbIndex](timer);
-                    // Have to check for running again in case timer was stopped in callback
-                    if (timer->repeat && timer->flags & UV_HANDLE_RUNNING) {
-                        uv_timer_enqueue(timer, timer->repeat);
-                    }
-                }
-            }
-        }
+        uv_timer_advance(loop, uv_timer_now(loop));
     }
 }
 
@@ -29,7 +29,9 @@ bool uv_is_closing(uv_timer_t *handle);
 #define UV_VERSION_MINOR 3
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <vector>
 #include <unordered_set>
 
@@ -37,6 +39,9 @@ bool uv_is_closing(uv_timer_t *handle);
 
 struct uv_handle_t;
 struct uv_loop_t;
+#ifdef USE_IO_URING
+struct uv_ring;
+#endif
 
 struct uv_async_t;
 struct uv_idle_t;
@@ -54,6 +59,13 @@ const unsigned char UV_HANDLE_RUNNING = 0x01 << 2;
 
 const int UV_WRITABLE = EPOLLOUT;
 const int UV_READABLE = EPOLLIN | EPOLLHUP;
+// with UV_READABLE, for a listening socket polled by several loops: only one
+// of them is woken per connection (Linux 4.5)
+#ifdef EPOLLEXCLUSIVE
+const int UV_EXCLUSIVE = EPOLLEXCLUSIVE;
+#else
+const int UV_EXCLUSIVE = 0;
+#endif
 const int UV_DISCONNECT = 4; // Not sure which epoll events correspond to disconnect. This value is taken from libuv source code instead.
 const int UV_RUN_DEFAULT = 0;
 typedef int uv_os_sock_t;
@@ -69,10 +81,11 @@ typedef void (*uv_timer_cb)(uv_timer_t *handle);
  *
  * Member size reference:
  * std::mutex .................................... 40 bytes
- * std::chrono::system_clock::time_point ......... 8 bytes
+ * std::chrono::steady_clock::time_point ......... 8 bytes
  * std::vector ................................... 24 bytes
  * std::unordered_set ............................ 56 bytes
  * epoll_event ................................... 12 bytes
+ * uv_timer_link ................................. 16 bytes
  */
 
 // 16 bytes
@@ -84,23 +97,69 @@ struct uv_handle_t {
     uv_loop_t *get_loop() const;
 };
 
-// 224 bytes
+// a running timer is linked into one slot of its loop's timer wheel; every
+// slot is a circular list around a link of its own
+struct uv_timer_link {
+    uv_timer_link *prev = nullptr, *next = nullptr;
+};
+
+// the wheel counts milliseconds: a slot of level 0 holds the timers due in
+// one millisecond, a slot of each level above spans all 64 slots of the one
+// below and is spread over them as they come round; timers further out than
+// the top level reaches, about 4.6 hours, wait in its last slot
+const int UV_TIMER_LEVELS = 4;
+const int UV_TIMER_SLOT_BITS = 6;
+const int UV_TIMER_SLOTS = 1 << UV_TIMER_SLOT_BITS;
+
+// 4336 bytes, 4344 with USE_IO_URING
 struct uv_loop_t {
     std::unordered_set<uv_async_t *> asyncs;
     std::unordered_set<uv_idle_t *> idlers;
-    std::vector<uv_timer_t *> timers;
     std::vector<std::pair<uv_handle_t *, uv_close_cb>> closing;
+    std::vector<epoll_event> readyEvents;
     std::mutex async_mutex;
-    std::chrono::system_clock::time_point timepoint;
+    // the wheel's ticks count from here; timerTick is the one it is at
+    std::chrono::steady_clock::time_point timepoint;
+    uint64_t timerTick;
+    uv_timer_link timerWheel[UV_TIMER_LEVELS][UV_TIMER_SLOTS];
     int efd;
     int index;
     int numEvents;
+    int numTimers;
     int asyncWakeupFd;
+    int spinMicros;
+#ifdef USE_IO_URING
+    // where the kernel has io_uring (Linux 5.11), polls are armed and waited
+    // for on it instead of on efd: the requests a loop iteration queues are
+    // submitted with its wait in one system call
+    uv_ring *ring;
+#endif
+    // what uv_metrics_info and uv_metrics_idle_time report, written by the
+    // loop's thread only: its iterations, the events they handled, the
+    // nanoseconds it waited for them and when its current wait began, 0
+    // while it runs callbacks
+    std::atomic<uint64_t> loopCount, eventCount, idleTime, waitStart;
 };
 
 uv_loop_t *uv_default_loop();
 uv_loop_t *uv_loop_new();
 void uv_loop_delete(uv_loop_t *loop);
+// the most events uv_run takes from one epoll_wait, 1024 by default
+void uv_loop_set_max_events(uv_loop_t *loop, int maxEvents);
+// how long an idle uv_run keeps polling before it blocks, answering new
+// events without the wakeup latency of a sleeping thread at the cost of a
+// busy core; 0, the default, blocks right away
+void uv_loop_set_spin(uv_loop_t *loop, int spinMicros);
+
+// as in libuv (1.45), but readable from any thread
+struct uv_metrics_t {
+    uint64_t loop_count;
+    uint64_t events;
+};
+int uv_metrics_info(uv_loop_t *loop, uv_metrics_t *metrics);
+// the nanoseconds the loop has waited for events, spinning included, up to
+// now should it be waiting
+uint64_t uv_metrics_idle_time(uv_loop_t *loop);
 
 
 // 16 bytes
@@ -125,11 +184,20 @@ void uv_idle_stop(uv_idle_t *idle);
 void uv_close(uv_idle_t *handle, uv_close_cb cb);
 bool uv_is_closing(uv_idle_t *handle);
 
-// 32 bytes
+// 32 bytes, 40 with USE_IO_URING
 struct uv_poll_t : uv_handle_t {
     unsigned char cbIndex;
+#ifdef USE_IO_URING
+    // the ring's poll requests are one-shot and re-armed as they complete;
+    // armedEvents is the interest of the one that counts, armGen tells it
+    // from those since removed, and inflight counts all not yet completed
+    unsigned char armGen, inflight;
+#endif
     int fd;
     epoll_event event;
+#ifdef USE_IO_URING
+    int armedEvents;
+#endif
 
     uv_poll_cb get_poll_cb() const;
 };
@@ -141,11 +209,12 @@ void uv_close(uv_poll_t *handle, uv_close_cb cb);
 bool uv_is_closing(uv_poll_t *handle);
 int uv_fileno(uv_poll_t *handle);
 
-// 24 bytes
-struct uv_timer_t : uv_handle_t {
+// 48 bytes
+struct uv_timer_t : uv_handle_t, uv_timer_link {
     unsigned char cbIndex;
     int repeat;
-    std::chrono::system_clock::time_point timepoint;
+    // the tick it is due at
+    uint64_t expiry;
 };
 
 void uv_timer_init(uv_loop_t *loop, uv_timer_t *timer);
@@ -156,6 +225,11 @@ bool uv_is_closing(uv_timer_t *handle);
 
 void uv_run(uv_loop_t *loop, int mode);
 
+// the loop's clock in ms, as of the timers it last ran, like libuv's
+inline uint64_t uv_now(const uv_loop_t *loop) {
+    return loop->timerTick;
+}
+
 //} // namespace uUV
 
 #endif
@@ -2,5 +2,6 @@
 #define UWS_UWS_H
 
 #include "Hub.h"
+#include "HubPool.h"
 
 #endif // UWS_UWS_H
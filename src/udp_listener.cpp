@@ -0,0 +1,204 @@
+#include "udp_listener.h"
+#include "latency.h"
+#include "measurement_record.h"
+#include "metrics.h"
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+///* batches read in one callback before the loop's other sockets
+const int kRounds = 8;
+
+uint32_t LoadLittleEndian32(const char *p) {
+	const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+	return uint32_t(u[0]) | uint32_t(u[1]) << 8 | uint32_t(u[2]) << 16 | uint32_t(u[3]) << 24;
+}
+
+///* a socket on port of either family that other loops' sockets may share
+int BindDatagramSocket(int port) {
+	int fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	const int enabled = 1;
+	const int disabled = 0;
+	if (fd >= 0) {
+		sockaddr_in6 address;
+		memset(&address, 0, sizeof(address));
+		address.sin6_family = AF_INET6;
+		address.sin6_addr = in6addr_any;
+		address.sin6_port = htons(port);
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &disabled, sizeof(disabled));
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled));
+		if (bind(fd, (sockaddr *) &address, sizeof(address)) == 0) {
+			return fd;
+		}
+		close(fd);
+	}
+	//hosts without IPv6
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled));
+	if (bind(fd, (sockaddr *) &address, sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+}
+
+const int UdpListener::kBatch;
+const size_t UdpListener::kMaxDatagram;
+const int UdpListener::kIdleTimeout;
+const int UdpListener::kColdTimeout;
+const size_t UdpListener::kHeaderSize;
+
+UdpListener::UdpListener(uWS::Hub &h, SessionPool &pool)
+	: hub_(&h), pool_(&pool), fd_(-1), poll_(nullptr), timer_(nullptr),
+	  buffers_(kBatch * kMaxDatagram), datagrams_(0), dropped_(0), demote_ms_(0), cold_(0) {}
+
+UdpListener::~UdpListener() {
+	for (std::unordered_map<uint32_t, Sensor>::iterator it = sensors_.begin(); it != sensors_.end(); ++it) {
+		pool_->Release(it->second.session);
+	}
+	if (poll_) {
+		uv_poll_stop(poll_);
+		uv_close(poll_, [](uv_handle_t *handle) {
+			delete (uv_poll_t *) handle;
+		});
+		uv_timer_stop(timer_);
+		uv_close(timer_, [](uv_handle_t *handle) {
+			delete (uv_timer_t *) handle;
+		});
+		close(fd_);
+	}
+}
+
+bool UdpListener::Listen(int port) {
+	if (poll_ || (fd_ = BindDatagramSocket(port)) < 0) {
+		return false;
+	}
+	poll_ = new uv_poll_t;
+	uv_poll_init_socket(hub_->getLoop(), poll_, fd_);
+	poll_->data = this;
+	uv_poll_start(poll_, UV_READABLE, [](uv_poll_t *poll, int status, int events) {
+		static_cast<UdpListener *>(poll->data)->Receive();
+	});
+	timer_ = new uv_timer_t;
+	uv_timer_init(hub_->getLoop(), timer_);
+	timer_->data = this;
+	const int period = (demote_ms_ > 0 && demote_ms_ < kIdleTimeout ? demote_ms_ : kIdleTimeout) / 4;
+	uv_timer_start(timer_, [](uv_timer_t *timer) {
+		static_cast<UdpListener *>(timer->data)->Expire();
+	}, period, period);
+	return true;
+}
+
+void UdpListener::Receive() {
+	mmsghdr messages[kBatch];
+	iovec vectors[kBatch];
+	uWS::Group<uWS::SERVER> &group = *hub_;
+	for (int round = 0; round < kRounds; round++) {
+		for (int i = 0; i < kBatch; i++) {
+			vectors[i].iov_base = &buffers_[i * kMaxDatagram];
+			vectors[i].iov_len = kMaxDatagram;
+			memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+			messages[i].msg_hdr.msg_iov = &vectors[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+		const int received = recvmmsg(fd_, messages, kBatch, MSG_DONTWAIT, nullptr);
+		if (received <= 0) {
+			return;
+		}
+
+		for (int i = 0; i < received; i++) {
+			const uint64_t start = LatencyStats::Now();
+			const char *datagram = &buffers_[i * kMaxDatagram];
+			const size_t length = messages[i].msg_len;
+			if ((messages[i].msg_hdr.msg_flags & MSG_TRUNC) || length <= kHeaderSize) {
+				dropped_++;
+				continue;
+			}
+			const uint32_t id = LoadLittleEndian32(datagram);
+			Sensor &sensor = sensors_[id];
+			if (!sensor.session) {
+				sensor.session = pool_->Acquire();
+				if (sensor.demoted) {
+					sensor.session->Promote(sensor.track);
+					sensor.demoted = false;
+					cold_--;
+					Metrics::Local().Add(METRIC_TRACKS_PROMOTED);
+				}
+				else {
+					std::cout << "Sensor " << id << " is track " << sensor.session->id() << std::endl;
+				}
+			}
+			sensor.heard = start;
+			//a datagram is one frame of records, answered to no one; the
+			//records up to a malformed one are filtered
+			const std::vector<char> &estimates = sensor.session->ProcessRecords(group, datagram + kHeaderSize,
+			                                                                   length - kHeaderSize, start);
+			if (estimates.empty()) {
+				dropped_++;
+			}
+			else {
+				datagrams_++;
+				LatencyStats::Local().Record(LATENCY_TOTAL, start);
+			}
+		}
+		if (received < kBatch) {
+			return;
+		}
+	}
+}
+
+void UdpListener::Expire() {
+	const uint64_t now = LatencyStats::Now();
+	const uint64_t timeout = uint64_t(kIdleTimeout) * 1000000;
+	const uint64_t cold_timeout = uint64_t(kColdTimeout) * 1000000;
+	const uint64_t demote = uint64_t(demote_ms_) * 1000000;
+	for (std::unordered_map<uint32_t, Sensor>::iterator it = sensors_.begin(); it != sensors_.end();) {
+		Sensor &sensor = it->second;
+		if (now - sensor.heard > (sensor.demoted ? cold_timeout : timeout)) {
+			pool_->Release(sensor.session);
+			cold_ -= sensor.demoted;
+			it = sensors_.erase(it);
+			continue;
+		}
+		if (demote && sensor.session && now - sensor.heard > demote) {
+			Demote(sensor);
+		}
+		++it;
+	}
+}
+
+size_t UdpListener::Demote(int ms) {
+	const uint64_t now = LatencyStats::Now();
+	const uint64_t quiet = uint64_t(ms) * 1000000;
+	size_t demoted = 0;
+	for (std::unordered_map<uint32_t, Sensor>::iterator it = sensors_.begin(); it != sensors_.end(); ++it) {
+		if (it->second.session && now - it->second.heard > quiet) {
+			Demote(it->second);
+			demoted++;
+		}
+	}
+	return demoted;
+}
+
+void UdpListener::Demote(Sensor &sensor) {
+	sensor.session->Demote(&sensor.track);
+	pool_->Release(sensor.session);
+	sensor.session = nullptr;
+	sensor.demoted = true;
+	cold_++;
+	Metrics::Local().Add(METRIC_TRACKS_DEMOTED);
+}
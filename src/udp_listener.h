@@ -0,0 +1,114 @@
+#ifndef UDP_LISTENER_H_
+#define UDP_LISTENER_H_
+
+#include <uWS/uWS.h>
+#include "cold_track.h"
+#include "session.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Takes measurements pushed by sensors as UDP datagrams on an event loop,
+ * without the framing and head-of-line blocking of a connection. Every
+ * datagram is an 8-byte header and one or more measurement records (see
+ * measurement_record.h) back to back:
+ *
+ *    0  uint32  sensor       the sensor's id, little-endian
+ *    4  uint32  reserved     zero
+ *    8  record  ...
+ *
+ * Each sensor id is a track with a session of its own from the loop's pool,
+ * released again once the sensor has been silent for kIdleTimeout. With a
+ * demotion timeout a sensor silent for that long keeps its track as a
+ * ColdTrack in float instead, and gives its session back to the pool, so
+ * that only the sensors heard recently hold a whole filter; its next
+ * datagram takes a session again and continues the track, unless it took
+ * longer than kColdTimeout. The sensors are
+ * not answered; their estimates go to viewers and the HTTP API
+ * as those of the connections do. Datagrams are read in batches of kBatch
+ * with one recvmmsg; truncated ones, and those without a valid record, are
+ * dropped and counted.
+ *
+ * Several loops can listen on one port, as SO_REUSEPORT has the kernel send
+ * the datagrams of each sender to one of them; a sensor then keeps to one
+ * address. The listener belongs to the loop's thread and must be created
+ * there.
+ */
+class UdpListener {
+public:
+  ///* datagrams read at once, and the largest taken
+  static const int kBatch = 32;
+  static const size_t kMaxDatagram = 2048;
+
+  ///* a silent sensor's session is released after this, in ms, and a
+  ///* demoted track forgotten after the longer cold timeout
+  static const int kIdleTimeout = 10000;
+  static const int kColdTimeout = 600000;
+
+  static const size_t kHeaderSize = 8;
+
+  UdpListener(uWS::Hub &h, SessionPool &pool);
+
+  ///* closes the socket and releases the sessions
+  ~UdpListener();
+
+  ///* demotes the tracks of sensors silent for ms, 0 for never; before
+  ///* Listen
+  void set_demote_after(int ms) { demote_ms_ = ms; }
+
+  /**
+   * Demotes the tracks of the sensors silent for ms now, whatever the
+   * demotion timeout; returns how many.
+   */
+  size_t Demote(int ms);
+
+  /**
+   * Listens on port, sharing it with the listeners of other loops.
+   * @return false if the port cannot be bound
+   */
+  bool Listen(int port);
+
+  ///* datagrams filtered, and dropped as malformed or truncated
+  long long datagrams() const { return datagrams_; }
+  long long dropped() const { return dropped_; }
+
+  ///* sensors heard, and of those the ones whose track is demoted
+  size_t sensors() const { return sensors_.size(); }
+  size_t cold() const { return cold_; }
+
+private:
+  ///* a sensor's session, or none while its track is cold
+  struct Sensor {
+    Session *session;
+    uint64_t heard;
+    bool demoted;
+    ColdTrack<float> track;
+  };
+
+  uWS::Hub *hub_;
+  SessionPool *pool_;
+  int fd_;
+  uv_poll_t *poll_;
+  uv_timer_t *timer_;
+  std::unordered_map<uint32_t, Sensor> sensors_;
+  std::vector<char> buffers_;
+  long long datagrams_;
+  long long dropped_;
+  int demote_ms_;
+  size_t cold_;
+
+  ///* reads and filters datagrams until none are left
+  void Receive();
+
+  ///* demotes the tracks of quiet sensors, and forgets silent ones
+  void Expire();
+
+  ///* keeps the track of sensor as a ColdTrack and releases its session
+  void Demote(Sensor &sensor);
+
+  UdpListener(const UdpListener &);
+  UdpListener &operator=(const UdpListener &);
+};
+
+#endif /* UDP_LISTENER_H_ */
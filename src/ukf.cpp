@@ -1,6 +1,13 @@
 #include "ukf.h"
+#include "angle.h"
 #include "tools.h"
+#include "allocation_counter.h"
+#include "ctrv_kernel.h"
+#include "latency.h"
+#include "probes.h"
+#include "unscented_transform.h"
 #include "Eigen/Dense"
+#include <cmath>
 #include <iostream>
 
 using namespace std;
@@ -8,220 +15,611 @@ using Eigen::MatrixXd;
 using Eigen::VectorXd;
 using std::vector;
 
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+const int UKF<NX, NAUG, Solver, Points, Sensors>::n_sig_;
+
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+const int UKF<NX, NAUG, Solver, Points, Sensors>::n_x_;
+
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+const int UKF<NX, NAUG, Solver, Points, Sensors>::n_aug_;
+
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+const int UKF<NX, NAUG, Solver, Points, Sensors>::kMaxRejections;
+
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+const double UKF<NX, NAUG, Solver, Points, Sensors>::kDivergenceNISLaser = 13.816;
+
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+const double UKF<NX, NAUG, Solver, Points, Sensors>::kDivergenceNISRadar = 16.266;
+
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+const int UKF<NX, NAUG, Solver, Points, Sensors>::kDivergenceRun;
+
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+const int UKF<NX, NAUG, Solver, Points, Sensors>::kIndefiniteRun;
+
+namespace {
+
 /**
-* Initializes Unscented Kalman filter
+* Lower triangular S with S * S^T = A^T * A from the QR decomposition of A.
+* The rows of R are flipped as needed so that S has a positive diagonal.
 */
-UKF::UKF() {
+template <class QR, class Matrix>
+void LowerFactorFromQR(const QR &qr, Matrix &S) {
+	const int n = Matrix::RowsAtCompileTime;
+	S = qr.matrixQR().template topRows<n>().template triangularView<Eigen::Upper>().transpose();
+	for (int k = 0; k < n; k++) {
+		if (S(k, k) < 0.0) {
+			S.col(k) = -S.col(k);
+		}
+	}
+}
 
-	// Initially set to false, set to true in first call of ProcessMeasurement
-	is_initialized_ = false;
+/**
+* Rank-one update of a lower Cholesky factor in place: afterwards
+* S * S^T equals the old S * S^T + sigma * x * x^T, with sigma = +1 or -1.
+* x is overwritten. Returns false if a downdate would make the matrix
+* indefinite; S is then invalid.
+*/
+template <class Matrix, class Vector>
+bool CholeskyRankOneUpdate(Matrix &S, Vector &x, double sigma) {
+	const int n = Matrix::RowsAtCompileTime;
+	for (int k = 0; k < n; k++) {
+		const double r2 = S(k, k)*S(k, k) + sigma*x(k)*x(k);
+		if (!(r2 > 0.0)) {
+			return false;
+		}
+		const double r = sqrt(r2);
+		const double c = r / S(k, k);
+		const double s = x(k) / S(k, k);
+		S(k, k) = r;
+		for (int i = k + 1; i < n; i++) {
+			S(i, k) = (S(i, k) + sigma*s*x(i)) / c;
+			x(i) = c*x(i) - s*S(i, k);
+		}
+	}
+	return true;
+}
 
-	// if this is false, laser measurements will be ignored (except during init)
-	use_laser_ = true;
+}
 
-	// if this is false, radar measurements will be ignored (except during init)
-	use_radar_ = true;
+/**
+* Initializes Unscented Kalman filter
+*/
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+UKF<NX, NAUG, Solver, Points, Sensors>::UKF() : config_(&UKFConfig::Default()) {
+	Initialize();
+}
 
-	// time when the state is true, in us
-	time_us_ = 0;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+UKF<NX, NAUG, Solver, Points, Sensors>::UKF(const UKFConfig &config) : config_(&config) {
+	Initialize();
+}
 
-	// Process noise standard deviation longitudinal acceleration in m/s^2
-	std_a_ = 1.0;      
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::Initialize() {
 
-	// Process noise standard deviation yaw acceleration in rad/s^2
-	std_yawdd_ = 1.0;   
+	// propagate the covariance as its Cholesky factor
+	use_square_root_ = false;
+	always_linearize_ = false;
 
-    // Laser measurement noise standard deviation position1 in m
-	std_laspx_ = 0.15;
+	Reset();
 
-	// Laser measurement noise standard deviation position2 in m
-	std_laspy_ = 0.15;
+	// registers this thread's latency histograms here rather than in the
+	// allocation-free ProcessMeasurement
+	LatencyStats::Local();
+}
 
-	// Radar measurement noise standard deviation radius in m
-	std_radr_ = 0.3;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::Reset() {
 
-	// Radar measurement noise standard deviation angle in rad
-	std_radphi_ = 0.03;
+	// Initially set to false, set to true in first call of ProcessMeasurement
+	is_initialized_ = false;
+	sigma_points_current_ = false;
+	radar_moments_current_ = false;
 
-	// Radar measurement noise standard deviation radius change in m/s
-	std_radrd_ = 0.3;
+	// time when the state is true, in us
+	time_us_ = 0;
+	pending_us_ = 0;
 
 	// the current NIS for radar
 	NIS_radar_ = 0.0;
 
 	// the current NIS for laser
 	NIS_laser_ = 0.0;
-
-	// State dimension
-	n_x_ = 5;
-
-	// Augmented state dimension
-	n_aug_ = 7;
+	rejected_ = false;
+	rejections_ = 0;
+	linearized_ = false;
+	reinitialized_ = false;
+	reinitializations_ = 0;
+	indefinite_ = 0;
+	outlying_ = 0;
 
 	// initial state vector
-	x_ = VectorXd(n_x_);
+	x_.fill(0.0);
 
 	// initial covariance matrix
-	P_ = MatrixXd(n_x_, n_x_);
+	P_.fill(0.0);
+	S_.fill(0.0);
 
 	// predicted sigma points matrix
-	Xsig_pred_ = MatrixXd(n_x_, 2 * n_aug_ + 1);
-
-	// Sigma point spreading parameter
-	lambda_ = 3.0 - n_aug_;
-
-	// Weights of sigma points
-	weights_ = VectorXd(2 * n_aug_ + 1);
-	weights_(0) = lambda_ / (lambda_ + n_aug_);
-	for (int i = 1; i<2 * n_aug_ + 1; i++) {
-		weights_(i) = 0.5 / (n_aug_ + lambda_);
-	}
+	Xsig_pred_.fill(0.0);
 }
 
-UKF::~UKF() {}
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+UKF<NX, NAUG, Solver, Points, Sensors>::~UKF() {}
 
 /**
 * @param {MeasurementPackage} meas_package The latest measurement data of
 * either radar or laser.
 */
-void UKF::ProcessMeasurement(MeasurementPackage meas_package) {
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::ProcessMeasurement(const MeasurementPackage &meas_package) {
+	UKF_ASSERT_NO_ALLOCATIONS;
+	UKF_PROBE2(process__entry, (int) meas_package.sensor_type_, meas_package.timestamp_);
+	reinitialized_ = false;
+
 	if (!is_initialized_) 
 	{ 
 		x_ << 0.0, 0.0, 3.0, 0.0, 0.1;       
-		P_ = MatrixXd::Identity(n_x_, n_x_); 
+		P_ = StateMatrix::Identity(); 
 		P_(2, 2) = 1.0*1.0;
 		P_(3, 3) = M_PI*M_PI / 64.0;
 		P_(4, 4) = P_(3, 3) / 10.0;
-		if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
-			float rho = meas_package.raw_measurements_[1]; 
-			x_(0) = meas_package.raw_measurements_[0] * cos(rho);
-			x_(1) = meas_package.raw_measurements_[0] * sin(rho);
-			P_(0, 0) = std_radr_*std_radr_*0.5;
-			P_(1, 1) = std_radr_*std_radr_*0.5;
-			NIS_radar_ = 0.0;
-		}
-		else if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
-			x_(0) = meas_package.raw_measurements_[0];
-			x_(1) = meas_package.raw_measurements_[1];
-			P_(0, 0) = std_laspx_*std_laspx_;
-			P_(1, 1) = std_laspy_*std_laspy_;
-			NIS_laser_ = 0.0;
-		}
+		// any sensor starts the track, also one the filter takes no updates of
+		const Starter starter = {this, &meas_package};
+		KnownSensors::Dispatch(meas_package.sensor_type_, starter);
 		time_us_ = meas_package.timestamp_;
+		pending_us_ = time_us_;
+		if (use_square_root_) {
+			RefactorCovariance();
+		}
+		sigma_points_current_ = false;
+		rejected_ = false;
 
 		// done initializing, no need to predict or update
 		is_initialized_ = true;
+		UKF_PROBE1(process__return, (int) meas_package.sensor_type_);
 		return;
 	}
-	// Calculate time delta to last update
-	double dt = (meas_package.timestamp_ - time_us_) / 1000000.0;	//dt - expressed in seconds
-	time_us_ = meas_package.timestamp_;
+	// predicted only when the measurement is used; an ignored one leaves
+	// the prediction pending, to be made in one step with the next
+	AdvanceTo(meas_package.timestamp_);
+	const Updater updater = {this, &meas_package};
+	if (!Sensors::Dispatch(meas_package.sensor_type_, updater)) {
+		rejected_ = false;
+	}
+	else if (Diverged(meas_package.sensor_type_)) {
+		Reinitialize(meas_package);
+	}
+	UKF_PROBE1(process__return, (int) meas_package.sensor_type_);
+}
 
-	Prediction(dt);
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+template <class Sensor>
+void UKF<NX, NAUG, Solver, Points, Sensors>::UpdateWith(const MeasurementPackage &meas_package) {
+	LatencyStats &latency = LatencyStats::Local();
+	uint64_t start = LatencyStats::Now();
+	if (Sensor::Enabled(*config_) && PredictPending(Sensor::sigma_points_)) {
+		start = latency.Record(LATENCY_PREDICTION, start);
+	}
+	Sensor::Update(*this, meas_package);
+	latency.Record(Sensor::latency_, start);
+}
 
-	if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
-		UpdateRadar(meas_package);
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+const typename UKF<NX, NAUG, Solver, Points, Sensors>::StateVector &UKF<NX, NAUG, Solver, Points, Sensors>::StateAt(long long timestamp) {
+	if (is_initialized_) {
+		AdvanceTo(timestamp);
+		PredictPending(false);
+	}
+	return x_;
+}
+
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+typename UKF<NX, NAUG, Solver, Points, Sensors>::StateVector UKF<NX, NAUG, Solver, Points, Sensors>::Extrapolate(long long timestamp) const {
+	if (!is_initialized_ || timestamp == time_us_) {
+		return x_;
+	}
+	//the mean as a single sigma point with zero noise
+	AugStateVector x_aug;
+	x_aug.template head<NX>() = x_;
+	x_aug.template tail<NAUG - NX>().setZero();
+	StateVector x;
+	const double *in[NAUG];
+	double *out[NX];
+	for (int k = 0; k < NAUG; k++) {
+		in[k] = &x_aug(k);
 	}
-	else if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
-		UpdateLidar(meas_package);
+	for (int k = 0; k < NX; k++) {
+		out[k] = &x(k);
 	}
+	ProcessModel::Propagate(in, out, 1, (timestamp - time_us_) / 1000000.0);
+	return x;
 }
 
-/**
-* Predicts sigma points, the state, and the state covariance matrix.
-* @param {double} delta_t the change in time (in seconds) between the last
-* measurement and this one.
-*/
-void UKF::Prediction(double delta_t) {
-	//create augmented mean vector
-	VectorXd x_aug = VectorXd(n_aug_);
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::Extrapolate(long long timestamp, StateVector *x, StateMatrix *P) const {
+	if (!is_initialized_ || timestamp == time_us_) {
+		*x = x_;
+		*P = P_;
+		return;
+	}
+	typedef UKFWorkspace<NX, NAUG, Solver, Points> Workspace;
+	AugStateVector x_aug;
+	x_aug.template head<NX>() = x_;
+	x_aug.template tail<NAUG - NX>().setZero();
+	StateMatrix L = S_;
+	if (!use_square_root_) {
+		L = P_.llt().matrixL();
+	}
+	Eigen::Matrix<double, NAUG - NX, 1> noise;
+	noise << config_->std_a_, config_->std_yawdd_;
+
+	AugSigmaMatrix Xsig_aug;
+	Eigen::Matrix<double, Workspace::n_state_sig_, NAUG> Xsig_aug_t;
+	Eigen::Matrix<double, Workspace::n_state_sig_, NX> Xsig_pred_t;
+	SigmaMatrix Xsig_pred;
+	Points::Draw(x_aug, L, noise, Xsig_aug);
+	Points::template Propagate<ProcessModel>(Xsig_aug, (timestamp - time_us_) / 1000000.0, Xsig_aug_t,
+	                                         Xsig_pred_t, Xsig_pred);
+	const WeightVector &weights = Points::Set().weights;
+	SigmaMean(Xsig_pred, weights, *x);
+	SigmaCovariance<ProcessModel::angle_>(Xsig_pred, weights, *x, *P);
+}
 
-	//create augmented state covariance
-	MatrixXd P_aug = MatrixXd(n_aug_, n_aug_);
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::CartesianEstimate(Eigen::Vector4d *estimate, Eigen::Matrix4d *covariance) const {
+	const double v = x_(2);
+	const double c = cos(x_(3));
+	const double s = sin(x_(3));
+	*estimate << x_(0), x_(1), c * v, s * v;
+	if (!covariance) {
+		return;
+	}
+	//the conversion only involves p_x, p_y, v and yaw
+	Eigen::Matrix4d J;
+	J << 1.0, 0.0, 0.0, 0.0,
+	     0.0, 1.0, 0.0, 0.0,
+	     0.0, 0.0, c, -s * v,
+	     0.0, 0.0, s, c * v;
+	*covariance = J * P_.template topLeftCorner<4, 4>() * J.transpose();
+}
 
-	//create sigma point matrix
-	MatrixXd Xsig_aug = MatrixXd(n_aug_, 2 * n_aug_ + 1);
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+int UKF<NX, NAUG, Solver, Points, Sensors>::PredictMeasurement(MeasurementPackage::SensorType sensor, long long timestamp,
+                                              Eigen::Vector3d *z_pred, Eigen::Matrix3d *S) {
+	AdvanceTo(timestamp);
+	if (sensor == MeasurementPackage::LASER) {
+		PredictPending(false);
+		z_pred->template head<2>() = x_.template head<2>();
+		S->template topLeftCorner<2, 2>() = P_.template topLeftCorner<2, 2>() + config_->R_laser_;
+		return 2;
+	}
+	PredictPending(true);
+	if (!radar_moments_current_) {
+		MeasurementMoments<RadarModel, ProcessModel::angle_>(Xsig_pred_, x_, Points::Set().weights,
+		                                                     workspace_.Zsig_radar, workspace_.z_pred_radar,
+		                                                     workspace_.S_radar, workspace_.Tc_radar);
+		radar_moments_current_ = true;
+	}
+	*z_pred = workspace_.z_pred_radar;
+	*S = workspace_.S_radar;
+	S->diagonal() += config_->R_radar_.diagonal();
+	return 3;
+}
 
-	//create augmented mean state
-	x_aug.head(n_x_) = x_;
-	x_aug(n_x_) = 0;
-	x_aug(n_x_ + 1) = 0;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+double UKF<NX, NAUG, Solver, Points, Sensors>::MeasurementNIS(const MeasurementPackage &meas_package) {
+	Eigen::Vector3d z_pred;
+	Eigen::Matrix3d S;
+	if (PredictMeasurement(meas_package.sensor_type_, meas_package.timestamp_, &z_pred, &S) == 2) {
+		Eigen::Matrix<double, 2, 1> &z_diff = workspace_.z_diff_laser;
+		z_diff = meas_package.raw_measurements_.template head<2>() - z_pred.head<2>();
+		workspace_.solver_laser.Compute(S.topLeftCorner<2, 2>());
+		return workspace_.solver_laser.Quadratic(z_diff);
+	}
+	Eigen::Matrix<double, 3, 1> &z_diff = workspace_.z_diff_radar;
+	z_diff = meas_package.raw_measurements_.template head<3>() - z_pred;
+	z_diff(RadarModel::angle_) = NormalizeAngle(z_diff(RadarModel::angle_));
+	workspace_.solver_radar.Compute(S);
+	return workspace_.solver_radar.Quadratic(z_diff);
+}
 
-	//create augmented covariance matrix
-	P_aug.fill(0.0);
-	P_aug.topLeftCorner(n_x_, n_x_) = P_;
-	P_aug(n_x_, n_x_) = std_a_*std_a_;
-	P_aug(n_x_ + 1, n_x_ + 1) = std_yawdd_*std_yawdd_;
-
-	//create square root matrix
-	MatrixXd L = P_aug.llt().matrixL();
-
-	//create augmented sigma points
-	double sqrt_lam_aug = sqrt(lambda_ + n_aug_);
-	Xsig_aug.col(0) = x_aug;
-	for (int i = 0; i< n_aug_; i++) {
-		Xsig_aug.col(i + 1) = x_aug + sqrt_lam_aug * L.col(i);
-		Xsig_aug.col(i + 1 + n_aug_) = x_aug - sqrt_lam_aug * L.col(i);
-	}
-
-	for (int i = 0; i< 2 * n_aug_ + 1; i++) {
-		//extract values for better readability
-		double p_x = Xsig_aug(0, i);
-		double p_y = Xsig_aug(1, i);
-		double v = Xsig_aug(2, i);
-		double yaw = Xsig_aug(3, i);
-		double yawd = Xsig_aug(4, i);
-		double nu_a = Xsig_aug(5, i);
-		double nu_yawdd = Xsig_aug(6, i);
-
-		//predicted state values
-		double px_p, py_p;
-
-		//avoid division by zero
-		if (fabs(yawd) > 0.001) {
-			px_p = p_x + v / yawd * (sin(yaw + yawd*delta_t) - sin(yaw));
-			py_p = p_y + v / yawd * (cos(yaw) - cos(yaw + yawd*delta_t));
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::FuseMeasurements(const MeasurementPackage *measurements, size_t count) {
+	reinitialized_ = false;
+	if (count && !is_initialized_) {
+		ProcessMeasurement(*measurements);
+		measurements++;
+		count--;
+	}
+	if (!count) {
+		return;
+	}
+	const bool laser = Sensors::template Contains<LaserSensor>::value && config_->use_laser_;
+	const bool radar = Sensors::template Contains<RadarSensor>::value && config_->use_radar_;
+	int lasers = 0, radars = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (measurements[i].sensor_type_ == MeasurementPackage::RADAR) {
+			radars += radar;
 		}
 		else {
-			px_p = p_x + v*delta_t*cos(yaw);
-			py_p = p_y + v*delta_t*sin(yaw);
+			lasers += laser;
+		}
+	}
+	// as in ProcessMeasurement, ignored measurements leave the prediction pending
+	AdvanceTo(measurements[0].timestamp_);
+	if (!lasers && !radars) {
+		rejected_ = false;
+		return;
+	}
+	LatencyStats &latency = LatencyStats::Local();
+	uint64_t start = LatencyStats::Now();
+	if (PredictPending(radars > 0)) {
+		start = latency.Record(LATENCY_PREDICTION, start);
+	}
+
+	StateMatrix &J = workspace_.J_fused;
+	StateVector &g = workspace_.g_fused;
+	J.setZero();
+	g.setZero();
+	int used = 0;
+
+	if (lasers) {
+		//H selects p_x and p_y: every lidar adds R^-1 to the top left block
+		const int n_z = UKFWorkspace<NX, NAUG, Solver, Points>::n_z_laser_;
+		Eigen::Matrix<double, n_z, n_z> &S = workspace_.S_laser;
+		S = config_->R_laser_ + P_.template topLeftCorner<n_z, n_z>();
+		typename Solver::template Factorization<n_z> &solver = workspace_.solver_laser;
+		solver.Compute(S);
+		Eigen::Matrix<double, n_z, 1> &z_diff = workspace_.z_diff_laser;
+		Eigen::Matrix<double, n_z, 1> &sum = workspace_.nu_laser_fused;
+		sum.setZero();
+		int accepted = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (measurements[i].sensor_type_ == MeasurementPackage::RADAR) {
+				continue;
+			}
+			z_diff = measurements[i].raw_measurements_.template head<n_z>() - x_.template head<n_z>();
+			NIS_laser_ = solver.Quadratic(z_diff);
+			if (!Gated(NIS_laser_, config_->gate_laser_)) {
+				sum += z_diff;
+				accepted++;
+			}
+		}
+		if (accepted) {
+			const Eigen::Matrix<double, n_z, n_z> Ri = config_->R_laser_.inverse();
+			J.template topLeftCorner<n_z, n_z>() += (double) accepted * Ri;
+			g.template head<n_z>() += Ri * sum;
+			used += accepted;
+		}
+	}
+
+	if (radars) {
+		const int n_z = RadarModel::n_z_;
+		Eigen::Matrix<double, n_z, 1> &z_pred = workspace_.z_pred_radar;
+		Eigen::Matrix<double, n_z, n_z> &S = workspace_.S_radar;
+		Eigen::Matrix<double, NX, n_z> &Tc = workspace_.Tc_radar;
+		linearized_ = false;
+		if (!(sigma_points_current_ && radar_moments_current_)) {
+			if (always_linearize_ || (config_->linearize_radar_ > 0.0 && RadarNearlyLinear())) {
+				LinearizeRadar();
+				linearized_ = true;
+			}
+			else {
+				MeasurementMoments<RadarModel, ProcessModel::angle_>(Xsig_pred_, x_, Points::Set().weights,
+				                                                     workspace_.Zsig_radar, z_pred, S, Tc);
+			}
+		}
+		radar_moments_current_ = false;
+
+		//H = Tc^T P^-1, and the noise S - H Tc the model leaves out
+		Eigen::Matrix<double, n_z, NX> &H = workspace_.H_fused;
+		workspace_.llt_state.compute(P_);
+		H = workspace_.llt_state.solve(Tc).transpose();
+		Eigen::Matrix<double, n_z, n_z> &R = workspace_.R_fused;
+		R.noalias() = S - H * Tc;
+		R.diagonal() += config_->R_radar_.diagonal();
+		S.diagonal() += config_->R_radar_.diagonal();
+
+		typename Solver::template Factorization<n_z> &solver = workspace_.solver_radar;
+		solver.Compute(S);
+		Eigen::Matrix<double, n_z, 1> &z_diff = workspace_.z_diff_radar;
+		Eigen::Matrix<double, n_z, 1> &sum = workspace_.nu_radar_fused;
+		sum.setZero();
+		int accepted = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (measurements[i].sensor_type_ != MeasurementPackage::RADAR) {
+				continue;
+			}
+			z_diff = measurements[i].raw_measurements_.template head<n_z>() - z_pred;
+			z_diff(RadarModel::angle_) = NormalizeAngle(z_diff(RadarModel::angle_));
+			NIS_radar_ = solver.Quadratic(z_diff);
+			if (!Gated(NIS_radar_, config_->gate_radar_)) {
+				sum += z_diff;
+				accepted++;
+			}
 		}
+		if (accepted) {
+			Eigen::Matrix<double, n_z, NX> &RiH = workspace_.RiH_fused;
+			solver.Compute(R);
+			solver.Solve(H, RiH);
+			J.noalias() += (double) accepted * H.transpose() * RiH;
+			g.noalias() += RiH.transpose() * sum;
+			used += accepted;
+		}
+	}
+
+	rejected_ = !used;
+	if (used) {
+		//(P^-1 + J)^-1 = (I + P J)^-1 P, without inverting P
+		StateMatrix &A = workspace_.A_fused;
+		A.setIdentity();
+		A.noalias() += P_ * J;
+		workspace_.lu_fused.compute(A);
+		StateMatrix &P = workspace_.P_fused;
+		P = workspace_.lu_fused.solve(P_);
+		P_ = 0.5 * (P + P.transpose());
+		x_.noalias() += P_ * g;
+		if (use_square_root_) {
+			RefactorCovariance();
+		}
+		sigma_points_current_ = false;
+	}
+	latency.Record(radars ? LATENCY_UPDATE_RADAR : LATENCY_UPDATE_LIDAR, start);
+	if (Diverged(radars ? MeasurementPackage::RADAR : MeasurementPackage::LASER)) {
+		Reinitialize(measurements[count - 1]);
+	}
+}
+
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::Save(Checkpoint *checkpoint) const {
+	checkpoint->x = x_;
+	checkpoint->P = P_;
+	checkpoint->S = S_;
+	checkpoint->time_us = time_us_;
+	checkpoint->initialized = is_initialized_;
+}
 
-		double v_p = v;
-		double yaw_p = yaw + yawd*delta_t;
-		double yawd_p = yawd;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::Restore(const Checkpoint &checkpoint) {
+	x_ = checkpoint.x;
+	P_ = checkpoint.P;
+	S_ = checkpoint.S;
+	time_us_ = checkpoint.time_us;
+	pending_us_ = checkpoint.time_us;
+	is_initialized_ = checkpoint.initialized;
+	sigma_points_current_ = false;
+	indefinite_ = 0;
+	outlying_ = 0;
+}
 
-		//add noise
-		px_p = px_p + 0.5*nu_a*delta_t*delta_t * cos(yaw);
-		py_p = py_p + 0.5*nu_a*delta_t*delta_t * sin(yaw);
-		v_p = v_p + nu_a*delta_t;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::PredictionCrossCovariance(StateMatrix *C) const {
+	const WeightVector &weights = Points::Set().weights;
+	const StateVector x_prior = workspace_.x_aug.template head<NX>();
+	C->fill(0.0);
+	for (int i = 0; i < n_sig_; i++) {
+		StateVector prior_diff = workspace_.Xsig_aug.col(i).template head<NX>() - x_prior;
+		StateVector x_diff = Xsig_pred_.col(i) - x_;
+		prior_diff(3) = NormalizeAngle(prior_diff(3));
+		x_diff(3) = NormalizeAngle(x_diff(3));
+		C->noalias() += weights(i) * prior_diff * x_diff.transpose();
+	}
+}
 
-		yaw_p = yaw_p + 0.5*nu_yawdd*delta_t*delta_t;
-		yawd_p = yawd_p + nu_yawdd*delta_t;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+bool UKF<NX, NAUG, Solver, Points, Sensors>::PredictPending(bool sigma_points) {
+	if (pending_us_ != time_us_) {
+		double dt = (pending_us_ - time_us_) / 1000000.0;	//dt - expressed in seconds
+		time_us_ = pending_us_;
+		UKF_PROBE1(predict__entry, time_us_);
+		Prediction(dt);
+		UKF_PROBE(predict__return);
+		return true;
+	}
+	if (sigma_points && !sigma_points_current_) {
+		//another measurement of the same instant: nothing to predict, but
+		//the radar update needs sigma points around the updated state
+		RedrawSigmaPoints();
+		return true;
+	}
+	return false;
+}
 
-		//write predicted sigma point into right column
-		Xsig_pred_(0, i) = px_p;
-		Xsig_pred_(1, i) = py_p;
-		Xsig_pred_(2, i) = v_p;
-		Xsig_pred_(3, i) = yaw_p;
-		Xsig_pred_(4, i) = yawd_p;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::ProcessMeasurements(const MeasurementPackage *measurements, size_t count) {
+	size_t begin = 0;
+	while (begin < count) {
+		size_t end = begin + 1;
+		while (end < count && measurements[end].timestamp_ == measurements[begin].timestamp_) {
+			end++;
+		}
+		for (size_t i = begin; i < end; i++) {
+			if (measurements[i].sensor_type_ == MeasurementPackage::RADAR) {
+				ProcessMeasurement(measurements[i]);
+			}
+		}
+		for (size_t i = begin; i < end; i++) {
+			if (measurements[i].sensor_type_ != MeasurementPackage::RADAR) {
+				ProcessMeasurement(measurements[i]);
+			}
+		}
+		begin = end;
 	}
+}
+
+/**
+* Predicts sigma points, the state, and the state covariance matrix.
+* @param {double} delta_t the change in time (in seconds) between the last
+* measurement and this one.
+*/
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::Prediction(double delta_t) {
+	//augmented mean vector and sigma point matrix
+	AugStateVector &x_aug = workspace_.x_aug;
+	AugSigmaMatrix &Xsig_aug = workspace_.Xsig_aug;
+
+	//create augmented mean state
+	x_aug.head(n_x_) = x_;
+	x_aug(n_x_) = 0;
+	x_aug(n_x_ + 1) = 0;
+
+	//the augmented covariance is block diagonal: only P_ needs a factor, and
+	//that of the noise block is the diagonal of standard deviations
+	const StateMatrix *L = &S_;
+	if (!use_square_root_) {
+		indefinite_ = Solver::FactorCovariance(P_, &workspace_.llt_state, &workspace_.L_state) ? 0 : indefinite_ + 1;
+		L = &workspace_.L_state;
+	}
+
+	//create augmented sigma points and propagate them
+	workspace_.noise << config_->std_a_, config_->std_yawdd_;
+	Points::Draw(x_aug, *L, workspace_.noise, Xsig_aug);
+	Points::template Propagate<ProcessModel>(Xsig_aug, delta_t, workspace_.Xsig_aug_t, workspace_.Xsig_pred_t,
+	                                         Xsig_pred_);
+	sigma_points_current_ = true;
+	radar_moments_current_ = false;
 
     // Predict state mean
-	x_.fill(0.0);
-	for (int i = 0; i < 2 * n_aug_ + 1; i++) {  
-		x_ = x_ + weights_(i) * Xsig_pred_.col(i);
+	const SigmaPointSet<NAUG, n_sig_> &set = Points::Set();
+	const WeightVector &weights = set.weights;
+	SigmaMean(Xsig_pred_, weights, x_);
+
+	StateVector &x_diff = workspace_.x_diff;
+	if (use_square_root_) {
+		//factor of the weighted deviations of the points but the center by
+		//QR, then a rank-one update with the (possibly negative) central weight
+		const int first = Points::has_center_ ? 1 : 0;
+		Eigen::Matrix<double, UKFWorkspace<NX, NAUG, Solver, Points>::n_outer_sig_, NX> &D = workspace_.D_pred;
+		for (int i = first; i < n_sig_; i++) {
+			x_diff = Xsig_pred_.col(i) - x_;
+			x_diff(3) = NormalizeAngle(x_diff(3));
+			D.row(i - first) = set.sqrt_weight * x_diff.transpose();
+		}
+		workspace_.qr_pred.compute(D);
+		LowerFactorFromQR(workspace_.qr_pred, S_);
+		if (!Points::has_center_) {
+			P_.noalias() = S_ * S_.transpose();
+			return;
+		}
+
+		x_diff = Xsig_pred_.col(0) - x_;
+		x_diff(3) = NormalizeAngle(x_diff(3));
+		x_diff *= set.sqrt_weight0;
+		if (CholeskyRankOneUpdate(S_, x_diff, set.weight0_sign)) {
+			P_.noalias() = S_ * S_.transpose();
+			return;
+		}
+		//the downdate lost definiteness, fall through to the full covariance
 	}
 
 	// Predict state covariance matrix
-	P_.fill(0.0);
-	VectorXd x_diff = VectorXd(n_x_);
-	for (int i = 0; i < 2 * n_aug_ + 1; i++) { 
-		x_diff = Xsig_pred_.col(i) - x_;
-		//angle normalization
-		x_diff(3) = fmod(x_diff(3) + M_PI, (2.0*M_PI)) - M_PI;
-
-		P_ = P_ + weights_(i) * x_diff * x_diff.transpose();
+	SigmaCovariance<ProcessModel::angle_>(Xsig_pred_, weights, x_, P_);
+	if (use_square_root_) {
+		RefactorCovariance();
 	}
 }
 
@@ -229,124 +627,248 @@ void UKF::Prediction(double delta_t) {
 * Updates the state and the state covariance matrix using a laser measurement.
 * @param {MeasurementPackage} meas_package
 */
-void UKF::UpdateLidar(MeasurementPackage meas_package) {
-	if (!use_laser_) {
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::UpdateLidar(const MeasurementPackage &meas_package) {
+	if (!Sensors::template Contains<LaserSensor>::value || !config_->use_laser_) {
 		NIS_laser_ = 0.0;
+		rejected_ = false;
 		return;
 	}
-	int n_z = 2; 
-	MatrixXd H = MatrixXd(n_z, n_x_);
-	H.fill(0.0);
-	H(0, 0) = 1.0;
-	H(1, 1) = 1.0;
-
-	MatrixXd R = MatrixXd(n_z, n_z);
-	R.fill(0.0);
-	R(0, 0) = std_laspx_*std_laspx_;
-	R(1, 1) = std_laspy_*std_laspy_;
-
-	MatrixXd HP = MatrixXd(n_z, n_x_);
-	HP = H * P_;
-
-	VectorXd z_diff = meas_package.raw_measurements_ - H * x_;
-	MatrixXd Ht = H.transpose();
-	MatrixXd S = HP * Ht + R;
-	MatrixXd Si = S.inverse();
-	MatrixXd K = HP.transpose() * Si;
-
-	x_ = x_ + (K * z_diff);
-	P_ = P_ - K * HP;
+	const int n_z = UKFWorkspace<NX, NAUG, Solver, Points>::n_z_laser_; 
+
+	//H selects p_x and p_y, so H P is the top rows of P_ and H P H^T its
+	//top left block; no products with H
+	Eigen::Matrix<double, n_z, NX> &HP = workspace_.HP_laser;
+	HP = P_.template topRows<n_z>();
+
+	Eigen::Matrix<double, n_z, 1> &z_diff = workspace_.z_diff_laser;
+	z_diff = meas_package.raw_measurements_.template head<n_z>() - x_.template head<n_z>();
+	Eigen::Matrix<double, n_z, n_z> &S = workspace_.S_laser;
+	S = config_->R_laser_ + HP.template leftCols<n_z>();
+	typename Solver::template Factorization<n_z> &solver = workspace_.solver_laser;
+	solver.Compute(S);
+	NIS_laser_ = solver.Quadratic(z_diff);
+	rejected_ = Gated(NIS_laser_, config_->gate_laser_);
+	if (rejected_) {
+		//clutter: the state, and any sigma points around it, stay as they are
+		return;
+	}
+	//K = P H^T S^-1, solved as K^T = S^-1 H P
+	Eigen::Matrix<double, n_z, NX> &Kt = workspace_.Kt_laser;
+	solver.Solve(HP, Kt);
+	Eigen::Matrix<double, NX, n_z> &K = workspace_.K_laser;
+	K = Kt.transpose();
+
+	x_.noalias() += K * z_diff;
+	if (use_square_root_) {
+		//Joseph form (I - KH) P (I - KH)^T + K R K^T as the QR of its factors
+		StateMatrix &A = workspace_.A_laser;
+		A.setIdentity();
+		A.template leftCols<n_z>() -= K;
+		Eigen::Matrix<double, NX + n_z, NX> &D = workspace_.D_laser;
+		D.template topRows<NX>().noalias() = S_.transpose() * A.transpose();
+		D.row(NX) = config_->std_laspx_ * K.col(0).transpose();
+		D.row(NX + 1) = config_->std_laspy_ * K.col(1).transpose();
+		workspace_.qr_laser.compute(D);
+		LowerFactorFromQR(workspace_.qr_laser, S_);
+		P_.noalias() = S_ * S_.transpose();
+	}
+	else {
+		//P - K H P is symmetric: the lower triangle, mirrored
+		for (int j = 0; j < NX; j++) {
+			for (int i = j; i < NX; i++) {
+				P_(i, j) -= K(i, 0)*HP(0, j) + K(i, 1)*HP(1, j);
+				P_(j, i) = P_(i, j);
+			}
+		}
+	}
 
-	NIS_laser_ = z_diff.transpose() * Si * z_diff;
+	sigma_points_current_ = false;
 }
 
 /**
 * Updates the state and the state covariance matrix using a radar measurement.
 * @param {MeasurementPackage} meas_package
 */
-void UKF::UpdateRadar(MeasurementPackage meas_package) {
-	if (!use_radar_) {
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::UpdateRadar(const MeasurementPackage &meas_package) {
+	linearized_ = false;
+	if (!Sensors::template Contains<RadarSensor>::value || !config_->use_radar_) {
 		NIS_radar_ = 0.0;
+		rejected_ = false;
 		return;
 	}
-	int n_z = 3; 
+	const int n_z = RadarModel::n_z_;
+
+	const WeightVector &weights = Points::Set().weights;
+
+	//measurement sigma points, their mean, covariance and cross correlation;
+	//moments PredictMeasurement computed are used as they are
+	Eigen::Matrix<double, n_z, 1> &z_pred = workspace_.z_pred_radar;
+	Eigen::Matrix<double, n_z, n_z> &S = workspace_.S_radar;
+	Eigen::Matrix<double, NX, n_z> &Tc = workspace_.Tc_radar;
+	if (!(sigma_points_current_ && radar_moments_current_)) {
+		if (always_linearize_ || (config_->linearize_radar_ > 0.0 && RadarNearlyLinear())) {
+			LinearizeRadar();
+			linearized_ = true;
+		}
+		else {
+			MeasurementMoments<RadarModel, ProcessModel::angle_>(Xsig_pred_, x_, weights,
+			                                                     workspace_.Zsig_radar, z_pred, S, Tc);
+		}
+	}
+	radar_moments_current_ = false;
+	// add measurement noise covariance matrix
+	S.diagonal() += config_->R_radar_.diagonal();
 
-	MatrixXd Zsig = MatrixXd(n_z, 2 * n_aug_ + 1);
-	for (int i = 0; i < 2 * n_aug_ + 1; i++) {  
-		double p_x = Xsig_pred_(0, i);
-		double p_y = Xsig_pred_(1, i);
-		double v = Xsig_pred_(2, i);
-		double yaw = Xsig_pred_(3, i);
+	//residual
+	Eigen::Matrix<double, n_z, 1> &z_diff = workspace_.z_diff_radar;
+	z_diff = meas_package.raw_measurements_.template head<n_z>() - z_pred;
 
-		double v1 = cos(yaw)*v;
-		double v2 = sin(yaw)*v;
+	//angle normalization
+	z_diff(RadarModel::angle_) = NormalizeAngle(z_diff(RadarModel::angle_));
+
+	typename Solver::template Factorization<n_z> &solver = workspace_.solver_radar;
+	solver.Compute(S);
+	NIS_radar_ = solver.Quadratic(z_diff);
+	rejected_ = Gated(NIS_radar_, config_->gate_radar_);
+	if (rejected_) {
+		//clutter: the state, and the sigma points around it, stay as they are
+		return;
+	}
 
-		Zsig(0, i) = sqrt(p_x*p_x + p_y*p_y);     
+	// Kalman gain K;
+	Eigen::Matrix<double, n_z, NX> &Kt = workspace_.Kt_radar;
+	solver.Solve(Tc.transpose(), Kt);
+	Eigen::Matrix<double, NX, n_z> &K = workspace_.K_radar;
+	K = Kt.transpose();
 
-		//Avoid too small numbers
-		if (Zsig(0, i)< 0.001) {                            
-			Zsig(0, i) = 0.001;
-			Zsig(1, i) = 0.0;
+	// Update state mean and covariance matrix
+	x_.noalias() += K * z_diff;
+	if (use_square_root_) {
+		//P - K S K^T as n_z rank-one downdates of the factor by K * chol(S)
+		workspace_.llt_radar.compute(S);
+		Eigen::Matrix<double, NX, n_z> &U = workspace_.U_radar;
+		U.noalias() = K * workspace_.llt_radar.matrixL();
+		StateVector &x_diff = workspace_.x_diff;
+		bool downdated = true;
+		for (int c = 0; c < n_z && downdated; c++) {
+			x_diff = U.col(c);
+			downdated = CholeskyRankOneUpdate(S_, x_diff, -1.0);
+		}
+		if (downdated) {
+			P_.noalias() = S_ * S_.transpose();
 		}
 		else {
-			Zsig(1, i) = atan2(p_y, p_x);               
+			Solver::SubtractGainProduct(&P_, Tc, K);
+			RefactorCovariance();
 		}
-		Zsig(2, i) = (p_x*v1 + p_y*v2) / Zsig(0, i);  
 	}
-
-	// Predicted measurement mean
-	VectorXd z_pred = VectorXd(n_z);
-	z_pred.fill(0.0);
-	for (int i = 0; i < 2 * n_aug_ + 1; i++) {
-		z_pred = z_pred + weights_(i) * Zsig.col(i);
+	else {
+		Solver::SubtractGainProduct(&P_, Tc, K);
 	}
 
-	// Measurement covariance matrix
-	MatrixXd S = MatrixXd(n_z, n_z);
-	S.fill(0.0);
-	VectorXd z_diff = VectorXd(n_z);
-	for (int i = 0; i < 2 * n_aug_ + 1; i++) {  
-		z_diff = Zsig.col(i) - z_pred;
-		//angle normalization
-		z_diff(1) = fmod(z_diff(1) + M_PI, (2.0*M_PI)) - M_PI;
-
-		S = S + weights_(i) * z_diff * z_diff.transpose();
-	}
-	// add measurement noise covariance matrix
-	S(0, 0) += std_radr_*std_radr_;
-	S(1, 1) += std_radphi_*std_radphi_;
-	S(2, 2) += std_radrd_*std_radrd_;
+	sigma_points_current_ = false;
+}
 
-	MatrixXd Tc = MatrixXd(n_x_, n_z);
-	Tc.fill(0.0);
-	VectorXd x_diff = VectorXd(n_x_);
-	for (int i = 0; i < 2 * n_aug_ + 1; i++) { 
-		z_diff = Zsig.col(i) - z_pred;
-		//angle normalization
-		z_diff(1) = fmod(z_diff(1) + M_PI, (2.0*M_PI)) - M_PI;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+bool UKF<NX, NAUG, Solver, Points, Sensors>::RadarNearlyLinear() const {
+	//the range and bearing bend over the position spread relative to the
+	//range, the range rate over the yaw spread through its sine and cosine
+	const double rho2 = x_(0)*x_(0) + x_(1)*x_(1);
+	const double limit2 = config_->linearize_radar_ * config_->linearize_radar_;
+	return rho2 > 1e-6 && P_(0, 0) + P_(1, 1) < limit2 * rho2 && P_(3, 3) < limit2;
+}
 
-		// state difference
-		x_diff = Xsig_pred_.col(i) - x_;
-		//angle normalization
-		x_diff(3) = fmod(x_diff(3) + M_PI, (2.0*M_PI)) - M_PI;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::LinearizeRadar() {
+	const double p_x = x_(0);
+	const double p_y = x_(1);
+	const double v = x_(2);
+	const double c = cos(x_(3));
+	const double s = sin(x_(3));
+	const double rho2 = p_x*p_x + p_y*p_y;
+	const double rho = sqrt(rho2);
+
+	Eigen::Matrix<double, RadarModel::n_z_, 1> &z_pred = workspace_.z_pred_radar;
+	z_pred(0) = rho;
+	z_pred(1) = atan2(p_y, p_x);
+	z_pred(2) = v * (p_x*c + p_y*s) / rho;
+
+	Eigen::Matrix<double, RadarModel::n_z_, NX> &H = workspace_.H_radar;
+	H.setZero();
+	H(0, 0) = p_x / rho;
+	H(0, 1) = p_y / rho;
+	H(1, 0) = -p_y / rho2;
+	H(1, 1) = p_x / rho2;
+	H(2, 0) = v * c / rho - z_pred(2) * p_x / rho2;
+	H(2, 1) = v * s / rho - z_pred(2) * p_y / rho2;
+	H(2, 2) = (p_x*c + p_y*s) / rho;
+	H(2, 3) = v * (p_y*c - p_x*s) / rho;
+
+	workspace_.Tc_radar.noalias() = P_ * H.transpose();
+	workspace_.S_radar.noalias() = H * workspace_.Tc_radar;
+}
 
-		Tc = Tc + weights_(i) * x_diff * z_diff.transpose();
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+bool UKF<NX, NAUG, Solver, Points, Sensors>::Gated(double nis, double gate) {
+	if (gate > 0.0 && nis > gate && rejections_ < kMaxRejections) {
+		rejections_++;
+		return true;
 	}
+	rejections_ = 0;
+	return false;
+}
 
-	// Kalman gain K;
-	MatrixXd Si = MatrixXd(n_z, n_z);
-	Si = S.inverse();
-	MatrixXd K = Tc * Si;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+bool UKF<NX, NAUG, Solver, Points, Sensors>::Diverged(MeasurementPackage::SensorType sensor) {
+	const bool radar = sensor == MeasurementPackage::RADAR;
+	if ((radar ? NIS_radar_ : NIS_laser_) > (radar ? kDivergenceNISRadar : kDivergenceNISLaser)) {
+		outlying_++;
+	}
+	else {
+		outlying_ = 0;
+	}
+	//a NaN or infinity anywhere makes the sum one
+	return indefinite_ >= kIndefiniteRun || outlying_ >= kDivergenceRun || !std::isfinite(x_.sum() + P_.sum());
+}
 
-	//residual
-	z_diff = meas_package.raw_measurements_ - z_pred;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::Reinitialize(const MeasurementPackage &meas_package) {
+	is_initialized_ = false;
+	rejections_ = 0;
+	indefinite_ = 0;
+	outlying_ = 0;
+	ProcessMeasurement(meas_package);
+	reinitialized_ = true;
+	reinitializations_++;
+}
 
-	//angle normalization
-	z_diff(1) = fmod(z_diff(1) + M_PI, (2.0*M_PI)) - M_PI;
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::RedrawSigmaPoints() {
+	const StateMatrix *L = &S_;
+	if (!use_square_root_) {
+		indefinite_ = Solver::FactorCovariance(P_, &workspace_.llt_state, &workspace_.L_state) ? 0 : indefinite_ + 1;
+		L = &workspace_.L_state;
+	}
+	Xsig_pred_.noalias() = L->lazyProduct(Points::Set().units.template topRows<NX>());
+	Xsig_pred_.colwise() += x_;
+	sigma_points_current_ = true;
+	radar_moments_current_ = false;
+}
 
-	// Update state mean and covariance matrix
-	x_ = x_ + K * z_diff;
-	P_ = P_ - Tc*K.transpose(); 
+/**
+* Recomputes the square-root factor S_ from P_.
+*/
+template <int NX, int NAUG, class Solver, class Points, class Sensors>
+void UKF<NX, NAUG, Solver, Points, Sensors>::RefactorCovariance() {
+	indefinite_ = Solver::FactorCovariance(P_, &workspace_.llt_state, &S_) ? 0 : indefinite_ + 1;
+}
 
-	NIS_radar_ = z_diff.transpose() * Si * z_diff;
-}
\ No newline at end of file
+template class UKF<5, 7>;
+template class UKF<5, 7, InverseSolver>;
+template class UKF<5, 7, SmallMatrixSolver, CTRVSigmaPoints>;
+template class UKF<5, 7, LdltSolver, SimplexSigmaPoints<7> >;
+template class UKF<5, 7, LdltSolver, CubatureSigmaPoints<7> >;
+template class UKF<5, 7, CTRVSolver, CTRVSigmaPoints, LaserOnlySensors>;
+template class UKF<5, 7, CTRVSolver, CTRVSigmaPoints, RadarOnlySensors>;
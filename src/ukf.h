@@ -2,6 +2,12 @@
 #define UKF_H
 
 #include "measurement_package.h"
+#include "innovation_solver.h"
+#include "unscented_transform.h"
+#include "sigma_points.h"
+#include "sensor_set.h"
+#include "cache_aligned.h"
+#include "ukf_config.h"
 #include "Eigen/Dense"
 #include <vector>
 #include <string>
@@ -10,62 +16,183 @@
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
-class UKF {
+/**
+ * Scratch storage for one filter step. Every temporary used by Prediction,
+ * UpdateLidar and UpdateRadar lives here, so once the filter is constructed
+ * the measurement loop never touches the heap.
+ */
+template <int NX, int NAUG, class Solver, class Points>
+struct UKFWorkspace {
+  static const int n_sig_ = Points::n_points_;
+  ///* the sigma points the process model propagates
+  static const int n_state_sig_ = Points::template Propagated<NX>::value;
+  ///* the sigma points but the center, which share one weight
+  static const int n_outer_sig_ = n_sig_ - (Points::has_center_ ? 1 : 0);
+  static const int n_z_laser_ = 2;
+  static const int n_z_radar_ = RadarMeasurementModel::n_z_;
+
+  ///* Prediction: augmented mean, noise standard deviations and sigma points
+  Eigen::Matrix<double, NAUG, 1> x_aug;
+  Eigen::Matrix<double, NAUG - NX, 1> noise;
+  Eigen::Matrix<double, NAUG, n_sig_> Xsig_aug;
+  Eigen::Matrix<double, NX, 1> x_diff;
+
+  ///* square-root mode: stacked factors, their QR and the radar downdate vectors
+  Eigen::Matrix<double, n_outer_sig_, NX> D_pred;
+  Eigen::HouseholderQR<Eigen::Matrix<double, n_outer_sig_, NX> > qr_pred;
+  Eigen::Matrix<double, NX, NX> A_laser;
+  Eigen::Matrix<double, NX + n_z_laser_, NX> D_laser;
+  Eigen::HouseholderQR<Eigen::Matrix<double, NX + n_z_laser_, NX> > qr_laser;
+  Eigen::LLT<Eigen::Matrix<double, n_z_radar_, n_z_radar_> > llt_radar;
+  Eigen::Matrix<double, NX, n_z_radar_> U_radar;
+  Eigen::LLT<Eigen::Matrix<double, NX, NX> > llt_state;
+
+  ///* the factor of P_ the sigma points are drawn with, without square roots
+  Eigen::Matrix<double, NX, NX> L_state;
+
+  ///* the state sigma points with one column per component, as the process
+  ///* model propagates them
+  Eigen::Matrix<double, n_state_sig_, NAUG> Xsig_aug_t;
+  Eigen::Matrix<double, n_state_sig_, NX> Xsig_pred_t;
+
+  ///* UpdateLidar: the rows of P_ the linear measurement model selects
+  Eigen::Matrix<double, n_z_laser_, NX> HP_laser;
+  Eigen::Matrix<double, n_z_laser_, 1> z_diff_laser;
+  Eigen::Matrix<double, n_z_laser_, n_z_laser_> S_laser;
+  typename Solver::template Factorization<n_z_laser_> solver_laser;
+  Eigen::Matrix<double, n_z_laser_, NX> Kt_laser;
+  Eigen::Matrix<double, NX, n_z_laser_> K_laser;
+
+  ///* UpdateRadar: measurement sigma points and moments
+  Eigen::Matrix<double, n_z_radar_, n_sig_> Zsig_radar;
+  Eigen::Matrix<double, n_z_radar_, 1> z_pred_radar;
+  Eigen::Matrix<double, n_z_radar_, 1> z_diff_radar;
+  Eigen::Matrix<double, n_z_radar_, n_z_radar_> S_radar;
+  typename Solver::template Factorization<n_z_radar_> solver_radar;
+  Eigen::Matrix<double, NX, n_z_radar_> Tc_radar;
+  ///* the Jacobian of the radar model, when the update is linearized
+  Eigen::Matrix<double, n_z_radar_, NX> H_radar;
+  Eigen::Matrix<double, n_z_radar_, NX> Kt_radar;
+  Eigen::Matrix<double, NX, n_z_radar_> K_radar;
+
+  ///* FuseMeasurements: the information the measurements add and their
+  ///* weighted residuals, the statistical radar model H with the noise it
+  ///* leaves out, and the posterior covariance P (I + J P)^-1 is solved for
+  Eigen::Matrix<double, NX, NX> J_fused;
+  Eigen::Matrix<double, NX, 1> g_fused;
+  Eigen::Matrix<double, n_z_laser_, 1> nu_laser_fused;
+  Eigen::Matrix<double, n_z_radar_, 1> nu_radar_fused;
+  Eigen::Matrix<double, n_z_radar_, NX> H_fused;
+  Eigen::Matrix<double, n_z_radar_, n_z_radar_> R_fused;
+  Eigen::Matrix<double, n_z_radar_, NX> RiH_fused;
+  Eigen::Matrix<double, NX, NX> A_fused;
+  Eigen::PartialPivLU<Eigen::Matrix<double, NX, NX> > lu_fused;
+  Eigen::Matrix<double, NX, NX> P_fused;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/**
+ * Unscented Kalman filter for the CTRV motion model with compile-time
+ * dimensions. NX is the state dimension and NAUG the dimension of the state
+ * augmented with the process noise terms; the CTRV filter is UKF<5, 7>.
+ * Solver is the policy that applies the inverse innovation covariance in
+ * the updates (see innovation_solver.h) and Points the sigma-point scheme
+ * (see sigma_points.h), and Sensors the SensorSet it takes measurements
+ * of: those of other sensors start the track but are ignored after that,
+ * as with the use_laser_ and use_radar_ of the configuration, and their
+ * updates are compiled out. The prediction and the radar update run the
+ * unscented transform of unscented_transform.h with the policies
+ * ProcessModel and RadarModel; the lidar update is linear.
+ *
+ * Each filter starts on a cache line and ends on one, so filters used by
+ * different threads never share a line; the sensor noise, flags and noise
+ * covariances are read from a UKFConfig that filters share, the weights
+ * from Points.
+ */
+template <int NX, int NAUG, class Solver = LdltSolver, class Points = ScaledSigmaPoints<NAUG>,
+          class Sensors = FusedSensors>
+class alignas(kCacheLineSize) UKF {
 public:
-  long previous_timestamp_ = 0;
-  ///* initially set to false, set to true in first call of ProcessMeasurement
-  bool is_initialized_;
+  ///* the model policies of the unscented transform
+  typedef CTRVProcessModel ProcessModel;
+  typedef RadarMeasurementModel RadarModel;
+
+  static_assert(NX == ProcessModel::n_x_ && NAUG == NX + ProcessModel::n_noise_,
+                "the CTRV process model needs a 5-d state and 2 noise terms");
+  static_assert(NAUG == Points::n_, "the sigma points must span the augmented state");
+
+  ///* number of sigma points
+  static const int n_sig_ = Points::n_points_;
 
-  ///* if this is false, laser measurements will be ignored (except for init)
-  bool use_laser_;
+  typedef Eigen::Matrix<double, NX, 1> StateVector;
+  typedef Eigen::Matrix<double, NX, NX> StateMatrix;
+  typedef Eigen::Matrix<double, NAUG, 1> AugStateVector;
+  typedef Eigen::Matrix<double, NAUG, NAUG> AugStateMatrix;
+  typedef Eigen::Matrix<double, NX, n_sig_> SigmaMatrix;
+  typedef Eigen::Matrix<double, NAUG, n_sig_> AugSigmaMatrix;
+  typedef Eigen::Matrix<double, n_sig_, 1> WeightVector;
 
-  ///* if this is false, radar measurements will be ignored (except for init)
-  bool use_radar_;
+private:
+  ///* read-only, on the first cache line with the vtable pointer
+  const UKFConfig *config_;
+
+  ///* whether Xsig_pred_ still spreads x_ and P_, i.e. no update since the
+  ///* last prediction
+  bool sigma_points_current_;
+
+  ///* whether the radar moments in the workspace are those of Xsig_pred_,
+  ///* computed ahead of the update by PredictMeasurement
+  bool radar_moments_current_;
+
+  ///* factorizations of the covariance in a row that failed, and the
+  ///* measurements in a row with NIS beyond the divergence bound, for
+  ///* Diverged
+  int indefinite_;
+  int outlying_;
+
+public:
+  ///* the state every step reads and writes, together on cache lines of its
+  ///* own, apart from the configuration and the diagnostics
 
   ///* state vector: [pos1 pos2 vel_abs yaw_angle yaw_rate] in SI units and rad
-  VectorXd x_;
+  alignas(kCacheLineSize) StateVector x_;
 
   ///* state covariance matrix
-  MatrixXd P_;
+  StateMatrix P_;
+
+  ///* lower triangular square root of P_, only maintained in square-root mode
+  StateMatrix S_;
 
   ///* predicted sigma points matrix
-  MatrixXd Xsig_pred_;
+  SigmaMatrix Xsig_pred_;
 
   ///* time when the state is true, in us
   long long time_us_;
 
-  ///* Process noise standard deviation longitudinal acceleration in m/s^2
-  double std_a_;
-
-  ///* Process noise standard deviation yaw acceleration in rad/s^2
-  double std_yawdd_;
+  ///* time the filter has been advanced to, in us; a prediction from
+  ///* time_us_ is pending while the two differ
+  long long pending_us_;
 
-  ///* Laser measurement noise standard deviation position1 in m
-  double std_laspx_;
-
-  ///* Laser measurement noise standard deviation position2 in m
-  double std_laspy_;
-
-  ///* Radar measurement noise standard deviation radius in m
-  double std_radr_;
-
-  ///* Radar measurement noise standard deviation angle in rad
-  double std_radphi_;
+  ///* initially set to false, set to true in first call of ProcessMeasurement
+  bool is_initialized_;
 
-  ///* Radar measurement noise standard deviation radius change in m/s
-  double std_radrd_ ;
+  ///* if this is true, the covariance is propagated as its Cholesky factor S_
+  ///* (square-root UKF); set it before the first measurement
+  bool use_square_root_;
 
-  ///* Weights of sigma points
-  VectorXd weights_;
+  ///* if this is true, every radar update is linearized around the mean,
+  ///* as by an EKF, whatever the spread of the state (see
+  ///* UKFConfig::linearize_radar_); for a session of a cheaper QoS tier
+  bool always_linearize_;
 
   ///* State dimension
-  int n_x_;
+  static const int n_x_ = NX;
 
   ///* Augmented state dimension
-  int n_aug_;
+  static const int n_aug_ = NAUG;
 
-  ///* Sigma point spreading parameter
-  double lambda_;
+  long long previous_timestamp_ = 0;
 
   ///* the NIS for radar
   double NIS_radar_;
@@ -73,12 +200,67 @@ public:
   ///* the NIS for laser
   double NIS_laser_;
 
+  ///* whether the last measurement's NIS was above the gate of its sensor
+  ///* (UKFConfig::gate_laser_ and gate_radar_), so that it updated nothing;
+  ///* its NIS is still reported
+  bool rejected_;
+
+  ///* whether the last radar update was linearized around the mean, the
+  ///* spread of the state being small enough for it (see
+  ///* UKFConfig::linearize_radar_), rather than unscented
+  bool linearized_;
+
+  ///* measurements rejected in a row; after kMaxRejections the next one
+  ///* updates the filter whatever its NIS, as a run that long means the
+  ///* filter rather than the sensor is off, as from a generic prior far
+  ///* from the target
+  static const int kMaxRejections = 3;
+  int rejections_;
+
+  ///* NIS values of the 99.9% chi-square bound for 2 and 3 degrees of
+  ///* freedom; kDivergenceRun measurements in a row beyond that of their
+  ///* sensor mean the filter has diverged
+  static const double kDivergenceNISLaser;
+  static const double kDivergenceNISRadar;
+  static const int kDivergenceRun = 10;
+
+  ///* factorizations of the covariance in a row that may fail before the
+  ///* filter has diverged: a single indefinite step, from rounding in the
+  ///* updates, is survived by the partial factor
+  static const int kIndefiniteRun = 2;
+
+  ///* whether the last measurement found the filter diverged, its state
+  ///* not finite, its covariance not positive definite kIndefiniteRun
+  ///* times in a row or its NIS beyond the bound kDivergenceRun times, and
+  ///* so started it again from that measurement as if it were the first
+  bool reinitialized_;
+
+  ///* the times that happened since the filter was constructed or Reset
+  int reinitializations_;
+
+  ///* temporaries of Prediction and the updates, allocated with the filter
+  UKFWorkspace<NX, NAUG, Solver, Points> workspace_;
+
 
   /**
-   * Constructor
+   * Constructor, with the simulator's sensor profile
    */
   UKF();
 
+  /**
+   * Constructor
+   * @param config The sensor profile, shared with other filters; it must
+   * outlive this filter
+   */
+  explicit UKF(const UKFConfig &config);
+
+  ///* the sensors used and the noise assumed
+  const UKFConfig &config() const { return *config_; }
+
+  ///* another sensor profile for the next steps, keeping the state; it
+  ///* must outlive this filter (see config_registry.h)
+  void set_config(const UKFConfig &config) { config_ = &config; }
+
   /**
    * Destructor
    */
@@ -88,7 +270,120 @@ public:
    * ProcessMeasurement
    * @param meas_package The latest measurement data of either radar or laser
    */
-  void ProcessMeasurement(MeasurementPackage meas_package);
+  void ProcessMeasurement(const MeasurementPackage &meas_package);
+
+  /**
+   * Returns the filter to its state before the first measurement, keeping
+   * its configuration and use_square_root_, so that a pooled filter can
+   * start a new track without being constructed again
+   */
+  void Reset();
+
+  /**
+   * Processes measurements in time order, predicting once for each run of
+   * measurements with the same timestamp. Within a run the radar updates
+   * come first, as they use the sigma points of the prediction while the
+   * linear lidar update needs none; a further radar measurement of the same
+   * instant only redraws the sigma points around the updated state.
+   * @param measurements The measurements, ordered by timestamp
+   * @param count Number of measurements
+   */
+  void ProcessMeasurements(const MeasurementPackage *measurements, size_t count);
+
+  /**
+   * Updates the filter with measurements of one instant, as many sensors
+   * report the same target, in one step of information form rather than
+   * one update each. The prediction and, for radar, the unscented moments
+   * are computed once; each sensor kind then adds the information
+   * H^T R^-1 H of its statistically linearized model, H = Tc^T P^-1 with R
+   * grown by the linearization error S - H Tc, so that a single measurement
+   * updates exactly as UpdateLidar or UpdateRadar would. A further
+   * measurement of a kind only adds its residual. Each is gated on its NIS
+   * against the prior; NIS_laser_ and NIS_radar_ hold the last of each
+   * kind, and rejected_ is set if none was used. An uninitialized filter
+   * starts from the first measurement.
+   * @param measurements The measurements, all of the same timestamp
+   * @param count Number of measurements
+   */
+  void FuseMeasurements(const MeasurementPackage *measurements, size_t count);
+
+  /**
+   * Advances the filter to timestamp (in us) without predicting yet: the
+   * prediction runs once the state is needed, by a measurement the filter
+   * uses or StateAt, over everything since the last one. Filters nobody
+   * updates or reads thus cost nothing.
+   */
+  void AdvanceTo(long long timestamp) { pending_us_ = timestamp; }
+
+  /**
+   * The state at timestamp (in us), predicted now if it is not yet; x_ and
+   * P_ are then valid at that time. Timestamps go forward as those of the
+   * measurements do.
+   */
+  const StateVector &StateAt(long long timestamp);
+
+  /**
+   * The state at timestamp (in us), extrapolated from time_us_ without
+   * touching the filter, for consumers that poll between measurements. The
+   * mean alone is one closed-form CTRV step of x_ without noise; its
+   * covariance as well takes the unscented prediction Prediction would run,
+   * on scratch of its own. Before initialization the state is x_ and P_.
+   */
+  StateVector Extrapolate(long long timestamp) const;
+  void Extrapolate(long long timestamp, StateVector *x, StateMatrix *P) const;
+
+  /**
+   * The estimate as the RMSE and the clients take it, [p_x p_y v_x v_y],
+   * into estimate, and if covariance is not null its covariance, P_ through
+   * the Jacobian of the conversion. The sine and cosine of the yaw are
+   * taken once for both.
+   */
+  void CartesianEstimate(Eigen::Vector4d *estimate, Eigen::Matrix4d *covariance = nullptr) const;
+
+  /**
+   * The measurement a sensor is expected to report at timestamp (in us) and
+   * its innovation covariance with the sensor noise, as the update would
+   * compute them, for gating and associating detections before updating
+   * (see tracker.h). Predicts to timestamp; a radar update that follows
+   * reuses the moments. The filter must be initialized.
+   * @return The measurement dimension, 2 for lidar and 3 for radar; only
+   * that many rows and columns of z_pred and S are set
+   */
+  int PredictMeasurement(MeasurementPackage::SensorType sensor, long long timestamp,
+                         Eigen::Vector3d *z_pred, Eigen::Matrix3d *S);
+
+  /**
+   * The NIS the measurement would have, from the moments of
+   * PredictMeasurement, without updating the filter: what the gate of the
+   * update tests, for scoring candidate associations. Predicts to the
+   * measurement's timestamp; the filter must be initialized.
+   */
+  double MeasurementNIS(const MeasurementPackage &meas_package);
+
+  /**
+   * The state of the filter at one time, to return to it later and filter
+   * again from there (see measurement_history.h)
+   */
+  struct Checkpoint {
+    StateVector x;
+    StateMatrix P;
+    StateMatrix S;
+    long long time_us;
+    bool initialized;
+  };
+
+  void Save(Checkpoint *checkpoint) const;
+
+  ///* returns to a saved state; the diagnostics are those of the last step
+  void Restore(const Checkpoint &checkpoint);
+
+  /**
+   * The cross-covariance of the state before the last prediction with the
+   * state after it, from the sigma points the prediction spread and
+   * propagated, as an unscented RTS smoother needs it (see
+   * fixed_lag_smoother.h). Valid right after a prediction, before an update.
+   */
+  void PredictionCrossCovariance(StateMatrix *C) const;
 
   /**
    * Prediction Predicts sigma points, the state, and the state covariance
@@ -101,13 +396,111 @@ public:
    * Updates the state and the state covariance matrix using a laser measurement
    * @param meas_package The measurement at k+1
    */
-  void UpdateLidar(MeasurementPackage meas_package);
+  void UpdateLidar(const MeasurementPackage &meas_package);
 
   /**
    * Updates the state and the state covariance matrix using a radar measurement
    * @param meas_package The measurement at k+1
    */
-  void UpdateRadar(MeasurementPackage meas_package);
+  void UpdateRadar(const MeasurementPackage &meas_package);
+
+  CACHE_ALIGNED_OPERATOR_NEW
+
+private:
+  void Initialize();
+
+  ///* calls for the sensor SensorSet::Dispatch finds: its part of the first
+  ///* state, and the prediction and update of a measurement of it
+  struct Starter {
+    UKF *filter;
+    const MeasurementPackage *meas_package;
+    template <class Sensor>
+    void Visit() const { Sensor::Initialize(*filter, *meas_package); }
+  };
+  struct Updater {
+    UKF *filter;
+    const MeasurementPackage *meas_package;
+    template <class Sensor>
+    void Visit() const { filter->template UpdateWith<Sensor>(*meas_package); }
+  };
+
+  template <class Sensor>
+  void UpdateWith(const MeasurementPackage &meas_package);
+
+  /**
+   * Spreads Xsig_pred_ around the current x_ and P_ as a prediction over no
+   * time would, without propagating: the process noise has no effect then,
+   * so only the state rows of the units move the points
+   */
+  void RedrawSigmaPoints();
+
+  /**
+   * Whether the radar model is close enough to linear over the spread of
+   * the state for LinearizeRadar to stand in for the unscented moments
+   */
+  bool RadarNearlyLinear() const;
+
+  /**
+   * The radar moments in the workspace, z_pred, S without the sensor noise
+   * and Tc, from the Jacobian of the radar model at x_: h(x), H P H^T and
+   * P H^T, without projecting the sigma points
+   */
+  void LinearizeRadar();
+
+  ///* whether a measurement of the given NIS is rejected by gate, counting
+  ///* the rejections in a row
+  bool Gated(double nis, double gate);
+
+  /**
+   * Whether the filter has diverged after a measurement of the sensor, in
+   * O(1): counts its NIS against the divergence bound, and checks that the
+   * covariance factored and the state is finite.
+   */
+  bool Diverged(MeasurementPackage::SensorType sensor);
+
+  /**
+   * Starts the filter again from meas_package, through the initialization
+   * branch of ProcessMeasurement.
+   */
+  void Reinitialize(const MeasurementPackage &meas_package);
+
+  /**
+   * Runs the pending prediction, or with sigma_points and none pending makes
+   * Xsig_pred_ current for a radar update
+   * @return Whether there was anything to do
+   */
+  bool PredictPending(bool sigma_points);
+
+  /**
+   * Recomputes S_ from P_ by Cholesky factorization; used at initialization
+   * and when a square-root downdate fails
+   */
+  void RefactorCovariance();
 };
 
+///* the sigma points of the CTRV filter, chosen per deployment by the
+///* UKF_SIGMA_POINTS build option
+#if defined(UKF_SIGMA_POINTS_SIMPLEX)
+typedef SimplexSigmaPoints<7> CTRVSigmaPoints;
+#elif defined(UKF_SIGMA_POINTS_CUBATURE)
+typedef CubatureSigmaPoints<7> CTRVSigmaPoints;
+#else
+typedef ScaledSigmaPoints<7> CTRVSigmaPoints;
+#endif
+
+///* the small-matrix arithmetic of the CTRV filter, Eigen's or the kernels
+///* of small_matrix.h, chosen by the UKF_SMALL_MATRIX build option
+#if defined(UKF_SMALL_MATRIX_KERNELS)
+typedef SmallMatrixSolver CTRVSolver;
+#else
+typedef LdltSolver CTRVSolver;
+#endif
+
+///* the CTRV filter used by the simulator server and all tools
+typedef UKF<5, 7, CTRVSolver, CTRVSigmaPoints> CTRVUKF;
+
+///* the CTRV filter of one sensor, for nodes that only have that sensor
+typedef UKF<5, 7, CTRVSolver, CTRVSigmaPoints, LaserOnlySensors> LaserCTRVUKF;
+typedef UKF<5, 7, CTRVSolver, CTRVSigmaPoints, RadarOnlySensors> RadarCTRVUKF;
+
 #endif /* UKF_H */
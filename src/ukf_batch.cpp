@@ -0,0 +1,466 @@
+#include "ukf_batch.h"
+#include "angle.h"
+#include "cholesky_kernel.h"
+#include "ctrv_kernel.h"
+#include "lidar_kernel.h"
+#include "radar_kernel.h"
+#include "ukf_batch_lane.h"
+#include <cmath>
+
+using std::vector;
+
+namespace {
+
+const int n_x = DoubleUKFBatch::n_x_;
+const int n_aug = DoubleUKFBatch::n_aug_;
+const int n_sig = DoubleUKFBatch::n_sig_;
+const int n_p = DoubleUKFBatch::n_p_;
+const int kLanes = DoubleUKFBatch::kLanes;
+
+/**
+* Lower Cholesky factor of every lane's covariance, written into L, by the
+* lanes together (Cholesky5). A covariance that is not positive definite,
+* from rounding in the updates, is factored again by Eigen's LLT, whose
+* partial factor the track survives a step on as UKF does. Returns the
+* number of those.
+*/
+template <class Scalar>
+int FactorCovariances(typename UKFBatch<Scalar>::Block &b) {
+	const Scalar *P[n_p];
+	Scalar *L[n_x * n_x];
+	for (int e = 0; e < n_p; e++) {
+		P[e] = b.P[e];
+	}
+	for (int m = 0; m < n_x * n_x; m++) {
+		L[m] = b.L[m];
+	}
+	unsigned char failed[kLanes];
+	const int indefinite = Cholesky5(P, L, b.count, failed);
+	if (!indefinite) {
+		return 0;
+	}
+
+	Eigen::Matrix<Scalar, n_x, n_x> Pj;
+	Eigen::LLT<Eigen::Matrix<Scalar, n_x, n_x> > llt;
+	for (int j = 0; j < b.count; j++) {
+		if (!failed[j]) {
+			continue;
+		}
+		// the factorization reads the lower triangle
+		for (int r = 0, e = 0; r < n_x; r++) {
+			for (int c = r; c < n_x; c++, e++) {
+				Pj(c, r) = b.P[e][j];
+			}
+		}
+		llt.compute(Pj);
+		Eigen::Matrix<Scalar, n_x, n_x> Lj = llt.matrixL();
+		for (int m = 0; m < n_x * n_x; m++) {
+			b.L[m][j] = Lj(m / n_x, m % n_x);
+		}
+	}
+	return indefinite;
+}
+
+/**
+* Generates the augmented sigma points of every lane and propagates them
+* through the CTRV model into b.Xsig. The augmented covariance is block
+* diagonal, so its factor is L of P_ plus the two noise standard deviations.
+*
+* The noise enters the model additively, as G(yaw, dt) nu with G independent
+* of nu, so the four points offset in nu alone are the central point plus a
+* column of G scaled by their offset: only the other 11 go through the
+* kernel. G depends on the lane but for the sine and cosine of its yaw on dt
+* alone, and is computed once per lane rather than once per point.
+*/
+template <class Scalar>
+void PredictSigmaPoints(typename UKFBatch<Scalar>::Block &b, const UKFBatch<Scalar> &f) {
+	const Scalar c = std::sqrt(f.lambda_ + n_aug);
+
+	// nonzero entries of G: the displacement, velocity, yaw and yaw rate a
+	// unit of nu_a or nu_yawdd adds over dt
+	Scalar a_p_x[kLanes], a_p_y[kLanes], a_v[kLanes], yawdd_yaw[kLanes], yawdd_yawd[kLanes];
+	for (int j = 0; j < b.count; j++) {
+		const Scalar dt = b.dt[j];
+		const Scalar half_dt2 = Scalar(0.5) * dt * dt;
+		a_p_x[j] = half_dt2 * std::cos(b.x[3][j]);
+		a_p_y[j] = half_dt2 * std::sin(b.x[3][j]);
+		a_v[j] = dt;
+		yawdd_yaw[j] = half_dt2;
+		yawdd_yawd[j] = dt;
+	}
+
+	for (int s = 0; s < n_sig; s++) {
+		// column and sign of the factor this sigma point is offset by
+		const int col = s == 0 ? -1 : (s - 1) % n_aug;
+		const Scalar sign = s <= n_aug ? c : -c;
+
+		if (col == n_x) {
+			const Scalar nu_a = sign * Scalar(f.std_a_);
+			for (int j = 0; j < b.count; j++) {
+				b.Xsig[0][s][j] = b.Xsig[0][0][j] + nu_a * a_p_x[j];
+				b.Xsig[1][s][j] = b.Xsig[1][0][j] + nu_a * a_p_y[j];
+				b.Xsig[2][s][j] = b.Xsig[2][0][j] + nu_a * a_v[j];
+				b.Xsig[3][s][j] = b.Xsig[3][0][j];
+				b.Xsig[4][s][j] = b.Xsig[4][0][j];
+			}
+			continue;
+		}
+		if (col == n_x + 1) {
+			const Scalar nu_yawdd = sign * Scalar(f.std_yawdd_);
+			for (int j = 0; j < b.count; j++) {
+				for (int k = 0; k < 3; k++) {
+					b.Xsig[k][s][j] = b.Xsig[k][0][j];
+				}
+				b.Xsig[3][s][j] = b.Xsig[3][0][j] + nu_yawdd * yawdd_yaw[j];
+				b.Xsig[4][s][j] = b.Xsig[4][0][j] + nu_yawdd * yawdd_yawd[j];
+			}
+			continue;
+		}
+
+		Scalar aug[n_x + 2][kLanes];
+		for (int k = 0; k < n_x; k++) {
+			for (int j = 0; j < b.count; j++) {
+				aug[k][j] = b.x[k][j];
+				if (col >= 0) {
+					aug[k][j] += sign * b.L[k * n_x + col][j];
+				}
+			}
+		}
+		for (int j = 0; j < b.count; j++) {
+			aug[n_x][j] = 0;
+			aug[n_x + 1][j] = 0;
+		}
+
+		const Scalar *in[n_x + 2];
+		Scalar *out[n_x];
+		for (int k = 0; k < n_x + 2; k++) {
+			in[k] = aug[k];
+		}
+		for (int k = 0; k < n_x; k++) {
+			out[k] = b.Xsig[k][s];
+		}
+		PropagateCTRV(in, out, b.count, b.dt);
+	}
+}
+
+/**
+* Predicted mean and covariance of every lane from b.Xsig.
+*/
+template <class Scalar>
+void PredictMoments(typename UKFBatch<Scalar>::Block &b, const UKFBatch<Scalar> &f) {
+	for (int k = 0; k < n_x; k++) {
+		for (int j = 0; j < b.count; j++) {
+			Scalar sum = 0;
+			for (int s = 0; s < n_sig; s++) {
+				sum += f.weights_[s] * b.Xsig[k][s][j];
+			}
+			b.x[k][j] = sum;
+		}
+	}
+
+	for (int e = 0; e < n_p; e++) {
+		for (int j = 0; j < b.count; j++) {
+			b.P[e][j] = 0;
+		}
+	}
+	for (int s = 0; s < n_sig; s++) {
+		const Scalar w = f.weights_[s];
+		for (int j = 0; j < b.count; j++) {
+			Scalar d[n_x];
+			for (int k = 0; k < n_x; k++) {
+				d[k] = b.Xsig[k][s][j] - b.x[k][j];
+			}
+			//angle normalization
+			d[3] = NormalizeAngle(d[3]);
+			for (int r = 0, e = 0; r < n_x; r++) {
+				for (int c = r; c < n_x; c++, e++) {
+					b.P[e][j] += w * d[r] * d[c];
+				}
+			}
+		}
+	}
+}
+
+/**
+* Prediction of every lane; returns the covariances FactorCovariances found
+* not positive definite.
+*/
+template <class Scalar>
+int Predict(typename UKFBatch<Scalar>::Block &b, const UKFBatch<Scalar> &f) {
+	const int indefinite = FactorCovariances<Scalar>(b);
+	PredictSigmaPoints(b, f);
+	PredictMoments(b, f);
+	return indefinite;
+}
+
+/**
+* Sigma points of every lane spread around its x and P as a prediction over
+* no time would, for a radar update at the instant of the one before: the
+* process noise moves nothing then, so the points offset in it are the
+* central one, and nothing goes through the CTRV kernel. Needs b.L.
+*/
+template <class Scalar>
+void RedrawSigmaPoints(typename UKFBatch<Scalar>::Block &b, const UKFBatch<Scalar> &f) {
+	const Scalar c = std::sqrt(f.lambda_ + n_aug);
+	for (int s = 0; s < n_sig; s++) {
+		const int col = s == 0 ? -1 : (s - 1) % n_aug;
+		const Scalar sign = s <= n_aug ? c : -c;
+		for (int k = 0; k < n_x; k++) {
+			for (int j = 0; j < b.count; j++) {
+				b.Xsig[k][s][j] = b.x[k][j];
+				if (col >= 0 && col < n_x) {
+					b.Xsig[k][s][j] += sign * b.L[k * n_x + col][j];
+				}
+			}
+		}
+	}
+}
+
+/**
+* Radar update of every lane: the measurement sigma points of all lanes
+* (ProjectRadar), then each lane's update (lane::UpdateRadar).
+*/
+template <class Scalar>
+void UpdateRadar(typename UKFBatch<Scalar>::Block &b, const lane::Model<Scalar> &model, bool approximate) {
+	for (int s = 0; s < n_sig; s++) {
+		const Scalar *in[4] = {b.Xsig[0][s], b.Xsig[1][s], b.Xsig[2][s], b.Xsig[3][s]};
+		Scalar *out[3] = {b.Zsig[0][s], b.Zsig[1][s], b.Zsig[2][s]};
+		ProjectRadar(in, out, b.count, approximate);
+	}
+	for (int j = 0; j < b.count; j++) {
+		b.NIS[j] = lane::UpdateRadar(model, b.measurement[j]->raw_measurements_.data(), &b.x[0][j], &b.P[0][j],
+		                             kLanes, &b.Xsig[0][0][j], &b.Zsig[0][0][j], kLanes);
+	}
+}
+
+/**
+* Linear lidar update of every lane, the lanes together (lidar_kernel.h).
+*/
+template <class Scalar>
+void UpdateLidar(typename UKFBatch<Scalar>::Block &b, const lane::Model<Scalar> &model) {
+	Scalar z[2][kLanes];
+	for (int j = 0; j < b.count; j++) {
+		z[0][j] = Scalar(b.measurement[j]->raw_measurements_(0));
+		z[1][j] = Scalar(b.measurement[j]->raw_measurements_(1));
+	}
+	const Scalar *measured[2] = {z[0], z[1]};
+	Scalar *x[n_x];
+	Scalar *P[n_p];
+	for (int k = 0; k < n_x; k++) {
+		x[k] = b.x[k];
+	}
+	for (int e = 0; e < n_p; e++) {
+		P[e] = b.P[e];
+	}
+	::UpdateLidar(measured, x, P, model.R_laser, b.NIS, b.count);
+}
+
+}
+
+template <class Scalar>
+UKFBatch<Scalar>::UKFBatch(size_t capacity) {
+	use_laser_ = true;
+	use_radar_ = true;
+	std_a_ = 1.0;
+	std_yawdd_ = 1.0;
+	std_laspx_ = 0.15;
+	std_laspy_ = 0.15;
+	std_radr_ = 0.3;
+	std_radphi_ = 0.03;
+	std_radrd_ = 0.3;
+	approximate_radar_ = false;
+	indefinite_ = 0;
+
+	lambda_ = Scalar(3 - n_aug_);
+	weights_[0] = lambda_ / (lambda_ + n_aug_);
+	for (int i = 1; i < n_sig_; i++) {
+		weights_[i] = Scalar(0.5) / (n_aug_ + lambda_);
+	}
+
+	for (int k = 0; k < n_x_; k++) {
+		x_[k].reserve(capacity);
+	}
+	for (int e = 0; e < n_p_; e++) {
+		P_[e].reserve(capacity);
+	}
+	time_us_.reserve(capacity);
+	is_initialized_.reserve(capacity);
+	NIS_radar_.reserve(capacity);
+	NIS_laser_.reserve(capacity);
+	wave_of_.reserve(capacity);
+	wave_ = 0;
+
+	radar_block_ = new Block;
+	lidar_block_ = new Block;
+	radar_block_->count = 0;
+	lidar_block_->count = 0;
+}
+
+template <class Scalar>
+UKFBatch<Scalar>::~UKFBatch() {
+	delete radar_block_;
+	delete lidar_block_;
+}
+
+template <class Scalar>
+size_t UKFBatch<Scalar>::AddTrack() {
+	for (int k = 0; k < n_x_; k++) {
+		x_[k].push_back(0);
+	}
+	for (int e = 0; e < n_p_; e++) {
+		P_[e].push_back(0);
+	}
+	time_us_.push_back(0);
+	is_initialized_.push_back(false);
+	NIS_radar_.push_back(0);
+	NIS_laser_.push_back(0);
+	wave_of_.push_back(0);
+	return size() - 1;
+}
+
+template <class Scalar>
+Eigen::Matrix<double, UKFBatch<Scalar>::n_x_, 1> UKFBatch<Scalar>::State(size_t track) const {
+	Eigen::Matrix<double, n_x_, 1> x;
+	for (int k = 0; k < n_x_; k++) {
+		x(k) = x_[k][track];
+	}
+	return x;
+}
+
+template <class Scalar>
+Eigen::Matrix<double, UKFBatch<Scalar>::n_x_, UKFBatch<Scalar>::n_x_> UKFBatch<Scalar>::Covariance(size_t track) const {
+	Eigen::Matrix<double, n_x_, n_x_> P;
+	for (int r = 0; r < n_x_; r++) {
+		for (int c = 0; c < n_x_; c++) {
+			P(r, c) = P_[lane::Packed(r, c)][track];
+		}
+	}
+	return P;
+}
+
+/**
+* Same initialization as the first call of UKF::ProcessMeasurement.
+*/
+template <class Scalar>
+void UKFBatch<Scalar>::Initialize(size_t t, const MeasurementPackage &meas_package) {
+	const bool radar = meas_package.sensor_type_ == MeasurementPackage::RADAR;
+	Scalar x[n_x_], P[n_p_];
+	lane::Initialize(lane::ModelOf<Scalar>(*this), radar, meas_package.raw_measurements_.data(), x, P, 1);
+	for (int k = 0; k < n_x_; k++) {
+		x_[k][t] = x[k];
+	}
+	for (int e = 0; e < n_p_; e++) {
+		P_[e][t] = P[e];
+	}
+	(radar ? NIS_radar_ : NIS_laser_)[t] = 0;
+	time_us_[t] = meas_package.timestamp_;
+	is_initialized_[t] = true;
+}
+
+template <class Scalar>
+void UKFBatch<Scalar>::ProcessMeasurements(const size_t *tracks,
+                                           const MeasurementPackage *measurements,
+                                           size_t count) {
+	// a wave holds at most one measurement per track; when a track repeats,
+	// the pending blocks are flushed so its measurements apply in order
+	wave_++;
+	for (size_t i = 0; i < count; i++) {
+		const size_t t = tracks[i];
+		if (wave_of_[t] == wave_) {
+			Flush(radar_block_);
+			Flush(lidar_block_);
+			wave_++;
+		}
+		wave_of_[t] = wave_;
+
+		const MeasurementPackage &m = measurements[i];
+		if (!is_initialized_[t]) {
+			Initialize(t, m);
+		}
+		else if (m.sensor_type_ == MeasurementPackage::RADAR) {
+			Enqueue(radar_block_, t, m);
+		}
+		else if (m.sensor_type_ == MeasurementPackage::LASER) {
+			Enqueue(lidar_block_, t, m);
+		}
+	}
+	Flush(radar_block_);
+	Flush(lidar_block_);
+}
+
+template <class Scalar>
+void UKFBatch<Scalar>::Enqueue(Block *block, size_t t, const MeasurementPackage &meas_package) {
+	const int j = block->count++;
+	block->track[j] = t;
+	block->measurement[j] = &meas_package;
+	block->dt[j] = Scalar((meas_package.timestamp_ - time_us_[t]) / 1000000.0);
+	time_us_[t] = meas_package.timestamp_;
+	for (int k = 0; k < n_x_; k++) {
+		block->x[k][j] = x_[k][t];
+	}
+	for (int e = 0; e < n_p_; e++) {
+		block->P[e][j] = P_[e][t];
+	}
+	if (block->count == kLanes) {
+		Flush(block);
+	}
+}
+
+template <class Scalar>
+void UKFBatch<Scalar>::Flush(Block *block) {
+	Block &b = *block;
+	if (!b.count) {
+		return;
+	}
+
+	const bool radar = block == radar_block_;
+	// a block of measurements all at the instants their tracks are at, as
+	// the second of a fused lidar and radar pair, has nothing to predict:
+	// the radar update only needs the points around the updated moments,
+	// and the linear lidar update not even those
+	bool elapsed = false;
+	for (int j = 0; j < b.count; j++) {
+		elapsed = elapsed || b.dt[j] != 0;
+	}
+	if (elapsed) {
+		indefinite_ += Predict(b, *this);
+	}
+	else if (radar && use_radar_) {
+		indefinite_ += FactorCovariances<Scalar>(b);
+		RedrawSigmaPoints(b, *this);
+	}
+
+	TrackArray<Scalar> &nis = radar ? NIS_radar_ : NIS_laser_;
+	if (radar ? use_radar_ : use_laser_) {
+		const lane::Model<Scalar> model = lane::ModelOf<Scalar>(*this);
+		if (radar) {
+			UpdateRadar(b, model, approximate_radar_);
+		}
+		else {
+			UpdateLidar(b, model);
+		}
+	}
+	else {
+		for (int j = 0; j < b.count; j++) {
+			b.NIS[j] = 0;
+		}
+	}
+
+	for (int j = 0; j < b.count; j++) {
+		const size_t t = b.track[j];
+		for (int k = 0; k < n_x_; k++) {
+			x_[k][t] = b.x[k][j];
+		}
+		//a turning target's yaw grows without bound, and at hundreds of rad
+		//a float no longer resolves its sine and cosine
+		x_[3][t] = NormalizeAngle(b.x[3][j]);
+		for (int e = 0; e < n_p_; e++) {
+			P_[e][t] = b.P[e][j];
+		}
+		nis[t] = b.NIS[j];
+	}
+	b.count = 0;
+}
+
+template class UKFBatch<double>;
+template class UKFBatch<float>;
@@ -0,0 +1,173 @@
+#ifndef UKF_BATCH_H_
+#define UKF_BATCH_H_
+
+#include "huge_pages.h"
+#include "measurement_package.h"
+#include "Eigen/Dense"
+#include <cstddef>
+#include <vector>
+
+/**
+ * CTRV unscented Kalman filter for many targets at once.
+ *
+ * The states and covariances of all tracks are stored in structure-of-arrays
+ * layout (all p_x contiguous, all P(0,0) contiguous, ...), each covariance
+ * packed as its upper triangle (see ukf_batch_lane.h). Measurements are
+ * processed in blocks of up to kLanes tracks: the block is gathered into lane
+ * arrays, predicted and updated with loops that run across tracks rather than
+ * within one track's 5x5 matrices, and scattered back. The filter equations
+ * are the same as UKF<5, 7>.
+ *
+ * Scalar is the precision of the stored tracks and of all filter arithmetic,
+ * double or float. In float a track takes half the memory and the CTRV
+ * kernel runs twice as many lanes per instruction; --precision-check
+ * compares the two on a replay corpus. The noise parameters stay double and
+ * are rounded where they are used.
+ *
+ * The per-track arrays are TrackArrays, which a batch of many tracks keeps
+ * on huge pages while HugePages is enabled.
+ */
+template <class Scalar>
+class UKFBatch {
+public:
+  static const int n_x_ = 5;
+  static const int n_aug_ = 7;
+  static const int n_sig_ = 2 * n_aug_ + 1;
+  ///* values of a packed covariance
+  static const int n_p_ = n_x_ * (n_x_ + 1) / 2;
+
+  ///* storage of one value of every track
+  template <class T>
+  using TrackArray = std::vector<T, HugePageAllocator<T> >;
+
+  ///* number of tracks processed together by the block kernels
+  static const int kLanes = 32;
+
+  /**
+   * Working set of one sensor type: the gathered tracks, their state and
+   * all per-lane temporaries of prediction and update.
+   */
+  struct Block {
+    int count;
+    size_t track[kLanes];
+    const MeasurementPackage *measurement[kLanes];
+    Scalar dt[kLanes];
+
+    Scalar x[n_x_][kLanes];
+    Scalar P[n_p_][kLanes];
+    Scalar L[n_x_ * n_x_][kLanes];
+    Scalar Xsig[n_x_][n_sig_][kLanes];
+    Scalar Zsig[3][n_sig_][kLanes];
+    Scalar NIS[kLanes];
+  };
+
+  ///* if this is false, laser measurements will be ignored (except for init)
+  bool use_laser_;
+
+  ///* if this is false, radar measurements will be ignored (except for init)
+  bool use_radar_;
+
+  ///* Process noise standard deviation longitudinal acceleration in m/s^2
+  double std_a_;
+
+  ///* Process noise standard deviation yaw acceleration in rad/s^2
+  double std_yawdd_;
+
+  ///* Laser measurement noise standard deviations in m
+  double std_laspx_;
+  double std_laspy_;
+
+  ///* Radar measurement noise standard deviations (m, rad, m/s)
+  double std_radr_;
+  double std_radphi_;
+  double std_radrd_;
+
+  ///* whether the bearings of the radar sigma points come from
+  ///* simd::Atan2Approximate rather than the exact simd::Atan2
+  bool approximate_radar_;
+
+  ///* Sigma point spreading parameter
+  Scalar lambda_;
+
+  ///* Weights of sigma points
+  Scalar weights_[n_sig_];
+
+  ///* state of track i, component k is x_[k][i]
+  TrackArray<Scalar> x_[n_x_];
+
+  ///* covariance of track i, entry (r, c) is P_[lane::Packed(r, c)][i]
+  TrackArray<Scalar> P_[n_p_];
+
+  ///* time when the state of each track is true, in us
+  TrackArray<long long> time_us_;
+
+  ///* per-track initialization flag
+  TrackArray<unsigned char> is_initialized_;
+
+  ///* the latest NIS of each track for radar and laser
+  TrackArray<Scalar> NIS_radar_;
+  TrackArray<Scalar> NIS_laser_;
+
+  ///* covariances the predictions found not positive definite, and so
+  ///* factored one at a time by Eigen rather than with the other lanes
+  unsigned long long indefinite_;
+
+  /**
+   * Constructor
+   * @param capacity Number of tracks to reserve storage for
+   */
+  explicit UKFBatch(size_t capacity = 0);
+
+  virtual ~UKFBatch();
+
+  /**
+   * Adds an uninitialized track and returns its index.
+   */
+  size_t AddTrack();
+
+  /**
+   * Number of tracks in the batch.
+   */
+  size_t size() const { return time_us_.size(); }
+
+  /**
+   * Predicts and updates the addressed tracks with one measurement each.
+   * A track may appear several times; its measurements are then applied in
+   * the given order. Measurements at the instant their track is at already,
+   * as the second of a fused pair, are not predicted again when a whole
+   * block of them is: radar redraws the sigma points from the factor of the
+   * covariance, and lidar uses the moments as they are.
+   * @param tracks Track index of every measurement
+   * @param measurements The measurements, count entries
+   */
+  void ProcessMeasurements(const size_t *tracks,
+                           const MeasurementPackage *measurements,
+                           size_t count);
+
+  /**
+   * Copies the state and covariance of one track into Eigen matrices, in
+   * double whatever the precision of the batch.
+   */
+  Eigen::Matrix<double, n_x_, 1> State(size_t track) const;
+  Eigen::Matrix<double, n_x_, n_x_> Covariance(size_t track) const;
+
+private:
+  Block *radar_block_;
+  Block *lidar_block_;
+
+  ///* wave number in which each track was last scheduled
+  TrackArray<unsigned long> wave_of_;
+  unsigned long wave_;
+
+  void Initialize(size_t track, const MeasurementPackage &meas_package);
+  void Enqueue(Block *block, size_t track, const MeasurementPackage &meas_package);
+  void Flush(Block *block);
+
+  UKFBatch(const UKFBatch &);
+  UKFBatch &operator=(const UKFBatch &);
+};
+
+typedef UKFBatch<double> DoubleUKFBatch;
+typedef UKFBatch<float> FloatUKFBatch;
+
+#endif /* UKF_BATCH_H_ */
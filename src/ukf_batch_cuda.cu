@@ -0,0 +1,300 @@
+#include "ukf_batch_cuda.h"
+#include <cuda_runtime.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+template <class Scalar>
+const int CudaUKFBatch<Scalar>::kThreads;
+template <class Scalar>
+const int CudaUKFBatch<Scalar>::kChunk;
+
+namespace {
+
+void Check(cudaError_t error, const char *what) {
+	if (error != cudaSuccess) {
+		std::cerr << "CUDA error " << what << ": " << cudaGetErrorString(error) << std::endl;
+		std::abort();
+	}
+}
+
+/**
+* Predicts and updates the track of each of the count records of a wave,
+* or initializes it, into results; x and P are the device arrays of all
+* tracks, stride entries per component.
+*/
+template <class Scalar>
+__global__ void ProcessWave(lane::Model<Scalar> model, bool use_laser, bool use_radar,
+                            const typename CudaUKFBatch<Scalar>::Record *records, int count,
+                            Scalar *x, Scalar *P, size_t stride,
+                            typename CudaUKFBatch<Scalar>::Result *results) {
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < count; i += blockDim.x * gridDim.x) {
+		const typename CudaUKFBatch<Scalar>::Record r = records[i];
+		Scalar *track_x = x + r.track;
+		Scalar *track_P = P + r.track;
+		Scalar nis = 0;
+		if (r.initialize) {
+			lane::Initialize(model, r.radar != 0, r.z, track_x, track_P, stride);
+		}
+		else {
+			//the thread's sigma points, in local memory
+			Scalar Xsig[lane::n_x * lane::n_sig];
+			lane::Predict(model, track_x, track_P, stride, r.dt, Xsig);
+			if (r.radar && use_radar) {
+				Scalar Zsig[3 * lane::n_sig];
+				for (int s = 0; s < lane::n_sig; s++) {
+					lane::RadarMeasurement(Xsig[s], Xsig[lane::n_sig + s], Xsig[2 * lane::n_sig + s], Xsig[3 * lane::n_sig + s],
+					                       &Zsig[s], &Zsig[lane::n_sig + s], &Zsig[2 * lane::n_sig + s]);
+				}
+				nis = lane::UpdateRadar(model, r.z, track_x, track_P, stride, Xsig, Zsig, 1);
+			}
+			else if (!r.radar && use_laser) {
+				nis = lane::UpdateLidar(model, r.z, track_x, track_P, stride);
+			}
+			//as UKFBatch::Flush, so that a float yaw keeps resolving its sine
+			track_x[3 * stride] = NormalizeAngle(track_x[3 * stride]);
+		}
+		for (int k = 0; k < lane::n_x; k++) {
+			results[i].x[k] = track_x[k * stride];
+		}
+		results[i].nis = nis;
+	}
+}
+
+}
+
+template <class Scalar>
+struct CudaUKFBatch<Scalar>::Device {
+	///* the states and covariances of capacity tracks, component by component
+	size_t capacity;
+	Scalar *x;
+	Scalar *P;
+
+	///* records and results of a wave of up to wave_capacity measurements,
+	///* staged in pinned host memory and on the device
+	size_t wave_capacity;
+	Record *staged_records;
+	Result *staged_results;
+	Record *records;
+	Result *results;
+
+	cudaStream_t streams[2];
+};
+
+template <class Scalar>
+CudaUKFBatch<Scalar>::CudaUKFBatch(size_t capacity) {
+	use_laser_ = true;
+	use_radar_ = true;
+	std_a_ = 1.0;
+	std_yawdd_ = 1.0;
+	std_laspx_ = 0.15;
+	std_laspy_ = 0.15;
+	std_radr_ = 0.3;
+	std_radphi_ = 0.03;
+	std_radrd_ = 0.3;
+
+	lambda_ = Scalar(3 - n_aug_);
+	weights_[0] = lambda_ / (lambda_ + n_aug_);
+	for (int i = 1; i < n_sig_; i++) {
+		weights_[i] = Scalar(0.5) / (n_aug_ + lambda_);
+	}
+
+	for (int k = 0; k < n_x_; k++) {
+		x_[k].reserve(capacity);
+	}
+	time_us_.reserve(capacity);
+	is_initialized_.reserve(capacity);
+	NIS_radar_.reserve(capacity);
+	NIS_laser_.reserve(capacity);
+	wave_of_.reserve(capacity);
+	wave_ = 0;
+
+	device_ = new Device();
+	for (int i = 0; i < 2; i++) {
+		Check(cudaStreamCreateWithFlags(&device_->streams[i], cudaStreamNonBlocking), "creating a stream");
+	}
+	Reserve(capacity);
+}
+
+template <class Scalar>
+CudaUKFBatch<Scalar>::~CudaUKFBatch() {
+	for (int i = 0; i < 2; i++) {
+		cudaStreamDestroy(device_->streams[i]);
+	}
+	cudaFree(device_->x);
+	cudaFree(device_->P);
+	cudaFree(device_->records);
+	cudaFree(device_->results);
+	cudaFreeHost(device_->staged_records);
+	cudaFreeHost(device_->staged_results);
+	delete device_;
+}
+
+template <class Scalar>
+bool CudaUKFBatch<Scalar>::Available() {
+	int devices = 0;
+	return cudaGetDeviceCount(&devices) == cudaSuccess && devices > 0;
+}
+
+template <class Scalar>
+size_t CudaUKFBatch<Scalar>::AddTrack() {
+	for (int k = 0; k < n_x_; k++) {
+		x_[k].push_back(0);
+	}
+	time_us_.push_back(0);
+	is_initialized_.push_back(false);
+	NIS_radar_.push_back(0);
+	NIS_laser_.push_back(0);
+	wave_of_.push_back(0);
+	return size() - 1;
+}
+
+/**
+* Grows the device arrays to hold at least capacity tracks, doubling, with
+* the tracks so far copied over and the new ones zero.
+*/
+template <class Scalar>
+void CudaUKFBatch<Scalar>::Reserve(size_t capacity) {
+	Device &d = *device_;
+	if (capacity <= d.capacity) {
+		return;
+	}
+	capacity = std::max(capacity, 2 * d.capacity);
+	Scalar *arrays[2] = {d.x, d.P};
+	const int components[2] = {n_x_, lane::n_p};
+	for (int a = 0; a < 2; a++) {
+		Scalar *grown;
+		Check(cudaMalloc(&grown, capacity * components[a] * sizeof(Scalar)), "allocating tracks");
+		Check(cudaMemset(grown, 0, capacity * components[a] * sizeof(Scalar)), "clearing tracks");
+		if (d.capacity) {
+			Check(cudaMemcpy2D(grown, capacity * sizeof(Scalar), arrays[a], d.capacity * sizeof(Scalar),
+			                   d.capacity * sizeof(Scalar), components[a], cudaMemcpyDeviceToDevice), "moving tracks");
+		}
+		cudaFree(arrays[a]);
+		arrays[a] = grown;
+	}
+	d.x = arrays[0];
+	d.P = arrays[1];
+	d.capacity = capacity;
+}
+
+template <class Scalar>
+Eigen::Matrix<double, CudaUKFBatch<Scalar>::n_x_, 1> CudaUKFBatch<Scalar>::State(size_t track) const {
+	Eigen::Matrix<double, n_x_, 1> x;
+	for (int k = 0; k < n_x_; k++) {
+		x(k) = x_[k][track];
+	}
+	return x;
+}
+
+template <class Scalar>
+Eigen::Matrix<double, CudaUKFBatch<Scalar>::n_x_, CudaUKFBatch<Scalar>::n_x_> CudaUKFBatch<Scalar>::Covariance(size_t track) const {
+	Eigen::Matrix<double, n_x_, n_x_> P = Eigen::Matrix<double, n_x_, n_x_>::Zero();
+	if (track >= device_->capacity) {
+		return P;
+	}
+	Scalar entries[lane::n_p];
+	Check(cudaMemcpy2D(entries, sizeof(Scalar), device_->P + track, device_->capacity * sizeof(Scalar),
+	                   sizeof(Scalar), lane::n_p, cudaMemcpyDeviceToHost), "reading a covariance");
+	for (int r = 0; r < n_x_; r++) {
+		for (int c = 0; c < n_x_; c++) {
+			P(r, c) = entries[lane::Packed(r, c)];
+		}
+	}
+	return P;
+}
+
+template <class Scalar>
+void CudaUKFBatch<Scalar>::ProcessMeasurements(const size_t *tracks,
+                                               const MeasurementPackage *measurements,
+                                               size_t count) {
+	// a wave holds at most one measurement per track; when a track repeats,
+	// the wave so far runs first so that its measurements apply in order
+	wave_++;
+	for (size_t i = 0; i < count; i++) {
+		const size_t t = tracks[i];
+		const MeasurementPackage &m = measurements[i];
+		if (m.sensor_type_ != MeasurementPackage::RADAR && m.sensor_type_ != MeasurementPackage::LASER) {
+			continue;
+		}
+		if (wave_of_[t] == wave_) {
+			RunWave();
+			wave_++;
+		}
+		wave_of_[t] = wave_;
+
+		Record r;
+		const int n_z = std::min((int) m.raw_measurements_.size(), 3);
+		for (int k = 0; k < 3; k++) {
+			r.z[k] = k < n_z ? m.raw_measurements_(k) : 0.0;
+		}
+		r.track = (unsigned int) t;
+		r.radar = m.sensor_type_ == MeasurementPackage::RADAR;
+		r.initialize = !is_initialized_[t];
+		r.dt = r.initialize ? Scalar(0) : Scalar((m.timestamp_ - time_us_[t]) / 1000000.0);
+		is_initialized_[t] = true;
+		time_us_[t] = m.timestamp_;
+		(r.radar ? radar_wave_ : laser_wave_).push_back(r);
+	}
+	RunWave();
+}
+
+template <class Scalar>
+void CudaUKFBatch<Scalar>::RunWave() {
+	const size_t count = radar_wave_.size() + laser_wave_.size();
+	if (!count) {
+		return;
+	}
+	Reserve(size());
+	Device &d = *device_;
+	if (count > d.wave_capacity) {
+		cudaFree(d.records);
+		cudaFree(d.results);
+		cudaFreeHost(d.staged_records);
+		cudaFreeHost(d.staged_results);
+		d.wave_capacity = std::max(count, 2 * d.wave_capacity);
+		Check(cudaMalloc(&d.records, d.wave_capacity * sizeof(Record)), "allocating a wave");
+		Check(cudaMalloc(&d.results, d.wave_capacity * sizeof(Result)), "allocating a wave");
+		Check(cudaMallocHost(&d.staged_records, d.wave_capacity * sizeof(Record)), "allocating a wave");
+		Check(cudaMallocHost(&d.staged_results, d.wave_capacity * sizeof(Result)), "allocating a wave");
+	}
+	if (!radar_wave_.empty()) {
+		memcpy(d.staged_records, radar_wave_.data(), radar_wave_.size() * sizeof(Record));
+	}
+	if (!laser_wave_.empty()) {
+		memcpy(d.staged_records + radar_wave_.size(), laser_wave_.data(), laser_wave_.size() * sizeof(Record));
+	}
+
+	// the tracks of a wave are distinct, so its chunks may run side by side
+	const lane::Model<Scalar> model = lane::ModelOf<Scalar>(*this);
+	for (size_t first = 0, chunk = 0; first < count; first += kChunk, chunk++) {
+		const size_t n = std::min(count - first, (size_t) kChunk);
+		cudaStream_t stream = d.streams[chunk % 2];
+		Check(cudaMemcpyAsync(d.records + first, d.staged_records + first, n * sizeof(Record),
+		                      cudaMemcpyHostToDevice, stream), "copying a wave");
+		const int blocks = (int) ((n + kThreads - 1) / kThreads);
+		ProcessWave<Scalar><<<blocks, kThreads, 0, stream>>>(model, use_laser_, use_radar_, d.records + first, (int) n,
+		                                                     d.x, d.P, d.capacity, d.results + first);
+		Check(cudaGetLastError(), "launching a wave");
+		Check(cudaMemcpyAsync(d.staged_results + first, d.results + first, n * sizeof(Result),
+		                      cudaMemcpyDeviceToHost, stream), "copying results");
+	}
+	for (int i = 0; i < 2; i++) {
+		Check(cudaStreamSynchronize(d.streams[i]), "running a wave");
+	}
+
+	for (size_t j = 0; j < count; j++) {
+		const Record &r = d.staged_records[j];
+		const Result &result = d.staged_results[j];
+		for (int k = 0; k < n_x_; k++) {
+			x_[k][r.track] = result.x[k];
+		}
+		(r.radar ? NIS_radar_ : NIS_laser_)[r.track] = result.nis;
+	}
+	radar_wave_.clear();
+	laser_wave_.clear();
+}
+
+template class CudaUKFBatch<double>;
+template class CudaUKFBatch<float>;
@@ -0,0 +1,156 @@
+#ifndef UKF_BATCH_CUDA_H_
+#define UKF_BATCH_CUDA_H_
+
+#include "measurement_package.h"
+#include "ukf_batch_lane.h"
+#include "Eigen/Dense"
+#include <cstddef>
+#include <vector>
+
+/**
+ * The CTRV unscented Kalman filter of UKFBatch on a CUDA device, for more
+ * tracks than the CPU keeps up with; built with `cmake -DUKF_CUDA=ON ..`.
+ *
+ * The states and covariances stay on the device in the structure-of-arrays
+ * layout of UKFBatch, one entry of every component per track. Every call
+ * of ProcessMeasurements splits its measurements into waves of at most one
+ * per track and runs each wave in one kernel, a device thread predicting
+ * and updating one track with the equations of ukf_batch_lane.h that the
+ * CPU batch also uses. The measurements of a wave are staged in pinned host
+ * memory, radar before laser so that a warp mostly runs one update, and go
+ * over in chunks on two streams, so that one chunk is copied while the one
+ * before it runs. The states and NIS come back the same way into the host
+ * copies below; covariances are read on demand.
+ *
+ * The interface is that of UKFBatch, so the replay tools take either. A
+ * CUDA error is fatal: it is reported and the process aborts.
+ */
+template <class Scalar>
+class CudaUKFBatch {
+public:
+  static const int n_x_ = 5;
+  static const int n_aug_ = 7;
+  static const int n_sig_ = 2 * n_aug_ + 1;
+
+  ///* device threads per block, and measurements per chunk of a wave
+  static const int kThreads = 128;
+  static const int kChunk = 32768;
+
+  ///* if this is false, laser measurements will be ignored (except for init)
+  bool use_laser_;
+
+  ///* if this is false, radar measurements will be ignored (except for init)
+  bool use_radar_;
+
+  ///* Process noise standard deviation longitudinal acceleration in m/s^2
+  double std_a_;
+
+  ///* Process noise standard deviation yaw acceleration in rad/s^2
+  double std_yawdd_;
+
+  ///* Laser measurement noise standard deviations in m
+  double std_laspx_;
+  double std_laspy_;
+
+  ///* Radar measurement noise standard deviations (m, rad, m/s)
+  double std_radr_;
+  double std_radphi_;
+  double std_radrd_;
+
+  ///* Sigma point spreading parameter
+  Scalar lambda_;
+
+  ///* Weights of sigma points
+  Scalar weights_[n_sig_];
+
+  ///* time when the state of each track is true, in us
+  std::vector<long long> time_us_;
+
+  ///* per-track initialization flag
+  std::vector<unsigned char> is_initialized_;
+
+  ///* the latest NIS of each track for radar and laser
+  std::vector<Scalar> NIS_radar_;
+  std::vector<Scalar> NIS_laser_;
+
+  /**
+   * Constructor
+   * @param capacity Number of tracks to reserve device storage for
+   */
+  explicit CudaUKFBatch(size_t capacity = 0);
+
+  virtual ~CudaUKFBatch();
+
+  /**
+   * Whether the process sees a CUDA device to run on.
+   */
+  static bool Available();
+
+  /**
+   * Adds an uninitialized track and returns its index.
+   */
+  size_t AddTrack();
+
+  /**
+   * Number of tracks in the batch.
+   */
+  size_t size() const { return time_us_.size(); }
+
+  /**
+   * Predicts and updates the addressed tracks with one measurement each,
+   * in the given order where a track appears several times, and waits for
+   * the device to finish.
+   * @param tracks Track index of every measurement
+   * @param measurements The measurements, count entries
+   */
+  void ProcessMeasurements(const size_t *tracks,
+                           const MeasurementPackage *measurements,
+                           size_t count);
+
+  /**
+   * The state of one track, from the host copy, and its covariance, read
+   * from the device; in double whatever the precision of the batch.
+   */
+  Eigen::Matrix<double, n_x_, 1> State(size_t track) const;
+  Eigen::Matrix<double, n_x_, n_x_> Covariance(size_t track) const;
+
+  ///* one measurement of a wave as the device reads it
+  struct Record {
+    double z[3];
+    Scalar dt;
+    unsigned int track;
+    unsigned char radar;
+    unsigned char initialize;
+  };
+
+  ///* what a wave's kernel gives back of each of its measurements
+  struct Result {
+    Scalar x[n_x_];
+    Scalar nis;
+  };
+
+private:
+  struct Device;
+  Device *device_;
+
+  ///* host copy of the states, component k of track i is x_[k][i]
+  std::vector<Scalar> x_[n_x_];
+
+  ///* the measurements of the current wave by sensor, and the wave number
+  ///* in which each track was last scheduled
+  std::vector<Record> radar_wave_;
+  std::vector<Record> laser_wave_;
+  std::vector<unsigned long> wave_of_;
+  unsigned long wave_;
+
+  void Reserve(size_t capacity);
+  void RunWave();
+
+  CudaUKFBatch(const CudaUKFBatch &);
+  CudaUKFBatch &operator=(const CudaUKFBatch &);
+};
+
+typedef CudaUKFBatch<double> DoubleCudaUKFBatch;
+typedef CudaUKFBatch<float> FloatCudaUKFBatch;
+
+#endif /* UKF_BATCH_CUDA_H_ */
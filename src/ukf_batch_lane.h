@@ -0,0 +1,387 @@
+#ifndef UKF_BATCH_LANE_H_
+#define UKF_BATCH_LANE_H_
+
+#include "angle.h"
+#include <cmath>
+#include <cstddef>
+
+/**
+ * The CTRV filter equations of one track of a batch, shared by the block
+ * kernels of UKFBatch and by the CUDA engine (ukf_batch_cuda.h), which runs
+ * one track per device thread. A track's values are strided: component k of
+ * x is x[k * stride], entry (r, c) of P is P[Packed(r, c) * stride], and
+ * component k of sigma point s is Xsig[(k * n_sig + s) * sig_stride], so the
+ * same code reads a lane of a block, a track of the device arrays or a
+ * thread's local sigma points. The equations are those of UKF<5, 7>.
+ *
+ * P is symmetric and kept packed, its upper triangle alone: 15 values of a
+ * track rather than 25, which is 40% less to move to and from memory in
+ * every step, the bound of a batch of many tracks. The updates compute each
+ * entry once, as the lower triangle was computed when the whole of P was
+ * kept, so the factor of the next prediction reads the same values.
+ */
+namespace lane {
+
+const int n_x = 5;
+const int n_aug = 7;
+const int n_sig = 2 * n_aug + 1;
+
+///* values of a packed covariance: its upper triangle, row by row
+const int n_p = n_x * (n_x + 1) / 2;
+
+/**
+ * The index of entry (r, c) of a packed covariance, of either triangle.
+ */
+UKF_HOST_DEVICE inline int Packed(int r, int c) {
+  return r <= c ? r * n_x - r * (r - 1) / 2 + c - r : c * n_x - c * (c - 1) / 2 + r - c;
+}
+
+/**
+ * The noise and sigma point parameters of a batch, in its precision.
+ */
+template <class Scalar>
+struct Model {
+  Scalar lambda;
+  Scalar weights[n_sig];
+  ///* process noise standard deviations
+  Scalar std_a;
+  Scalar std_yawdd;
+  ///* measurement noise variances of p_x, p_y and of rho, phi, rho_dot
+  Scalar R_laser[2];
+  Scalar R_radar[3];
+};
+
+/**
+ * The Model of a batch with the parameters of UKFBatch: lambda_, weights_,
+ * std_a_, std_yawdd_ and the laser and radar standard deviations.
+ */
+template <class Scalar, class Batch>
+Model<Scalar> ModelOf(const Batch &f) {
+  Model<Scalar> m;
+  m.lambda = f.lambda_;
+  for (int s = 0; s < n_sig; s++) {
+    m.weights[s] = f.weights_[s];
+  }
+  m.std_a = Scalar(f.std_a_);
+  m.std_yawdd = Scalar(f.std_yawdd_);
+  m.R_laser[0] = Scalar(f.std_laspx_*f.std_laspx_);
+  m.R_laser[1] = Scalar(f.std_laspy_*f.std_laspy_);
+  m.R_radar[0] = Scalar(f.std_radr_*f.std_radr_);
+  m.R_radar[1] = Scalar(f.std_radphi_*f.std_radphi_);
+  m.R_radar[2] = Scalar(f.std_radrd_*f.std_radrd_);
+  return m;
+}
+
+/**
+ * Same initialization as the first call of UKF::ProcessMeasurement, from
+ * the raw measurement z of a radar or a laser.
+ */
+template <class Scalar>
+UKF_HOST_DEVICE inline void Initialize(const Model<Scalar> &m, bool radar, const double *z,
+                                       Scalar *x, Scalar *P, size_t stride) {
+  const double x0[n_x] = {0.0, 0.0, 3.0, 0.0, 0.1};
+  for (int k = 0; k < n_x; k++) {
+    x[k * stride] = Scalar(x0[k]);
+  }
+  for (int e = 0; e < n_p; e++) {
+    P[e * stride] = 0;
+  }
+  P[Packed(2, 2) * stride] = Scalar(1.0*1.0);
+  P[Packed(3, 3) * stride] = Scalar(M_PI*M_PI / 64.0);
+  P[Packed(4, 4) * stride] = Scalar(M_PI*M_PI / 640.0);
+
+  if (radar) {
+    float rho = z[1];
+    x[0] = Scalar(z[0] * cos(rho));
+    x[stride] = Scalar(z[0] * sin(rho));
+    P[0] = m.R_radar[0] * Scalar(0.5);
+    P[Packed(1, 1) * stride] = m.R_radar[0] * Scalar(0.5);
+  }
+  else {
+    x[0] = Scalar(z[0]);
+    x[stride] = Scalar(z[1]);
+    P[0] = m.R_laser[0];
+    P[Packed(1, 1) * stride] = m.R_laser[1];
+  }
+}
+
+/**
+ * The radar measurement rho, phi, rho_dot of a state.
+ */
+template <class Scalar>
+UKF_HOST_DEVICE inline void RadarMeasurement(Scalar p_x, Scalar p_y, Scalar v, Scalar yaw,
+                                             Scalar *rho_out, Scalar *phi_out, Scalar *rho_dot_out) {
+  Scalar rho = std::sqrt(p_x*p_x + p_y*p_y);
+  Scalar phi;
+  //Avoid too small numbers
+  if (rho < Scalar(0.001)) {
+    rho = Scalar(0.001);
+    phi = 0;
+  }
+  else {
+    phi = std::atan2(p_y, p_x);
+  }
+  *rho_out = rho;
+  *phi_out = phi;
+  *rho_dot_out = (p_x*std::cos(yaw)*v + p_y*std::sin(yaw)*v) / rho;
+}
+
+/**
+ * Radar update with the raw measurement z, from the predicted sigma points
+ * Xsig of the state and their measurements Zsig (component r of point s
+ * at (r * n_sig + s) * sig_stride): predicted measurement, innovation
+ * covariance, cross covariance and gain. Returns the NIS.
+ */
+template <class Scalar>
+UKF_HOST_DEVICE inline Scalar UpdateRadar(const Model<Scalar> &m, const double *z, Scalar *x, Scalar *P,
+                                          size_t stride, const Scalar *Xsig, const Scalar *Zsig,
+                                          size_t sig_stride) {
+  Scalar z_pred[3] = {0, 0, 0};
+  for (int s = 0; s < n_sig; s++) {
+    for (int r = 0; r < 3; r++) {
+      z_pred[r] += m.weights[s] * Zsig[(r * n_sig + s) * sig_stride];
+    }
+  }
+
+  Scalar S[3][3] = {{0}};
+  Scalar Tc[n_x][3] = {{0}};
+  for (int s = 0; s < n_sig; s++) {
+    Scalar dz[3], dx[n_x];
+    for (int r = 0; r < 3; r++) {
+      dz[r] = Zsig[(r * n_sig + s) * sig_stride] - z_pred[r];
+    }
+    dz[1] = NormalizeAngle(dz[1]);
+    for (int k = 0; k < n_x; k++) {
+      dx[k] = Xsig[(k * n_sig + s) * sig_stride] - x[k * stride];
+    }
+    dx[3] = NormalizeAngle(dx[3]);
+
+    const Scalar w = m.weights[s];
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        S[r][c] += w * dz[r] * dz[c];
+      }
+      for (int k = 0; k < n_x; k++) {
+        Tc[k][r] += w * dx[k] * dz[r];
+      }
+    }
+  }
+  S[0][0] += m.R_radar[0];
+  S[1][1] += m.R_radar[1];
+  S[2][2] += m.R_radar[2];
+
+  // closed-form inverse of the symmetric 3x3 innovation covariance
+  Scalar Si[3][3];
+  Si[0][0] = S[1][1]*S[2][2] - S[1][2]*S[2][1];
+  Si[0][1] = S[0][2]*S[2][1] - S[0][1]*S[2][2];
+  Si[0][2] = S[0][1]*S[1][2] - S[0][2]*S[1][1];
+  Si[1][1] = S[0][0]*S[2][2] - S[0][2]*S[2][0];
+  Si[1][2] = S[0][2]*S[1][0] - S[0][0]*S[1][2];
+  Si[2][2] = S[0][0]*S[1][1] - S[0][1]*S[1][0];
+  const Scalar inv_det = Scalar(1) / (S[0][0]*Si[0][0] + S[0][1]*(S[1][2]*S[2][0] - S[1][0]*S[2][2]) + S[0][2]*(S[1][0]*S[2][1] - S[1][1]*S[2][0]));
+  Si[0][0] *= inv_det; Si[0][1] *= inv_det; Si[0][2] *= inv_det;
+  Si[1][1] *= inv_det; Si[1][2] *= inv_det; Si[2][2] *= inv_det;
+  Si[1][0] = Si[0][1]; Si[2][0] = Si[0][2]; Si[2][1] = Si[1][2];
+
+  Scalar K[n_x][3];
+  for (int k = 0; k < n_x; k++) {
+    for (int c = 0; c < 3; c++) {
+      K[k][c] = Tc[k][0]*Si[0][c] + Tc[k][1]*Si[1][c] + Tc[k][2]*Si[2][c];
+    }
+  }
+
+  //residual
+  Scalar y[3];
+  for (int r = 0; r < 3; r++) {
+    y[r] = Scalar(z[r]) - z_pred[r];
+  }
+  y[1] = NormalizeAngle(y[1]);
+
+  // Update state mean and covariance matrix, P -= Tc K^T
+  for (int k = 0; k < n_x; k++) {
+    x[k * stride] += K[k][0]*y[0] + K[k][1]*y[1] + K[k][2]*y[2];
+    for (int c = k; c < n_x; c++) {
+      P[Packed(k, c) * stride] -= Tc[c][0]*K[k][0] + Tc[c][1]*K[k][1] + Tc[c][2]*K[k][2];
+    }
+  }
+
+  Scalar nis = 0;
+  for (int r = 0; r < 3; r++) {
+    nis += y[r] * (Si[r][0]*y[0] + Si[r][1]*y[1] + Si[r][2]*y[2]);
+  }
+  return nis;
+}
+
+/**
+ * Linear lidar update with the raw measurement z; H selects p_x and p_y.
+ * Returns the NIS.
+ */
+template <class Scalar>
+UKF_HOST_DEVICE inline Scalar UpdateLidar(const Model<Scalar> &m, const double *z, Scalar *x, Scalar *P,
+                                          size_t stride) {
+  const Scalar s00 = P[0] + m.R_laser[0];
+  const Scalar s01 = P[stride];
+  const Scalar s11 = P[Packed(1, 1) * stride] + m.R_laser[1];
+  const Scalar inv_det = Scalar(1) / (s00*s11 - s01*s01);
+  const Scalar si00 = s11 * inv_det;
+  const Scalar si01 = -s01 * inv_det;
+  const Scalar si11 = s00 * inv_det;
+
+  const Scalar y0 = Scalar(z[0]) - x[0];
+  const Scalar y1 = Scalar(z[1]) - x[stride];
+
+  // K = P H^T Si, where P H^T is the first two columns of P
+  Scalar K[n_x][2];
+  for (int k = 0; k < n_x; k++) {
+    const Scalar ph0 = P[Packed(k, 0) * stride];
+    const Scalar ph1 = P[Packed(k, 1) * stride];
+    K[k][0] = ph0*si00 + ph1*si01;
+    K[k][1] = ph0*si01 + ph1*si11;
+  }
+
+  // P -= K H P, where H P is the first two rows of P
+  Scalar HP[2][n_x];
+  for (int c = 0; c < n_x; c++) {
+    HP[0][c] = P[c * stride];
+    HP[1][c] = P[Packed(1, c) * stride];
+  }
+  for (int k = 0; k < n_x; k++) {
+    x[k * stride] += K[k][0]*y0 + K[k][1]*y1;
+    for (int c = k; c < n_x; c++) {
+      P[Packed(k, c) * stride] -= K[c][0]*HP[0][k] + K[c][1]*HP[1][k];
+    }
+  }
+
+  return y0*(si00*y0 + si01*y1) + y1*(si01*y0 + si11*y1);
+}
+
+/*
+ * The prediction of one track, which the block kernels of UKFBatch run
+ * across lanes instead (FactorCovariances, PropagateCTRV and
+ * PredictMoments); the CUDA engine runs these, one track per thread.
+ */
+
+/**
+ * Lower Cholesky factor L, row major, of the packed covariance P.
+ */
+template <class Scalar>
+UKF_HOST_DEVICE inline void Factor(const Scalar *P, size_t stride, Scalar *L) {
+  for (int c = 0; c < n_x; c++) {
+    Scalar d = P[Packed(c, c) * stride];
+    for (int k = 0; k < c; k++) {
+      d -= L[c * n_x + k] * L[c * n_x + k];
+    }
+    d = std::sqrt(d);
+    L[c * n_x + c] = d;
+    for (int r = c + 1; r < n_x; r++) {
+      Scalar e = P[Packed(c, r) * stride];
+      for (int k = 0; k < c; k++) {
+        e -= L[r * n_x + k] * L[c * n_x + k];
+      }
+      L[r * n_x + c] = e / d;
+      L[c * n_x + r] = 0;
+    }
+  }
+}
+
+/**
+ * The CTRV model of PropagateCTRV (ctrv_kernel.h) for one augmented point:
+ * the turn over dt follows by angle addition, with cos(w) - 1 taken as
+ * -2 sin^2(w / 2) so that a slow turn does not cancel.
+ */
+template <class Scalar>
+UKF_HOST_DEVICE inline void PropagatePoint(const Scalar *in, Scalar *out, Scalar dt) {
+  const Scalar p_x = in[0], p_y = in[1], v = in[2], yaw = in[3], yawd = in[4];
+  const Scalar nu_a = in[5], nu_yawdd = in[6];
+
+  const Scalar w = yawd * dt;
+  const Scalar yaw_p = yaw + w;
+  const Scalar sin_yaw = std::sin(yaw), cos_yaw = std::cos(yaw);
+
+  Scalar dx, dy;
+  if (std::abs(yawd) > Scalar(0.001)) {
+    const Scalar sin_half = std::sin(Scalar(0.5) * w);
+    const Scalar sin_w = std::sin(w), cos_w_m1 = Scalar(-2) * sin_half * sin_half;
+    const Scalar v_yawd = v / yawd;
+    dx = v_yawd * (sin_yaw * cos_w_m1 + cos_yaw * sin_w);
+    dy = -v_yawd * (cos_yaw * cos_w_m1 - sin_yaw * sin_w);
+  }
+  else {
+    dx = v * dt * cos_yaw;
+    dy = v * dt * sin_yaw;
+  }
+
+  //add noise
+  const Scalar half_dt2 = Scalar(0.5) * dt * dt;
+  const Scalar a_dt2 = nu_a * half_dt2;
+  out[0] = p_x + dx + a_dt2 * cos_yaw;
+  out[1] = p_y + dy + a_dt2 * sin_yaw;
+  out[2] = v + nu_a * dt;
+  out[3] = yaw_p + nu_yawdd * half_dt2;
+  out[4] = yawd + nu_yawdd * dt;
+}
+
+/**
+ * Predicts a track over dt: the augmented sigma points from the factor of
+ * P, propagated into Xsig (sig_stride 1, n_x * n_sig values), and the
+ * predicted mean and covariance written over x and P.
+ */
+template <class Scalar>
+UKF_HOST_DEVICE inline void Predict(const Model<Scalar> &m, Scalar *x, Scalar *P, size_t stride,
+                                    Scalar dt, Scalar *Xsig) {
+  Scalar L[n_x * n_x];
+  Factor(P, stride, L);
+
+  const Scalar spread = std::sqrt(m.lambda + n_aug);
+  for (int s = 0; s < n_sig; s++) {
+    // column and sign of the factor this sigma point is offset by
+    const int col = s == 0 ? -1 : (s - 1) % n_aug;
+    const Scalar sign = s <= n_aug ? spread : -spread;
+    Scalar aug[n_aug], out[n_x];
+    for (int k = 0; k < n_x; k++) {
+      aug[k] = x[k * stride];
+      if (col >= 0 && col < n_x) {
+        aug[k] += sign * L[k * n_x + col];
+      }
+    }
+    aug[n_x] = col == n_x ? sign * m.std_a : Scalar(0);
+    aug[n_x + 1] = col == n_x + 1 ? sign * m.std_yawdd : Scalar(0);
+    PropagatePoint(aug, out, dt);
+    for (int k = 0; k < n_x; k++) {
+      Xsig[k * n_sig + s] = out[k];
+    }
+  }
+
+  Scalar mean[n_x];
+  for (int k = 0; k < n_x; k++) {
+    Scalar sum = 0;
+    for (int s = 0; s < n_sig; s++) {
+      sum += m.weights[s] * Xsig[k * n_sig + s];
+    }
+    mean[k] = sum;
+    x[k * stride] = sum;
+  }
+
+  Scalar cov[n_p] = {0};
+  for (int s = 0; s < n_sig; s++) {
+    const Scalar w = m.weights[s];
+    Scalar d[n_x];
+    for (int k = 0; k < n_x; k++) {
+      d[k] = Xsig[k * n_sig + s] - mean[k];
+    }
+    //angle normalization
+    d[3] = NormalizeAngle(d[3]);
+    for (int r = 0, e = 0; r < n_x; r++) {
+      for (int c = r; c < n_x; c++, e++) {
+        cov[e] += w * d[r] * d[c];
+      }
+    }
+  }
+  for (int e = 0; e < n_p; e++) {
+    P[e * stride] = cov[e];
+  }
+}
+
+}
+
+#endif /* UKF_BATCH_LANE_H_ */
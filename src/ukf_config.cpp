@@ -0,0 +1,44 @@
+#include "ukf_config.h"
+
+namespace {
+
+Eigen::Matrix2d Diagonal(double a, double b) {
+	Eigen::Matrix2d m;
+	m << a*a, 0.0,
+	     0.0, b*b;
+	return m;
+}
+
+Eigen::Matrix3d Diagonal(double a, double b, double c) {
+	Eigen::Matrix3d m;
+	m << a*a, 0.0, 0.0,
+	     0.0, b*b, 0.0,
+	     0.0, 0.0, c*c;
+	return m;
+}
+
+}
+
+/**
+* The simulator's sensors: process noise standard deviations of 1 m/s^2 and
+* 1 rad/s^2, lidar 0.15 m, radar 0.3 m, 0.03 rad and 0.3 m/s
+*/
+UKFConfig::UKFConfig() : UKFConfig(1.0, 1.0, 0.15, 0.15, 0.3, 0.03, 0.3) {}
+
+UKFConfig::UKFConfig(double std_a, double std_yawdd, double std_laspx, double std_laspy,
+                     double std_radr, double std_radphi, double std_radrd,
+                     bool use_laser, bool use_radar,
+                     double gate_laser, double gate_radar, double linearize_radar)
+	: use_laser_(use_laser), use_radar_(use_radar),
+	  std_a_(std_a), std_yawdd_(std_yawdd),
+	  std_laspx_(std_laspx), std_laspy_(std_laspy),
+	  std_radr_(std_radr), std_radphi_(std_radphi), std_radrd_(std_radrd),
+	  Q_(Diagonal(std_a, std_yawdd)),
+	  R_laser_(Diagonal(std_laspx, std_laspy)),
+	  R_radar_(Diagonal(std_radr, std_radphi, std_radrd)),
+	  gate_laser_(gate_laser), gate_radar_(gate_radar), linearize_radar_(linearize_radar) {}
+
+const UKFConfig &UKFConfig::Default() {
+	static const UKFConfig config;
+	return config;
+}
@@ -0,0 +1,83 @@
+#ifndef UKF_CONFIG_H_
+#define UKF_CONFIG_H_
+
+#include "Eigen/Dense"
+
+/**
+ * The sensor profile of a CTRV filter: the sensors it uses, the noise it
+ * assumes and everything the filter derives from them, computed once here
+ * rather than in every filter and step. Immutable; filters read it by
+ * reference, so every filter with the same profile shares one copy, which
+ * must outlive them; the server retunes its filters by publishing new ones
+ * (see config_registry.h).
+ */
+class UKFConfig {
+public:
+  ///* if this is false, laser measurements will be ignored (except for init)
+  const bool use_laser_;
+
+  ///* if this is false, radar measurements will be ignored (except for init)
+  const bool use_radar_;
+
+  ///* Process noise standard deviation longitudinal acceleration in m/s^2
+  const double std_a_;
+
+  ///* Process noise standard deviation yaw acceleration in rad/s^2
+  const double std_yawdd_;
+
+  ///* Laser measurement noise standard deviation position1 in m
+  const double std_laspx_;
+
+  ///* Laser measurement noise standard deviation position2 in m
+  const double std_laspy_;
+
+  ///* Radar measurement noise standard deviation radius in m
+  const double std_radr_;
+
+  ///* Radar measurement noise standard deviation angle in rad
+  const double std_radphi_;
+
+  ///* Radar measurement noise standard deviation radius change in m/s
+  const double std_radrd_;
+
+  ///* process noise covariance, the lower right block of the augmented one
+  const Eigen::Matrix2d Q_;
+
+  ///* laser and radar measurement noise covariance
+  const Eigen::Matrix2d R_laser_;
+  const Eigen::Matrix3d R_radar_;
+
+  ///* NIS above which a laser or radar measurement is rejected as clutter
+  ///* before it updates the filter, a chi-square quantile of 2 or 3 degrees
+  ///* of freedom (9.21 and 11.34 keep 99% of true measurements); 0 accepts
+  ///* every measurement
+  const double gate_laser_;
+  const double gate_radar_;
+
+  ///* how far the radar model may bend over the spread of the state for
+  ///* the radar update to be linearized around the mean, as by an EKF,
+  ///* instead of projecting the sigma points: the larger of the position
+  ///* standard deviation over the range and the yaw standard deviation in
+  ///* rad. 0 always runs the unscented update
+  const double linearize_radar_;
+
+  /**
+   * The profile of the simulator's sensors
+   */
+  UKFConfig();
+
+  UKFConfig(double std_a, double std_yawdd, double std_laspx, double std_laspy,
+            double std_radr, double std_radphi, double std_radrd,
+            bool use_laser = true, bool use_radar = true,
+            double gate_laser = 0.0, double gate_radar = 0.0, double linearize_radar = 0.0);
+
+  ///* that profile, shared by the filters constructed without one
+  static const UKFConfig &Default();
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  UKFConfig &operator=(const UKFConfig &);
+};
+
+#endif /* UKF_CONFIG_H_ */
@@ -0,0 +1,239 @@
+#ifndef UNSCENTED_TRANSFORM_H_
+#define UNSCENTED_TRANSFORM_H_
+
+#include "angle.h"
+#include "ctrv_kernel.h"
+#include "Eigen/Dense"
+#include <cmath>
+
+/**
+ * The unscented transform of the filters, generic over compile-time model
+ * policies, so that a new process model or sensor reuses the same
+ * fixed-size, allocation-free loops.
+ *
+ * A process model policy provides
+ *   n_x_, n_noise_   state and process noise dimensions
+ *   angle_           the state component that is an angle, or -1
+ *   Propagate(in, out, n, delta_t)
+ *                    n augmented sigma points, component-wise as the
+ *                    kernels of ctrv_kernel.h read and write them
+ *   NoiseEffect(x, nu, delta_t, dx)
+ *                    the change dx the noise nu alone makes to the state x
+ *                    propagated by delta_t, which must be linear in nu
+ *
+ * A measurement model policy provides
+ *   n_z_             measurement dimension
+ *   angle_           the measurement component that is an angle, or -1
+ *   Project(x, z)    the measurement z of one state x, both indexable with
+ *                    operator(), so that any Eigen vector, block or strided
+ *                    map serves
+ */
+
+///* the CTRV model of UKF, on (p_x, p_y, v, yaw, yawd)
+struct CTRVProcessModel {
+  static const int n_x_ = 5;
+  static const int n_noise_ = 2;
+  static const int angle_ = 3;
+
+  static void Propagate(const double *const in[n_x_ + n_noise_], double *const out[n_x_],
+                        int n, double delta_t) {
+    PropagateCTRV(in, out, n, delta_t);
+  }
+
+  ///* the noise terms PropagateCTRV adds to the noise-free prediction
+  static void NoiseEffect(const double *x, const double *nu, double delta_t, double *dx) {
+    const double half_dt2 = 0.5 * delta_t * delta_t;
+    dx[0] = half_dt2 * cos(x[3]) * nu[0];
+    dx[1] = half_dt2 * sin(x[3]) * nu[0];
+    dx[2] = delta_t * nu[0];
+    dx[3] = half_dt2 * nu[1];
+    dx[4] = delta_t * nu[1];
+  }
+};
+
+///* range, bearing and range rate of the radar, from p_x, p_y, v and yaw
+struct RadarMeasurementModel {
+  static const int n_z_ = 3;
+  static const int angle_ = 1;
+
+  template <class State, class Measurement>
+  static void Project(const State &x, Measurement &&z) {
+    const double p_x = x(0);
+    const double p_y = x(1);
+    const double v = x(2);
+    const double yaw = x(3);
+
+    double rho = sqrt(p_x*p_x + p_y*p_y);
+    double phi;
+    //Avoid too small numbers
+    if (rho < 0.001) {
+      rho = 0.001;
+      phi = 0.0;
+    }
+    else {
+      phi = atan2(p_y, p_x);
+    }
+    z(0) = rho;
+    z(1) = phi;
+    z(2) = (p_x*cos(yaw)*v + p_y*sin(yaw)*v) / rho;
+  }
+};
+
+/**
+ * Propagates the augmented sigma points Xsig_aug (one column per point)
+ * by delta_t through Process into Xsig_pred. Xsig_aug_t and Xsig_pred_t
+ * are scratch for the component-wise layout of Propagate.
+ */
+template <class Process, int NPOINTS>
+void PropagateSigmaPoints(const Eigen::Matrix<double, Process::n_x_ + Process::n_noise_, NPOINTS> &Xsig_aug,
+                          double delta_t,
+                          Eigen::Matrix<double, NPOINTS, Process::n_x_ + Process::n_noise_> &Xsig_aug_t,
+                          Eigen::Matrix<double, NPOINTS, Process::n_x_> &Xsig_pred_t,
+                          Eigen::Matrix<double, Process::n_x_, NPOINTS> &Xsig_pred) {
+  const int n_aug = Process::n_x_ + Process::n_noise_;
+  Xsig_aug_t = Xsig_aug.transpose();
+  const double *in[n_aug];
+  double *out[Process::n_x_];
+  for (int k = 0; k < n_aug; k++) {
+    in[k] = &Xsig_aug_t(0, k);
+  }
+  for (int k = 0; k < Process::n_x_; k++) {
+    out[k] = &Xsig_pred_t(0, k);
+  }
+  Process::Propagate(in, out, NPOINTS, delta_t);
+  Xsig_pred = Xsig_pred_t.transpose();
+}
+
+/**
+ * PropagateSigmaPoints for the scaled symmetric points drawn from a
+ * block-diagonal augmented covariance (ScaledSigmaPoints in
+ * sigma_points.h): point 0 is the mean, points 1 + i and 1 + i + n_aug lie
+ * at +- column i of its factor, and a column i >= n_x_ of the noise block
+ * only moves noise component i - n_x_. Only the 2 n_x_ + 1 points that move
+ * the state go through Process::Propagate; each noise-only point is the
+ * propagated mean plus or minus a Process::NoiseEffect, in closed form.
+ * Xsig_aug_t and Xsig_pred_t are scratch for the state points.
+ */
+template <class Process, int NSTATE, int NPOINTS>
+void PropagateBlockSigmaPoints(const Eigen::Matrix<double, Process::n_x_ + Process::n_noise_, NPOINTS> &Xsig_aug,
+                               double delta_t,
+                               Eigen::Matrix<double, NSTATE, Process::n_x_ + Process::n_noise_> &Xsig_aug_t,
+                               Eigen::Matrix<double, NSTATE, Process::n_x_> &Xsig_pred_t,
+                               Eigen::Matrix<double, Process::n_x_, NPOINTS> &Xsig_pred) {
+  const int n_x = Process::n_x_;
+  const int n_aug = n_x + Process::n_noise_;
+  static_assert(NSTATE == 2 * n_x + 1 && NPOINTS == 2 * n_aug + 1, "sigma points of the augmented state expected");
+
+  //the state points, at rows 0 .. n_x and n_x + 1 .. 2 n_x
+  Xsig_aug_t.template topRows<n_x + 1>() = Xsig_aug.template leftCols<n_x + 1>().transpose();
+  Xsig_aug_t.template bottomRows<n_x>() = Xsig_aug.template middleCols<n_x>(n_aug + 1).transpose();
+  const double *in[n_aug];
+  double *out[n_x];
+  for (int k = 0; k < n_aug; k++) {
+    in[k] = &Xsig_aug_t(0, k);
+  }
+  for (int k = 0; k < n_x; k++) {
+    out[k] = &Xsig_pred_t(0, k);
+  }
+  Process::Propagate(in, out, NSTATE, delta_t);
+  Xsig_pred.template leftCols<n_x + 1>() = Xsig_pred_t.template topRows<n_x + 1>().transpose();
+  Xsig_pred.template middleCols<n_x>(n_aug + 1) = Xsig_pred_t.template bottomRows<n_x>().transpose();
+
+  Eigen::Matrix<double, Process::n_noise_, 1> nu;
+  Eigen::Matrix<double, n_x, 1> dx;
+  for (int j = 0; j < Process::n_noise_; j++) {
+    nu.setZero();
+    nu(j) = Xsig_aug(n_x + j, n_x + j + 1);
+    Process::NoiseEffect(Xsig_aug.data(), nu.data(), delta_t, dx.data());
+    Xsig_pred.col(n_x + j + 1) = Xsig_pred.col(0) + dx;
+    Xsig_pred.col(n_aug + n_x + j + 1) = Xsig_pred.col(0) - dx;
+  }
+}
+
+/**
+ * Weighted mean of the sigma points X, as one matrix-vector product. An
+ * angle component is averaged as is, which is right while the points
+ * spread over much less than a turn.
+ */
+template <int N, int NPOINTS>
+void SigmaMean(const Eigen::Matrix<double, N, NPOINTS> &X, const Eigen::Matrix<double, NPOINTS, 1> &weights,
+               Eigen::Matrix<double, N, 1> &mean) {
+  mean.noalias() = X * weights;
+}
+
+/**
+ * The deviations D of the sigma points X from mean, one column per point,
+ * with component Angle (-1 for none) normalized
+ */
+template <int Angle, int N, int NPOINTS>
+void SigmaDeviations(const Eigen::Matrix<double, N, NPOINTS> &X, const Eigen::Matrix<double, N, 1> &mean,
+                     Eigen::Matrix<double, N, NPOINTS> &D) {
+  D = X.colwise() - mean;
+  if (Angle >= 0) {
+    for (int i = 0; i < NPOINTS; i++) {
+      D(Angle, i) = NormalizeAngle(D(Angle, i));
+    }
+  }
+}
+
+/**
+ * The symmetric D W D^T for the deviations D and the diagonal weights W of
+ * WD = D W: only the lower triangle is multiplied out, then mirrored.
+ */
+template <int N, int NPOINTS>
+void SymmetricProduct(const Eigen::Matrix<double, N, NPOINTS> &WD, const Eigen::Matrix<double, N, NPOINTS> &D,
+                      Eigen::Matrix<double, N, N> &P) {
+  for (int j = 0; j < N; j++) {
+    for (int i = j; i < N; i++) {
+      P(i, j) = WD.row(i).dot(D.row(j));
+    }
+  }
+  P.template triangularView<Eigen::StrictlyUpper>() = P.transpose();
+}
+
+/**
+ * Weighted covariance of the sigma points X around mean, with component
+ * Angle (-1 for none) of the deviations normalized: D W D^T over the matrix
+ * of deviations D rather than a sum of rank-one updates.
+ */
+template <int Angle, int N, int NPOINTS>
+void SigmaCovariance(const Eigen::Matrix<double, N, NPOINTS> &X, const Eigen::Matrix<double, NPOINTS, 1> &weights,
+                     const Eigen::Matrix<double, N, 1> &mean, Eigen::Matrix<double, N, N> &P) {
+  Eigen::Matrix<double, N, NPOINTS> D;
+  SigmaDeviations<Angle>(X, mean, D);
+  const Eigen::Matrix<double, N, NPOINTS> WD = D * weights.asDiagonal();
+  SymmetricProduct(WD, D, P);
+}
+
+/**
+ * The measurement side of an update: projects the predicted sigma points
+ * Xsig around the state x through Measurement into Zsig, and computes the
+ * predicted measurement z_pred, its covariance S without the sensor noise
+ * and the cross covariance Tc with the state. The projection is one pass;
+ * the moments are then products of the normalized deviation matrices, with
+ * the weights applied once to those of the measurement: S = Dz W Dz^T (one
+ * triangle) and Tc = Dx W Dz^T.
+ */
+template <class Measurement, int StateAngle, int NX, int NPOINTS>
+void MeasurementMoments(const Eigen::Matrix<double, NX, NPOINTS> &Xsig, const Eigen::Matrix<double, NX, 1> &x,
+                        const Eigen::Matrix<double, NPOINTS, 1> &weights,
+                        Eigen::Matrix<double, Measurement::n_z_, NPOINTS> &Zsig,
+                        Eigen::Matrix<double, Measurement::n_z_, 1> &z_pred,
+                        Eigen::Matrix<double, Measurement::n_z_, Measurement::n_z_> &S,
+                        Eigen::Matrix<double, NX, Measurement::n_z_> &Tc) {
+  const int n_z = Measurement::n_z_;
+  for (int i = 0; i < NPOINTS; i++) {
+    Measurement::Project(Xsig.col(i), Zsig.col(i));
+  }
+  z_pred.noalias() = Zsig * weights;
+
+  Eigen::Matrix<double, n_z, NPOINTS> Dz;
+  Eigen::Matrix<double, NX, NPOINTS> Dx;
+  SigmaDeviations<Measurement::angle_>(Zsig, z_pred, Dz);
+  SigmaDeviations<StateAngle>(Xsig, x, Dx);
+  const Eigen::Matrix<double, n_z, NPOINTS> WDz = Dz * weights.asDiagonal();
+  SymmetricProduct(WDz, Dz, S);
+  Tc.noalias() = Dx.lazyProduct(WDz.transpose());
+}
+
+#endif /* UNSCENTED_TRANSFORM_H_ */